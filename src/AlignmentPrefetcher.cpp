@@ -0,0 +1,93 @@
+#include "AlignmentPrefetcher.h"
+#include "AlleleParser.h"
+
+AlignmentPrefetcher::AlignmentPrefetcher(AlleleParser* p, size_t m)
+    : parser(p)
+    , maxBatches(max(m, (size_t) 1))
+    , currentIndex(0)
+    , running(false)
+    , finished(false)
+    , stopping(false)
+{ }
+
+AlignmentPrefetcher::~AlignmentPrefetcher(void) {
+    stop();
+}
+
+void AlignmentPrefetcher::start(void) {
+    running = true;
+    finished = false;
+    stopping = false;
+    reader = thread(&AlignmentPrefetcher::read, this);
+}
+
+void AlignmentPrefetcher::stop(void) {
+    if (running) {
+        {
+            lock_guard<mutex> lock(batchMutex);
+            stopping = true;
+        }
+        drained.notify_all();
+        reader.join();
+        running = false;
+    }
+    batches.clear();
+    current.clear();
+    currentIndex = 0;
+    finished = false;
+    stopping = false;
+}
+
+void AlignmentPrefetcher::read(void) {
+    TargetCursor cursor;
+    bool more = true;
+    while (more) {
+        vector<PrefetchedAlignment> batch;
+        batch.reserve(ALIGNMENT_PREFETCH_BATCH_SIZE);
+        while (batch.size() < ALIGNMENT_PREFETCH_BATCH_SIZE) {
+            PrefetchedAlignment a;
+            if (!GETNEXT(parser->bamMultiReader, a.alignment)) {
+                more = false;
+                break;
+            }
+            if (parser->nearStdinTarget(a.alignment, cursor)
+                && parser->acceptAlignment(a.alignment, a.sampleName, a.sequencingTech)) {
+                batch.push_back(a);
+            }
+        }
+        {
+            unique_lock<mutex> lock(batchMutex);
+            drained.wait(lock, [&]() { return stopping || batches.size() < maxBatches; });
+            if (stopping) {
+                return;
+            }
+            if (!batch.empty()) {
+                batches.push_back(vector<PrefetchedAlignment>());
+                batches.back().swap(batch);
+            }
+            finished = !more;
+        }
+        filled.notify_one();
+    }
+}
+
+bool AlignmentPrefetcher::next(PrefetchedAlignment& a) {
+    if (currentIndex == current.size()) {
+        if (!running) {
+            start();
+        }
+        {
+            unique_lock<mutex> lock(batchMutex);
+            filled.wait(lock, [&]() { return finished || !batches.empty(); });
+            if (batches.empty()) {
+                return false;
+            }
+            current.swap(batches.front());
+            batches.pop_front();
+        }
+        drained.notify_one();
+        currentIndex = 0;
+    }
+    a = move(current[currentIndex++]);
+    return true;
+}
@@ -0,0 +1,73 @@
+#ifndef FREEBAYES_ALIGNMENTPREFETCHER_H
+#define FREEBAYES_ALIGNMENTPREFETCHER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "LeftAlign.h"
+
+// the number of alignments handed over from the prefetching thread at a time
+#define ALIGNMENT_PREFETCH_BATCH_SIZE 512
+
+using namespace std;
+
+class AlleleParser;
+
+// an alignment which has passed the read filters, with its sample
+class PrefetchedAlignment {
+public:
+    BAMALIGN alignment;
+    string sampleName;
+    string sequencingTech;
+};
+
+// reads alignments from a parser's reader on a thread of its own, applying
+// the filters which depend only on the alignment itself
+// (AlleleParser::acceptAlignment), so that reading and decoding overlap with
+// genotyping.  reading stdin with targets, it also drops the alignments far
+// from all of them (AlleleParser::nearStdinTarget), so the parser
+// fast-forwards over the gaps between sparse targets.  at most maxBatches
+// batches of alignments are held at a time.
+//
+// the reader is only used from the prefetching thread while it runs, so it
+// must be stopped before the reader is repositioned.
+class AlignmentPrefetcher {
+
+public:
+
+    AlignmentPrefetcher(AlleleParser* p, size_t maxBatches);
+    ~AlignmentPrefetcher(void);
+
+    // gets the next alignment, starting to read if we aren't already;
+    // returns false when the reader has no more alignments
+    bool next(PrefetchedAlignment& a);
+    // stops reading and discards anything read but not yet taken
+    void stop(void);
+
+private:
+
+    void start(void);
+    void read(void);
+
+    AlleleParser* parser;
+    size_t maxBatches;
+
+    deque<vector<PrefetchedAlignment> > batches;
+    vector<PrefetchedAlignment> current; // the batch being handed out
+    size_t currentIndex;
+
+    bool running;
+    bool finished; // the reader has run out of alignments
+    bool stopping;
+
+    thread reader;
+    mutex batchMutex;
+    condition_variable filled;
+    condition_variable drained;
+
+};
+
+#endif
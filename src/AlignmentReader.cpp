@@ -0,0 +1,514 @@
+#include "AlignmentReader.h"
+#include "Logging.h"
+#include "split.h"
+#include "htslib/hfile.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// the size and modification time of the file, by which the header cache
+// knows it, or false if it isn't a local file
+static bool fileStamp(const string& path, string& stamp) {
+    struct stat st;
+    if (path == "-" || stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    stringstream s;
+    s << st.st_size << "\t" << st.st_mtime;
+    stamp = s.str();
+    return true;
+}
+
+AlignmentReader::~AlignmentReader(void) {
+    for (deque<AlignmentFile>::iterator f = files.begin(); f != files.end(); ++f) {
+        closeFile(*f);
+    }
+}
+
+bool AlignmentReader::SetThreadPool(SeqLib::ThreadPool p) {
+    if (!p.IsOpen()) {
+        return false;
+    }
+    pool = p;
+    for (deque<AlignmentFile>::iterator f = files.begin(); f != files.end(); ++f) {
+        if (f->fp) {
+            hts_set_opt(f->fp, HTS_OPT_THREAD_POOL, &pool.p);
+        }
+    }
+    return true;
+}
+
+bool AlignmentReader::Open(const string& path) {
+    files.push_back(AlignmentFile());
+    AlignmentFile& file = files.back();
+    file.path = path;
+    file.cramReference = cramReference;
+    file.rank = files.size() - 1;
+    if (!openFile(file)) {
+        if (referenceHolder == &file) {
+            referenceHolder = NULL;
+        }
+        files.pop_back();
+        return false;
+    }
+    keepHeaderText(file);
+    setIdle(file);
+    return true;
+}
+
+void AlignmentReader::keepHeaderText(AlignmentFile& file) {
+    if (&file == &files.front()) {
+        firstHeader = SeqLib::BamHeader(file.header);
+        file.headerText = firstHeader.AsString();
+    } else {
+        // the sequences are those of the first file; the rest is wanted for
+        // the read groups
+        file.headerText.clear();
+        vector<string> lines = split(string(file.header->text, file.header->l_text), '\n');
+        for (vector<string>::iterator l = lines.begin(); l != lines.end(); ++l) {
+            if (l->find("@SQ") != 0) {
+                file.headerText += *l + "\n";
+            }
+        }
+    }
+}
+
+void AlignmentReader::Add(const string& path) {
+    files.push_back(AlignmentFile());
+    AlignmentFile& file = files.back();
+    file.path = path;
+    file.cramReference = cramReference;
+    file.rank = files.size() - 1;
+    added.push_back(&file);
+}
+
+bool AlignmentReader::OpenAdded(void) {
+
+    map<string, pair<string, string> > cache; // path -> stamp, header text
+    if (!headerCache.empty()) {
+        readHeaderCache(cache);
+    }
+
+    // the first file gives the sequences, so is always opened; the rest are
+    // left closed if the cache has their headers
+    vector<AlignmentFile*> toOpen;
+    bool cacheChanged = false;
+    for (vector<AlignmentFile*>::iterator f = added.begin(); f != added.end(); ++f) {
+        AlignmentFile& file = **f;
+        if (&file != &files.front() && !headerCache.empty()) {
+            map<string, pair<string, string> >::iterator c = cache.find(file.path);
+            string stamp;
+            if (c != cache.end() && fileStamp(file.path, stamp) && c->second.first == stamp) {
+                file.headerText = c->second.second;
+                continue;
+            }
+            cacheChanged = true;
+        }
+        toOpen.push_back(&file);
+    }
+    added.clear();
+
+    // in batches, so no more than a batch are open beyond the idle limit
+    for (size_t b = 0; b < toOpen.size(); b += openThreads) {
+        vector<AlignmentFile*> batch(toOpen.begin() + b, toOpen.begin() + min(b + openThreads, toOpen.size()));
+        forEachFile(batch, [this](AlignmentFile& file) {
+            if (openFile(file)) {
+                keepHeaderText(file);
+            }
+        });
+        for (vector<AlignmentFile*>::iterator f = batch.begin(); f != batch.end(); ++f) {
+            if (!(*f)->header) {
+                ERROR("Could not open input BAM file: " << (*f)->path);
+                return false;
+            }
+            setIdle(**f);
+        }
+    }
+
+    if (cacheChanged) {
+        writeHeaderCache();
+    }
+    return true;
+
+}
+
+void AlignmentReader::forEachFile(vector<AlignmentFile*>& batch, const function<void(AlignmentFile&)>& work) {
+    if (openThreads <= 1 || batch.size() <= 1) {
+        for (vector<AlignmentFile*>::iterator f = batch.begin(); f != batch.end(); ++f) {
+            work(**f);
+        }
+        return;
+    }
+    atomic<size_t> next(0);
+    vector<thread> workers;
+    for (int i = 0; i < openThreads && i < (int) batch.size(); ++i) {
+        workers.push_back(thread([&]() {
+            for (size_t f = next++; f < batch.size(); f = next++) {
+                work(*batch[f]);
+            }
+        }));
+    }
+    for (vector<thread>::iterator w = workers.begin(); w != workers.end(); ++w) {
+        w->join();
+    }
+}
+
+// the cache is a text file of the header of each file but the first of a
+// run, without its @SQ lines, under a line giving its size, modification
+// time and path:
+//
+//   >SIZE<tab>MTIME<tab>PATH
+//   @RG ...
+void AlignmentReader::readHeaderCache(map<string, pair<string, string> >& cache) {
+    ifstream in(headerCache.c_str());
+    string line;
+    pair<string, string>* entry = NULL;
+    while (getline(in, line)) {
+        if (!line.empty() && line[0] == '>') {
+            size_t size = line.find('\t');
+            size_t mtime = size == string::npos ? size : line.find('\t', size + 1);
+            if (mtime == string::npos) {
+                entry = NULL;
+                continue;
+            }
+            entry = &cache[line.substr(mtime + 1)];
+            entry->first = line.substr(1, mtime - 1);
+            entry->second.clear();
+        } else if (entry) {
+            entry->second += line + "\n";
+        }
+    }
+}
+
+void AlignmentReader::writeHeaderCache(void) {
+    // with what's there of files which aren't in this run
+    map<string, pair<string, string> > cache;
+    readHeaderCache(cache);
+    for (deque<AlignmentFile>::iterator f = files.begin() + 1; f < files.end(); ++f) {
+        string stamp;
+        if (fileStamp(f->path, stamp)) {
+            cache[f->path] = make_pair(stamp, f->headerText);
+        }
+    }
+    // written aside and moved into place, so a run started meanwhile reads
+    // either cache, not half of one.  the readers of each thread of a run
+    // may be writing it too
+    static atomic<int> writes(0);
+    stringstream tmpName;
+    tmpName << headerCache << "." << getpid() << "." << writes++ << ".tmp";
+    string tmp = tmpName.str();
+    ofstream out(tmp.c_str());
+    for (map<string, pair<string, string> >::iterator c = cache.begin(); c != cache.end(); ++c) {
+        out << ">" << c->second.first << "\t" << c->first << "\n" << c->second.second;
+    }
+    out.close();
+    if (!out || rename(tmp.c_str(), headerCache.c_str()) != 0) {
+        WARNING("could not write the header cache " << headerCache);
+        remove(tmp.c_str());
+    }
+}
+
+bool AlignmentReader::openFile(AlignmentFile& file) {
+    if (file.fp) {
+        return true;
+    }
+    file.fp = hts_open(file.path.c_str(), "r");
+    if (!file.fp) {
+        return false;
+    }
+    if (pool.IsOpen()) {
+        hts_set_opt(file.fp, HTS_OPT_THREAD_POOL, &pool.p);
+    }
+    // over a network each read costs a round trip, so a large buffer reads
+    // ahead of the blocks being decoded
+    if (remoteReadAhead > 0 && hisremote(file.path.c_str())) {
+        hts_set_opt(file.fp, HTS_OPT_BLOCK_SIZE, remoteReadAhead);
+    }
+    if (!file.cramReference.empty() && hts_set_fai_filename(file.fp, file.cramReference.c_str()) < 0) {
+        ERROR("Could not read reference genome " << file.cramReference << " for CRAM input " << file.path);
+        exit(1);
+    }
+    file.cram = hts_get_format(file.fp)->format == cram;
+    if (file.cram) {
+        lock_guard<mutex> lock(referenceMutex);
+        if (cramFields) {
+            hts_set_opt(file.fp, CRAM_OPT_REQUIRED_FIELDS, cramFields);
+            // nor the MD and NM tags, which are made up from the reference
+            hts_set_opt(file.fp, CRAM_OPT_DECODE_MD, 0);
+        }
+        // the contigs of the reference are loaded once, for all of the files
+        if (!referenceHolder) {
+            referenceHolder = &file;
+        } else if (referenceHolder != &file && referenceHolder->fp
+                   && referenceHolder->cramReference == file.cramReference) {
+            hts_set_opt(file.fp, CRAM_OPT_SHARED_REF, cram_get_refs(referenceHolder->fp));
+        }
+    }
+    file.header = sam_hdr_read(file.fp);
+    if (!file.header) {
+        hts_close(file.fp);
+        file.fp = NULL;
+        return false;
+    }
+    return true;
+}
+
+void AlignmentReader::closeFile(AlignmentFile& file) {
+    closeHandle(file);
+    if (file.idx) {
+        hts_idx_destroy(file.idx);
+        file.idx = NULL;
+    }
+}
+
+void AlignmentReader::closeHandle(AlignmentFile& file) {
+    if (file.itr) {
+        hts_itr_destroy(file.itr);
+        file.itr = NULL;
+    }
+    // the index of a CRAM file is read through its handle
+    if (file.idx && file.cram) {
+        hts_idx_destroy(file.idx);
+        file.idx = NULL;
+    }
+    if (file.header) {
+        bam_hdr_destroy(file.header);
+        file.header = NULL;
+    }
+    if (file.fp) {
+        hts_close(file.fp);
+        file.fp = NULL;
+    }
+    file.reading = false;
+}
+
+bool AlignmentReader::loadIndex(AlignmentFile& file) {
+    if (!file.idx) {
+        file.idx = sam_index_load(file.fp, file.path.c_str());
+    }
+    if (!file.idx) {
+        if (file.path != "-") {
+            ERROR("Failed to load index for " << file.path << ". Rebuild samtools index");
+        } else {
+            ERROR("Random access with SetRegion not available for STDIN reading (no index file)");
+        }
+        return false;
+    }
+    return true;
+}
+
+// false only if the index of the file, if it's loaded, has no chunks for
+// any of the intervals.  the query only looks up the bins, reading nothing
+// from the file, which may be closed
+static bool mayHaveRecords(AlignmentFile& file, int refID, const vector<pair<long int, long int> >& intervals) {
+    if (!file.idx || file.cram) {
+        return true;
+    }
+    for (vector<pair<long int, long int> >::const_iterator i = intervals.begin(); i != intervals.end(); ++i) {
+        hts_itr_t* itr = sam_itr_queryi(file.idx, refID, i->first, i->second);
+        if (!itr) {
+            return true;
+        }
+        bool chunks = itr->n_off > 0;
+        hts_itr_destroy(itr);
+        if (chunks) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool AlignmentReader::MayHaveRecords(int refID, long int start, long int end) {
+    if (streaming || refID < 0 || refID >= firstHeader.NumSequences()) {
+        return true;
+    }
+    vector<pair<long int, long int> > interval(1, make_pair(start, end));
+    for (deque<AlignmentFile>::iterator f = files.begin(); f != files.end(); ++f) {
+        if (mayHaveRecords(*f, refID, interval)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool AlignmentReader::SetRegion(const SeqLib::GenomicRegion& region) {
+    return SetRegions(region.chr, vector<pair<long int, long int> >(1, make_pair((long int) region.pos1, (long int) region.pos2)));
+}
+
+bool AlignmentReader::SetRegions(int refID, const vector<pair<long int, long int> >& intervals) {
+
+    while (!queue.empty()) {
+        queue.pop();
+    }
+    regionSet = true;
+    streaming = false;
+    // every file is opened or closed again below
+    idleOpen = 0;
+
+    if (refID < 0 || refID >= firstHeader.NumSequences()) {
+        ERROR("Failed to set region: sequence id " << refID << " is not in the header");
+        return false;
+    }
+
+    // a closed file whose index has nothing in the intervals is left closed
+    vector<AlignmentFile*> toStart;
+    for (deque<AlignmentFile>::iterator f = files.begin(); f != files.end(); ++f) {
+        if (!f->fp && !mayHaveRecords(*f, refID, intervals)) {
+            f->reading = false;
+            continue;
+        }
+        toStart.push_back(&*f);
+    }
+
+    bool success = true;
+    // in batches, so no more than a batch are open beyond the idle limit
+    for (size_t b = 0; b < toStart.size(); b += openThreads) {
+        vector<AlignmentFile*> batch(toStart.begin() + b, toStart.begin() + min(b + (size_t) openThreads, toStart.size()));
+        vector<int> started(batch.size());
+        vector<AlignmentFile*>::iterator first = batch.begin();
+        forEachFile(batch, [&](AlignmentFile& file) {
+            started[find(first, batch.end(), &file) - first] = startRegion(file, refID, intervals);
+        });
+        for (size_t f = 0; f < batch.size(); ++f) {
+            AlignmentFile& file = *batch[f];
+            if (started[f] < 0) {
+                ERROR("Could not open input BAM file: " << file.path);
+                exit(1);
+            }
+            if (file.reading) {
+                queue.push(&file);
+            } else {
+                setIdle(file);
+            }
+            if (started[f] == 0) {
+                success = false;
+            }
+        }
+    }
+
+    return success;
+
+}
+
+int AlignmentReader::startRegion(AlignmentFile& file, int refID, const vector<pair<long int, long int> >& intervals) {
+    if (file.itr) {
+        hts_itr_destroy(file.itr);
+        file.itr = NULL;
+    }
+    file.reading = false;
+    if (!openFile(file)) {
+        return -1;
+    }
+    if (!loadIndex(file)) {
+        return 0;
+    }
+    if (intervals.size() == 1) {
+        file.itr = sam_itr_queryi(file.idx, refID, intervals.front().first, intervals.front().second);
+    } else {
+        // one iterator reads the chunks of every interval in one pass,
+        // returning each alignment once however many intervals it overlaps
+        string name = file.header->target_name[refID];
+        vector<string> strings;
+        for (vector<pair<long int, long int> >::const_iterator i = intervals.begin(); i != intervals.end(); ++i) {
+            stringstream r;
+            r << "{" << name << "}:" << i->first + 1 << "-" << i->second;
+            strings.push_back(r.str());
+        }
+        vector<char*> regarray;
+        for (vector<string>::iterator s = strings.begin(); s != strings.end(); ++s) {
+            regarray.push_back(&(*s)[0]);
+        }
+        file.itr = sam_itr_regarray(file.idx, file.header, &regarray[0], regarray.size());
+    }
+    if (!file.itr) {
+        ERROR("Failed to set region on " << file.path);
+        return 0;
+    }
+    readNext(file);
+    return 1;
+}
+
+void AlignmentReader::advance(AlignmentFile& file) {
+    if (readNext(file)) {
+        queue.push(&file);
+    }
+}
+
+bool AlignmentReader::readNext(AlignmentFile& file) {
+    bam1_t* b = bam_init1();
+    int status = file.itr ? sam_itr_next(file.fp, file.itr, b) : sam_read1(file.fp, file.header, b);
+    if (status >= 0) {
+        file.next.assign(b);
+        file.reading = true;
+        return true;
+    }
+    bam_destroy1(b);
+    if (status < -1) {
+        ERROR("sam_read1 return status: " << status << " file: " << file.path);
+        exit(1);
+    }
+    // done with the region
+    file.reading = false;
+    if (file.itr) {
+        hts_itr_destroy(file.itr);
+        file.itr = NULL;
+    }
+    return false;
+}
+
+// keeps the file open if fewer than the limit of files are open without
+// alignments left to give, or closes it
+void AlignmentReader::setIdle(AlignmentFile& file) {
+    // stdin can't be opened again
+    if (idleLimit > 0 && !streaming && file.path != "-" && &file != referenceHolder
+        && idleOpen >= idleLimit) {
+        closeHandle(file);
+    } else {
+        ++idleOpen;
+    }
+}
+
+// without a region, every file is read from its start, and all stay open
+void AlignmentReader::startStreaming(void) {
+    streaming = true;
+    for (deque<AlignmentFile>::iterator f = files.begin(); f != files.end(); ++f) {
+        if (!openFile(*f)) {
+            ERROR("Could not open input BAM file: " << f->path);
+            exit(1);
+        }
+        advance(*f);
+    }
+}
+
+bool AlignmentReader::GetNextRecord(SeqLib::BamRecord& record) {
+    if (!regionSet && !streaming) {
+        startStreaming();
+    }
+    if (queue.empty()) {
+        return false;
+    }
+    AlignmentFile* file = queue.top();
+    queue.pop();
+    record = file->next;
+    file->next = SeqLib::BamRecord();
+    advance(*file);
+    if (!file->reading) {
+        setIdle(*file);
+    }
+    return true;
+}
+
+string AlignmentReader::HeaderConcat(void) const {
+    stringstream ss;
+    for (deque<AlignmentFile>::const_iterator f = files.begin(); f != files.end(); ++f) {
+        ss << f->headerText;
+    }
+    return ss.str();
+}
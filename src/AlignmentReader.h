@@ -0,0 +1,168 @@
+#ifndef FREEBAYES_ALIGNMENTREADER_H
+#define FREEBAYES_ALIGNMENTREADER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <queue>
+#include <map>
+#include <mutex>
+#include <functional>
+#include <algorithm>
+#include <stdint.h>
+#include "SeqLib/BamRecord.h"
+#include "SeqLib/BamHeader.h"
+#include "SeqLib/GenomicRegion.h"
+#include "SeqLib/ThreadPool.h"
+#include "htslib/sam.h"
+#include "htslib/cram.h"
+
+using namespace std;
+
+// one of the files of an AlignmentReader.  its handle and header are held
+// only while it's open, and its index from when it's first loaded, but for a
+// CRAM file, whose index is of its handle.  what's needed of its header
+// otherwise is kept as text.
+class AlignmentFile {
+
+public:
+
+    AlignmentFile(void)
+        : rank(0), fp(NULL), header(NULL), idx(NULL), itr(NULL)
+        , reading(false), cram(false)
+    { }
+
+    string path;
+    string cramReference;
+    int rank;             // in the order the files were opened, to break ties
+    htsFile* fp;
+    bam_hdr_t* header;
+    hts_idx_t* idx;
+    hts_itr_t* itr;       // over the region, or NULL when reading the whole file
+    SeqLib::BamRecord next;
+    bool reading;         // next is a record we have yet to return
+    bool cram;
+    string headerText;    // all of it for the first file, and without @SQ lines for the rest
+
+};
+
+// merges the alignments of any number of files, as SeqLib::BamReader does,
+// but for cohorts of thousands of files.
+//
+// the files are opened, and their indexes loaded for each region, a batch at
+// a time on a few threads, as over a network filesystem or object store it's
+// the waiting on each file which takes the time.  with a header cache, files
+// whose headers are in the cache aren't opened until a region needs them.
+//
+// the files waiting to give their next record are kept in a heap, not
+// scanned for each record.  each file's chunks for a region, or for the
+// intervals of a run of targets, are read in one pass with a multi-region
+// iterator, which is all that is made again for a new region of an open
+// file.  once a limit of files are open without alignments left in the
+// region being read, any more are closed, dropping their handles but keeping
+// their indexes, and are only opened again by a region their index has
+// chunks in.  a file with alignments in the region stays open until it's
+// read through them.
+class AlignmentReader {
+
+public:
+
+    AlignmentReader(void)
+        : idleLimit(0), idleOpen(0), cramFields(0), openThreads(1), remoteReadAhead(0), referenceHolder(NULL)
+        , regionSet(false), streaming(false)
+    { }
+    ~AlignmentReader(void);
+
+    // for the files opened after this, as SeqLib::BamReader
+    void SetCramReference(const string& ref) { cramReference = ref; }
+    bool SetThreadPool(SeqLib::ThreadPool p);
+    // the most idle files to keep open, or 0 to keep them all open
+    void SetIdleFileLimit(size_t limit) { idleLimit = limit; }
+    // the fields (SAM_QNAME etc.) which CRAM files opened after this decode,
+    // or 0 for all of them
+    void SetCramRequiredFields(int fields) { cramFields = fields; }
+    // how many files to open, or set on a region, at once
+    void SetOpenThreads(int threads) { openThreads = max(threads, 1); }
+    // the size of the reads of files given as URLs, or 0 for htslib's own
+    void SetRemoteReadAhead(int bytes) { remoteReadAhead = bytes; }
+    // a file keeping the headers of the files opened, by their sizes and
+    // modification times, from one run to the next
+    void SetHeaderCache(const string& path) { headerCache = path; }
+
+    bool Open(const string& path);
+    // adds a file to be opened by OpenAdded, with the CRAM reference set
+    void Add(const string& path);
+    // opens the files added, reporting the first which can't be
+    bool OpenAdded(void);
+
+    // 0-based and half-open
+    bool SetRegion(const SeqLib::GenomicRegion& region);
+    // the intervals of one sequence, 0-based, half-open and sorted
+    bool SetRegions(int refID, const vector<pair<long int, long int> >& intervals);
+
+    bool GetNextRecord(SeqLib::BamRecord& record);
+
+    // false only if the indexes of all of the files, as they are loaded,
+    // have no chunks for the interval (0-based, half-open), so that setting
+    // the region would read nothing; a file without its index loaded, or a
+    // CRAM file, may have records anywhere
+    bool MayHaveRecords(int refID, long int start, long int end);
+
+    // of the first file
+    SeqLib::BamHeader Header(void) const { return firstHeader; }
+    string HeaderConcat(void) const;
+
+private:
+
+    bool openFile(AlignmentFile& file);
+    void closeFile(AlignmentFile& file);
+    // as closeFile, but keeping the index, where it isn't of the handle
+    void closeHandle(AlignmentFile& file);
+    bool loadIndex(AlignmentFile& file);
+    // keeps what's wanted of the header of the file once it's open
+    void keepHeaderText(AlignmentFile& file);
+    // opens the file and starts its iterator over the intervals, reading its
+    // first record: 1 if that worked, 0 if the region couldn't be set, or -1
+    // if the file couldn't be opened
+    int startRegion(AlignmentFile& file, int refID, const vector<pair<long int, long int> >& intervals);
+    // reads the next record of the file into its slot, returning whether there is one
+    bool readNext(AlignmentFile& file);
+    // as readNext, queueing the file if there is one
+    void advance(AlignmentFile& file);
+    // runs work on each of the files, on up to openThreads threads
+    void forEachFile(vector<AlignmentFile*>& batch, const function<void(AlignmentFile&)>& work);
+    void readHeaderCache(map<string, pair<string, string> >& cache);
+    void writeHeaderCache(void);
+    void setIdle(AlignmentFile& file);
+    void startStreaming(void);
+
+    struct FileOrder {
+        bool operator()(const AlignmentFile* a, const AlignmentFile* b) const {
+            if (a->next.ChrID() != b->next.ChrID()) return a->next.ChrID() > b->next.ChrID();
+            if (a->next.Position() != b->next.Position()) return a->next.Position() > b->next.Position();
+            return a->rank > b->rank;
+        }
+    };
+
+    deque<AlignmentFile> files; // references to these remain valid as files are added
+    priority_queue<AlignmentFile*, vector<AlignmentFile*>, FileOrder> queue;
+    SeqLib::BamHeader firstHeader;
+    string cramReference;
+    SeqLib::ThreadPool pool;
+    size_t idleLimit;
+    size_t idleOpen;   // files open without a record to give
+    int cramFields;
+    int openThreads;
+    int remoteReadAhead;
+    string headerCache;
+    vector<AlignmentFile*> added; // not yet opened
+    mutex referenceMutex;
+    // the first CRAM file, which loads the reference the others share, and
+    // is kept open so that they can
+    AlignmentFile* referenceHolder;
+    bool regionSet;
+    bool streaming;    // reading the files from their starts, without an index
+
+};
+
+#endif
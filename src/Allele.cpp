@@ -52,7 +52,7 @@ const int Allele::subquality(int startpos, int len) const {
 }
 
 // quality of subsequence of allele
-const long double Allele::lnsubquality(int startpos, int len) const {
+const Probability Allele::lnsubquality(int startpos, int len) const {
     return phred2ln(subquality(startpos, len));
 }
 
@@ -126,16 +126,10 @@ const int Allele::subquality(const Allele &a) const {
     return sum * (l / L);
 }
 
-const long double Allele::lnsubquality(const Allele& a) const {
+const Probability Allele::lnsubquality(const Allele& a) const {
     return phred2ln(subquality(a));
 }
 
-void updateAllelesCachedData(vector<Allele*>& alleles) {
-    for (vector<Allele*>::iterator a = alleles.begin(); a != alleles.end(); ++a) {
-        (*a)->update();
-    }
-}
-
 /*
   const int Allele::basesLeft(void) const {
   if (type == ALLELE_REFERENCE) {
@@ -183,46 +177,35 @@ const short Allele::currentQuality(void) const {
     return 0;
 }
 
-const long double Allele::lncurrentQuality(void) const {
+const Probability Allele::lncurrentQuality(void) const {
     return phred2ln(currentQuality());
 }
 
 string Allele::typeStr(void) const {
+    return string(typeName());
+}
 
-    string t;
-
+const char* Allele::typeName(void) const {
     switch (this->type) {
         case ALLELE_GENOTYPE:
-            t = "genotype";
-            break;
+            return "genotype";
         case ALLELE_REFERENCE:
-            t = "reference";
-            break;
+            return "reference";
         case ALLELE_MNP:
-            t = "mnp";
-            break;
+            return "mnp";
         case ALLELE_SNP:
-            t = "snp";
-            break;
+            return "snp";
         case ALLELE_INSERTION:
-            t = "insertion";
-            break;
+            return "insertion";
         case ALLELE_DELETION:
-            t = "deletion";
-            break;
+            return "deletion";
         case ALLELE_COMPLEX:
-            t = "complex";
-            break;
+            return "complex";
         case ALLELE_NULL:
-            t = "null";
-            break;
+            return "null";
         default:
-            t = "unknown";
-            break;
+            return "unknown";
     }
-
-    return t;
-
 }
 
 bool Allele::isReference(void) const {
@@ -270,23 +253,23 @@ const string Allele::base(void) const { // the base of this allele
         return alternateSequence; // todo fix
         break;
     case ALLELE_REFERENCE:
-        return "R:" + convert(position) + ":" + cigar + ":" + alternateSequence;
+        return "R:" + convert(position) + ":" + cigar.str() + ":" + alternateSequence;
         break;
         */
     case ALLELE_SNP:
-        return "S:" + convert(position) + ":" + cigar + ":" + alternateSequence;
+        return "S:" + convert(position) + ":" + cigar.str() + ":" + alternateSequence;
         break;
     case ALLELE_MNP:
-        return "M:" + convert(position) + ":" + cigar + ":" + alternateSequence;
+        return "M:" + convert(position) + ":" + cigar.str() + ":" + alternateSequence;
         break;
     case ALLELE_INSERTION:
-        return "I:" + convert(position) + ":" + cigar + ":" + alternateSequence;
+        return "I:" + convert(position) + ":" + cigar.str() + ":" + alternateSequence;
         break;
     case ALLELE_DELETION:
-        return "D:" + convert(position) + ":" + cigar;
+        return "D:" + convert(position) + ":" + cigar.str();
         break;
     case ALLELE_COMPLEX:
-        return "C:" + convert(position) + ":" + cigar + ":" + alternateSequence;
+        return "C:" + convert(position) + ":" + cigar.str() + ":" + alternateSequence;
         break;
     case ALLELE_NULL:
         return "N:" + convert(position) + ":" + alternateSequence;
@@ -648,7 +631,7 @@ void homogenizeAlleles(map<string, vector<Allele*> >& alleleGroups, string& refs
         }
         string& altseq = alleles.front()->alternateSequence;
         Allele* toallele = homogenizeTo[altseq];
-        string& cigar = toallele->cigar;
+        Cigar& cigar = toallele->cigar;
         AlleleType type = toallele->type;
         long int position = toallele->position;
         for (vector<Allele*>::iterator a = alleles.begin(); a != alleles.end(); ++a) {
@@ -839,19 +822,22 @@ vector<vector<Allele> >  groupAlleles_copy(vector<Allele> &alleles) {
     return groups;
 }
 
-bool Allele::sameSample(Allele &other) { return this->sampleID == other.sampleID; }
+bool Allele::sameSample(Allele &other) {
+    if (sampleIndex >= 0 && other.sampleIndex >= 0) return sampleIndex == other.sampleIndex;
+    return this->sampleID == other.sampleID;
+}
 
 bool allelesSameType(Allele* &a, Allele* &b) { return a->type == b->type; }
 
 bool allelesEquivalent(Allele* &a, Allele* &b) { return a->equivalent(*b); }
 
-bool allelesSameSample(Allele* &a, Allele* &b) { return a->sampleID == b->sampleID; }
+bool allelesSameSample(Allele* &a, Allele* &b) { return a->sameSample(*b); }
 
 bool allelesSameType(Allele &a, Allele &b) { return a.type == b.type; }
 
 bool allelesEquivalent(Allele &a, Allele &b) { return a.equivalent(b); }
 
-bool allelesSameSample(Allele &a, Allele &b) { return a.sampleID == b.sampleID; }
+bool allelesSameSample(Allele &a, Allele &b) { return a.sameSample(b); }
 
 bool allelesEqual(Allele &a, Allele &b) { return a == b; }
 
@@ -895,7 +881,7 @@ Allele genotypeAllele(Allele &a) {
     return Allele(a.type, a.alternateSequence, a.length, a.referenceLength, a.cigar, a.position, a.repeatRightBoundary);
 }
 
-Allele genotypeAllele(AlleleType type, string alt, unsigned int len, string cigar, unsigned int reflen, long int pos, long int rrbound) {
+Allele genotypeAllele(AlleleType type, string alt, unsigned int len, const Cigar& cigar, unsigned int reflen, long int pos, long int rrbound) {
     return Allele(type, alt, len, reflen, cigar, pos, rrbound);
 }
 
@@ -1084,8 +1070,8 @@ void Allele::subtract(
         int subtractFromRefEnd,
         string& substart,
         string& subend,
-        vector<pair<int, string> >& cigarStart,
-        vector<pair<int, string> >& cigarEnd,
+        Cigar& cigarStart,
+        Cigar& cigarEnd,
         vector<short>& qsubstart,
         vector<short>& qsubend
     ) {
@@ -1097,30 +1083,30 @@ void Allele::subtract(
     qsubstart.clear();
     qsubend.clear();
 
-    // prepare to adjust cigar
-    list<pair<int, string> > cigarL = splitCigarList(cigar);
+    // the cigar is cut in place: elements [first, last) are what remain
+    size_t first = 0;
+    size_t last = cigar.size();
 
     // walk the cigar string to determine where to make the left cut in the alternate sequence
     int subtractFromAltStart = 0;
     if (subtractFromRefStart) {
         int refbpstart = subtractFromRefStart;
-        pair<int, string> c;
-        while (!cigarL.empty()) {
-            c = cigarL.front();
-            cigarL.pop_front();
-            char op = c.second[0];
+        while (first < last) {
+            CigarElement c = cigar[first++];
+            int clen = c.length();
+            char op = c.op();
             switch (op) {
                 case 'M':
                 case 'X':
                 case 'N':
-                    refbpstart -= c.first;
-                    subtractFromAltStart += c.first;
+                    refbpstart -= clen;
+                    subtractFromAltStart += clen;
                     break;
                 case 'I':
-                    subtractFromAltStart += c.first;
+                    subtractFromAltStart += clen;
                     break;
                 case 'D':
-                    refbpstart -= c.first;
+                    refbpstart -= clen;
                     break;
                 default:
                     break;
@@ -1130,9 +1116,8 @@ void Allele::subtract(
 
             if (refbpstart < 0) {
                 // split/adjust the last cigar element
-                cigarL.push_front(c);
-                cigarL.front().first = -refbpstart;
-                cigarStart.back().first += refbpstart;
+                cigar[--first].setLength(-refbpstart);
+                cigarStart.back().setLength(clen + refbpstart);
                 switch (op) {
                     case 'M':
                     case 'X':
@@ -1154,23 +1139,22 @@ void Allele::subtract(
     // walk the cigar string to determine where to make the right cut in the alternate sequence
     if (subtractFromRefEnd) {
         int refbpend = subtractFromRefEnd;
-        pair<int, string> c;
-        while (!cigarL.empty() && refbpend > 0) {
-            c = cigarL.back();
-            cigarL.pop_back();
-            char op = c.second[0];
+        while (first < last && refbpend > 0) {
+            CigarElement c = cigar[--last];
+            int clen = c.length();
+            char op = c.op();
             switch (op) {
                 case 'M':
                 case 'X':
                 case 'N':
-                    subtractFromAltEnd += c.first;
-                    refbpend -= c.first;
+                    subtractFromAltEnd += clen;
+                    refbpend -= clen;
                     break;
                 case 'I':
-                    subtractFromAltEnd += c.first;
+                    subtractFromAltEnd += clen;
                     break;
                 case 'D':
-                    refbpend -= c.first;
+                    refbpend -= clen;
                     break;
                 default:
                     break;
@@ -1180,9 +1164,8 @@ void Allele::subtract(
 
             if (refbpend < 0) {
                 // split/adjust the last cigar element
-                cigarL.push_back(c);
-                cigarL.back().first = -refbpend;
-                cigarEnd.front().first += refbpend;
+                cigar[last++].setLength(-refbpend);
+                cigarEnd.front().setLength(clen + refbpend);
                 switch (op) {
                     case 'M':
                     case 'X':
@@ -1212,8 +1195,9 @@ void Allele::subtract(
     baseQualities.erase(baseQualities.begin() + baseQualities.size() - subtractFromAltEnd, baseQualities.end());
 
     // reset the cigar
-    cigarL.erase(remove_if(cigarL.begin(), cigarL.end(), isEmptyCigarElement), cigarL.end());
-    cigar = joinCigarList(cigarL);
+    cigar.erase(cigar.begin() + last, cigar.end());
+    cigar.erase(cigar.begin(), cigar.begin() + first);
+    cigar.removeEmpty();
 
     // reset the length
     length = alternateSequence.size();
@@ -1231,30 +1215,30 @@ void Allele::subtract(
 
 }
 
-void Allele::subtractFromStart(int bp, string& seq, vector<pair<int, string> >& cig, vector<short>& quals) {
+void Allele::subtractFromStart(int bp, string& seq, Cigar& cig, vector<short>& quals) {
     string emptystr;
-    vector<pair<int, string> > emptycigar;
+    Cigar emptycigar;
     vector<short> emptyquals;
     subtract(bp, 0, seq, emptystr, cig, emptycigar, quals, emptyquals);
 }
 
-void Allele::subtractFromEnd(int bp, string& seq, vector<pair<int, string> >& cig, vector<short>& quals) {
+void Allele::subtractFromEnd(int bp, string& seq, Cigar& cig, vector<short>& quals) {
     string emptystr;
-    vector<pair<int, string> > emptycigar;
+    Cigar emptycigar;
     vector<short> emptyquals;
     subtract(0, bp, emptystr, seq, emptycigar, cig, emptyquals, quals);
 }
 
-void Allele::addToStart(string& seq, vector<pair<int, string> >& cig, vector<short>& quals) {
+void Allele::addToStart(string& seq, Cigar& cig, vector<short>& quals) {
     string emptystr;
-    vector<pair<int, string> > emptycigar;
+    Cigar emptycigar;
     vector<short> emptyquals;
     add(seq, emptystr, cig, emptycigar, quals, emptyquals);
 }
 
-void Allele::addToEnd(string& seq, vector<pair<int, string> >& cig, vector<short>& quals) {
+void Allele::addToEnd(string& seq, Cigar& cig, vector<short>& quals) {
     string emptystr;
-    vector<pair<int, string> > emptycigar;
+    Cigar emptycigar;
     vector<short> emptyquals;
     add(emptystr, seq, emptycigar, cig, emptyquals, quals);
 }
@@ -1262,20 +1246,20 @@ void Allele::addToEnd(string& seq, vector<pair<int, string> >& cig, vector<short
 void Allele::add(
         string& addToStart,
         string& addToEnd,
-        vector<pair<int, string> >& cigarStart,
-        vector<pair<int, string> >& cigarEnd,
+        Cigar& cigarStart,
+        Cigar& cigarEnd,
         vector<short>& qaddToStart,
         vector<short>& qaddToEnd
     ) {
 
     // adjust the position
-    for (vector<pair<int, string> >::iterator c = cigarStart.begin(); c != cigarStart.end(); ++c) {
-        switch (c->second[0]) {
+    for (Cigar::iterator c = cigarStart.begin(); c != cigarStart.end(); ++c) {
+        switch (c->op()) {
             case 'M':
             case 'X':
             case 'D':
             case 'N':
-                position -= c->first;
+                position -= c->length();
                 break;
             case 'I':
             default:
@@ -1283,26 +1267,23 @@ void Allele::add(
         }
     }
 
-    // prepare to adjust cigar
-    vector<pair<int, string> > cigarV = splitCigar(cigar);
-
     // adjust the cigar
     if (!cigarStart.empty()) {
-        if (cigarStart.back().second == cigarV.front().second) {
+        if (cigarStart.back().sameOp(cigar.front())) {
             // merge
-            cigarV.front().first += cigarStart.back().first;
+            cigar.front().setLength(cigar.front().length() + cigarStart.back().length());
             cigarStart.pop_back();
         }
     }
-    cigarV.insert(cigarV.begin(), cigarStart.begin(), cigarStart.end());
+    cigar.insert(cigar.begin(), cigarStart.begin(), cigarStart.end());
 
     if (!cigarEnd.empty()) {
-        if (cigarEnd.front().second == cigarV.back().second) {
+        if (cigarEnd.front().sameOp(cigar.back())) {
             // merge
-            cigarV.back().first += cigarEnd.front().first;
+            cigar.back().setLength(cigar.back().length() + cigarEnd.front().length());
             cigarEnd.pop_back();
         } else {
-            cigarV.insert(cigarV.end(), cigarEnd.begin(), cigarEnd.end());
+            cigar.insert(cigar.end(), cigarEnd.begin(), cigarEnd.end());
         }
     }
 
@@ -1315,8 +1296,7 @@ void Allele::add(
     baseQualities.insert(baseQualities.end(), qaddToEnd.begin(), qaddToEnd.end());
 
     // reset the cigar
-    cigarV.erase(remove_if(cigarV.begin(), cigarV.end(), isEmptyCigarElement), cigarV.end());
-    cigar = joinCigar(cigarV);
+    cigar.removeEmpty();
 
     updateTypeAndLengthFromCigar();
 
@@ -1327,13 +1307,11 @@ void Allele::add(
 
 void Allele::updateTypeAndLengthFromCigar(void) {
 
-    vector<pair<int, string> > cigarV = splitCigar(cigar);
-
     map<char, int> cigarTypes;
     map<char, int> cigarLengths;
-    for (vector<pair<int, string> >::iterator c = cigarV.begin(); c != cigarV.end(); ++c) {
-        ++cigarTypes[c->second[0]];
-        cigarLengths[c->second[0]] += c->first;
+    for (Cigar::iterator c = cigar.begin(); c != cigar.end(); ++c) {
+        ++cigarTypes[c->op()];
+        cigarLengths[c->op()] += c->length();
     }
     if (cigarTypes.size() == 1) {
         switch (cigarTypes.begin()->first) {
@@ -1408,42 +1386,8 @@ void Allele::updateTypeAndLengthFromCigar(void) {
 
 }
 
-int referenceLengthFromCigar(string& cigar) {
-    int r = 0;
-    vector<pair<int, string> > cigarV = splitCigar(cigar);
-    for (vector<pair<int, string> >::iterator c = cigarV.begin(); c != cigarV.end(); ++c) {
-        switch (c->second[0]) {
-        case 'M':
-        case 'X':
-        case 'D':
-            r += c->first;
-            break;
-        case 'N':
-        case 'I':
-        default:
-            break;
-        }
-    }
-    return r;
-}
-
 int Allele::referenceLengthFromCigar(void) {
-    int r = 0;
-    vector<pair<int, string> > cigarV = splitCigar(cigar);
-    for (vector<pair<int, string> >::iterator c = cigarV.begin(); c != cigarV.end(); ++c) {
-        switch (c->second[0]) {
-        case 'M':
-        case 'X':
-        case 'D':
-            r += c->first;
-            break;
-        case 'N':
-        case 'I':
-        default:
-            break;
-        }
-    }
-    return r;
+    return cigar.referenceLength();
 }
 
 
@@ -1462,7 +1406,7 @@ void Allele::mergeAllele(const Allele& newAllele, AlleleType newType) {
     if (newAllele.type != ALLELE_REFERENCE) {
         repeatRightBoundary = newAllele.repeatRightBoundary;
     }
-    cigar = mergeCigar(cigar, newAllele.cigar);
+    cigar.merge(newAllele.cigar);
     referenceLength = referenceLengthFromCigar();
 }
 
@@ -1496,8 +1440,8 @@ bool isEmptyAllele(const Allele& allele) {
 }
 
 bool isDividedIndel(const Allele& allele) {
-    vector<pair<int, string> > cigarV = splitCigar(allele.cigar);
-    if (cigarV.front().second == "D" || cigarV.front().second == "I") {
+    char op = allele.cigar.front().op();
+    if (op == 'D' || op == 'I') {
         return true;
     } else {
         return false;
@@ -1509,11 +1453,12 @@ bool isUnflankedIndel(const Allele& allele) {
     if (allele.isReference() || allele.isSNP() || allele.isMNP()) {
         return false;
     } else {
-        vector<pair<int, string> > cigarV = splitCigar(allele.cigar);
-        if (cigarV.back().second == "D"
-            || cigarV.back().second == "I"
-            || cigarV.front().second == "D"
-            || cigarV.front().second == "I") {
+        char firstOp = allele.cigar.front().op();
+        char lastOp = allele.cigar.back().op();
+        if (lastOp == 'D'
+            || lastOp == 'I'
+            || firstOp == 'D'
+            || firstOp == 'I') {
             return true;
         } else {
             return false;
@@ -1524,3 +1469,52 @@ bool isUnflankedIndel(const Allele& allele) {
 bool isEmptyAlleleOrIsDividedIndel(const Allele& allele) {
     return isEmptyAllele(allele) || isDividedIndel(allele);
 }
+
+void AlleleVectorPool::recycle(vector<Allele>& a) {
+    a.clear();
+    if (pool.size() < maxSize && a.capacity() > 0) {
+        pool.push_back(vector<Allele>());
+        pool.back().swap(a);
+    }
+}
+
+void AlleleVectorPool::take(vector<Allele>& a) {
+    if (!pool.empty()) {
+        a.swap(pool.back());
+        pool.pop_back();
+    }
+}
+
+void AlleleVectorPool::purge(void) {
+    vector<vector<Allele> >().swap(pool);
+}
+
+// pointers into different vectors are only ordered by std::less
+static bool rangeStartsBefore(const pair<Allele*, Allele*>& a, const pair<Allele*, Allele*>& b) {
+    return less<Allele*>()(a.first, b.first);
+}
+
+void AlleleStorageRanges::add(vector<Allele>& alleles) {
+    if (!alleles.empty()) {
+        ranges.push_back(make_pair(&alleles.front(), &alleles.front() + alleles.size()));
+        sorted = false;
+    }
+}
+
+bool AlleleStorageRanges::contains(Allele* allele) {
+    if (ranges.empty()) {
+        return false;
+    }
+    if (!sorted) {
+        sort(ranges.begin(), ranges.end(), rangeStartsBefore);
+        sorted = true;
+    }
+    // the last range starting at or before the allele
+    vector<pair<Allele*, Allele*> >::iterator r
+        = upper_bound(ranges.begin(), ranges.end(), make_pair(allele, (Allele*) NULL), rangeStartsBefore);
+    if (r == ranges.begin()) {
+        return false;
+    }
+    --r;
+    return !less<Allele*>()(allele, r->first) && less<Allele*>()(allele, r->second);
+}
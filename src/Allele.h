@@ -12,7 +12,9 @@
 #include <sstream>
 #include <assert.h>
 #include "Utility.h"
+#include "Cigar.h"
 #include "convert.h"
+#include "AllocationProfile.h"
 
 //#ifdef HAVE_BAMTOOLS
 //#include "api/BamAlignment.h"
@@ -23,38 +25,6 @@ using namespace std;
 
 class Allele;
 
-// Allele recycling allocator
-// without we spend 30% of our runtime deleting Allele instances
-
-class AlleleFreeList {
-
-public:
-    AlleleFreeList()
-        : _p(NULL)
-        , _size(0)
-        , _allocs(0)
-        , _min_size(0)
-        , _max_size(0)
-        , _tick_allocs(1000000)  // attempt realloc every million allocs
-    { }
-
-    ~AlleleFreeList();
-    void Purge();
-    void Resize(int new_size);
-    void* NewAllele();
-    void Recycle(void* mem);
-
-private:
-    Allele* _p;
-    int _size;    // number of alleles on list
-    int _allocs;  // allocation counter
-    int _min_size; // min size within some previous number of calls to new
-    int _max_size;
-    int _tick_allocs; // GC cycle length
-
-};
-
-
 // a structure describing an allele
 
 enum AlleleType {
@@ -80,8 +50,6 @@ typedef long int Position;
 
 class Allele {
 
-    friend class AlleleFreeList;
-
     friend string stringForAllele(const Allele &a);
     friend string stringForAlleles(vector<Allele> &av);
 
@@ -120,13 +88,15 @@ public:
     AlleleStrand strand;          // strand, true = +, false = -
     string sampleID;        // representative sample ID
     string readGroupID;     // read group membership
-    string readID;          // id of the read which the allele is drawn from
+    string readID;          // id of the read which the allele is drawn from, with --debug
+    int sampleIndex;        // id of the sample in the run's sample list, or -1 if not from one
+    int readGroupIndex;     // id of the read group, or -1 if the read has none we know of
     vector<short> baseQualities;
-    long double quality;          // base quality score associated with this allele, updated every position in the case of reference alleles
-    long double lnquality;  // log version of above
+    Probability quality;          // base quality score associated with this allele, updated every position in the case of reference alleles
+    Probability lnquality;  // log version of above
     string currentBase;       // current base, meant to be updated every position
     short mapQuality;       // map quality for the originating read
-    long double lnmapQuality;       // map quality for the originating read
+    Probability lnmapQuality;       // map quality for the originating read
     double readMismatchRate; // per-base mismatch rate for the read
     double readIndelRate;  // only considering gaps
     double readSNPRate;    // only considering snps/mnps
@@ -135,10 +105,13 @@ public:
     bool isMateMapped;  // if the mate in the pair is mapped
     bool genotypeAllele;    // if this is an abstract 'genotype' allele
     bool processed; // flag to mark if we've presented this allele for analysis
-    string cigar; // a cigar representation of the allele
+    Cigar cigar; // a cigar representation of the allele
     vector<Allele>* alignmentAlleles;
     long int alignmentStart;
     long int alignmentEnd;
+#ifdef ALLOC_PROFILE
+    LiveCount<LIVE_ALLELES> liveCount;
+#endif
 
     // default constructor, for converting alignments into allele observations
     Allele(AlleleType t, 
@@ -150,19 +123,19 @@ public:
            long int rrbound,
            int bleft,
            int bright,
-           string alt,
+           const string& alt,
            string& sampleid,
            string& readid,
            string& readgroupid,
            string& sqtech,
            bool strnd, 
-           long double qual,
-           string qstr, 
+           Probability qual,
+           const string& qstr,
            short mapqual,
            bool ispair,
            bool ismm,
            bool isproppair,
-           string cigarstr,
+           const Cigar& cigarstr,
            vector<Allele>* ra,
            long int bas,
            long int bae)
@@ -180,10 +153,12 @@ public:
         , sampleID(sampleid)
         , readID(readid)
         , readGroupID(readgroupid)
+        , sampleIndex(-1)
+        , readGroupIndex(-1)
         , sequencingTechnology(sqtech)
         , strand(strnd ? STRAND_FORWARD : STRAND_REVERSE)
         , quality((qual == -1) ? averageQuality(qstr) : qual) // passing -1 as quality triggers this calculation
-        , lnquality(phred2ln((qual == -1) ? averageQuality(qstr) : qual))
+        , lnquality(phred2ln(quality))
         , mapQuality(mapqual) 
         , lnmapQuality(phred2ln(mapqual))
         , isProperPair(isproppair)
@@ -211,7 +186,7 @@ public:
 	   string alt,
 	   unsigned int len,
 	   unsigned int reflen,
-	   string cigarStr,
+	   const Cigar& cigarStr,
 	   long int pos=0,
 	   long int rrbound=0,
 	   bool gallele=true) 
@@ -224,6 +199,8 @@ public:
         , lnquality(1)
         , position(pos)
         , genotypeAllele(true)
+        , sampleIndex(-1)
+        , readGroupIndex(-1)
         , readMismatchRate(0)
         , readIndelRate(0)
         , readSNPRate(0)
@@ -238,6 +215,7 @@ public:
 
     bool equivalent(Allele &a);  // heuristic 'equivalency' between two alleles, which depends on their type
     string typeStr(void) const; // return a string representation of the allele type, for output
+    const char* typeName(void) const; // the same, without making a string
     bool isReference(void) const; // true if type == ALLELE_REFERENCE
     bool isSNP(void) const; // true if type == ALLELE_SNP
     bool isInsertion(void) const; // true if type == ALLELE_INSERTION
@@ -247,11 +225,11 @@ public:
     bool isNull(void) const; // true if type == ALLELE_NULL
     int referenceOffset(void) const;
     const short currentQuality(void) const;  // for getting the quality of a given position in multi-bp alleles
-    const long double lncurrentQuality(void) const;
+    const Probability lncurrentQuality(void) const;
     const int subquality(int startpos, int len) const;
-    const long double lnsubquality(int startpos, int len) const;
+    const Probability lnsubquality(int startpos, int len) const;
     const int subquality(const Allele &a) const;
-    const long double lnsubquality(const Allele &a) const;
+    const Probability lnsubquality(const Allele &a) const;
     //const int basesLeft(void) const; // returns the bases left within the read of the current position within the allele
     //const int basesRight(void) const; // returns the bases right within the read of the current position within the allele
     bool sameSample(Allele &other);  // if the other allele has the same sample as this one
@@ -287,23 +265,23 @@ public:
             int subtractFromRefEnd,
             string& substart,
             string& subend,
-            vector<pair<int, string> >& cigarstart,
-            vector<pair<int, string> >& cigarend,
+            Cigar& cigarstart,
+            Cigar& cigarend,
             vector<short>& qsubstart,
             vector<short>& qsubend);
 
     void add(string& addToStart,
             string& addToEnd,
-            vector<pair<int, string> >& cigarStart,
-            vector<pair<int, string> >& cigarEnd,
+            Cigar& cigarStart,
+            Cigar& cigarEnd,
             vector<short>& qaddToStart,
             vector<short>& qaddToEnd);
 
 
-    void subtractFromStart(int bp, string& seq, vector<pair<int, string> >& cig, vector<short>& quals);
-    void subtractFromEnd(int bp, string& seq, vector<pair<int, string> >& cig, vector<short>& quals);
-    void addToStart(string& seq, vector<pair<int, string> >& cig, vector<short>& quals);
-    void addToEnd(string& seq, vector<pair<int, string> >& cig, vector<short>& quals);
+    void subtractFromStart(int bp, string& seq, Cigar& cig, vector<short>& quals);
+    void subtractFromEnd(int bp, string& seq, Cigar& cig, vector<short>& quals);
+    void addToStart(string& seq, Cigar& cig, vector<short>& quals);
+    void addToEnd(string& seq, Cigar& cig, vector<short>& quals);
 
     void mergeAllele(const Allele& allele, AlleleType newType);
 
@@ -330,7 +308,6 @@ public:
 };
 
 
-void updateAllelesCachedData(vector<Allele*>& alleles);
 
 map<string, vector<Allele*> > groupAllelesBySample(list<Allele*>& alleles);
 void groupAllelesBySample(list<Allele*>& alleles, map<string, vector<Allele*> >& groups);
@@ -382,15 +359,56 @@ vector<Allele> genotypeAllelesFromAlleleGroups(vector<vector<Allele*> > &groups)
 vector<Allele> genotypeAllelesFromAlleles(vector<Allele> &alleles);
 vector<Allele> genotypeAllelesFromAlleles(vector<Allele*> &alleles);
 Allele genotypeAllele(Allele& a);
-Allele genotypeAllele(AlleleType type, string alt = "", unsigned int length = 0, string cigar = "", unsigned int reflen = 0, long int position = 0, long int rrbound = 0);
+Allele genotypeAllele(AlleleType type, string alt = "", unsigned int length = 0, const Cigar& cigar = Cigar(), unsigned int reflen = 0, long int position = 0, long int rrbound = 0);
 
 bool isEmptyAllele(const Allele& allele);
 bool isDividedIndel(const Allele& allele);
 bool isEmptyAlleleOrIsDividedIndel(const Allele& allele);
 bool isUnflankedIndel(const Allele& allele);
 
-int referenceLengthFromCigar(string& cigar);
 
-//AlleleFreeList Allele::_freeList;
+// Allele storage recycling
+//
+// the observations of each registered alignment are held in a vector<Allele>
+// which lives until the alignment leaves the haplotype window.  alignments
+// are registered and retired at about the same rate as we move along the
+// genome, so rather than freeing the storage of each retired alignment's
+// alleles and allocating (and regrowing) it for each new one, we keep the
+// retired storage here and hand it out again.  without this a large part of
+// our runtime goes to malloc and free.
+
+class AlleleVectorPool {
+
+public:
+    AlleleVectorPool(size_t m = 4096) : maxSize(m) { }
+
+    // releases the alleles in a, keeping a's storage for reuse
+    void recycle(vector<Allele>& a);
+    // gives the empty vector a some recycled storage, if we have any
+    void take(vector<Allele>& a);
+    void purge(void);
+
+private:
+    vector<vector<Allele> > pool;
+    size_t maxSize; // the number of vectors we hold on to at most
+
+};
+
+// the storage of the alleles of a set of registered alignments, for finding
+// which allele pointers refer into it without putting every allele in a set
+
+class AlleleStorageRanges {
+
+public:
+    AlleleStorageRanges(void) : sorted(true) { }
+    void add(vector<Allele>& alleles);
+    bool contains(Allele* allele);
+    bool empty(void) { return ranges.empty(); }
+
+private:
+    vector<pair<Allele*, Allele*> > ranges; // [first, last) of each vector
+    bool sorted;
+
+};
 
 #endif
@@ -5,6 +5,10 @@
                          // http://www.cplusplus.com/doc/tutorial/templates/ "Templates and Multi-file projects"
 #include "multipermute.h"
 #include "Logging.h"
+#include "VariantWriter.h"
+#include "ShardPlan.h"
+#include <limits>
+#include <string.h>
 
 using namespace std;
 
@@ -68,6 +72,29 @@ void AlleleParser::openBams(void) {
 
 #else
 
+    // readers opened from here on hand their decompression to the run's pool
+    if (run->decompressionPool.IsOpen()) {
+        bamMultiReader.SetThreadPool(run->decompressionPool);
+    }
+    bamMultiReader.SetIdleFileLimit(parameters.idleAlignmentFiles);
+    bamMultiReader.SetOpenThreads(parameters.openThreads);
+    bamMultiReader.SetRemoteReadAhead(parameters.remoteReadAhead);
+    bamMultiReader.SetHeaderCache(parameters.headerCacheFile);
+    // CRAM input decodes only what we read of each record.  the names are
+    // wanted by --limit-coverage and --max-memory, which rank the reads by
+    // them, by --merge-overlapping-mates, which pairs mates by them, and
+    // for debugging.  --merge-overlapping-mates also finds the mate by where
+    // it lies
+    int cramFields = SAM_FLAG | SAM_RNAME | SAM_POS | SAM_MAPQ | SAM_CIGAR | SAM_SEQ | SAM_QUAL | SAM_RGAUX;
+    if (parameters.limitCoverage > 0 || parameters.maxMemory > 0 || parameters.mergeOverlappingMates
+        || parameters.debug) {
+        cramFields |= SAM_QNAME;
+    }
+    if (parameters.mergeOverlappingMates) {
+        cramFields |= SAM_RNEXT | SAM_PNEXT | SAM_TLEN;
+    }
+    bamMultiReader.SetCramRequiredFields(cramFields);
+
     if (parameters.useStdin) {
         if (!bamMultiReader.Open("-")) {
             ERROR("Could not read BAM data from stdin");
@@ -86,10 +113,7 @@ void AlleleParser::openBams(void) {
                 bamMultiReader.SetCramReference("");
             }
 
-            if (!bamMultiReader.Open(*i)) {
-                ERROR("Could not open input BAM file: " + *i);
-                exit(1);
-            }else {
+            bamMultiReader.Add(*i);
             /*if (!bamMultiReader.LocateIndexes()) {
                     ERROR("Opened BAM reader without index file, jumping is disabled.");
                     cerr << bamMultiReader.GetErrorString() << endl;
@@ -102,13 +126,16 @@ void AlleleParser::openBams(void) {
                         exit(1);
                     }
             }*/
-            }
         }
         /*if (!bamMultiReader.SetExplicitMergeOrder(bamMultiReader.MergeByCoordinate)) {
             ERROR("could not set sort order to coordinate");
             cerr << bamMultiReader.GetErrorString() << endl;
             exit(1);
 	    }*/
+        // opened together, a few at a time
+        if (!bamMultiReader.OpenAdded()) {
+            exit(1);
+        }
 
     }
 #endif
@@ -136,12 +163,30 @@ void AlleleParser::openBams(void) {
 
 #endif
 
+    // read ahead of the parser, from a thread of its own.  stdin is never
+    // repositioned, so it is always read so, decoding while we call
+    size_t prefetchBatches = parameters.prefetchAlignments;
+    if (prefetchBatches == 0 && parameters.useStdin) {
+        prefetchBatches = STDIN_PREFETCH_BATCHES;
+    }
+    if (prefetchBatches > 0) {
+        prefetcher = new AlignmentPrefetcher(this, prefetchBatches);
+    }
+
     DEBUG(" done");
 }
 
 void AlleleParser::openOutputFile(void) {
-    if (parameters.outputFile != "") {
-        outputFile.open(parameters.outputFile.c_str(), ios::out);
+    // BCF and compressed VCF are written by htslib, which opens the file itself
+    // a resumed run appends to the output, once it is cut back to the
+    // checkpoint, which isn't done until the checkpoint is found to be of
+    // this run
+    if (parameters.resume && !run->checkpoint.load(parameters.checkpointDir, parameters.commandline)) {
+        exit(1);
+    }
+    if (parameters.outputFile != ""
+        && !VariantWriter::opensFile(parameters.outputFile, parameters.outputFormat)) {
+        outputFile.open(parameters.outputFile.c_str(), parameters.resume ? ios::out | ios::app : ios::out);
         DEBUG("Opening output file: " << parameters.outputFile << " ...");
         if (!outputFile) {
             ERROR(" unable to open output file: " << parameters.outputFile);
@@ -526,6 +571,16 @@ string AlleleParser::vcfHeader() {
         headerss << "##INFO=<ID=technology." << tech << ",Number=A,Type=Float,Description=\"Fraction of observations supporting the alternate observed in reads from " << tech << "\">" << endl;
     }
 
+    if (parameters.maxSiteTime > 0) {
+        headerss << "##INFO=<ID=APPROX,Number=0,Type=Flag,Description=\"The site ran past --max-site-time, and was genotyped approximately\">" << endl;
+    }
+    if (parameters.maxMemory > 0) {
+        headerss << "##INFO=<ID=MEMLIMIT,Number=0,Type=Flag,Description=\"The run was near --max-memory, and the alignments it downsampled or the genotype combinations it capped at this site changed the call\">" << endl;
+    }
+    if (parameters.maxHaplotypeCost > 0) {
+        headerss << "##INFO=<ID=HCAP,Number=0,Type=Flag,Description=\"The haplotype was held to --max-haplotype-cost, shortening it or leaving out its least supported alleles\">" << endl;
+    }
+
     if (parameters.showReferenceRepeats) {
         headerss << "##INFO=<ID=REPEAT,Number=1,Type=String,Description=\"Description of the local repeat structures flanking the current position\">" << endl;
     }
@@ -557,7 +612,15 @@ string AlleleParser::vcfHeader() {
         //<< "##FORMAT=<ID=LA,Number=1,Type=Integer,Description=\"Number of alternate observations placed left of the loci\">" << endl
         //<< "##FORMAT=<ID=ER,Number=1,Type=Integer,Description=\"Number of reference observations overlapping the loci in their '3 end\">" << endl
         //<< "##FORMAT=<ID=EA,Number=1,Type=Integer,Description=\"Number of alternate observations overlapping the loci in their '3 end\">" << endl
-        << "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\t"
+        ;
+    if (parameters.localAlleles) {
+        headerss << "##FORMAT=<ID=LAA,Number=.,Type=Integer,Description=\"Local alternate alleles, the 1-based indexes of the alternate alleles observed or called in the sample, to which LAD, LAO, LQA and LGL refer at multi-allelic records\">" << endl
+            << "##FORMAT=<ID=LAD,Number=.,Type=Integer,Description=\"Number of observation for the reference and each local alternate allele\">" << endl
+            << "##FORMAT=<ID=LAO,Number=.,Type=Integer,Description=\"Local alternate allele observation count\">" << endl
+            << "##FORMAT=<ID=LQA,Number=.,Type="<< Qtype << ",Description=\"Sum of quality of the local alternate observations\">" << endl
+            << "##FORMAT=<ID=LGL,Number=.,Type=Float,Description=\"Local Genotype Likelihood, as GL over the genotypes of the reference and local alternate alleles\">" << endl;
+    }
+    headerss << "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\t"
         << join(sampleList, "\t") << endl;
 
     return headerss.str();
@@ -566,15 +629,25 @@ string AlleleParser::vcfHeader() {
 
 
 void AlleleParser::setupVCFOutput(void) {
-    string vcfheader = vcfHeader();
-    variantCallFile.openForOutput(vcfheader);
+    // the header is built once per run, and reused by the parsers for its regions
+    if (run->vcfHeader.empty()) {
+        run->vcfHeader = vcfHeader();
+    }
+    variantCallFile.openForOutput(run->vcfHeader);
 }
 
 void AlleleParser::setupVCFInput(void) {
     // variant input for analysis and targeting
     if (!parameters.variantPriorsFile.empty()) {
-        variantCallInputFile.open(parameters.variantPriorsFile);
-        currentVariant = new vcflib::Variant(variantCallInputFile);
+        if (InputAlleleIndex::isIndex(parameters.variantPriorsFile)) {
+            if (!variantInputIndex.open(parameters.variantPriorsFile)) {
+                ERROR("could not read the input allele index " << parameters.variantPriorsFile);
+                exit(1);
+            }
+        } else {
+            variantCallInputFile.open(parameters.variantPriorsFile);
+            currentVariant = new vcflib::Variant(variantCallInputFile);
+        }
         usingVariantInputAlleles = true;
 
         // get sample names from VCF input file
@@ -594,7 +667,14 @@ void AlleleParser::setupVCFInput(void) {
 
     // haplotype alleles for constructing haplotype alleles
     if (!parameters.haplotypeVariantFile.empty()) {
-        haplotypeVariantInputFile.open(parameters.haplotypeVariantFile);
+        if (InputAlleleIndex::isIndex(parameters.haplotypeVariantFile)) {
+            if (!haplotypeBasisIndex.open(parameters.haplotypeVariantFile)) {
+                ERROR("could not read the input allele index " << parameters.haplotypeVariantFile);
+                exit(1);
+            }
+        } else {
+            haplotypeVariantInputFile.open(parameters.haplotypeVariantFile);
+        }
         usingHaplotypeBasisAlleles = true;
     }
 }
@@ -617,6 +697,54 @@ void AlleleParser::loadBamReferenceSequenceNames(void) {
 }
 
 
+void AlleleParser::loadFastaReferenceSequenceNames(void) {
+
+    int i = 0;
+    for (vector<string>::iterator n = reference.index->sequenceNames.begin(); n != reference.index->sequenceNames.end(); ++n) {
+        referenceSequences.push_back(REFVEC::value_type(*n, reference.sequenceLength(*n)));
+        referenceIDToName[i] = *n;
+        ++i;
+    }
+
+    DEBUG("Number of ref seqs: " << referenceSequences.size());
+}
+
+void AlleleParser::openLikelihoodDumps(void) {
+
+    for (vector<string>::iterator f = parameters.jointLikelihoodFiles.begin(); f != parameters.jointLikelihoodFiles.end(); ++f) {
+        shared_ptr<LikelihoodDump> dump = make_shared<LikelihoodDump>();
+        if (!dump->open(*f)) {
+            ERROR("could not open likelihood dump " << *f);
+            exit(1);
+        }
+        DEBUG("opened likelihood dump " << *f << " of " << dump->samples().size() << " samples");
+        // each sample is its own read group, as if we'd read its alignments
+        for (vector<string>::const_iterator s = dump->samples().begin(); s != dump->samples().end(); ++s) {
+            if (readGroupToSampleNames.count(*s)) {
+                ERROR("sample " << *s << " is in more than one of the likelihood dumps given to --joint-likelihoods");
+                exit(1);
+            }
+            sampleListFromBam.push_back(*s);
+            readGroupToSampleNames[*s] = *s;
+        }
+        run->jointLikelihoods.push_back(dump);
+    }
+
+}
+
+void AlleleParser::toJointSite(const string& seqname, long int position, int referenceLength) {
+    if (currentSequenceName != seqname) {
+        currentSequenceName = seqname;
+        currentSequenceStart = 0;
+        repeatIndex.clear();
+        repeatEntropyBounds.clear();
+        currentSequence.clear();
+    }
+    currentPosition = position;
+    extendReferenceSequence(position, position + referenceLength);
+    trimReferenceSequence(position);
+}
+
 void AlleleParser::loadFastaReference(void) {
 
     DEBUG("loading fasta reference " << parameters.fasta);
@@ -658,6 +786,7 @@ bool AlleleParser::loadNextPositionWithInputVariant(void) {
     //cerr << "Next is " << next.first << ":" << next.second << endl;
     loadReferenceSequence(referenceIDToName[next.first]);
     currentPosition = next.second;
+    extendReferenceSequence(currentPosition, currentPosition + 1);
     rightmostHaplotypeBasisAllelePosition = currentPosition;
     return true;
   } else {
@@ -669,25 +798,64 @@ bool AlleleParser::loadNextPositionWithInputVariant(void) {
 void AlleleParser::loadReferenceSequence(BAMALIGN& alignment) {
   loadReferenceSequence(referenceIDToName[alignment.REFID]);
   currentPosition = alignment.POSITION;
+  extendReferenceSequence(currentPosition, currentPosition + 1);
 }
 
 void AlleleParser::loadReferenceSequence(string& seqname) {
     if (currentSequenceName != seqname) {
         currentSequenceName = seqname;
         currentSequenceStart = 0;
+        repeatIndex.clear();
+        repeatEntropyBounds.clear();
         currentRefID = bamMultiReader.GETREFID(currentSequenceName);
-        currentSequence = uppercase(reference.getRawSequence(currentSequenceName));
         // check the first few characters and verify they are not garbage
+        string head = uppercase(reference.getRawSubSequence(currentSequenceName, 0, 100));
         string validBases = "ACGTURYKMSWBDHVN-";
-        size_t found = currentSequence.substr(0, 100).find_first_not_of(validBases);
+        size_t found = head.find_first_not_of(validBases);
         if (found != string::npos) {
-            ERROR("Found non-DNA character " << currentSequence.at(found)
+            ERROR("Found non-DNA character " << head.at(found)
                   << " at position " << found << " in " << seqname << endl
                   << "Is your reference compressed or corrupted? "
-                  << "freebayes requires an uncompressed reference sequence.");
+                  << "freebayes requires an uncompressed or bgzip-compressed reference sequence.");
             exit(1);
         }
-        currentSequence = reference.getSequence(currentSequenceName);
+        // only the window of the sequence around where we are is cached;
+        // it's filled in as we go by extendReferenceSequence
+        currentSequence.clear();
+    }
+}
+
+long int AlleleParser::referenceWindowMargin(void) {
+    return CACHED_REFERENCE_WINDOW + longestAlignment;
+}
+
+void AlleleParser::extendReferenceSequence(long int start, long int end) {
+    long int sequenceLength = reference.sequenceLength(currentSequenceName);
+    long int cachedEnd = currentSequenceStart + currentSequence.size();
+    long int margin = referenceWindowMargin();
+    start = max((long int) 0, start - CACHED_REFERENCE_WINDOW);
+    end = min(sequenceLength, end + CACHED_REFERENCE_WINDOW);
+    if (currentSequence.empty() || start < currentSequenceStart || start > cachedEnd) {
+        // we've jumped, so start a new window
+        currentSequenceStart = max((long int) 0, start - margin);
+        long int windowEnd = min(sequenceLength, end + margin);
+        DEBUG2("caching reference " << currentSequenceName << ":" << currentSequenceStart << ".." << windowEnd);
+        currentSequence = reference.getSubSequence(currentSequenceName, currentSequenceStart, windowEnd - currentSequenceStart);
+    } else if (end > cachedEnd) {
+        // fetching the margin beyond what we need means we don't come back
+        // for every position we step onto
+        long int windowEnd = min(sequenceLength, end + margin);
+        currentSequence.append(reference.getSubSequence(currentSequenceName, cachedEnd, windowEnd - cachedEnd));
+    }
+}
+
+void AlleleParser::trimReferenceSequence(long int position) {
+    long int keepFrom = position - referenceWindowMargin();
+    // erasing moves what we keep, so wait until there is a margin's worth to drop
+    if (keepFrom - currentSequenceStart > referenceWindowMargin()) {
+        long int drop = min(keepFrom - currentSequenceStart, (long int) currentSequence.size());
+        currentSequence.erase(0, drop);
+        currentSequenceStart += drop;
     }
 }
 
@@ -721,78 +889,379 @@ void AlleleParser::loadTargets(void) {
 
     // if we have a region specified, use it to generate a target
     for (vector<string>::iterator r = parameters.regions.begin(); r != parameters.regions.end(); ++r) {
-        // drawn from bamtools_utilities.cpp, modified to suit 1-based context, no end sequence
+        BedTarget bd;
+        if (!regionTarget(*r, bd)) {
+            exit(1);
+        }
+        DEBUG("will process reference sequence " << bd.seq << ":" << bd.left << ".." << bd.right + 1);
+        targets.push_back(bd);
+        bedReader.targets.push_back(bd);
+    }
 
-        string region = *r;
-        string startSeq;
-        int startPos;
-        int stopPos;
+    // a shard of a plan made from these targets calls its own part of them
+    if (!parameters.shardPlanFile.empty()) {
+        ShardPlan plan;
+        if (!plan.read(parameters.shardPlanFile)) {
+            exit(1);
+        }
+        if ((size_t) parameters.shardIndex >= plan.shards.size()) {
+            ERROR("there is no shard " << parameters.shardIndex << " in the plan " << parameters.shardPlanFile
+                  << ", which has " << plan.shards.size());
+            exit(1);
+        }
+        targets = plan.calledTargets(parameters.shardIndex);
+        for (vector<BedTarget>::iterator t = targets.begin(); t != targets.end(); ++t) {
+            if (reference.index->find(t->seq) != reference.index->end()) {
+                t->right = min(t->right, (int) reference.sequenceLength(t->seq) - 1);
+            }
+        }
+        bedReader.targets = targets;
+        DEBUG("calling shard " << parameters.shardIndex << " of " << plan.shards.size()
+              << " over " << targets.size() << " padded targets");
+    }
 
-        size_t foundLastColon = region.rfind(":");
+    // check validity of targets wrt. reference
+    for (vector<BedTarget>::iterator e = targets.begin(); e != targets.end(); ++e) {
+        if (!validTarget(*e)) {
+            exit(1);
+        }
+    }
+
+    bedReader.buildIntervals(); // set up interval tree in the bedreader
+    targetIndex.index(targets);
+    targetCursor.reset();
+
+    DEBUG("Number of target regions: " << targets.size());
+
+}
+
+// the target of a region given as seq, seq:start, seq:start- or
+// seq:start..end (or seq:start-end), 0-based and end-exclusive as in BED,
+// or false if its sequence isn't in the reference
+bool AlleleParser::regionTarget(const string& region, BedTarget& target) {
+    // drawn from bamtools_utilities.cpp, modified to suit 1-based context, no end sequence
+
+    string startSeq;
+    int startPos;
+    int stopPos;
+
+    size_t foundLastColon = region.rfind(":");
 
-        // we only have a single string, use the whole sequence as the target
-        if (foundLastColon == string::npos) {
-            startSeq = region;
-            startPos = 0;
-            stopPos = -1;
+    // we only have a single string, use the whole sequence as the target
+    if (foundLastColon == string::npos) {
+        startSeq = region;
+        startPos = 0;
+        stopPos = -1;
+    } else {
+        startSeq = region.substr(0, foundLastColon);
+        string sep = "..";
+        size_t foundRangeSep = region.find(sep, foundLastColon);
+        if (foundRangeSep == string::npos) {
+            sep = "-";
+            foundRangeSep = region.find(sep, foundLastColon);
+        }
+        if (foundRangeSep == string::npos) {
+            startPos = stringToInt(region.substr(foundLastColon + 1));
+            // differ from bamtools in this regard, in that we process only
+            // the specified position if a range isn't given
+            stopPos = startPos + 1;
         } else {
-            startSeq = region.substr(0, foundLastColon);
-            string sep = "..";
-            size_t foundRangeSep = region.find(sep, foundLastColon);
-            if (foundRangeSep == string::npos) {
-                sep = "-";
-                foundRangeSep = region.find(sep, foundLastColon);
-            }
-            if (foundRangeSep == string::npos) {
-                startPos = stringToInt(region.substr(foundLastColon + 1));
-                // differ from bamtools in this regard, in that we process only
-                // the specified position if a range isn't given
-                stopPos = startPos + 1;
+            startPos = stringToInt(region.substr(foundLastColon + 1, foundRangeSep - foundLastColon).c_str());
+            // if we have range sep specified, but no second number, read to the end of sequence
+            if (foundRangeSep + sep.size() != region.size()) {
+                stopPos = stringToInt(region.substr(foundRangeSep + sep.size()).c_str()); // end-exclusive, bed-format
             } else {
-                startPos = stringToInt(region.substr(foundLastColon + 1, foundRangeSep - foundLastColon).c_str());
-                // if we have range sep specified, but no second number, read to the end of sequence
-                if (foundRangeSep + sep.size() != region.size()) {
-                    stopPos = stringToInt(region.substr(foundRangeSep + sep.size()).c_str()); // end-exclusive, bed-format
-                } else {
-                    stopPos = -1;
+                stopPos = -1;
+            }
+        }
+    }
+
+    //DEBUG("startPos == " << startPos);
+    //DEBUG("stopPos == " << stopPos);
+
+    if (reference.index->find(startSeq) == reference.index->end()) {
+        ERROR("Region " << region << " is on a sequence which is not in the reference");
+        return false;
+    }
+
+    // REAL BED format is 0 based, half open (end base not included)
+    target = BedTarget(startSeq,
+                       (startPos == 0) ? 0 : startPos,
+                       ((stopPos == -1) ? reference.sequenceLength(startSeq) : stopPos) - 1); // internally, we use 0-base inclusive end
+    return true;
+
+}
+
+// whether the target lies within the reference, reporting it if it doesn't
+bool AlleleParser::validTarget(const BedTarget& bd) {
+    if (reference.index->find(bd.seq) == reference.index->end()) {
+        ERROR("Target sequence " << bd.seq << " is not in the reference");
+        return false;
+    }
+    // internally, we use 0-base inclusive end
+    if (bd.left < 0 || bd.right + 1 > reference.sequenceLength(bd.seq)) {
+        ERROR("Target region coordinates (" << bd.seq << " "
+                << bd.left << " " << bd.right + 1
+                << ") outside of reference sequence bounds ("
+                << bd.seq << " " << reference.sequenceLength(bd.seq) << ") terminating.");
+        return false;
+    }
+    if (bd.right < bd.left) {
+        ERROR("Invalid target region coordinates (" << bd.seq << " " << bd.left << " " << bd.right + 1 << ")"
+                << " right bound is lower than left bound!");
+        return false;
+    }
+    return true;
+}
+
+// replaces the targets of the parser and rewinds it, so that the next call to
+// getNextAlleles begins at the start of the first of the new targets
+void AlleleParser::setTargets(const vector<BedTarget>& newTargets) {
+
+    targets = newTargets;
+    bedReader.targets = targets;
+    bedReader.intervals.clear();
+    bedReader.buildIntervals();
+    targetIndex.index(targets);
+    targetCursor.reset();
+    readCursor.reset();
+
+    currentTarget = NULL;
+    justSwitchedTargets = false;
+    hasMoreAlignments = true;
+    lastHaplotypeLength = 1; // so that we step onto the first target
+    rightmostHaplotypeBasisAllelePosition = 0;
+    rightmostInputAllelePosition = 0;
+
+    clearRegisteredAlignments();
+    repeatIndex.clear();
+    repeatEntropyBounds.clear();
+    coverage.clear();
+    inputVariantAlleles.clear();
+    haplotypeBasisAlleles.clear();
+
+}
+
+// the targets of the run, or if none were given, every reference sequence
+// which is in both the alignments and the fasta reference
+vector<BedTarget> AlleleParser::runTargets(void) {
+
+    if (!targets.empty()) {
+        return targets;
+    }
+
+    vector<BedTarget> wholeTargets;
+    for (REFVEC::iterator r = referenceSequences.begin(); r != referenceSequences.end(); ++r) {
+        if (!reference.index->count(r->REFNAME)) {
+            DEBUG("skipping " << r->REFNAME << ", which is not in the fasta reference");
+            continue;
+        }
+        long int length = min((long int) r->REFLEN, (long int) reference.sequenceLength(r->REFNAME));
+        if (length > 0) {
+            wholeTargets.push_back(BedTarget(r->REFNAME, 0, length - 1)); // 0-based inclusive internally
+        }
+    }
+    return wholeTargets;
+
+}
+
+// breaks the targets, or every reference sequence if we have no targets, into
+// consecutive regions no longer than regionSize
+vector<BedTarget> AlleleParser::targetRegions(long int regionSize) {
+
+    vector<BedTarget> wholeTargets = runTargets();
+
+    vector<BedTarget> regions;
+    for (vector<BedTarget>::iterator t = wholeTargets.begin(); t != wholeTargets.end(); ++t) {
+        for (long int left = t->left; left <= t->right; left += regionSize) {
+            long int right = min(left + regionSize - 1, (long int) t->right);
+            regions.push_back(BedTarget(t->seq, left, right, t->desc));
+        }
+    }
+
+    DEBUG("split " << wholeTargets.size() << " targets into " << regions.size() << " regions");
+
+    return regions;
+
+}
+
+// estimates the amount of alignment data in each AUTO_REGION_BIN_SIZE bin of
+// each target, from the index chunks overlapping it in each input file
+vector<vector<Probability> > AlleleParser::indexedDataInBins(vector<BedTarget>& wholeTargets) {
+
+    vector<vector<Probability> > weights;
+    for (vector<BedTarget>::iterator t = wholeTargets.begin(); t != wholeTargets.end(); ++t) {
+        weights.push_back(vector<Probability>((t->right - t->left) / AUTO_REGION_BIN_SIZE + 1, 0));
+    }
+
+#ifdef HAVE_BAMTOOLS
+    WARNING("--auto-regions can't read the alignment indexes when built against bamtools, splitting by length");
+#else
+    for (vector<string>::const_iterator b = parameters.bams.begin(); b != parameters.bams.end(); ++b) {
+        // SeqLib keeps its index handles to itself, so open the index separately
+        htsFile* fp = hts_open(b->c_str(), "r");
+        bam_hdr_t* header = fp ? sam_hdr_read(fp) : NULL;
+        hts_idx_t* idx = header ? sam_index_load(fp, b->c_str()) : NULL;
+        if (!idx) {
+            WARNING("could not load the index of " << *b << ", it will not be used to balance the regions");
+        } else {
+            for (size_t i = 0; i < wholeTargets.size(); ++i) {
+                BedTarget& target = wholeTargets[i];
+                int tid = bam_name2id(header, target.seq.c_str());
+                if (tid < 0) {
+                    continue;
+                }
+                vector<Probability>& bins = weights[i];
+                for (size_t j = 0; j < bins.size(); ++j) {
+                    long int left = target.left + j * AUTO_REGION_BIN_SIZE;
+                    long int right = min(left + AUTO_REGION_BIN_SIZE - 1, (long int) target.right);
+                    hts_itr_t* itr = sam_itr_queryi(idx, tid, left, right + 1);
+                    if (!itr) {
+                        continue;
+                    }
+                    // chunks are pairs of virtual offsets; the high 48 bits are
+                    // the offset of the compressed block and the low 16 the
+                    // offset within its (~4x larger) uncompressed data
+                    for (int k = 0; k < itr->n_off; ++k) {
+                        uint64_t u = itr->off[k].u;
+                        uint64_t v = itr->off[k].v;
+                        bins[j] += (Probability) ((v >> 16) - (u >> 16))
+                            + ((Probability) (v & 0xFFFF) - (Probability) (u & 0xFFFF)) / 4;
+                    }
+                    hts_itr_destroy(itr);
                 }
             }
+            hts_idx_destroy(idx);
         }
+        if (header) bam_hdr_destroy(header);
+        if (fp) hts_close(fp);
+    }
+#endif
 
-        //DEBUG("startPos == " << startPos);
-        //DEBUG("stopPos == " << stopPos);
+    return weights;
 
-        // REAL BED format is 0 based, half open (end base not included)
-        BedTarget bd(startSeq,
-                    (startPos == 0) ? 0 : startPos,
-                    ((stopPos == -1) ? reference.sequenceLength(startSeq) : stopPos) - 1); // internally, we use 0-base inclusive end
-        DEBUG("will process reference sequence " << startSeq << ":" << bd.left << ".." << bd.right + 1);
-        targets.push_back(bd);
-        bedReader.targets.push_back(bd);
+}
+
+// splits the targets of the run into regionCount regions holding roughly equal
+// amounts of alignment data.  a region may hold parts of several targets.
+vector<vector<BedTarget> > AlleleParser::balancedRegions(int regionCount) {
+
+    vector<BedTarget> wholeTargets = runTargets();
+    vector<vector<Probability> > weights = indexedDataInBins(wholeTargets);
 
+    Probability total = 0;
+    for (vector<vector<Probability> >::iterator w = weights.begin(); w != weights.end(); ++w) {
+        for (vector<Probability>::iterator b = w->begin(); b != w->end(); ++b) {
+            total += *b;
+        }
     }
 
-    // check validity of targets wrt. reference
-    for (vector<BedTarget>::iterator e = targets.begin(); e != targets.end(); ++e) {
-        BedTarget& bd = *e;
-        // internally, we use 0-base inclusive end
-        if (bd.left < 0 || bd.right + 1 > reference.sequenceLength(bd.seq)) {
-            ERROR("Target region coordinates (" << bd.seq << " "
-                    << bd.left << " " << bd.right + 1
-                    << ") outside of reference sequence bounds ("
-                    << bd.seq << " " << reference.sequenceLength(bd.seq) << ") terminating.");
-            exit(1);
+    // without any usable index data, fall back to balancing by length
+    bool byLength = total <= 0;
+    if (byLength) {
+        DEBUG("no index data for --auto-regions, splitting targets by length");
+        for (size_t i = 0; i < wholeTargets.size(); ++i) {
+            total += wholeTargets[i].right - wholeTargets[i].left + 1;
         }
-        if (bd.right < bd.left) {
-            ERROR("Invalid target region coordinates (" << bd.seq << " " << bd.left << " " << bd.right + 1 << ")"
-                    << " right bound is lower than left bound!");
-            exit(1);
+    }
+
+    Probability share = total / max(regionCount, 1);
+    Probability cumulative = 0;
+
+    vector<vector<BedTarget> > regions(1);
+    int lastTarget = -1; // the target which the last piece of the current region came from
+    for (size_t i = 0; i < wholeTargets.size(); ++i) {
+        BedTarget& target = wholeTargets[i];
+        for (size_t j = 0; j < weights[i].size(); ++j) {
+            long int left = target.left + j * AUTO_REGION_BIN_SIZE;
+            long int right = min(left + AUTO_REGION_BIN_SIZE - 1, (long int) target.right);
+            vector<BedTarget>& region = regions.back();
+            if (lastTarget == (int) i && !region.empty()) {
+                region.back().right = right;
+            } else {
+                region.push_back(BedTarget(target.seq, left, right, target.desc));
+                lastTarget = i;
+            }
+            cumulative += byLength ? right - left + 1 : weights[i][j];
+            if (cumulative >= share * regions.size() && (int) regions.size() < regionCount) {
+                regions.push_back(vector<BedTarget>());
+            }
         }
     }
+    if (regions.back().empty()) {
+        regions.pop_back();
+    }
 
-    bedReader.buildIntervals(); // set up interval tree in the bedreader
+    DEBUG("split " << wholeTargets.size() << " targets into " << regions.size()
+          << " regions of about " << share << (byLength ? " bp" : " indexed bytes") << " each");
 
-    DEBUG("Number of target regions: " << targets.size());
+    return regions;
+
+}
+
+// true if the calls up to and including the current position can't depend on
+// anything after it, so that the targets may be split at the next position:
+// we aren't partway through a haplotype, and no registered alignment carrying
+// non-reference alleles reaches into the window over which alleles may be
+// merged into complex haplotypes around the split
+bool AlleleParser::atSafeSplitPosition(void) {
+
+    if (!currentTarget || lastHaplotypeLength > 1) {
+        return false;
+    }
+
+    long int windowStart = currentPosition + 1 - max(1, parameters.maxComplexGap + 1);
+    // registered alignments are keyed by their end position
+    for (PositionWindow<deque<RegisteredAlignment> >::iterator f
+             = registeredAlignments.lower_bound(max(0L, windowStart));
+         f != registeredAlignments.end(); ++f) {
+        for (deque<RegisteredAlignment>::iterator ra = f->second.begin(); ra != f->second.end(); ++ra) {
+            if (ra->alleleTypes & ~ALLELE_REFERENCE) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+
+}
+
+// the parts of our targets from position in the current target onwards
+vector<BedTarget> AlleleParser::remainingTargets(long int position) {
+
+    vector<BedTarget> tail;
+    if (!currentTarget) {
+        return tail;
+    }
+    if (position <= currentTarget->right) {
+        tail.push_back(BedTarget(currentTarget->seq, position, currentTarget->right, currentTarget->desc));
+    }
+    tail.insert(tail.end(), currentTarget + 1, &targets.front() + targets.size());
+    return tail;
+
+}
+
+// stops processing at position in the current target, returning the targets
+// which we will no longer process
+vector<BedTarget> AlleleParser::splitTargets(long int position) {
+
+    vector<BedTarget> tail = remainingTargets(position);
+    if (!currentTarget) {
+        return tail;
+    }
+
+    // currentTarget stays valid, as we only erase the targets after it
+    size_t current = currentTarget - &targets.front();
+    targets.erase(targets.begin() + current + 1, targets.end());
+    if (position <= currentTarget->right) {
+        currentTarget->right = position - 1;
+    }
+
+    bedReader.targets = targets;
+    bedReader.intervals.clear();
+    bedReader.buildIntervals();
+
+    return tail;
 
 }
 
@@ -836,7 +1305,13 @@ void AlleleParser::loadSampleCNVMap(void) {
 }
 
 int AlleleParser::currentSamplePloidy(string const& sample) {
-    return sampleCNV.ploidy(sample, currentSequenceName, currentPosition);
+    const vector<int>& ploidies = cnvCursor.ploidies(sampleCNV, currentSequenceName, currentPosition);
+    int id = run->sampleID(sample);
+    if (id < 0 || id >= ploidies.size()) {
+        // e.g. the reference sample
+        return sampleCNV.ploidy(sample, currentSequenceName, currentPosition);
+    }
+    return ploidies[id];
 }
 
 int AlleleParser::copiesOfLocus(Samples& samples) {
@@ -868,45 +1343,84 @@ bool AlleleParser::inTarget(void) {
     if (targets.empty()) {
         return true;  // everything is in target if we don't have targets
     } else {
-        // expects 0-based, fully-closed, and we're only checking a single
-        // base, so start == end.
-        if (bedReader.targetsOverlap(currentSequenceName, currentPosition, currentPosition)) {
-            return true;
-        } else {
-            return false;
-        }
+        // the position only moves on within a sequence, so the cursor
+        // rarely has to look further than the interval it last found
+        return targetCursor.contains(targetIndex, currentSequenceName, currentPosition);
     }
 }
 
-// initialization function
-// sets up environment so we can start registering alleles
-AlleleParser::AlleleParser(int argc, char** argv) : parameters(Parameters(argc,argv))
+// binds the parser to the run's shared state, and sets the initial state of
+// the parser's position and input flags
+AlleleParser::AlleleParser(shared_ptr<RunContext> context)
+    : run(context)
+    , parameters(run->parameters)
+    , sampleList(run->sampleList)
+    , sampleListFromBam(run->sampleListFromBam)
+    , sampleListFromVCF(run->sampleListFromVCF)
+    , samplePopulation(run->samplePopulation)
+    , populationSamples(run->populationSamples)
+    , readGroupToSampleNames(run->readGroupToSampleNames)
+    , readGroupToTechnology(run->readGroupToTechnology)
+    , sequencingTechnologies(run->sequencingTechnologies)
+    , sampleCNV(run->sampleCNV)
+    , oneSampleAnalysis(run->oneSampleAnalysis)
 {
 
-    oneSampleAnalysis = false;
+    prefetcher = NULL;
     currentRefID = 0; // will get set properly via toNextRefID
     currentPosition = 0;
     currentTarget = NULL; // to be initialized on first call to getNextAlleles
+    readerRegionEnd = 0;
     currentReferenceAllele = NULL; // same, NULL is brazenly used as an initialization flag
     justSwitchedTargets = false;  // flag to trigger cleanup of Allele*'s and objects after jumping targets
     hasMoreAlignments = true; // flag to track when we run out of alignments in the current target or BAM files
     currentSequenceStart = 0;
+    longestAlignment = 0;
     lastHaplotypeLength = 0;
+    haplotypeCostCapped = false;
+    memoryCutEnd = 0;
+    allelesRegistered = 0;
     usingHaplotypeBasisAlleles = false;
     usingVariantInputAlleles = false;
+    inputVariantRefID = -1;
+    inputVariantPosition = 0;
+    inputVariantsExhausted = true;
     rightmostHaplotypeBasisAllelePosition = 0;
     rightmostInputAllelePosition = 0;
     nullSample = new Sample();
     referenceSampleName = "reference_sample";
 
+}
+
+// initialization function
+// sets up environment so we can start registering alleles
+AlleleParser::AlleleParser(int argc, char** argv)
+    : AlleleParser(make_shared<RunContext>(argc, argv))
+{
+    openRun();
+}
+
+AlleleParser::AlleleParser(const Parameters& p)
+    : AlleleParser(make_shared<RunContext>(p))
+{
+    openRun();
+}
+
+void AlleleParser::openRun(void) {
+
     // initialization
     openOutputFile();
 
     loadFastaReference();
     // when we open the bam files we can use the number of targets to decide if
     // we should load the indexes
-    openBams();
-    loadBamReferenceSequenceNames();
+    if (parameters.jointLikelihoodFiles.empty()) {
+        openBams();
+        loadBamReferenceSequenceNames();
+    } else {
+        openLikelihoodDumps();
+        loadFastaReferenceSequenceNames();
+    }
     // check how many targets we have specified
     loadTargets();
     getSampleNames();
@@ -916,6 +1430,10 @@ AlleleParser::AlleleParser(int argc, char** argv) : parameters(Parameters(argc,a
     // sample CNV
     loadSampleCNVMap();
 
+    // the samples and read groups are now fixed
+    run->assignIDs();
+    sampleCNV.index(sampleList);
+
     // output
     setupVCFOutput();
 
@@ -927,8 +1445,32 @@ AlleleParser::AlleleParser(int argc, char** argv) : parameters(Parameters(argc,a
 
 }
 
+// sets up a parser over the targets given, sharing the sample, population,
+// technology and copy-number metadata which the run has already loaded
+AlleleParser::AlleleParser(const AlleleParser& other, const vector<BedTarget>& regionTargets)
+    : AlleleParser(other.run)
+{
+
+    // the run owns the output; parsers for individual regions don't write to it
+    output = other.output;
+
+    // each parser needs its own handles on the reference and alignments
+    loadFastaReference();
+    openBams();
+    loadBamReferenceSequenceNames();
+
+    setupVCFOutput();
+    setupVCFInput();
+
+    setTargets(regionTargets);
+
+}
+
 AlleleParser::~AlleleParser(void) {
 
+    // stop reading before the readers are closed
+    delete prefetcher;
+
     delete nullSample;
 
     // close trace file?  seems to get closed properly on object deletion...
@@ -1066,23 +1608,20 @@ void RegisteredAlignment::clumpAlleles(bool mergeComplex, int maxComplexGap, boo
         Allele& currAllele = alleles[i];
         Allele& nextAllele = alleles[i+1];
         if (!lastAllele.length || !currAllele.length || !nextAllele.length) continue;
-        vector<pair<int, string> > lastCigar = splitCigar(lastAllele.cigar);
-        vector<pair<int, string> > currCigar = splitCigar(currAllele.cigar);
-        vector<pair<int, string> > nextCigar = splitCigar(nextAllele.cigar);
-        string currFirstOp = currCigar.front().second;
-        string currLastOp = currCigar.back().second;
-        string lastLastOp = lastCigar.back().second;
-        string nextFirstOp = nextCigar.front().second;
-        if ((currFirstOp == "I" || currFirstOp == "D")
-            && (lastLastOp == "M" || lastLastOp == "X")) {
+        char currFirstOp = currAllele.cigar.front().op();
+        char currLastOp = currAllele.cigar.back().op();
+        char lastLastOp = lastAllele.cigar.back().op();
+        char nextFirstOp = nextAllele.cigar.front().op();
+        if ((currFirstOp == 'I' || currFirstOp == 'D')
+            && (lastLastOp == 'M' || lastLastOp == 'X')) {
             // split from the last onto curr
-            string seq; vector<pair<int, string> > cig; vector<short> quals;
+            string seq; Cigar cig; vector<short> quals;
             lastAllele.subtractFromEnd(1, seq, cig, quals);
             currAllele.addToStart(seq, cig, quals);
         }
-        if ((currLastOp == "I" || currLastOp == "D")
-            && (nextFirstOp == "M" || nextFirstOp == "X")) {
-            string seq; vector<pair<int, string> > cig; vector<short> quals;
+        if ((currLastOp == 'I' || currLastOp == 'D')
+            && (nextFirstOp == 'M' || nextFirstOp == 'X')) {
+            string seq; Cigar cig; vector<short> quals;
             nextAllele.subtractFromStart(1, seq, cig, quals);
             currAllele.addToEnd(seq, cig, quals);
             // split from the next onto curr
@@ -1098,6 +1637,19 @@ void RegisteredAlignment::clumpAlleles(bool mergeComplex, int maxComplexGap, boo
 // TODO erase alleles which are beyond N bp before the current position on position step
 void AlleleParser::updateHaplotypeBasisAlleles(long int pos, int referenceLength) {
     if (pos + referenceLength > rightmostHaplotypeBasisAllelePosition) {
+        if (haplotypeBasisIndex.is_open()) {
+            // the window covers the 1-based positions after the last one we fetched
+            vector<InputPrimitive> primitives;
+            haplotypeBasisIndex.fetch(currentSequenceName,
+                                      rightmostHaplotypeBasisAllelePosition + 1,
+                                      pos + referenceLength + CACHED_BASIS_HAPLOTYPE_WINDOW + 1,
+                                      primitives);
+            for (vector<InputPrimitive>::iterator p = primitives.begin(); p != primitives.end(); ++p) {
+                haplotypeBasisAlleles.add(p->position, p->ref, p->alt);
+            }
+            rightmostHaplotypeBasisAllelePosition = pos + referenceLength + CACHED_BASIS_HAPLOTYPE_WINDOW;
+            return;
+        }
         stringstream r;
         //r << currentSequenceName << ":" << rightmostHaplotypeBasisAllelePosition << "-" << pos + referenceLength + CACHED_BASIS_HAPLOTYPE_WINDOW;
         //cerr << "getting variants in " << r.str() << endl;
@@ -1129,7 +1681,7 @@ void AlleleParser::updateHaplotypeBasisAlleles(long int pos, int referenceLength
                         //cerr << v->ref << "/" << v->alt << endl;
                         if (v->ref != v->alt) {
                             //cerr << "basis allele " << v->position << " " << v->ref << "/" << v->alt << endl;
-                            haplotypeBasisAlleles[v->position].push_back(AllelicPrimitive(v->ref, v->alt));
+                            haplotypeBasisAlleles.add(v->position, v->ref, v->alt);
                             //cerr << "number of alleles at position " <<  haplotypeBasisAlleles[v->position].size() << endl;
                         }
                     }
@@ -1153,18 +1705,7 @@ bool AlleleParser::allowedHaplotypeBasisAllele(long int pos, string& ref, string
     if (!usingHaplotypeBasisAlleles) {
         return true; // always true if we aren't using the haplotype basis allele system
     } else {
-        map<long int, vector<AllelicPrimitive> >::iterator p = haplotypeBasisAlleles.find(pos);
-        if (p != haplotypeBasisAlleles.end()) {
-            vector<AllelicPrimitive>& alleles = p->second;
-            for (vector<AllelicPrimitive>::iterator z = alleles.begin(); z != alleles.end(); ++z) {
-                //cerr << "overlapping allele " << z->ref << ":" << z->alt << endl;
-                if (z->ref == ref && z->alt == alt) {
-                    //cerr << "yess" << endl;
-                    return true;
-                }
-            }
-        }
-        return false;
+        return haplotypeBasisAlleles.contains(pos, ref, alt);
     }
 
 }
@@ -1180,28 +1721,30 @@ Allele AlleleParser::makeAllele(RegisteredAlignment& ra,
                                 string& sampleName,
                                 BAMALIGN& alignment,
                                 string& sequencingTech,
-                                long double qual,
+                                Probability qual,
                                 string& qualstr
     ) {
 
-    string cigar;
+    Cigar cigar;
     int reflen = length;
 
     if (type == ALLELE_REFERENCE) {
-        cigar = convert(length) + "M";
+        cigar = Cigar(length, 'M');
     } else if (type == ALLELE_SNP || type == ALLELE_MNP) {
-        cigar = convert(length) + "X";
+        cigar = Cigar(length, 'X');
     } else if (type == ALLELE_INSERTION) {
         reflen = 0;
-        cigar = convert(length) + "I";
+        cigar = Cigar(length, 'I');
     } else if (type == ALLELE_DELETION) {
-        cigar = convert(length) + "D";
+        cigar = Cigar(length, 'D');
     } else if (type == ALLELE_NULL) {
-        cigar = convert(length) + "N";
+        cigar = Cigar(length, 'N');
     }
 
+    // only used for non-reference, non-null alleles, which avoids the soft
+    // clipping edge cases and copying out the long spans of reference matches
     string refSequence;
-    if (type != ALLELE_NULL) { // only used for non null allele, avoid soft clipping edge cases
+    if (type != ALLELE_NULL && type != ALLELE_REFERENCE) {
         refSequence = currentSequence.substr(pos - currentSequenceStart, reflen);
     }
 
@@ -1226,8 +1769,8 @@ Allele AlleleParser::makeAllele(RegisteredAlignment& ra,
                                         refSequence,
                                         readSequence)) {
         type = ALLELE_REFERENCE;
-        length = referenceLengthFromCigar(cigar);
-        cigar = convert(length) + "M";
+        length = cigar.referenceLength();
+        cigar = Cigar(length, 'M');
         // by adjusting the cigar, we implicitly adjust
         // allele.referenceLength, which is calculated when the allele is made
         qualstr = string(length, qualityInt2Char(0));
@@ -1244,12 +1787,7 @@ Allele AlleleParser::makeAllele(RegisteredAlignment& ra,
         } else if (type == ALLELE_DELETION) {
             alleleseq = refSequence;
         }
-        map<long int, map<string, int> >::iterator rc = cachedRepeatCounts.find(pos);
-        if (rc == cachedRepeatCounts.end()) {
-            cachedRepeatCounts[pos] = repeatCounts(pos - currentSequenceStart, currentSequence, 12);
-            rc = cachedRepeatCounts.find(pos);
-        }
-        map<string, int>& matchedRepeatCounts = rc->second;
+        map<string, int> matchedRepeatCounts = repeatCounts(pos, 12);
         for (map<string, int>::iterator r = matchedRepeatCounts.begin(); r != matchedRepeatCounts.end(); ++r) {
             const string& repeatunit = r->first;
             int rptcount = r->second;
@@ -1278,16 +1816,8 @@ Allele AlleleParser::makeAllele(RegisteredAlignment& ra,
         }
 
         // a dangerous game
-        int start = pos - currentSequenceStart;
-        double minEntropy = parameters.minRepeatEntropy;
-        while (minEntropy > 0 && // ignore if turned off
-               // don't run off the end of the current sequence
-               repeatRightBoundary - currentSequenceStart < currentSequence.size() &&
-               // there is no point in going past the alignment end
-               // because we won't make a haplotype call unless we have a covering observation from a read
-               repeatRightBoundary < alignment_end_pos &&
-               entropy(currentSequence.substr(start, repeatRightBoundary - pos)) < minEntropy) {
-            ++repeatRightBoundary;
+        if (parameters.minRepeatEntropy > 0) { // ignore if turned off
+            repeatRightBoundary = minEntropyBoundary(pos, repeatRightBoundary, alignment_end_pos);
         }
 
         // edge case, the indel is an insertion and matches the reference to the right
@@ -1297,9 +1827,11 @@ Allele AlleleParser::makeAllele(RegisteredAlignment& ra,
         }
     }
 
-    string qnamer = alignment.QNAME;
+    // nothing but the debugging output looks at the names of the reads, which
+    // would otherwise take more memory than the observations' bases
+    string qnamer = parameters.debug ? alignment.QNAME : string();
 
-    return Allele(type,
+    Allele allele(type,
                   currentSequenceName,
                   pos,
                   &currentPosition,
@@ -1314,7 +1846,7 @@ Allele AlleleParser::makeAllele(RegisteredAlignment& ra,
                   ra.readgroup,
                   sequencingTech,
                   !alignment.ISREVERSESTRAND,
-                  max(qual, (long double) 0), // ensure qual is at least 0
+                  max(qual, (Probability) 0), // ensure qual is at least 0
                   qualstr,
                   alignment.MAPPINGQUALITY,
                   alignment.ISPAIRED,
@@ -1324,20 +1856,162 @@ Allele AlleleParser::makeAllele(RegisteredAlignment& ra,
                   &ra.alleles,
                   alignment.POSITION,
                   alignment_end_pos);
+    allele.sampleIndex = ra.sampleIndex;
+    allele.readGroupIndex = ra.readGroupIndex;
+    return allele;
 
 }
 
-RegisteredAlignment& AlleleParser::registerAlignment(BAMALIGN& alignment, RegisteredAlignment& ra, string& sampleName, string& sequencingTech) {
+void AlignmentSequence::indexQualitySums(void) const {
+    if (!qualitySums.empty()) {
+        return;
+    }
+    qualitySums.resize(length + 1);
+    lastZero.resize(length);
+    qualitySums[0] = 0;
+    for (int i = 0; i < length; ++i) {
+        int q = quality(i);
+        qualitySums[i + 1] = qualitySums[i] + q;
+        lastZero[i] = q == 0 ? i : (i > 0 ? lastZero[i - 1] : -1);
+    }
+}
 
-    string rDna = alignment.QUERYBASES;
-    string rQual = alignment.QUALITIES;
-    if (qualityChar2LongDouble(rQual.at(0)) == -1) {
-        // force rQual to be 0
-        char q0 = qualityInt2Char(0);
-        for (size_t i = 0; i < rQual.size(); ++i) {
-            rQual[i] = q0;
+void AlignmentSequence::indexQualityMins(void) const {
+    if (!qualityMins.empty()) {
+        return;
+    }
+    qualityMins.push_back(vector<short>(length));
+    for (int i = 0; i < length; ++i) {
+        qualityMins[0][i] = quality(i);
+    }
+    for (int k = 1; (1 << k) <= length; ++k) {
+        qualityMins.push_back(vector<short>(length - (1 << k) + 1));
+        const vector<short>& half = qualityMins[k - 1];
+        vector<short>& mins = qualityMins[k];
+        for (size_t i = 0; i < mins.size(); ++i) {
+            mins[i] = min(half[i], half[i + (1 << (k - 1))]);
         }
     }
+}
+
+Probability AlignmentSequence::qualitySum(int pos, int len) const {
+    len = min(len, length - pos);
+    if (len <= 0) {
+        return 0;
+    }
+    indexQualitySums();
+    return qualitySums[pos + len] - qualitySums[pos];
+}
+
+Probability AlignmentSequence::qualityMin(int pos, int len) const {
+    len = min(len, length - pos);
+    if (len <= 0) {
+        return 0;
+    }
+    indexQualitySums();
+    indexQualityMins();
+    // minQuality starts over after a quality of 0, so only the qualities
+    // after the span's last 0 count, and it's 0 if that's the last of them
+    int end = pos + len - 1;
+    if (lastZero[end] == end) {
+        return 0;
+    }
+    int from = max(pos, lastZero[end] + 1);
+    int k = 0;
+    while ((2 << k) <= end - from + 1) {
+        ++k;
+    }
+    return min(qualityMins[k][from], qualityMins[k][end + 1 - (1 << k)]);
+}
+
+// true if any byte of the word is c
+static inline bool hasByte(uint64_t word, char c) {
+    uint64_t x = word ^ (0x0101010101010101ULL * (unsigned char) c);
+    return ((x - 0x0101010101010101ULL) & ~x & 0x8080808080808080ULL) != 0;
+}
+
+int AlignmentSequence::mismatches(int pos, const char* ref, int len, int minQuality) const {
+    int count = 0;
+    int i = 0;
+    // compare eight bases at a time, and look at the bases one by one only
+    // where the word differs from the reference or the reference has an N
+    for ( ; i + 8 <= len; i += 8) {
+        char b[8];
+        for (int j = 0; j < 8; ++j) {
+            b[j] = base(pos + i + j);
+        }
+        uint64_t bw, rw;
+        memcpy(&bw, b, 8);
+        memcpy(&rw, ref + i, 8);
+        if (bw == rw && !hasByte(rw, 'N')) {
+            continue;
+        }
+        for (int j = 0; j < 8; ++j) {
+            if ((b[j] != ref[i + j] || ref[i + j] == 'N') && quality(pos + i + j) >= minQuality) {
+                ++count;
+            }
+        }
+    }
+    for ( ; i < len; ++i) {
+        if ((base(pos + i) != ref[i] || ref[i] == 'N') && quality(pos + i) >= minQuality) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+// true if the alignment is over --read-mismatch-limit,
+// --read-max-mismatch-fraction, --read-snp-limit or --read-indel-limit
+//
+// this counts as registerAlignment does, but from the cigar and the bases
+// alone, so that the reads these drop are dropped before any of their alleles
+// are made.  the limits are checked again on the registered alignment.
+bool AlleleParser::overReadLimits(BAMALIGN& alignment) {
+
+    AlignmentSequence read(alignment);
+    int rp = 0;
+    int csp = currentSequencePosition(alignment);
+    int mismatches = 0;
+    int indels = 0;
+    CIGAR cigar = alignment.GETCIGAR;
+    for (CIGAR::const_iterator c = cigar.begin(); c != cigar.end(); ++c) {
+        int l = c->CIGLEN;
+        char t = c->CIGTYPE;
+        if (t == 'M' || t == 'X' || t == '=') {
+            // registerAlignment stops at the end of the read or the reference
+            int n = min(l, min(read.size() - rp, (int) currentSequence.size() - csp));
+            if (csp >= 0 && n > 0) {
+                mismatches += read.mismatches(rp, currentSequence.c_str() + csp, n, parameters.BQL2);
+            }
+            rp += l;
+            csp += l;
+        } else if (t == 'D') {
+            ++indels;
+            csp += l;
+        } else if (t == 'I') {
+            ++indels;
+            rp += l;
+        } else if (t == 'S') {
+            rp += l;
+        } else if (t == 'N') {
+            csp += l;
+        }
+    }
+
+    // each mismatch is also a snp
+    return ((float) mismatches / (float) alignment.SEQLEN) > parameters.readMaxMismatchFraction
+        || mismatches > parameters.RMU
+        || mismatches > parameters.readSnpLimit
+        || indels > parameters.readIndelLimit;
+
+}
+
+RegisteredAlignment& AlleleParser::registerAlignment(BAMALIGN& alignment, RegisteredAlignment& ra, string& sampleName, string& sequencingTech) {
+
+    // bases and qualities are read in place; qualities are 0 if the record has none
+    AlignmentSequence read(alignment);
+    ra.sampleIndex = run->sampleID(sampleName);
+    ra.readGroupIndex = run->readGroupID(ra.readgroup);
     int rp = 0;  // read position, 0-based relative to read
     int csp = currentSequencePosition(alignment); // current sequence position, 0-based relative to currentSequence
     int sp = alignment.POSITION;  // sequence position
@@ -1376,7 +2050,7 @@ RegisteredAlignment& AlleleParser::registerAlignment(BAMALIGN& alignment, Regist
 
         DEBUG2("current sequence pointer: " << csp);
 
-        DEBUG2("read:          " << rDna);
+        DEBUG2("read:          " << alignment.QUERYBASES);
         DEBUG2("aligned bases: " << alignment.QUERYBASES);
         DEBUG2("qualities:     " << alignment.QUALITIES);
         DEBUG2("reference seq: " << currentSequence.substr(csp, alignment.ALIGNEDBASES));
@@ -1433,27 +2107,21 @@ RegisteredAlignment& AlleleParser::registerAlignment(BAMALIGN& alignment, Regist
             for (int i=0; i<l; i++) {
 
                 // extract aligned base
-                string b;
-                try {
-                    b = rDna.at(rp);
-                } catch (const std::out_of_range& outOfRange) {
+                if (rp >= read.size()) {
                     cerr << "Exception: Cannot read past the end of the alignment's sequence." << endl
                          << alignment.QNAME << endl
                          << currentSequenceName << ":" << (long unsigned int) currentPosition + 1 << endl
-		      //<< alignment.AlignedBases << endl
                          << currentSequence.substr(csp, alignment.ALIGNEDBASES) << endl;
-		    cerr << " RP " << rp << " " << rDna  <<" len " << rDna.length() <<  std::endl;
+                    cerr << " RP " << rp << " " << alignment.QUERYBASES << " len " << read.size() << std::endl;
                     abort();
                 }
+                char b = read.base(rp);
 
                 // convert base quality value into short int
-                long double qual = qualityChar2LongDouble(rQual.at(rp));
+                Probability qual = qualityChar2LongDouble(read.qualityChar(rp));
 
                 // get reference allele
-                string sb;
-                try {
-                    sb = currentSequence.at(csp);
-                } catch (const std::out_of_range& outOfRange) {
+                if (csp < 0 || csp >= (int) currentSequence.size()) {
                     cerr << "Exception: Alignment reports a match past the end of the current reference sequence." << endl
                          << "This suggests alignment corruption or a mismatch between this reference and the alignments." << endl
                          << "Are you sure that you are calling against the same reference you aligned to?" << endl
@@ -1461,13 +2129,14 @@ RegisteredAlignment& AlleleParser::registerAlignment(BAMALIGN& alignment, Regist
                          << "Alignment: " << alignment.QNAME << " @ " << alignment.POSITION << "-" << alignment.ENDPOSITION << endl;
                     break;
                 }
+                char sb = currentSequence[csp];
 
                 // record mismatch if we have a mismatch here
-                if (b != sb || sb == "N") {  // when the reference is N, we should always call a mismatch
+                if (b != sb || sb == 'N') {  // when the reference is N, we should always call a mismatch
                     if (firstMatch < csp) {
                         int length = csp - firstMatch;
-                        string readSequence = rDna.substr(rp - length, length);
-                        string qualstr = rQual.substr(rp - length, length);
+                        string readSequence = read.bases(rp - length, length);
+                        string qualstr = read.qualities(rp - length, length);
                         // record 'reference' allele for last matching region
                         if (allATGC(readSequence)) {
                             ra.addAllele(
@@ -1507,10 +2176,10 @@ RegisteredAlignment& AlleleParser::registerAlignment(BAMALIGN& alignment, Regist
                 } else if (inMismatch) {
                     inMismatch = false;
                     int length = csp - mismatchStart;
-                    string readSequence = rDna.substr(rp - length, length);
-                    string qualstr = rQual.substr(rp - length, length);
+                    string readSequence = read.bases(rp - length, length);
+                    string qualstr = read.qualities(rp - length, length);
                     for (int j = 0; j < length; ++j) {
-                        long double lqual = qualityChar2LongDouble(qualstr.at(j));
+                        Probability lqual = qualityChar2LongDouble(qualstr.at(j));
                         string qualp = qualstr.substr(j, 1);
                         string rs = readSequence.substr(j, 1);
                         if (allATGC(rs)) {
@@ -1559,10 +2228,10 @@ RegisteredAlignment& AlleleParser::registerAlignment(BAMALIGN& alignment, Regist
             if (inMismatch) {
                 inMismatch = false;
                 int length = csp - mismatchStart;
-                string readSequence = rDna.substr(rp - length, length);
-                string qualstr = rQual.substr(rp - length, length);
+                string readSequence = read.bases(rp - length, length);
+                string qualstr = read.qualities(rp - length, length);
                 for (int j = 0; j < length; ++j) {
-                    long double lqual = qualityChar2LongDouble(qualstr.at(j));
+                    Probability lqual = qualityChar2LongDouble(qualstr.at(j));
                     string qualp = qualstr.substr(j, 1);
                     string rs = readSequence.substr(j, 1);
                     if (allATGC(rs)) {
@@ -1604,8 +2273,8 @@ RegisteredAlignment& AlleleParser::registerAlignment(BAMALIGN& alignment, Regist
             } else if (firstMatch < csp) {
                 int length = csp - firstMatch;
                 //string matchingSequence = currentSequence.substr(csp - length, length);
-                string readSequence = rDna.substr(rp - length, length);
-                string qualstr = rQual.substr(rp - length, length);
+                string readSequence = read.bases(rp - length, length);
+                string qualstr = read.qualities(rp - length, length);
                 if (allATGC(readSequence)) {
                     ra.addAllele(
                         makeAllele(ra,
@@ -1638,8 +2307,8 @@ RegisteredAlignment& AlleleParser::registerAlignment(BAMALIGN& alignment, Regist
             // upon
             int L = l + 2;
 
-            if (L > rQual.size()) {
-                L = rQual.size();
+            if (L > read.size()) {
+                L = read.size();
                 spanstart = 0;
             } else {
                 // set lower bound to 0
@@ -1649,28 +2318,26 @@ RegisteredAlignment& AlleleParser::registerAlignment(BAMALIGN& alignment, Regist
                     spanstart = rp - (L / 2);
                 }
                 // set upper bound to the string length
-                if (spanstart + L > rQual.size()) {
-                    spanstart = rQual.size() - L;
+                if (spanstart + L > read.size()) {
+                    spanstart = read.size() - L;
                 }
             }
 
-            string qualstr = rQual.substr(spanstart, L);
-
-            long double qual;
+            Probability qual;
             if (parameters.useMinIndelQuality) {
-                qual = minQuality(qualstr);
+                qual = read.qualityMin(spanstart, L);
                 //qual = averageQuality(qualstr);
             } else {
                 // quality, scaled inversely by the ratio between the quality
                 // string length and the length of the event
-                qual = sumQuality(qualstr);
+                qual = read.qualitySum(spanstart, L);
                 // quality adjustment:
                 // scale the quality by the inverse harmonic sum of the length of
                 // the quality string X a scaling constant derived from the ratio
                 // between the length of the quality string and the length of the
                 // allele
-                //qual += ln2phred(log((long double) l / (long double) L));
-                qual += ln2phred(log((long double) L / (long double) l));
+                //qual += ln2phred(log((Probability) l / (Probability) L));
+                qual += ln2phred(log((Probability) L / (Probability) l));
                 qual /= harmonicSum(l);
             }
 
@@ -1678,8 +2345,7 @@ RegisteredAlignment& AlleleParser::registerAlignment(BAMALIGN& alignment, Regist
             // some aligners like to report deletions at the beginnings and ends of reads.
             // without any sequence in the read to support this, it is hard to believe
             // that these deletions are real, so we ignore them here.
-	      CIGAR cigar = alignment.GETCIGAR;
-	      if (cigarIter != cigar.begin()      // guard against deletion at beginning
+            if (cigarIter != cigar.begin()      // guard against deletion at beginning
               && (cigarIter+1) != cigar.end() // and against deletion at end
               && allATGC(refseq)) {
                 string nullstr;
@@ -1706,7 +2372,7 @@ RegisteredAlignment& AlleleParser::registerAlignment(BAMALIGN& alignment, Regist
 
         } else if (t == 'I') { // insertion
 
-            //string qualstr = rQual.substr(rp, l);
+            //string qualstr = read.qualities(rp, l);
             int spanstart;
 
             // this is used to calculate the quality string adding 2bp grounds
@@ -1714,8 +2380,8 @@ RegisteredAlignment& AlleleParser::registerAlignment(BAMALIGN& alignment, Regist
             // upon
             int L = l + 2;
 
-            if (L > rQual.size()) {
-                L = rQual.size();
+            if (L > read.size()) {
+                L = read.size();
                 spanstart = 0;
             } else {
                 // set lower bound to 0
@@ -1725,34 +2391,32 @@ RegisteredAlignment& AlleleParser::registerAlignment(BAMALIGN& alignment, Regist
                     spanstart = rp - 1;
                 }
                 // set upper bound to the string length
-                if (spanstart + L > rQual.size()) {
-                    spanstart = rQual.size() - L;
+                if (spanstart + L > read.size()) {
+                    spanstart = read.size() - L;
                 }
             }
 
-            string qualstr = rQual.substr(spanstart, L);
-
-            long double qual;
+            Probability qual;
             if (parameters.useMinIndelQuality) {
-                qual = minQuality(qualstr);
+                qual = read.qualityMin(spanstart, L);
                 //qual = averageQuality(qualstr); // does not work as well as the min
             } else {
                 // quality, scaled inversely by the ratio between the quality
                 // string length and the length of the event
-                qual = sumQuality(qualstr);
+                qual = read.qualitySum(spanstart, L);
                 // quality adjustment:
                 // scale the quality by the inverse harmonic sum of the length of
                 // the quality string X a scaling constant derived from the ratio
                 // between the length of the quality string and the length of the
                 // allele
-                //qual += ln2phred(log((long double) l / (long double) L));
-                qual += ln2phred(log((long double) L / (long double) l));
+                //qual += ln2phred(log((Probability) l / (Probability) L));
+                qual += ln2phred(log((Probability) L / (Probability) l));
                 qual /= harmonicSum(l);
             }
 
-            string readseq = rDna.substr(rp, l);
+            string readseq = read.bases(rp, l);
             if (allATGC(readseq)) {
-                string qualstr = rQual.substr(rp, l);
+                string qualstr = read.qualities(rp, l);
                 ra.addAllele(
                     makeAllele(ra,
                                ALLELE_INSERTION,
@@ -1778,8 +2442,8 @@ RegisteredAlignment& AlleleParser::registerAlignment(BAMALIGN& alignment, Regist
             if (sp - l < 0) {
                 // nothing to do, soft clip is beyond the beginning of the reference
             } else {
-                string qualstr = rQual.substr(rp, l);
-                string readseq = alignment.QUERYBASES.substr(rp, l);
+                string qualstr = read.qualities(rp, l);
+                string readseq = read.bases(rp, l);
                 // skip these bases in the read
                 ra.addAllele(
                     makeAllele(ra,
@@ -1841,8 +2505,8 @@ RegisteredAlignment& AlleleParser::registerAlignment(BAMALIGN& alignment, Regist
     if (parameters.trimComplexTail) {
       // Simplify complex final alleles by splitting off any trailing reference matches
       Allele& lastAllele = ra.alleles.back();
-      vector< pair<int, string> > lastCigar = splitCigar(lastAllele.cigar);
-      if (lastAllele.isComplex() && lastCigar.back().second == "M") {
+      CigarElement lastElement = lastAllele.cigar.back();
+      if (lastAllele.isComplex() && lastElement.op() == 'M') {
         DEBUG2("registerAlignment: trimming reference matches from end of final complex allele");
         // FIXME TODO: The allele may not actually be complex
         // anymore after splitting, in which case we should demote
@@ -1850,8 +2514,8 @@ RegisteredAlignment& AlleleParser::registerAlignment(BAMALIGN& alignment, Regist
         // -trs, 23 Jan 2015
         ra.alleles.push_back(lastAllele);
         Allele& pAllele = ra.alleles.at(ra.alleles.size() - 2);
-        string seq; vector<pair<int, string> > cig; vector<short> quals;
-        pAllele.subtractFromEnd(lastCigar.back().first, seq, cig, quals);
+        string seq; Cigar cig; vector<short> quals;
+        pAllele.subtractFromEnd(lastElement.length(), seq, cig, quals);
         ra.alleles.back().subtractFromStart(pAllele.referenceLength, seq, cig, quals);
       }
     }
@@ -1961,9 +2625,6 @@ void AlleleParser::updateAlignmentQueue(long int position,
            << "; currentSequenceStart = " << currentSequenceStart
            << "; currentSequence end = " << currentSequence.size() + currentSequenceStart);
 
-    // make sure we have sequence for the *first* alignment
-    //extendReferenceSequence(currentAlignment);
-
     // push to the front until we get to an alignment that doesn't overlap our
     // current position or we reach the end of available alignments
     // filter input reads; only allow mapped reads with a certain quality
@@ -1974,191 +2635,658 @@ void AlleleParser::updateAlignmentQueue(long int position,
            << " .. + currentSequence.size() == " << currentSequenceStart + currentSequence.size()
         );
 
-    uint64_t currentAlignment_end_position = 0;
-
     if (hasMoreAlignments
         && currentAlignment.POSITION <= position
         && currentAlignment.REFID == currentRefID) {
         do {
             DEBUG2("top of alignment parsing loop");
             DEBUG("alignment: " << currentAlignment.QNAME);
-            // get read group, and map back to a sample name
-            string readGroup;
-#ifdef HAVE_BAMTOOLS
-            if (!currentAlignment.GetTag("RG", readGroup)) {
-#else
-	      currentAlignment.GetZTag("RG", readGroup);
-	    if (readGroup.empty()) {
-#endif
-                if (!oneSampleAnalysis) {
-                    ERROR("Couldn't find read group id (@RG tag) for BAM Alignment " <<
-                          currentAlignment.QNAME << " at " << currentSequenceName << ":"
-                          << position + 1 << " EXITING!");
-                    exit(1);
-                } else {
-                    readGroup = "unknown";
-                }
+            // alignments failing the read filters, and those with low mapping
+            // quality, have already been skipped by getNextAlignment
+            if (parameters.limitCoverage > 0 || run->memoryBudget.enabled()) {
+                deferAlignment();
             } else {
-                if (oneSampleAnalysis) {
-                    ERROR("No read groups specified in BAM header, but alignment " <<
-                          currentAlignment.QNAME << " at " << currentSequenceName << ":"
-                          << position + 1 << " has a read group.");
-                    exit(1);
-                }
+                addAlignment(currentAlignment, currentSampleName, currentSequencingTech,
+                             position, newAlleles, gettingPartials);
             }
+        } while ((hasMoreAlignments = getNextAlignment())
+                 && currentAlignment.POSITION <= position
+                 && currentAlignment.REFID == currentRefID);
+    }
+
+    if (!splicedBlocks.empty()) {
+        updateExonBlocks(position, newAlleles);
+    }
+
+    // every alignment starting at or before the position has now been read
+    if (!deferredAlignments.empty()) {
+        downsampleDeferredAlignments(position, newAlleles, gettingPartials);
+    }
+
+    DEBUG2("... finished pushing new alignments");
 
-            // skip this alignment if we are not analyzing the sample it is drawn from
-            if (readGroupToSampleNames.find(readGroup) == readGroupToSampleNames.end()) {
-                ERROR("could not find sample matching read group id " << readGroup);
+}
+
+// the reference spans skipped by the N operations of the alignment, in order
+static void referenceSkips(BAMALIGN& alignment, vector<pair<long int, long int> >& skips) {
+    long int sp = alignment.POSITION;
+    CIGAR cigar = alignment.GETCIGAR;
+    for (CIGAR::const_iterator c = cigar.begin(); c != cigar.end(); ++c) {
+        char t = c->CIGTYPE;
+        if (t == 'N') {
+            skips.push_back(make_pair(sp, sp + (long int) c->CIGLEN));
+        }
+        if (t == 'M' || t == 'X' || t == '=' || t == 'D' || t == 'N') {
+            sp += c->CIGLEN;
+        }
+    }
+}
+
+// registers the alignment and adds its alleles to newAlleles, returning false
+// if it was out of order, skipped for --skip-coverage, or dropped by the read
+// filters which need its alleles
+bool AlleleParser::addAlignment(BAMALIGN& alignment, string& sampleName, string& sequencingTech,
+                                long int position, vector<Allele*>& newAlleles, bool gettingPartials) {
+
+    uint64_t alignmentEnd = alignment.ENDPOSITION; // cache, as this is dynamically computed
+    if (!gettingPartials && alignmentEnd < position) {
+        cerr << alignment.QNAME << " at " << currentSequenceName << ":" << alignment.POSITION << " is out of order!"
+             << " expected after " << position << endl;
+        return false;
+    }
+
+    // otherwise, register the alignment to generate a sequence of alleles
+    // we have to register the alignment to acquire some information required by filters
+    // such as mismatches
+
+    // extend our cached reference sequence to allow processing of this alignment
+    longestAlignment = max(longestAlignment, (long int) (alignmentEnd - alignment.POSITION + 1));
+    extendReferenceSequence(alignment.POSITION, alignmentEnd + 1);
+    // left realign indels
+    // reads without indels have nothing to realign
+    if (parameters.leftAlignIndels && hasIndels(alignment)) {
+        leftAlignCache.stablyLeftAlign(alignment, currentSequence, currentSequenceStart);
+    }
+    // the introns of a spliced read
+    vector<pair<long int, long int> > skips;
+    referenceSkips(alignment, skips);
+    // do we exceed coverage anywhere?
+    // do we touch anything where we had exceeded coverage?
+    // if so skip this read, and mark and remove processed alignments and registered alleles overlapping the coverage capped position
+    bool considerAlignment = true;
+    if (parameters.skipCoverage > 0) {
+        vector<pair<long int, long int> >::iterator skip = skips.begin();
+        for (unsigned long int i =  alignment.POSITION; i < alignmentEnd; ++i) {
+            // the read doesn't cover its introns
+            if (skip != skips.end() && (long int) i >= skip->first) {
+                i = skip->second - 1;
+                ++skip;
                 continue;
             }
+            PositionCoverage& c = coverage[i];
+            unsigned long int x = ++c.count;
+            if (x > parameters.skipCoverage && !gettingPartials) {
+                considerAlignment = false;
+                // we're exceeding coverage at this position for the first time, so clean up
+                if (!c.skipped) {
+                    // clean up reads overlapping this position
+                    removeCoverageSkippedAlleles(registeredAlleles, i);
+                    registeredAlleleIndex.invalidate();
+                    removeCoverageSkippedAlleles(newAlleles, i);
+                    // remove the alignments overlapping this position
+                    removeRegisteredAlignmentsOverlappingPosition(i);
+                    // record that the position is capped
+                    c.skipped = true;
+                }
+            }
+        }
+    }
+    // decomposes alignment into a set of alleles
+    // here we get the deque of alignments ending at this alignment's end position
+    deque<RegisteredAlignment>& rq = registeredAlignments[alignmentEnd];
+    //cerr << "parameters capcoverage " << parameters.capCoverage << " " << rq.size() << endl;
+    if (considerAlignment) {
+        // drop reads over the mismatch and indel limits before making their
+        // alleles, when the limits are low enough to drop any
+        if ((parameters.readMaxMismatchFraction < 1.0
+             || parameters.RMU < alignment.SEQLEN
+             || parameters.readSnpLimit < alignment.SEQLEN
+             || parameters.readIndelLimit < alignment.SEQLEN)
+            && overReadLimits(alignment)) {
+            return false;
+        }
+        // and insert the registered alignment into that deque
+        rq.push_front(RegisteredAlignment(alignment));
+        RegisteredAlignment& ra = rq.front();
+        if (parameters.debug) {
+            ra.name = alignment.QNAME;
+        }
+        alleleVectorPool.take(ra.alleles);
+        registerAlignment(alignment, ra, sampleName, sequencingTech);
+        // backtracking if we have too many mismatches
+        // or if there are no recorded alleles
+        if (ra.alleles.empty()
+            || ((float) ra.mismatches / (float) alignment.SEQLEN) > parameters.readMaxMismatchFraction
+            || ra.mismatches > parameters.RMU
+            || ra.snpCount > parameters.readSnpLimit
+            || ra.indelCount > parameters.readIndelLimit) {
+            alleleVectorPool.recycle(ra.alleles);
+            rq.pop_front(); // backtrack
+            return false;
+        } else if (!skips.empty()) {
+            registerExonBlocks(rq, skips, position, newAlleles);
+        } else {
+            if (parameters.mergeOverlappingMates && fuseWithMate(ra, alignment) && ra.alleles.empty()) {
+                // every base of the read was its mate's too
+                alleleVectorPool.recycle(ra.alleles);
+                rq.pop_front();
+                return true;
+            }
+            addObservedAlleles(ra, newAlleles);
+        }
+    }
+    return considerAlignment;
 
-            // skip this alignment if we are not using duplicate reads (we remove them by default)
-            if (currentAlignment.ISDUPLICATE && !parameters.useDuplicateReads) {
-                DEBUG("skipping alignment " << currentAlignment.QNAME << " because it is a duplicate read");
-                continue;
+}
+
+// pushes the alleles of the registered alignment into our new alleles vector
+void AlleleParser::addObservedAlleles(RegisteredAlignment& ra, vector<Allele*>& newAlleles) {
+    allelesRegistered += ra.alleles.size();
+    for (vector<Allele>::iterator allele = ra.alleles.begin(); allele != ra.alleles.end(); ++allele) {
+        newAlleles.push_back(&*allele);
+        if (!allele->isReference() && !allele->isNull() && allele->quality >= parameters.BQL0) {
+            nonReferencePositions[allele->position].add(*allele);
+        }
+    }
+}
+
+// splits the spliced read registered at the front of rq into its exon blocks
+//
+// each block is registered as an alignment of its own, keyed by where the
+// block ends, from the position it starts at; the blocks ahead of the
+// position wait in splicedBlocks until we reach them.  so the read is in the
+// window only where it has bases, and the window isn't stretched over its
+// introns.  the read's filters have already been applied to it as a whole,
+// and alleles merged across a short skip stay with the block they start in.
+void AlleleParser::registerExonBlocks(deque<RegisteredAlignment>& rq, vector<pair<long int, long int> >& skips,
+                                      long int position, vector<Allele*>& newAlleles) {
+
+    vector<Allele> alleles;
+    alleles.swap(rq.front().alleles);
+    RegisteredAlignment read = rq.front();
+    rq.pop_front();
+
+    vector<Allele>::iterator a = alleles.begin();
+    for (size_t k = 0; k <= skips.size() && a != alleles.end(); ++k) {
+        // the block runs up to the k-th skip, and takes the alleles starting before its end
+        vector<Allele>::iterator b = a;
+        long int blockEnd = 0;
+        while (b != alleles.end() && (k == skips.size() || b->position < skips[k].second)) {
+            blockEnd = max(blockEnd, b->position + (long int) b->referenceLength);
+            ++b;
+        }
+        if (b == a) {
+            continue;
+        }
+        long int blockStart = a->position;
+        deque<RegisteredAlignment>& bq = blockStart <= position
+            ? registeredAlignments[blockEnd] : splicedBlocks[blockStart];
+        bq.push_front(read);
+        RegisteredAlignment& block = bq.front();
+        alleleVectorPool.take(block.alleles);
+        block.alleles.assign(a, b);
+        block.start = blockStart;
+        block.end = blockEnd;
+        a = b;
+        if (blockStart <= position) {
+            addObservedAlleles(block, newAlleles);
+        }
+    }
+    alleleVectorPool.recycle(alleles);
+
+}
+
+// registers the waiting exon blocks of spliced reads which start at or before the position
+void AlleleParser::updateExonBlocks(long int position, vector<Allele*>& newAlleles) {
+    map<long int, deque<RegisteredAlignment> >::iterator s = splicedBlocks.begin();
+    while (s != splicedBlocks.end() && s->first <= position) {
+        for (deque<RegisteredAlignment>::iterator b = s->second.begin(); b != s->second.end(); ++b) {
+            vector<Allele> alleles;
+            alleles.swap(b->alleles);
+            deque<RegisteredAlignment>& bq = registeredAlignments[b->end];
+            bq.push_front(*b);
+            bq.front().alleles.swap(alleles);
+            addObservedAlleles(bq.front(), newAlleles);
+        }
+        splicedBlocks.erase(s++);
+    }
+}
+
+// the splitmix64 finalizer, which spreads every bit of x over the result
+static uint64_t splitmix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// an arbitrary but fixed order of the reads of each sample, as a random draw
+// keyed by --random-seed, the sample and the read name.  it depends on nothing
+// of the run, such as the threads or where the regions split, and it leaves
+// out the position so that the mates of a pair rank alike.  they aren't
+// always kept or dropped together, though: each is weighed against the
+// coverage where it starts, which may have room for one and not the other.
+static uint64_t readPriority(const string& sample, const string& name, uint64_t seed) {
+    return splitmix64(fnv1a(name) ^ splitmix64(fnv1a(sample) ^ splitmix64(seed)));
+}
+
+// --merge-overlapping-mates: where the mates of a fragment overlap, they read
+// the same bases of the same molecule, so rather than count those bases
+// twice the second mate leaves the overlap to the first.  the reference and
+// SNP observations of the first over the overlap take the quality of the
+// second too, the sum (up to MATE_OVERLAP_MAX_QUALITY) where the mates agree
+// and the difference (down to 0) where they don't.  the second's reference
+// observation running past the overlap is cut back to it, and any other
+// reaching past it is kept whole.
+//
+// a read whose mate starts within it waits in overlappingMates, by a key of
+// its sample and name, until the mate comes or it leaves the window.  returns
+// true if the read was the second of such a pair, and its overlap is dropped.
+bool AlleleParser::fuseWithMate(RegisteredAlignment& ra, BAMALIGN& alignment) {
+
+    if (!alignment.ISPAIRED || !alignment.ISMATEMAPPED || alignment.MATEREFID != alignment.REFID) {
+        return false;
+    }
+    uint64_t key = splitmix64(fnv1a(alignment.QNAME) ^ splitmix64(ra.sampleIndex + 1));
+    long int start = alignment.POSITION;
+    long int mateStart = alignment.MATEPOSITION;
+    map<uint64_t, RegisteredAlignment*>::iterator m = overlappingMates.find(key);
+    if (m == overlappingMates.end()
+        || m->second->mateStart != start || (long int) m->second->start != mateStart) {
+        if (m == overlappingMates.end() && mateStart >= start && mateStart < (long int) ra.end) {
+            ra.mateKey = key;
+            ra.mateStart = mateStart;
+            overlappingMates[key] = &ra;
+        }
+        return false;
+    }
+    RegisteredAlignment& first = *m->second;
+    forgetMate(first);
+
+    long int overlapStart = start;
+    long int overlapEnd = min((long int) first.end, (long int) ra.end);
+    if (overlapEnd <= overlapStart) {
+        return false;
+    }
+
+    // the bases of the second mate over the overlap, '=' where it reads the
+    // reference and ' ' where it has no base to compare
+    size_t span = overlapEnd - overlapStart;
+    string bases(span, ' ');
+    vector<short> quals(span, 0);
+    for (vector<Allele>::iterator a = ra.alleles.begin(); a != ra.alleles.end(); ++a) {
+        if (a->type != ALLELE_REFERENCE && a->type != ALLELE_SNP && a->type != ALLELE_MNP) {
+            continue;
+        }
+        for (size_t k = 0; k < a->referenceLength && k < a->baseQualities.size(); ++k) {
+            long int p = a->position + k;
+            if (p >= overlapStart && p < overlapEnd) {
+                bases[p - overlapStart] = a->type == ALLELE_REFERENCE ? '=' : a->alternateSequence[k];
+                quals[p - overlapStart] = a->baseQualities[k];
             }
+        }
+    }
 
-            // skip unmapped alignments, as they cannot be used in the algorithm
-            if (!currentAlignment.ISMAPPED) {
-                DEBUG("skipping alignment " << currentAlignment.QNAME << " because it is not mapped");
+    for (vector<Allele>::iterator a = first.alleles.begin(); a != first.alleles.end(); ++a) {
+        if (a->type != ALLELE_REFERENCE && a->type != ALLELE_SNP) {
+            continue;
+        }
+        for (size_t k = 0; k < a->referenceLength && k < a->baseQualities.size(); ++k) {
+            long int p = a->position + k;
+            if (p < overlapStart || p >= overlapEnd || bases[p - overlapStart] == ' ') {
                 continue;
             }
+            char base = a->type == ALLELE_REFERENCE ? '=' : a->alternateSequence[k];
+            int q = a->baseQualities[k];
+            int mateq = quals[p - overlapStart];
+            a->baseQualities[k] = base == bases[p - overlapStart]
+                ? min(q + mateq, MATE_OVERLAP_MAX_QUALITY) : max(q - mateq, 0);
+        }
+        // reference observations take their quality from the bases as they're used
+        if (a->type == ALLELE_SNP) {
+            int oldQuality = a->quality;
+            a->quality = a->baseQualities.front();
+            a->lnquality = phred2ln(a->quality);
+            retallyAlternate(*a, oldQuality);
+        }
+    }
 
-            // skip alignments which have no aligned bases
-            if (currentAlignment.ALIGNEDBASES == 0) {
-                DEBUG("skipping alignment " << currentAlignment.QNAME << " because it has no aligned bases");
+    // drop the overlap from the second mate
+    size_t kept = 0;
+    for (size_t i = 0; i < ra.alleles.size(); ++i) {
+        Allele& a = ra.alleles[i];
+        if (a.position < overlapEnd) {
+            if (a.position + (long int) a.referenceLength <= overlapEnd) {
                 continue;
             }
+            if (a.type == ALLELE_REFERENCE) {
+                string seq;
+                Cigar cigar;
+                vector<short> qualities;
+                a.subtractFromStart(overlapEnd - a.position, seq, cigar, qualities);
+            }
+        }
+        if (kept != i) {
+            ra.alleles[kept] = a;
+        }
+        ++kept;
+    }
+    ra.alleles.erase(ra.alleles.begin() + kept, ra.alleles.end());
+    if (!ra.alleles.empty()) {
+        ra.start = ra.alleles.front().position;
+    }
+    return true;
+
+}
+
+// addObservedAlleles tallied the alternate at its old quality, before its
+// mate was fused into it
+void AlleleParser::retallyAlternate(const Allele& allele, int oldQuality) {
+    bool counted = oldQuality >= parameters.BQL0;
+    bool counts = allele.quality >= parameters.BQL0;
+    // the tallies behind the current position are gone
+    if ((!counted && !counts) || allele.position < currentPosition) {
+        return;
+    }
+    AlternateEvidence& evidence = nonReferencePositions[allele.position];
+    if (counted) {
+        evidence.add(allele, oldQuality, -1);
+    }
+    if (counts) {
+        evidence.add(allele, allele.quality, 1);
+    }
+}
+
+// drops the read from those waiting for an overlapping mate
+void AlleleParser::forgetMate(RegisteredAlignment& ra) {
+    if (!ra.mateKey) {
+        return;
+    }
+    map<uint64_t, RegisteredAlignment*>::iterator m = overlappingMates.find(ra.mateKey);
+    if (m != overlappingMates.end() && m->second == &ra) {
+        overlappingMates.erase(m);
+    }
+    ra.mateKey = 0;
+}
+
+// holds the current alignment back for --limit-coverage or --max-memory
+void AlleleParser::deferAlignment(void) {
+    deferredAlignments.push_back(DeferredAlignment());
+    DeferredAlignment& d = deferredAlignments.back();
+    // with htslib, this shares the record, which the reader doesn't reuse
+    d.alignment = currentAlignment;
+    d.sampleName = currentSampleName;
+    d.sequencingTech = currentSequencingTech;
+    d.priority = readPriority(d.sampleName, d.alignment.QNAME, parameters.randomSeed);
+}
+
+// --limit-coverage, as the alignments are read: of the alignments of each
+// sample which start at a position, we keep the ones first in the order of
+// readPriority until the sample's kept alignments reach the limit over the
+// position, and drop the rest before they are broken into alleles.  as the
+// kept alignments end, their places go to alignments starting later, so no
+// position is covered by more than the limit, and the work done over deep
+// regions goes with the limit rather than the depth.
+//
+// with --max-memory, the alignments are always held back so, and while the
+// run is pressed for memory they are kept to MEMORY_PRESSURE_COVERAGE.
+// memoryCutEnd records how far the alignments which only the pressure
+// dropped reach, so the records they would have covered can be flagged.
+void AlleleParser::downsampleDeferredAlignments(long int position, vector<Allele*>& newAlleles, bool gettingPartials) {
+
+    size_t unpressedLimit = parameters.limitCoverage > 0 ? parameters.limitCoverage : (size_t) -1;
+    size_t limit = unpressedLimit;
+    if (run->memoryBudget.pressed()) {
+        limit = min(limit, (size_t) MEMORY_PRESSURE_COVERAGE);
+    }
+
+    vector<bool> keep(deferredAlignments.size(), false);
+    size_t i = 0;
+    while (i < deferredAlignments.size()) {
+        // the alignments starting at the same position, which arrive together
+        long int start = deferredAlignments[i].alignment.POSITION;
+        size_t j = i;
+        map<string, vector<pair<uint64_t, size_t> > > bySample;
+        for ( ; j < deferredAlignments.size() && deferredAlignments[j].alignment.POSITION == start; ++j) {
+            bySample[deferredAlignments[j].sampleName].push_back(make_pair(deferredAlignments[j].priority, j));
+        }
+        for (map<string, vector<pair<uint64_t, size_t> > >::iterator s = bySample.begin(); s != bySample.end(); ++s) {
+            CoverageReservoir& reservoir = coverageReservoirs[s->first];
+            size_t kept = reservoir.coverage(start);
+            size_t room = kept < limit ? limit - kept : 0;
+            size_t unpressedRoom = kept < unpressedLimit ? unpressedLimit - kept : 0;
+            vector<pair<uint64_t, size_t> >& candidates = s->second;
+            if (candidates.size() > room) {
+                nth_element(candidates.begin(), candidates.begin() + room, candidates.end());
+                // of the dropped alignments, the unpressed limit would have kept some
+                size_t cut = min(candidates.size(), unpressedRoom);
+                for (size_t c = room; c < cut; ++c) {
+                    memoryCutEnd = max(memoryCutEnd, (long int) deferredAlignments[candidates[c].second].alignment.ENDPOSITION);
+                }
+                candidates.resize(room);
+            }
+            for (vector<pair<uint64_t, size_t> >::iterator c = candidates.begin(); c != candidates.end(); ++c) {
+                keep[c->second] = true;
+            }
+        }
+        i = j;
+    }
+
+    // the kept alignments are registered in the order they were read
+    for (size_t k = 0; k < deferredAlignments.size(); ++k) {
+        DeferredAlignment& d = deferredAlignments[k];
+        if (!keep[k]) {
+            DEBUG2("dropping " << d.alignment.QNAME << " for --limit-coverage or --max-memory");
+            continue;
+        }
+        if (addAlignment(d.alignment, d.sampleName, d.sequencingTech, position, newAlleles, gettingPartials)) {
+            coverageReservoirs[d.sampleName].ends.push(d.alignment.ENDPOSITION);
+        }
+    }
+    deferredAlignments.clear();
+
+}
+
+// the name of a reference sequence, without adding to referenceIDToName
+string AlleleParser::referenceIDName(int refid) {
+    map<int, string>::iterator r = referenceIDToName.find(refid);
+    return r == referenceIDToName.end() ? "*" : r->second;
+}
+
+// applies the read filters which depend only on the alignment itself, and
+// looks up the sample and technology of the read group of alignments which
+// pass them.  this may be run ahead of time, from the prefetching thread, so
+// it must not change the state of the parser.
+bool AlleleParser::acceptAlignment(BAMALIGN& alignment, string& sampleName, string& sequencingTech) {
+
+    // get read group, and map back to a sample name
+    string readGroup;
+#ifdef HAVE_BAMTOOLS
+    if (!alignment.GetTag("RG", readGroup)) {
+#else
+    alignment.GetZTag("RG", readGroup);
+    if (readGroup.empty()) {
+#endif
+        if (!oneSampleAnalysis) {
+            ERROR("Couldn't find read group id (@RG tag) for BAM Alignment " <<
+                  alignment.QNAME << " at " << referenceIDName(alignment.REFID) << ":"
+                  << alignment.POSITION + 1 << " EXITING!");
+            exit(1);
+        } else {
+            readGroup = "unknown";
+        }
+    } else {
+        if (oneSampleAnalysis) {
+            ERROR("No read groups specified in BAM header, but alignment " <<
+                  alignment.QNAME << " at " << referenceIDName(alignment.REFID) << ":"
+                  << alignment.POSITION + 1 << " has a read group.");
+            exit(1);
+        }
+    }
+
+    // skip this alignment if we are not analyzing the sample it is drawn from
+    map<string, string>::iterator s = readGroupToSampleNames.find(readGroup);
+    if (s == readGroupToSampleNames.end()) {
+        ERROR("could not find sample matching read group id " << readGroup);
+        return false;
+    }
+
+    // skip this alignment if we are not using duplicate reads (we remove them by default)
+    if (alignment.ISDUPLICATE && !parameters.useDuplicateReads) {
+        DEBUG("skipping alignment " << alignment.QNAME << " because it is a duplicate read");
+        return false;
+    }
+
+    // skip unmapped alignments, as they cannot be used in the algorithm
+    if (!alignment.ISMAPPED) {
+        DEBUG("skipping alignment " << alignment.QNAME << " because it is not mapped");
+        return false;
+    }
+
+    // skip alignments which have no aligned bases
+    if (alignment.ALIGNEDBASES == 0) {
+        DEBUG("skipping alignment " << alignment.QNAME << " because it has no aligned bases");
+        return false;
+    }
+
+    // skip alignments which are non-primary
+    if (alignment.SecondaryFlag()) {
+        DEBUG("skipping alignment " << alignment.QNAME << " because it is not marked primary");
+        return false;
+    }
+
+    // skip reads with low mapping quality (what happens if MapQuality is not in the file)
+    if (alignment.MAPPINGQUALITY < parameters.MQL0) {
+        return false;
+    }
+
+    sampleName = s->second;
+    sequencingTech.clear();
+    map<string, string>::iterator t = readGroupToTechnology.find(readGroup);
+    if (t != readGroupToTechnology.end()) {
+        sequencingTech = t->second;
+    }
+
+    // limit base quality if cap set
+    if (parameters.baseQualityCap != 0) {
+        capBaseQuality(alignment, parameters.baseQualityCap);
+    }
+
+    return true;
+
+}
+
+// reading stdin, which can't seek to the targets, false if the alignment lies
+// too far from all of them to bear on a call, so it can be dropped before we
+// register it and gather its observations.  the cursor is the caller's, so
+// that this may be run from the prefetching thread.
+bool AlleleParser::nearStdinTarget(BAMALIGN& alignment, TargetCursor& cursor) {
+    if (!parameters.useStdin || targetIndex.empty()
+        || alignment.REFID < 0 || alignment.REFID >= (int) referenceSequences.size()) {
+        return true;
+    }
+    const string& seq = referenceSequences[alignment.REFID].REFNAME;
+    long int start = max((long int) 0, (long int) alignment.POSITION - STDIN_TARGET_PADDING);
+    long int next = cursor.nextTargetPosition(targetIndex, seq, start);
+    return next >= 0 && next <= (long int) alignment.ENDPOSITION + STDIN_TARGET_PADDING;
+}
 
-            // skip alignments which are non-primary
-            if (currentAlignment.SecondaryFlag()) {
-                DEBUG("skipping alignment " << currentAlignment.QNAME << " because it is not marked primary");
-                continue;
-            }
+// steps currentAlignment to the next alignment passing acceptAlignment
+bool AlleleParser::getNextAlignment(void) {
 
-            currentAlignment_end_position = currentAlignment.ENDPOSITION; // cache, as this is dynamically computed
-            if (!gettingPartials && currentAlignment_end_position < position) {
-                cerr << currentAlignment.QNAME << " at " << currentSequenceName << ":" << currentAlignment.POSITION << " is out of order!"
-                     << " expected after " << position << endl;
-                continue;
-            }
+    if (prefetcher) {
+        PrefetchedAlignment next;
+        if (!prefetcher->next(next)) {
+            return false;
+        }
+        currentAlignment = next.alignment;
+        currentSampleName.swap(next.sampleName);
+        currentSequencingTech.swap(next.sequencingTech);
+        return true;
+    }
 
-            // otherwise, get the sample name and register the alignment to generate a sequence of alleles
-            // we have to register the alignment to acquire some information required by filters
-            // such as mismatches
-
-            // initially skip reads with low mapping quality (what happens if MapQuality is not in the file)
-            if (currentAlignment.MAPPINGQUALITY >= parameters.MQL0) {
-                // extend our cached reference sequence to allow processing of this alignment
-                //extendReferenceSequence(currentAlignment);
-                // left realign indels
-                if (parameters.leftAlignIndels) {
-                    int length = currentAlignment_end_position - currentAlignment.POSITION + 1;
-                    stablyLeftAlign(currentAlignment,
-                                    currentSequence.substr(currentSequencePosition(currentAlignment), length));
-                }
-                // get sample name
-                string sampleName = readGroupToSampleNames[readGroup];
-                string sequencingTech;
-                map<string, string>::iterator t = readGroupToTechnology.find(readGroup);
-                if (t != readGroupToTechnology.end()) {
-                    sequencingTech = t->second;
-                }
-                // limit base quality if cap set
-                if (parameters.baseQualityCap != 0) {
-                    capBaseQuality(currentAlignment, parameters.baseQualityCap);
-                }
-                // do we exceed coverage anywhere?
-                // do we touch anything where we had exceeded coverage?
-                // if so skip this read, and mark and remove processed alignments and registered alleles overlapping the coverage capped position
-                bool considerAlignment = true;
-                if (parameters.skipCoverage > 0) {
-                    for (unsigned long int i =  currentAlignment.POSITION; i < currentAlignment_end_position; ++i) {
-                        unsigned long int x = ++coverage[i];
-                        if (x > parameters.skipCoverage && !gettingPartials) {
-                            considerAlignment = false;
-                            // we're exceeding coverage at this position for the first time, so clean up
-                            if (!coverageSkippedPositions.count(i)) {
-                                // clean up reads overlapping this position
-                                removeCoverageSkippedAlleles(registeredAlleles, i);
-                                removeCoverageSkippedAlleles(newAlleles, i);
-                                // remove the alignments overlapping this position
-                                removeRegisteredAlignmentsOverlappingPosition(i);
-                                // record that the position is capped
-                                coverageSkippedPositions.insert(i);
-                            }
-                        }
-                    }
-                }
-                // decomposes alignment into a set of alleles
-                // here we get the deque of alignments ending at this alignment's end position
-                deque<RegisteredAlignment>& rq = registeredAlignments[currentAlignment_end_position];
-                //cerr << "parameters capcoverage " << parameters.capCoverage << " " << rq.size() << endl;
-                if (considerAlignment) {
-                    // and insert the registered alignment into that deque
-                    rq.push_front(RegisteredAlignment(currentAlignment));
-                    RegisteredAlignment& ra = rq.front();
-                    registerAlignment(currentAlignment, ra, sampleName, sequencingTech);
-                    // backtracking if we have too many mismatches
-                    // or if there are no recorded alleles
-                    if (ra.alleles.empty()
-                        || ((float) ra.mismatches / (float) currentAlignment.SEQLEN) > parameters.readMaxMismatchFraction
-                        || ra.mismatches > parameters.RMU
-                        || ra.snpCount > parameters.readSnpLimit
-                        || ra.indelCount > parameters.readIndelLimit) {
-                        rq.pop_front(); // backtrack
-                    } else {
-                        // push the alleles into our new alleles vector
-                        for (vector<Allele>::iterator allele = ra.alleles.begin(); allele != ra.alleles.end(); ++allele) {
-                            newAlleles.push_back(&*allele);
-                        }
-                    }
-                }
-            }
-	    } while ((hasMoreAlignments = GETNEXT(bamMultiReader, currentAlignment))
-                 && currentAlignment.POSITION <= position
-                 && currentAlignment.REFID == currentRefID);
+    while (GETNEXT(bamMultiReader, currentAlignment)) {
+        if (nearStdinTarget(currentAlignment, readCursor)
+            && acceptAlignment(currentAlignment, currentSampleName, currentSequencingTech)) {
+            return true;
+        }
     }
+    return false;
 
-    DEBUG2("... finished pushing new alignments");
+}
 
+size_t AlleleParser::registeredAlignmentCount(void) {
+    size_t count = 0;
+    for (PositionWindow<deque<RegisteredAlignment> >::iterator f = registeredAlignments.begin();
+         f != registeredAlignments.end(); ++f) {
+        count += f->second.size();
+    }
+    return count;
 }
 
 void AlleleParser::removeRegisteredAlignmentsOverlappingPosition(long unsigned int pos) {
-    map<long unsigned int, deque<RegisteredAlignment> >::iterator f = registeredAlignments.begin();
+    PositionWindow<deque<RegisteredAlignment> >::iterator f = registeredAlignments.begin();
     map<long unsigned int, set<deque<RegisteredAlignment>::iterator> > alignmentsToErase;
-    set<Allele*> allelesToErase;
+    AlleleStorageRanges allelesToErase;
     while (f != registeredAlignments.end()) {
         for (deque<RegisteredAlignment>::iterator d = f->second.begin(); d != f->second.end(); ++d) {
             if (d->start <= pos && d->end > pos) {
                 alignmentsToErase[f->first].insert(d);
-                for (vector<Allele>::iterator a = d->alleles.begin(); a != d->alleles.end(); ++a) {
-                    allelesToErase.insert(&*a);
-                }
+                allelesToErase.add(d->alleles);
             }
         }
         ++f;
     }
     // clean up registered alleles--- maybe this should be done externally?
     for (vector<Allele*>::iterator a = registeredAlleles.begin(); a != registeredAlleles.end(); ++a) {
-        if (allelesToErase.count(*a)) {
+        if (allelesToErase.contains(*a)) {
             *a = NULL;
         }
     }
     registeredAlleles.erase(remove(registeredAlleles.begin(), registeredAlleles.end(), (Allele*)NULL), registeredAlleles.end());
+    registeredAlleleIndex.invalidate();
     if (alignmentsToErase.size()) {
+        // the deques are rebuilt, so reads waiting on their mates move
+        overlappingMates.clear();
         for (map<long unsigned int, set<deque<RegisteredAlignment>::iterator> >::iterator e = alignmentsToErase.begin();
              e != alignmentsToErase.end(); ++e) {
             deque<RegisteredAlignment> updated;
-            map<long unsigned int, deque<RegisteredAlignment> >::iterator f = registeredAlignments.find(e->first);
-            assert(f != registeredAlignments.end());
-            for (deque<RegisteredAlignment>::iterator d = f->second.begin(); d != f->second.end(); ++d) {
+            deque<RegisteredAlignment>* f = registeredAlignments.find(e->first);
+            assert(f != NULL);
+            for (deque<RegisteredAlignment>::iterator d = f->begin(); d != f->end(); ++d) {
                 if (!e->second.count(d)) {
                     updated.push_back(*d);
                 }
             }
-            f->second = updated;
+            *f = updated;
+        }
+    }
+    // and the exon blocks waiting to be registered
+    map<long int, deque<RegisteredAlignment> >::iterator s = splicedBlocks.begin();
+    while (s != splicedBlocks.end() && s->first <= (long int) pos) {
+        deque<RegisteredAlignment>& blocks = s->second;
+        for (deque<RegisteredAlignment>::iterator d = blocks.begin(); d != blocks.end(); ) {
+            if (d->end > pos) {
+                alleleVectorPool.recycle(d->alleles);
+                d = blocks.erase(d);
+            } else {
+                ++d;
+            }
+        }
+        if (blocks.empty()) {
+            splicedBlocks.erase(s++);
+        } else {
+            ++s;
         }
     }
 }
@@ -2167,6 +3295,7 @@ void AlleleParser::addToRegisteredAlleles(vector<Allele*>& alleles) {
     registeredAlleles.insert(registeredAlleles.end(),
                              alleles.begin(),
                              alleles.end());
+    registeredAlleleIndex.add(alleles);
 }
 
 // updates registered alleles and erases the unused portion of our cached reference sequence
@@ -2183,10 +3312,12 @@ void AlleleParser::updateRegisteredAlleles(void) {
     }
 
     alleles.erase(remove(alleles.begin(), alleles.end(), (Allele*)NULL), alleles.end());
+    registeredAlleleIndex.invalidate();
 
 }
 
 pair<int, long int> AlleleParser::nextInputVariantPosition(void) {
+    fillInputVariants();
     // are we past the last one in the sequence?
     if (usingVariantInputAlleles &&
         ((inputVariantAlleles.find(currentRefID) != inputVariantAlleles.end()
@@ -2210,117 +3341,148 @@ pair<int, long int> AlleleParser::nextInputVariantPosition(void) {
     return make_pair(-1, 0);
 }
 
-void AlleleParser::getAllInputVariants(void) {
-    string nullstr;
-    getInputVariantsInRegion(nullstr);
-}
-
-void AlleleParser::getInputVariantsInRegion(string& seq, long start, long end) {
+// input variants are read in the order of the input, which must follow that
+// of the reference sequences, and are kept in inputVariantAlleles from the
+// current position up to CACHED_BASIS_HAPLOTYPE_WINDOW beyond it, along with
+// the first one past that, which tells us where the next input variant is.
+// starts reading the input variants of the region, or all of them if seq is
+// empty; an end of 0 runs to the end of the sequence
+void AlleleParser::startInputVariants(const string& seq, long start, long end) {
 
     if (!usingVariantInputAlleles) return;
 
-    // get the variants in the target region
-    vcflib::Variant var(variantCallInputFile);
-    if (!seq.empty()) {
+    inputVariantRefID = -1;
+    inputVariantPosition = 0;
+    inputVariantsExhausted = false;
+    if (variantInputIndex.is_open()) {
+        if (seq.empty()) {
+            variantInputIndex.seek(inputVariantCursor);
+        } else {
+            variantInputIndex.seek(inputVariantCursor, seq, start, end ? end + 1 : numeric_limits<long int>::max());
+        }
+    } else if (!seq.empty()) {
         variantCallInputFile.setRegion(seq, start, end);
     }
-    bool ok;
-    while ((ok = variantCallInputFile.getNextVariant(*currentVariant))) {
+    fillInputVariants();
 
-        long int pos = currentVariant->position - 1;
-        // get alternate alleles
-        bool includePreviousBaseForIndels = true;
-        map<string, vector<vcflib::VariantAllele> > variantAlleles = currentVariant->parsedAlternates();
-        // TODO this would be a nice option: why does it not work?
-        //map<string, vector<vcflib::VariantAllele> > variantAlleles = currentVariant->flatAlternates();
-        vector< vector<vcflib::VariantAllele> > orderedVariantAlleles;
-        for (vector<string>::iterator a = currentVariant->alt.begin();
-          a != currentVariant->alt.end(); ++a) {
-            orderedVariantAlleles.push_back(variantAlleles[*a]);
-        }
+}
 
-        vector<Allele> genotypeAlleles;
-        set<long int> alternatePositions;
+void AlleleParser::fillInputVariants(void) {
+    while (usingVariantInputAlleles && !inputVariantsExhausted
+           && (inputVariantRefID < currentRefID
+               || (inputVariantRefID == currentRefID
+                   && inputVariantPosition <= currentPosition + CACHED_BASIS_HAPLOTYPE_WINDOW))) {
+        readInputVariant();
+    }
+}
 
-        for (vector< vector<vcflib::VariantAllele> >::iterator
-          g = orderedVariantAlleles.begin();
-          g != orderedVariantAlleles.end(); ++g) {
+// reads the next record of the input VCF, or primitive of the input index
+void AlleleParser::readInputVariant(void) {
+
+    if (variantInputIndex.is_open()) {
+        // the primitives were decomposed when the index was compiled
+        string sequenceName;
+        InputPrimitive primitive;
+        if (!variantInputIndex.next(inputVariantCursor, sequenceName, primitive)) {
+            inputVariantsExhausted = true;
+            return;
+        }
+        addInputVariantAllele(sequenceName, primitive.position, primitive.ref, primitive.alt);
+        inputVariantRefID = bamMultiReader.GETREFID(sequenceName);
+        inputVariantPosition = primitive.position - 1;
+        return;
+    }
 
-            vector<vcflib::VariantAllele>& altAllele = *g;
+    if (!variantCallInputFile.getNextVariant(*currentVariant)) {
+        inputVariantsExhausted = true;
+        return;
+    }
 
-            vector<Allele> alleles;
+    // get alternate alleles
+    map<string, vector<vcflib::VariantAllele> > variantAlleles = currentVariant->parsedAlternates();
+    // TODO this would be a nice option: why does it not work?
+    //map<string, vector<vcflib::VariantAllele> > variantAlleles = currentVariant->flatAlternates();
+    for (vector<string>::iterator a = currentVariant->alt.begin();
+      a != currentVariant->alt.end(); ++a) {
+        vector<vcflib::VariantAllele>& altAllele = variantAlleles[*a];
+        for (vector<vcflib::VariantAllele>::iterator v = altAllele.begin();
+          v != altAllele.end(); ++v) {
+            addInputVariantAllele(currentVariant->sequenceName, v->position, v->ref, v->alt);
+        }
+    }
+    inputVariantRefID = bamMultiReader.GETREFID(currentVariant->sequenceName);
+    inputVariantPosition = currentVariant->position - 1;
 
-            for (vector<vcflib::VariantAllele>::iterator v = altAllele.begin();
-              v != altAllele.end(); ++v) {
-                vcflib::VariantAllele& variant = *v;
-                long int allelePos = variant.position - 1;
-                AlleleType type;
-                string alleleSequence = variant.alt;
-
-                int len = 0;
-                int reflen = 0;
-                string cigar;
-
-                // XXX
-                // FAIL
-                // you need to add in the reference bases between the non-reference ones!
-                // to allow for complex events!
-
-                if (variant.ref == variant.alt) {
-                    // XXX note that for reference alleles, we only use the first base internally
-                    // but this is technically incorrect, so this hack should be noted
-                    len = variant.ref.size();
-                    reflen = len;
-                    //alleleSequence = alleleSequence.at(0); // take only the first base
-                    type = ALLELE_REFERENCE;
-                    cigar = convert(len) + "M";
-                } else if (variant.ref.size() == variant.alt.size()) {
-                    len = variant.ref.size();
-                    reflen = len;
-                    if (variant.ref.size() == 1) {
-                        type = ALLELE_SNP;
-                    } else {
-                        type = ALLELE_MNP;
-                    }
-                    cigar = convert(len) + "X";
-                } else if (variant.ref.size() > variant.alt.size()) {
-                    type = ALLELE_DELETION;
-                    len = variant.ref.size() - variant.alt.size();
-                    allelePos -= 1;
-                    reflen = len + 2;
-                    alleleSequence =
-                        reference.getSubSequence(currentVariant->sequenceName, allelePos, 1)
-                        + alleleSequence
-                        + reference.getSubSequence(currentVariant->sequenceName, allelePos+1+len, 1);
-                    cigar = "1M" + convert(len) + "D" + "1M";
-                } else {
-                    // we always include the flanking bases for these elsewhere, so here too in order to be consistent and trigger use
-                    type = ALLELE_INSERTION;
-                    // add previous base and post base to match format typically used for calling
-                    allelePos -= 1;
-                    alleleSequence =
-                        reference.getSubSequence(currentVariant->sequenceName, allelePos, 1)
-                        + alleleSequence
-                        + reference.getSubSequence(currentVariant->sequenceName, allelePos+1, 1);
-                    len = variant.alt.size() - var.ref.size();
-                    cigar = "1M" + convert(len) + "I" + "1M";
-                    reflen = 2;
-                }
-                // TODO deal woth complex subs
+}
 
-                Allele allele = genotypeAllele(type, alleleSequence, (unsigned int) len, cigar, (unsigned int) reflen, allelePos);
-                DEBUG("input allele: " << allele.referenceName << " " << allele);
-                //cerr << "input allele: " << allele.referenceName << " " << allele << endl;
+// makes an input allele of the primitive at the 1-based position, and stores
+// it in inputVariantAlleles unless it is a reference allele
+void AlleleParser::addInputVariantAllele(const string& sequenceName, long int position, const string& ref, const string& alt) {
 
-                //alleles.push_back(allele);
-                genotypeAlleles.push_back(allele);
+    long int allelePos = position - 1;
+    AlleleType type;
+    string alleleSequence = alt;
 
-                if (allele.type != ALLELE_REFERENCE) {
-                    inputVariantAlleles[bamMultiReader.GETREFID(currentVariant->sequenceName)][allele.position].push_back(allele);
-                    alternatePositions.insert(allele.position);
-                }
-            }
-        }
+    int len = 0;
+    int reflen = 0;
+    Cigar cigar;
+
+    // XXX
+    // FAIL
+    // you need to add in the reference bases between the non-reference ones!
+    // to allow for complex events!
+
+    if (ref == alt) {
+        // XXX note that for reference alleles, we only use the first base internally
+        // but this is technically incorrect, so this hack should be noted
+        len = ref.size();
+        reflen = len;
+        //alleleSequence = alleleSequence.at(0); // take only the first base
+        type = ALLELE_REFERENCE;
+        cigar = Cigar(len, 'M');
+    } else if (ref.size() == alt.size()) {
+        len = ref.size();
+        reflen = len;
+        if (ref.size() == 1) {
+            type = ALLELE_SNP;
+        } else {
+            type = ALLELE_MNP;
+        }
+        cigar = Cigar(len, 'X');
+    } else if (ref.size() > alt.size()) {
+        type = ALLELE_DELETION;
+        len = ref.size() - alt.size();
+        allelePos -= 1;
+        reflen = len + 2;
+        alleleSequence =
+            reference.getSubSequence(sequenceName, allelePos, 1)
+            + alleleSequence
+            + reference.getSubSequence(sequenceName, allelePos+1+len, 1);
+        cigar = Cigar(1, 'M');
+        cigar.push_back(CigarElement(len, 'D'));
+        cigar.push_back(CigarElement(1, 'M'));
+    } else {
+        // we always include the flanking bases for these elsewhere, so here too in order to be consistent and trigger use
+        type = ALLELE_INSERTION;
+        // add previous base and post base to match format typically used for calling
+        allelePos -= 1;
+        alleleSequence =
+            reference.getSubSequence(sequenceName, allelePos, 1)
+            + alleleSequence
+            + reference.getSubSequence(sequenceName, allelePos+1, 1);
+        len = alt.size() - ref.size();
+        cigar = Cigar(1, 'M');
+        cigar.push_back(CigarElement(len, 'I'));
+        cigar.push_back(CigarElement(1, 'M'));
+        reflen = 2;
+    }
+    // TODO deal woth complex subs
+
+    Allele allele = genotypeAllele(type, alleleSequence, (unsigned int) len, cigar, (unsigned int) reflen, allelePos);
+    DEBUG("input allele: " << sequenceName << " " << allele);
+
+    if (allele.type != ALLELE_REFERENCE) {
+        inputVariantAlleles[bamMultiReader.GETREFID(sequenceName)][allele.position].push_back(allele);
     }
 }
 
@@ -2362,96 +3524,13 @@ void AlleleParser::updateInputVariants(long int pos, int referenceLength) {
             while ((ok = variantCallInputFile.getNextVariant(*currentVariant))) {
 
                 DEBUG("getting input alleles from input VCF at position " << currentVariant->sequenceName << ":" << currentVariant->position);
-                long int pos = currentVariant->position - 1;
                 // get alternate alleles
-                bool includePreviousBaseForIndels = true;
                 map<string, vector<vcflib::VariantAllele> > variantAlleles = currentVariant->parsedAlternates();
-                // TODO this would be a nice option: why does it not work?
-                //map<string, vector<vcflib::VariantAllele> > variantAlleles = currentVariant->flatAlternates();
-                vector< vector<vcflib::VariantAllele> > orderedVariantAlleles;
                 for (vector<string>::iterator a = currentVariant->alt.begin(); a != currentVariant->alt.end(); ++a) {
-                    orderedVariantAlleles.push_back(variantAlleles[*a]);
-                }
-
-                vector<Allele> genotypeAlleles;
-                set<long int> alternatePositions;
-
-                for (vector< vector<vcflib::VariantAllele> >::iterator g = orderedVariantAlleles.begin(); g != orderedVariantAlleles.end(); ++g) {
-
-                    vector<vcflib::VariantAllele>& altAllele = *g;
-
-                    vector<Allele> alleles;
-
+                    vector<vcflib::VariantAllele>& altAllele = variantAlleles[*a];
                     for (vector<vcflib::VariantAllele>::iterator v = altAllele.begin(); v != altAllele.end(); ++v) {
-                        vcflib::VariantAllele& variant = *v;
-                        long int allelePos = variant.position - 1;
-                        AlleleType type;
-                        string alleleSequence = variant.alt;
-
-                        int len = 0;
-                        int reflen = 0;
-                        string cigar;
-
-                        // XXX
-                        // FAIL
-                        // you need to add in the reference bases between the non-reference ones!
-                        // to allow for complex events!
-
-                        if (variant.ref == variant.alt) {
-                            // XXX note that for reference alleles, we only use the first base internally
-                            // but this is technically incorrect, so this hack should be noted
-                            len = variant.ref.size();
-                            reflen = len;
-                            //alleleSequence = alleleSequence.at(0); // take only the first base
-                            type = ALLELE_REFERENCE;
-                            cigar = convert(len) + "M";
-                        } else if (variant.ref.size() == variant.alt.size()) {
-                            len = variant.ref.size();
-                            reflen = len;
-                            if (variant.ref.size() == 1) {
-                                type = ALLELE_SNP;
-                            } else {
-                                type = ALLELE_MNP;
-                            }
-                            cigar = convert(len) + "X";
-                        } else if (variant.ref.size() > variant.alt.size()) {
-                            type = ALLELE_DELETION;
-                            len = variant.ref.size() - variant.alt.size();
-                            allelePos -= 1;
-                            reflen = len + 2;
-                            alleleSequence =
-                                reference.getSubSequence(currentSequenceName, allelePos, 1)
-                                + alleleSequence
-                                + reference.getSubSequence(currentSequenceName, allelePos+1+len, 1);
-                            cigar = "1M" + convert(len) + "D" + "1M";
-                        } else {
-                            // we always include the flanking bases for these elsewhere, so here too in order to be consistent and trigger use
-                            type = ALLELE_INSERTION;
-                            // add previous base and post base to match format typically used for calling
-                            allelePos -= 1;
-                            alleleSequence =
-                                reference.getSubSequence(currentSequenceName, allelePos, 1)
-                                + alleleSequence
-                                + reference.getSubSequence(currentSequenceName, allelePos+1, 1);
-                            len = variant.alt.size() - var.ref.size();
-                            cigar = "1M" + convert(len) + "I" + "1M";
-                            reflen = 2;
-                        }
-                        // TODO deal woth complex subs
-
-                        Allele allele = genotypeAllele(type, alleleSequence, (unsigned int) len, cigar, (unsigned int) reflen, allelePos);
-                        DEBUG("input allele: " << allele.referenceName << " " << allele);
-
-                        //alleles.push_back(allele);
-                        genotypeAlleles.push_back(allele);
-
-                        if (allele.type != ALLELE_REFERENCE) {
-                            inputVariantAlleles[bamMultiReader.GETREFID(allele.referenceName)][allele.position].push_back(allele);
-                            alternatePositions.insert(allele.position);
-                        }
-
+                        addInputVariantAllele(currentSequenceName, v->position, v->ref, v->alt);
                     }
-
                 }
 
                 // store the allele counts, if they are provided
@@ -2482,7 +3561,7 @@ void AlleleParser::addCurrentGenotypeLikelihoods(map<int, vector<Genotype> >& ge
     // check if there are any genotype likelihoods at the current position
     if (inputGenotypeLikelihoods.find(currentPosition) != inputGenotypeLikelihoods.end()) {
 
-        map<string, map<string, long double> >& inputLikelihoodsBySample = inputGenotypeLikelihoods[currentPosition];
+        map<string, map<string, Probability> >& inputLikelihoodsBySample = inputGenotypeLikelihoods[currentPosition];
 
         vector<Genotype*> genotypePtrs;
         for (map<int, vector<Genotype> >::iterator gp = genotypesByPloidy.begin(); gp != genotypesByPloidy.end(); ++gp) {
@@ -2492,14 +3571,14 @@ void AlleleParser::addCurrentGenotypeLikelihoods(map<int, vector<Genotype> >& ge
             }
         }
         // if there are, add them to the sample data likelihoods
-        for (map<string, map<string, long double> >::iterator gls = inputLikelihoodsBySample.begin();
+        for (map<string, map<string, Probability> >::iterator gls = inputLikelihoodsBySample.begin();
                 gls != inputLikelihoodsBySample.end(); ++gls) {
             const string& sampleName = gls->first;
-            map<string, long double>& likelihoods = gls->second;
-            map<Genotype*, long double> likelihoodsPtr;
-            for (map<string, long double>::iterator gl = likelihoods.begin(); gl != likelihoods.end(); ++gl) {
+            map<string, Probability>& likelihoods = gls->second;
+            map<Genotype*, Probability> likelihoodsPtr;
+            for (map<string, Probability>::iterator gl = likelihoods.begin(); gl != likelihoods.end(); ++gl) {
                 const string& genotype = gl->first;
-                long double l = gl->second;
+                Probability l = gl->second;
                 for (vector<Genotype*>::iterator g = genotypePtrs.begin(); g != genotypePtrs.end(); ++g) {
                     if (convert(**g) == genotype) {
                         likelihoodsPtr[*g] = l;
@@ -2511,7 +3590,7 @@ void AlleleParser::addCurrentGenotypeLikelihoods(map<int, vector<Genotype> >& ge
             sampleData.name = sampleName;
             // TODO add null sample object to sampleData
             // do you need to????
-            for (map<Genotype*, long double>::iterator p = likelihoodsPtr.begin(); p != likelihoodsPtr.end(); ++p) {
+            for (map<Genotype*, Probability>::iterator p = likelihoodsPtr.begin(); p != likelihoodsPtr.end(); ++p) {
                 sampleData.push_back(SampleDataLikelihood(sampleName, nullSample, p->first, p->second, 0));
             }
             sortSampleDataLikelihoods(sampleData);
@@ -2637,17 +3716,22 @@ bool AlleleParser::toNextTarget(void) {
 
     DEBUG("to next target");
 
+    if (!parameters.useStdin && currentTarget && currentTarget != &targets.back()
+        && continueToTarget(currentTarget + 1)) {
+        return true;
+    }
+
     clearRegisteredAlignments();
-    coverageSkippedPositions.clear();
-    cachedRepeatCounts.clear();
+    repeatIndex.clear();
+    repeatEntropyBounds.clear();
     coverage.clear();
 
     // reset haplotype length; there is no last call in this sequence; it isn't relevant
     lastHaplotypeLength = 0;
 
     if (targets.empty() && usingVariantInputAlleles) {
-        // we are processing everything, so load the entire input variant allele set
-        getAllInputVariants();
+        // we are processing everything, so read through the entire input variant allele set
+        startInputVariants(string());
     }
 
     // load first target if we have targets and have not loaded the first
@@ -2657,12 +3741,16 @@ bool AlleleParser::toNextTarget(void) {
 
         // try to load the first target if we need to
         if (!currentTarget) {
-            ok = loadTarget(&targets.front()) && getFirstAlignment();
+            if (targetLacksAlignments(&targets.front())) {
+                currentTarget = &targets.front();
+            } else {
+                ok = loadTarget(&targets.front()) && getFirstAlignment();
+            }
         }
 
         // step through targets until we get to one with alignments
         while (!ok && currentTarget != &targets.back()) {
-            if (!loadTarget(++currentTarget)) {
+            if (targetLacksAlignments(++currentTarget) || !loadTarget(currentTarget)) {
                 continue;
             }
             if ((ok = getFirstAlignment())) {
@@ -2695,7 +3783,7 @@ bool AlleleParser::toNextTarget(void) {
     }
 
     if (currentTarget && usingVariantInputAlleles) {
-        getInputVariantsInRegion(currentTarget->seq, currentTarget->left, currentTarget->right);
+        startInputVariants(currentTarget->seq, currentTarget->left, currentTarget->right);
     }
 
     loadReferenceSequence(currentSequenceName);
@@ -2706,6 +3794,31 @@ bool AlleleParser::toNextTarget(void) {
 }
 
 
+// whether the indexes of the alignment files show nothing in the target, so
+// that it can be passed over without seeking to it, and reading what's there
+// only to find it's elsewhere.  with sparse targets, such as hotspot lists,
+// most may have no coverage.  targets are visited all the same where input
+// variants are read along with them.
+bool AlleleParser::targetLacksAlignments(BedTarget* target) {
+#ifdef HAVE_BAMTOOLS
+    return false;
+#else
+    if (usingVariantInputAlleles || variantCallInputFile.is_open()) {
+        return false;
+    }
+    // the indexes are changed as files are opened and closed in reading
+    if (prefetcher) {
+        prefetcher->stop();
+    }
+    if (bamMultiReader.MayHaveRecords(bamMultiReader.GETREFID(target->seq), target->left, target->right + 1)) {
+        return false;
+    }
+    DEBUG("passing over target " << target->desc << " " << target->seq << " " << target->left << " "
+          << target->right + 1 << ", as the alignment indexes have nothing in it");
+    return true;
+#endif
+}
+
 // TODO refactor this to allow reading from stdin or reading the whole file
 // without loading each sequence as a target
 bool AlleleParser::loadTarget(BedTarget* target) {
@@ -2723,15 +3836,31 @@ bool AlleleParser::loadTarget(BedTarget* target) {
     currentPosition = currentTarget->left;
     rightmostHaplotypeBasisAllelePosition = currentTarget->left;
 
+    // the reader can't be repositioned while it's being read ahead
+    if (prefetcher) {
+        prefetcher->stop();
+    }
+
+    // the region takes in the targets close behind this one, which we'll read on to
+    BedTarget* lastOfRun = lastTargetOfRun(currentTarget);
+    readerRegionEnd = lastOfRun->right + 1;
+
 #ifdef HAVE_BAMTOOLS
-    if (!bamMultiReader.SetRegion(currentRefID, currentTarget->left, currentRefID, currentTarget->right + 1)) { // bamtools expects 0-based, half-open
-        ERROR("Could not SetRegion to " << currentTarget->seq << ":" << currentTarget->left << ".." << currentTarget->right + 1);
+    if (!bamMultiReader.SetRegion(currentRefID, currentTarget->left, currentRefID, readerRegionEnd)) { // bamtools expects 0-based, half-open
+        ERROR("Could not SetRegion to " << currentTarget->seq << ":" << currentTarget->left << ".." << readerRegionEnd);
         cerr << bamMultiReader.GetErrorString() << endl;
+        readerRegionEnd = 0;
         return false;
     }
 #else
-    if (!bamMultiReader.SetRegion(SeqLib::GenomicRegion(currentRefID, currentTarget->left, currentTarget->right + 1))) { // bamtools expects 0-based, half-open
-        ERROR("Could not SetRegion to " << currentTarget->seq << ":" << currentTarget->left << ".." << currentTarget->right + 1);
+    // only the alignments overlapping the targets themselves, not the gaps between
+    vector<pair<long int, long int> > intervals;
+    for (BedTarget* t = currentTarget; t <= lastOfRun; ++t) {
+        intervals.push_back(make_pair((long int) t->left, (long int) t->right + 1)); // 0-based, half-open
+    }
+    if (!bamMultiReader.SetRegions(currentRefID, intervals)) {
+        ERROR("Could not SetRegion to " << currentTarget->seq << ":" << currentTarget->left << ".." << readerRegionEnd);
+        readerRegionEnd = 0;
         return false;
     }
 #endif
@@ -2762,18 +3891,57 @@ bool AlleleParser::loadTarget(BedTarget* target) {
 
 }
 
+// the last of the run of targets starting at this one in which each follows
+// the last on the same sequence within TARGET_SEEK_GAP bases
+BedTarget* AlleleParser::lastTargetOfRun(BedTarget* target) {
+    BedTarget* last = target;
+    while (last != &targets.back()) {
+        BedTarget* next = last + 1;
+        if (next->seq != target->seq
+            || next->left <= last->right
+            || next->left - last->right > TARGET_SEEK_GAP) {
+            break;
+        }
+        last = next;
+    }
+    return last;
+}
+
+// moves on to the target without seeking, if the reader's region already
+// takes it in.  the alignments registered in the last target which overlap
+// this one stay registered, so tiled targets don't decode the same
+// alignments over again.
+bool AlleleParser::continueToTarget(BedTarget* target) {
+
+    // input variants are sought per target along with the alignments
+    if (usingVariantInputAlleles || variantCallInputFile.is_open()) {
+        return false;
+    }
+    if (target->seq != currentSequenceName
+        || target->left <= currentTarget->right
+        || target->left < currentPosition
+        || target->right >= readerRegionEnd) {
+        return false;
+    }
+
+    DEBUG("continuing to target " << target->desc << " " << target->seq << " "
+          << target->left << " " << target->right + 1);
+
+    currentTarget = target;
+    currentPosition = target->left;
+    rightmostHaplotypeBasisAllelePosition = target->left;
+    lastHaplotypeLength = 0;
+    justSwitchedTargets = true;
+    return true;
+
+}
+
 bool AlleleParser::getFirstAlignment(void) {
 
     bool hasAlignments = true;
-    if (!GETNEXT(bamMultiReader, currentAlignment)) {
-      hasAlignments = false;
-    } else {
-      while (!currentAlignment.ISMAPPED) {
-	if (!GETNEXT(bamMultiReader, currentAlignment)) {
-	  hasAlignments = false;
-	  break;
-	}
-      }
+    // unmapped alignments are never returned by getNextAlignment
+    if (!getNextAlignment()) {
+        hasAlignments = false;
     }
 
     if (hasAlignments) {
@@ -2815,7 +3983,13 @@ bool AlleleParser::getFirstVariant(void) {
 void AlleleParser::clearRegisteredAlignments(void) {
     DEBUG2("clearing registered alignments and alleles");
     registeredAlignments.clear();
+    splicedBlocks.clear();
+    overlappingMates.clear();
     registeredAlleles.clear();
+    registeredAlleleIndex.invalidate();
+    nonReferencePositions.clear();
+    coverageReservoirs.clear();
+    memoryCutEnd = 0;
 }
 
 // TODO
@@ -2844,7 +4018,8 @@ bool AlleleParser::toNextPosition(void) {
     // is this our first position? (indicated by empty currentSequenceName)
     // if so, load it up
     bool first_pos = false;
-    if (currentSequenceName.empty()) {
+    if (currentSequenceName.empty()
+        || (!parameters.useStdin && !targets.empty() && !currentTarget)) {
         DEBUG("loading first target");
         if (!toNextTarget()) {
             return false;
@@ -2857,7 +4032,7 @@ bool AlleleParser::toNextPosition(void) {
         // here we loop over unaligned reads at the beginning of a target
         // we need to get to a mapped read to figure out where we are
         while (hasMoreAlignments && !currentAlignment.ISMAPPED) {
-            hasMoreAlignments = GETNEXT(bamMultiReader, currentAlignment);
+            hasMoreAlignments = getNextAlignment();
         }
         // determine if we have more alignments or not
         if (!hasMoreAlignments) {
@@ -2865,10 +4040,10 @@ bool AlleleParser::toNextPosition(void) {
                 // continue as we have more variants
                 DEBUG("continuing because we have more input variants");
                 loadNextPositionWithInputVariant();
-            } else if (registeredAlignments.empty()) {
+            } else if (registeredAlignments.empty() && splicedBlocks.empty()) {
                 DEBUG("no more alignments in input");
                 return false;
-            } else if (currentPosition >= currentSequence.size() + currentSequenceStart) {
+            } else if (currentPosition >= reference.sequenceLength(currentSequenceName)) {
                 DEBUG("no more alignments in input");
                 DEBUG("at end of sequence");
                 return false;
@@ -2883,11 +4058,11 @@ bool AlleleParser::toNextPosition(void) {
             // if the current position of this alignment is outside of the reference sequence length
             // we need to switch references
             if (currentPosition >= reference.sequenceLength(currentSequenceName)
-                || (registeredAlignments.empty() && currentRefID != currentAlignment.REFID)) {
+                || (registeredAlignments.empty() && splicedBlocks.empty() && currentRefID != currentAlignment.REFID)) {
                 DEBUG("at end of sequence");
                 clearRegisteredAlignments();
-                coverageSkippedPositions.clear();
-                cachedRepeatCounts.clear();
+                repeatIndex.clear();
+                repeatEntropyBounds.clear();
                 coverage.clear();
                 loadNextPositionWithAlignmentOrInputVariant(currentAlignment);
                 justSwitchedTargets = true;
@@ -2913,6 +4088,7 @@ bool AlleleParser::toNextPosition(void) {
     }
 
     // so we have to make sure it's still there (this matters in low-coverage)
+    extendReferenceSequence(currentPosition, currentPosition + 1);
     currentReferenceBase = currentReferenceBaseChar();
 
     // handle the case in which we don't have targets but in which we've switched reference sequence
@@ -2924,6 +4100,7 @@ bool AlleleParser::toNextPosition(void) {
     DEBUG2("updating variants");
     // done typically at each new read, but this handles the case where there is no data for a while
     //updateInputVariants(currentPosition, 1);
+    fillInputVariants();
 
     // remove past registered alleles
     DEBUG2("marking previous alleles as processed and removing from registered alleles");
@@ -2931,65 +4108,64 @@ bool AlleleParser::toNextPosition(void) {
 
     // if we have alignments which ended at the previous base, erase them and their alleles
     DEBUG2("erasing old registered alignments");
-    map<long unsigned int, deque<RegisteredAlignment> >::iterator f = registeredAlignments.begin();
-    set<long unsigned int> positionsToErase;
-    set<Allele*> allelesToErase;
+    long unsigned int windowStart = currentPosition - lastHaplotypeLength;
+    PositionWindow<deque<RegisteredAlignment> >::iterator f = registeredAlignments.begin();
+    AlleleStorageRanges allelesToErase;
     while (f != registeredAlignments.end()
-           && f->first < currentPosition - lastHaplotypeLength) {
+           && f->first < windowStart) {
         for (deque<RegisteredAlignment>::iterator d = f->second.begin(); d != f->second.end(); ++d) {
-            for (vector<Allele>::iterator a = d->alleles.begin(); a != d->alleles.end(); ++a) {
-                allelesToErase.insert(&*a);
-            }
+            allelesToErase.add(d->alleles);
         }
-        positionsToErase.insert(f->first);
         ++f;
     }
-    for (vector<Allele*>::iterator a = registeredAlleles.begin(); a != registeredAlleles.end(); ++a) {
-        if (allelesToErase.count(*a)) {
-            *a = NULL;
+    if (!allelesToErase.empty()) {
+        size_t registered = registeredAlleles.size();
+        for (vector<Allele*>::iterator a = registeredAlleles.begin(); a != registeredAlleles.end(); ++a) {
+            if (allelesToErase.contains(*a)) {
+                *a = NULL;
+            }
+        }
+        registeredAlleles.erase(remove(registeredAlleles.begin(), registeredAlleles.end(), (Allele*)NULL), registeredAlleles.end());
+        // these end behind the position, so the index has dropped them, unless
+        // they reach past what removePreviousAlleles takes
+        if (registeredAlleles.size() != registered) {
+            registeredAlleleIndex.invalidate();
         }
     }
-    registeredAlleles.erase(remove(registeredAlleles.begin(), registeredAlleles.end(), (Allele*)NULL), registeredAlleles.end());
-    for (set<long unsigned int>::iterator p = positionsToErase.begin(); p != positionsToErase.end(); ++p) {
-        registeredAlignments.erase(*p);
+    // the alignments before f are done with; keep their alleles' storage for
+    // the alignments we register next
+    for (PositionWindow<deque<RegisteredAlignment> >::iterator e = registeredAlignments.begin(); e != f; ++e) {
+        for (deque<RegisteredAlignment>::iterator d = e->second.begin(); d != e->second.end(); ++d) {
+            alleleVectorPool.recycle(d->alleles);
+            forgetMate(*d);
+        }
     }
+    registeredAlignments.eraseBefore(windowStart);
+    trimReferenceSequence(currentPosition - lastHaplotypeLength);
 
     // and do the same for the variants from the input VCF
     DEBUG2("erasing old input variant alleles");
+    // those of later sequences are the input we've read ahead
     int refid = bamMultiReader.GETREFID(currentSequenceName);
-    if (inputVariantAlleles.find(refid) != inputVariantAlleles.end()) {
-        map<long int, vector<Allele> >::iterator v = inputVariantAlleles[refid].begin();
-        while (v != inputVariantAlleles[refid].end() && v->first < currentPosition) {
-            inputVariantAlleles[refid].erase(v++);
-        }
-        for (map<int, map<long int, vector<Allele> > >::iterator v = inputVariantAlleles.begin();
-             v != inputVariantAlleles.end(); ++v) {
-            if (v->first != refid) inputVariantAlleles.erase(v);
-        }
+    map<int, map<long int, vector<Allele> > >::iterator iv = inputVariantAlleles.begin();
+    while (iv != inputVariantAlleles.end() && iv->first < refid) {
+        inputVariantAlleles.erase(iv++);
+    }
+    if (iv != inputVariantAlleles.end() && iv->first == refid) {
+        iv->second.erase(iv->second.begin(), iv->second.lower_bound(currentPosition));
     }
+    fillInputVariants();
 
     DEBUG2("erasing old input haplotype basis alleles");
-    map<long int, vector<AllelicPrimitive> >::iterator z = haplotypeBasisAlleles.begin();
-    while (z != haplotypeBasisAlleles.end() && z->first < currentPosition) {
-        haplotypeBasisAlleles.erase(z++);
-    }
+    haplotypeBasisAlleles.eraseBefore(currentPosition);
 
-    DEBUG2("erasing old cached repeat counts");
-    map<long int, map<string, int> >::iterator rc = cachedRepeatCounts.begin();
-    while (rc != cachedRepeatCounts.end() && rc->first < currentPosition) {
-        cachedRepeatCounts.erase(rc++);
-    }
+    repeatEntropyBounds.erase(repeatEntropyBounds.begin(),
+                              repeatEntropyBounds.lower_bound(make_pair((long int) currentPosition, (long int) 0)));
 
-    DEBUG2("erasing old coverage cap");
-    while (coverageSkippedPositions.size() && *coverageSkippedPositions.begin() < currentPosition) {
-        coverageSkippedPositions.erase(coverageSkippedPositions.begin());
-    }
+    DEBUG2("erasing old coverage counts and caps");
+    coverage.eraseBefore(currentPosition);
 
-    DEBUG2("erasing old coverage counts");
-    map<long unsigned int, long unsigned int>::iterator cov = coverage.begin();
-    while (cov != coverage.end() && cov->first < currentPosition) {
-        coverage.erase(cov++);
-    }
+    nonReferencePositions.erase(nonReferencePositions.begin(), nonReferencePositions.lower_bound(currentPosition));
 
     return true;
 
@@ -3003,7 +4179,7 @@ bool AlleleParser::dummyProcessNextTarget(void) {
         return false;
     }
 
-    while (GETNEXT(bamMultiReader, currentAlignment)) { }
+    while (getNextAlignment()) { }
 
     return true;
 }
@@ -3057,12 +4233,36 @@ bool RegisteredAlignment::fitHaplotype(int haplotypeStart, int haplotypeLength,
     cerr << "registered alignment alleles," << endl << alleles << endl;
     */
 
-    // save and bail out if we can't construct a haplotype allele
-    vector<Allele> savedAlleles = alleles;
-
     if ((allowPartials && (start <= haplotypeEnd || end >= haplotypeStart))
         || (start <= haplotypeStart && end >= haplotypeEnd)) {
-        vector<Allele>::iterator a = alleles.begin();
+
+        // buildHaplotypeAlleles refits every overlapping read on each pass as
+        // the window grows, and then again when collecting observations.
+        // once fit, a window is left as one allele, and fitting it again
+        // would change nothing.
+        bool extending = false;
+        if (fittedLength > 0 && fittedStart == haplotypeStart && fittedAllele < alleles.size()) {
+            Allele& fitted = alleles[fittedAllele];
+            if (fitted.position == haplotypeStart && fitted.referenceLength == fittedLength) {
+                if (fittedLength == haplotypeLength) {
+                    aptr = &fitted;
+                    return true;
+                }
+                extending = true;
+            }
+        }
+
+        // save and bail out if we can't construct a haplotype allele
+        // partial fits are kept as they are, so there is nothing to restore
+        vector<Allele> savedAlleles;
+        if (!allowPartials) {
+            savedAlleles = alleles;
+        }
+
+        // a window grown from the last fit is extended from the allele which
+        // covers that one, as the alleles before it end by its start
+        vector<Allele>::iterator a = extending ? alleles.begin() + fittedAllele : alleles.begin();
+        fittedLength = 0;
         //cerr << "trying to find overlapping haplotype alleles for the range " << haplotypeStart << " to " << haplotypeEnd << endl;
         //cerr << alleles << endl;
         while (a+1 != alleles.end()) {
@@ -3074,7 +4274,8 @@ bool RegisteredAlignment::fitHaplotype(int haplotypeStart, int haplotypeLength,
         if (!(a->position <= haplotypeStart && a->position + a->referenceLength > haplotypeStart)) {
             return false;
         }
-        vector<Allele>::iterator b = alleles.begin();
+        // nothing before a can end in the window
+        vector<Allele>::iterator b = a;
         while (b + 1 != alleles.end()) {
             if (b->position < haplotypeEnd && b->position + b->referenceLength >= haplotypeEnd) {
                 break;
@@ -3105,7 +4306,7 @@ bool RegisteredAlignment::fitHaplotype(int haplotypeStart, int haplotypeLength,
         //}
 
         string seq;
-        vector<pair<int, string> > cigar;
+        Cigar cigar;
         vector<short> quals;
 
         // now "a" should overlap the start of the haplotype block, and "b" the end
@@ -3147,7 +4348,7 @@ bool RegisteredAlignment::fitHaplotype(int haplotypeStart, int haplotypeLength,
 
         // now, for everything between a and b, merge them into one allele
         while (a != b) {
-            vector<pair<int, string> > cigarV = splitCigar(a->cigar);
+            Cigar cigarV = a->cigar;
             vector<Allele>::iterator p = a + 1;
             // update the quality of the merged allele in the same way as we do
             // for complex events
@@ -3188,6 +4389,9 @@ bool RegisteredAlignment::fitHaplotype(int haplotypeStart, int haplotypeLength,
                     dividedIndel = true;
                 } else {
                     hasHaplotypeAllele = true;
+                    fittedStart = haplotypeStart;
+                    fittedLength = haplotypeLength;
+                    fittedAllele = p - alleles.begin();
                 }
                 break;
             }
@@ -3212,6 +4416,60 @@ bool RegisteredAlignment::fitHaplotype(int haplotypeStart, int haplotypeLength,
 
 }
 
+// the candidate alleles of a haplotype times the samples times the genotypes
+// of those alleles at the default ploidy, which is what the likelihoods and the
+// genotype search go over
+double AlleleParser::haplotypeCost(int alleleCount) {
+    double genotypes = 1;
+    for (int i = 1; i <= parameters.ploidy; ++i) {
+        genotypes = genotypes * (alleleCount + i - 1) / i;
+    }
+    return (double) alleleCount * sampleList.size() * genotypes;
+}
+
+// drops the alternates with the least supporting quality until the alleles
+// fit --max-haplotype-cost, keeping at least one
+void AlleleParser::trimToHaplotypeCost(vector<Allele>& alleles, map<string, vector<Allele*> >& alleleGroups) {
+    vector<pair<int, size_t> > alternates; // by quality sum, negated to sort best first
+    for (size_t i = 0; i < alleles.size(); ++i) {
+        if (alleles[i].isReference()) {
+            continue;
+        }
+        int qsum = 0;
+        map<string, vector<Allele*> >::iterator g = alleleGroups.find(alleles[i].currentBase);
+        if (g != alleleGroups.end()) {
+            for (vector<Allele*>::iterator a = g->second.begin(); a != g->second.end(); ++a) {
+                qsum += (*a)->quality;
+            }
+        }
+        alternates.push_back(make_pair(-qsum, i));
+    }
+    // the reference is genotyped whether or not it's among the alleles, so
+    // the cost always counts it alongside the alternates kept
+    size_t kept = alternates.size();
+    while (kept > 1 && haplotypeCost(kept + 1) > parameters.maxHaplotypeCost) {
+        --kept;
+    }
+    if (kept == alternates.size()) {
+        return;
+    }
+    DEBUG("keeping the best " << kept << " of " << alternates.size()
+          << " alternates to fit the haplotype cost of " << parameters.maxHaplotypeCost);
+    sort(alternates.begin(), alternates.end());
+    vector<bool> dropped(alleles.size(), false);
+    for (size_t i = kept; i < alternates.size(); ++i) {
+        dropped[alternates[i].second] = true;
+    }
+    vector<Allele> trimmed;
+    for (size_t i = 0; i < alleles.size(); ++i) {
+        if (!dropped[i]) {
+            trimmed.push_back(alleles[i]);
+        }
+    }
+    alleles.swap(trimmed);
+    haplotypeCostCapped = true;
+}
+
 void AlleleParser::buildHaplotypeAlleles(
     vector<Allele>& alleles,
     Samples& samples,
@@ -3221,7 +4479,9 @@ void AlleleParser::buildHaplotypeAlleles(
     map<Allele*, set<Allele*> >& partialObservationSupport,
     int allowedAlleleTypes) {
 
+    haplotypeCostCapped = false;
     int haplotypeLength = 1;
+    int allelesLength = 1; // that of the longest allele, short of any repeat
     for (vector<Allele>::iterator a = alleles.begin(); a != alleles.end(); ++a) {
         Allele& allele = *a;
         if (allele.isReference()) continue;
@@ -3231,6 +4491,7 @@ void AlleleParser::buildHaplotypeAlleles(
                   << " so extending haplotype");
             haplotypeLength = allele.referenceLength;
         }
+        allelesLength = max(allelesLength, (int) allele.referenceLength);
         // check if we are embedded in a repeat structure
         if (allele.repeatRightBoundary > currentPosition + haplotypeLength) {
             DEBUG("right boundary " << allele.repeatRightBoundary << " for " << allele << " is past "
@@ -3256,6 +4517,10 @@ void AlleleParser::buildHaplotypeAlleles(
         // boundary of the repeat.  We build the haplotype to the
         // maximal boundary indicated by the present alleles.
 
+        // with --max-haplotype-cost, a window which holds too many alleles
+        // to genotype goes back to the length of the alleles at the site, and
+        // grows no further
+        int longestHaplotypeLength = 0;
         int oldHaplotypeLength = haplotypeLength;
         do {
             oldHaplotypeLength = haplotypeLength;
@@ -3263,10 +4528,11 @@ void AlleleParser::buildHaplotypeAlleles(
             // rebuild samples
             samples.clear();
 
-            long int maxAlignmentEnd = registeredAlignments.rbegin()->first;
+            long int maxAlignmentEnd = registeredAlignments.stop() - 1;
             for (long int i = currentPosition+1; i < maxAlignmentEnd; ++i) {
-                deque<RegisteredAlignment>& ras = registeredAlignments[i];
-                for (deque<RegisteredAlignment>::iterator r = ras.begin(); r != ras.end(); ++r) {
+                deque<RegisteredAlignment>* ras = registeredAlignments.find(i);
+                if (!ras) continue;
+                for (deque<RegisteredAlignment>::iterator r = ras->begin(); r != ras->end(); ++r) {
                     RegisteredAlignment& ra = *r;
                     if ((ra.start > currentPosition && ra.start < currentPosition + haplotypeLength)
                         || (ra.end > currentPosition && ra.end < currentPosition + haplotypeLength)) {
@@ -3279,6 +4545,8 @@ void AlleleParser::buildHaplotypeAlleles(
                     }
                 }
             }
+            // fitting haplotypes moves the alleles of the alignments
+            registeredAlleleIndex.invalidate();
 
             getAlleles(samples, allowedAlleleTypes, haplotypeLength, true, true);
             alleleGroups.clear();
@@ -3308,6 +4576,16 @@ void AlleleParser::buildHaplotypeAlleles(
                     }
                 }
             }
+            if (parameters.maxHaplotypeCost > 0 && !longestHaplotypeLength && haplotypeLength > allelesLength
+                && haplotypeCost(alleles.size()) > parameters.maxHaplotypeCost) {
+                DEBUG("haplotype of " << haplotypeLength << "bp with " << alleles.size()
+                      << " alleles is past --max-haplotype-cost, so capping it at " << allelesLength << "bp");
+                longestHaplotypeLength = allelesLength;
+                haplotypeCostCapped = true;
+            }
+            if (longestHaplotypeLength && haplotypeLength > longestHaplotypeLength) {
+                haplotypeLength = longestHaplotypeLength;
+            }
         } while (haplotypeLength != oldHaplotypeLength); // && haplotypeLength < parameters.maxHaplotypeLength);
 
 
@@ -3323,8 +4601,10 @@ void AlleleParser::buildHaplotypeAlleles(
         DEBUG("fitting haplotype block " << currentPosition << " to " << currentPosition + haplotypeLength << ", " << haplotypeLength << "bp");
 
         lastHaplotypeLength = haplotypeLength;
+        extendReferenceSequence(currentPosition, currentPosition + haplotypeLength);
 
         registeredAlleles.clear();
+        registeredAlleleIndex.invalidate();
         samples.clear();
 
         vector<Allele*> haplotypeObservations;
@@ -3403,7 +4683,7 @@ void AlleleParser::buildHaplotypeAlleles(
         Allele refAllele = genotypeAllele(ALLELE_REFERENCE,
                                           reference.getSubSequence(currentSequenceName, currentPosition, haplotypeLength),
                                           haplotypeLength,
-                                          convert(haplotypeLength)+"M",
+                                          Cigar(haplotypeLength, 'M'),
                                           haplotypeLength,
                                           currentPosition);
 
@@ -3413,6 +4693,7 @@ void AlleleParser::buildHaplotypeAlleles(
         // ensure uniqueness of registered alleles
         sort(registeredAlleles.begin(), registeredAlleles.end());
         registeredAlleles.erase(unique(registeredAlleles.begin(), registeredAlleles.end()), registeredAlleles.end());
+        registeredAlleleIndex.invalidate();
 
         removeDuplicateAlleles(samples, alleleGroups, allowedAlleleTypes, haplotypeLength, refAllele);
 
@@ -3435,6 +4716,7 @@ void AlleleParser::buildHaplotypeAlleles(
         if (maxAlleleLength > haplotypeLength) {
             //cerr << "max allele length = " << maxAlleleLength << endl;
             removeAllelesWithoutReadSpan(registeredAlleles, maxAlleleLength, haplotypeLength);
+            registeredAlleleIndex.invalidate();
             samples.clear();
             // require that reference obs are over an equivalent amount of sequence as the max allele length
             getAlleles(samples, allowedAlleleTypes, haplotypeLength, false, true);
@@ -3444,6 +4726,10 @@ void AlleleParser::buildHaplotypeAlleles(
             alleles = genotypeAlleles(alleleGroups, samples, parameters.onlyUseInputAlleles, haplotypeLength);
         }
 
+        if (parameters.maxHaplotypeCost > 0) {
+            trimToHaplotypeCost(alleles, alleleGroups);
+        }
+
         // force the ref allele into the analysis, if it somehow isn't supported
         // this can happen where we don't have sufficient read span, such as in long deletions
         // or where our samples are homozygous for an alternate
@@ -3509,6 +4795,7 @@ void AlleleParser::buildHaplotypeAlleles(
             // clean up potential duplicates
             sort(registeredAlleles.begin(), registeredAlleles.end());
             registeredAlleles.erase(unique(registeredAlleles.begin(), registeredAlleles.end()), registeredAlleles.end());
+            registeredAlleleIndex.invalidate();
 
             samples.clearFullObservations();
             getAlleles(samples, allowedAlleleTypes, haplotypeLength, false, true);
@@ -3538,7 +4825,7 @@ void AlleleParser::buildHaplotypeAlleles(
         registeredAlleles.clear();
 
         // reset registered alleles
-        for (map<long unsigned int, deque<RegisteredAlignment> >::iterator ras = registeredAlignments.begin(); ras != registeredAlignments.end(); ++ras) {
+        for (PositionWindow<deque<RegisteredAlignment> >::iterator ras = registeredAlignments.begin(); ras != registeredAlignments.end(); ++ras) {
             deque<RegisteredAlignment>& rq = ras->second;
             for (deque<RegisteredAlignment>::iterator rai = rq.begin(); rai != rq.end(); ++rai) {
                 RegisteredAlignment& ra = *rai;
@@ -3547,6 +4834,7 @@ void AlleleParser::buildHaplotypeAlleles(
                 }
             }
         }
+        registeredAlleleIndex.invalidate();
 
         if (!parameters.useRefAllele) {
             vector<Allele> refAlleleVector;
@@ -3575,7 +4863,7 @@ void AlleleParser::buildHaplotypeAlleles(
 }
 
 void AlleleParser::getCompleteObservationsOfHaplotype(Samples& samples, int haplotypeLength, vector<Allele*>& haplotypeObservations) {
-    for (map<long unsigned int, deque<RegisteredAlignment> >::iterator ras = registeredAlignments.begin(); ras != registeredAlignments.end(); ++ras) {
+    for (PositionWindow<deque<RegisteredAlignment> >::iterator ras = registeredAlignments.begin(); ras != registeredAlignments.end(); ++ras) {
         deque<RegisteredAlignment>& rq = ras->second;
         for (deque<RegisteredAlignment>::iterator rai = rq.begin(); rai != rq.end(); ++rai) {
             RegisteredAlignment& ra = *rai;
@@ -3604,7 +4892,7 @@ void AlleleParser::getCompleteObservationsOfHaplotype(Samples& samples, int hapl
 }
 
 void AlleleParser::unsetAllProcessedFlags(void) {
-    for (map<long unsigned int, deque<RegisteredAlignment> >::iterator ras = registeredAlignments.begin(); ras != registeredAlignments.end(); ++ras) {
+    for (PositionWindow<deque<RegisteredAlignment> >::iterator ras = registeredAlignments.begin(); ras != registeredAlignments.end(); ++ras) {
         deque<RegisteredAlignment>& rq = ras->second;
         for (deque<RegisteredAlignment>::iterator rai = rq.begin(); rai != rq.end(); ++rai) {
             RegisteredAlignment& ra = *rai;
@@ -3631,11 +4919,12 @@ void AlleleParser::getPartialObservationsOfHaplotype(Samples& samples, int haplo
     vector<Allele*> partialObs;
     // now get the partial obs
     // get the max alignment end position, iterate to there
-    long int maxAlignmentEnd = registeredAlignments.rbegin()->first;
+    long int maxAlignmentEnd = registeredAlignments.stop() - 1;
     for (long int i = currentPosition+1; i < maxAlignmentEnd; ++i) {
         DEBUG("getting partial observations of haplotype @" << i);
-        deque<RegisteredAlignment>& ras = registeredAlignments[i];
-        for (deque<RegisteredAlignment>::iterator r = ras.begin(); r != ras.end(); ++r) {
+        deque<RegisteredAlignment>* ras = registeredAlignments.find(i);
+        if (!ras) continue;
+        for (deque<RegisteredAlignment>::iterator r = ras->begin(); r != ras->end(); ++r) {
             RegisteredAlignment& ra = *r;
             if ((ra.start > currentPosition && ra.start < currentPosition + haplotypeLength)
 		 || (ra.end > currentPosition && ra.end < currentPosition + haplotypeLength)) {
@@ -3665,8 +4954,122 @@ void AlleleParser::getPartialObservationsOfHaplotype(Samples& samples, int haplo
     addToRegisteredAlleles(otherObs);
 }
 
+void AlternateEvidence::add(const Allele& allele, int quality, int count) {
+    // getAlleles drops these before they reach any sample
+    if (allele.alternateSequence.empty()) {
+        return;
+    }
+    total += count;
+    if (allele.sampleIndex < 0) {
+        unknownSample = true;
+        return;
+    }
+    size_t i = 0;
+    while (i < sampleIndexes.size() && sampleIndexes[i] != allele.sampleIndex) {
+        ++i;
+    }
+    if (i == sampleIndexes.size()) {
+        sampleIndexes.push_back(allele.sampleIndex);
+        counts.push_back(0);
+        qualSums.push_back(0);
+    }
+    counts[i] += count;
+    qualSums[i] += count * quality;
+}
+
+// genotypeAlleles keeps an allele only if some sample has at least
+// --min-alternate-count observations of it with a quality sum of at least
+// --min-alternate-qsum, out of at least --min-alternate-total in all
+bool AlternateEvidence::mayPass(const Parameters& parameters) const {
+    if (unknownSample) {
+        return true;
+    }
+    if (total == 0 || total < parameters.minAltTotal) {
+        return false;
+    }
+    // which any sample passes, with or without observations
+    if (parameters.minAltCount <= 0 && parameters.minAltQSum <= 0) {
+        return true;
+    }
+    for (size_t i = 0; i < sampleIndexes.size(); ++i) {
+        if (counts[i] >= parameters.minAltCount && qualSums[i] >= parameters.minAltQSum) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool AlleleParser::canSkipReferencePositions(void) {
+    return !parameters.reportMonomorphic && !parameters.gVCFout;
+}
+
+// the positions at which we might call are those of non-reference observations
+// which could pass the alternate thresholds, and input alleles.  we can't pass
+// the next alignment we haven't registered, as it may add more, nor the last
+// position of the current target or sequence, after which we move to the next
+// one.
+long int AlleleParser::nextCandidatePosition(void) {
+
+    long int next;
+    if (!parameters.useStdin && !targets.empty()) {
+        next = currentTarget->right;
+    } else {
+        next = reference.sequenceLength(currentSequenceName) - 1;
+    }
+
+    if (hasMoreAlignments) {
+        if (!currentAlignment.ISMAPPED) {
+            return currentPosition + 1;
+        } else if (currentAlignment.REFID == currentRefID) {
+            next = min(next, (long int) currentAlignment.POSITION);
+        }
+    }
+
+    fillInputVariants();
+    map<int, map<long int, vector<Allele> > >::iterator v = inputVariantAlleles.find(currentRefID);
+    if (v != inputVariantAlleles.end()) {
+        map<long int, vector<Allele> >::iterator i = v->second.upper_bound(currentPosition);
+        if (i != v->second.end()) {
+            next = min(next, i->first);
+        }
+    }
+
+    // before the next alignment, no more observations can arrive at a position
+    map<long int, AlternateEvidence>::iterator n = nonReferencePositions.upper_bound(currentPosition);
+    while (n != nonReferencePositions.end() && n->first < next && !n->second.mayPass(parameters)) {
+        ++n;
+    }
+    if (n != nonReferencePositions.end()) {
+        next = min(next, n->first);
+    }
+    next = max(next, currentPosition + 1);
+
+    // reading stdin, where we only call within the targets, we can step on to
+    // the next of them
+    if (parameters.useStdin && !targets.empty()) {
+        long int t = targetCursor.nextTargetPosition(targetIndex, currentSequenceName, next);
+        if (t > next && t < reference.sequenceLength(currentSequenceName)) {
+            next = t;
+        }
+    }
+
+    return next;
+
+}
+
 bool AlleleParser::getNextAlleles(Samples& samples, int allowedAlleleTypes) {
     long int nextPosition = currentPosition + lastHaplotypeLength;
+    // step over positions where we can't call, unless we're still working
+    // through the positions of the last haplotype
+    if (lastHaplotypeLength <= 1 && canSkipReferencePositions()
+        && !currentSequenceName.empty() && (parameters.useStdin || targets.empty() || currentTarget)) {
+        long int candidate = nextCandidatePosition();
+        if (candidate > currentPosition + 1) {
+            DEBUG2("skipping to candidate position " << candidate + 1);
+            currentPosition = candidate - 1;
+            nextPosition = candidate;
+        }
+    }
     while (currentPosition < nextPosition) {
         if (!toNextPosition()) {
             return false;
@@ -3676,23 +5079,62 @@ bool AlleleParser::getNextAlleles(Samples& samples, int allowedAlleleTypes) {
                 nextPosition = 0;
                 justSwitchedTargets = false;
             }
-            getAlleles(samples, allowedAlleleTypes);
+            if (currentPosition < nextPosition) {
+                // within the last haplotype, where no one looks at the samples
+                markProcessedAlleles(allowedAlleleTypes);
+            } else if (parameters.useStdin && !inTarget()) {
+                // reading stdin, the targets limit where we call
+                markProcessedAlleles(allowedAlleleTypes);
+                nextPosition = currentPosition + 1;
+            } else {
+                getAlleles(samples, allowedAlleleTypes);
+            }
         }
     }
     lastHaplotypeLength = 1;
     return true;
 }
 
+// does what getAlleles does to the registered alleles at the current position,
+// updating them and marking those which pass the filters as processed, without
+// gathering them into samples.  so stepping through the positions covered by
+// the last haplotype doesn't sort every overlapping observation into its
+// sample, only for the samples to be thrown away at the next position.
+void AlleleParser::markProcessedAlleles(int allowedAlleleTypes) {
+    registeredAlleleIndex.find(registeredAlleles, currentPosition, 1, allelesHere);
+    for (vector<Allele*>::const_iterator a = allelesHere.begin(); a != allelesHere.end(); ++a) {
+        Allele& allele = **a;
+        if (!(allowedAlleleTypes & allele.type)) continue;
+        if ((allele.type == ALLELE_REFERENCE
+             && allele.position <= currentPosition
+             && allele.position + allele.referenceLength > currentPosition)
+            || allele.position == currentPosition) {
+            allele.update();
+            if (allele.quality >= parameters.BQL0 && allele.currentBase != "N"
+                && (allele.isReference() || !allele.alternateSequence.empty())) {
+                allele.processed = true;
+            }
+        }
+    }
+}
+
 void AlleleParser::getAlleles(Samples& samples, int allowedAlleleTypes,
                               int haplotypeLength, bool getAllAllelesInHaplotype,
                               bool ignoreProcessedFlag) {
     Samples gvcf_held; // make some samples that by bass filtering for gvcf lines
+    // the samples we've filled, by sample id, so each observation doesn't
+    // have to look its sample up by name
+    samplesByID.assign(sampleList.size(), NULL);
+    siteAlleles.clear();
+    sampleGroupsByID.resize(sampleList.size());
+    for (vector<vector<vector<Allele*>*> >::iterator g = sampleGroupsByID.begin(); g != sampleGroupsByID.end(); ++g) {
+        g->clear();
+    }
     DEBUG2("getting alleles");
     samples.clear();
     // Commenting this out and replacinf with .clear() to relly empty it, it is more aloc, but no major change
     //for (Samples::iterator s = samples.begin(); s != samples.end(); ++s)
     //    s->second.clear();
-    // TODO ^^^ this should be optimized for better scanning performance
 
     // if we have targets and are outside of the current target, don't return anything
 
@@ -3707,7 +5149,9 @@ void AlleleParser::getAlleles(Samples& samples, int allowedAlleleTypes,
 
     // get the variant alleles *at* the current position
     // and the reference alleles *overlapping* the current position
-    for (vector<Allele*>::const_iterator a = registeredAlleles.begin(); a != registeredAlleles.end(); ++a) {
+    registeredAlleleIndex.find(registeredAlleles, currentPosition,
+                               getAllAllelesInHaplotype ? haplotypeLength : 1, allelesHere);
+    for (vector<Allele*>::const_iterator a = allelesHere.begin(); a != allelesHere.end(); ++a) {
         Allele& allele = **a;
         //cerr << "getting alleles at position " << currentPosition << " with length " << haplotypeLength << " " << allele << endl;
         if (!ignoreProcessedFlag && allele.processed) continue;
@@ -3740,7 +5184,25 @@ void AlleleParser::getAlleles(Samples& samples, int allowedAlleleTypes,
             if (allele.quality >= parameters.BQL0 && allele.currentBase != "N"
                 && (allele.isReference() || !allele.alternateSequence.empty())) { // filters haplotype construction chaff
                 //cerr << "keeping allele " << allele << endl;
-                samples[allele.sampleID][allele.currentBase].push_back(*a);
+                Sample* sample = (allele.sampleIndex >= 0) ? samplesByID[allele.sampleIndex] : NULL;
+                if (!sample) {
+                    sample = &samples[allele.sampleID];
+                    if (allele.sampleIndex >= 0) samplesByID[allele.sampleIndex] = sample;
+                }
+                if (allele.sampleIndex >= 0) {
+                    // the bases are hashed once, where the sample's map would compare them
+                    size_t id = siteAlleles.intern(allele.currentBase);
+                    vector<vector<Allele*>*>& groups = sampleGroupsByID[allele.sampleIndex];
+                    if (id >= groups.size()) {
+                        groups.resize(id + 1, NULL);
+                    }
+                    if (!groups[id]) {
+                        groups[id] = &(*sample)[allele.currentBase];
+                    }
+                    groups[id]->push_back(*a);
+                } else {
+                    (*sample)[allele.currentBase].push_back(*a);
+                }
                 // XXX testing
                 if (!getAllAllelesInHaplotype) {
                     allele.processed = true;
@@ -3767,10 +5229,6 @@ void AlleleParser::getAlleles(Samples& samples, int allowedAlleleTypes,
         const string& name = s->first;
         Sample& sample = s->second;
 
-        // move updated reference alleles to the right bin
-        // everything else will get axed
-        //sample.sortReferenceAlleles();
-
         bool empty = true;
         vector<string> genotypesToErase;
         // and remove any empty groups which remain
@@ -3848,7 +5306,19 @@ vector<Allele> AlleleParser::genotypeAlleles(
     int haplotypeLength
     ) {
 
-    vector<pair<Allele, int> > unfilteredAlleles;
+    map<Allele, int> filteredAlleles;
+
+    // with --use-best-n-indels, indel, MNP and complex alleles are ranked
+    // apart from the SNP and reference alleles
+    bool separateIndels = parameters.useBestNIndels > 0;
+    size_t bestN[2] = { (size_t) parameters.useBestNAlleles,
+                        (size_t) (separateIndels ? parameters.useBestNIndels : parameters.useBestNAlleles) };
+    // the quality sums of the best alleles of each rank found so far.  once
+    // there are enough, a group whose sum falls below all of them can't be
+    // kept, so it's passed over before its allele is built and tested against
+    // each sample.  the reference is never passed over, as whether it was
+    // seen decides whether it's added back.
+    priority_queue<int, vector<int>, greater<int> > bestSums[2];
 
     DEBUG("getting genotype alleles");
 
@@ -3862,11 +5332,10 @@ vector<Allele> AlleleParser::genotypeAlleles(
             DEBUG("allele group contains partially-null observations, skipping");
             continue;
         }
-        if (alleles.size() < parameters.minAltTotal) {
+        if (alleles.size() < (size_t) parameters.minAltTotal) {
             DEBUG("allele group lacks sufficient observations in the whole population (min-alternate-total)");
             continue;
         }
-        bool passesFilters = false;
         int qSum = 0;
         int mqSum = 0;
         for (vector<Allele*>::iterator a = alleles.begin(); a != alleles.end(); ++a) {
@@ -3875,47 +5344,44 @@ vector<Allele> AlleleParser::genotypeAlleles(
             qSum += allele.quality;
             mqSum += allele.mapQuality;
         }
-        if (qSum >= parameters.minSupportingAlleleQualitySum && mqSum >= parameters.minSupportingMappingQualitySum) {
-            Allele& allele = *(alleles.front());
-            int length = allele.length;
-            int reflength = allele.referenceLength;
-            string altseq = allele.alternateSequence;
-            if (allele.type == ALLELE_REFERENCE) {
-                length = haplotypeLength;
-                reflength = haplotypeLength;
-                if (haplotypeLength == 1) {
-                    altseq = currentReferenceBase;
-                } else {
-                    altseq = reference.getSubSequence(currentSequenceName, currentPosition, haplotypeLength);
-                }
+        if (qSum < parameters.minSupportingAlleleQualitySum || mqSum < parameters.minSupportingMappingQualitySum) {
+            continue;
+        }
+        Allele& allele = *(alleles.front());
+        int rank = separateIndels && (allele.type & (ALLELE_DELETION | ALLELE_INSERTION | ALLELE_MNP | ALLELE_COMPLEX)) ? 1 : 0;
+        if (bestN[rank] > 0 && allele.type != ALLELE_REFERENCE
+            && bestSums[rank].size() == bestN[rank] && qSum < bestSums[rank].top()) {
+            DEBUG("allele group quality sum " << qSum << " is below that of the best " << bestN[rank] << " alleles");
+            continue;
+        }
+        int length = allele.length;
+        int reflength = allele.referenceLength;
+        string altseq = allele.alternateSequence;
+        if (allele.type == ALLELE_REFERENCE) {
+            length = haplotypeLength;
+            reflength = haplotypeLength;
+            if (haplotypeLength == 1) {
+                altseq = currentReferenceBase;
+            } else {
+                altseq = reference.getSubSequence(currentSequenceName, currentPosition, haplotypeLength);
             }
-            unfilteredAlleles.push_back(make_pair(genotypeAllele(allele.type,
-                                                                 altseq,
-                                                                 length,
-                                                                 allele.cigar,
-                                                                 reflength,
-                                                                 allele.position,
-                                                                 allele.repeatRightBoundary), qSum));
         }
-    }
-    DEBUG("found genotype alleles");
-
-    map<Allele, int> filteredAlleles;
-
-    DEBUG("filtering genotype alleles which are not supported by at least " << parameters.minAltCount
-           << " observations comprising at least " << parameters.minAltFraction << " of the observations in a single individual");
-    for (vector<pair<Allele, int> >::iterator p = unfilteredAlleles.begin();
-         p != unfilteredAlleles.end(); ++p) {
-
-        Allele& genotypeAllele = p->first;
-        int qSum = p->second;
-        DEBUG("genotype allele: " << genotypeAllele << " qsum " << qSum);
-
+        Allele candidate = genotypeAllele(allele.type,
+                                           altseq,
+                                           length,
+                                           allele.cigar,
+                                           reflength,
+                                           allele.position,
+                                           allele.repeatRightBoundary);
+        DEBUG("genotype allele: " << candidate << " qsum " << qSum);
+
+        // which has to be supported by at least minAltCount observations
+        // comprising at least minAltFraction of the observations in a single individual
         for (Samples::iterator s = samples.begin(); s != samples.end(); ++s) {
             Sample& sample = s->second;
             int alleleCount = 0;
             int qsum = 0;
-            Sample::iterator c = sample.find(genotypeAllele.currentBase);
+            Sample::iterator c = sample.find(candidate.currentBase);
             if (c != sample.end()) {
                 vector<Allele*>& obs = c->second;
                 alleleCount = obs.size();
@@ -3928,12 +5394,18 @@ vector<Allele> AlleleParser::genotypeAlleles(
             if (qsum >= parameters.minAltQSum
                 && alleleCount >= parameters.minAltCount
                 && ((float) alleleCount / (float) observationCount) >= parameters.minAltFraction) {
-                DEBUG(genotypeAllele << " has support of " << alleleCount
+                DEBUG(candidate << " has support of " << alleleCount
                       << " in individual " << s->first << " (" << observationCount << " obs)" <<  " and fraction "
                       << (float) alleleCount / (float) observationCount);
-                filteredAlleles[genotypeAllele] = qSum;
+                filteredAlleles[candidate] = qSum;
+                if (bestN[rank] > 0) {
+                    bestSums[rank].push(qSum);
+                    if (bestSums[rank].size() > bestN[rank]) {
+                        bestSums[rank].pop();
+                    }
+                }
                 break;
-                //out << *genotypeAllele << endl;
+                //out << *candidate << endl;
             }
         }
     }
@@ -3947,7 +5419,7 @@ vector<Allele> AlleleParser::genotypeAlleles(
     // XXX XXX XXX
     string refBase = currentReferenceHaplotype();
 
-    if (parameters.useBestNAlleles == 0) {
+    if (parameters.useBestNAlleles == 0 && !separateIndels) {
         // this means "use everything"
         bool hasRefAllele = false;
         for (map<Allele, int>::iterator p = filteredAlleles.begin();
@@ -3961,7 +5433,7 @@ vector<Allele> AlleleParser::genotypeAlleles(
         if (parameters.forceRefAllele && !hasRefAllele) {
             DEBUG("including reference allele");
             // XXX TODO change to get the haplotype of the reference sequence
-            resultAlleles.insert(resultAlleles.begin(), genotypeAllele(ALLELE_REFERENCE, refBase, 1, "1M", 1, currentPosition));
+            resultAlleles.insert(resultAlleles.begin(), genotypeAllele(ALLELE_REFERENCE, refBase, 1, Cigar(1, 'M'), 1, currentPosition));
         }
     } else {
         // this means, use the N best
@@ -3971,25 +5443,28 @@ vector<Allele> AlleleParser::genotypeAlleles(
             sortedAlleles.push_back(make_pair(p->first, p->second));
         }
         DEBUG2("sorting alleles to get best alleles");
+        // stably, so that which of equally supported alleles are kept doesn't
+        // depend on those passed over above
         AllelePairIntCompare alleleQualityCompare;
-        sort(sortedAlleles.begin(), sortedAlleles.end(), alleleQualityCompare);
+        stable_sort(sortedAlleles.begin(), sortedAlleles.end(), alleleQualityCompare);
 
-        DEBUG("getting " << parameters.useBestNAlleles << " best SNP alleles, and all other alleles");
+        DEBUG("getting " << parameters.useBestNAlleles << " best SNP alleles, and "
+              << (separateIndels ? parameters.useBestNIndels : 0) << " best other alleles (0 for all)");
         bool hasRefAllele = false;
         for (vector<pair<Allele, int> >::iterator a = sortedAlleles.begin(); a != sortedAlleles.end(); ++a) {
             Allele& allele = a->first;
             if (allele.currentBase == refBase) {
                 hasRefAllele = true;
             }
-            /*            if (allele.type & (ALLELE_DELETION | ALLELE_INSERTION | ALLELE_MNP | ALLELE_COMPLEX)) {
-                DEBUG("adding allele to result alleles " << allele.currentBase);
-                resultIndelAndMNPAlleles.push_back(allele);
+            if (separateIndels && (allele.type & (ALLELE_DELETION | ALLELE_INSERTION | ALLELE_MNP | ALLELE_COMPLEX))) {
+                if (resultIndelAndMNPAlleles.size() < bestN[1]) {
+                    DEBUG("adding allele to result alleles " << allele.currentBase);
+                    resultIndelAndMNPAlleles.push_back(allele);
+                }
             } else {
                 DEBUG("adding allele to SNP alleles " << allele.currentBase);
+                resultAlleles.push_back(allele);
             }
-            */
-            DEBUG("adding allele to result alleles " << allele.currentBase);
-            resultAlleles.push_back(allele);
             DEBUG("allele quality sum " << a->second);
         }
         DEBUG("found " << sortedAlleles.size() << " SNP/ref alleles of which we now have " << resultAlleles.size() << endl
@@ -3999,15 +5474,15 @@ vector<Allele> AlleleParser::genotypeAlleles(
         // haven't included the reference allele, include it
         if (parameters.forceRefAllele && !hasRefAllele) {
             DEBUG("including reference allele in analysis");
-            resultAlleles.insert(resultAlleles.begin(), genotypeAllele(ALLELE_REFERENCE, refBase, 1, "1M", 1, currentPosition));
+            resultAlleles.insert(resultAlleles.begin(), genotypeAllele(ALLELE_REFERENCE, refBase, 1, Cigar(1, 'M'), 1, currentPosition));
         }
 
         // if we now have too many alleles (most likely one too many), get rid of some
-        while (resultAlleles.size() > parameters.useBestNAlleles) {
+        while (bestN[0] > 0 && resultAlleles.size() > bestN[0]) {
             resultAlleles.pop_back();
         }
 
-        // drop the SNPs back into the set of alleles
+        // drop the indels back into the set of alleles
         for (vector<Allele>::iterator a = resultIndelAndMNPAlleles.begin(); a != resultIndelAndMNPAlleles.end(); ++a) {
             resultAlleles.push_back(*a);
         }
@@ -4041,20 +5516,20 @@ vector<Allele> AlleleParser::genotypeAlleles(
                         resultAlleles.push_back(allele);
                     } else {
                         string altseq = "";
-                        string cigar = "";
+                        Cigar cigar;
                         long int extend_left = allele.position - currentPosition;
                         long int extend_right = currentPosition + haplotypeLength
                                 - allele.position - allele.referenceLength;
                         if (extend_left > 0) {
                             altseq += currentSequence.substr(currentPosition - currentSequenceStart, extend_left);
-                            cigar += convert(extend_left) + "M";
+                            cigar.push_back(CigarElement(extend_left, 'M'));
                         }
                         altseq += allele.alternateSequence;
-                        cigar += allele.cigar;
+                        cigar.insert(cigar.end(), allele.cigar.begin(), allele.cigar.end());
                         if (extend_right > 0) {
                             altseq += currentSequence.substr(
                                 allele.position + allele.referenceLength - currentSequenceStart, extend_right);
-                            cigar += convert(extend_right) + "M";
+                            cigar.push_back(CigarElement(extend_right, 'M'));
                         }
                         Allele new_allele = genotypeAllele(allele.type,
                                                            altseq,
@@ -4108,31 +5583,70 @@ int AlleleParser::homopolymerRunRight(string altbase) {
 
 }
 
-map<string, int> AlleleParser::repeatCounts(long int position, const string& sequence, int maxsize) {
-    map<string, int> counts;
-    for (int i = 1; i <= maxsize; ++i) {
-        // subseq here i bases
-        string seq = sequence.substr(position, i);
-        // go left.
+// extends the repeat boundary of an indel at the position until the
+// reference from the position up to it has --min-repeat-entropy
+//
+// there is no point in going past the alignment end, because we won't make a
+// haplotype call unless we have a covering observation from a read, nor past
+// the end of the current sequence.  the entropy is kept up base by base as
+// the boundary grows, rather than recounted over the whole span each time.
+// where the entropy is what stops the boundary, the boundary depends only on
+// where it started, so it's kept for the other reads with the same indel.
+long int AlleleParser::minEntropyBoundary(long int position, long int boundary, long int alignmentEnd) {
+
+    if (boundary >= alignmentEnd) {
+        return boundary;
+    }
+    pair<long int, long int> locus(position, boundary);
+    map<pair<long int, long int>, long int>::iterator m = repeatEntropyBounds.find(locus);
+    if (m != repeatEntropyBounds.end()) {
+        return min(m->second, alignmentEnd);
+    }
 
-        int j = position - i;
-        int leftsteps = 0;
-        while (j >= 0 && seq == sequence.substr(j, i)) {
-            j -= i;
-            ++leftsteps;
+    double minEntropy = parameters.minRepeatEntropy;
+    double ln2 = log(2);
+    vector<int> counts(256, 0);
+    string alphabet; // the bases seen, in order, as entropy() takes them
+    long int span = 0;
+    for (long int p = position; p < boundary; ++p) {
+        unsigned char c = currentSequence[p - currentSequenceStart];
+        if (counts[c]++ == 0) {
+            alphabet.insert(lower_bound(alphabet.begin(), alphabet.end(), (char) c), (char) c);
+        }
+        ++span;
+    }
+    while (boundary - currentSequenceStart < (long int) currentSequence.size()
+           && boundary < alignmentEnd) {
+        // what entropy() gives for the span
+        double ent = 0;
+        for (string::iterator c = alphabet.begin(); c != alphabet.end(); ++c) {
+            double f = (double) counts[(unsigned char) *c] / (double) span;
+            ent += f * log(f) / ln2;
+        }
+        ent = -ent;
+        if (ent >= minEntropy) {
+            repeatEntropyBounds[locus] = boundary;
+            break;
         }
+        unsigned char c = currentSequence[boundary - currentSequenceStart];
+        if (counts[c]++ == 0) {
+            alphabet.insert(lower_bound(alphabet.begin(), alphabet.end(), (char) c), (char) c);
+        }
+        ++span;
+        ++boundary;
+    }
+    return boundary;
 
-        // go right.
-        j = position;
+}
 
-        int rightsteps = 0;
-        while (j + i <= sequence.size() && seq == sequence.substr(j, i)) {
-            j += i;
-            ++rightsteps;
-        }
-        // if we went left and right a non-zero number of times,
-        if (leftsteps + rightsteps > 1) {
-            counts[seq] = leftsteps + rightsteps;
+map<string, int> AlleleParser::repeatCounts(long int position, int maxsize) {
+    map<string, int> counts;
+    repeatIndex.update(currentSequence, currentSequenceStart);
+    maxsize = min(maxsize, repeatIndex.maxUnit());
+    for (int i = 1; i <= maxsize; ++i) {
+        int copies = repeatIndex.copies(position, i);
+        if (copies > 1) {
+            counts[currentSequence.substr(position - currentSequenceStart, i)] = copies;
         }
     }
 
@@ -7,8 +7,10 @@
 #include <vector>
 #include <map>
 #include <deque>
+#include <queue>
 #include <utility>
 #include <algorithm>
+#include <memory>
 #include <time.h>
 #include <assert.h>
 #include <ctype.h>
@@ -29,18 +31,176 @@
 #include "CNV.h"
 #include "Result.h"
 #include "LeftAlign.h"
+#ifndef HAVE_BAMTOOLS
+#include "AlignmentReader.h"
+#endif
 #include "Variant.h"
 #include "version_git.h"
+#include "RunContext.h"
+#include "AlignmentPrefetcher.h"
+#include "PositionWindow.h"
+#include "RegisteredAlleleIndex.h"
+#include "HaplotypeBasisAlleles.h"
+#include "InputAlleleIndex.h"
+#include "RepeatIndex.h"
 
 // the size of the window of the reference which is always cached in memory
+// around the positions and alignments we're working on
 #define CACHED_REFERENCE_WINDOW 300
 
 // the window of haplotype basis alleles which we ensure we keep
 // increasing this reduces disk access when using haplotype basis alleles, but increases memory usage
 #define CACHED_BASIS_HAPLOTYPE_WINDOW 1000
 
+// the maximum size of the regions which are called independently of each
+// other when running with more than one thread
+#define THREADED_REGION_SIZE 1000000
+
+// the resolution at which --auto-regions estimates the work in each part of
+// the genome, a multiple of the 16kb windows of the BAI linear index
+#define AUTO_REGION_BIN_SIZE 65536
+
+// targets which follow the last on its sequence by no more than this many
+// bases are read on to rather than sought
+#define TARGET_SEEK_GAP 1000
+
+// reading stdin with targets, alignments lying further than this from all of
+// them are dropped as they are read, as they can't bear on a call within one
+#define STDIN_TARGET_PADDING 1000
+
+// the batches of alignments read ahead of the caller from stdin, unless
+// --prefetch-alignments says otherwise
+#define STDIN_PREFETCH_BATCHES 8
+
+// the most base quality --merge-overlapping-mates gives a base both mates
+// agree on, as their errors aren't independent where they come from the
+// library rather than the sequencer
+#define MATE_OVERLAP_MAX_QUALITY 60
+
 using namespace std;
 
+// read-only access to the bases and base qualities of an alignment
+//
+// with htslib records these are read from the packed sequence and quality
+// arrays of the bam1_t in place, rather than being unpacked into strings for
+// each alignment; only the spans used to build alleles are copied out.
+class AlignmentSequence {
+public:
+#ifdef HAVE_BAMTOOLS
+    AlignmentSequence(BAMALIGN& alignment)
+        : sequence(alignment.QUERYBASES)
+        , quals(alignment.QUALITIES)
+        , length(sequence.size())
+        , missingQualities(!quals.empty() && qualityChar2LongDouble(quals.at(0)) == -1)
+    { }
+    char base(int i) const { return sequence[i]; }
+    char qualityChar(int i) const { return missingQualities ? qualityInt2Char(0) : quals[i]; }
+#else
+    AlignmentSequence(BAMALIGN& alignment)
+        : seq(bam_get_seq(alignment.raw()))
+        , qual(bam_get_qual(alignment.raw()))
+        , length(alignment.raw()->core.l_qseq)
+        , missingQualities(length > 0 && qual[0] == 0xff)
+    { }
+    char base(int i) const { return seq_nt16_str[bam_seqi(seq, i)]; }
+    char qualityChar(int i) const { return missingQualities ? qualityInt2Char(0) : (char) (qual[i] + 33); }
+#endif
+    int size(void) const { return length; }
+    // like string::substr, spans are cut short at the end of the read
+    string bases(int pos, int len) const {
+        len = min(len, length - pos);
+        string b(len, 'N');
+        for (int i = 0; i < len; ++i) b[i] = base(pos + i);
+        return b;
+    }
+    string qualities(int pos, int len) const {
+        len = min(len, length - pos);
+        string q(len, '!');
+        for (int i = 0; i < len; ++i) q[i] = qualityChar(pos + i);
+        return q;
+    }
+    int quality(int i) const { return qualityChar(i) - 33; }
+    // what sumQuality and minQuality give for qualities(pos, len), in constant
+    // time from prefix sums and a sparse table of minimums.  these are built
+    // the first time they're wanted, so reads without indels don't pay for them.
+    Probability qualitySum(int pos, int len) const;
+    Probability qualityMin(int pos, int len) const;
+    // the bases of pos..pos+len which differ from ref, or where ref is N, with
+    // quality of at least minQuality; these are what registerAlignment counts
+    // as mismatches
+    int mismatches(int pos, const char* ref, int len, int minQuality) const;
+private:
+    void indexQualitySums(void) const;
+    void indexQualityMins(void) const;
+#ifdef HAVE_BAMTOOLS
+    string sequence;
+    string quals;
+#else
+    const uint8_t* seq;
+    const uint8_t* qual;
+#endif
+    int length;
+    bool missingQualities; // the record has no qualities, so treat them as 0
+    mutable vector<int> qualitySums;  // of the qualities before each position
+    mutable vector<int> lastZero;     // the last position at or before each with quality 0, or -1
+    mutable vector<vector<short> > qualityMins; // [k][i] is the least of the 2^k from i
+};
+
+// the number of alignments registered over a position, and if that has
+// exceeded --skip-coverage
+class PositionCoverage {
+public:
+    unsigned long int count;
+    bool skipped;
+    PositionCoverage(void) : count(0), skipped(false) { }
+    void clear(void) { count = 0; skipped = false; }
+    bool empty(void) const { return count == 0 && !skipped; }
+};
+
+// the registered non-reference observations starting at a position, summed by
+// sample, by which nextCandidatePosition steps over positions where no allele
+// could pass --min-alternate-count, --min-alternate-qsum and
+// --min-alternate-total without getAlleles sorting them into samples.  the
+// sums are over every non-reference allele, and observations are never taken
+// back out, so they can only overstate what genotypeAlleles would find.
+class AlternateEvidence {
+public:
+    int total;
+    vector<int> sampleIndexes;
+    vector<int> counts;    // by entry in sampleIndexes
+    vector<int> qualSums;
+    bool unknownSample;    // an observation not from a sample in the run
+    AlternateEvidence(void) : total(0), unknownSample(false) { }
+    void add(const Allele& allele) { add(allele, allele.quality, 1); }
+    // a count of -1 takes back an observation added at the quality
+    void add(const Allele& allele, int quality, int count);
+    bool mayPass(const Parameters& parameters) const;
+};
+
+// an alignment held back by --limit-coverage until every alignment of its
+// sample starting at the same position has been read
+class DeferredAlignment {
+public:
+    BAMALIGN alignment;
+    string sampleName;
+    string sequencingTech;
+    uint64_t priority; // from the read name, lowest first
+};
+
+// the ends of the alignments of a sample kept by --limit-coverage which
+// overlap the last position alignments were taken at
+class CoverageReservoir {
+public:
+    priority_queue<long int, vector<long int>, greater<long int> > ends;
+    // the alignments kept over the position, once those ending before it are let go
+    size_t coverage(long int position) {
+        while (!ends.empty() && ends.top() <= position) {
+            ends.pop();
+        }
+        return ends.size();
+    }
+};
+
 // a structure holding information about our parameters
 
 // structure to encapsulate registered reads and alleles
@@ -51,23 +211,40 @@ public:
     long unsigned int start;
     long unsigned int end;
     int refid;
-    string name;
+    string name;        // only with --debug, which prints it
     string readgroup;
+    int sampleIndex;    // ids of the sample and read group, see RunContext
+    int readGroupIndex;
     vector<Allele> alleles;
     int mismatches;
     int snpCount;
     int indelCount;
     int alleleTypes;
+    // the last haplotype window fit by fitHaplotype, and the index of the
+    // allele covering it, so that refitting the same window is free
+    int fittedStart;
+    int fittedLength;
+    size_t fittedAllele;
+    // for --merge-overlapping-mates, the key of the read and where its mate
+    // starts, if the mate is yet to come and will overlap it
+    uint64_t mateKey;
+    long int mateStart;
 
     RegisteredAlignment(BAMALIGN& alignment)
         : start(alignment.POSITION)
         , end(alignment.ENDPOSITION)
         , refid(alignment.REFID)
-        , name(alignment.QNAME)
+        , sampleIndex(-1)
+        , readGroupIndex(-1)
         , mismatches(0)
         , snpCount(0)
         , indelCount(0)
         , alleleTypes(0)
+        , fittedStart(0)
+        , fittedLength(0)
+        , fittedAllele(0)
+        , mateKey(0)
+        , mateStart(-1)
     {
       FILLREADGROUP(readgroup, alignment);
     }
@@ -125,21 +302,32 @@ class AlleleParser {
 
 public:
 
-    Parameters parameters; // holds operational parameters passed at program invocation
+    // the state shared by every parser in the run; the members below which
+    // refer into it are kept so that callers needn't go through run->
+    shared_ptr<RunContext> run;
+
+    Parameters& parameters; // holds operational parameters passed at program invocation
 
     AlleleParser(int argc, char** argv);
+    // a run from parameters already parsed from a command line
+    AlleleParser(const Parameters& p);
+    // a parser over the same run (parameters, inputs, samples and copy
+    // number map) as an existing one, which steps through its own targets
+    // with its own alignment and reference readers
+    AlleleParser(const AlleleParser& other, const vector<BedTarget>& regionTargets);
     ~AlleleParser(void);
 
-    vector<string> sampleList; // list of sample names, indexed by sample id
-    vector<string> sampleListFromBam; // sample names drawn from BAM file
-    vector<string> sampleListFromVCF; // sample names drawn from input VCF
-    map<string, string> samplePopulation; // population subdivisions of samples
-    map<string, vector<string> > populationSamples; // inversion of samplePopulation
-    map<string, string> readGroupToSampleNames; // maps read groups to samples
-    map<string, string> readGroupToTechnology; // maps read groups to technologies
-    vector<string> sequencingTechnologies;  // a list of the present technologies
+    vector<string>& sampleList; // list of sample names, indexed by sample id
+    vector<string>& sampleListFromBam; // sample names drawn from BAM file
+    vector<string>& sampleListFromVCF; // sample names drawn from input VCF
+    map<string, string>& samplePopulation; // population subdivisions of samples
+    map<string, vector<string> >& populationSamples; // inversion of samplePopulation
+    map<string, string>& readGroupToSampleNames; // maps read groups to samples
+    map<string, string>& readGroupToTechnology; // maps read groups to technologies
+    vector<string>& sequencingTechnologies;  // a list of the present technologies
 
-    CNVMap sampleCNV;
+    CNVMap& sampleCNV;
+    CNVCursor cnvCursor; // the ploidies of the samples at the current position
 
     // reference
     FB::FastaReference reference;
@@ -154,21 +342,29 @@ public:
     bool inTarget(void);
 
     // bamreader
+#ifdef HAVE_BAMTOOLS
     BAMREADER bamMultiReader;
+#else
+    AlignmentReader bamMultiReader;
+#endif
 
     // bed reader
     BedReader bedReader;
+    TargetIndex targetIndex; // of the targets, for inTarget
+    TargetCursor targetCursor;
 
     // VCF
     vcflib::VariantCallFile variantCallFile;
     vcflib::VariantCallFile variantCallInputFile;   // input variant alleles, to target analysis
     vcflib::VariantCallFile haplotypeVariantInputFile;  // input alleles which will be used to construct haplotype alleles
+    // compiled by indexalleles, used in place of the VCFs above when given
+    InputAlleleIndex variantInputIndex;
+    InputAlleleIndex haplotypeBasisIndex;
 
     // input haplotype alleles
     //
     // as calling progresses, a window of haplotype basis alleles from the flanking sequence
-    // map from starting position to length->alle
-    map<long int, vector<AllelicPrimitive> > haplotypeBasisAlleles;  // this is in the current reference sequence
+    HaplotypeBasisAlleles haplotypeBasisAlleles;  // this is in the current reference sequence
     bool usingHaplotypeBasisAlleles;
     bool usingVariantInputAlleles;
     long int rightmostHaplotypeBasisAllelePosition;
@@ -187,23 +383,42 @@ public:
                       string& sampleName,
                       BAMALIGN& alignment,
                       string& sequencingTech,
-                      long double qual,
+                      Probability qual,
                       string& qualstr);
 
 
 
     vector<Allele*> registeredAlleles;
-    map<long unsigned int, deque<RegisteredAlignment> > registeredAlignments;
-    set<long unsigned int> coverageSkippedPositions;
-    map<long unsigned int, long unsigned int> coverage;
+    RegisteredAlleleIndex registeredAlleleIndex; // of registeredAlleles, for getAlleles
+    vector<Allele*> allelesHere; // those the index finds for getAlleles
+    PositionWindow<deque<RegisteredAlignment> > registeredAlignments; // keyed by alignment end position
+    map<long int, deque<RegisteredAlignment> > splicedBlocks; // exon blocks of spliced reads yet to be registered, by start
+    uint64_t allelesRegistered; // observed alleles added to the window, for --profile-report
+    size_t registeredAlignmentCount(void); // of alignments and exon blocks in the window
+    PositionWindow<PositionCoverage> coverage; // for --skip-coverage
+    vector<DeferredAlignment> deferredAlignments; // for --limit-coverage
+    map<string, CoverageReservoir> coverageReservoirs; // by sample, for --limit-coverage
+    map<uint64_t, RegisteredAlignment*> overlappingMates; // by mateKey, for --merge-overlapping-mates
+    map<long int, AlternateEvidence> nonReferencePositions; // of registered non-reference observations at or after the current position
     map<int, map<long int, vector<Allele> > > inputVariantAlleles; // all variants present in the input VCF, as 'genotype' alleles
     pair<int, long int> nextInputVariantPosition(void);
-    void getInputVariantsInRegion(string& seq, long start = 0, long end = 0);
-    void getAllInputVariants(void);
+    void startInputVariants(const string& seq, long start = 0, long end = 0);
+    void fillInputVariants(void);
+    void readInputVariant(void);
+    void addInputVariantAllele(const string& sequenceName, long int position, const string& ref, const string& alt);
+    // the cursor over the input variants
+    InputAlleleIndex::Cursor inputVariantCursor;
+    int inputVariantRefID; // of the last input variant read, or -1
+    long int inputVariantPosition;
+    bool inputVariantsExhausted;
     //  position         sample     genotype  likelihood
-    map<string, map<long int, map<string, map<string, long double> > > > inputGenotypeLikelihoods; // drawn from input VCF
+    map<string, map<long int, map<string, map<string, Probability> > > > inputGenotypeLikelihoods; // drawn from input VCF
     map<string, map<long int, map<Allele, int> > > inputAlleleCounts; // drawn from input VCF
     Sample* nullSample;
+    vector<Sample*> samplesByID; // used by getAlleles
+    SiteAlleles siteAlleles; // the bases of the observations getAlleles gathers
+    vector<vector<vector<Allele*>*> > sampleGroupsByID; // by sample id, then site allele, for getAlleles
+    AlleleVectorPool alleleVectorPool; // storage for the alleles of registered alignments
 
     bool loadNextPositionWithAlignmentOrInputVariant(BAMALIGN& currentAlignment);
     bool loadNextPositionWithInputVariant(void);
@@ -224,6 +439,9 @@ public:
     vector<string> bamHeaderLines;
 
     void openBams(void);
+    // opens the --joint-likelihoods dumps, whose samples stand in for those
+    // of the alignments
+    void openLikelihoodDumps(void);
     void openOutputFile(void);
     void getSampleNames(void);
     void getPopulations(void);
@@ -233,18 +451,57 @@ public:
     int copiesOfLocus(Samples& samples);
     vector<int> currentPloidies(Samples& samples);
     void loadBamReferenceSequenceNames(void);
+    // takes the reference sequences from the fasta index, when there are no
+    // alignments to take them from
+    void loadFastaReferenceSequenceNames(void);
     void loadFastaReference(void);
     void loadReferenceSequence(BAMALIGN& alignment);
     void loadReferenceSequence(string& seqname);
+    // moves to a site of the --joint-likelihoods dumps, spanning the given
+    // length of reference, caching the reference around it
+    void toJointSite(const string& seqname, long int position, int referenceLength);
+    // makes sure the cached reference covers [start, end) of the current sequence
+    void extendReferenceSequence(long int start, long int end);
+    // drops the cached reference we no longer need ahead of position
+    void trimReferenceSequence(long int position);
+    long int referenceWindowMargin(void);
     string referenceSubstr(long int position, unsigned int length);
     void loadTargets(void);
+    // a --region string, such as chr20:1000-2000, as a target
+    bool regionTarget(const string& region, BedTarget& target);
+    bool validTarget(const BedTarget& target);
+    void setTargets(const vector<BedTarget>& newTargets);
+    // the targets of the run, or if none were given, the whole reference
+    vector<BedTarget> runTargets(void);
+    vector<BedTarget> targetRegions(long int regionSize);
+    vector<vector<BedTarget> > balancedRegions(int regionCount);
+    // splitting of the targets being processed, at a position after the current one
+    bool atSafeSplitPosition(void);
+    vector<BedTarget> remainingTargets(long int position);
+    vector<BedTarget> splitTargets(long int position);
     bool getFirstAlignment(void);
+    bool getNextAlignment(void);
+    bool acceptAlignment(BAMALIGN& alignment, string& sampleName, string& sequencingTech);
+    bool nearStdinTarget(BAMALIGN& alignment, TargetCursor& cursor);
+    TargetCursor readCursor; // for nearStdinTarget, when reading without the prefetcher
     bool getFirstVariant(void);
     void loadTargetsFromBams(void);
     void initializeOutputFiles(void);
     RegisteredAlignment& registerAlignment(BAMALIGN& alignment, RegisteredAlignment& ra, string& sampleName, string& sequencingTech);
     void clearRegisteredAlignments(void);
     void updateAlignmentQueue(long int position, vector<Allele*>& newAlleles, bool gettingPartials = false);
+    bool addAlignment(BAMALIGN& alignment, string& sampleName, string& sequencingTech,
+                      long int position, vector<Allele*>& newAlleles, bool gettingPartials);
+    bool overReadLimits(BAMALIGN& alignment);
+    void addObservedAlleles(RegisteredAlignment& ra, vector<Allele*>& newAlleles);
+    bool fuseWithMate(RegisteredAlignment& ra, BAMALIGN& alignment);
+    void retallyAlternate(const Allele& allele, int oldQuality);
+    void forgetMate(RegisteredAlignment& ra);
+    void registerExonBlocks(deque<RegisteredAlignment>& rq, vector<pair<long int, long int> >& skips,
+                            long int position, vector<Allele*>& newAlleles);
+    void updateExonBlocks(long int position, vector<Allele*>& newAlleles);
+    void deferAlignment(void);
+    void downsampleDeferredAlignments(long int position, vector<Allele*>& newAlleles, bool gettingPartials);
     void updateInputVariants(long int pos, int referenceLength);
     void updateHaplotypeBasisAlleles(void);
     void removeAllelesWithoutReadSpan(vector<Allele*>& alleles, int probeLength, int haplotypeLength);
@@ -260,9 +517,11 @@ public:
     void updateRegisteredAlleles(void);
     void addToRegisteredAlleles(vector<Allele*>& alleles);
     void updatePriorAlleles(void);
-    vector<BedTarget>* targetsInCurrentRefSeq(void);
     bool toNextRefID(void);
     bool loadTarget(BedTarget*);
+    bool targetLacksAlignments(BedTarget* target);
+    bool continueToTarget(BedTarget* target);
+    BedTarget* lastTargetOfRun(BedTarget* target);
     bool toFirstTargetPosition(void);
     bool toNextPosition(void);
     void getCompleteObservationsOfHaplotype(Samples& samples, int haplotypeLength, vector<Allele*>& haplotypeObservations);
@@ -274,9 +533,17 @@ public:
     int currentSequencePosition();
     void unsetAllProcessedFlags(void);
     bool getNextAlleles(Samples& allelesBySample, int allowedAlleleTypes);
+    // true if positions without non-reference observations or input alleles
+    // can't produce output, so getNextAlleles may step over them
+    bool canSkipReferencePositions(void);
+    // the next position after the current one at which we could make a call
+    long int nextCandidatePosition(void);
 
     // builds up haplotype (longer, e.g. ref+snp+ref) alleles to match the longest allele in genotypeAlleles
     // updates vector<Allele>& alleles with the new alleles
+    // the estimated cost of genotyping the alleles, for --max-haplotype-cost
+    double haplotypeCost(int alleleCount);
+    void trimToHaplotypeCost(vector<Allele>& alleles, map<string, vector<Allele*> >& alleleGroups);
     void buildHaplotypeAlleles(vector<Allele>& alleles,
                                Samples& allelesBySample,
                                map<string, vector<Allele*> >& alleleGroups,
@@ -289,12 +556,16 @@ public:
                     int haplotypeLength = 1,
                     bool getAllAllelesInHaplotype = false,
                     bool ignoreProcessedAlleles = true);
+    void markProcessedAlleles(int allowedAlleleTypes);
     Allele* referenceAllele(int mapQ, int baseQ);
     Allele* alternateAllele(int mapQ, int baseQ);
     int homopolymerRunLeft(string altbase);
     int homopolymerRunRight(string altbase);
-    map<string, int> repeatCounts(long int position, const string& sequence, int maxsize);
-    map<long int, map<string, int> > cachedRepeatCounts; // cached version of previous
+    // the repeat units of up to maxsize bp at the position, keyed to their copy counts
+    map<string, int> repeatCounts(long int position, int maxsize);
+    RepeatIndex repeatIndex; // of the cached reference window
+    long int minEntropyBoundary(long int position, long int boundary, long int alignmentEnd);
+    map<pair<long int, long int>, long int> repeatEntropyBounds; // --min-repeat-entropy boundaries, by indel position and starting boundary
     bool isRepeatUnit(const string& seq, const string& unit);
     void setupVCFOutput(void);
     void setupVCFInput(void);
@@ -312,8 +583,11 @@ public:
     int fastaReferenceSequenceCount; // number of reference sequences
     bool hasTarget;
     BedTarget* currentTarget;
+    long int readerRegionEnd; // of the region the alignment reader was last set to, exclusive
     long int currentPosition;  // 0-based current position
     int lastHaplotypeLength;
+    bool haplotypeCostCapped; // the last haplotype was held to --max-haplotype-cost
+    long int memoryCutEnd; // alignments dropped for --max-memory alone cover positions before this
     char currentReferenceBase;
     string currentSequence;
     char currentReferenceBaseChar();
@@ -332,6 +606,13 @@ public:
 
 private:
 
+    // binds the parser to the run and sets up its position and input flags
+    AlleleParser(shared_ptr<RunContext> context);
+    // opens the inputs and the output of a new run, and reads its samples
+    void openRun(void);
+
+    vector<vector<Probability> > indexedDataInBins(vector<BedTarget>& wholeTargets);
+
     bool justSwitchedTargets;  // to trigger clearing of queues, maps and such holding Allele*'s on jump
 
     Allele* currentReferenceAllele;
@@ -339,17 +620,24 @@ private:
 
     //BedTarget currentSequenceBounds;
     long int currentSequenceStart;
+    long int longestAlignment; // the longest alignment we've registered, which sizes the cached reference window
+    LeftAlignCache leftAlignCache; // of the reads realigned with --left-align-indels
 
     bool hasMoreAlignments;
     bool hasMoreVariants;;
 
-    bool oneSampleAnalysis; // if we are analyzing just one sample, and there are no specified read groups
+    bool& oneSampleAnalysis; // if we are analyzing just one sample, and there are no specified read groups
 
     int basesBeforeCurrentTarget; // number of bases in sequence we're storing before the current target
     int basesAfterCurrentTarget;  // ........................................  after ...................
 
     int currentRefID;
     BAMALIGN currentAlignment;
+    string currentSampleName;       // the sample and technology of currentAlignment
+    string currentSequencingTech;
+    AlignmentPrefetcher* prefetcher; // NULL unless using --prefetch-alignments or --stdin
+
+    string referenceIDName(int refid);
     vcflib::Variant* currentVariant;
 
 };
@@ -0,0 +1,53 @@
+#include "AllocationProfile.h"
+
+#ifdef ALLOC_PROFILE
+
+#include <new>
+#include <stdlib.h>
+
+atomic<long> liveObjects[LIVE_OBJECT_COUNT];
+
+static thread_local AllocationCounts allocationCounts;
+static thread_local long livePeaks[LIVE_OBJECT_COUNT];
+
+AllocationCounts threadAllocations(void) {
+    return allocationCounts;
+}
+
+long livePeak(LiveObject object) {
+    return livePeaks[object];
+}
+
+void resetLivePeaks(void) {
+    for (int i = 0; i < LIVE_OBJECT_COUNT; ++i) {
+        livePeaks[i] = liveObjects[i];
+    }
+}
+
+void noteLive(LiveObject object, long live) {
+    if (live > livePeaks[object]) {
+        livePeaks[object] = live;
+    }
+}
+
+// the replacements of the global allocation functions; the nothrow and array
+// forms the library provides go through these
+void* operator new(size_t size) {
+    ++allocationCounts.allocations;
+    allocationCounts.bytes += size;
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef FREEBAYES_ALLOCATIONPROFILE_H
+#define FREEBAYES_ALLOCATIONPROFILE_H
+
+#include <atomic>
+#include <stdint.h>
+
+using namespace std;
+
+// counts of the allocations made by each thread, and of the alleles and
+// genotype combos alive at once, which --profile-report gives for each of its
+// stages in builds configured with
+//
+//     meson build -Dalloc_profile=true
+//
+// every operator new of such a build is counted, so they are slower, and are
+// for finding where memory goes rather than for production runs.  in other
+// builds none of this is compiled in.
+
+struct AllocationCounts {
+    uint64_t allocations;
+    uint64_t bytes;
+};
+
+// the objects whose live counts are kept
+enum LiveObject {
+    LIVE_ALLELES = 0,
+    LIVE_GENOTYPE_COMBOS,
+    LIVE_OBJECT_COUNT
+};
+
+#ifdef ALLOC_PROFILE
+
+// made by the calling thread so far
+AllocationCounts threadAllocations(void);
+
+// alive in the process, and the most alive since the calling thread last
+// reset its peaks
+extern atomic<long> liveObjects[LIVE_OBJECT_COUNT];
+long livePeak(LiveObject object);
+void resetLivePeaks(void);
+void noteLive(LiveObject object, long live);
+
+// a member which counts the objects holding it in and out of liveObjects
+template <LiveObject Object>
+class LiveCount {
+public:
+    LiveCount(void) { added(); }
+    LiveCount(const LiveCount&) { added(); }
+    LiveCount& operator=(const LiveCount&) { return *this; }
+    ~LiveCount(void) { --liveObjects[Object]; }
+private:
+    void added(void) { noteLive(Object, ++liveObjects[Object]); }
+};
+
+#endif
+
+#endif
@@ -0,0 +1,219 @@
+#include "BatchRun.h"
+#include "AlleleParser.h"
+#include "Caller.h"
+#include "RegionScheduler.h"
+#include "VariantWriter.h"
+#include "Logging.h"
+#include "BedReader.h"
+#include "htslib/sam.h"
+#include "htslib/faidx.h"
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+bool readBatch(const string& file, vector<BatchJob>& jobs) {
+    ifstream in(file.c_str());
+    if (!in) {
+        ERROR("could not open the batch " << file);
+        return false;
+    }
+    jobs.clear();
+    string line;
+    size_t lineNumber = 0;
+    while (getline(in, line)) {
+        ++lineNumber;
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line.erase(line.size() - 1);
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        vector<string> fields = split(line, '\t');
+        if (fields.size() != 3 || fields[0].empty() || fields[1].empty() || fields[2].empty()) {
+            ERROR("line " << lineNumber << " of the batch " << file
+                  << " isn't an alignment file, reference and output separated by tabs");
+            return false;
+        }
+        BatchJob job;
+        job.bam = fields[0];
+        job.fasta = fields[1];
+        job.outputFile = fields[2];
+        jobs.push_back(job);
+    }
+    if (jobs.empty()) {
+        ERROR("the batch " << file << " has no jobs");
+        return false;
+    }
+    return true;
+}
+
+// the sequence of a region, given as to --region
+static string regionSequence(const string& region) {
+    size_t colon = region.rfind(':');
+    return colon == string::npos ? region : region.substr(0, colon);
+}
+
+// checks what the parser of the job would stop the process over, so that a
+// job with a bad input fails alone: that its alignment file and reference
+// can be read, that the regions and targets of the run are on its
+// reference, and that its output can be written.  a job which gets past
+// these may yet stop the run, as over a malformed alignment.
+static bool checkJob(const Parameters& p, string& problem) {
+    const string& bam = p.bams.front();
+    htsFile* fp = hts_open(bam.c_str(), "r");
+    if (!fp) {
+        problem = "could not open the alignment file " + bam;
+        return false;
+    }
+    bam_hdr_t* header = sam_hdr_read(fp);
+    bool readable = header != NULL;
+    bool indexed = true;
+    if (readable && (!p.regions.empty() || !p.targets.empty())) {
+        hts_idx_t* idx = sam_index_load(fp, bam.c_str());
+        indexed = idx != NULL;
+        if (idx) {
+            hts_idx_destroy(idx);
+        }
+    }
+    if (header) {
+        bam_hdr_destroy(header);
+    }
+    hts_close(fp);
+    if (!readable) {
+        problem = "could not read the header of the alignment file " + bam;
+        return false;
+    }
+    if (!indexed) {
+        problem = "the alignment file " + bam + " has no index, which calling regions needs";
+        return false;
+    }
+
+    faidx_t* fai = fai_load(p.fasta.c_str());
+    if (!fai) {
+        problem = "could not read the reference " + p.fasta;
+        return false;
+    }
+    vector<string> sequences;
+    for (vector<string>::const_iterator r = p.regions.begin(); r != p.regions.end(); ++r) {
+        sequences.push_back(regionSequence(*r));
+    }
+    if (!p.targets.empty()) {
+        string targets = p.targets;
+        BedReader bed(targets);
+        for (vector<BedTarget>::iterator t = bed.targets.begin(); t != bed.targets.end(); ++t) {
+            sequences.push_back(t->seq);
+        }
+    }
+    for (vector<string>::iterator s = sequences.begin(); s != sequences.end(); ++s) {
+        if (!faidx_has_seq(fai, s->c_str())) {
+            problem = "the sequence " + *s + " of the regions is not in the reference " + p.fasta;
+            fai_destroy(fai);
+            return false;
+        }
+    }
+    fai_destroy(fai);
+
+    // htslib reports its own outputs as they are opened
+    if (!VariantWriter::opensFile(p.outputFile, p.outputFormat)) {
+        ofstream out(p.outputFile.c_str(), ios::app);
+        if (!out) {
+            problem = "could not open the output " + p.outputFile;
+            return false;
+        }
+    }
+    return true;
+}
+
+// calls the job alone, as if the run had been given its files, or returns
+// false with the problem which stopped it
+static bool callJob(const Parameters& run, const BatchJob& job, SiteCounts& sites, string& problem) {
+    Parameters p = run;
+    p.batchFile.clear();
+    p.bams.assign(1, job.bam);
+    p.fasta = job.fasta;
+    p.outputFile = job.outputFile;
+    p.threads = 1;
+    // the reports of the run are of a single process, not of its jobs
+    p.profileReportFile.clear();
+    p.slowSiteLogFile.clear();
+    p.traceFile.clear();
+    p.traceRegions.clear();
+    p.traceSamples.clear();
+    p.progressInterval = 0;
+
+    if (!checkJob(p, problem)) {
+        return false;
+    }
+    AlleleParser* parser = new AlleleParser(p);
+    VariantWriter writer;
+    if (!VariantWriter::opensFile(p.outputFile, p.outputFormat)) {
+        writer.open(*(parser->output));
+    } else if (!writer.open(p.outputFile, p.outputFormat, p.compressThreads)) {
+        problem = "could not open the output " + p.outputFile;
+        delete parser;
+        return false;
+    }
+    if (p.output == "vcf") {
+        writer.writeHeader(parser->variantCallFile.header);
+    }
+    StreamVariantOutput variantOut(writer);
+    callVariants(parser, variantOut, sites);
+    writer.close();
+    delete parser;
+    return true;
+}
+
+bool callBatch(const Parameters& parameters) {
+
+    vector<BatchJob> jobs;
+    if (!readBatch(parameters.batchFile, jobs)) {
+        return false;
+    }
+
+    // the workers take the jobs in order, as each finishes its last
+    // a job which fails is reported, and the rest of the batch carries on
+    atomic<size_t> next(0);
+    atomic<size_t> failed(0);
+    mutex sitesMutex;
+    SiteCounts sites;
+    auto work = [&]() {
+        size_t j;
+        while ((j = next++) < jobs.size()) {
+            SiteCounts jobSites;
+            string problem;
+            if (!callJob(parameters, jobs[j], jobSites, problem)) {
+                ERROR("job " << j + 1 << " of the batch, " << jobs[j].bam << " into " << jobs[j].outputFile
+                      << ", failed: " << problem);
+                ++failed;
+                continue;
+            }
+            DEBUG("called job " << j + 1 << " of " << jobs.size() << ", " << jobs[j].bam
+                  << " against " << jobs[j].fasta << ", into " << jobs[j].outputFile);
+            lock_guard<mutex> lock(sitesMutex);
+            sites.add(jobSites);
+        }
+    };
+
+    size_t workers = min((size_t) max(parameters.threads, 1), jobs.size());
+    if (workers == 1) {
+        work();
+    } else {
+        vector<thread> threads;
+        for (size_t i = 0; i < workers; ++i) {
+            threads.push_back(thread(work));
+        }
+        for (vector<thread>::iterator t = threads.begin(); t != threads.end(); ++t) {
+            t->join();
+        }
+    }
+
+    DEBUG("called " << jobs.size() - failed << " jobs of the batch on " << workers << " threads: "
+          << sites.total << " sites, of which " << sites.processed << " were processed");
+    if (failed > 0) {
+        ERROR(failed << " of the " << jobs.size() << " jobs of the batch failed");
+        return false;
+    }
+    return true;
+
+}
@@ -0,0 +1,39 @@
+#ifndef FREEBAYES_BATCHRUN_H
+#define FREEBAYES_BATCHRUN_H
+
+#include <string>
+#include <vector>
+#include "Parameters.h"
+
+using namespace std;
+
+// a job of --batch: an alignment file called against its reference, into
+// its own output
+class BatchJob {
+public:
+    string bam;
+    string fasta;
+    string outputFile;
+};
+
+// --batch FILE: calls each job listed in FILE with the arguments of the run,
+// as though freebayes had been run on it alone, but without starting a
+// process for each.  FILE has a line for each job, of its alignment file,
+// reference and output, separated by tabs; blank lines and those beginning
+// with # are skipped.
+//
+// the jobs are called in turn on --threads threads, each job on a single
+// thread, so that runs over thousands of small genomes keep every core busy
+// without splitting any one of them into regions.  references are mapped
+// into memory, so jobs against the same reference share the pages of one
+// copy of it.
+
+// reads the jobs of the batch; false if FILE can't be read or has none
+bool readBatch(const string& file, vector<BatchJob>& jobs);
+
+// calls the jobs of the batch; false if any of them failed.  a job whose
+// inputs can't be read, or whose reference lacks a region of the run, is
+// reported and the rest are still called
+bool callBatch(const Parameters& parameters);
+
+#endif
@@ -73,3 +73,63 @@ vector<BedTarget*> BedReader::targetsOverlapping(BedTarget& target) {
     }
     return overlapping;
 }
+
+void TargetIndex::index(const vector<BedTarget>& targets) {
+    intervals.clear();
+    for (vector<BedTarget>::const_iterator t = targets.begin(); t != targets.end(); ++t) {
+        intervals[t->seq].push_back(make_pair((long int) t->left, (long int) t->right));
+    }
+    for (map<string, vector<pair<long int, long int> > >::iterator s = intervals.begin(); s != intervals.end(); ++s) {
+        vector<pair<long int, long int> >& v = s->second;
+        sort(v.begin(), v.end());
+        vector<pair<long int, long int> > merged;
+        for (vector<pair<long int, long int> >::iterator i = v.begin(); i != v.end(); ++i) {
+            if (!merged.empty() && i->first <= merged.back().second + 1) {
+                merged.back().second = max(merged.back().second, i->second);
+            } else {
+                merged.push_back(*i);
+            }
+        }
+        v.swap(merged);
+    }
+}
+
+void TargetCursor::seek(TargetIndex& index, const string& seq, long int position) {
+    if (last < 0 || seq != sequence || position < last) {
+        sequence = seq;
+        map<string, vector<pair<long int, long int> > >::iterator s = index.intervals.find(seq);
+        intervals = (s == index.intervals.end()) ? NULL : &s->second;
+        next = 0;
+        if (intervals) {
+            // the first interval ending at or after the position
+            size_t low = 0, high = intervals->size();
+            while (low < high) {
+                size_t mid = (low + high) / 2;
+                if ((*intervals)[mid].second < position) {
+                    low = mid + 1;
+                } else {
+                    high = mid;
+                }
+            }
+            next = low;
+        }
+    } else if (intervals) {
+        while (next < intervals->size() && (*intervals)[next].second < position) {
+            ++next;
+        }
+    }
+    last = position;
+}
+
+bool TargetCursor::contains(TargetIndex& index, const string& seq, long int position) {
+    seek(index, seq, position);
+    return intervals && next < intervals->size() && (*intervals)[next].first <= position;
+}
+
+long int TargetCursor::nextTargetPosition(TargetIndex& index, const string& seq, long int position) {
+    seek(index, seq, position);
+    if (!intervals || next == intervals->size()) {
+        return -1;
+    }
+    return max(position, (*intervals)[next].first);
+}
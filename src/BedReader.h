@@ -24,6 +24,8 @@ public:
     int right;   // right position, adjusted to 0-base inclusive
     string desc; // descriptive information, target name typically
 
+    BedTarget(void) : left(0), right(0) { }
+
     BedTarget(string s, int l, int r, string d = "")
         : seq(s)
         , left(l)
@@ -34,6 +36,42 @@ public:
 };
 
 
+// the targets of each sequence, merged where they overlap or abut and sorted,
+// for TargetCursor
+class TargetIndex {
+
+public:
+    void index(const vector<BedTarget>& targets);
+    bool empty(void) const { return intervals.empty(); }
+
+private:
+    friend class TargetCursor;
+    map<string, vector<pair<long int, long int> > > intervals; // 0-based, fully closed
+};
+
+// answers whether positions are in a target, and where the next one starts,
+// for positions which only ever move onward along a sequence.  each query
+// steps past the intervals behind it, so a pass along the sequence takes as
+// many steps as it has intervals; moving to another sequence, or backwards,
+// finds its place again by binary search.
+class TargetCursor {
+
+public:
+    TargetCursor(void) : intervals(NULL), next(0), last(-1) { }
+    bool contains(TargetIndex& index, const string& seq, long int position);
+    // the first position at or after the given one which is in a target of
+    // the sequence, or -1 if there is none
+    long int nextTargetPosition(TargetIndex& index, const string& seq, long int position);
+    void reset(void) { last = -1; }
+
+private:
+    void seek(TargetIndex& index, const string& seq, long int position);
+    string sequence;
+    const vector<pair<long int, long int> >* intervals; // of the sequence, or NULL if it has none
+    size_t next; // the first interval which doesn't end before the last position
+    long int last; // the last position asked about, or -1 before the first
+};
+
 class BedReader : public ifstream {
 
 public:
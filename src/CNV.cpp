@@ -79,3 +79,48 @@ int CNVMap::ploidy(string const& sample, string const& seq, long int position) {
     }
 
 }
+
+void CNVMap::index(const vector<string>& samples) {
+    indexedSamples = samples;
+    breakpoints.clear();
+    for (SampleSeqCNVMap::iterator scnv = sampleSeqCNV.begin(); scnv != sampleSeqCNV.end(); ++scnv) {
+        for (map<string, vector<tuple<long int, long int, int> > >::iterator c = scnv->second.begin();
+             c != scnv->second.end(); ++c) {
+            // ploidy searches the intervals by their ends
+            sort(c->second.begin(), c->second.end());
+            vector<long int>& b = breakpoints[c->first];
+            for (vector<tuple<long int, long int, int> >::iterator i = c->second.begin(); i != c->second.end(); ++i) {
+                b.push_back(get<0>(*i));
+                b.push_back(get<1>(*i));
+            }
+        }
+    }
+    for (map<string, vector<long int> >::iterator b = breakpoints.begin(); b != breakpoints.end(); ++b) {
+        sort(b->second.begin(), b->second.end());
+        b->second.erase(unique(b->second.begin(), b->second.end()), b->second.end());
+    }
+}
+
+const vector<int>& CNVCursor::ploidies(CNVMap& cnvs, const string& seq, long int position) {
+    if (seq == sequence && start <= position && position < end) {
+        return current;
+    }
+    sequence = seq;
+    start = LONG_MIN;
+    end = LONG_MAX;
+    map<string, vector<long int> >::iterator b = cnvs.breakpoints.find(seq);
+    if (b != cnvs.breakpoints.end()) {
+        vector<long int>::iterator next = upper_bound(b->second.begin(), b->second.end(), position);
+        if (next != b->second.end()) {
+            end = *next;
+        }
+        if (next != b->second.begin()) {
+            start = *(next - 1);
+        }
+    }
+    current.resize(cnvs.indexedSamples.size());
+    for (size_t i = 0; i < cnvs.indexedSamples.size(); ++i) {
+        current[i] = cnvs.ploidy(cnvs.indexedSamples[i], seq, position);
+    }
+    return current;
+}
@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <algorithm>
 #include <tuple>
+#include <climits>
 #include "split.h"
 
 using namespace std;
@@ -25,12 +26,37 @@ public:
     bool load(string const& filename);
     int ploidy(string const& sample, string const& seq, long int position);
     void setPloidy(string const& sample, string const& seq, long int start, long int end, int ploidy);
+    // once the map is loaded, sorts it and collects the positions on each
+    // sequence at which the ploidy of any sample changes, for CNVCursor
+    void index(const vector<string>& samples);
 
 private:
+    friend class CNVCursor;
+
     // note: this map is stored as 0-based, end position exclusive
     SampleSeqCNVMap sampleSeqCNV;
     int defaultPloidy;
     map<string, int> samplePloidy;
+    vector<string> indexedSamples;
+    map<string, vector<long int> > breakpoints; // by sequence, sorted
+
+};
+
+// the ploidy of each sample given to CNVMap::index at the current position,
+// which is looked up again only once the position crosses a breakpoint of the
+// map, rather than for every sample at every site
+class CNVCursor {
+
+public:
+    CNVCursor(void) : start(0), end(-1) { }
+    // indexed as the samples given to CNVMap::index
+    const vector<int>& ploidies(CNVMap& cnvs, const string& seq, long int position);
+
+private:
+    string sequence;
+    long int start; // the ploidies hold over [start, end)
+    long int end;
+    vector<int> current;
 
 };
 
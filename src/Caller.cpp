@@ -0,0 +1,1491 @@
+#include "Caller.h"
+#include "Numa.h"
+
+// standard includes
+//#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <deque>
+#include <memory>
+#include <iterator>
+#include <algorithm>
+#include <cmath>
+#include <time.h>
+#include <float.h>
+#include <stdlib.h>
+#include <thread>
+#include <mutex>
+
+// private libraries
+#ifdef HAVE_BAMTOOLS
+#include "api/BamReader.h"
+#endif
+#include "TryCatch.h"
+#include "Parameters.h"
+#include "Allele.h"
+#include "Sample.h"
+#include "AlleleParser.h"
+#include "Utility.h"
+
+#include "multichoose.h"
+#include "multipermute.h"
+
+#include "Genotype.h"
+#include "DataLikelihood.h"
+#include "Marginals.h"
+#include "ResultData.h"
+
+#include "Bias.h"
+#include "Contamination.h"
+#include "NonCall.h"
+#include "Logging.h"
+#include "RegionScheduler.h"
+#include "VariantWriter.h"
+#include "LikelihoodDump.h"
+#include "Profile.h"
+#include "Progress.h"
+
+using namespace std;
+
+// whether the genotype search at a site can take the fast path
+//
+// at biallelic sites where every sample is diploid, each sample has just three
+// genotypes, so it's cheap for each pass of the search to keep the combos it
+// scores.  the search can then stop as soon as it converges, where otherwise it
+// would score the neighbours of the final combo a second time to keep them.
+// the combos found are the same either way.  other sites take the general path.
+bool takesFastPath(vector<Allele>& genotypeAlleles, vector<int>& ploidies) {
+    return genotypeAlleles.size() == 2
+        && ploidies.size() == 1
+        && ploidies.front() == 2;
+}
+
+// an upper bound on the p(var) which genotyping the site would come to, from
+// the data likelihoods alone, or 1 if we can't bound it
+//
+// p(var) is 1 less the posterior of the combo in which every sample is
+// homozygous for the reference, which the search always adds.  the priors of
+// the combos are probabilities, so the normalizer over the distinct combos
+// the search finds, and those it evicts, is at most the product over the
+// samples of the sum of their data likelihoods.  this only holds within one
+// population, as combining populations counts the combos of each again.
+Probability pVarUpperBound(map<string, SampleDataLikelihoods>& sampleDataLikelihoodsByPopulation,
+                           Samples& samples,
+                           vector<Allele>& genotypeAlleles,
+                           const string& referenceBase,
+                           Probability theta,
+                           Parameters& parameters) {
+
+    if (sampleDataLikelihoodsByPopulation.size() != 1) {
+        return 1;
+    }
+    SampleDataLikelihoods& sampleDataLikelihoods = sampleDataLikelihoodsByPopulation.begin()->second;
+
+    Probability lnNormalizerBound = 0;
+    vector<Probability> probs;
+    for (SampleDataLikelihoods::iterator s = sampleDataLikelihoods.begin(); s != sampleDataLikelihoods.end(); ++s) {
+        probs.clear();
+        for (vector<SampleDataLikelihood>::iterator d = s->begin(); d != s->end(); ++d) {
+            probs.push_back(d->prob);
+        }
+        lnNormalizerBound += logsumexp_probs(probs);
+    }
+
+    // the homozygous combos as the search makes them
+    list<GenotypeCombo> homozygousCombos;
+    SampleDataLikelihoods nullSampleDataLikelihoods;
+    addAllHomozygousCombos(homozygousCombos,
+                           sampleDataLikelihoods,
+                           sampleDataLikelihoods,
+                           nullSampleDataLikelihoods,
+                           samples,
+                           genotypeAlleles,
+                           theta,
+                           parameters.pooledDiscrete,
+                           parameters.ewensPriors,
+                           parameters.permute,
+                           parameters.hwePriors,
+                           parameters.obsBinomialPriors,
+                           parameters.alleleBalancePriors,
+                           parameters.diffusionPriorScalar);
+    for (list<GenotypeCombo>::iterator gc = homozygousCombos.begin(); gc != homozygousCombos.end(); ++gc) {
+        if (gc->size() == sampleDataLikelihoods.size()
+            && gc->isHomozygous() && gc->alleles().front() == referenceBase) {
+            return -expm1(min((Probability) 0, gc->posteriorProb - lnNormalizerBound));
+        }
+    }
+    return 1;
+
+}
+
+// --max-combos, held to MEMORY_PRESSURE_COMBOS while the run is pressed for
+// memory
+static size_t comboCap(const Parameters& parameters, bool memoryPressed) {
+    size_t cap = parameters.maxCombos;
+    if (memoryPressed && (cap == 0 || cap > MEMORY_PRESSURE_COMBOS)) {
+        cap = MEMORY_PRESSURE_COMBOS;
+    }
+    return cap;
+}
+
+// adds the parser's current position to the gVCF block, first writing out the
+// block if the position starts a new GQ band
+void recordNonCall(NonCalls& nonCalls, VariantOutput& out, AlleleParser* parser, Samples& samples) {
+    if (!nonCalls.record(parser->currentSequenceName, parser->currentPosition, samples)) {
+        Results results;
+        vcflib::Variant var(parser->variantCallFile);
+        out.write(results.gvcf(var, nonCalls, parser), &results.values);
+        nonCalls.clear();
+        nonCalls.record(parser->currentSequenceName, parser->currentPosition, samples);
+    }
+}
+
+// the combos the search finds at a site, by population
+class ComboSearch {
+public:
+    map<string, list<GenotypeCombo> > combos;
+    map<string, Probability> lnEvicted;             // posterior mass of the combos we didn't keep
+    map<string, list<GenotypeCombo> > glMaxCombos;  // --report-genotype-likelihood-max
+    int iterations;    // of the last population, as reported before the searches were split
+    bool approximate;  // cut short by --max-site-time
+
+    ComboSearch(void) : iterations(0), approximate(false) { }
+};
+
+// whether the memory pressure narrowed the search: under a tighter cap than
+// --max-combos alone, the search let some combos go
+static bool combosCutForMemory(const ComboSearch& search, const Parameters& parameters, size_t maxCombos) {
+    if (maxCombos == (size_t) parameters.maxCombos) {
+        return false;
+    }
+    for (map<string, Probability>::const_iterator e = search.lnEvicted.begin(); e != search.lnEvicted.end(); ++e) {
+        if (e->second != -INFINITY) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// whether alignments dropped for the memory pressure, which --limit-coverage
+// alone would have kept, lay over the current position
+static bool coverageCutForMemory(AlleleParser* parser) {
+    return parser->currentPosition < parser->memoryCutEnd;
+}
+
+// searches the genotype combos of each population at the site, until the
+// deadline if there is one
+//
+// the populations are searched independently, so when there are several, the
+// genotyping team takes one each rather than sharing the search of one.  the
+// results are kept by population and combined in order, so they don't depend
+// on which thread searched which.
+static void searchGenotypeCombos(ComboSearch& search,
+                                 map<string, SampleDataLikelihoods>& sampleDataLikelihoodsByPopulation,
+                                 Samples& samples,
+                                 vector<Allele>& genotypeAlleles,
+                                 map<string, int>& inputAlleleCounts,
+                                 Probability theta,
+                                 int itermax,
+                                 bool fastPath,
+                                 size_t maxCombos,
+                                 uint64_t deadline,
+                                 Parameters& parameters,
+                                 WorkerTeam& genotypingTeam,
+                                 RunProfile& profile) {
+
+    vector<map<string, SampleDataLikelihoods>::iterator> populations;
+    for (map<string, SampleDataLikelihoods>::iterator p = sampleDataLikelihoodsByPopulation.begin(); p != sampleDataLikelihoodsByPopulation.end(); ++p) {
+        populations.push_back(p);
+        search.combos[p->first];
+        search.lnEvicted[p->first];
+        if (parameters.reportGenotypeLikelihoodMax) {
+            search.glMaxCombos[p->first];
+        }
+    }
+    vector<int> populationIterations(populations.size(), 0);
+    vector<char> populationApproximate(populations.size(), false);
+
+    // XXX HACK
+    // passing 0 for bandwidth and banddepth means "exhaustive local search"
+    // this produces properly normalized GQ's at polyallelic sites
+    int adjustedBandwidth = 0;
+    int adjustedBanddepth = 0;
+    // however, this can lead to huge performance problems at complex sites,
+    // so we implement this hack...
+    if (parameters.genotypingMaxBandDepth > 0 &&
+        genotypeAlleles.size() > (size_t) parameters.genotypingMaxBandDepth) {
+        adjustedBandwidth = 1;
+        adjustedBanddepth = parameters.genotypingMaxBandDepth;
+    }
+
+    auto searchPopulation = [&](size_t j, WorkerTeam* team) {
+
+        map<string, SampleDataLikelihoods>::iterator p = populations[j];
+        const string& population = p->first;
+        SampleDataLikelihoods& sampleDataLikelihoods = p->second;
+        // the entries were made above, so these lookups don't change the maps
+        list<GenotypeCombo>& populationGenotypeCombos = search.combos.at(population);
+
+        DEBUG2("genqerating banded genotype combinations from " << sampleDataLikelihoods.size() << " sample genotypes in population " << population);
+
+        GenotypeCombo nullCombo;
+        SampleDataLikelihoods nullSampleDataLikelihoods;
+
+        // this is the genotype-likelihood maximum
+        if (parameters.reportGenotypeLikelihoodMax) {
+            GenotypeCombo comboKing;
+            vector<int> initialPosition;
+            initialPosition.assign(sampleDataLikelihoods.size(), 0);
+            SampleDataLikelihoods nullDataLikelihoods; // dummy variable
+            makeComboByDatalLikelihoodRank(comboKing,
+                                           initialPosition,
+                                           sampleDataLikelihoods,
+                                           nullDataLikelihoods,
+                                           inputAlleleCounts,
+                                           theta,
+                                           parameters.pooledDiscrete,
+                                           parameters.ewensPriors,
+                                           parameters.permute,
+                                           parameters.hwePriors,
+                                           parameters.obsBinomialPriors,
+                                           parameters.alleleBalancePriors,
+                                           parameters.diffusionPriorScalar);
+
+            search.glMaxCombos.at(population).push_back(comboKing);
+        }
+
+        if (deadline && wallClockNanoseconds() > deadline) {
+            // out of time already, so in place of the search take the
+            // data likelihood maximum, and the homozygous combos to
+            // estimate the probability of variation against
+            populationApproximate[j] = true;
+            GenotypeCombo comboKing;
+            vector<int> initialPosition;
+            initialPosition.assign(sampleDataLikelihoods.size(), 0);
+            makeComboByDatalLikelihoodRank(comboKing,
+                                           initialPosition,
+                                           sampleDataLikelihoods,
+                                           nullSampleDataLikelihoods,
+                                           inputAlleleCounts,
+                                           theta,
+                                           parameters.pooledDiscrete,
+                                           parameters.ewensPriors,
+                                           parameters.permute,
+                                           parameters.hwePriors,
+                                           parameters.obsBinomialPriors,
+                                           parameters.alleleBalancePriors,
+                                           parameters.diffusionPriorScalar);
+            populationGenotypeCombos.push_back(comboKing);
+            addAllHomozygousCombos(populationGenotypeCombos,
+                                   sampleDataLikelihoods,
+                                   sampleDataLikelihoods,
+                                   nullSampleDataLikelihoods,
+                                   samples,
+                                   genotypeAlleles,
+                                   theta,
+                                   parameters.pooledDiscrete,
+                                   parameters.ewensPriors,
+                                   parameters.permute,
+                                   parameters.hwePriors,
+                                   parameters.obsBinomialPriors,
+                                   parameters.alleleBalancePriors,
+                                   parameters.diffusionPriorScalar);
+            search.lnEvicted.at(population) = -INFINITY;
+            return;
+        }
+
+        // search much longer for convergence
+        bool stoppedByDeadline = false;
+        convergentGenotypeComboSearch(
+            populationGenotypeCombos,
+            nullCombo,
+            sampleDataLikelihoods, // vary everything
+            sampleDataLikelihoods,
+            nullSampleDataLikelihoods,
+            samples,
+            genotypeAlleles,
+            inputAlleleCounts,
+            adjustedBandwidth,
+            adjustedBanddepth,
+            theta,
+            parameters.pooledDiscrete,
+            parameters.ewensPriors,
+            parameters.permute,
+            parameters.hwePriors,
+            parameters.obsBinomialPriors,
+            parameters.alleleBalancePriors,
+            parameters.diffusionPriorScalar,
+            itermax,
+            populationIterations[j],
+            true, // add homozygous combos
+            // ^^ combo results are sorted by default
+            team,
+            maxCombos,
+            &search.lnEvicted.at(population),
+            fastPath, // keep the combos of every pass
+            deadline,
+            log102ln(parameters.genotypingTolerance),
+            &stoppedByDeadline);
+        populationApproximate[j] = stoppedByDeadline;
+    };
+
+    {
+        // timed as a whole, as the team may search the populations at once
+        StageTimer timer(profile, STAGE_COMBO_SEARCH);
+        if (populations.size() > 1 && genotypingTeam.size() > 1) {
+            genotypingTeam.run([&](int member) {
+                for (size_t j = member; j < populations.size(); j += genotypingTeam.size()) {
+                    searchPopulation(j, NULL);
+                }
+            });
+        } else {
+            for (size_t j = 0; j < populations.size(); ++j) {
+                searchPopulation(j, &genotypingTeam);
+            }
+        }
+    }
+    if (!populationIterations.empty()) {
+        search.iterations = populationIterations.back();
+    }
+    profile.count(HISTOGRAM_GENOTYPING_ITERATIONS, search.iterations);
+    for (size_t j = 0; j < populationIterations.size(); ++j) {
+        profile.tally(COUNTER_GENOTYPING_ITERATIONS, populationIterations[j]);
+    }
+    search.approximate = find(populationApproximate.begin(), populationApproximate.end(), true) != populationApproximate.end();
+
+}
+
+// what we call at a site from the combos the search found
+class SiteCall {
+public:
+    list<GenotypeCombo> combos;  // of every population, best first
+    Probability lnHom;
+    Probability pVar;
+    Probability bestComboOddsRatio;
+    vector<Allele> alts;         // reported
+    GenotypeCombo bestCombo;     // reported
+
+    SiteCall(void) : lnHom(-INFINITY), pVar(1.0), bestComboOddsRatio(0) { }
+
+    // whether the site is written, by --pvar
+    bool passes(const Parameters& parameters) const {
+        return (!alts.empty() && pVar >= parameters.PVL) || parameters.PVL == 0;
+    }
+};
+
+// combines the combos of the populations into the call
+//
+// we provide p(var|data), or the probability that the location has variation
+// between individuals relative to the probability that it has no variation
+//
+// in other words:
+// p(var|d) = 1 - p(AA|d) - p(TT|d) - P(GG|d) - P(CC|d)
+//
+// the approach is go through all the homozygous combos and then subtract this
+// from 1... resolving p(var|d).  it is kept in log space, which holds the tiny
+// probabilities of well-supported variants without resorting to BigFloats.
+static void makeCall(SiteCall& call,
+                     ComboSearch& search,
+                     map<string, SampleDataLikelihoods>& sampleDataLikelihoodsByPopulation,
+                     vector<Allele>& genotypeAlleles,
+                     const string& referenceBase,
+                     Parameters& parameters) {
+
+    // accumulate combos from independently-calculated populations into the list of combos
+    list<GenotypeCombo>& genotypeCombos = call.combos;
+    combinePopulationCombos(genotypeCombos, search.combos);
+
+    // re-get posterior normalizer
+    vector<Probability> comboProbs;
+    for (list<GenotypeCombo>::iterator gc = genotypeCombos.begin(); gc != genotypeCombos.end(); ++gc) {
+        comboProbs.push_back(gc->posteriorProb);
+    }
+    // including the combos dropped by --max-combos
+    Probability lnEvicted = combinedEvictedPosterior(search.combos, search.lnEvicted);
+    if (lnEvicted != -INFINITY) {
+        comboProbs.push_back(lnEvicted);
+    }
+    Probability posteriorNormalizer = logsumexp_probs(comboProbs);
+
+    // calculates pvar
+    vector<Probability> homProbs;
+    for (list<GenotypeCombo>::iterator gc = genotypeCombos.begin(); gc != genotypeCombos.end(); ++gc) {
+        if (gc->isHomozygous() && gc->alleles().front() == referenceBase) {
+            homProbs.push_back(gc->posteriorProb - posteriorNormalizer);
+        }
+    }
+    if (!homProbs.empty()) {
+        call.lnHom = logsumexp_probs(homProbs);
+    }
+    call.pVar = -expm1(call.lnHom); // 1 - pHom
+
+    // odds ratio between the first and second-best combinations
+    if (genotypeCombos.size() > 1) {
+        call.bestComboOddsRatio = genotypeCombos.front().posteriorProb - (++genotypeCombos.begin())->posteriorProb;
+    }
+
+    vector<Allele>& alts = call.alts;
+    if (parameters.onlyUseInputAlleles
+        || parameters.reportAllHaplotypeAlleles
+        || parameters.pooledContinuous) {
+        for (vector<Allele>::iterator a = genotypeAlleles.begin(); a != genotypeAlleles.end(); ++a) {
+            if (!a->isReference()) {
+                alts.push_back(*a);
+            }
+        }
+    } else {
+        // get the unique alternate alleles in the best combo, sorted by frequency in the combo
+        vector<pair<Allele, int> > alternates = alternateAlleles(genotypeCombos.front(), referenceBase);
+        for (vector<pair<Allele, int> >::iterator a = alternates.begin(); a != alternates.end(); ++a) {
+            Allele& alt = a->first;
+            if (!alt.isNull() && !alt.isReference())
+                alts.push_back(alt);
+        }
+        // if there are no alternate alleles in the best combo, use the genotype alleles
+        // XXX ...
+        if (alts.empty()) {
+            for (vector<Allele>::iterator a = genotypeAlleles.begin(); a != genotypeAlleles.end(); ++a) {
+                if (!a->isReference()) {
+                    alts.push_back(*a);
+                }
+            }
+        }
+    }
+
+    // reporting the GL maximum *over all alleles*
+    if (parameters.reportGenotypeLikelihoodMax) {
+        list<GenotypeCombo> glMaxGenotypeCombos;
+        combinePopulationCombos(glMaxGenotypeCombos, search.glMaxCombos);
+        call.bestCombo = glMaxGenotypeCombos.front();
+        return;
+    }
+
+    // the default behavior is to report the GL maximum genotyping over the
+    // alleles in the best posterior genotyping.  this is not the same thing
+    // as the GL max over all alleles!  it is the GL max over the selected
+    // alleles at this point.  samples with likelihoods of none of them, as
+    // can happen with --joint-likelihoods, take their best genotype.
+    vector<Allele> alleles = alts;
+    for (vector<Allele>::iterator a = genotypeAlleles.begin(); a != genotypeAlleles.end(); ++a) {
+        if (a->isReference()) {
+            alleles.push_back(*a);
+        }
+    }
+    map<string, list<GenotypeCombo> > glMaxComboBasedOnAltsByPop;
+    for (map<string, SampleDataLikelihoods>::iterator p = sampleDataLikelihoodsByPopulation.begin(); p != sampleDataLikelihoodsByPopulation.end(); ++p) {
+        const string& population = p->first;
+        SampleDataLikelihoods& sampleDataLikelihoods = p->second;
+        GenotypeCombo glMaxBasedOnAlts;
+        for (SampleDataLikelihoods::iterator v = sampleDataLikelihoods.begin(); v != sampleDataLikelihoods.end(); ++v) {
+            SampleDataLikelihood* m = &v->front();
+            for (vector<SampleDataLikelihood>::iterator d = v->begin(); d != v->end(); ++d) {
+                if (d->genotype->matchesAlleles(alleles)) {
+                    m = &*d;
+                    break;
+                }
+            }
+            glMaxBasedOnAlts.push_back(m);
+        }
+        glMaxComboBasedOnAltsByPop[population].push_back(glMaxBasedOnAlts);
+    }
+    list<GenotypeCombo> glMaxBasedOnAltsGenotypeCombos; // build new combos into this list
+    combinePopulationCombos(glMaxBasedOnAltsGenotypeCombos, glMaxComboBasedOnAltsByPop);
+    call.bestCombo = glMaxBasedOnAltsGenotypeCombos.front();
+
+}
+
+// writes the record of a call which passes, with the marginals if they are
+// reported
+static void writeCall(SiteCall& call,
+                      AlleleParser* parser,
+                      VariantOutput& out,
+                      Results& results,
+                      SiteCounts& sites,
+                      map<string, SampleDataLikelihoods>& sampleDataLikelihoodsByPopulation,
+                      Samples& samples,
+                      const string& referenceBase,
+                      int iterations,
+                      int coverage,
+                      map<string, vector<Allele*> >& alleleGroups,
+                      map<string, vector<Allele*> >& partialObservationGroups,
+                      map<Allele*, set<Allele*> >& partialObservationSupport,
+                      map<int, vector<Genotype> >& genotypesByPloidy,
+                      bool approximate,
+                      bool memoryLimited,
+                      WorkerTeam* team) {
+
+    Parameters& parameters = parser->parameters;
+
+    // the marginals are only reported, so only get them for the sites we write
+    if (parameters.calculateMarginals) {
+        StageTimer timer(sites.profile, STAGE_MARGINALS);
+        marginalGenotypeLikelihoods(call.combos, sampleDataLikelihoodsByPopulation);
+        // store the marginal data likelihoods in the results, for easy parsing
+        for (map<string, SampleDataLikelihoods>::iterator p = sampleDataLikelihoodsByPopulation.begin(); p != sampleDataLikelihoodsByPopulation.end(); ++p) {
+            results.update(p->second);
+        }
+    }
+
+    map<string, int> repeats;
+    if (parameters.showReferenceRepeats) {
+        repeats = parser->repeatCounts(parser->currentPosition, 12);
+    }
+
+    vcflib::Variant var(parser->variantCallFile);
+    {
+        StageTimer timer(sites.profile, STAGE_RESULTS_VCF);
+        results.vcf(
+            var,
+            call.lnHom,
+            call.bestComboOddsRatio,
+            samples,
+            referenceBase,
+            call.alts,
+            repeats,
+            iterations,
+            parser->sampleList,
+            coverage,
+            call.bestCombo,
+            alleleGroups,
+            partialObservationGroups,
+            partialObservationSupport,
+            genotypesByPloidy,
+            parser->sequencingTechnologies,
+            parser,
+            team);
+    }
+    if (approximate) {
+        var.infoFlags["APPROX"] = true;
+    }
+    if (parser->haplotypeCostCapped) {
+        var.infoFlags["HCAP"] = true;
+    }
+    if (memoryLimited) {
+        ++sites.memoryLimited;
+        var.infoFlags["MEMLIMIT"] = true;
+    }
+    out.write(var, &results.values);
+
+}
+
+// what we learn of a site as we call it, which is written to --slow-site-log
+// as the site is left, however that happens, if it took long enough
+class SlowSiteEntry {
+public:
+    int coverage;
+    int alleles;
+    int iterations;
+    size_t combos;
+    bool approximate;  // cut short by --max-site-time
+
+    SlowSiteEntry(AlleleParser* p, uint64_t s)
+        : coverage(0), alleles(0), iterations(0), combos(0), approximate(false)
+        , parser(p), start(s) { }
+
+    ~SlowSiteEntry(void) {
+        SlowSiteLog& log = parser->run->slowSiteLog;
+        if (log.is_open()) {
+            uint64_t elapsed = wallClockNanoseconds() - start;
+            if (elapsed >= log.thresholdNanoseconds()) {
+                log.log(parser->currentSequenceName, parser->currentPosition, parser->lastHaplotypeLength,
+                        elapsed, coverage, alleles, iterations, combos, approximate);
+            }
+        }
+    }
+
+private:
+    AlleleParser* parser;
+    uint64_t start;
+};
+
+// how often a thread brings its --progress slot up to date
+#define PROGRESS_UPDATE_NANOSECONDS 100000000
+
+// keeps the run's --progress monitor up to date with how far the parser has
+// got, counting the bases of each target as the parser moves through it.  the
+// targets, or parts of them, which the parser skips for lack of alignments are
+// counted once it is done.
+class ProgressTracker {
+public:
+    ProgressTracker(AlleleParser* p, SiteCounts& s)
+        : parser(p), sites(s), monitor(p->run->progress), slot(NULL)
+        , target(NULL), sequenceEnd(0), position(0), counted(0), pending(0)
+        , countedSites(s.total), countedProcessed(s.processed), lastUpdate(0)
+    {
+        if (monitor.enabled()) {
+            slot = monitor.slot();
+        }
+    }
+
+    // at each site
+    void update(void) {
+        if (!slot) {
+            return;
+        }
+        if (parser->currentTarget != target || parser->currentSequenceName != sequence) {
+            // the rest of the last target or sequence
+            advance(target ? target->right + 1 : sequenceEnd);
+            target = parser->currentTarget;
+            sequence = parser->currentSequenceName;
+            position = target ? target->left : 0;
+            sequenceEnd = target ? 0 : parser->reference.sequenceLength(sequence);
+        }
+        advance(parser->currentPosition);
+        uint64_t now = wallClockNanoseconds();
+        if (now - lastUpdate >= PROGRESS_UPDATE_NANOSECONDS) {
+            flush();
+            lastUpdate = now;
+        }
+    }
+
+    ~ProgressTracker(void) {
+        if (!slot) {
+            return;
+        }
+        // the targets now end where the parser stopped, if the scheduler split them
+        vector<BedTarget> targets = parser->runTargets();
+        long int targetBases = 0;
+        for (vector<BedTarget>::iterator t = targets.begin(); t != targets.end(); ++t) {
+            targetBases += t->right - t->left + 1;
+        }
+        if (targetBases > counted) {
+            pending += targetBases - counted;
+        }
+        flush();
+    }
+
+private:
+    void advance(long int to) {
+        if (to > position) {
+            counted += to - position;
+            pending += to - position;
+            position = to;
+        }
+    }
+
+    void flush(void) {
+        monitor.bases += pending;
+        pending = 0;
+        monitor.sites += sites.total - countedSites;
+        monitor.processedSites += sites.processed - countedProcessed;
+        countedSites = sites.total;
+        countedProcessed = sites.processed;
+        uint64_t alignments = 0;
+        for (PositionWindow<deque<RegisteredAlignment> >::iterator ras = parser->registeredAlignments.begin();
+             ras != parser->registeredAlignments.end(); ++ras) {
+            alignments += ras->second.size();
+        }
+        lock_guard<mutex> lock(slot->slotMutex);
+        slot->sequence = parser->currentSequenceName;
+        slot->position = parser->currentPosition;
+        slot->alignments = alignments;
+    }
+
+    AlleleParser* parser;
+    SiteCounts& sites;
+    ProgressMonitor& monitor;
+    ProgressSlot* slot;
+    BedTarget* target;
+    string sequence;
+    long int sequenceEnd; // without targets, the length of the sequence
+    long int position;    // counted up to here
+    long int counted;
+    long int pending;     // counted, and not yet added to the monitor
+    unsigned long countedSites;
+    unsigned long countedProcessed;
+    uint64_t lastUpdate;
+};
+
+// calls variants at each position the parser steps through, writing the
+// resulting records to out.  when calling a region of a threaded run, the
+// scheduler may take the rest of the region from us to hand to an idle thread.
+void callVariants(AlleleParser* parser,
+                  VariantOutput& out,
+                  SiteCounts& sites,
+                  RegionScheduler* scheduler,
+                  ScheduledRegion* region) {
+
+    Parameters& parameters = parser->parameters;
+    Bias& observationBias = parser->run->observationBias;
+    Contamination& contaminationEstimates = parser->run->contaminationEstimates;
+    list<Allele*> alleles;
+
+    Samples samples;
+    NonCalls nonCalls(parameters.gVCFGQBands);
+    WorkerTeam genotypingTeam(parameters.genotypingThreads);
+
+    // this can be uncommented to force operation on a specific set of genotypes
+    vector<Allele> allGenotypeAlleles;
+    allGenotypeAlleles.push_back(genotypeAllele(ALLELE_GENOTYPE, "A", 1));
+    allGenotypeAlleles.push_back(genotypeAllele(ALLELE_GENOTYPE, "T", 1));
+    allGenotypeAlleles.push_back(genotypeAllele(ALLELE_GENOTYPE, "G", 1));
+    allGenotypeAlleles.push_back(genotypeAllele(ALLELE_GENOTYPE, "C", 1));
+
+    int allowedAlleleTypes = ALLELE_REFERENCE;
+    if (parameters.allowSNPs) {
+        allowedAlleleTypes |= ALLELE_SNP;
+    }
+    if (parameters.allowIndels) {
+        allowedAlleleTypes |= ALLELE_INSERTION;
+        allowedAlleleTypes |= ALLELE_DELETION;
+    }
+    if (parameters.allowMNPs) {
+        allowedAlleleTypes |= ALLELE_MNP;
+    }
+    if (parameters.allowComplex) {
+        allowedAlleleTypes |= ALLELE_COMPLEX;
+    }
+
+    Allele nullAllele = genotypeAllele(ALLELE_NULL, "N", 1, "1N");
+
+    sites.profile.enabled = !parameters.profileReportFile.empty();
+    // sites are timed from when the parser starts stepping to them
+    bool timingSites = parser->run->slowSiteLog.is_open() || parameters.maxSiteTime > 0;
+    uint64_t siteStart = 0;
+    auto nextAlleles = [&]() {
+        if (timingSites) {
+            siteStart = wallClockNanoseconds();
+        }
+        bool more;
+        {
+            StageTimer timer(sites.profile, STAGE_GET_NEXT_ALLELES);
+            more = parser->getNextAlleles(samples, allowedAlleleTypes);
+        }
+        if (sites.profile.enabled) {
+            sites.profile.tally(COUNTER_ALLELES_REGISTERED, parser->allelesRegistered);
+            parser->allelesRegistered = 0;
+            sites.profile.tally(COUNTER_PEAK_REGISTERED_ALIGNMENTS, parser->registeredAlignmentCount());
+        }
+        return more;
+    };
+
+    ProgressTracker progress(parser, sites);
+
+    while (nextAlleles()) {
+
+        ++sites.total;
+        progress.update();
+        FREEBAYES_PROBE2(site, parser->currentSequenceName.c_str(), parser->currentPosition);
+
+        SlowSiteEntry slowSite(parser, siteStart);
+        uint64_t deadline = parameters.maxSiteTime > 0 ? siteStart + (uint64_t) (parameters.maxSiteTime * 1e9) : 0;
+        bool memoryPressed = parser->run->memoryBudget.check();
+        size_t maxCombos = comboCap(parameters, memoryPressed);
+
+        if (scheduler) {
+            scheduler->offerSplit(region, parser);
+        }
+
+        DEBUG2("at start of main loop");
+        
+        // did we switch chromosomes or exceed our gVCF chunk size, or do we not want to use chunks?
+        // if so, we may need to output a gVCF record
+        Results results;
+        if (parameters.gVCFout 
+               &&  !(nonCalls.empty()) 
+               &&  (  (parameters.gVCFNoChunk)
+                   || (nonCalls.firstPos().first != parser->currentSequenceName)
+                   || (parameters.gVCFchunk 
+                       && nonCalls.lastPos().second - nonCalls.firstPos().second >= parameters.gVCFchunk
+                      )
+                  )
+            ){
+            vcflib::Variant var(parser->variantCallFile);
+            out.write(results.gvcf(var, nonCalls, parser), &results.values);
+            nonCalls.clear();
+        }
+
+        // don't process non-ATGCN's in the reference
+        string cb = parser->currentReferenceBaseString();
+        if (cb != "A" && cb != "T" && cb != "C" && cb != "G" && cb != "N") {
+            DEBUG2("current reference base is not in { A T G C N }");
+            continue;
+        }
+
+        int coverage = countAlleles(samples);
+
+        DEBUG("position: " << parser->currentSequenceName << ":" << (long unsigned int) parser->currentPosition + 1 << " coverage: " << coverage);
+
+        bool skip = false;
+        if (!parser->hasInputVariantAllelesAtCurrentPosition()) {
+            // skips 0-coverage regions
+            if (coverage == 0) {
+                DEBUG("no alleles left at this site after filtering");
+                skip = true;
+            } else if (coverage < parameters.minCoverage) {
+                DEBUG("post-filtering coverage of " << coverage << " is less than --min-coverage of " << parameters.minCoverage);
+                skip = true;
+            } else if (parameters.onlyUseInputAlleles) {
+                DEBUG("no input alleles, but using only input alleles for analysis, skipping position");
+                skip = true;
+            }
+
+            DEBUG2("coverage " << parser->currentSequenceName << ":" << parser->currentPosition << " == " << coverage);
+
+            // establish a set of possible alternate alleles to evaluate at this location
+
+            if (!parameters.reportMonomorphic
+                && !sufficientAlternateObservations(samples, parameters.minAltCount, parameters.minAltFraction)) {
+                DEBUG("insufficient alternate observations");
+                skip = true;
+            }
+            if (parameters.reportMonomorphic) {
+                DEBUG("calling at site even though there are no alternate observations");
+            }
+        } else {
+            /*
+            cerr << "has input variants at " << parser->currentSequenceName << ":" << parser->currentPosition << endl;
+            vector<Allele>& inputs = parser->inputVariantAlleles[parser->currentSequenceName][parser->currentPosition];
+            for (vector<Allele>::iterator a = inputs.begin(); a != inputs.end(); ++a) {
+                cerr << *a << endl;
+            }
+            */
+        }
+
+        if (skip) {
+            // record data for gVCF
+            if (parameters.gVCFout) {
+                recordNonCall(nonCalls, out, parser, samples);
+            }
+            // and step ahead
+            continue;
+        }
+
+        // to ensure proper ordering of output stream
+        vector<string> sampleListPlusRef;
+
+        for (vector<string>::iterator s = parser->sampleList.begin(); s != parser->sampleList.end(); ++s) {
+            sampleListPlusRef.push_back(*s);
+        }
+        if (parameters.useRefAllele) {
+            sampleListPlusRef.push_back(parser->currentSequenceName);
+        }
+
+        // establish genotype alleles using input filters
+        map<string, vector<Allele*> > alleleGroups;
+        groupAlleles(samples, alleleGroups);
+        DEBUG2("grouped alleles by equivalence");
+
+        vector<Allele> genotypeAlleles;
+        {
+            StageTimer timer(sites.profile, STAGE_GENOTYPE_ALLELES);
+            genotypeAlleles = parser->genotypeAlleles(alleleGroups, samples, parameters.onlyUseInputAlleles);
+        }
+
+        // always include the reference allele as a possible genotype, even when we don't include it by default
+        if (!parameters.useRefAllele) {
+            vector<Allele> refAlleleVector;
+            refAlleleVector.push_back(genotypeAllele(ALLELE_REFERENCE, string(1, parser->currentReferenceBase), 1, "1M"));
+            genotypeAlleles = alleleUnion(genotypeAlleles, refAlleleVector);
+        }
+
+        map<string, vector<Allele*> > partialObservationGroups;
+        map<Allele*, set<Allele*> > partialObservationSupport;
+
+        // build haplotype alleles matching the current longest allele (often will do nothing)
+        // this will adjust genotypeAlleles if changes are made
+        DEBUG("building haplotype alleles, currently there are " << genotypeAlleles.size() << " genotype alleles");
+        DEBUG(genotypeAlleles);
+        {
+            StageTimer timer(sites.profile, STAGE_BUILD_HAPLOTYPE_ALLELES);
+            parser->buildHaplotypeAlleles(genotypeAlleles,
+                                          samples,
+                                          alleleGroups,
+                                          partialObservationGroups,
+                                          partialObservationSupport,
+                                          allowedAlleleTypes);
+        }
+        DEBUG("built haplotype alleles, now there are " << genotypeAlleles.size() << " genotype alleles");
+        DEBUG(genotypeAlleles);
+
+        string referenceBase = parser->currentReferenceHaplotype();
+
+
+        // for debugging
+        /*
+        for (Samples::iterator s = samples.begin(); s != samples.end(); ++s) {
+            string sampleName = s->first;
+            Sample& sample = s->second;
+            cerr << sampleName << ": " << sample << endl;
+        }
+        */
+
+        // re-calculate coverage, as this could change now that we've built haplotype alleles
+        coverage = countAlleles(samples);
+
+        // estimate theta using the haplotype length
+        Probability theta = parameters.TH * parser->lastHaplotypeLength;
+
+        // if we have only one viable allele, we don't have evidence for variation at this site
+        if (!parser->hasInputVariantAllelesAtCurrentPosition() && !parameters.reportMonomorphic && genotypeAlleles.size() <= 1 && genotypeAlleles.front().isReference()) {
+            DEBUG("no alternate genotype alleles passed filters at " << parser->currentSequenceName << ":" << parser->currentPosition);
+            continue;
+        }
+        DEBUG("genotype alleles: " << genotypeAlleles);
+
+        // add the null genotype
+        bool usingNull = false;
+        if (parameters.excludeUnobservedGenotypes && genotypeAlleles.size() > 2) {
+            genotypeAlleles.push_back(nullAllele);
+            usingNull = true;
+        }
+
+        ++sites.processed;
+        slowSite.coverage = coverage;
+        slowSite.alleles = genotypeAlleles.size();
+
+        // with only the reference to genotype, as with --report-monomorphic or
+        // input variants lacking alternate support, every sample is hom-ref and
+        // the site is written as such from its observations, unless it is to
+        // be dumped or traced with its likelihoods
+        if (genotypeAlleles.size() == 1 && genotypeAlleles.front().isReference()
+            && parameters.PVL == 0
+            && !parser->run->likelihoodDump.is_open()
+            && !(parser->run->siteTrace.is_open()
+                 && parser->run->siteTrace.traces(parser->currentSequenceName, parser->currentPosition))) {
+            ++sites.monomorphic;
+            if (parameters.gVCFout && !nonCalls.empty()) {
+                vcflib::Variant var(parser->variantCallFile);
+                out.write(results.gvcf(var, nonCalls, parser), &results.values);
+                nonCalls.clear();
+            }
+            vcflib::Variant var(parser->variantCallFile);
+            {
+                StageTimer timer(sites.profile, STAGE_RESULTS_VCF);
+                results.monomorphicVcf(var, samples, referenceBase, parser->sampleList, coverage, parser);
+            }
+            if (parser->haplotypeCostCapped) {
+                var.infoFlags["HCAP"] = true;
+            }
+            if (memoryPressed && coverageCutForMemory(parser)) {
+                ++sites.memoryLimited;
+                var.infoFlags["MEMLIMIT"] = true;
+            }
+            out.write(var, &results.values);
+            continue;
+        }
+
+        // generate possible genotypes
+
+        // for each possible ploidy in the dataset, generate all possible genotypes
+        vector<int> ploidies = parser->currentPloidies(samples);
+        map<int, vector<Genotype> > genotypesByPloidy = getGenotypesByPloidy(ploidies, genotypeAlleles, parameters.poolFrequencyGrid);
+        bool fastPath = takesFastPath(genotypeAlleles, ploidies);
+        int numCopiesOfLocus = parser->copiesOfLocus(samples);
+
+
+        DEBUG2("generated all possible genotypes:");
+        if (parameters.debug2) {
+            for (map<int, vector<Genotype> >::iterator s = genotypesByPloidy.begin(); s != genotypesByPloidy.end(); ++s) {
+                vector<Genotype>& genotypes = s->second;
+                for (vector<Genotype>::iterator g = genotypes.begin(); g != genotypes.end(); ++g) {
+                    DEBUG2(*g);
+                }
+            }
+        }
+
+        // get estimated allele frequencies using sum of estimated qualities
+        map<string, double> estimatedAlleleFrequencies = samples.estimatedAlleleFrequencies();
+        double estimatedMaxAlleleFrequency = 0;
+        double estimatedMaxAlleleCount = 0;
+        double estimatedMajorFrequency = estimatedAlleleFrequencies[referenceBase];
+        if (estimatedMajorFrequency < 0.5) estimatedMajorFrequency = 1-estimatedMajorFrequency;
+        double estimatedMinorFrequency = 1-estimatedMajorFrequency;
+        //cerr << "num copies of locus " << numCopiesOfLocus << endl;
+        int estimatedMinorAllelesAtLocus = max(1, (int) ceil((double) numCopiesOfLocus * estimatedMinorFrequency));
+        //cerr << "estimated minor frequency " << estimatedMinorFrequency << endl;
+        //cerr << "estimated minor count " << estimatedMinorAllelesAtLocus << endl;
+
+
+        map<string, vector<vector<SampleDataLikelihood> > > sampleDataLikelihoodsByPopulation;
+        map<string, vector<size_t> > variantSamplesByPopulation;
+        map<string, vector<size_t> > invariantSamplesByPopulation;
+
+        map<string, int> inputAlleleCounts;
+        int inputLikelihoodCount = 0;
+
+        DEBUG2("calculating data likelihoods");
+        {
+            StageTimer timer(sites.profile, STAGE_DATA_LIKELIHOODS);
+            calculateSampleDataLikelihoods(
+                samples,
+                results,
+                parser,
+                genotypesByPloidy,
+                parameters,
+                usingNull,
+                observationBias,
+                genotypeAlleles,
+                contaminationEstimates,
+                estimatedAlleleFrequencies,
+                sampleDataLikelihoodsByPopulation,
+                variantSamplesByPopulation,
+                invariantSamplesByPopulation,
+                &genotypingTeam);
+        }
+
+        DEBUG2("finished calculating data likelihoods");
+
+        if (sites.profile.enabled) {
+            for (map<string, SampleDataLikelihoods>::iterator p = sampleDataLikelihoodsByPopulation.begin();
+                 p != sampleDataLikelihoodsByPopulation.end(); ++p) {
+                for (SampleDataLikelihoods::iterator s = p->second.begin(); s != p->second.end(); ++s) {
+                    sites.profile.tally(COUNTER_LIKELIHOOD_EVALUATIONS, s->size());
+                }
+            }
+        }
+
+
+        // if somehow we get here without any possible sample genotype likelihoods, bail out
+        bool hasSampleLikelihoods = false;
+        for (map<string, vector<vector<SampleDataLikelihood> > >::iterator s = sampleDataLikelihoodsByPopulation.begin();
+             s != sampleDataLikelihoodsByPopulation.end(); ++s) {
+            if (!s->second.empty()) {
+                hasSampleLikelihoods = true;
+                break;
+            }
+        }
+        if (!hasSampleLikelihoods) {
+            continue;
+        }
+
+        if (parser->run->likelihoodDump.is_open()) {
+            parser->run->likelihoodDump.add(parser->currentSequenceName, parser->currentPosition,
+                                            genotypeAlleles, genotypesByPloidy, samples,
+                                            sampleDataLikelihoodsByPopulation);
+        }
+
+        if (parser->run->siteTrace.is_open()
+            && parser->run->siteTrace.traces(parser->currentSequenceName, parser->currentPosition)) {
+            parser->run->siteTrace.add(parser->currentSequenceName, parser->currentPosition,
+                                       genotypeAlleles, sampleDataLikelihoodsByPopulation);
+        }
+
+        // skip the search at sites which can't reach --pvar, whatever it finds.
+        // the margin keeps rounding in the bound from dropping a site at the edge.
+        if (parameters.PVL > 0
+            && pVarUpperBound(sampleDataLikelihoodsByPopulation, samples, genotypeAlleles,
+                              referenceBase, theta, parameters) + PVAR_BOUND_MARGIN < parameters.PVL) {
+            ++sites.pruned;
+            if (parameters.gVCFout) {
+                recordNonCall(nonCalls, out, parser, samples);
+            }
+            continue;
+        }
+
+        if (fastPath) {
+            ++sites.fastPath;
+        } else {
+            ++sites.generalPath;
+        }
+        sites.profile.count(HISTOGRAM_OBSERVATIONS, coverage);
+
+        DEBUG("searching genotype space");
+
+        // cap the number of iterations at 2 x the number of alternate alleles
+        // max it at parameters.genotypingMaxIterations iterations, min at 10
+        int itermax = min(max(10, 2 * estimatedMinorAllelesAtLocus), parameters.genotypingMaxIterations);
+        ComboSearch search;
+        searchGenotypeCombos(search, sampleDataLikelihoodsByPopulation, samples, genotypeAlleles,
+                             inputAlleleCounts, theta, itermax, fastPath, maxCombos, deadline,
+                             parameters, genotypingTeam, sites.profile);
+        slowSite.iterations = search.iterations;
+        slowSite.approximate = search.approximate;
+
+        SiteCall call;
+        makeCall(call, search, sampleDataLikelihoodsByPopulation, genotypeAlleles, referenceBase, parameters);
+        sites.profile.count(HISTOGRAM_COMBOS, call.combos.size());
+        slowSite.combos = call.combos.size();
+
+        DEBUG("best combo: " << call.bestCombo);
+
+        // output
+
+        if (call.passes(parameters)) {
+
+            // write the last gVCF record(s)
+            if (parameters.gVCFout && !nonCalls.empty()) {
+                vcflib::Variant var(parser->variantCallFile);
+                out.write(results.gvcf(var, nonCalls, parser), &results.values);
+                nonCalls.clear();
+            }
+
+            writeCall(call, parser, out, results, sites, sampleDataLikelihoodsByPopulation, samples,
+                      referenceBase, search.iterations, coverage, alleleGroups,
+                      partialObservationGroups, partialObservationSupport, genotypesByPloidy,
+                      search.approximate,
+                      memoryPressed && (coverageCutForMemory(parser) || combosCutForMemory(search, parameters, maxCombos)),
+                      &genotypingTeam);
+
+        } else if (parameters.gVCFout) {
+            // record statistics for gVCF output
+            recordNonCall(nonCalls, out, parser, samples);
+        }
+        DEBUG2("finished position");
+
+    }
+
+    // write the last gVCF record
+    // NOTE: for some resion this is only needed if we are using gVCF chunks, if minimal chunking it is not requird, in fact it breaks....
+    if (parameters.gVCFout && !nonCalls.empty() && !parameters.gVCFNoChunk) {
+        Results results;
+        vcflib::Variant var(parser->variantCallFile);
+        out.write(results.gvcf(var, nonCalls, parser), &results.values);
+        nonCalls.clear();
+    }
+
+}
+
+// calls the regions of the run in parallel, giving each thread its own parser
+// over the regions it takes on.  the records of each region are held by a
+// RegionScheduler until all the regions before it have been written, so that
+// the output is in the same order as it would be from a single parser.
+vector<vector<BedTarget> > threadedRegions(AlleleParser* parser) {
+    vector<vector<BedTarget> > regions;
+    if (parser->parameters.autoRegions > 0) {
+        regions = parser->balancedRegions(parser->parameters.autoRegions);
+    } else {
+        vector<BedTarget> windows = parser->targetRegions(THREADED_REGION_SIZE);
+        for (vector<BedTarget>::iterator w = windows.begin(); w != windows.end(); ++w) {
+            regions.push_back(vector<BedTarget>(1, *w));
+        }
+    }
+    return regions;
+}
+
+bool startCheckpoint(AlleleParser* parser, size_t regions) {
+    RunCheckpoint& checkpoint = parser->run->checkpoint;
+    if (!checkpoint.start(regions)) {
+        ERROR("the checkpoint is of a run over " << checkpoint.regions << " regions, not "
+              << regions << "; was the reference or were the targets changed?");
+        return false;
+    }
+    return true;
+}
+
+void callVariantsInThreads(AlleleParser* parser,
+                           VariantWriter& writer,
+                           SiteCounts& sites) {
+
+    Parameters& parameters = parser->parameters;
+
+    vector<vector<BedTarget> > regions = threadedRegions(parser);
+    // more threads than regions is fine, as idle threads split the running regions
+    int threadCount = parameters.threads;
+
+    DEBUG("calling " << regions.size() << " regions using " << threadCount << " threads");
+
+    // a resumed run picks up after the regions its checkpoint has written
+    RunCheckpoint* checkpoint = parser->run->checkpoint.is_open() ? &parser->run->checkpoint : NULL;
+    if (checkpoint) {
+        if (!startCheckpoint(parser, regions.size())) {
+            exit(1);
+        }
+        if (checkpoint->resuming()) {
+            DEBUG("resuming after " << checkpoint->written << " of " << regions.size() << " regions");
+            regions.erase(regions.begin(), regions.begin() + checkpoint->written);
+        }
+    }
+
+    // allow each thread to run a region ahead of the oldest unwritten one
+    RegionScheduler scheduler(writer, regions, 2 * threadCount, checkpoint);
+    mutex sitesMutex;
+
+    // the threads are dealt out over the nodes in turn.  each builds its
+    // parser, reference window and allele pools after it is placed, so they
+    // are allocated on its node, as is the work of the team it starts.
+    NumaTopology topology;
+    if (parameters.numa && !topology.load()) {
+        WARNING("--numa found no NUMA nodes, leaving the threads unplaced");
+    }
+    vector<uint64_t> numaThreads(topology.nodes(), 0);
+
+    vector<thread> workers;
+    for (int i = 0; i < threadCount; ++i) {
+        workers.push_back(thread([&, i]() {
+            if (topology.nodes() > 0) {
+                size_t node = i % topology.nodes();
+                if (pinThreadToCpus(topology.nodeCpus[node])) {
+                    lock_guard<mutex> lock(sitesMutex);
+                    ++numaThreads[node];
+                }
+            }
+            AlleleParser* cursor = NULL;
+            SiteCounts threadSites;
+            while (ScheduledRegion* region = scheduler.nextRegion()) {
+                if (!cursor) {
+                    cursor = new AlleleParser(*parser, region->targets);
+                } else {
+                    cursor->setTargets(region->targets);
+                }
+                RegionVariantOutput regionOut(scheduler, region);
+                callVariants(cursor, regionOut, threadSites, &scheduler, region);
+                scheduler.finishRegion(region);
+            }
+            delete cursor;
+            lock_guard<mutex> lock(sitesMutex);
+            sites.add(threadSites);
+        }));
+    }
+
+    for (vector<thread>::iterator w = workers.begin(); w != workers.end(); ++w) {
+        w->join();
+    }
+    if (!numaThreads.empty()) {
+        sites.profile.numaThreads = numaThreads;
+    }
+
+}
+
+// genotypes the samples of the --joint-likelihoods dumps together at each site
+// any of them has, from the likelihoods stored in the dumps rather than from
+// their alignments.
+//
+// the alleles of a site are the union of those of the dumps which have it,
+// over the longest reference span any of them gives it.  dumps whose site
+// spans less of the reference leave their samples out, as do samples with no
+// likelihoods at the site, just as samples without reads are left out.  the
+// stored likelihoods of each sample are mapped onto the genotypes of the
+// union, where an allele which the sample's dump didn't consider stands in for
+// the allele of the dump which the sample has the fewest observations of, as
+// it has no observations of it either.  the observation counts and quality
+// sums of the dumps are rebuilt into stand-in observations, so the records
+// report them, but not what the dumps don't keep, such as mapping qualities.
+void callJointGenotypes(AlleleParser* parser,
+                        VariantOutput& out,
+                        SiteCounts& sites) {
+
+    Parameters& parameters = parser->parameters;
+    vector<shared_ptr<LikelihoodDump> >& dumps = parser->run->jointLikelihoods;
+    WorkerTeam genotypingTeam(parameters.genotypingThreads);
+    sites.profile.enabled = !parameters.profileReportFile.empty();
+
+    vector<BedTarget> targets = parser->runTargets();
+    for (vector<BedTarget>::iterator t = targets.begin(); t != targets.end(); ++t) {
+
+        // the sites of every dump in the target
+        set<long int> positions;
+        for (vector<shared_ptr<LikelihoodDump> >::iterator d = dumps.begin(); d != dumps.end(); ++d) {
+            vector<long int> sitePositions;
+            (*d)->positions(t->seq, sitePositions);
+            for (vector<long int>::iterator p = sitePositions.begin(); p != sitePositions.end(); ++p) {
+                if (*p >= t->left && *p <= t->right) {
+                    positions.insert(*p);
+                }
+            }
+        }
+
+        for (set<long int>::iterator p = positions.begin(); p != positions.end(); ++p) {
+
+            ++sites.total;
+            bool memoryPressed = parser->run->memoryBudget.check();
+            size_t maxCombos = comboCap(parameters, memoryPressed);
+
+            vector<LikelihoodDumpSite> dumpSites(dumps.size());
+            vector<bool> hasSite(dumps.size(), false);
+            int referenceLength = 0;
+            for (size_t d = 0; d < dumps.size(); ++d) {
+                if (dumps[d]->read(t->seq, *p, dumpSites[d]) && !dumpSites[d].alleles.empty()) {
+                    hasSite[d] = true;
+                    referenceLength = max(referenceLength, (int) dumpSites[d].alleles.front().referenceLength);
+                }
+            }
+
+            // the union of the alleles of the dumps which span the site
+            vector<Allele> genotypeAlleles;
+            map<string, int> alleleIndexes;
+            for (size_t d = 0; d < dumps.size(); ++d) {
+                if (hasSite[d] && dumpSites[d].alleles.front().referenceLength != referenceLength) {
+                    DEBUG("the site of " << parameters.jointLikelihoodFiles[d] << " at " << t->seq << ":" << *p + 1
+                          << " spans " << dumpSites[d].alleles.front().referenceLength << "bp rather than "
+                          << referenceLength << "bp, leaving out its samples");
+                    hasSite[d] = false;
+                }
+                if (!hasSite[d]) {
+                    continue;
+                }
+                vector<Allele>& siteAlleles = dumpSites[d].alleles;
+                for (vector<Allele>::iterator a = siteAlleles.begin(); a != siteAlleles.end(); ++a) {
+                    if (!alleleIndexes.count(a->currentBase)) {
+                        alleleIndexes[a->currentBase] = genotypeAlleles.size();
+                        genotypeAlleles.push_back(*a);
+                    }
+                }
+            }
+
+            string referenceBase;
+            for (vector<Allele>::iterator a = genotypeAlleles.begin(); a != genotypeAlleles.end(); ++a) {
+                if (a->isReference()) {
+                    referenceBase = a->currentBase;
+                }
+            }
+            if (referenceBase.empty()) {
+                DEBUG("no reference allele at " << t->seq << ":" << *p + 1);
+                continue;
+            }
+            if (!parameters.reportMonomorphic && genotypeAlleles.size() <= 1) {
+                continue;
+            }
+
+            parser->toJointSite(t->seq, *p, referenceLength);
+
+            // the dump and ploidy of each sample with likelihoods at the site,
+            // and its observations, as counted by the dump
+            map<string, pair<size_t, int> > sampleSources;
+            Samples samples;
+            map<string, vector<Allele*> > alleleGroups;
+            deque<Allele> observations;
+            set<int> ploidySet;
+            for (size_t d = 0; d < dumps.size(); ++d) {
+                if (!hasSite[d]) {
+                    continue;
+                }
+                LikelihoodDumpSite& site = dumpSites[d];
+                const vector<string>& dumpSamples = dumps[d]->samples();
+                for (size_t s = 0; s < dumpSamples.size(); ++s) {
+                    const string& name = dumpSamples[s];
+                    if (!parser->run->sampleIDs.count(name)) {
+                        continue; // not in --samples
+                    }
+                    int ploidy = 0;
+                    for (size_t g = 0; g < site.genotypes.size(); ++g) {
+                        if (!std::isnan(site.likelihood(s, g))) {
+                            ploidy = site.genotypes[g].size();
+                            break;
+                        }
+                    }
+                    if (ploidy == 0) {
+                        continue;
+                    }
+                    sampleSources[name] = make_pair(d, ploidy);
+                    ploidySet.insert(ploidy);
+                    Sample& sample = samples[name];
+                    for (size_t a = 0; a < site.alleles.size(); ++a) {
+                        int count = site.observationCount(s, a);
+                        for (int i = 0; i < count; ++i) {
+                            observations.push_back(site.alleles[a]);
+                            Allele* observation = &observations.back();
+                            // the sum of the qualities is carried by the first
+                            observation->quality = i == 0 ? site.qualSum(s, a) : 0;
+                            sample[observation->currentBase].push_back(observation);
+                            alleleGroups[observation->currentBase].push_back(observation);
+                        }
+                    }
+                }
+            }
+            if (sampleSources.empty()) {
+                continue;
+            }
+
+            ++sites.processed;
+
+            vector<int> ploidies(ploidySet.begin(), ploidySet.end());
+            map<int, vector<Genotype> > genotypesByPloidy = getGenotypesByPloidy(ploidies, genotypeAlleles, parameters.poolFrequencyGrid);
+            bool fastPath = takesFastPath(genotypeAlleles, ploidies);
+
+            // the genotypes of each dump, by the sorted indexes of their alleles
+            vector<map<vector<int>, size_t> > dumpGenotypes(dumps.size());
+            for (size_t d = 0; d < dumps.size(); ++d) {
+                if (!hasSite[d]) {
+                    continue;
+                }
+                vector<vector<int> >& genotypes = dumpSites[d].genotypes;
+                for (size_t g = 0; g < genotypes.size(); ++g) {
+                    vector<int> key = genotypes[g];
+                    sort(key.begin(), key.end());
+                    dumpGenotypes[d][key] = g;
+                }
+            }
+
+            Results results;
+            map<string, vector<vector<SampleDataLikelihood> > > sampleDataLikelihoodsByPopulation;
+            for (vector<string>::iterator n = parser->sampleList.begin(); n != parser->sampleList.end(); ++n) {
+                map<string, pair<size_t, int> >::iterator source = sampleSources.find(*n);
+                if (source == sampleSources.end()) {
+                    continue;
+                }
+                const string& sampleName = *n;
+                size_t d = source->second.first;
+                LikelihoodDumpSite& site = dumpSites[d];
+                size_t s = find(dumps[d]->samples().begin(), dumps[d]->samples().end(), sampleName) - dumps[d]->samples().begin();
+                Sample& sample = samples[sampleName];
+
+                // the allele of the dump standing for each allele of the union
+                size_t leastObserved = 0;
+                for (size_t a = 1; a < site.alleles.size(); ++a) {
+                    if (site.observationCount(s, a) < site.observationCount(s, leastObserved)) {
+                        leastObserved = a;
+                    }
+                }
+                map<string, int> siteIndexes;
+                for (size_t a = 0; a < site.alleles.size(); ++a) {
+                    siteIndexes[site.alleles[a].currentBase] = a;
+                }
+
+                Result& sampleData = results[sampleName];
+                sampleData.name = sampleName;
+                sampleData.observations = &sample;
+                vector<Genotype>& genotypes = genotypesByPloidy[source->second.second];
+                for (vector<Genotype>::iterator g = genotypes.begin(); g != genotypes.end(); ++g) {
+                    vector<int> key;
+                    for (Genotype::iterator e = g->begin(); e != g->end(); ++e) {
+                        map<string, int>::iterator i = siteIndexes.find(e->allele.currentBase);
+                        key.insert(key.end(), e->count, i == siteIndexes.end() ? leastObserved : i->second);
+                    }
+                    sort(key.begin(), key.end());
+                    map<vector<int>, size_t>::iterator k = dumpGenotypes[d].find(key);
+                    if (k != dumpGenotypes[d].end()) {
+                        double likelihood = site.likelihood(s, k->second);
+                        if (!std::isnan(likelihood)) {
+                            sampleData.push_back(SampleDataLikelihood(sampleName, &sample, &*g, likelihood, 0));
+                        }
+                    }
+                }
+                if (sampleData.empty()) {
+                    results.erase(sampleName);
+                    continue;
+                }
+                sortSampleDataLikelihoods(sampleData);
+                sampleDataLikelihoodsByPopulation[parser->samplePopulation[sampleName]].push_back(sampleData);
+            }
+            if (sampleDataLikelihoodsByPopulation.empty()) {
+                continue;
+            }
+
+            if (fastPath) {
+                ++sites.fastPath;
+            } else {
+                ++sites.generalPath;
+            }
+
+            Probability theta = parameters.TH * referenceLength;
+            int itermax = min(max(10, 2 * (int) (genotypeAlleles.size() - 1)), parameters.genotypingMaxIterations);
+            map<string, int> inputAlleleCounts;
+            sites.profile.count(HISTOGRAM_OBSERVATIONS, countAlleles(samples));
+            ComboSearch search;
+            searchGenotypeCombos(search, sampleDataLikelihoodsByPopulation, samples, genotypeAlleles,
+                                 inputAlleleCounts, theta, itermax, fastPath, maxCombos, 0, // no deadline
+                                 parameters, genotypingTeam, sites.profile);
+
+            SiteCall call;
+            makeCall(call, search, sampleDataLikelihoodsByPopulation, genotypeAlleles, referenceBase, parameters);
+            sites.profile.count(HISTOGRAM_COMBOS, call.combos.size());
+            if (!call.passes(parameters)) {
+                continue;
+            }
+
+            map<string, vector<Allele*> > partialObservationGroups;
+            map<Allele*, set<Allele*> > partialObservationSupport;
+            writeCall(call, parser, out, results, sites, sampleDataLikelihoodsByPopulation, samples,
+                      referenceBase, search.iterations, countAlleles(samples), alleleGroups,
+                      partialObservationGroups, partialObservationSupport, genotypesByPloidy,
+                      false, memoryPressed && combosCutForMemory(search, parameters, maxCombos),
+                      &genotypingTeam);
+        }
+    }
+
+}
@@ -0,0 +1,66 @@
+#ifndef FREEBAYES_CALLER_H
+#define FREEBAYES_CALLER_H
+
+#include "AlleleParser.h"
+#include "RegionScheduler.h"
+#include "VariantWriter.h"
+#include "Profile.h"
+
+using namespace std;
+
+// tallies of the sites we step through, reported at the end of the run
+class SiteCounts {
+public:
+    unsigned long total;        // sites the parser stepped to
+    unsigned long processed;    // sites with alleles worth genotyping
+    unsigned long fastPath;     // sites genotyped by the fast path, see takesFastPath
+    unsigned long generalPath;  // sites genotyped by the general search
+    unsigned long pruned;       // sites not searched, as they couldn't reach --pvar
+    unsigned long monomorphic;  // sites written as hom-ref without genotyping
+    unsigned long memoryLimited;  // records the --max-memory limits changed, flagged MEMLIMIT
+    RunProfile profile;         // --profile-report
+
+    SiteCounts(void) : total(0), processed(0), fastPath(0), generalPath(0), pruned(0), monomorphic(0), memoryLimited(0) { }
+
+    void add(const SiteCounts& other) {
+        total += other.total;
+        processed += other.processed;
+        fastPath += other.fastPath;
+        generalPath += other.generalPath;
+        pruned += other.pruned;
+        monomorphic += other.monomorphic;
+        memoryLimited += other.memoryLimited;
+        profile.add(other.profile);
+    }
+};
+
+// sites with an upper bound on p(var) this far below --pvar aren't genotyped
+#define PVAR_BOUND_MARGIN 1e-9
+
+// calls variants at each position the parser steps through, writing the
+// resulting records to out.  when calling a region of a threaded run, the
+// scheduler may take the rest of the region from us to hand to an idle thread.
+void callVariants(AlleleParser* parser,
+                  VariantOutput& out,
+                  SiteCounts& sites,
+                  RegionScheduler* scheduler = NULL,
+                  ScheduledRegion* region = NULL);
+
+// the regions a threaded run is called in, each of one or more targets
+vector<vector<BedTarget> > threadedRegions(AlleleParser* parser);
+
+// starts the checkpoint of a run over the regions, returning false if they
+// aren't those of the checkpoint it resumes
+bool startCheckpoint(AlleleParser* parser, size_t regions);
+
+// calls the regions of the run in parallel, writing the records in order
+void callVariantsInThreads(AlleleParser* parser,
+                           VariantWriter& writer,
+                           SiteCounts& sites);
+
+// genotypes the samples of the --joint-likelihoods dumps together
+void callJointGenotypes(AlleleParser* parser,
+                        VariantOutput& out,
+                        SiteCounts& sites);
+
+#endif
@@ -0,0 +1,106 @@
+#include "CallingSession.h"
+#include "Logging.h"
+#include <stdlib.h>
+#include <getopt.h>
+
+CallingSession::CallingSession(const vector<string>& arguments) {
+
+    vector<string> args;
+    args.push_back("freebayes");
+    args.insert(args.end(), arguments.begin(), arguments.end());
+    vector<char*> argv;
+    for (vector<string>::iterator a = args.begin(); a != args.end(); ++a) {
+        argv.push_back(&(*a)[0]);
+    }
+    argv.push_back(NULL);
+
+    // getopt keeps its place in globals, left at the end of the last parse
+    optind = 1;
+    parser = new AlleleParser(args.size(), &argv[0]);
+    start();
+
+}
+
+CallingSession::CallingSession(AlleleParser* p)
+    : parser(p)
+{
+    start();
+}
+
+void CallingSession::start(void) {
+
+    Parameters& parameters = parser->parameters;
+    if (parameters.useStdin) {
+        ERROR("a calling session needs indexed alignment files, not stdin");
+        exit(1);
+    }
+    if (!parameters.jointLikelihoodFiles.empty()) {
+        ERROR("a calling session calls from alignments, not --joint-likelihoods");
+        exit(1);
+    }
+    if (parameters.threads > 1) {
+        WARNING("a calling session calls each request on a single thread, ignoring --threads");
+    }
+
+    sessionTargets = parser->runTargets();
+
+}
+
+CallingSession::~CallingSession(void) {
+    delete parser;
+}
+
+const Parameters& CallingSession::parameters(void) {
+    return parser->parameters;
+}
+
+string CallingSession::vcfHeader(void) {
+    return parser->variantCallFile.header;
+}
+
+bool CallingSession::regionTarget(const string& region, BedTarget& target) {
+    lock_guard<mutex> lock(callMutex);
+    return parser->regionTarget(region, target) && parser->validTarget(target);
+}
+
+SiteCounts CallingSession::siteCounts(void) {
+    lock_guard<mutex> lock(callMutex);
+    return sites;
+}
+
+bool CallingSession::callRegions(const vector<string>& regions, VariantCallback callback) {
+    vector<BedTarget> targets;
+    for (vector<string>::const_iterator r = regions.begin(); r != regions.end(); ++r) {
+        BedTarget target;
+        if (!regionTarget(*r, target)) {
+            return false;
+        }
+        targets.push_back(target);
+    }
+    return callTargets(targets, callback);
+}
+
+bool CallingSession::callRegions(const vector<string>& regions, vector<vcflib::Variant>& variants) {
+    return callRegions(regions, [&variants](vcflib::Variant& var) { variants.push_back(var); });
+}
+
+bool CallingSession::callTargets(const vector<BedTarget>& targets, VariantCallback callback) {
+    lock_guard<mutex> lock(callMutex);
+    for (vector<BedTarget>::const_iterator t = targets.begin(); t != targets.end(); ++t) {
+        if (!parser->validTarget(*t)) {
+            return false;
+        }
+    }
+    if (targets.empty()) {
+        return true;
+    }
+    // a parser without targets would stream the files from their starts
+    parser->setTargets(targets);
+    CallbackVariantOutput out(callback);
+    callVariants(parser, out, sites);
+    return true;
+}
+
+void CallingSession::call(VariantCallback callback) {
+    callTargets(sessionTargets, callback);
+}
@@ -0,0 +1,91 @@
+#ifndef FREEBAYES_CALLINGSESSION_H
+#define FREEBAYES_CALLINGSESSION_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <functional>
+#include "Variant.h"
+#include "BedReader.h"
+#include "AlleleParser.h"
+#include "RegionScheduler.h"
+#include "Caller.h"
+
+using namespace std;
+
+// hands the records made while calling to a function
+class CallbackVariantOutput : public VariantOutput {
+public:
+    using VariantOutput::write;
+    CallbackVariantOutput(function<void(vcflib::Variant&)> c) : callback(c) { }
+    void write(vcflib::Variant& var, RecordValues* values) {
+        callback(var);
+    }
+private:
+    function<void(vcflib::Variant&)> callback;
+};
+
+// a run of freebayes kept open in-process, for genotyping one small region
+// after another without starting a process and reopening the inputs for each
+//
+// the session is set up from the arguments freebayes would be run with, and
+// opens the reference and the alignments and their indexes, and reads the
+// samples of their headers, once.  each call rewinds the session's parser
+// over the regions asked for, as the threads of a threaded run are rewound
+// over the regions they take on, so all of that stays open between calls.
+// the records of a call are handed to a callback as they're made, or
+// returned, in the order of the regions given.  they refer to the session's
+// VCF header, and are valid for as long as the session is.
+//
+// calls from several threads are made one at a time, and each is called on
+// the thread making it, so --threads is ignored, with a warning.  as with the
+// command, arguments freebayes would reject end the process; regions which
+// aren't on the reference only fail the call.
+class CallingSession {
+
+public:
+
+    typedef function<void(vcflib::Variant&)> VariantCallback;
+
+    // the arguments of the command line, without the program name; any
+    // --region or --targets given are what calls to call() cover
+    CallingSession(const vector<string>& arguments);
+    // a session over a parser already set up from the command line, which
+    // the session takes on
+    CallingSession(AlleleParser* p);
+    ~CallingSession(void);
+
+    // the header of the VCF which the records belong to
+    string vcfHeader(void);
+    // those the session was set up with
+    const Parameters& parameters(void);
+
+    // calls the regions, each given as to --region, returning false without
+    // calling any of them if one isn't on the reference
+    bool callRegions(const vector<string>& regions, VariantCallback callback);
+    bool callRegions(const vector<string>& regions, vector<vcflib::Variant>& variants);
+    // calls the targets, 0-based with inclusive ends, as BedReader reads them
+    bool callTargets(const vector<BedTarget>& targets, VariantCallback callback);
+    // calls the targets given with the arguments of the session, or the
+    // whole of the reference if none were
+    void call(VariantCallback callback);
+
+    // the target of a region given as to --region, false if it isn't one of
+    // the reference
+    bool regionTarget(const string& region, BedTarget& target);
+    // the sites of the calls made so far
+    SiteCounts siteCounts(void);
+
+private:
+
+    void start(void);
+
+    AlleleParser* parser;
+    SiteCounts sites;  // over the calls made so far
+
+    vector<BedTarget> sessionTargets; // of the arguments, or the whole reference
+    mutex callMutex;
+
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include "Checkpoint.h"
+#include "Profile.h"
+#include "Logging.h"
+#include "convert.h"
+#include <fstream>
+#include <sstream>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// the command line as it would be given to resume the run, or to start it
+static string resumableCommand(const string& commandline) {
+    stringstream words(commandline);
+    string word;
+    string command;
+    while (words >> word) {
+        if (word != "--resume") {
+            command += (command.empty() ? "" : " ") + word;
+        }
+    }
+    return command;
+}
+
+bool RunCheckpoint::load(const string& dir, const string& commandline) {
+    string checkpointPath = dir + "/checkpoint";
+    ifstream in(checkpointPath.c_str());
+    if (!in) {
+        ERROR("there is no checkpoint to resume from in " << dir);
+        return false;
+    }
+    string line;
+    string savedCommand;
+    while (getline(in, line)) {
+        size_t space = line.find(' ');
+        string key = line.substr(0, space);
+        string value = space == string::npos ? "" : line.substr(space + 1);
+        if (key == "command") {
+            savedCommand = value;
+        } else if (key == "regions") {
+            convert(value, regions);
+        } else if (key == "written") {
+            convert(value, written);
+        } else if (key == "offset") {
+            convert(value, offset);
+        }
+    }
+    if (savedCommand != resumableCommand(commandline)) {
+        ERROR("the checkpoint in " << dir << " is of another run: " << savedCommand);
+        return false;
+    }
+    resumed = true;
+    return true;
+}
+
+bool RunCheckpoint::open(const string& dir, double intervalSeconds, const string& file, const string& commandline) {
+    if (mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST) {
+        ERROR("could not make the checkpoint directory " << dir << ": " << strerror(errno));
+        return false;
+    }
+    path = dir + "/checkpoint";
+    command = resumableCommand(commandline);
+    outputFile = file;
+    intervalNanoseconds = intervalSeconds * 1e9;
+    lastSaved = wallClockNanoseconds();
+    return true;
+}
+
+bool RunCheckpoint::start(size_t runRegions) {
+    if (resumed && runRegions != regions) {
+        return false;
+    }
+    regions = runRegions;
+    resumedRegions = written;
+    return true;
+}
+
+void RunCheckpoint::regionsWritten(VariantWriter& writer, size_t count) {
+    written = resumedRegions + count;
+    uint64_t now = wallClockNanoseconds();
+    if (written < regions && now - lastSaved < intervalNanoseconds) {
+        return;
+    }
+    writer.flush();
+    struct stat info;
+    if (stat(outputFile.c_str(), &info) != 0) {
+        WARNING("could not find the size of " << outputFile << " for a checkpoint: " << strerror(errno));
+        return;
+    }
+    offset = info.st_size;
+    if (!save()) {
+        WARNING("could not write the checkpoint " << path << ": " << strerror(errno));
+    }
+    lastSaved = now;
+}
+
+bool RunCheckpoint::save(void) {
+    string partial = path + ".partial";
+    {
+        ofstream out(partial.c_str());
+        out << "command " << command << endl
+            << "output " << outputFile << endl
+            << "regions " << regions << endl
+            << "written " << written << endl
+            << "offset " << offset << endl;
+        out.close();
+        if (!out) {
+            return false;
+        }
+    }
+    return rename(partial.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,71 @@
+#ifndef FREEBAYES_CHECKPOINT_H
+#define FREEBAYES_CHECKPOINT_H
+
+#include <string>
+#include <stdint.h>
+#include "VariantWriter.h"
+
+using namespace std;
+
+// where a run stands, for --checkpoint and --resume
+//
+// a checkpointed run is called in regions which are fixed by its arguments
+// and the reference, and written in order by a RegionScheduler.  a checkpoint
+// records how many of the regions have been written, and the size of the
+// output once they are flushed to it, which for BGZF output ends a block.
+// each region ends with the gVCF record of its last non-called sites, so
+// nothing else is pending between regions.  a resumed run cuts the output
+// back to that size and calls the regions after those written, appending to
+// the output.
+//
+// the checkpoint is written beside the last and renamed over it, so a run
+// stopped while writing one leaves the one before.
+class RunCheckpoint {
+
+public:
+
+    RunCheckpoint(void)
+        : regions(0)
+        , written(0)
+        , offset(0)
+        , resumed(false)
+        , resumedRegions(0)
+        , intervalNanoseconds(0)
+        , lastSaved(0)
+    { }
+
+    // reads the checkpoint in the directory, for --resume, returning false
+    // if there isn't one, or if it was made by another command line
+    bool load(const string& dir, const string& commandline);
+    // keeps checkpoints of the output file in the directory, made if need be
+    bool open(const string& dir, double intervalSeconds, const string& outputFile, const string& commandline);
+    bool is_open(void) const { return !path.empty(); }
+    bool resuming(void) const { return resumed; }
+
+    // called with the regions of the run before they are called, returning
+    // false if they aren't those of the checkpoint being resumed
+    bool start(size_t runRegions);
+    // called once the first count of the regions called by this process are
+    // written; saves a checkpoint once the interval has passed since the
+    // last, and once every region is written
+    void regionsWritten(VariantWriter& writer, size_t count);
+
+    size_t regions;  // of the run
+    size_t written;  // of those, as of the last checkpoint
+    long int offset; // the size of the output once they were written
+
+private:
+
+    bool save(void);
+
+    string path;        // of the checkpoint
+    string command;     // the command line, without --resume
+    string outputFile;
+    bool resumed;
+    size_t resumedRegions; // written before this process started
+    uint64_t intervalNanoseconds;
+    uint64_t lastSaved;
+
+};
+
+#endif
@@ -0,0 +1,84 @@
+#include "Cigar.h"
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "convert.h"
+
+uint32_t CigarElement::opCode(char op) {
+    const char* ops = "MIDNSHP=X";
+    const char* o = strchr(ops, op);
+    if (!o || !op) {
+        cerr << "unknown CIGAR operation '" << op << "'" << endl;
+        exit(1);
+    }
+    return o - ops;
+}
+
+Cigar::Cigar(const string& cigarStr) {
+    // strings go [Number][Type] ...
+    uint32_t length = 0;
+    for (string::const_iterator s = cigarStr.begin(); s != cigarStr.end(); ++s) {
+        char c = *s;
+        if (isdigit(c)) {
+            length = length * 10 + (c - '0');
+        } else {
+            if (length) {
+                push_back(CigarElement(length, c));
+            }
+            length = 0;
+        }
+    }
+}
+
+Cigar::Cigar(const char* cigarStr) {
+    *this = Cigar(string(cigarStr));
+}
+
+void Cigar::merge(const Cigar& other) {
+    const_iterator c = other.begin();
+    if (!empty() && c != other.end() && back().sameOp(*c)) {
+        back().setLength(back().length() + c->length());
+        ++c;
+    }
+    insert(end(), c, other.end());
+}
+
+static bool isEmptyCigarElement(const CigarElement& elem) {
+    return elem.length() == 0;
+}
+
+void Cigar::removeEmpty(void) {
+    erase(remove_if(begin(), end(), isEmptyCigarElement), end());
+}
+
+int Cigar::referenceLength(void) const {
+    int r = 0;
+    for (const_iterator c = begin(); c != end(); ++c) {
+        switch (c->op()) {
+        case 'M':
+        case 'X':
+        case 'D':
+            r += c->length();
+            break;
+        case 'N':
+        case 'I':
+        default:
+            break;
+        }
+    }
+    return r;
+}
+
+string Cigar::str(void) const {
+    string cigarStr;
+    for (const_iterator c = begin(); c != end(); ++c) {
+        if (c->length()) {
+            cigarStr += convert(c->length()) + c->op();
+        }
+    }
+    return cigarStr;
+}
+
+ostream& operator<<(ostream& out, const Cigar& cigar) {
+    return out << cigar.str();
+}
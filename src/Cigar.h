@@ -0,0 +1,64 @@
+#ifndef FREEBAYES_CIGAR_H
+#define FREEBAYES_CIGAR_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+// one operation of a CIGAR, packed as in BAM: the length in the upper 28
+// bits and the operation in the lower 4.  besides the BAM operations we use
+// 'X' for mismatches and 'N' for the bases of null alleles.
+class CigarElement {
+
+public:
+
+    CigarElement(void) : packed(0) { }
+    CigarElement(uint32_t length, char op) : packed(length << 4 | opCode(op)) { }
+
+    uint32_t length(void) const { return packed >> 4; }
+    char op(void) const { return "MIDNSHP=X"[packed & 0xf]; }
+    bool sameOp(const CigarElement& other) const { return (packed & 0xf) == (other.packed & 0xf); }
+
+    void setLength(uint32_t length) { packed = length << 4 | (packed & 0xf); }
+
+    bool operator==(const CigarElement& other) const { return packed == other.packed; }
+    bool operator!=(const CigarElement& other) const { return packed != other.packed; }
+
+private:
+
+    static uint32_t opCode(char op);
+
+    uint32_t packed;
+
+};
+
+// the CIGAR of an allele, which is only written out as a string for
+// debugging and the CIGAR field of the VCF
+class Cigar : public vector<CigarElement> {
+
+public:
+
+    Cigar(void) { }
+    Cigar(uint32_t length, char op) { push_back(CigarElement(length, op)); }
+    // parses e.g. "1M2D1M"
+    Cigar(const string& cigarStr);
+    Cigar(const char* cigarStr);
+
+    // appends the other, merging the elements at the join if they're alike
+    void merge(const Cigar& other);
+    // drops elements of length 0
+    void removeEmpty(void);
+
+    // on the reference, counting M, X and D
+    int referenceLength(void) const;
+
+    string str(void) const;
+
+};
+
+ostream& operator<<(ostream& out, const Cigar& cigar);
+
+#endif
@@ -25,6 +25,7 @@ void Contamination::open(string& file) {
         ContaminationEstimate c;
         convert(fields[1], c.probRefGivenHet);
         convert(fields[2], c.probRefGivenHomAlt);
+        c.update();
         if (sample == "*") { // default
             defaultEstimate = c;
         } else {
@@ -69,3 +70,19 @@ ContaminationEstimate& Contamination::of(string& sample) {
         return defaultEstimate;
     }
 }
+
+void Contamination::index(const vector<string>& readGroups) {
+    readGroupEstimates.clear();
+    for (vector<string>::const_iterator r = readGroups.begin(); r != readGroups.end(); ++r) {
+        string readGroup = *r;
+        readGroupEstimates.push_back(of(readGroup));
+    }
+}
+
+ContaminationEstimate& Contamination::of(int readGroup) {
+    if (readGroup >= 0 && readGroup < readGroupEstimates.size()) {
+        return readGroupEstimates[readGroup];
+    } else {
+        return defaultEstimate;
+    }
+}
@@ -9,6 +9,7 @@
 #include <cstdlib>
 #include <cmath>
 #include "split.h"
+#include "Probability.h"
 
 using namespace std;
 
@@ -17,21 +18,36 @@ public:
     double probRefGivenHet;
     double probRefGivenHomAlt;
     double refBias;
-ContaminationEstimate(void) : probRefGivenHet(0.5), probRefGivenHomAlt(0), refBias(0) { }
-ContaminationEstimate(double ra, double aa) : probRefGivenHet(ra), probRefGivenHomAlt(aa)
-    {
+    // the logs the likelihoods take of the above, for each observation of
+    // a homozygous genotype, and of a reference or alternate allele of a
+    // heterozygous one
+    Probability lnHomozygous;        // log(1 - probRefGivenHomAlt)
+    Probability lnRefGivenHet;       // log(probRefGivenHet / 0.5)
+    Probability lnAltGivenHet;       // log((1 - probRefGivenHet) / 0.5)
+ContaminationEstimate(void) : probRefGivenHet(0.5), probRefGivenHomAlt(0) { update(); }
+ContaminationEstimate(double ra, double aa) : probRefGivenHet(ra), probRefGivenHomAlt(aa) { update(); }
+    // after the probabilities are set
+    void update(void) {
         refBias = probRefGivenHet * 2 - 1;
+        lnHomozygous = log(1 - probRefGivenHomAlt);
+        lnRefGivenHet = log(probRefGivenHet / 0.5);
+        lnAltGivenHet = log((1 - probRefGivenHet) / 0.5);
     }
 };
 
 class Contamination : public map<string, ContaminationEstimate> {
 public:
     ContaminationEstimate defaultEstimate;
+    vector<ContaminationEstimate> readGroupEstimates; // by read group id, see index
     void open(string& file);
+    // lays the estimates out by read group id, so they can be found without
+    // comparing names; readGroups gives the name of each id
+    void index(const vector<string>& readGroups);
     double probRefGivenHet(string& sample);
     double probRefGivenHomAlt(string& sample);
     double refBias(string& sample);
     ContaminationEstimate& of(string& sample);
+    ContaminationEstimate& of(int readGroup);
 Contamination(void) : defaultEstimate(ContaminationEstimate(0.5, 0)) { }
 Contamination(double ra, double aa) : defaultEstimate(ContaminationEstimate(ra, aa)) { }
 };
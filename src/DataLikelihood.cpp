@@ -2,172 +2,287 @@
 #include "multichoose.h"
 #include "multipermute.h"
 #include "Logging.h"
+#include <atomic>
 
-long double
-probObservedAllelesGivenGenotype(
+void EncodedObservations::encode(Sample& sample, vector<Allele>& genotypeAlleles, Contamination& contaminations) {
+    alleles.clear();
+    alleleIndex.clear();
+    siteIndex.clear();
+    counts.clear();
+    lnqualitySum.clear();
+    lnBestQualitySum.clear();
+    lnErrorSum.clear();
+    lnHomozygousSum.clear();
+    lnHeterozygousSum.clear();
+    readGroups.clear();
+    for (map<string, CompactObservations>::iterator s = sample.compactObservations.begin();
+         s != sample.compactObservations.end(); ++s) {
+        CompactObservations& observations = s->second;
+        alleleIndex[s->first] = alleles.size();
+        alleles.push_back(s->first);
+        siteIndex.push_back(-1);
+        for (int j = 0; j < genotypeAlleles.size(); ++j) {
+            if (genotypeAlleles[j].currentBase == s->first) {
+                siteIndex.back() = j;
+                break;
+            }
+        }
+        counts.push_back(observations.size());
+        lnqualitySum.push_back(observations.lnqualitySum);
+        lnBestQualitySum.push_back(observations.lnBestQualitySum);
+        readGroups.push_back(vector<ReadGroupObservationCounts>());
+        vector<ReadGroupObservationCounts>& groups = readGroups.back();
+        Probability lnError = 0;
+        for (int i = 0; i < observations.size(); ++i) {
+            // note that this will underflow if we have mapping quality = 0
+            // we guard against this externally, by ignoring such alignments (quality has to be > MQL0)
+            lnError += observations.lnProbIncorrect[i];
+            int readGroup = observations.readGroupIndex[i];
+            ContaminationEstimate* contamination = (readGroup >= 0)
+                ? &contaminations.of(readGroup) : &contaminations.of(observations.alleles[i]->readGroupID);
+            // samples have few read groups, so a scan beats a map
+            vector<ReadGroupObservationCounts>::iterator g = groups.begin();
+            while (g != groups.end() && g->contamination != contamination) ++g;
+            if (g == groups.end()) {
+                groups.push_back(ReadGroupObservationCounts(contamination));
+                g = groups.end() - 1;
+            }
+            if (observations.isReference[i]) {
+                ++g->reference;
+            } else {
+                ++g->alternate;
+            }
+        }
+        lnErrorSum.push_back(lnError);
+        Probability lnHomozygous = 0;
+        Probability lnHeterozygous = 0;
+        for (vector<ReadGroupObservationCounts>::iterator g = groups.begin(); g != groups.end(); ++g) {
+            ContaminationEstimate& contamination = *g->contamination;
+            // scale by frequency of (other) possibly contaminating alleles
+            lnHomozygous += (g->reference + g->alternate) * contamination.lnHomozygous;
+            // to deal with polyploids
+            // note that this reduces to 1 for diploid heterozygotes
+            // this term captures reference bias
+            if (g->reference) {
+                lnHeterozygous += g->reference * contamination.lnRefGivenHet;
+            }
+            if (g->alternate) {
+                lnHeterozygous += g->alternate * contamination.lnAltGivenHet;
+            }
+        }
+        lnHomozygousSum.push_back(lnHomozygous);
+        lnHeterozygousSum.push_back(lnHeterozygous);
+    }
+}
+
+void EncodedObservations::dosages(Genotype& genotype, vector<int>& dosage) {
+    dosage.assign(alleles.size(), 0);
+    if (genotype.indexed()) {
+        for (int k = 0; k < alleles.size(); ++k) {
+            if (siteIndex[k] >= 0) {
+                dosage[k] = genotype.dosage(siteIndex[k]);
+            }
+        }
+        return;
+    }
+    for (Genotype::iterator e = genotype.begin(); e != genotype.end(); ++e) {
+        map<string, int>::iterator i = alleleIndex.find(e->allele.currentBase);
+        if (i != alleleIndex.end()) {
+            dosage[i->second] = e->count;
+        }
+    }
+}
+
+// the partial observations of the sample, which support the genotype's
+// alleles through its haplotypes, and so are matched to each genotype
+void
+probPartialObservationsGivenGenotype(
         Sample& sample,
         Genotype& genotype,
-        Bias& observationBias,
         vector<Allele>& genotypeAlleles,
         Contamination& contaminations,
-        map<string, double>& freqs,
+        Probability& prodQout,
+        int& countOut,
+        Probability& prodSample,
         Parameters& parameters
     ) {
 
-    DEBUG2("P(" << genotype << " given" << endl <<  sample);
-
-    int observationCount = sample.observationCount();
-    vector<long double> alleleProbs = genotype.alleleProbabilities(observationBias);
-    vector<int> observationCounts = genotype.alleleObservationCounts(sample);
-    int countOut = 0;
-    double countIn = 0;
-    long double prodQout = 0;  // the probability that the reads not in the genotype are all wrong
-    long double prodSample = 0;
-    
-    if (parameters.standardGLs) {
-        for (Sample::iterator s = sample.begin(); s != sample.end(); ++s) {
-            const string& base = s->first;
-            if (!genotype.containsAllele(base)) {
-                vector<Allele*>& alleles = s->second;
-                if (parameters.useMappingQuality) {
-                    for (vector<Allele*>::iterator a = alleles.begin(); a != alleles.end(); ++a) {
-                        // take the lesser of mapping quality and base quality (in log space)
-                        prodQout += max((*a)->lnquality, (*a)->lnmapQuality);
-                    }
-                } else {
-                    for (vector<Allele*>::iterator a = alleles.begin(); a != alleles.end(); ++a) {
-                        prodQout += (*a)->lnquality;
-                    }
+    for (map<string, vector<Allele*> >::iterator p = sample.partialSupport.begin();
+         p != sample.partialSupport.end(); ++p) {
+        vector<Allele*>* partials = &p->second;
+        for (vector<Allele*>::iterator a = partials->begin(); a != partials->end(); ++a) {
+            Allele& obs = **a;
+            DEBUG2("observation: " << obs);
+            ContaminationEstimate& contamination = (obs.readGroupIndex >= 0)
+                ? contaminations.of(obs.readGroupIndex) : contaminations.of(obs.readGroupID);
+            double scale = 1;
+            // note that this will underflow if we have mapping quality = 0
+            // we guard against this externally, by ignoring such alignments (quality has to be > MQL0)
+            Probability qual = (1.0 - exp(obs.lnquality)) * (1.0 - exp(obs.lnmapQuality));
+
+            // the genotype alleles the partial supports, by their indexes
+            const AlleleSupport* supports = NULL;
+            map<Allele*, AlleleSupport>::iterator r = sample.reversePartials.find(*a);
+            if (r != sample.reversePartials.end()) {
+                supports = &r->second;
+                int supported = supports->size();
+                if (supported == 0) {
+                    cerr << "partial " << *a << " has empty reverse" << endl;
+                    exit(1);
                 }
-                countOut += alleles.size();
+
+                DEBUG2("partial " << *a << " supports potentially " << supported << " alleles : ");
+#ifdef VERBOSE_DEBUG
+                for (int m = 0; m < genotypeAlleles.size(); ++m)
+                    if (supports->contains(m)) DEBUG2(genotypeAlleles[m] << " ");
+#endif
+
+                scale = (double)1/(double)supported;
+                qual *= scale;
             }
-        }
-    } else {
-        vector<Allele*> emptyA;
-        vector<Allele*> emptyB;
-        for (set<string>::iterator c = sample.supportedAlleles.begin();
-             c != sample.supportedAlleles.end(); ++c) {
-
-            vector<Allele*>* alleles = &emptyA;
-            Sample::iterator si = sample.find(*c);
-            if (si != sample.end()) alleles = &si->second;
-
-            vector<Allele*>* partials = &emptyB;
-            map<string, vector<Allele*> >::iterator pi = sample.partialSupport.find(*c);
-            if (pi != sample.partialSupport.end()) partials = &pi->second;
-
-            bool onPartials = false;
-            vector<Allele*>::iterator a = alleles->begin();
-            bool hasPartials = !partials->empty();
-            for ( ; (!hasPartials && a != alleles->end()) || a != partials->end(); ++a) {
-                if (a == alleles->end()) {
-                    if (hasPartials) {
-                        a = partials->begin();
-                        onPartials = true;
-                    } else {
-                        break;
-                    }
-                }
-                Allele& obs = **a;
-                DEBUG2("observation: " << obs);
-                long double probi = 0;
-                ContaminationEstimate& contamination = contaminations.of(obs.readGroupID);
-                double scale = 1;
-                // note that this will underflow if we have mapping quality = 0
-                // we guard against this externally, by ignoring such alignments (quality has to be > MQL0)
-                long double qual = (1.0 - exp(obs.lnquality)) * (1.0 - exp(obs.lnmapQuality));
-                
-                if (onPartials) {
-                    map<Allele*, set<Allele*> >::iterator r = sample.reversePartials.find(*a);
-                    if (r != sample.reversePartials.end()) {
-                        if (sample.reversePartials[*a].empty()) {
-                            cerr << "partial " << *a << " has empty reverse" << endl;
-                            exit(1);
-                        }
-
-                        DEBUG2("partial " << *a << " supports potentially " << sample.reversePartials[*a].size() << " alleles : ");
-                        for (set<Allele*>::iterator m = sample.reversePartials[*a].begin();
-                             m != sample.reversePartials[*a].end(); ++m)
-                            DEBUG2(**m << " ");
-
-                        scale = (double)1/(double)sample.reversePartials[*a].size();
-                        qual *= scale;
-                    }
-                }
 
-                // TODO add partial obs, now that we have them recorded
-                // how does this work?
-                // each partial obs is recorded as supporting, but with observation probability scaled by the number of possible haplotypes it supports
-                bool isInGenotype = false;
-                long double asampl = genotype.alleleSamplingProb(obs);
-
-                // for each of the unique genotype alleles
-                for (vector<Allele>::iterator b = genotypeAlleles.begin(); b != genotypeAlleles.end(); ++b) {
-                    Allele& allele = *b;
-                    const string& base = allele.currentBase;
-                    if (genotype.containsAllele(base)
-                        && (obs.currentBase == base
-                            || (onPartials && sample.observationSupports(*a, &*b)))) {
-                        isInGenotype = true;
-                        // use the matched allele to estimate the asampl
-                        asampl = max(asampl, (long double)genotype.alleleSamplingProb(allele));
-                    }
-                }
+            // TODO add partial obs, now that we have them recorded
+            // how does this work?
+            // each partial obs is recorded as supporting, but with observation probability scaled by the number of possible haplotypes it supports
+            bool isInGenotype = false;
+            Probability asampl = genotype.alleleSamplingProb(obs);
 
-                if (asampl == 0) {
-                    // scale by frequency of (this) possibly contaminating allele
-                    asampl = contamination.probRefGivenHomAlt;
-                } else if (asampl == 1) {
-                    // scale by frequency of (other) possibly contaminating alleles
-                    asampl = 1 - contamination.probRefGivenHomAlt;
-                } else { //if (genotype.ploidy == 2) {
-                    // to deal with polyploids
-                    // note that this reduces to 1 for diploid heterozygotes
-                    // this term captures reference bias
-                    if (obs.isReference()) {
-                        asampl *= (contamination.probRefGivenHet / 0.5);
-                    } else {
-                        asampl *= ((1 - contamination.probRefGivenHet) / 0.5);
-                    }
+            // for each of the unique genotype alleles
+            for (vector<Allele>::iterator b = genotypeAlleles.begin(); b != genotypeAlleles.end(); ++b) {
+                Allele& allele = *b;
+                const string& base = allele.currentBase;
+                int count = genotype.indexed()
+                    ? genotype.dosage(b - genotypeAlleles.begin()) : genotype.alleleCount(base);
+                if (count > 0
+                    && (obs.currentBase == base
+                        || (supports && supports->contains(b - genotypeAlleles.begin())))) {
+                    isInGenotype = true;
+                    // use the matched allele to estimate the asampl
+                    asampl = max(asampl, (Probability) ((double) count / (double) genotype.ploidy));
                 }
+            }
 
-                // distribute observation support across haplotypes
-                if (!isInGenotype) {
-                    prodQout += log(1-qual);
-                    countOut += scale;
+            if (asampl == 0) {
+                // scale by frequency of (this) possibly contaminating allele
+                asampl = contamination.probRefGivenHomAlt;
+            } else if (asampl == 1) {
+                // scale by frequency of (other) possibly contaminating alleles
+                asampl = 1 - contamination.probRefGivenHomAlt;
+            } else { //if (genotype.ploidy == 2) {
+                // to deal with polyploids
+                // note that this reduces to 1 for diploid heterozygotes
+                // this term captures reference bias
+                if (obs.isReference()) {
+                    asampl *= (contamination.probRefGivenHet / 0.5);
                 } else {
-                    prodSample += log(asampl*scale);
+                    asampl *= ((1 - contamination.probRefGivenHet) / 0.5);
                 }
             }
+
+            // distribute observation support across haplotypes
+            if (!isInGenotype) {
+                prodQout += log(1-qual);
+                countOut += scale;
+            } else {
+                prodSample += log(asampl*scale);
+            }
         }
     }
 
-    // read dependence factor, asymptotically downgrade quality values of
-    // successive reads to parameters.RDF * quality
-    if (parameters.standardGLs) {
-        if (countOut > 1) {
-            prodQout *= (1 + (countOut - 1) * parameters.RDF) / countOut;
+}
+
+Probability
+probObservedAllelesGivenGenotype(
+        Sample& sample,
+        Genotype& genotype,
+        Bias& observationBias,
+        vector<Allele>& genotypeAlleles,
+        Contamination& contaminations,
+        map<string, double>& freqs,
+        Parameters& parameters
+    ) {
+
+    vector<Genotype*> genotypes;
+    genotypes.push_back(&genotype);
+    return probObservedAllelesGivenGenotypes(sample, genotypes, observationBias, genotypeAlleles,
+                                             contaminations, freqs, parameters).front().second;
+
+}
+
+// log(d / P) for each dosage d of an allele in a genotype of ploidy P
+template <int P>
+class DosageFractionsLn {
+public:
+    Probability ln[P + 1];
+    DosageFractionsLn(void) {
+        for (int d = 0; d <= P; ++d) {
+            ln[d] = log((Probability) d / (Probability) P);
         }
+    }
+};
 
-        if (sum(observationCounts) == 0) {
-            return prodQout;
+// the terms of the sample's full observations given a genotype's dosages,
+// added to the out-of-genotype and sampling probabilities
+typedef void (*FullObservationsKernel)(EncodedObservations& observations, const vector<int>& dosage, int ploidy,
+                                       Probability& prodQout, int& countOut, Probability& prodSample);
+
+// for the common ploidies, the genotype's ploidy and the log of each dosage's
+// fraction of it are fixed at compile time, so the only logs left in the loop
+// are precomputed
+template <int P>
+static void fullObservationsGivenDosages(EncodedObservations& observations, const vector<int>& dosage, int ploidy,
+                                         Probability& prodQout, int& countOut, Probability& prodSample) {
+    static const DosageFractionsLn<P> fractions;
+    int alleleCount = observations.alleles.size();
+    for (int k = 0; k < alleleCount; ++k) {
+        int d = dosage[k];
+        if (d == 0) {
+            prodQout += observations.lnErrorSum[k];
+            countOut += observations.counts[k];
+        } else if (d == P) {
+            prodSample += observations.lnHomozygousSum[k];
         } else {
-            //cerr << "P(obs|" << genotype << ") = " << prodQout + multinomialSamplingProbLn(alleleProbs, observationCounts) << endl << endl << string(80, '@') << endl << endl;
-            return prodQout + multinomialSamplingProbLn(alleleProbs, observationCounts);
-            //return prodQout + samplingProbLn(alleleProbs, observationCounts);
-        }
-    } else {
-        if (countOut > 1) {
-            prodQout *= (1 + (countOut - 1) * parameters.RDF) / countOut;
+            prodSample += observations.counts[k] * fractions.ln[d] + observations.lnHeterozygousSum[k];
         }
-        long double probObsGivenGt = prodQout + prodSample;
-        return isinf(probObsGivenGt) ? 0 : probObsGivenGt;
     }
+}
 
+// any other ploidy
+static void fullObservationsGivenDosages(EncodedObservations& observations, const vector<int>& dosage, int ploidy,
+                                         Probability& prodQout, int& countOut, Probability& prodSample) {
+    int alleleCount = observations.alleles.size();
+    for (int k = 0; k < alleleCount; ++k) {
+        int d = dosage[k];
+        if (d == 0) {
+            prodQout += observations.lnErrorSum[k];
+            countOut += observations.counts[k];
+        } else if (d == ploidy) {
+            prodSample += observations.lnHomozygousSum[k];
+        } else {
+            prodSample += observations.counts[k] * log((Probability) d / (Probability) ploidy)
+                + observations.lnHeterozygousSum[k];
+        }
+    }
 }
 
+static FullObservationsKernel fullObservationsKernel(int ploidy) {
+    switch (ploidy) {
+    case 1:
+        return &fullObservationsGivenDosages<1>;
+    case 2:
+        return &fullObservationsGivenDosages<2>;
+    case 4:
+        return &fullObservationsGivenDosages<4>;
+    default:
+        return &fullObservationsGivenDosages;
+    }
+}
 
-vector<pair<Genotype*, long double> >
+// evaluates every genotype of the sample in one pass
+//
+// the observations are reduced once, so each genotype costs a lookup of its
+// dosages and a term per allele, rather than a walk over the observations
+vector<pair<Genotype*, Probability> >
 probObservedAllelesGivenGenotypes(
         Sample& sample,
         vector<Genotype*>& genotypes,
@@ -177,23 +292,207 @@ probObservedAllelesGivenGenotypes(
         map<string, double>& freqs,
         Parameters& parameters
     ) {
-    vector<pair<Genotype*, long double> > results;
+
+    EncodedObservations observations;
+    observations.encode(sample, genotypeAlleles, contaminations);
+    int alleleCount = observations.alleles.size();
+    vector<int> dosage;
+
+    vector<pair<Genotype*, Probability> > results;
+    results.reserve(genotypes.size());
+
+    vector<int> observationCounts; // of the alleles of each genotype, reused
+
+    // the genotypes of a sample normally share a ploidy, so this is chosen once
+    int kernelPloidy = 0;
+    FullObservationsKernel fullObservations = NULL;
+
     for (vector<Genotype*>::iterator g = genotypes.begin(); g != genotypes.end(); ++g) {
         Genotype& genotype = **g;
-        results.push_back(
-	    make_pair(*g,
-                  probObservedAllelesGivenGenotype(
-                      sample,
-                      **g,
-                      observationBias,
-                      genotypeAlleles,
-                      contaminations,
-                      freqs,
-                      parameters)));
+        DEBUG2("P(" << genotype << " given" << endl <<  sample);
+
+        observations.dosages(genotype, dosage);
+        int countOut = 0;
+        Probability prodQout = 0;  // the probability that the reads not in the genotype are all wrong
+        Probability prodSample = 0;
+        Probability probObsGivenGt = 0;
+
+        if (parameters.standardGLs) {
+            for (int k = 0; k < alleleCount; ++k) {
+                if (dosage[k] == 0) {
+                    if (parameters.useMappingQuality) {
+                        // take the lesser of mapping quality and base quality (in log space)
+                        prodQout += observations.lnBestQualitySum[k];
+                    } else {
+                        prodQout += observations.lnqualitySum[k];
+                    }
+                    countOut += observations.counts[k];
+                }
+            }
+            // read dependence factor, asymptotically downgrade quality values of
+            // successive reads to parameters.RDF * quality
+            if (countOut > 1) {
+                prodQout *= (1 + (countOut - 1) * parameters.RDF) / countOut;
+            }
+            observationCounts.clear();
+            int observed = 0;
+            for (Genotype::iterator e = genotype.begin(); e != genotype.end(); ++e) {
+                map<string, int>::iterator i = observations.alleleIndex.find(e->allele.currentBase);
+                observationCounts.push_back((i != observations.alleleIndex.end()) ? observations.counts[i->second] : 0);
+                observed += observationCounts.back();
+            }
+            if (observed == 0) {
+                probObsGivenGt = prodQout;
+            } else if (observationBias.empty()) {
+                probObsGivenGt = prodQout + multinomialSamplingLnProbs(genotype.lnAlleleProbabilities.data(),
+                                                                       observationCounts.data(),
+                                                                       observationCounts.size());
+            } else {
+                vector<Probability> alleleProbs = genotype.alleleProbabilities(observationBias);
+                probObsGivenGt = prodQout + multinomialSamplingProbLn(alleleProbs, observationCounts);
+            }
+        } else {
+            // the full observations of an allele are in the genotype, and are
+            // sampled with the same probability, or not, together
+            if (!fullObservations || genotype.ploidy != kernelPloidy) {
+                kernelPloidy = genotype.ploidy;
+                fullObservations = fullObservationsKernel(kernelPloidy);
+            }
+            fullObservations(observations, dosage, genotype.ploidy, prodQout, countOut, prodSample);
+            probPartialObservationsGivenGenotype(sample, genotype, genotypeAlleles, contaminations,
+                                                 prodQout, countOut, prodSample, parameters);
+            // read dependence factor, as above
+            if (countOut > 1) {
+                prodQout *= (1 + (countOut - 1) * parameters.RDF) / countOut;
+            }
+            probObsGivenGt = prodQout + prodSample;
+            if (isinf(probObsGivenGt)) {
+                probObsGivenGt = 0;
+            }
+        }
+
+        results.push_back(make_pair(*g, probObsGivenGt));
     }
+
     return results;
 }
 
+void genotypesToScore(SampleLikelihoodSlot& slot, SiteLikelihoodInputs& site, vector<Genotype*>& genotypesWithObs) {
+    Parameters& parameters = site.parameters;
+    Sample& sample = *slot.sample;
+    vector<Genotype>& genotypes = *slot.genotypes;
+    for (vector<Genotype>::iterator g = genotypes.begin(); g != genotypes.end(); ++g) {
+        if (parameters.excludePartiallyObservedGenotypes) {
+            if (g->sampleHasSupportingObservationsForAllAlleles(sample)) {
+                genotypesWithObs.push_back(&*g);
+            }
+        } else if (parameters.excludeUnobservedGenotypes && site.usingNull) {
+            if (g->sampleHasSupportingObservations(sample)) {
+                //cerr << sampleName << " has suppporting obs for " << *g << endl;
+                genotypesWithObs.push_back(&*g);
+            } else if (g->hasNullAllele() && g->homozygous) {
+                // this genotype will never be added if we are running in observed-only mode, but
+                // we still need it for consistency
+                genotypesWithObs.push_back(&*g);
+            }
+        } else {
+            genotypesWithObs.push_back(&*g);
+        }
+    }
+}
+
+void sortSampleLikelihoods(SampleLikelihoodSlot& slot, SiteLikelihoodInputs& site) {
+    vector<SampleDataLikelihood>& likelihoods = slot.likelihoods;
+    Probability margin = site.parameters.glMargin;
+    if (margin > 0 && !likelihoods.empty()) {
+        // the homozygous genotypes are kept whatever their likelihood, as the
+        // search makes a combo of each to weigh p(var) against
+        Probability best = -INFINITY;
+        for (vector<SampleDataLikelihood>::iterator d = likelihoods.begin(); d != likelihoods.end(); ++d) {
+            best = max(best, d->prob);
+        }
+        Probability lnMargin = log102ln(margin);
+        vector<SampleDataLikelihood>::iterator kept
+            = partition(likelihoods.begin(), likelihoods.end(),
+                        [&](const SampleDataLikelihood& d) {
+                            return d.genotype->homozygous || d.prob >= best - lnMargin;
+                        });
+        // those left out are reported at the floor, which bounds them all
+        if (kept != likelihoods.end()) {
+            slot.lnFloor = best - lnMargin;
+        }
+        likelihoods.erase(kept, likelihoods.end());
+    }
+    sortSampleDataLikelihoods(likelihoods);
+}
+
+// scores each sample on the calling thread, or on the team if there are
+// enough of them, from the sufficient statistics of its observations
+class CpuLikelihoodEngine : public LikelihoodEngine {
+public:
+    const char* name(void) const { return "cpu"; }
+    void score(vector<SampleLikelihoodSlot>& slots, SiteLikelihoodInputs& site, WorkerTeam* team);
+private:
+    void scoreSample(SampleLikelihoodSlot& slot, SiteLikelihoodInputs& site);
+};
+
+void CpuLikelihoodEngine::scoreSample(SampleLikelihoodSlot& slot, SiteLikelihoodInputs& site) {
+    Parameters& parameters = site.parameters;
+    string& sampleName = *slot.name;
+    Sample& sample = *slot.sample;
+    sample.setCompactObservations();
+    vector<Genotype*> genotypesWithObs;
+    genotypesToScore(slot, site, genotypesWithObs);
+
+    // skip this sample if we have no observations supporting any of the genotypes we are going to evaluate
+    if (genotypesWithObs.empty()) {
+        return;
+    }
+
+    vector<pair<Genotype*, Probability> > probs
+        = probObservedAllelesGivenGenotypes(sample,
+                                            genotypesWithObs,
+                                            site.observationBias,
+                                            site.genotypeAlleles,
+                                            site.contaminations,
+                                            site.frequencies,
+                                            parameters);
+
+    slot.likelihoods.reserve(probs.size());
+    for (vector<pair<Genotype*, Probability> >::iterator p = probs.begin(); p != probs.end(); ++p) {
+        slot.likelihoods.push_back(SampleDataLikelihood(sampleName, &sample, p->first, p->second, 0));
+    }
+    sortSampleLikelihoods(slot, site);
+}
+
+void CpuLikelihoodEngine::score(vector<SampleLikelihoodSlot>& slots, SiteLikelihoodInputs& site, WorkerTeam* team) {
+    // the samples are independent, so each is scored into its own slot
+    if (team && team->size() > 1 && slots.size() >= PARALLEL_LIKELIHOODS_MIN_SAMPLES) {
+        // taken one at a time, as the samples' depths differ
+        atomic<size_t> next(0);
+        team->run([&](int member) {
+            for (size_t i = next++; i < slots.size(); i = next++) {
+                scoreSample(slots[i], site);
+            }
+        });
+    } else {
+        for (vector<SampleLikelihoodSlot>::iterator slot = slots.begin(); slot != slots.end(); ++slot) {
+            scoreSample(*slot, site);
+        }
+    }
+}
+
+LikelihoodEngine* makeLikelihoodEngine(const string& name) {
+    if (name == "cpu") {
+        return new CpuLikelihoodEngine;
+    }
+    return NULL;
+}
+
+string likelihoodEngineNames(void) {
+    return "cpu";
+}
+
 void
 calculateSampleDataLikelihoods(
     Samples& samples,
@@ -207,9 +506,13 @@ calculateSampleDataLikelihoods(
     Contamination& contaminationEstimates,
     map<string, double>& estimatedAlleleFrequencies,
     map<string, vector<vector<SampleDataLikelihood> > >& sampleDataLikelihoodsByPopulation,
-    map<string, vector<vector<SampleDataLikelihood> > >& variantSampleDataLikelihoodsByPopulation,
-    map<string, vector<vector<SampleDataLikelihood> > >& invariantSampleDataLikelihoodsByPopulation) {
+    map<string, vector<size_t> >& variantSamplesByPopulation,
+    map<string, vector<size_t> >& invariantSamplesByPopulation,
+    WorkerTeam* team) {
 
+    // the samples and their genotypes are looked up first, as that changes
+    // the parser and the maps
+    vector<SampleLikelihoodSlot> slots;
     for (vector<string>::iterator n = parser->sampleList.begin(); n != parser->sampleList.end(); ++n) {
         //string sampleName = s->first;
         string& sampleName = *n;
@@ -220,71 +523,54 @@ calculateSampleDataLikelihoods(
                  || parameters.reportMonomorphic)) {
             continue;
         }
-        Sample& sample = samples[sampleName];
-        vector<Genotype>& genotypes = genotypesByPloidy[parser->currentSamplePloidy(sampleName)];
-        vector<Genotype*> genotypesWithObs;
-        for (vector<Genotype>::iterator g = genotypes.begin(); g != genotypes.end(); ++g) {
-            if (parameters.excludePartiallyObservedGenotypes) {
-                if (g->sampleHasSupportingObservationsForAllAlleles(sample)) {
-                    genotypesWithObs.push_back(&*g);
-                }
-            } else if (parameters.excludeUnobservedGenotypes && usingNull) {
-                if (g->sampleHasSupportingObservations(sample)) {
-                    //cerr << sampleName << " has suppporting obs for " << *g << endl;
-                    genotypesWithObs.push_back(&*g);
-                } else if (g->hasNullAllele() && g->homozygous) {
-                    // this genotype will never be added if we are running in observed-only mode, but
-                    // we still need it for consistency
-                    genotypesWithObs.push_back(&*g);
-                }
-            } else {
-                genotypesWithObs.push_back(&*g);
+        slots.push_back(SampleLikelihoodSlot());
+        SampleLikelihoodSlot& slot = slots.back();
+        slot.name = &sampleName;
+        slot.sample = &samples[sampleName];
+        slot.genotypes = &genotypesByPloidy[parser->currentSamplePloidy(sampleName)];
+    }
+
+    SiteLikelihoodInputs site(observationBias, genotypeAlleles, contaminationEstimates,
+                              estimatedAlleleFrequencies, parameters, usingNull);
+    parser->run->likelihoodEngine->score(slots, site, team);
+    if (parameters.debug2) {
+        for (vector<SampleLikelihoodSlot>::iterator slot = slots.begin(); slot != slots.end(); ++slot) {
+            for (vector<SampleDataLikelihood>::iterator p = slot->likelihoods.begin(); p != slot->likelihoods.end(); ++p) {
+                DEBUG2(parser->currentSequenceName << "," << (long unsigned int) parser->currentPosition + 1 << ","
+                       << *slot->name << ",likelihood," << *p->genotype << "," << p->prob);
             }
         }
+    }
 
-        // skip this sample if we have no observations supporting any of the genotypes we are going to evaluate
-        if (genotypesWithObs.empty()) {
+    // and taken into the results and populations in order
+    for (vector<SampleLikelihoodSlot>::iterator slot = slots.begin(); slot != slots.end(); ++slot) {
+        if (slot->likelihoods.empty()) {
             continue;
         }
-
-        vector<pair<Genotype*, long double> > probs
-            = probObservedAllelesGivenGenotypes(sample,
-                                                genotypesWithObs,
-                                                observationBias,
-                                                genotypeAlleles,
-                                                contaminationEstimates,
-                                                estimatedAlleleFrequencies,
-                                                parameters);
-            
-        for (vector<pair<Genotype*, long double> >::iterator p = probs.begin(); p != probs.end(); ++p) {
-            DEBUG2(parser->currentSequenceName << "," << (long unsigned int) parser->currentPosition + 1 << ","
-                   << sampleName << ",likelihood," << *(p->first) << "," << p->second);
-        }
+        string& sampleName = *slot->name;
 
         Result& sampleData = results[sampleName];
         sampleData.name = sampleName;
-        sampleData.observations = &sample;
-        for (vector<pair<Genotype*, long double> >::iterator p = probs.begin(); p != probs.end(); ++p) {
-            sampleData.push_back(SampleDataLikelihood(sampleName, &sample, p->first, p->second, 0));
-        }
-
-        sortSampleDataLikelihoods(sampleData);
+        sampleData.observations = slot->sample;
+        sampleData.lnFloor = slot->lnFloor;
+        sampleData.swap(slot->likelihoods);
 
         string& population = parser->samplePopulation[sampleName];
         vector<vector<SampleDataLikelihood> >& sampleDataLikelihoods = sampleDataLikelihoodsByPopulation[population];
-        vector<vector<SampleDataLikelihood> >& variantSampleDataLikelihoods = variantSampleDataLikelihoodsByPopulation[population];
-        vector<vector<SampleDataLikelihood> >& invariantSampleDataLikelihoods = invariantSampleDataLikelihoodsByPopulation[population];
 
+        // the variant and invariant samples are offsets into the population's
+        // likelihoods, not copies of them
+        size_t offset = sampleDataLikelihoods.size();
         if (parameters.genotypeVariantThreshold != 0) {
             if (sampleData.size() > 1
                 && abs(sampleData.at(1).prob - sampleData.front().prob)
                 < parameters.genotypeVariantThreshold) {
-                variantSampleDataLikelihoods.push_back(sampleData);
+                variantSamplesByPopulation[population].push_back(offset);
             } else {
-                invariantSampleDataLikelihoods.push_back(sampleData);
+                invariantSamplesByPopulation[population].push_back(offset);
             }
         } else {
-            variantSampleDataLikelihoods.push_back(sampleData);
+            variantSamplesByPopulation[population].push_back(offset);
         }
         sampleDataLikelihoods.push_back(sampleData);
 
@@ -19,10 +19,66 @@
 #include "Contamination.h"
 #include "AlleleParser.h"
 #include "ResultData.h"
+#include "WorkerTeam.h"
+#include "LikelihoodEngine.h"
 
 using namespace std;
 
-long double
+// the genotyping team scores the samples of a site's data likelihoods only
+// when there are at least this many
+#define PARALLEL_LIKELIHOODS_MIN_SAMPLES 64
+
+// the observations of one read group of an allele, which share a
+// contamination estimate
+class ReadGroupObservationCounts {
+public:
+    ContaminationEstimate* contamination;
+    int reference;   // observations of the reference allele
+    int alternate;   // and of others
+    ReadGroupObservationCounts(ContaminationEstimate* c) : contamination(c), reference(0), alternate(0) { }
+};
+
+// the full observations of a sample, reduced once to the sufficient statistics
+// of each allele, so that all of its genotypes can be evaluated in time
+// proportional to the number of alleles rather than of observations
+//
+// each allele's observations contribute a fixed log term when the allele is
+// absent from the genotype (they are all errors), is the genotype's only
+// allele (contamination), or is one of several (reference bias scaling plus
+// the allele's sampling probability).  genotypes are encoded as the dosage
+// of each of the sample's alleles.
+class EncodedObservations {
+
+public:
+    vector<string> alleles;        // the observed alleles, indexed by allele
+    map<string, int> alleleIndex;
+    vector<int> siteIndex;         // the index of each in the site's alleles, or -1
+    vector<int> counts;            // the number of observations of each allele
+    vector<Probability> lnqualitySum;     // for standard GLs
+    vector<Probability> lnBestQualitySum;
+    vector<Probability> lnErrorSum;       // sum of log(1 - p(base and mapping are correct))
+    vector<Probability> lnHomozygousSum;  // log p(observations | homozygous genotype)
+    vector<Probability> lnHeterozygousSum; // reference bias scaling, less the sampling probs
+    vector<vector<ReadGroupObservationCounts> > readGroups; // per allele, for contamination
+
+    void encode(Sample& sample, vector<Allele>& genotypeAlleles, Contamination& contaminations);
+    // the dosage of each allele in the genotype
+    void dosages(Genotype& genotype, vector<int>& dosage);
+
+};
+
+void
+probPartialObservationsGivenGenotype(
+        Sample& sample,
+        Genotype& genotype,
+        vector<Allele>& genotypeAlleles,
+        Contamination& contaminations,
+        Probability& prodQout,
+        int& countOut,
+        Probability& prodSample,
+        Parameters& parameters);
+
+Probability
 probObservedAllelesGivenGenotype(
         Sample& sample,
         Genotype& genotype,
@@ -32,7 +88,7 @@ probObservedAllelesGivenGenotype(
         map<string, double>& freqs,
         Parameters& parameters);
 
-vector<pair<Genotype*, long double> >
+vector<pair<Genotype*, Probability> >
 probObservedAllelesGivenGenotypes(
         Sample& sample,
         vector<Genotype*>& genotypes,
@@ -55,7 +111,8 @@ calculateSampleDataLikelihoods(
     Contamination& contaminationEstimates,
     map<string, double>& estimatedAlleleFrequencies,
     map<string, vector<vector<SampleDataLikelihood> > >& sampleDataLikelihoodsByPopulation,
-    map<string, vector<vector<SampleDataLikelihood> > >& variantSampleDataLikelihoodsByPopulation,
-    map<string, vector<vector<SampleDataLikelihood> > >& invariantSampleDataLikelihoodsByPopulation);
+    map<string, vector<size_t> >& variantSamplesByPopulation,
+    map<string, vector<size_t> >& invariantSamplesByPopulation,
+    WorkerTeam* team = NULL);
 
 #endif
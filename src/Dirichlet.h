@@ -5,9 +5,9 @@
 #include "Utility.h"
 #include "Sum.h"
 
-long double dirichletMaximumLikelihoodRatio(const vector<long double>& probs, const vector<int>& obs, long double s = (long double) 1.0);
-long double dirichlet(const vector<long double>& probs, const vector<int>& obs, long double s = (long double) 1.0);
-long double dirichletMaximumLikelihoodRatioln(const vector<long double>& probs, const vector<int>& obs, long double s = (long double) 1.0);
-long double dirichletln(const vector<long double>& probs, const vector<int>& obs, long double s = (long double) 1.0);
+Probability dirichletMaximumLikelihoodRatio(const vector<Probability>& probs, const vector<int>& obs, Probability s = (Probability) 1.0);
+Probability dirichlet(const vector<Probability>& probs, const vector<int>& obs, Probability s = (Probability) 1.0);
+Probability dirichletMaximumLikelihoodRatioln(const vector<Probability>& probs, const vector<int>& obs, Probability s = (Probability) 1.0);
+Probability dirichletln(const vector<Probability>& probs, const vector<int>& obs, Probability s = (Probability) 1.0);
 
 #endif
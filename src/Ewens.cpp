@@ -1,10 +1,10 @@
 #include "Ewens.h"
 
 
-long double alleleFrequencyProbability(const map<int, int>& alleleFrequencyCounts, long double theta) {
+Probability alleleFrequencyProbability(const map<int, int>& alleleFrequencyCounts, Probability theta) {
 
     int M = 0;
-    long double p = 1;
+    Probability p = 1;
 
     for (map<int, int>::const_iterator f = alleleFrequencyCounts.begin(); f != alleleFrequencyCounts.end(); ++f) {
         int frequency = f->first;
@@ -13,7 +13,7 @@ long double alleleFrequencyProbability(const map<int, int>& alleleFrequencyCount
         p *= (double) pow((double) theta, (double) count) / ((double) pow((double) frequency, (double) count) * factorial(count));
     }
 
-    long double thetaH = 1;
+    Probability thetaH = 1;
     for (int h = 1; h < M; ++h)
         thetaH *= theta + h;
 
@@ -21,19 +21,28 @@ long double alleleFrequencyProbability(const map<int, int>& alleleFrequencyCount
 
 }
 
-AlleleFrequencyProbabilityCache alleleFrequencyProbabilityCache;
+// thread_local: sites may be genotyped concurrently when using --threads
+thread_local AlleleFrequencyProbabilityCache alleleFrequencyProbabilityCache;
 
-long double alleleFrequencyProbabilityln(const map<int, int>& alleleFrequencyCounts, long double theta) {
-    return alleleFrequencyProbabilityCache.alleleFrequencyProbabilityln(alleleFrequencyCounts, theta);
+Probability alleleFrequencyProbabilityln(const map<int, int>& alleleFrequencyCounts, Probability theta) {
+    vector<int> spectrum;
+    for (map<int, int>::const_iterator f = alleleFrequencyCounts.begin(); f != alleleFrequencyCounts.end(); ++f) {
+        spectrum.insert(spectrum.end(), f->second, f->first);
+    }
+    return alleleFrequencyProbabilityCache.alleleFrequencyProbabilityln(spectrum, theta);
+}
+
+Probability alleleFrequencyProbabilityln(const vector<int>& spectrum, Probability theta) {
+    return alleleFrequencyProbabilityCache.alleleFrequencyProbabilityln(spectrum, theta);
 }
 
 // Implements Ewens' Sampling Formula, which provides probability of a given
 // partition of alleles in a sample from a population
-long double impl_alleleFrequencyProbabilityln(const map<int, int>& alleleFrequencyCounts, long double theta) {
+Probability impl_alleleFrequencyProbabilityln(const map<int, int>& alleleFrequencyCounts, Probability theta) {
 
     int M = 0; // multiplicity of site
-    long double p = 0;
-    long double thetaln = log(theta);
+    Probability p = 0;
+    Probability thetaln = log(theta);
 
     for (map<int, int>::const_iterator f = alleleFrequencyCounts.begin(); f != alleleFrequencyCounts.end(); ++f) {
         int frequency = f->first;
@@ -42,7 +51,33 @@ long double impl_alleleFrequencyProbabilityln(const map<int, int>& alleleFrequen
         p += powln(thetaln, count) - (powln(log(frequency), count) + factorialln(count));
     }
 
-    long double thetaH = 0;
+    Probability thetaH = 0;
+    for (int h = 1; h < M; ++h)
+        thetaH += log(theta + h);
+
+    return factorialln(M) - (thetaln + thetaH) + p;
+
+}
+
+Probability impl_alleleFrequencyProbabilityln(const vector<int>& spectrum, Probability theta) {
+
+    int M = 0; // multiplicity of site
+    Probability p = 0;
+    Probability thetaln = log(theta);
+
+    // each run of equal frequencies is one term of the formula
+    vector<int>::const_iterator f = spectrum.begin();
+    while (f != spectrum.end()) {
+        int frequency = *f;
+        int count = 0;
+        for ( ; f != spectrum.end() && *f == frequency; ++f) {
+            ++count;
+        }
+        M += frequency * count;
+        p += powln(thetaln, count) - (powln(log(frequency), count) + factorialln(count));
+    }
+
+    Probability thetaH = 0;
     for (int h = 1; h < M; ++h)
         thetaH += log(theta + h);
 
@@ -2,6 +2,7 @@
 #define FREEBAYES_EWENS_H
 
 #include <map>
+#include <vector>
 #include <cmath>
 #include "Utility.h"
 
@@ -9,17 +10,33 @@ using namespace std;
 
 // genotype priors
 
-long double alleleFrequencyProbability(const map<int, int>& alleleFrequencyCounts, long double theta);
-long double alleleFrequencyProbabilityln(const map<int, int>& alleleFrequencyCounts, long double theta);
-long double impl_alleleFrequencyProbabilityln(const map<int, int>& alleleFrequencyCounts, long double theta);
+Probability alleleFrequencyProbability(const map<int, int>& alleleFrequencyCounts, Probability theta);
+Probability alleleFrequencyProbabilityln(const map<int, int>& alleleFrequencyCounts, Probability theta);
+Probability impl_alleleFrequencyProbabilityln(const map<int, int>& alleleFrequencyCounts, Probability theta);
+// as above, given the frequency spectrum as the allele frequencies in
+// ascending order, rather than as counts of each frequency
+Probability alleleFrequencyProbabilityln(const vector<int>& spectrum, Probability theta);
+Probability impl_alleleFrequencyProbabilityln(const vector<int>& spectrum, Probability theta);
 
-class AlleleFrequencyProbabilityCache : public map<map<int, int>, long double> {
+// the sites of a run draw their combos' frequency spectra from a small set, so
+// we keep the prior of each spectrum we've seen.  the cache holds priors for
+// one theta at a time, and is emptied if it grows past
+// ALLELE_FREQUENCY_CACHE_SIZE spectra.
+#define ALLELE_FREQUENCY_CACHE_SIZE 65536
+
+class AlleleFrequencyProbabilityCache : public map<vector<int>, Probability> {
 public:
-    long double alleleFrequencyProbabilityln(const map<int, int>& counts, long double theta) {
-        map<map<int, int>, long double>::iterator p = find(counts);
+    Probability theta;
+    AlleleFrequencyProbabilityCache(void) : theta(NAN) { }
+    Probability alleleFrequencyProbabilityln(const vector<int>& spectrum, Probability t) {
+        if (!(t == theta) || size() >= ALLELE_FREQUENCY_CACHE_SIZE) {
+            clear();
+            theta = t;
+        }
+        map<vector<int>, Probability>::iterator p = find(spectrum);
         if (p == end()) {
-            long double pln = impl_alleleFrequencyProbabilityln(counts, theta);
-            insert(make_pair(counts, pln));
+            Probability pln = impl_alleleFrequencyProbabilityln(spectrum, t);
+            insert(make_pair(spectrum, pln));
             return pln;
         } else {
             return p->second;
@@ -7,6 +7,7 @@
 // ---------------------------------------------------------------------------
 
 #include "FBFasta.h"
+#include "htslib/hfile.h"
 
 FB::FastaIndexEntry::FastaIndexEntry(string name, int length, long long offset, int line_blen, int line_len)
     : name(name)
@@ -205,7 +206,7 @@ FB::FastaIndex::~FastaIndex(void) {
     indexFile.close();
 }
 
-FB::FastaIndexEntry FB::FastaIndex::entry(string name) {
+const FB::FastaIndexEntry& FB::FastaIndex::entry(const string& name) {
     FastaIndex::iterator e = this->find(name);
     if (e == this->end()) {
         cerr << "unable to find FASTA index entry for '" << name << "'" << endl;
@@ -217,17 +218,49 @@ FB::FastaIndexEntry FB::FastaIndex::entry(string name) {
 
 string FB::FastaIndex::indexFileExtension() { return ".fai"; }
 
-/*
-FastaReference::FastaReference(string reffilename) {
-}
-*/
+FB::FastaReference::FastaReference(void)
+    : file(NULL)
+    , index(NULL)
+    , data(NULL)
+    , dataSize(0)
+    , bgzfIndex(NULL)
+{ }
 
 void FB::FastaReference::open(string reffilename) {
     filename = reffilename;
+    // a reference given as a URL is read through htslib, whether or not it's
+    // compressed, as are its .fai (and .gzi) beside it
+    if (hisremote(filename.c_str())) {
+        openBgzf();
+        return;
+    }
     if (!(file = fopen(filename.c_str(), "r"))) {
         cerr << "could not open " << filename << endl;
         exit(1);
     }
+    // gzip files start 1f 8b, and set FEXTRA (4) in the flags when they are
+    // bgzip'd, as the headers of BGZF blocks carry their size there
+    unsigned char magic[4] = { 0, 0, 0, 0 };
+    size_t magicLength = fread(magic, 1, 4, file);
+    rewind(file);
+    if (magicLength == 4 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        if (!(magic[3] & 4)) {
+            cerr << filename << " is gzip-compressed, which doesn't allow random access; "
+                 << "compress it with bgzip instead" << endl;
+            exit(1);
+        }
+        openBgzf();
+        return;
+    }
+    // map the reference if we can, otherwise we fall back to reading it
+    struct stat stReference;
+    if (fstat(fileno(file), &stReference) == 0 && S_ISREG(stReference.st_mode) && stReference.st_size > 0) {
+        void* mapped = mmap(NULL, stReference.st_size, PROT_READ, MAP_SHARED, fileno(file), 0);
+        if (mapped != MAP_FAILED) {
+            data = (const char*) mapped;
+            dataSize = stReference.st_size;
+        }
+    }
     index = new FastaIndex();
     struct stat stFileInfo; 
     string indexFileName = filename + index->indexFileExtension(); 
@@ -241,42 +274,117 @@ void FB::FastaReference::open(string reffilename) {
     }
 }
 
+// faidx writes FILE.fai and FILE.gzi if they don't exist yet, except for a
+// remote FILE, which must have them.  we fill in our own index from it, so
+// that the rest of the reference interface is unchanged.
+void FB::FastaReference::openBgzf(void) {
+    if (!(bgzfIndex = fai_load(filename.c_str()))) {
+        cerr << "could not load or build the faidx index of " << filename << endl;
+        exit(1);
+    }
+    index = new FastaIndex();
+    for (int i = 0; i < faidx_nseq(bgzfIndex); ++i) {
+        string name = faidx_iseq(bgzfIndex, i);
+        index->sequenceNames.push_back(name);
+        index->insert(make_pair(name, FastaIndexEntry(name, faidx_seq_len(bgzfIndex, name.c_str()), 0, 0, 0)));
+    }
+}
+
 FB::FastaReference::~FastaReference(void) {
-    fclose(file);
+    if (bgzfIndex) {
+        fai_destroy(bgzfIndex);
+    }
+    if (data) {
+        munmap((void*) data, dataSize);
+    }
+    if (file) {
+        fclose(file);
+    }
     delete index;
 }
 
-string removeIupacBases(string& str) {
+void removeIupacBases(string& str) {
     const string validBases = "ATGCN";
     size_t found = str.find_first_not_of(validBases);
     while (found != string::npos) {
         str[found] = 'N';
         found = str.find_first_not_of(validBases, found + 1);
     }
-    return str;
 }
 
-string FB::FastaReference::getRawSequence(string seqname) {
-    FastaIndexEntry entry = index->entry(seqname);
-    int newlines_in_sequence = entry.length / entry.line_blen;
-    int seqlen = newlines_in_sequence  + entry.length;
+void uppercaseInPlace(string& str) {
+    for (string::iterator c = str.begin(); c != str.end(); ++c) {
+        *c = toupper(*c);
+    }
+}
+
+void FB::FastaReference::readBases(const FastaIndexEntry& entry, int start, int length, string& s) {
+    if (length < 1) {
+        return;
+    }
+    if (bgzfIndex) {
+        hts_pos_t fetched = 0;
+        char* seq = faidx_fetch_seq64(bgzfIndex, entry.name.c_str(), start, start + length - 1, &fetched);
+        if (!seq) {
+            cerr << "could not read " << entry.name << ":" << start << ".." << start + length
+                 << " from " << filename << endl;
+            exit(1);
+        }
+        s.append(seq, fetched);
+        free(seq);
+        return;
+    }
+    if (entry.line_blen < 1) {
+        return;
+    }
+    if (data) {
+        // copy the bases of each line straight out of the mapping, skipping
+        // the line ends
+        const char* end = data + dataSize;
+        int column = start % entry.line_blen;
+        const char* p = data + entry.offset + (long long) (start / entry.line_blen) * entry.line_len + column;
+        s.reserve(s.size() + length);
+        while (length > 0 && p < end) {
+            int n = min((long long) min(length, entry.line_blen - column), (long long) (end - p));
+            s.append(p, n);
+            length -= n;
+            p += n + entry.line_len - entry.line_blen;
+            column = 0;
+        }
+        return;
+    }
+    // we have to handle newlines
+    // approach: count newlines before start
+    //           count newlines by end of read
+    //             subtracting newlines before start find count of embedded newlines
+    int newlines_before = start > 0 ? (start - 1) / entry.line_blen : 0;
+    int newlines_by_end = (start + length - 1) / entry.line_blen;
+    int newlines_inside = newlines_by_end - newlines_before;
+    int seqlen = length + newlines_inside;
     char* seq = (char*) calloc (seqlen + 1, sizeof(char));
-    fseek64(file, entry.offset, SEEK_SET);
-    size_t x = fread(seq, sizeof(char), seqlen, file);
+    fseek64(file, (off_t) (entry.offset + newlines_before + start), SEEK_SET);
+    size_t x = fread(seq, sizeof(char), (off_t) seqlen, file);
     seq[seqlen] = '\0';
     char* pbegin = seq;
     char* pend = seq + (seqlen/sizeof(char));
     pend = remove(pbegin, pend, '\n');
     pend = remove(pbegin, pend, '\0');
-    string s = seq;
+    s.append(pbegin, pend - pbegin);
     free(seq);
-    s.resize((pend - pbegin)/sizeof(char));
+}
+
+string FB::FastaReference::getRawSequence(string seqname) {
+    const FastaIndexEntry& entry = index->entry(seqname);
+    string s;
+    readBases(entry, 0, entry.length, s);
     return s;
 }
 
 string FB::FastaReference::getSequence(string seqname) {
-    string u = uppercase(getRawSequence(seqname));
-    return removeIupacBases(u);
+    string s = getRawSequence(seqname);
+    uppercaseInPlace(s);
+    removeIupacBases(s);
+    return s;
 }
 
 // TODO cleanup; odd function.  use a map
@@ -290,40 +398,23 @@ string FB::FastaReference::sequenceNameStartingWith(string seqnameStart) {
 }
 
 string FB::FastaReference::getRawSubSequence(string seqname, int start, int length) {
-    FastaIndexEntry entry = index->entry(seqname);
+    const FastaIndexEntry& entry = index->entry(seqname);
     length = min(length, entry.length - start);
     if (start < 0 || length < 1) {
         return "";
     }
-    // we have to handle newlines
-    // approach: count newlines before start
-    //           count newlines by end of read
-    //             subtracting newlines before start find count of embedded newlines
-    int newlines_before = start > 0 ? (start - 1) / entry.line_blen : 0;
-    int newlines_by_end = (start + length - 1) / entry.line_blen;
-    int newlines_inside = newlines_by_end - newlines_before;
-    int seqlen = length + newlines_inside;
-    char* seq = (char*) calloc (seqlen + 1, sizeof(char));
-    fseek64(file, (off_t) (entry.offset + newlines_before + start), SEEK_SET);
-    size_t x = fread(seq, sizeof(char), (off_t) seqlen, file);
-    seq[seqlen] = '\0';
-    char* pbegin = seq;
-    char* pend = seq + (seqlen/sizeof(char));
-    pend = remove(pbegin, pend, '\n');
-    pend = remove(pbegin, pend, '\0');
-    string s = seq;
-    free(seq);
-    s.resize((pend - pbegin)/sizeof(char));
+    string s;
+    readBases(entry, start, length, s);
     return s;
 }
 
 string FB::FastaReference::getSubSequence(string seqname, int start, int length) {
-    string u = uppercase(getRawSubSequence(seqname, start, length));
-    return removeIupacBases(u);
+    string s = getRawSubSequence(seqname, start, length);
+    uppercaseInPlace(s);
+    removeIupacBases(s);
+    return s;
 }
 
 long unsigned int FB::FastaReference::sequenceLength(string seqname) {
-    FastaIndexEntry entry = index->entry(seqname);
-    return entry.length;
+    return index->entry(seqname).length;
 }
-
@@ -19,10 +19,12 @@
 #include "LargeFileSupport.h"
 #include "Utility.h"
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include "split.h"
 #include <stdlib.h>
 #include <ctype.h>
 #include <unistd.h>
+#include "htslib/faidx.h"
 
 using namespace std;
 
@@ -54,20 +56,30 @@ class FastaIndex : public map<string, FastaIndexEntry> {
         void readIndexFile(string fname);
         void writeIndexFile(string fname);
         ifstream indexFile;
-        FastaIndexEntry entry(string key);
+        const FastaIndexEntry& entry(const string& key);
         void flushEntryToIndex(FastaIndexEntry& entry);
         string indexFileExtension(void);
 };
 
 ostream& operator<<(ostream& output, FastaIndex& i);
 
+// the reference is mapped into memory when it can be, so that sequence is
+// read straight out of the page cache.  the mapping is read-only, so every
+// parser (or process) reading the same reference shares a single copy of it.
+// a bgzip-compressed reference is read through htslib's faidx, using its .gzi
+// block index to decompress only the blocks we ask for, as is a reference
+// given as a URL.
 class FastaReference {
     public:
+        FastaReference(void);
         void open(string reffilename);
         string filename;
         ~FastaReference(void);
         FILE* file;
         FastaIndex* index;
+        const char* data;  // the mapped file, or NULL if we read it through file
+        size_t dataSize;
+        faidx_t* bgzfIndex;  // set if the reference is bgzip-compressed
         vector<FastaIndexEntry> findSequencesStartingWith(string seqnameStart);
         string getRawSequence(string seqname);
         string getSequence(string seqname);
@@ -77,6 +89,10 @@ class FastaReference {
         string getSubSequence(string seqname, int start, int length);
         string sequenceNameStartingWith(string seqnameStart);
         long unsigned int sequenceLength(string seqname);
+    private:
+        void openBgzf(void);
+        // appends the bases of the entry in [start, start + length) to s
+        void readBases(const FastaIndexEntry& entry, int start, int length, string& s);
 };
 
 }  // namespace FB
@@ -0,0 +1,67 @@
+#ifndef FREEBAYES_FLATMAP_H
+#define FREEBAYES_FLATMAP_H
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+using namespace std;
+
+// a map kept as a vector of (key, value) pairs, sorted by key
+//
+// meant for the few entries counted for each genotype combo, i.e. its alleles
+// and genotypes.  everything is held in one block, so copying a map into
+// another reuses the other's storage, and finding and walking the entries
+// stays in cache.  entries are visited in key order, as with map.  unlike a
+// map, adding or erasing an entry invalidates iterators.
+template <class K, class V>
+class FlatMap {
+
+public:
+
+    typedef pair<K, V> value_type;
+    typedef typename vector<value_type>::iterator iterator;
+    typedef typename vector<value_type>::const_iterator const_iterator;
+
+    iterator begin(void) { return entries.begin(); }
+    iterator end(void) { return entries.end(); }
+    const_iterator begin(void) const { return entries.begin(); }
+    const_iterator end(void) const { return entries.end(); }
+
+    size_t size(void) const { return entries.size(); }
+    bool empty(void) const { return entries.empty(); }
+    void clear(void) { entries.clear(); }
+
+    iterator find(const K& key) {
+        iterator e = lowerBound(key);
+        return (e != entries.end() && !(key < e->first)) ? e : entries.end();
+    }
+
+    // the value for the key, which is added if it isn't there
+    V& operator[](const K& key) {
+        iterator e = lowerBound(key);
+        if (e == entries.end() || key < e->first) {
+            e = entries.insert(e, value_type(key, V()));
+        }
+        return e->second;
+    }
+
+    // returns the entry following the erased one
+    iterator erase(iterator e) { return entries.erase(e); }
+
+private:
+
+    iterator lowerBound(const K& key) {
+        iterator e = entries.begin();
+        // there are few enough entries that a scan beats a binary search
+        while (e != entries.end() && e->first < key) {
+            ++e;
+        }
+        return e;
+    }
+
+    vector<value_type> entries;
+
+};
+
+#endif
@@ -1,6 +1,8 @@
 #include "Genotype.h"
 #include "multichoose.h"
 #include "multipermute.h"
+#include "Profile.h"
+#include <mutex>
 
 
 vector<Allele*> Genotype::uniqueAlleles(void) {
@@ -233,24 +235,34 @@ bool Genotype::isHomozygousReference(void) {
 }
 
 // the probability of drawing each allele out of the genotype, ordered by allele
-vector<long double> Genotype::alleleProbabilities(void) {
-    vector<long double> probs;
+vector<Probability> Genotype::alleleProbabilities(void) {
+    vector<Probability> probs;
     for (vector<GenotypeElement>::const_iterator a = this->begin(); a != this->end(); ++a) {
-        probs.push_back((long double) a->count / (long double) ploidy);
+        probs.push_back((Probability) a->count / (Probability) ploidy);
     }
     return probs;
 }
 
+// as alleleProbabilities(observationBias) comes to without a bias
+void Genotype::setLnAlleleProbabilities(void) {
+    vector<Probability> probs = alleleProbabilities();
+    normalizeSumToOne(probs);
+    lnAlleleProbabilities.clear();
+    for (vector<Probability>::iterator p = probs.begin(); p != probs.end(); ++p) {
+        lnAlleleProbabilities.push_back(log(*p));
+    }
+}
+
 // the probability of drawing each allele out of the genotype, ordered by allele, adjusted for reference bias
-vector<long double> Genotype::alleleProbabilities(Bias& observationBias) {
-    vector<long double> probs;
+vector<Probability> Genotype::alleleProbabilities(Bias& observationBias) {
+    vector<Probability> probs;
     for (vector<GenotypeElement>::const_iterator a = this->begin(); a != this->end(); ++a) {
-	long double bias = 1;
+	Probability bias = 1;
 	if (!a->allele.isReference()) {
 	    int alleleLengthDifference = a->allele.alternateSequence.size() - a->allele.referenceLength;
 	    bias = observationBias.bias(alleleLengthDifference);
 	}
-        probs.push_back(((long double) a->count / (long double) ploidy) * bias);
+        probs.push_back(((Probability) a->count / (Probability) ploidy) * bias);
     }
     normalizeSumToOne(probs);
     return probs;
@@ -323,9 +335,9 @@ ostream& operator<<(ostream& out, list<GenotypeCombo>& g) {
 ostream& operator<<(ostream& out, GenotypeCombo& g) {
     GenotypeCombo::iterator i = g.begin(); ++i;
     out << "combo posterior prob: " << g.posteriorProb << endl;
-    out << "{\"" << g.front()->name << "\":[\"" << *(g.front()->genotype) << "\"," << exp(g.front()->prob) << "]";
+    out << "{\"" << *g.front()->name << "\":[\"" << *(g.front()->genotype) << "\"," << exp(g.front()->prob) << "]";
     for (;i != g.end(); ++i) {
-        out << ", \"" << (*i)->name << "\":[\"" << *((*i)->genotype) << "\"," << exp((*i)->prob) << "]";
+        out << ", \"" << *(*i)->name << "\":[\"" << *((*i)->genotype) << "\"," << exp((*i)->prob) << "]";
     }
     out << "}";
     return out;
@@ -351,8 +363,106 @@ bool operator<(Genotype& a, Genotype& b) {
     return false; // if the two are equal, then we return false per C++ convention
 }
 
-vector<Genotype> allPossibleGenotypes(int ploidy, vector<Allele>& potentialAlleles) {
+// shared by the threads of the run; entries are only ever added, so the
+// references we hand out stay valid
+static map<pair<pair<int, int>, int>, vector<GenotypeTemplate> > genotypeTemplateCache;
+static mutex genotypeTemplateMutex;
+
+const vector<GenotypeTemplate>& genotypeTemplates(int ploidy, int alleleCount, int grid) {
+    if (grid >= ploidy) {
+        grid = 0;
+    }
+    lock_guard<mutex> lock(genotypeTemplateMutex);
+    pair<pair<int, int>, int> key = make_pair(make_pair(ploidy, alleleCount), grid);
+    map<pair<pair<int, int>, int>, vector<GenotypeTemplate> >::iterator c = genotypeTemplateCache.find(key);
+    if (c != genotypeTemplateCache.end()) {
+        return c->second;
+    }
+    vector<GenotypeTemplate>& templates = genotypeTemplateCache[key];
+    vector<int> indexes;
+    for (int i = 0; i < alleleCount; ++i) {
+        indexes.push_back(i);
+    }
+    // on a grid, the combinations are of grid steps, which are then made
+    // copies by rounding the running total of steps to a fraction of the
+    // ploidy.  as a step is more than one copy, every allele given steps is
+    // given copies, and no two combinations give the same genotype.
+    vector<vector<int> > combinations = multichoose(grid ? grid : ploidy, indexes);
+    for (vector<vector<int> >::iterator combo = combinations.begin(); combo != combinations.end(); ++combo) {
+        // multichoose gives the indexes in order, so equal ones are adjacent
+        GenotypeTemplate shape;
+        vector<int> counts;
+        for (vector<int>::iterator i = combo->begin(); i != combo->end(); ++i) {
+            if (shape.dosages.empty() || shape.dosages.back().first != *i) {
+                shape.dosages.push_back(make_pair(*i, 0));
+            }
+            ++shape.dosages.back().second;
+        }
+        if (grid) {
+            int steps = 0;
+            int copies = 0;
+            for (vector<pair<int, int> >::iterator d = shape.dosages.begin(); d != shape.dosages.end(); ++d) {
+                steps += d->second;
+                int total = ((long int) ploidy * steps + grid / 2) / grid;
+                d->second = total - copies;
+                copies = total;
+            }
+        }
+        if (shape.dosages.size() > 1) {
+            for (vector<pair<int, int> >::iterator d = shape.dosages.begin(); d != shape.dosages.end(); ++d) {
+                counts.push_back(d->second);
+            }
+            shape.permutationsln = multinomialCoefficientLn(ploidy, counts);
+        }
+        templates.push_back(shape);
+    }
+    return templates;
+}
+
+static bool dosageBaseLess(const pair<const Allele*, int>& a, const pair<const Allele*, int>& b) {
+    return *a.first < *b.first;
+}
+
+Genotype::Genotype(const GenotypeTemplate& shape, vector<Allele>& siteAlleles) {
+    // elements are ordered by allele, as when built from the alleles themselves
+    vector<pair<const Allele*, int> > elements;
+    for (vector<pair<int, int> >::const_iterator d = shape.dosages.begin(); d != shape.dosages.end(); ++d) {
+        elements.push_back(make_pair(&siteAlleles[d->first], d->second));
+    }
+    sort(elements.begin(), elements.end(), dosageBaseLess);
+    ploidy = 0;
+    for (vector<pair<const Allele*, int> >::iterator e = elements.begin(); e != elements.end(); ++e) {
+        this->push_back(GenotypeElement(*e->first, e->second));
+        alleleCounts[e->first->currentBase] = e->second;
+        alleles.insert(alleles.end(), e->second, *e->first);
+        ploidy += e->second;
+    }
+    homozygous = isHomozygous();
+    permutationsln = shape.permutationsln;
+    indexedCounts = shape.dosages;
+    dosages.assign(siteAlleles.size(), 0);
+    for (vector<pair<int, int> >::const_iterator d = shape.dosages.begin(); d != shape.dosages.end(); ++d) {
+        dosages[d->first] = d->second;
+    }
+    setLnAlleleProbabilities();
+}
+
+vector<Genotype> allPossibleGenotypes(int ploidy, vector<Allele>& potentialAlleles, int grid) {
     vector<Genotype> genotypes;
+    // alleles which are the same would be merged into one element, which
+    // the templates can't describe
+    set<string> bases;
+    for (vector<Allele>::iterator a = potentialAlleles.begin(); a != potentialAlleles.end(); ++a) {
+        bases.insert(a->currentBase);
+    }
+    if (bases.size() == potentialAlleles.size()) {
+        const vector<GenotypeTemplate>& templates = genotypeTemplates(ploidy, potentialAlleles.size(), grid);
+        genotypes.reserve(templates.size());
+        for (vector<GenotypeTemplate>::const_iterator t = templates.begin(); t != templates.end(); ++t) {
+            genotypes.push_back(Genotype(*t, potentialAlleles));
+        }
+        return genotypes;
+    }
     vector<vector<Allele> > alleleCombinations = multichoose(ploidy, potentialAlleles);
     for (vector<vector<Allele> >::iterator combo = alleleCombinations.begin(); combo != alleleCombinations.end(); ++combo) {
         genotypes.push_back(Genotype(*combo));
@@ -363,7 +473,7 @@ vector<Genotype> allPossibleGenotypes(int ploidy, vector<Allele>& potentialAllel
 
 int GenotypeCombo::numberOfAlleles(void) {
     int count = 0;
-    for (map<string, AlleleCounter>::iterator f = alleleCounters.begin(); f != alleleCounters.end(); ++f) {
+    for (FlatMap<string, AlleleCounter>::iterator f = alleleCounters.begin(); f != alleleCounters.end(); ++f) {
         const AlleleCounter& allele = f->second;
         count += allele.frequency;
     }
@@ -422,6 +532,19 @@ void GenotypeCombo::init(bool useObsExpectations) {
     }
 }
 
+void GenotypeCombo::copyCounts(const GenotypeCombo& other) {
+    probObsGivenGenotypes = other.probObsGivenGenotypes;
+    permutationsln = other.permutationsln;
+    alleleCounters = other.alleleCounters;
+    genotypeCounts = other.genotypeCounts;
+    posteriorProb = other.posteriorProb;
+    priorProb = other.priorProb;
+    priorProbG_Af = other.priorProbG_Af;
+    priorProbAf = other.priorProbAf;
+    priorProbObservations = other.priorProbObservations;
+    priorProbGenotypesGivenHWE = other.priorProbGenotypesGivenHWE;
+}
+
 void GenotypeCombo::addPriorAlleleCounts(map<string, int>& priorACs) {
     for (map<string, int>::iterator p = priorACs.begin(); p != priorACs.end(); ++p) {
         const string& alleleBase = p->first;
@@ -434,7 +557,7 @@ void GenotypeCombo::addPriorAlleleCounts(map<string, int>& priorACs) {
 
 // frequency... should this just be "allele count"?
 int GenotypeCombo::alleleCount(Allele& allele) {
-    map<string, AlleleCounter>::iterator f = alleleCounters.find(allele.currentBase);
+    FlatMap<string, AlleleCounter>::iterator f = alleleCounters.find(allele.currentBase);
     if (f == alleleCounters.end()) {
         return 0;
     } else {
@@ -443,7 +566,7 @@ int GenotypeCombo::alleleCount(Allele& allele) {
 }
 
 int GenotypeCombo::alleleCount(const string& allele) {
-    map<string, AlleleCounter>::iterator f = alleleCounters.find(allele);
+    FlatMap<string, AlleleCounter>::iterator f = alleleCounters.find(allele);
     if (f == alleleCounters.end()) {
         return 0;
     } else {
@@ -451,16 +574,16 @@ int GenotypeCombo::alleleCount(const string& allele) {
     }
 }
 
-long double GenotypeCombo::alleleFrequency(Allele& allele) {
-    return alleleCount(allele) / (long double) numberOfAlleles();
+Probability GenotypeCombo::alleleFrequency(Allele& allele) {
+    return alleleCount(allele) / (Probability) numberOfAlleles();
 }
 
-long double GenotypeCombo::alleleFrequency(const string& allele) {
-    return alleleCount(allele) / (long double) numberOfAlleles();
+Probability GenotypeCombo::alleleFrequency(const string& allele) {
+    return alleleCount(allele) / (Probability) numberOfAlleles();
 }
 
-long double GenotypeCombo::genotypeFrequency(Genotype* genotype) {
-    map<Genotype*, int>::iterator g = genotypeCounts.find(genotype);
+Probability GenotypeCombo::genotypeFrequency(Genotype* genotype) {
+    FlatMap<Genotype*, int>::iterator g = genotypeCounts.find(genotype);
     if (g == genotypeCounts.end()) {
         return 0;
     } else {
@@ -474,25 +597,18 @@ void GenotypeCombo::updateCachedCounts(
         Genotype* newGenotype,
         bool useObsExpectations) {
 
-    // update genotype counts
-    --genotypeCounts[oldGenotype];
+    // update genotype counts, dropping the old genotype if it's now absent
+    FlatMap<Genotype*, int>::iterator gc = genotypeCounts.find(oldGenotype);
+    assert(gc != genotypeCounts.end() && gc->second > 0);
+    if (--gc->second == 0) {
+        genotypeCounts.erase(gc);
+    }
     ++genotypeCounts[newGenotype];
 
     // update permutations
     permutationsln -= oldGenotype->permutationsln;
     permutationsln += newGenotype->permutationsln;
 
-    // remove allele frequencies which are now 0 or below
-    map<Genotype*, int>::iterator gc = genotypeCounts.begin();
-    while (gc != genotypeCounts.end()) {
-        assert(gc->second >= 0);
-        if (gc->second == 0) {
-            genotypeCounts.erase(gc++);
-        } else {
-            ++gc;
-        }
-    }
-
     // TODO can we improve efficiency by only adjusting for bases which are actually changed
 
     // remove allele frequency information for old genotype
@@ -596,12 +712,12 @@ void GenotypeCombo::updateCachedCounts(
     }
 
     // remove allele frequencies which are now 0 or below
-    map<string, AlleleCounter>::iterator af = alleleCounters.begin();
+    FlatMap<string, AlleleCounter>::iterator af = alleleCounters.begin();
     while (af != alleleCounters.end()) {
         assert(af->second.frequency >= 0);
         if (af->second.frequency == 0) {
             assert(af->second.observations == 0);
-            alleleCounters.erase(af++);
+            af = alleleCounters.erase(af);
         } else {
             ++af;
         }
@@ -611,7 +727,7 @@ void GenotypeCombo::updateCachedCounts(
 
 map<int, int> GenotypeCombo::countFrequencies(void) {
     map<int, int> frequencyCounts;
-    for (map<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
+    for (FlatMap<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
         const AlleleCounter& allele = a->second;
         map<int, int>::iterator c = frequencyCounts.find(allele.frequency);
         if (c != frequencyCounts.end()) {
@@ -623,10 +739,19 @@ map<int, int> GenotypeCombo::countFrequencies(void) {
     return frequencyCounts;
 }
 
+void GenotypeCombo::frequencySpectrum(vector<int>& spectrum) {
+    spectrum.clear();
+    for (FlatMap<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
+        spectrum.push_back(a->second.frequency);
+    }
+    sort(spectrum.begin(), spectrum.end());
+}
+
 vector<int> GenotypeCombo::counts(void) {
     //map<string, int> alleleCounters = countAlleles();
     vector<int> counts;
-    for (map<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
+    counts.reserve(alleleCounters.size());
+    for (FlatMap<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
         const AlleleCounter& allele = a->second;
         counts.push_back(allele.frequency);
     }
@@ -645,7 +770,8 @@ int GenotypeCombo::hetCount(void) {
 
 vector<int> GenotypeCombo::observationCounts(void) {
     vector<int> counts;
-    for (map<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
+    counts.reserve(alleleCounters.size());
+    for (FlatMap<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
         const AlleleCounter& allele = a->second;
         counts.push_back(allele.observations);
     }
@@ -654,7 +780,7 @@ vector<int> GenotypeCombo::observationCounts(void) {
 
 int GenotypeCombo::observationTotal(void) {
     int total = 0;
-    for (map<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
+    for (FlatMap<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
         const AlleleCounter& allele = a->second;
         total += allele.observations;
     }
@@ -664,17 +790,18 @@ int GenotypeCombo::observationTotal(void) {
 // how many copies of the locus are in the whole genotype combination?
 int GenotypeCombo::ploidy(void) {
     int copies = 0;
-    for (map<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
+    for (FlatMap<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
         const AlleleCounter& allele = a->second;
         copies += allele.frequency;
     }
     return copies;
 }
 
-vector<long double> GenotypeCombo::alleleProbs(void) {
-    vector<long double> probs;
-    long double copies = ploidy();
-    for (map<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
+vector<Probability> GenotypeCombo::alleleProbs(void) {
+    vector<Probability> probs;
+    probs.reserve(alleleCounters.size());
+    Probability copies = ploidy();
+    for (FlatMap<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
         const AlleleCounter& allele = a->second;
         probs.push_back(allele.frequency / copies);
     }
@@ -683,7 +810,7 @@ vector<long double> GenotypeCombo::alleleProbs(void) {
 
 vector<string> GenotypeCombo::alleles(void) {
     vector<string> bases;
-    for (map<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
+    for (FlatMap<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
         bases.push_back(a->first);
     }
     return bases;
@@ -772,19 +899,112 @@ bool sortSampleDataLikelihoodsScaledByMarginals(SampleDataLikelihoods& samplesLi
     return reordered;
 }
 
+// adds a combo made of the king's genotypes with the cached counts and
+// probabilities of the scored one; the caller puts in the genotypes which
+// differ from the king's
+static GenotypeCombo& addScoredCombo(list<GenotypeCombo>& combos, GenotypeCombo& comboKing, GenotypeCombo& scored) {
+    combos.push_back(GenotypeCombo());
+    GenotypeCombo& combo = combos.back();
+    combo.assign(comboKing.begin(), comboKing.end());
+    combo.copyCounts(scored);
+    return combo;
+}
+
+void GenotypeComboHeap::reset(size_t maxCombos) {
+    capacity = maxCombos;
+    used = 0;
+    heap.clear();
+    pinned.clear();
+    lnEvicted = -INFINITY;
+}
+
+bool GenotypeComboHeap::precedes(size_t a, size_t b) {
+    const Slot& x = arena[a];
+    const Slot& y = arena[b];
+    return x.counts.posteriorProb > y.counts.posteriorProb
+        || (x.counts.posteriorProb == y.counts.posteriorProb && x.order < y.order);
+}
+
+size_t GenotypeComboHeap::store(GenotypeCombo& scored, const ComboMoves& moves, Order order) {
+    size_t slot = used++;
+    if (slot == arena.size()) {
+        arena.push_back(Slot());
+    }
+    arena[slot].counts.copyCounts(scored);
+    arena[slot].moves = moves;
+    arena[slot].order = order;
+    return slot;
+}
+
+void GenotypeComboHeap::offer(GenotypeCombo& scored, const ComboMoves& moves, Order order) {
+    if (capacity == 0) {
+        heap.push_back(store(scored, moves, order));
+        return;
+    }
+    if (scored.isHomozygous()) {
+        pinned.push_back(store(scored, moves, order));
+        return;
+    }
+    // with precedes as its ordering, the heap keeps its worst combo in front
+    function<bool(size_t, size_t)> worse = [this](size_t a, size_t b) { return precedes(a, b); };
+    if (heap.size() < capacity) {
+        heap.push_back(store(scored, moves, order));
+        push_heap(heap.begin(), heap.end(), worse);
+        return;
+    }
+    const Slot& worst = arena[heap.front()];
+    if (scored.posteriorProb < worst.counts.posteriorProb
+        || (scored.posteriorProb == worst.counts.posteriorProb && order > worst.order)) {
+        lnEvicted = logaddexp(lnEvicted, scored.posteriorProb);
+        return;
+    }
+    pop_heap(heap.begin(), heap.end(), worse);
+    Slot& slot = arena[heap.back()];
+    lnEvicted = logaddexp(lnEvicted, slot.counts.posteriorProb);
+    slot.counts.copyCounts(scored);
+    slot.moves = moves;
+    slot.order = order;
+    push_heap(heap.begin(), heap.end(), worse);
+}
+
+void GenotypeComboHeap::merge(GenotypeComboHeap& other) {
+    for (vector<size_t>::iterator i = other.heap.begin(); i != other.heap.end(); ++i) {
+        Slot& slot = other.arena[*i];
+        offer(slot.counts, slot.moves, slot.order);
+    }
+    for (vector<size_t>::iterator i = other.pinned.begin(); i != other.pinned.end(); ++i) {
+        Slot& slot = other.arena[*i];
+        offer(slot.counts, slot.moves, slot.order);
+    }
+    lnEvicted = logaddexp(lnEvicted, other.lnEvicted);
+}
+
+void GenotypeComboHeap::build(list<GenotypeCombo>& combos, GenotypeCombo& comboKing) {
+    vector<size_t> slots(heap);
+    slots.insert(slots.end(), pinned.begin(), pinned.end());
+    sort(slots.begin(), slots.end(), [this](size_t a, size_t b) { return precedes(a, b); });
+    for (vector<size_t>::iterator i = slots.begin(); i != slots.end(); ++i) {
+        Slot& slot = arena[*i];
+        GenotypeCombo& combo = addScoredCombo(combos, comboKing, slot.counts);
+        for (ComboMoves::iterator m = slot.moves.begin(); m != slot.moves.end(); ++m) {
+            combo.at(m->first) = m->second;
+        }
+    }
+}
+
 // assumes that the data likelihoods are sorted
 void
 dataLikelihoodMaxGenotypeCombo(
     GenotypeCombo& combo,
     SampleDataLikelihoods& sampleDataLikelihoods,
-    long double theta,
+    Probability theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar) {
+    Probability diffusionPriorScalar) {
 
     for (SampleDataLikelihoods::iterator s = sampleDataLikelihoods.begin();
             s != sampleDataLikelihoods.end(); ++s) {
@@ -812,14 +1032,14 @@ makeComboByDatalLikelihoodRank(
     SampleDataLikelihoods& variantSampleDataLikelihoods,
     SampleDataLikelihoods& invariantSampleDataLikelihoods,
     map<string, int>& priorACs,
-    long double theta,
+    Probability theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar) {
+    Probability diffusionPriorScalar) {
 
     // generate the best genotype combination according to data
     // likelihoods
@@ -857,6 +1077,76 @@ makeComboByDatalLikelihoodRank(
 
 // 'local' genotype combinations which step only in one sample away from the
 // data likelihood maxiumum.  deal with all genotypes.
+// scores the combos one step from the king, changing a sample in [first, last)
+//
+// moves are scored on a copy of the king's counts, so evaluating one costs
+// the size of the counts rather than of the population.  only the combos we
+// keep are built in full: all of them if we're keeping combos, and otherwise
+// just the best, once the caller has seen every range.
+void LocalComboMoves::score(
+    GenotypeCombo& comboKing,
+    SampleDataLikelihoods& sampleDataLikelihoods,
+    size_t first, size_t last,
+    Probability kingPosterior,
+    Probability theta,
+    bool pooled,
+    bool ewensPriors,
+    bool permute,
+    bool hwePriors,
+    bool binomialObsPriors,
+    bool alleleBalancePriors,
+    Probability diffusionPriorScalar,
+    bool keepCombos) {
+
+    bestMove = NULL;
+    bestPosterior = kingPosterior;
+    ComboMoves move(1);
+
+    for (size_t sampleOffset = first; sampleOffset < last; ++sampleOffset) {
+        SampleDataLikelihood& oldsdl = *comboKing.at(sampleOffset);
+        vector<SampleDataLikelihood>& sdls = sampleDataLikelihoods[sampleOffset];
+        for (vector<SampleDataLikelihood>::iterator dl = sdls.begin(); dl != sdls.end(); ++dl) {
+
+            SampleDataLikelihood& newsdl = *dl;
+            if (newsdl.genotype == oldsdl.genotype) {  // don't duplicate the comboKing
+                continue;
+            }
+            trial.copyCounts(comboKing);
+            // get the old and new genotypes, which we compare
+            // to change the cached counts and probability of
+            // the combo
+            trial.updateCachedCounts(oldsdl.sample,
+                    oldsdl.genotype, newsdl.genotype,
+                    binomialObsPriors);
+            // find data likelihood difference from ComboKing
+            Probability diff = oldsdl.prob - newsdl.prob;
+            // adjust combination total data likelihood
+            trial.probObsGivenGenotypes -= diff;
+            trial.calculatePosteriorProbability(theta,
+                                            pooled,
+                                            ewensPriors,
+                                            permute,
+                                            hwePriors,
+                                            binomialObsPriors,
+                                            alleleBalancePriors,
+                                            diffusionPriorScalar);
+            if (keepCombos) {
+                // replace genotype with new genotype
+                move.front() = make_pair(sampleOffset, &*dl);
+                kept.offer(trial, move, make_pair(sampleOffset, (size_t) (dl - sdls.begin())));
+            }
+            if (trial.posteriorProb > bestPosterior) {
+                // the best so far replaces the one we hold, as when all are
+                // built and the worse of each pair is dropped
+                bestPosterior = trial.posteriorProb;
+                bestCounts.copyCounts(trial);
+                bestMove = &*dl;
+                bestOffset = sampleOffset;
+            }
+        }
+    }
+}
+
 void
 allLocalGenotypeCombinations(
     list<GenotypeCombo>& combos,
@@ -864,15 +1154,19 @@ allLocalGenotypeCombinations(
     SampleDataLikelihoods& sampleDataLikelihoods,
     Samples& samples,
     map<string, int>& priorACs,
-    long double theta,
+    Probability theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar,
-    bool keepCombos) {
+    Probability diffusionPriorScalar,
+    bool keepCombos,
+    WorkerTeam* team,
+    size_t maxCombos,
+    Probability* lnEvicted,
+    GenotypeCombo* bestNeighbour) {
 
     // make the data likelihood maximum if needed
     if (comboKing.empty()) {
@@ -899,54 +1193,60 @@ allLocalGenotypeCombinations(
         combos.push_back(comboKing);
     }
 
-    // for each sampledatalikelihood
-    // add a combo for each genotype where the combo is one step from the comboKing
-    size_t sampleOffset = 0;
-    //GenotypeCombo::iterator sampleGenotypeItr = comboKing.begin();
-    for (SampleDataLikelihoods::iterator s = sampleDataLikelihoods.begin();
-            s != sampleDataLikelihoods.end(); ++s, ++sampleOffset) {
-        SampleDataLikelihood& oldsdl = *comboKing.at(sampleOffset);
-        vector<SampleDataLikelihood>& sdls = *s;
-        for (vector<SampleDataLikelihood>::iterator dl = sdls.begin(); dl != sdls.end(); ++dl) {
+    // the samples are split into contiguous ranges, one per member of the
+    // team, which are scored independently and then taken in order, so the
+    // result doesn't depend on the number of threads
+    int members = 1;
+    if (team && !sampleDataLikelihoods.empty()) {
+        members = min((size_t) team->size(),
+                      max((size_t) 1, sampleDataLikelihoods.size() / MIN_SAMPLES_PER_GENOTYPING_THREAD));
+    }
+    vector<LocalComboMoves> moves(members);
+    Probability kingPosterior = combos.front().posteriorProb;
+    function<void(int)> score = [&](int member) {
+        if (member >= members) {
+            return;
+        }
+        size_t first = sampleDataLikelihoods.size() * member / members;
+        size_t last = sampleDataLikelihoods.size() * (member + 1) / members;
+        moves[member].kept.reset(maxCombos);
+        moves[member].score(comboKing, sampleDataLikelihoods, first, last, kingPosterior,
+                            theta, pooled, ewensPriors, permute, hwePriors,
+                            binomialObsPriors, alleleBalancePriors, diffusionPriorScalar, keepCombos);
+    };
+    if (members > 1) {
+        team->run(score);
+    } else {
+        score(0);
+    }
 
-            SampleDataLikelihood& newsdl = *dl;
-            if (newsdl.genotype == oldsdl.genotype) {  // don't duplicate the comboKing
-                continue;
-            }
-            combos.push_back(comboKing);
-            GenotypeCombo& combo = combos.back();
-            // get the old and new genotypes, which we compare
-            // to change the cached counts and probability of
-            // the combo
-            combo.updateCachedCounts(oldsdl.sample,
-                    oldsdl.genotype, newsdl.genotype,
-                    binomialObsPriors);
-            // replace genotype with new genotype
-            combo.at(sampleOffset) = &*dl;
-            // find data likelihood difference from ComboKing
-            long double diff = oldsdl.prob - newsdl.prob;
-            // adjust combination total data likelihood
-            combo.probObsGivenGenotypes -= diff;
-            combo.calculatePosteriorProbability(theta,
-                                            pooled,
-                                            ewensPriors,
-                                            permute,
-                                            hwePriors,
-                                            binomialObsPriors,
-                                            alleleBalancePriors,
-                                            diffusionPriorScalar);
-            // TODO
-            // memory-saving intervention, improve this
-            // difficult if we want to calculate marginals...
-            if (!keepCombos) {
-		// we should only have two combos in the list now...
-		if (combos.front().posteriorProb < combos.back().posteriorProb) {
-		    combos.pop_front();
-		} else {
-		    combos.pop_back();
-		}
-            }
+    // the first of the best, as if the samples were scored in one pass
+    LocalComboMoves* best = NULL;
+    for (vector<LocalComboMoves>::iterator m = moves.begin(); m != moves.end(); ++m) {
+        if (m->bestMove && (!best || m->bestPosterior > best->bestPosterior)) {
+            best = &*m;
+        }
+    }
+
+    if (keepCombos && bestNeighbour && best) {
+        // the king has been beaten, so the caller doesn't want the combos
+        bestNeighbour->assign(comboKing.begin(), comboKing.end());
+        bestNeighbour->copyCounts(best->bestCounts);
+        bestNeighbour->at(best->bestOffset) = best->bestMove;
+        return;
+    } else if (keepCombos) {
+        GenotypeComboHeap& kept = moves.front().kept;
+        for (vector<LocalComboMoves>::iterator m = moves.begin() + 1; m != moves.end(); ++m) {
+            kept.merge(m->kept);
+        }
+        kept.build(combos, comboKing);
+        if (lnEvicted) {
+            *lnEvicted = logaddexp(*lnEvicted, kept.lnEvicted);
         }
+    } else if (best) {
+        GenotypeCombo& combo = addScoredCombo(combos, comboKing, best->bestCounts);
+        combo.at(best->bestOffset) = best->bestMove;
+        combos.pop_front();
     }
 
     GenotypeComboResultSorter gcrSorter;
@@ -964,15 +1264,17 @@ bandedGenotypeCombinations(
     Samples& samples,
     map<string, int>& priorACs,
     int bandwidth, int banddepth,
-    long double theta,
+    Probability theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar,
-    bool keepCombos) {
+    Probability diffusionPriorScalar,
+    bool keepCombos,
+    size_t maxCombos,
+    Probability* lnEvicted) {
 
     // get the number of samples that vary
     int nsamples = variantSampleDataLikelihoods.size();
@@ -1034,6 +1336,18 @@ bandedGenotypeCombinations(
     }
     vector<vector<int> > deviations = multichoose(bandwidth, depths);
 
+    // as in allLocalGenotypeCombinations, combos are scored from counts
+    // and only built if they are kept
+    GenotypeCombo trial;
+    GenotypeCombo bestCounts;
+    ComboMoves moves;
+    ComboMoves bestMoves;
+    bool haveBest = false;
+    GenotypeComboHeap kept;
+    kept.reset(maxCombos);
+    size_t scored = 0;
+    Probability bestPosterior = combos.empty() ? 0 : combos.front().posteriorProb;
+
     // skip the first vector, which will always be the same as the
     // combo king, and has been pushed into our combinations already
     for (vector<vector<int> >::iterator d = deviations.begin(); d != deviations.end(); ++d) {
@@ -1044,14 +1358,15 @@ bandedGenotypeCombinations(
         }
         vector<vector<int> > indexPermutations = multipermute(indexes);
         for (vector<vector<int> >::const_iterator p = indexPermutations.begin(); p != indexPermutations.end(); ++p) {
-            combos.push_back(comboKing); // copy the king, and then we'll modify it according to the indicies
-            GenotypeCombo& combo = combos.back();
-            GenotypeCombo::iterator sampleGenotypeItr = combo.begin();
+            // score the combo on a copy of the king's counts, and note the
+            // genotypes it replaces, so we only build it if we keep it
+            trial.copyCounts(comboKing);
+            moves.clear();
+            GenotypeCombo::iterator sampleGenotypeItr = comboKing.begin();
             vector<int>::const_iterator n = p->begin();
             for (SampleDataLikelihoods::iterator s = variantSampleDataLikelihoods.begin();
                     s != variantSampleDataLikelihoods.end(); ++s, ++n, ++sampleGenotypeItr) {
                 SampleDataLikelihood& oldsdl = **sampleGenotypeItr;
-                SampleDataLikelihood*& oldsdl_ptr = *sampleGenotypeItr;
                 vector<SampleDataLikelihood>& sdls = *s;
                 int offset = *n + oldsdl.rank;
                 if (offset > 0) {
@@ -1061,18 +1376,18 @@ bandedGenotypeCombinations(
                     // get the old and new genotypes, which we compare
                     // to change the cached counts and probability of
                     // the combo
-                    combo.updateCachedCounts(oldsdl.sample,
+                    trial.updateCachedCounts(oldsdl.sample,
                             oldsdl.genotype, newsdl->genotype,
                             binomialObsPriors);
                     // replace genotype with new genotype
-                    oldsdl_ptr = newsdl;
+                    moves.push_back(make_pair(sampleGenotypeItr - comboKing.begin(), newsdl));
                     // find data likelihood difference from ComboKing
-                    long double diff = oldsdl.prob - newsdl->prob;
+                    Probability diff = oldsdl.prob - newsdl->prob;
                     // adjust combination total data likelihood
-                    combo.probObsGivenGenotypes -= diff;
+                    trial.probObsGivenGenotypes -= diff;
                 }
             }
-            combo.calculatePosteriorProbability(theta,
+            trial.calculatePosteriorProbability(theta,
                                             pooled,
                                             ewensPriors,
                                             permute,
@@ -1080,17 +1395,36 @@ bandedGenotypeCombinations(
                                             binomialObsPriors,
                                             alleleBalancePriors,
                                             diffusionPriorScalar);
-            if (!keepCombos && combos.size()  > 1) {
-                // we should only have two combos in the list now...
-                if (combos.front().posteriorProb < combos.back().posteriorProb) {
-                    combos.pop_front();
-                } else {
-                    combos.pop_back();
-                }
+            if (keepCombos) {
+                kept.offer(trial, moves, make_pair((size_t) 0, scored++));
+            } else if ((combos.empty() && !haveBest) || trial.posteriorProb > bestPosterior) {
+                // we should only have one combo at the end, the best
+                bestPosterior = trial.posteriorProb;
+                bestCounts.copyCounts(trial);
+                bestMoves = moves;
+                haveBest = true;
             }
         }
     }
 
+    if (haveBest) {
+        bool replacing = !combos.empty();
+        GenotypeCombo& combo = addScoredCombo(combos, comboKing, bestCounts);
+        for (ComboMoves::iterator m = bestMoves.begin(); m != bestMoves.end(); ++m) {
+            combo.at(m->first) = m->second;
+        }
+        if (replacing) {
+            combos.pop_front();
+        }
+    }
+
+    if (keepCombos) {
+        kept.build(combos, comboKing);
+        if (lnEvicted) {
+            *lnEvicted = logaddexp(*lnEvicted, kept.lnEvicted);
+        }
+    }
+
     GenotypeComboResultSorter gcrSorter;
     combos.sort(gcrSorter);
     combos.unique();
@@ -1109,17 +1443,31 @@ convergentGenotypeComboSearch(
     vector<Allele>& genotypeAlleles,
     map<string, int>& priorACs,
     int bandwidth, int banddepth,
-    long double theta,
+    Probability theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar,
+    Probability diffusionPriorScalar,
     int maxiterations,
     int& totaliterations,
-    bool addHomozygousCombos) {
+    bool addHomozygousCombos,
+    WorkerTeam* team,
+    size_t maxCombos,
+    Probability* lnEvictedPosterior,
+    bool keepEveryPass,
+    uint64_t deadline,
+    Probability tolerance,
+    bool* stoppedByDeadline) {
+
+    if (lnEvictedPosterior) {
+        *lnEvictedPosterior = -INFINITY;
+    }
+    if (stoppedByDeadline) {
+        *stoppedByDeadline = false;
+    }
 
     if (comboKing.empty()) {
         // seed EM with the data likelihood maximum
@@ -1142,13 +1490,91 @@ convergentGenotypeComboSearch(
 
     // set best position, which is updated during the EM step
     GenotypeCombo bestCombo = comboKing;
+    bool unbanded = bandwidth == 0 && banddepth == 0;
 
     int i = 0;
     for (; i < maxiterations; ++i) {
 
+        if (deadline && i > 0 && wallClockNanoseconds() > deadline) {
+            // out of time, so we make do with what we have
+            if (stoppedByDeadline) {
+                *stoppedByDeadline = true;
+            }
+            break;
+        }
+
         combos.clear();
 
-        if (bandwidth == 0 && banddepth == 0) {
+        if (unbanded && (keepEveryPass || tolerance > 0)) {
+            // this follows the same path as the search below, but each pass
+            // keeps its combos, which are those the final pass would make,
+            // unless a neighbour beats the king.  with a tolerance the pass
+            // may end the search short of that, so it's taken this way too,
+            // rather than keeping and sorting the combos of every pass
+            GenotypeCombo bestNeighbour;
+            Probability lnEvicted = -INFINITY;
+            allLocalGenotypeCombinations(
+                    combos,
+                    bestCombo,
+                    sampleDataLikelihoods,
+                    samples,
+                    priorACs,
+                    theta,
+                    pooled,
+                    ewensPriors,
+                    permute,
+                    hwePriors,
+                    binomialObsPriors,
+                    alleleBalancePriors,
+                    diffusionPriorScalar,
+                    true, // keep combos, unless the king is beaten
+                    team,
+                    maxCombos,
+                    &lnEvicted,
+                    &bestNeighbour);
+            if (bestNeighbour.empty() || bestNeighbour.isHomozygous()
+                || (tolerance > 0 && bestNeighbour.posteriorProb - bestCombo.posteriorProb < tolerance)) {
+                if (!bestNeighbour.empty()) {
+                    // we've converged on a homozygous combo, or as near the
+                    // best as the tolerance asks, and get the combos around it
+                    combos.clear();
+                    allLocalGenotypeCombinations(
+                            combos,
+                            bestNeighbour,
+                            sampleDataLikelihoods,
+                            samples,
+                            priorACs,
+                            theta,
+                            pooled,
+                            ewensPriors,
+                            permute,
+                            hwePriors,
+                            binomialObsPriors,
+                            alleleBalancePriors,
+                            diffusionPriorScalar,
+                            true, // keep combos
+                            team,
+                            maxCombos,
+                            &lnEvicted);
+                }
+                if (lnEvictedPosterior) {
+                    *lnEvictedPosterior = lnEvicted;
+                }
+                break;
+            }
+            bestCombo = bestNeighbour;
+            combos.clear();
+            combos.push_back(bestCombo);
+            continue;
+        }
+
+        // with a tolerance, any banded pass may be the last, and as the
+        // banded search is scored again around the last best, each keeps its
+        // combos rather than scoring them again once the search converges
+        bool keepPass = tolerance > 0;
+        Probability lnEvicted = -INFINITY;
+
+        if (unbanded) {
             allLocalGenotypeCombinations(
                     combos,
                     bestCombo,
@@ -1163,7 +1589,10 @@ convergentGenotypeComboSearch(
                     binomialObsPriors,
                     alleleBalancePriors,
                     diffusionPriorScalar,
-                    false); // throw away combos, so as to reduce memory usage
+                    keepPass, // otherwise throw away combos, so as to reduce memory usage
+                    team,
+                    maxCombos,
+                    &lnEvicted);
         } else {
             bandedGenotypeCombinations(
                     combos,
@@ -1182,7 +1611,9 @@ convergentGenotypeComboSearch(
                     binomialObsPriors,
                     alleleBalancePriors,
                     diffusionPriorScalar,
-                    false); // throw away combos, so as to reduce memory usage
+                    keepPass, // as above
+                    maxCombos,
+                    &lnEvicted);
         }
 
         //cerr << "combos size = " << combos.size() << endl;
@@ -1192,10 +1623,16 @@ convergentGenotypeComboSearch(
         //
         // either we've converged on the best homozygous combo, which suggests
         // weak support for variation, or we've got the same combo twice in a
-        // row as our best
-        if (combos.front().isHomozygous() || bestCombo == combos.front()) {
-            // we've converged
-	    if (bandwidth == 0 && banddepth == 0) {
+        // row as our best, or the best has gained less than the tolerance
+        if (combos.front().isHomozygous() || bestCombo == combos.front()
+            || (keepPass && combos.front().posteriorProb - bestCombo.posteriorProb < tolerance)) {
+            // we've converged.  a kept pass is of the banded search, whose
+            // combos would be scored around the last best again
+            if (keepPass) {
+                if (lnEvictedPosterior) {
+                    *lnEvictedPosterior = lnEvicted;
+                }
+	    } else if (unbanded) {
 		// XXX temporary hack
 		// get the rest of the combos in memory so we can do computation with them...
 		allLocalGenotypeCombinations(
@@ -1212,7 +1649,10 @@ convergentGenotypeComboSearch(
 		    binomialObsPriors,
 		    alleleBalancePriors,
 		    diffusionPriorScalar,
-		    true); // keep combos
+		    true, // keep combos
+		    team,
+		    maxCombos,
+		    lnEvictedPosterior);
 	    } else {
 		bandedGenotypeCombinations(
 		    combos,
@@ -1231,7 +1671,9 @@ convergentGenotypeComboSearch(
 		    binomialObsPriors,
 		    alleleBalancePriors,
 		    diffusionPriorScalar,
-		    true); // keep combos
+		    true, // keep combos
+		    maxCombos,
+		    lnEvictedPosterior);
 	    }
 	    break;
         } else {
@@ -1274,14 +1716,14 @@ void addAllHomozygousCombos(
     SampleDataLikelihoods& invariantSampleDataLikelihoods,
     Samples& samples,
     vector<Allele>& genotypeAlleles,
-    long double theta,
+    Probability theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar) {
+    Probability diffusionPriorScalar) {
 
     // determine which homozygous combos we already have
 
@@ -1316,25 +1758,38 @@ void addAllHomozygousCombos(
         map<Allele, bool>::iterator g = allelesWithHomozygousCombos.find(allele);
         if (g == allelesWithHomozygousCombos.end()) {
             // we need to make a new combo
-            // iterate through the sample genotype vector
-            GenotypeCombo& combo = homozygousCombos[allele];
-            // match the way we make combos in bandedCombos*()
-            SampleDataLikelihoods::iterator s = variantSampleDataLikelihoods.begin();
-            while (s != invariantSampleDataLikelihoods.end()) {
-                // for each sample genotype, if the genotype is the same as our currently needed genotype, push it back onto a new combo
-                for (vector<SampleDataLikelihood>::iterator d = s->begin(); d != s->end(); ++d) {
-                    SampleDataLikelihood& sdl = *d;
-                    // this check is ploidy-independent
-                    if (sdl.genotype->homozygous && sdl.genotype->front().allele == allele) {
-                        combo.push_back(&sdl);
-                        break;
-                    }
+            homozygousCombos[allele];
+        }
+    }
+
+    // the combos are filled in one pass over the genotypes of each sample,
+    // each taking the sample's first homozygous genotype of its allele
+    if (!homozygousCombos.empty()) {
+        // match the way we make combos in bandedCombos*()
+        size_t sample = 0;
+        map<GenotypeCombo*, size_t> filled; // the samples each combo has, plus one
+        SampleDataLikelihoods::iterator s = variantSampleDataLikelihoods.begin();
+        while (s != invariantSampleDataLikelihoods.end()) {
+            ++sample;
+            for (vector<SampleDataLikelihood>::iterator d = s->begin(); d != s->end(); ++d) {
+                SampleDataLikelihood& sdl = *d;
+                // this check is ploidy-independent
+                if (!sdl.genotype->homozygous) {
+                    continue;
                 }
-                ++s;
-                if (s == variantSampleDataLikelihoods.end()) {
-                    s = invariantSampleDataLikelihoods.begin();
+                map<Allele, GenotypeCombo>::iterator c = homozygousCombos.find(sdl.genotype->front().allele);
+                if (c != homozygousCombos.end()) {
+                    size_t& last = filled[&c->second];
+                    if (last != sample) {
+                        c->second.push_back(&sdl);
+                        last = sample;
+                    }
                 }
             }
+            ++s;
+            if (s == variantSampleDataLikelihoods.end()) {
+                s = invariantSampleDataLikelihoods.begin();
+            }
         }
     }
 
@@ -1388,47 +1843,90 @@ void addAllHomozygousCombos(
 }
 
 // conditional probability of the genotype combination given the represented allele frequencies
-long double GenotypeCombo::probabilityGivenAlleleFrequencyln(bool permute) {
+Probability GenotypeCombo::probabilityGivenAlleleFrequencyln(bool permute) {
 
     //return -multinomialCoefficientLn(numberOfAlleles(), counts());
 
     int n = numberOfAlleles();
-    long double lnhetscalar = 0;
+    Probability lnhetscalar = 0;
 
     if (permute) {
         // scale by the product of permutations of heterozygotes
         lnhetscalar = permutationsln; // cached permutations of this combo
     }
 
-    return lnhetscalar - multinomialCoefficientLn(n, counts());
+    Probability factorials = 0;
+    for (FlatMap<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
+        factorials += factorialln(a->second.frequency);
+    }
+    return lnhetscalar - (factorialln(n) - factorials);
 
 }
 
-long double GenotypeCombo::hweComboProb(void) {
-    long double comboHweProb = 0;
-    for (map<Genotype*, int>::iterator gc = genotypeCounts.begin(); gc != genotypeCounts.end(); ++gc) {
+// the sum of hweProbGenotypeFrequencyln over the genotypes in the combo
+//
+// of the terms of each genotype's probability, only the arrangements of its
+// own alleles (its permutationsln) are particular to it.  the arrangements of
+// the population's alleles are the same for every genotype, and those of the
+// genotypes are the same for every genotype of a ploidy, so we find each of
+// these once per combo rather than once per genotype.
+Probability GenotypeCombo::hweComboProb(void) {
+
+    int popTotalAlleles = 0;
+    vector<int> popAlleleCounts;
+    popAlleleCounts.reserve(alleleCounters.size());
+    for (FlatMap<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
+        popAlleleCounts.push_back(a->second.frequency);
+        popTotalAlleles += a->second.frequency;
+    }
+    Probability arrangementsOfAllelesInSample = multinomialCoefficientLn(popTotalAlleles, popAlleleCounts);
+
+    map<int, Probability> arrangementsOfGenotypesByPloidy;
+    Probability comboHweProb = 0;
+    for (FlatMap<Genotype*, int>::iterator gc = genotypeCounts.begin(); gc != genotypeCounts.end(); ++gc) {
         Genotype* genotype = gc->first;
-        comboHweProb += hweProbGenotypeFrequencyln(genotype);
+        map<int, Probability>::iterator a = arrangementsOfGenotypesByPloidy.find(genotype->ploidy);
+        if (a == arrangementsOfGenotypesByPloidy.end()) {
+            Probability arrangements;
+            // for haploid, estimate as if we have all ploidy 1
+            if (genotype->ploidy == 1) {
+                arrangements = arrangementsOfAllelesInSample;
+            } else {
+                int popTotalGenotypes = 0;
+                vector<int> popGenotypeCounts;
+                for (FlatMap<Genotype*, int>::iterator g = genotypeCounts.begin(); g != genotypeCounts.end(); ++g) {
+                    if (g->first->ploidy == genotype->ploidy) {
+                        popGenotypeCounts.push_back(g->second);
+                        popTotalGenotypes += g->second;
+                    }
+                }
+                arrangements = multinomialCoefficientLn(popTotalGenotypes, popGenotypeCounts);
+            }
+            a = arrangementsOfGenotypesByPloidy.insert(make_pair(genotype->ploidy, arrangements)).first;
+        }
+        comboHweProb += genotype->permutationsln + a->second - arrangementsOfAllelesInSample;
     }
     return comboHweProb;
+
 }
 
 // probability of the combo under HWE
-long double GenotypeCombo::hweExpectedFrequencyln(Genotype* genotype) {
+Probability GenotypeCombo::hweExpectedFrequencyln(Genotype* genotype) {
 
     int ploidy = genotype->ploidy;
 
     vector<int> genotypeAlleleCounts;
-    vector<long double> alleleFrequencies;
-    for (map<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
+    vector<Probability> alleleFrequencies;
+    Probability alleles = numberOfAlleles();
+    for (FlatMap<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
         genotypeAlleleCounts.push_back(genotype->alleleCount(a->first));
-        alleleFrequencies.push_back((long double) a->second.frequency / (long double) numberOfAlleles());
+        alleleFrequencies.push_back((Probability) a->second.frequency / alleles);
     }
 
-    long double HWECoefficientln = multinomialCoefficientLn(ploidy, genotypeAlleleCounts);
+    Probability HWECoefficientln = multinomialCoefficientLn(ploidy, genotypeAlleleCounts);
 
     vector<int>::iterator c = genotypeAlleleCounts.begin();
-    vector<long double>::iterator f = alleleFrequencies.begin();
+    vector<Probability>::iterator f = alleleFrequencies.begin();
     for (; c != genotypeAlleleCounts.end(); ++c, ++f) {
          HWECoefficientln += powln(log(*f), *c);
     }
@@ -1439,7 +1937,7 @@ long double GenotypeCombo::hweExpectedFrequencyln(Genotype* genotype) {
 
 // probability that the genotype count in the combo is what it is given the
 // counts of the other alleles
-long double GenotypeCombo::hweProbGenotypeFrequencyln(Genotype* genotype) {
+Probability GenotypeCombo::hweProbGenotypeFrequencyln(Genotype* genotype) {
 
     //cout << endl << *genotype << endl;
 
@@ -1447,7 +1945,7 @@ long double GenotypeCombo::hweProbGenotypeFrequencyln(Genotype* genotype) {
     //cout << "popTotalAlleles = " << popTotalAlleles << endl;
     vector<int> popAlleleCounts;
     vector<int> thisGenotypeAlleleCounts;
-    for (map<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
+    for (FlatMap<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
         //cout << a->first << "\t" << a->second.frequency << "\t" << genotype->alleleCount(a->first) << endl;
         popAlleleCounts.push_back(a->second.frequency);
         thisGenotypeAlleleCounts.push_back(genotype->alleleCount(a->first));
@@ -1457,12 +1955,12 @@ long double GenotypeCombo::hweProbGenotypeFrequencyln(Genotype* genotype) {
     vector<int> popGenotypeCounts;
     // for haploid, estimate as if we have all ploidy 1
     if (genotype->ploidy == 1) {
-        for (map<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
+        for (FlatMap<string, AlleleCounter>::iterator a = alleleCounters.begin(); a != alleleCounters.end(); ++a) {
             popGenotypeCounts.push_back(a->second.frequency);
             popTotalGenotypes += a->second.frequency;
         }
     } else {
-        for (map<Genotype*, int>::iterator g = genotypeCounts.begin(); g != genotypeCounts.end(); ++g) {
+        for (FlatMap<Genotype*, int>::iterator g = genotypeCounts.begin(); g != genotypeCounts.end(); ++g) {
             if (g->first->ploidy == genotype->ploidy) {
                 //cout << *g->first << "\t" << g->second << endl;
                 popGenotypeCounts.push_back(g->second);
@@ -1471,10 +1969,10 @@ long double GenotypeCombo::hweProbGenotypeFrequencyln(Genotype* genotype) {
         }
     }
 
-    long double arrangementsOfAllelesInSample = multinomialCoefficientLn(popTotalAlleles, popAlleleCounts);
+    Probability arrangementsOfAllelesInSample = multinomialCoefficientLn(popTotalAlleles, popAlleleCounts);
     //cout << "arrangementsOfAllelesInSample = " << exp(arrangementsOfAllelesInSample) << endl;
 
-    long double arrangementsWithExactlyCountGenotypesGivenAF =
+    Probability arrangementsWithExactlyCountGenotypesGivenAF =
         multinomialCoefficientLn(genotype->ploidy, thisGenotypeAlleleCounts)
         + multinomialCoefficientLn(popTotalGenotypes, popGenotypeCounts);
     /*
@@ -1497,14 +1995,14 @@ long double GenotypeCombo::hweProbGenotypeFrequencyln(Genotype* genotype) {
 //
 void
 GenotypeCombo::calculatePosteriorProbability(
-        long double theta,
+        Probability theta,
         bool pooled,
         bool ewensPriors,
         bool permute,
         bool hwePriors,
         bool binomialObsPriors,
         bool alleleBalancePriors,
-        long double diffusionPriorScalar) {
+        Probability diffusionPriorScalar) {
 
     posteriorProb = 0;
     priorProb = 0;
@@ -1522,17 +2020,14 @@ GenotypeCombo::calculatePosteriorProbability(
 
     // XXX XXX hwe
     if (hwePriors) {
-        for (map<Genotype*, int>::iterator gc = genotypeCounts.begin(); gc != genotypeCounts.end(); ++gc) {
-            Genotype* genotype = gc->first;
-            priorProbGenotypesGivenHWE += hweProbGenotypeFrequencyln(genotype);
-        }
+        priorProbGenotypesGivenHWE = hweComboProb();
     }
 
     if (binomialObsPriors) {
         // for each alternate and the reference allele
         // calculate the binomial probability that we see the given strand balance and read placement prob
         //cerr << *this << endl;
-        for (map<string, AlleleCounter>::iterator ac = alleleCounters.begin(); ac != alleleCounters.end(); ++ac) {
+        for (FlatMap<string, AlleleCounter>::iterator ac = alleleCounters.begin(); ac != alleleCounters.end(); ++ac) {
             //const string& allele = ac->first;
             const AlleleCounter& alleleCounter = ac->second;
             int obs = alleleCounter.observations;
@@ -1579,7 +2074,10 @@ GenotypeCombo::calculatePosteriorProbability(
 
     // Ewens' Sampling Formula
     if (ewensPriors) {
-        priorProbAf = alleleFrequencyProbabilityln(countFrequencies(), theta);
+        // scratch space for the spectrum, which is looked up in the cache
+        thread_local vector<int> spectrum;
+        frequencySpectrum(spectrum);
+        priorProbAf = alleleFrequencyProbabilityln(spectrum, theta);
     }
 
     // posterior probability
@@ -1620,7 +2118,7 @@ pair<int, int> alternateAndReferenceCount(vector<Allele*>& observations, string&
 
 void genotypeCombo2Map(GenotypeCombo& gc, GenotypeComboMap& gcm) {
     for (GenotypeCombo::iterator g = gc.begin(); g != gc.end(); ++g) {
-        gcm[(*g)->name] = *g;;
+        gcm[*(*g)->name] = *g;;
     }
 }
 
@@ -1629,20 +2127,20 @@ void orderedGenotypeCombo(
     GenotypeCombo& combo,
     GenotypeCombo& orderedCombo,
     SampleDataLikelihoods& sampleDataLikelihoods,
-    long double theta,
+    Probability theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar) {
+    Probability diffusionPriorScalar) {
 
     GenotypeComboMap bestComboMap;
 
     genotypeCombo2Map(combo, bestComboMap);
     for (SampleDataLikelihoods::iterator sdl = sampleDataLikelihoods.begin(); sdl != sampleDataLikelihoods.end(); ++sdl) {
-        orderedCombo.push_back(bestComboMap[sdl->front().name]);
+        orderedCombo.push_back(bestComboMap[*sdl->front().name]);
     }
 
     orderedCombo.init(binomialObsPriors);
@@ -1731,14 +2229,14 @@ bool Genotype::sampleHasSupportingObservationsForAllAlleles(Sample& sample) {
 }
 
 
-map<int, vector<Genotype> > getGenotypesByPloidy(vector<int>& ploidies, vector<Allele>& genotypeAlleles) {
+map<int, vector<Genotype> > getGenotypesByPloidy(vector<int>& ploidies, vector<Allele>& genotypeAlleles, int grid) {
 
     map<int, vector<Genotype> > genotypesByPloidy;
 
     for (vector<int>::iterator p = ploidies.begin(); p != ploidies.end(); ++p) {
         int ploidy = *p;
         if (genotypesByPloidy.find(ploidy) == genotypesByPloidy.end()) {
-            genotypesByPloidy[ploidy] = allPossibleGenotypes(ploidy, genotypeAlleles);
+            genotypesByPloidy[ploidy] = allPossibleGenotypes(ploidy, genotypeAlleles, grid);
         }
     }
 
@@ -1774,9 +2272,25 @@ bool Genotype::hasNullAllele(void) {
 
 void GenotypeCombo::appendIndependentCombo(GenotypeCombo& other) {
 
-    for (map<string, AlleleCounter>::iterator c = other.alleleCounters.begin(); c != other.alleleCounters.end(); ++c) {
+    appendIndependentCounts(other);
+
+    for (GenotypeCombo::iterator s = begin(); s != end(); ++s) {
+        const SampleDataLikelihood& sdl = **s;
+        const Sample& sample = *sdl.sample;
+        ++genotypeCounts[sdl.genotype];
+    }
+
+    // add the other sample data likelihoods to this combo
+    reserve(size() + distance(other.begin(), other.end()));
+    insert(end(), other.begin(), other.end());
+
+}
+
+void GenotypeCombo::appendIndependentCounts(const GenotypeCombo& other) {
+
+    for (FlatMap<string, AlleleCounter>::const_iterator c = other.alleleCounters.begin(); c != other.alleleCounters.end(); ++c) {
         const string& allele = c->first;
-        AlleleCounter& otherCounter = c->second;
+        const AlleleCounter& otherCounter = c->second;
         AlleleCounter& thisCounter = alleleCounters[allele];
         thisCounter.frequency += otherCounter.frequency;
         thisCounter.observations += otherCounter.observations;
@@ -1788,12 +2302,6 @@ void GenotypeCombo::appendIndependentCombo(GenotypeCombo& other) {
         thisCounter.placedEnd += otherCounter.placedEnd;
     }
 
-    for (GenotypeCombo::iterator s = begin(); s != end(); ++s) {
-        const SampleDataLikelihood& sdl = **s;
-        const Sample& sample = *sdl.sample;
-        ++genotypeCounts[sdl.genotype];
-    }
-
     // permutations
     permutationsln += other.permutationsln;
 
@@ -1812,10 +2320,6 @@ void GenotypeCombo::appendIndependentCombo(GenotypeCombo& other) {
     priorProbObservations += other.priorProbObservations;
     priorProbGenotypesGivenHWE += other.priorProbGenotypesGivenHWE;
 
-    // add the other sample data likelihoods to this combo
-    reserve(size() + distance(other.begin(), other.end()));
-    insert(end(), other.begin(), other.end());
-
 }
 
 // all combos of each population are combined with the best combos of the other pops
@@ -1827,34 +2331,47 @@ void combinePopulationCombos(list<GenotypeCombo>& genotypeCombos, map<string, li
         genotypeCombos = genotypeCombosByPopulation.begin()->second;
     } else {
 
-        // for each sub-pop
-        for (map<string, list<GenotypeCombo> >::iterator p = genotypeCombosByPopulation.begin(); p != genotypeCombosByPopulation.end(); ++p) {
+        // the best combos of the populations, and the counts and
+        // probabilities of those before and after each, so that those of the
+        // other populations of each are two appends rather than one for every
+        // other population
+        vector<GenotypeCombo*> best;
+        for (map<string, list<GenotypeCombo> >::iterator o = genotypeCombosByPopulation.begin(); o != genotypeCombosByPopulation.end(); ++o) {
+            best.push_back(&o->second.front());
+        }
+        size_t populations = best.size();
+        vector<GenotypeCombo> bestBefore(populations + 1);
+        vector<GenotypeCombo> bestAfter(populations + 1);
+        size_t samples = 0;
+        for (size_t i = 0; i < populations; ++i) {
+            bestBefore[i + 1].copyCounts(bestBefore[i]);
+            bestBefore[i + 1].appendIndependentCounts(*best[i]);
+            samples += best[i]->size();
+        }
+        for (size_t i = populations; i > 0; --i) {
+            bestAfter[i - 1].copyCounts(bestAfter[i]);
+            bestAfter[i - 1].appendIndependentCounts(*best[i - 1]);
+        }
 
-            const string& population = p->first;
+        // each combo of a population is extended with the best combos of the
+        // others, whose genotype counts nothing reads once the search is done
+        size_t i = 0;
+        for (map<string, list<GenotypeCombo> >::iterator p = genotypeCombosByPopulation.begin(); p != genotypeCombosByPopulation.end(); ++p, ++i) {
+            GenotypeCombo otherPopulationsBest;
+            otherPopulationsBest.copyCounts(bestBefore[i]);
+            otherPopulationsBest.appendIndependentCounts(bestAfter[i + 1]);
             list<GenotypeCombo>& populationGenotypeCombos = p->second;
-
-            GenotypeCombo otherPopulationsBestCombo;
-
-            // run through all the other combos to generate a best combo for the
-            // other populations, and accumulate homozygous combos, keyed by allele
-            for (map<string, list<GenotypeCombo> >::iterator o = genotypeCombosByPopulation.begin(); o != genotypeCombosByPopulation.end(); ++o) {
-                if (o->first != p->first) { // if the genotype list is for a different population
-                    GenotypeCombo& bestCombo = o->second.front(); // this is the "best" combo from the other population
-                    // add the best combo from this population to the best combos from the other populations
-                    if (otherPopulationsBestCombo.empty()) {
-                        otherPopulationsBestCombo = bestCombo;
-                    } else {
-                        otherPopulationsBestCombo.appendIndependentCombo(bestCombo);
-                    }
-                }
-            }
-
-            // append the best "other population" combo to all the combos in this set
             for (list<GenotypeCombo>::iterator g = populationGenotypeCombos.begin(); g != populationGenotypeCombos.end(); ++g) {
                 genotypeCombos.push_back(*g);
-                genotypeCombos.back().appendIndependentCombo(otherPopulationsBestCombo);
+                GenotypeCombo& combo = genotypeCombos.back();
+                combo.appendIndependentCounts(otherPopulationsBest);
+                combo.reserve(combo.size() + samples - best[i]->size());
+                for (size_t o = 0; o < populations; ++o) {
+                    if (o != i) {
+                        combo.insert(combo.end(), best[o]->begin(), best[o]->end());
+                    }
+                }
             }
-
         }
 
         map<Allele, GenotypeCombo> otherPopulationsHomozygousCombos;
@@ -1892,3 +2409,27 @@ void combinePopulationCombos(list<GenotypeCombo>& genotypeCombos, map<string, li
     }
 
 }
+
+Probability combinedEvictedPosterior(map<string, list<GenotypeCombo> >& genotypeCombosByPopulation,
+                                     map<string, Probability>& lnEvictedByPopulation) {
+
+    Probability lnEvicted = -INFINITY;
+
+    for (map<string, Probability>::iterator e = lnEvictedByPopulation.begin(); e != lnEvictedByPopulation.end(); ++e) {
+        if (e->second == -INFINITY) {
+            continue;
+        }
+        // each evicted combo would have been combined with the best combos
+        // of the other populations
+        Probability otherPopulationsBest = 0;
+        for (map<string, list<GenotypeCombo> >::iterator o = genotypeCombosByPopulation.begin(); o != genotypeCombosByPopulation.end(); ++o) {
+            if (o->first != e->first && !o->second.empty()) {
+                otherPopulationsBest += o->second.front().posteriorProb;
+            }
+        }
+        lnEvicted = logaddexp(lnEvicted, e->second + otherPopulationsBest);
+    }
+
+    return lnEvicted;
+
+}
@@ -12,6 +12,7 @@
 #include <cmath>
 #include <numeric>
 #include <assert.h>
+#include <stdint.h>
 #include "Allele.h"
 #include "Sample.h"
 #include "Utility.h"
@@ -21,6 +22,9 @@
 #include "Bias.h"
 #include "join.h"
 #include "convert.h"
+#include "WorkerTeam.h"
+#include "FlatMap.h"
+#include "AllocationProfile.h"
 
 using namespace std;
 
@@ -38,6 +42,23 @@ public:
 };
 
 
+// the shape of a genotype: how many copies it has of each of a site's
+// alleles, by index.  this depends only on the ploidy and the number of
+// alleles, so it's computed once and bound to the alleles of each site.
+class GenotypeTemplate {
+public:
+    vector<pair<int, int> > dosages; // (allele index, count), by allele index
+    Probability permutationsln;
+    GenotypeTemplate(void) : permutationsln(0) { }
+};
+
+// every genotype of the ploidy over the number of alleles, in the order of
+// multichoose over the alleles.  given a grid smaller than the ploidy, only
+// the genotypes whose allele frequencies fall on grid + 1 evenly spaced points
+// from 0 to 1 (rounded to whole copies), whose number grows with the grid
+// rather than the ploidy.
+const vector<GenotypeTemplate>& genotypeTemplates(int ploidy, int alleleCount, int grid = 0);
+
 class Genotype : public vector<GenotypeElement> {
 
     friend ostream& operator<<(ostream& out, const pair<Allele, int>& rhs);
@@ -50,7 +71,14 @@ public:
     vector<Allele> alleles;
     map<string, int> alleleCounts;
     bool homozygous;
-    long double permutationsln;  // aka, multinomialCoefficientLn(ploidy, counts())
+    Probability permutationsln;  // aka, multinomialCoefficientLn(ploidy, counts())
+    // the compact form, over the alleles of the site the genotype was made
+    // for (see GenotypeTemplate); empty for genotypes made from alleles
+    vector<pair<int, int> > indexedCounts; // (allele index, count), by allele index
+    vector<int> dosages;                   // the count of each of the site's alleles
+    // the logs of alleleProbabilities() without bias, by element, for the
+    // multinomial over the observations of the genotype's alleles
+    vector<Probability> lnAlleleProbabilities;
 
     Genotype(vector<Allele>& ungroupedAlleles) {
         alleles = ungroupedAlleles;
@@ -67,9 +95,19 @@ public:
         if (!homozygous) {
             permutationsln = multinomialCoefficientLn(ploidy, counts());
         }
+        setLnAlleleProbabilities();
 
     }
 
+    // the genotype a template describes over the site's alleles
+    Genotype(const GenotypeTemplate& shape, vector<Allele>& siteAlleles);
+
+    // true if the genotype has the compact form, so can be queried by the
+    // index of an allele in the site's alleles
+    bool indexed(void) const { return !dosages.empty(); }
+    int dosage(int alleleIndex) const { return dosages[alleleIndex]; }
+
+    void setLnAlleleProbabilities(void);
     vector<Allele*> uniqueAlleles(void);
     int getPloidy(void);
     int alleleCount(const string& base);
@@ -82,8 +120,8 @@ public:
     vector<string> alternateBases(string& refbase);
     vector<int> counts(void);
     // the probability of drawing each allele out of the genotype, ordered by allele
-    vector<long double> alleleProbabilities(void);
-    vector<long double> alleleProbabilities(Bias& observationBias);
+    vector<Probability> alleleProbabilities(void);
+    vector<Probability> alleleProbabilities(Bias& observationBias);
     double alleleSamplingProb(const string& base);
     double alleleSamplingProb(Allele& allele);
     string str(void) const;
@@ -109,19 +147,22 @@ public:
 string IUPAC(Genotype& g);
 string IUPAC2GenotypeStr(string iupac);
 
-vector<Genotype> allPossibleGenotypes(int ploidy, vector<Allele>& potentialAlleles);
+vector<Genotype> allPossibleGenotypes(int ploidy, vector<Allele>& potentialAlleles, int grid = 0);
 
+// the likelihood of a genotype of a sample.  these are copied about between
+// the views of a site, so they hold only pointers: the name is that of the
+// run's sample list, which outlives every site.
 class SampleDataLikelihood {
 public:
-    string name;
+    const string* name;
     Genotype* genotype;
-    long double prob;
-    long double marginal;
+    Probability prob;
+    Probability marginal;
     Sample* sample;
     bool hasObservations;
     int rank; // the rank of this data likelihood relative to others for the sample, 0 is best
-    SampleDataLikelihood(string n, Sample* s, Genotype* g, long double p, int r)
-        : name(n)
+    SampleDataLikelihood(const string& n, Sample* s, Genotype* g, Probability p, int r)
+        : name(&n)
         , sample(s)
         , genotype(g)
         , prob(p)
@@ -168,9 +209,9 @@ public:
     // GenotypeCombo::prob is equal to the sum of probs in the combo.  We
     // factor it out so that we can construct the probabilities efficiently as
     // we generate the genotype combinations
-    long double probObsGivenGenotypes;  // aka data likelihood
+    Probability probObsGivenGenotypes;  // aka data likelihood
 
-    long double permutationsln;  // the number of perutations of unphased genotypes in the combo
+    Probability permutationsln;  // the number of perutations of unphased genotypes in the combo
 
     // these *must* be generated at construction time
     // for efficiency they can be updated as each genotype combo is generated
@@ -178,8 +219,8 @@ public:
     //map<string, pair<int, int> > alleleStrandCounts; // map from allele spec to (forword, reverse) counts
     //map<string, pair<int, int> > alleleReadPlacementCounts; // map from allele spec to (left, right) counts
     //map<string, pair<int, int> > alleleReadPositionCounts; // map from allele spec to (left, right) counts
-    map<string, AlleleCounter> alleleCounters;
-    map<Genotype*, int> genotypeCounts;
+    FlatMap<string, AlleleCounter> alleleCounters;
+    FlatMap<Genotype*, int> genotypeCounts;
 
     GenotypeCombo(void)
         : probObsGivenGenotypes(0)
@@ -188,28 +229,35 @@ public:
         , priorProbG_Af(0)
         , priorProbAf(0)
         , priorProbObservations(0)
+        , priorProbGenotypesGivenHWE(0)
         , permutationsln(0)
     { }
 
     void init(bool useObsExpectations);
     void addPriorAlleleCounts(map<string, int>& priorACs);
+    // copies everything but the genotypes themselves: the cached counts and
+    // the probabilities, which is all that scoring a combo needs
+    void copyCounts(const GenotypeCombo& other);
 
     // appends the other combo to this one,
     // updates the counts, and multiplies the probabilites,
     // assuming independence between the two combos
     void appendIndependentCombo(GenotypeCombo& other);
+    // the same for the counts and the probabilities, leaving the genotypes
+    void appendIndependentCounts(const GenotypeCombo& other);
 
     int numberOfAlleles(void);
-    vector<long double> alleleProbs(void);  // scales counts() by the total number of alleles
+    vector<Probability> alleleProbs(void);  // scales counts() by the total number of alleles
     int ploidy(void); // the number of copies of the locus in this combination
     int alleleCount(Allele& allele);
     int alleleCount(const string& allele);
-    long double alleleFrequency(Allele& allele);
-    long double alleleFrequency(const string& allele);
-    long double genotypeFrequency(Genotype* genotype);
+    Probability alleleFrequency(Allele& allele);
+    Probability alleleFrequency(const string& allele);
+    Probability genotypeFrequency(Genotype* genotype);
     void updateCachedCounts(Sample* sample, Genotype* oldGenotype, Genotype* newGenotype, bool useObsExpectations);
     map<string, int> countAlleles(void);
     map<int, int> countFrequencies(void);
+    void frequencySpectrum(vector<int>& spectrum); // the allele frequencies, in ascending order
     int hetCount(void);
     vector<int> counts(void); // the counts of frequencies of the alleles in the genotype combo
     vector<int> observationCounts(void); // the counts of observations of the alleles (in sorted order)
@@ -220,32 +268,35 @@ public:
 
     // posterior
 
-    long double posteriorProb; // p(genotype combo) * p(observations | genotype combo)
+    Probability posteriorProb; // p(genotype combo) * p(observations | genotype combo)
 
     // priors
 
-    long double priorProb; // p(genotype combo) = p(genotype combo | allele frequency) * p(allele frequency) * p(observations)
-    long double priorProbG_Af; // p(genotype combo | allele frequency)
-    long double priorProbAf; // p(allele frequency)
-    long double priorProbObservations; // p(observations)
-    long double priorProbGenotypesGivenHWE;
+    Probability priorProb; // p(genotype combo) = p(genotype combo | allele frequency) * p(allele frequency) * p(observations)
+    Probability priorProbG_Af; // p(genotype combo | allele frequency)
+    Probability priorProbAf; // p(allele frequency)
+    Probability priorProbObservations; // p(observations)
+    Probability priorProbGenotypesGivenHWE;
+#ifdef ALLOC_PROFILE
+    LiveCount<LIVE_GENOTYPE_COMBOS> liveCount;
+#endif
 
     //GenotypeCombo* combo,
     void calculatePosteriorProbability(
-        long double theta,
+        Probability theta,
         bool pooled,
         bool ewensPriors,
         bool permute,
         bool hwePriors,
         bool obsBinomialPriors,
         bool alleleBalancePriors,
-        long double diffusionPriorScalarln);
+        Probability diffusionPriorScalarln);
 
-    long double probabilityGivenAlleleFrequencyln(bool permute);
+    Probability probabilityGivenAlleleFrequencyln(bool permute);
 
-    long double hweExpectedFrequencyln(Genotype* genotype);
-    long double hweProbGenotypeFrequencyln(Genotype* genotype);
-    long double hweComboProb(void);
+    Probability hweExpectedFrequencyln(Genotype* genotype);
+    Probability hweProbGenotypeFrequencyln(Genotype* genotype);
+    Probability hweComboProb(void);
 
 };
 
@@ -307,6 +358,95 @@ struct SampleMarginalAndObsCompare {
 // a set of probabilities for a set of genotypes for a set of samples
 typedef vector<vector<SampleDataLikelihood> > SampleDataLikelihoods;
 
+// local combo search splits its samples between the members of a team only
+// when each member has at least this many to score
+#define MIN_SAMPLES_PER_GENOTYPING_THREAD 32
+
+// the genotypes in which a combo differs from the king, as (sample offset,
+// new genotype) pairs
+typedef vector<pair<size_t, SampleDataLikelihood*> > ComboMoves;
+
+// the most probable of the combos it's offered, up to a fixed number
+//
+// a combo is held as the counts of the trial which scored it and the moves
+// which make it from the king, in a slot of a contiguous arena, so it is only
+// built in full if it's kept to the end.  once full, the heap holds its worst
+// combo at the front, and the slot of an evicted combo is reused for the one
+// which replaces it.  the posterior mass of the combos turned away is summed,
+// so that posteriors can still be normalised over everything we scored.
+// homozygous combos are never evicted, as they would be added back after the
+// search anyway.
+//
+// ties in posterior are broken by the order key offered with each combo,
+// which is the order in which a serial search would score them, so the
+// combos kept don't depend on how the search was divided between threads.
+class GenotypeComboHeap {
+public:
+    typedef pair<size_t, size_t> Order;
+
+    Probability lnEvicted; // log of the summed posteriors of the evicted combos
+
+    GenotypeComboHeap(void) : lnEvicted(-INFINITY), capacity(0), used(0) { }
+
+    // empties the heap, which will then keep up to maxCombos combos, or all
+    // of them if maxCombos is 0
+    void reset(size_t maxCombos);
+    bool empty(void) const { return used == 0; }
+    void offer(GenotypeCombo& scored, const ComboMoves& moves, Order order);
+    // offers every combo held by the other heap, and adds its evicted mass
+    void merge(GenotypeComboHeap& other);
+    // appends the kept combos to the list, best first
+    void build(list<GenotypeCombo>& combos, GenotypeCombo& comboKing);
+
+private:
+    class Slot {
+    public:
+        GenotypeCombo counts;
+        ComboMoves moves;
+        Order order;
+    };
+
+    // true if the slot's combo is more probable than the other's
+    bool precedes(size_t a, size_t b);
+    size_t store(GenotypeCombo& scored, const ComboMoves& moves, Order order);
+
+    size_t capacity;
+    vector<Slot> arena;
+    size_t used;            // slots of the arena holding combos
+    vector<size_t> heap;    // slots of the combos which may be evicted, worst first
+    vector<size_t> pinned;  // slots of homozygous combos, when bounded
+
+};
+
+// the moves of a local combo search over a range of its samples, as scored
+// by one member of a team
+class LocalComboMoves {
+public:
+    GenotypeCombo trial;       // scratch counts for the move being scored
+    GenotypeCombo bestCounts;  // the counts of the best move, if there is one
+    SampleDataLikelihood* bestMove;
+    size_t bestOffset;
+    Probability bestPosterior;
+    GenotypeComboHeap kept;    // the moves kept, if keeping combos
+
+    LocalComboMoves(void) : bestMove(NULL), bestOffset(0), bestPosterior(0) { }
+
+    void score(
+        GenotypeCombo& comboKing,
+        SampleDataLikelihoods& sampleDataLikelihoods,
+        size_t first, size_t last,
+        Probability kingPosterior,
+        Probability theta,
+        bool pooled,
+        bool ewensPriors,
+        bool permute,
+        bool hwePriors,
+        bool binomialObsPriors,
+        bool alleleBalancePriors,
+        Probability diffusionPriorScalar,
+        bool keepCombos);
+};
+
 void sortSampleDataLikelihoods(vector<SampleDataLikelihood>& likelihoods);
 bool sortSampleDataLikelihoodsByMarginals(vector<SampleDataLikelihood>& likelihoods);
 bool sortSampleDataLikelihoodsByMarginals(SampleDataLikelihoods& samplesLikelihoods);
@@ -323,14 +463,14 @@ orderedGenotypeCombo(
     GenotypeCombo& combo,
     GenotypeCombo& orderedCombo,
     SampleDataLikelihoods& sampleDataLikelihoods,
-    long double theta,
+    Probability theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar);
+    Probability diffusionPriorScalar);
 
 void
 makeComboByDatalLikelihoodRank(
@@ -339,27 +479,27 @@ makeComboByDatalLikelihoodRank(
     SampleDataLikelihoods& variantSampleDataLikelihoods,
     SampleDataLikelihoods& invariantSampleDataLikelihoods,
     map<string, int>& priorACs,
-    long double theta,
+    Probability theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar);
+    Probability diffusionPriorScalar);
 
 void
 dataLikelihoodMaxGenotypeCombo(
     GenotypeCombo& combo,
     SampleDataLikelihoods& sampleDataLikelihoods,
-    long double theta,
+    Probability theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar);
+    Probability diffusionPriorScalar);
 
 bool
 bandedGenotypeCombinations(
@@ -370,14 +510,17 @@ bandedGenotypeCombinations(
     Samples& samples,
     map<string, int>& priorACs,
     int bandwidth, int banddepth,
-    long double theta,
+    Probability theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar);
+    Probability diffusionPriorScalar,
+    bool keepCombos,
+    size_t maxCombos = 0,
+    Probability* lnEvicted = NULL);
 
 void
 allLocalGenotypeCombinations(
@@ -386,15 +529,22 @@ allLocalGenotypeCombinations(
     SampleDataLikelihoods& sampleDataLikelihoods,
     Samples& samples,
     map<string, int>& priorACs,
-    long double theta,
+    Probability theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar,
-    bool keepCombos);
+    Probability diffusionPriorScalar,
+    bool keepCombos,
+    WorkerTeam* team = NULL,
+    size_t maxCombos = 0,              // if keeping combos, how many beyond the king; 0 keeps all
+    Probability* lnEvicted = NULL,     // summed with the posterior mass of any we don't keep
+    // if given when keeping combos, and a neighbour beats the king, the combos
+    // aren't built, and the best neighbour (as found without keeping combos)
+    // is put here instead
+    GenotypeCombo* bestNeighbour = NULL);
 
 void
 convergentGenotypeComboSearch(
@@ -407,17 +557,35 @@ convergentGenotypeComboSearch(
     vector<Allele>& genotypeAlleles,
     map<string, int>& priorACs,
     int bandwidth, int banddepth,
-    long double theta,
+    Probability theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar,
+    Probability diffusionPriorScalar,
     int maxiterations,
     int& totaliterations,
-    bool addHomozygousCombos);
+    bool addHomozygousCombos,
+    WorkerTeam* team = NULL,
+    size_t maxCombos = 0,
+    Probability* lnEvictedPosterior = NULL,  // set to the posterior mass of the combos not kept
+    // keep the combos of each pass of a local search, so that we finish as
+    // soon as the king holds rather than scoring its neighbours again; cheap
+    // where samples have few genotypes, e.g. at biallelic diploid sites
+    bool keepEveryPass = false,
+    // if given, the time on wallClockNanoseconds past which the search stops
+    // iterating, and keeps the combos of its last pass
+    uint64_t deadline = 0,
+    // if positive, the search also stops once a pass improves the log
+    // posterior of the best combo by less than this.  a local search then
+    // keeps the combos of a pass as keepEveryPass does, and a banded one
+    // keeps those of every pass, so the last needn't be scored again
+    Probability tolerance = 0,
+    // if given, set to whether the deadline stopped the search before it
+    // converged
+    bool* stoppedByDeadline = NULL);
 
 void
 addAllHomozygousCombos(
@@ -427,14 +595,14 @@ addAllHomozygousCombos(
     SampleDataLikelihoods& invariantSampleDataLikelihoods,
     Samples& samples,
     vector<Allele>& genotypeAlleles,
-    long double theta,
+    Probability theta,
     bool pooled,
     bool ewensPriors,
     bool permute,
     bool hwePriors,
     bool binomialObsPriors,
     bool alleleBalancePriors,
-    long double diffusionPriorScalar);
+    Probability diffusionPriorScalar);
 
 
 vector<pair<Allele, int> > alternateAlleles(GenotypeCombo& combo, string referenceBase);
@@ -444,9 +612,16 @@ pair<int, int> alternateAndReferenceCount(vector<Allele*>& observations, string&
 ostream& operator<<(ostream& out, list<GenotypeCombo>& combo);
 ostream& operator<<(ostream& out, GenotypeCombo& g);
 
-map<int, vector<Genotype> > getGenotypesByPloidy(vector<int>& ploidies, vector<Allele>& genotypeAlleles);
+// with a grid, as genotypeTemplates, for the ploidies above it
+map<int, vector<Genotype> > getGenotypesByPloidy(vector<int>& ploidies, vector<Allele>& genotypeAlleles, int grid = 0);
 
 void combinePopulationCombos(list<GenotypeCombo>& genotypeCombos,
                              map<string, list<GenotypeCombo> >& genotypeCombosByPopulation);
 
+// the posterior mass of the combos each population's search didn't keep, once
+// they are combined with the best combos of the other populations, as in
+// combinePopulationCombos
+Probability combinedEvictedPosterior(map<string, list<GenotypeCombo> >& genotypeCombosByPopulation,
+                                     map<string, Probability>& lnEvictedByPopulation);
+
 #endif
@@ -0,0 +1,65 @@
+#include "HaplotypeBasisAlleles.h"
+#include <algorithm>
+#include <functional>
+
+uint64_t HaplotypeBasisAlleles::key(const string& ref, const string& alt) {
+    hash<string> h;
+    uint64_t k = h(ref);
+    return k ^ (h(alt) + 0x9e3779b97f4a7c15ULL + (k << 6) + (k >> 2));
+}
+
+void HaplotypeBasisAlleles::add(long int position, const string& ref, const string& alt) {
+    entries.push_back(Entry());
+    Entry& e = entries.back();
+    e.position = position;
+    e.key = key(ref, alt);
+    e.ref = ref;
+    e.alt = alt;
+}
+
+// the window is filled in order of position, window by window, so the added
+// entries are mostly after those already there
+void HaplotypeBasisAlleles::sortAdded(void) {
+    if (sorted == entries.size()) {
+        return;
+    }
+    vector<Entry>::iterator middle = entries.begin() + sorted;
+    stable_sort(middle, entries.end());
+    if (sorted > first && (middle - 1)->position > middle->position) {
+        inplace_merge(entries.begin() + first, middle, entries.end());
+    }
+    sorted = entries.size();
+}
+
+bool HaplotypeBasisAlleles::contains(long int position, const string& ref, const string& alt) {
+    sortAdded();
+    Entry probe;
+    probe.position = position;
+    vector<Entry>::iterator e = lower_bound(entries.begin() + first, entries.end(), probe);
+    uint64_t k = key(ref, alt);
+    for ( ; e != entries.end() && e->position == position; ++e) {
+        if (e->key == k && e->ref == ref && e->alt == alt) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void HaplotypeBasisAlleles::eraseBefore(long int position) {
+    sortAdded();
+    while (first < entries.size() && entries[first].position < position) {
+        ++first;
+    }
+    // the dropped entries are let go once they are most of the array
+    if (first > 0 && first * 2 >= entries.size()) {
+        entries.erase(entries.begin(), entries.begin() + first);
+        sorted -= first;
+        first = 0;
+    }
+}
+
+void HaplotypeBasisAlleles::clear(void) {
+    entries.clear();
+    first = 0;
+    sorted = 0;
+}
@@ -0,0 +1,55 @@
+#ifndef FREEBAYES_HAPLOTYPEBASISALLELES_H
+#define FREEBAYES_HAPLOTYPEBASISALLELES_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+// the window of --haplotype-basis-alleles over the current reference
+// sequence, for allowedHaplotypeBasisAllele
+//
+// every candidate allele of every read is looked up here, so rather than a
+// map of positions to lists of primitives, the primitives are kept in one
+// array sorted by position, each with a hash of its ref and alt, and the
+// strings are only compared where the hashes agree.  the window is filled
+// ahead of the reads as they are registered and dropped behind the current
+// position as it moves on, which only moves the start of the array, so the
+// lookups binary search what lies between the two.
+class HaplotypeBasisAlleles {
+
+public:
+
+    HaplotypeBasisAlleles(void) : first(0), sorted(0) { }
+
+    // adds a primitive at the 1-based position, in any order; the
+    // primitives added are sorted into the window by the next lookup
+    void add(long int position, const string& ref, const string& alt);
+    // true if the primitive is in the window
+    bool contains(long int position, const string& ref, const string& alt);
+    // drops the primitives before the position
+    void eraseBefore(long int position);
+    void clear(void);
+
+private:
+
+    class Entry {
+    public:
+        long int position;
+        uint64_t key; // of ref and alt
+        string ref;
+        string alt;
+        bool operator<(const Entry& other) const { return position < other.position; }
+    };
+
+    static uint64_t key(const string& ref, const string& alt);
+    void sortAdded(void);
+
+    vector<Entry> entries; // those before first have been dropped
+    size_t first;
+    size_t sorted; // the entries added since are yet to be sorted in
+
+};
+
+#endif
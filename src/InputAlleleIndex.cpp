@@ -0,0 +1,245 @@
+#include "InputAlleleIndex.h"
+#include "Utility.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <limits>
+
+static const char INPUT_ALLELE_INDEX_MAGIC[8] = { 'F', 'B', 'A', 'L', 'L', 'I', 'X', '1' };
+
+bool InputAlleleIndexWriter::open(const string& filename) {
+    if (!(file = fopen(filename.c_str(), "wb"))) {
+        return false;
+    }
+    // the offset of the table is filled in by close
+    uint64_t tableOffset = 0;
+    fwrite(INPUT_ALLELE_INDEX_MAGIC, 1, sizeof(INPUT_ALLELE_INDEX_MAGIC), file);
+    fwrite(&tableOffset, sizeof(tableOffset), 1, file);
+    offset = sizeof(INPUT_ALLELE_INDEX_MAGIC) + sizeof(tableOffset);
+    currentSequence.clear();
+    pending.clear();
+    sequences.clear();
+    return true;
+}
+
+void InputAlleleIndexWriter::add(const string& sequence, long int recordPosition, const InputPrimitive& primitive) {
+    if (sequences.empty() || sequence != currentSequence) {
+        flush(numeric_limits<long int>::max());
+        currentSequence = sequence;
+        sequences.push_back(make_pair(sequence, vector<Block>()));
+    }
+    // nothing to come can precede this record
+    flush(recordPosition);
+    pending.insert(make_pair(primitive.position, primitive));
+}
+
+void InputAlleleIndexWriter::flush(long int before) {
+    multimap<long int, InputPrimitive>::iterator p = pending.begin();
+    for ( ; p != pending.end() && p->first < before; ++p) {
+        write(p->second);
+    }
+    pending.erase(pending.begin(), p);
+}
+
+void InputAlleleIndexWriter::write(const InputPrimitive& primitive) {
+    vector<Block>& blocks = sequences.back().second;
+    if (blocks.empty() || blocks.back().count == INPUT_ALLELE_INDEX_BLOCK_SIZE) {
+        Block block;
+        block.first = primitive.position;
+        block.offset = offset;
+        block.count = 0;
+        blocks.push_back(block);
+    }
+    int64_t position = primitive.position;
+    uint32_t refLength = primitive.ref.size();
+    uint32_t altLength = primitive.alt.size();
+    fwrite(&position, sizeof(position), 1, file);
+    fwrite(&refLength, sizeof(refLength), 1, file);
+    fwrite(&altLength, sizeof(altLength), 1, file);
+    fwrite(primitive.ref.data(), 1, refLength, file);
+    fwrite(primitive.alt.data(), 1, altLength, file);
+    offset += sizeof(position) + sizeof(refLength) + sizeof(altLength) + refLength + altLength;
+    ++blocks.back().count;
+}
+
+void InputAlleleIndexWriter::close(void) {
+    if (!file) {
+        return;
+    }
+    if (!sequences.empty()) {
+        flush(numeric_limits<long int>::max());
+    }
+    uint64_t tableOffset = offset;
+    uint32_t sequenceCount = sequences.size();
+    fwrite(&sequenceCount, sizeof(sequenceCount), 1, file);
+    for (vector<pair<string, vector<Block> > >::iterator s = sequences.begin(); s != sequences.end(); ++s) {
+        uint32_t nameLength = s->first.size();
+        uint64_t blockCount = s->second.size();
+        fwrite(&nameLength, sizeof(nameLength), 1, file);
+        fwrite(s->first.data(), 1, nameLength, file);
+        fwrite(&blockCount, sizeof(blockCount), 1, file);
+        for (vector<Block>::iterator b = s->second.begin(); b != s->second.end(); ++b) {
+            int64_t first = b->first;
+            fwrite(&first, sizeof(first), 1, file);
+            fwrite(&b->offset, sizeof(b->offset), 1, file);
+            fwrite(&b->count, sizeof(b->count), 1, file);
+        }
+    }
+    fseek(file, sizeof(INPUT_ALLELE_INDEX_MAGIC), SEEK_SET);
+    fwrite(&tableOffset, sizeof(tableOffset), 1, file);
+    fclose(file);
+    file = NULL;
+}
+
+bool InputAlleleIndex::blockStartsBefore(const Block& block, long int position) {
+    return block.first < position;
+}
+
+InputAlleleIndex::~InputAlleleIndex(void) {
+    if (data) {
+        munmap((void*) data, dataSize);
+    }
+}
+
+bool InputAlleleIndex::isIndex(const string& filename) {
+    char magic[sizeof(INPUT_ALLELE_INDEX_MAGIC)];
+    FILE* f = fopen(filename.c_str(), "rb");
+    if (!f) {
+        return false;
+    }
+    size_t n = fread(magic, 1, sizeof(magic), f);
+    fclose(f);
+    return n == sizeof(magic) && memcmp(magic, INPUT_ALLELE_INDEX_MAGIC, sizeof(magic)) == 0;
+}
+
+bool InputAlleleIndex::open(const string& filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) (sizeof(INPUT_ALLELE_INDEX_MAGIC) + sizeof(uint64_t))) {
+        ::close(fd);
+        return false;
+    }
+    void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    data = (const char*) mapped;
+    dataSize = st.st_size;
+
+    if (memcmp(data, INPUT_ALLELE_INDEX_MAGIC, sizeof(INPUT_ALLELE_INDEX_MAGIC)) != 0) {
+        return false;
+    }
+    const char* p = data + sizeof(INPUT_ALLELE_INDEX_MAGIC);
+    uint64_t tableOffset = readValue<uint64_t>(p);
+    if (tableOffset + sizeof(uint32_t) > dataSize) {
+        return false;
+    }
+    p = data + tableOffset;
+    uint32_t sequenceCount = readValue<uint32_t>(p);
+    for (uint32_t i = 0; i < sequenceCount; ++i) {
+        uint32_t nameLength = readValue<uint32_t>(p);
+        string name(p, nameLength);
+        p += nameLength;
+        uint64_t blockCount = readValue<uint64_t>(p);
+        sequenceIndexes[name] = names.size();
+        names.push_back(name);
+        blocks.push_back(vector<Block>());
+        vector<Block>& sequenceBlocks = blocks.back();
+        for (uint64_t j = 0; j < blockCount; ++j) {
+            Block block;
+            block.first = readValue<int64_t>(p);
+            block.offset = readValue<uint64_t>(p);
+            block.count = readValue<uint32_t>(p);
+            sequenceBlocks.push_back(block);
+        }
+    }
+    return true;
+}
+
+void InputAlleleIndex::seek(Cursor& cursor) const {
+    cursor = Cursor();
+}
+
+void InputAlleleIndex::seek(Cursor& cursor, const string& sequence, long int start, long int end) const {
+    cursor = Cursor();
+    cursor.start = start;
+    cursor.end = end;
+    cursor.bounded = true;
+    map<string, size_t>::const_iterator s = sequenceIndexes.find(sequence);
+    if (s == sequenceIndexes.end()) {
+        cursor.sequence = names.size();
+        return;
+    }
+    cursor.sequence = s->second;
+    // the block before the first one starting at or after start may hold
+    // primitives from start on
+    const vector<Block>& sequenceBlocks = blocks[cursor.sequence];
+    vector<Block>::const_iterator b = lower_bound(sequenceBlocks.begin(), sequenceBlocks.end(), start, blockStartsBefore);
+    if (b != sequenceBlocks.begin()) {
+        --b;
+    }
+    cursor.block = b - sequenceBlocks.begin();
+}
+
+bool InputAlleleIndex::next(Cursor& cursor, string& sequence, InputPrimitive& primitive) const {
+    while (cursor.sequence < names.size()) {
+        const vector<Block>& sequenceBlocks = blocks[cursor.sequence];
+        if (cursor.block == sequenceBlocks.size()) {
+            if (cursor.bounded) {
+                break;
+            }
+            ++cursor.sequence;
+            cursor.block = 0;
+            cursor.record = 0;
+            cursor.p = NULL;
+            continue;
+        }
+        const Block& block = sequenceBlocks[cursor.block];
+        if (cursor.record == block.count) {
+            ++cursor.block;
+            cursor.record = 0;
+            cursor.p = NULL;
+            continue;
+        }
+        if (!cursor.p) {
+            cursor.p = data + block.offset;
+        }
+        long int position = readValue<int64_t>(cursor.p);
+        uint32_t refLength = readValue<uint32_t>(cursor.p);
+        uint32_t altLength = readValue<uint32_t>(cursor.p);
+        const char* bases = cursor.p;
+        cursor.p += refLength + altLength;
+        ++cursor.record;
+        if (cursor.bounded && position >= cursor.end) {
+            break;
+        }
+        if (position < cursor.start) {
+            continue;
+        }
+        sequence = names[cursor.sequence];
+        primitive.position = position;
+        primitive.ref.assign(bases, refLength);
+        primitive.alt.assign(bases + refLength, altLength);
+        return true;
+    }
+    // stay at the end
+    cursor.sequence = names.size();
+    return false;
+}
+
+void InputAlleleIndex::fetch(const string& sequence, long int start, long int end, vector<InputPrimitive>& primitives) const {
+    Cursor cursor;
+    seek(cursor, sequence, start, end);
+    string name;
+    InputPrimitive primitive;
+    while (next(cursor, name, primitive)) {
+        primitives.push_back(primitive);
+    }
+}
@@ -0,0 +1,144 @@
+#ifndef FREEBAYES_INPUTALLELEINDEX_H
+#define FREEBAYES_INPUTALLELEINDEX_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+
+// the number of primitives in each block of the index
+#define INPUT_ALLELE_INDEX_BLOCK_SIZE 4096
+
+using namespace std;
+
+// an allelic primitive of an input VCF record, as decomposed by
+// vcflib::Variant::parsedAlternates.  position is 1-based, as in the VCF.
+class InputPrimitive {
+public:
+    long int position;
+    string ref;
+    string alt;
+    InputPrimitive(void) : position(0) { }
+    InputPrimitive(long int p, const string& r, const string& a)
+        : position(p)
+        , ref(r)
+        , alt(a) { }
+};
+
+// a compiled index of the non-reference primitives of a VCF, for use with
+// --haplotype-basis-alleles and --variant-input, so that the alignment of
+// REF against each ALT is done once (by indexalleles) rather than on every run
+//
+// the file is a header, then blocks of primitives sorted by position, then a
+// table of the blocks of each sequence:
+//
+//   header   "FBALLIX1", uint64 offset of the table
+//   block    per primitive: int64 position, uint32 ref length,
+//            uint32 alt length, ref bases, alt bases
+//   table    uint32 sequence count, then per sequence: uint32 name length,
+//            name, uint64 block count, then per block: int64 first position,
+//            uint64 offset, uint32 primitive count
+//
+// all integers are written in the byte order of the host.
+class InputAlleleIndexWriter {
+
+public:
+
+    InputAlleleIndexWriter(void) : file(NULL) { }
+    ~InputAlleleIndexWriter(void) { close(); }
+
+    bool open(const string& filename);
+    // adds a primitive of the record at recordPosition.  records must be
+    // added in sorted order, but the primitives of a record may be in any
+    // order, as they are all at or after the record's position.
+    void add(const string& sequence, long int recordPosition, const InputPrimitive& primitive);
+    // writes out what's pending and the table
+    void close(void);
+
+private:
+
+    class Block {
+    public:
+        long int first;
+        uint64_t offset;
+        uint32_t count;
+    };
+
+    // writes the pending primitives before the given position
+    void flush(long int before);
+    void write(const InputPrimitive& primitive);
+
+    FILE* file;
+    uint64_t offset;
+    string currentSequence;
+    // primitives of recent records, which may yet be followed by primitives
+    // of later records at smaller positions
+    multimap<long int, InputPrimitive> pending;
+    vector<pair<string, vector<Block> > > sequences;
+
+};
+
+class InputAlleleIndex {
+
+public:
+
+    // a place in the index, from which primitives are read in order
+    class Cursor {
+    public:
+        Cursor(void)
+            : sequence(0), block(0), record(0), start(0), end(0), bounded(false), p(NULL) { }
+    private:
+        friend class InputAlleleIndex;
+        size_t sequence;
+        size_t block;
+        uint32_t record;
+        long int start;
+        long int end;
+        bool bounded; // to [start, end) of the one sequence
+        const char* p; // the next primitive of the block, or NULL
+    };
+
+    InputAlleleIndex(void) : data(NULL), dataSize(0) { }
+    ~InputAlleleIndex(void);
+
+    // true if the file is a compiled index, rather than a VCF
+    static bool isIndex(const string& filename);
+
+    bool open(const string& filename);
+    bool is_open(void) const { return data != NULL; }
+
+    // the sequences with primitives, in the order they were compiled
+    const vector<string>& sequenceNames(void) const { return names; }
+
+    // sets the cursor to read every primitive in the index
+    void seek(Cursor& cursor) const;
+    // sets the cursor to read the primitives of the sequence with
+    // start <= position < end
+    void seek(Cursor& cursor, const string& sequence, long int start, long int end) const;
+    // reads the primitive at the cursor, and moves it on; false at the end
+    bool next(Cursor& cursor, string& sequence, InputPrimitive& primitive) const;
+
+    // appends the primitives of the sequence with start <= position < end
+    void fetch(const string& sequence, long int start, long int end, vector<InputPrimitive>& primitives) const;
+
+private:
+
+    class Block {
+    public:
+        long int first;
+        uint64_t offset;
+        uint32_t count;
+    };
+
+    static bool blockStartsBefore(const Block& block, long int position);
+
+    const char* data; // the mapped file
+    size_t dataSize;
+    vector<string> names;
+    vector<vector<Block> > blocks; // of each sequence, as names
+    map<string, size_t> sequenceIndexes;
+
+};
+
+#endif
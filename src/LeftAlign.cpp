@@ -415,3 +415,62 @@ int countMismatches(BAMALIGN& alignment, string referenceSequence) {
     }
 
 }
+
+bool hasIndels(BAMALIGN& alignment) {
+    CIGAR cigar = alignment.GETCIGAR;
+    for (CIGAR::const_iterator c = cigar.begin(); c != cigar.end(); ++c) {
+        char t = c->CIGTYPE;
+        if (t == 'I' || t == 'D' || t == 'N') {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool LeftAlignCache::stablyLeftAlign(BAMALIGN& alignment, const string& referenceSequence, long int referenceStart) {
+
+    // the reference, the CIGAR and the read bases are all the realignment sees
+    string key;
+    int32_t refid = alignment.REFID;
+    int32_t position = alignment.POSITION;
+    key.append((const char*) &refid, sizeof(refid));
+    key.append((const char*) &position, sizeof(position));
+    CIGAR cigar = alignment.GETCIGAR;
+    for (CIGAR::const_iterator c = cigar.begin(); c != cigar.end(); ++c) {
+        uint32_t l = c->CIGLEN;
+        key.append((const char*) &l, sizeof(l));
+        key += c->CIGTYPE;
+    }
+    key += ':';
+    key += alignment.QUERYBASES;
+
+    unordered_map<string, list<Entry>::iterator>::iterator i = index.find(key);
+    if (i != index.end()) {
+        entries.splice(entries.begin(), entries, i->second);
+        Entry& entry = entries.front();
+#ifdef HAVE_BAMTOOLS
+        alignment.CigarData = entry.cigar;
+#else
+        alignment.SetCigar(entry.cigar);
+#endif
+        return entry.stable;
+    }
+
+    int length = alignment.ENDPOSITION - alignment.POSITION + 1;
+    bool stable = ::stablyLeftAlign(alignment,
+                                    referenceSequence.substr(alignment.POSITION - referenceStart, length));
+
+    if (entries.size() == capacity) {
+        index.erase(entries.back().key);
+        entries.pop_back();
+    }
+    entries.push_front(Entry());
+    Entry& entry = entries.front();
+    entry.key.swap(key);
+    entry.cigar = alignment.GETCIGAR;
+    entry.stable = stable;
+    index[entry.key] = entries.begin();
+
+    return stable;
+
+}
@@ -12,6 +12,9 @@
 #include <algorithm>
 #include <map>
 #include <vector>
+#include <list>
+#include <string>
+#include <unordered_map>
 
 #ifdef HAVE_BAMTOOLS
 #include "api/BamAlignment.h"
@@ -46,6 +49,8 @@ using namespace BamTools;
 #define ISREVERSESTRAND IsReverseStrand()
 #define ISPAIRED IsPaired()
 #define ISMATEMAPPED IsMateMapped()
+#define MATEREFID MateRefID
+#define MATEPOSITION MatePosition
 #define ISPROPERPAIR IsProperPair()
 #define CIGLEN Length
 #define CIGTYPE Type
@@ -65,6 +70,8 @@ using namespace BamTools;
 #define ISMAPPED MappedFlag()
 #define ISPAIRED PairedFlag()
 #define ISMATEMAPPED MateMappedFlag()
+#define MATEREFID MateChrID()
+#define MATEPOSITION MatePosition()
 #define ISPROPERPAIR ProperPair()
 #define ISREVERSESTRAND ReverseFlag()
 #define SEQLEN Length()
@@ -117,5 +124,43 @@ using namespace std;
 bool leftAlign(BAMALIGN& alignment, string& referenceSequence, bool debug = false);
 bool stablyLeftAlign(BAMALIGN& alignment, string referenceSequence, int maxiterations = 20, bool debug = false);
 int countMismatches(BAMALIGN& alignment, string referenceSequence);
+// true if the alignment has an indel for leftAlign to move
+bool hasIndels(BAMALIGN& alignment);
+
+// the number of realignments kept by a LeftAlignCache
+#define LEFT_ALIGN_CACHE_SIZE 1024
+
+// the CIGARs of recent stable left-realignments
+//
+// at deep amplicons many reads share their start, CIGAR and bases, and the
+// realignment of each is the same.  as the realignment depends on nothing
+// else, with the reference fixed, the result for one is kept for the rest.
+// the least recently used results are dropped first.
+class LeftAlignCache {
+
+public:
+
+    LeftAlignCache(size_t size = LEFT_ALIGN_CACHE_SIZE) : capacity(size) { }
+
+    // as stablyLeftAlign, on the reference from the alignment's start to its
+    // end, taken from the referenceSequence at referenceStart
+    bool stablyLeftAlign(BAMALIGN& alignment, const string& referenceSequence, long int referenceStart);
+
+    void clear(void) { entries.clear(); index.clear(); }
+
+private:
+
+    class Entry {
+    public:
+        string key;
+        CIGAR cigar;
+        bool stable;
+    };
+
+    size_t capacity;
+    list<Entry> entries; // most recently used first
+    unordered_map<string, list<Entry>::iterator> index;
+
+};
 
 #endif
@@ -0,0 +1,182 @@
+#include "LikelihoodCache.h"
+#include "AlleleParser.h"
+#include "Caller.h"
+#include "RegionScheduler.h"
+#include "VariantWriter.h"
+#include "Logging.h"
+#include <set>
+#include <sstream>
+#include <iomanip>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// the size and modification time of the file, empty if there is no such file
+static string fileStamp(const string& path) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) {
+        return "";
+    }
+    stringstream stamp;
+    stamp << info.st_size << " " << info.st_mtime;
+    return stamp.str();
+}
+
+// the options which don't change what is dumped for a file, by how threads
+// read and write, what is reported alongside, or where the output goes;
+// those marked take a value
+static const struct { const char* name; bool value; } unkeyedOptions[] = {
+    {"-b", true}, {"--bam", true},
+    {"-L", true}, {"--bam-list", true},
+    {"-v", true}, {"--vcf", true},
+    {"--output-format", true}, {"--compress-threads", true},
+    {"--threads", true}, {"--auto-regions", true}, {"--numa", false},
+    {"--genotyping-threads", true}, {"--emit-queue", true}, {"--decompress-threads", true},
+    {"--prefetch-alignments", true}, {"--remote-read-ahead", true}, {"--idle-alignment-files", true},
+    {"--open-threads", true}, {"--header-cache", true},
+    {"--profile-report", true}, {"--slow-site-log", true}, {"--slow-site-time", true},
+    {"--progress", true}, {"--progress-file", true},
+    {"--trace", true}, {"--trace-region", true}, {"--trace-sample", true},
+    {"--likelihood-cache", true}, {"--likelihood-dump", true},
+    {"--checkpoint", true}, {"--checkpoint-interval", true}, {"--resume", false},
+    {0, false}
+};
+
+// whether the word is an unkeyed option, and if so whether its value is the
+// next word rather than part of this one (--name=value, or -vFILE)
+static bool unkeyedOption(const string& word, bool& valueFollows) {
+    for (int i = 0; unkeyedOptions[i].name; ++i) {
+        string name = unkeyedOptions[i].name;
+        if (word == name) {
+            valueFollows = unkeyedOptions[i].value;
+            return true;
+        }
+        bool isLong = name.size() > 2;
+        if (unkeyedOptions[i].value && word.compare(0, name.size(), name) == 0
+            && (!isLong || word[name.size()] == '=')) {
+            valueFollows = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+// the arguments of the run which bear on the dump of any one file, with the
+// stamps of the files they name
+static string keyedArguments(const Parameters& parameters) {
+    set<string> inputs(parameters.bams.begin(), parameters.bams.end());
+    stringstream words(parameters.commandline);
+    string word;
+    string arguments;
+    words >> word; // the program
+    bool skipNext = false;
+    while (words >> word) {
+        bool valueFollows = false;
+        if (skipNext) {
+            skipNext = false;
+        } else if (unkeyedOption(word, valueFollows)) {
+            skipNext = valueFollows;
+        } else if (!inputs.count(word)) {
+            arguments += " " + word;
+            string stamp = fileStamp(word);
+            if (!stamp.empty()) {
+                arguments += " (" + stamp + ")";
+            }
+        }
+    }
+    return arguments;
+}
+
+// the name of the dump of the file in the cache
+static string cacheKey(const string& file, const string& arguments) {
+    uint64_t h = fnv1a(file);
+    h = fnv1a(fileStamp(file), h);
+    h = fnv1a(arguments, h);
+    stringstream key;
+    key << hex << setw(16) << setfill('0') << h;
+    return key.str();
+}
+
+// calls the file alone, writing only the dump
+static bool writeDump(const Parameters& run, const string& file, const string& dumpFile) {
+    Parameters p = run;
+    p.bams.assign(1, file);
+    p.likelihoodDumpFile = dumpFile;
+    p.likelihoodCacheDir.clear();
+    p.outputFile = "/dev/null";
+    p.outputFormat = "vcf";
+    p.gVCFout = false;
+    p.profileReportFile.clear();
+    p.slowSiteLogFile.clear();
+    p.traceFile.clear();
+    p.traceRegions.clear();
+    p.traceSamples.clear();
+    p.progressInterval = 0;
+    p.checkpointDir.clear();
+    p.resume = false;
+
+    AlleleParser* parser = new AlleleParser(p);
+    vector<string> sequences;
+    for (REFVEC::const_iterator r = parser->referenceSequences.begin(); r != parser->referenceSequences.end(); ++r) {
+        sequences.push_back(r->REFNAME);
+    }
+    if (!parser->run->likelihoodDump.open(dumpFile, parser->sampleList, sequences)) {
+        ERROR("unable to open likelihood dump: " << dumpFile);
+        delete parser;
+        return false;
+    }
+
+    // the records are discarded, as the dumps are genotyped together after
+    VariantWriter writer;
+    writer.open(*(parser->output));
+    SiteCounts sites;
+    if (p.threads > 1) {
+        callVariantsInThreads(parser, writer, sites);
+    } else {
+        StreamVariantOutput variantOut(writer);
+        callVariants(parser, variantOut, sites);
+    }
+    writer.close();
+    parser->run->likelihoodDump.close();
+    delete parser;
+    return true;
+}
+
+bool prepareLikelihoodCache(Parameters& parameters) {
+
+    const string& dir = parameters.likelihoodCacheDir;
+    if (mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST) {
+        ERROR("could not make the likelihood cache directory " << dir << ": " << strerror(errno));
+        return false;
+    }
+
+    string arguments = keyedArguments(parameters);
+    vector<string> dumps;
+    for (vector<string>::iterator f = parameters.bams.begin(); f != parameters.bams.end(); ++f) {
+        if (fileStamp(*f).empty()) {
+            ERROR("could not find the alignment file " << *f << " to key the likelihood cache");
+            return false;
+        }
+        string dump = dir + "/" + cacheKey(*f, arguments) + ".gld";
+        if (fileStamp(dump).empty()) {
+            DEBUG("calling " << *f << " into the likelihood cache as " << dump);
+            string partial = dump + ".partial";
+            if (!writeDump(parameters, *f, partial)) {
+                return false;
+            }
+            if (rename(partial.c_str(), dump.c_str()) != 0) {
+                ERROR("could not move " << partial << " into the likelihood cache: " << strerror(errno));
+                return false;
+            }
+        } else {
+            DEBUG("reusing the likelihood dump " << dump << " of " << *f);
+        }
+        dumps.push_back(dump);
+    }
+
+    parameters.bams.clear();
+    parameters.jointLikelihoodFiles = dumps;
+    return true;
+
+}
@@ -0,0 +1,25 @@
+#ifndef FREEBAYES_LIKELIHOODCACHE_H
+#define FREEBAYES_LIKELIHOODCACHE_H
+
+#include <string>
+#include "Parameters.h"
+
+using namespace std;
+
+// --likelihood-cache DIR: each alignment file of the run is called alone,
+// writing a likelihood dump to DIR named by a key of the file, then the dumps
+// are genotyped together as with --joint-likelihoods.  the key hashes the
+// path, size and modification time of the file, and the arguments of the
+// run which change what is dumped, with the size and modification time of
+// any file they name, such as the reference or the targets.  a file whose
+// dump is already in DIR isn't read again, so adding samples to a cohort
+// only costs reading their alignments.
+//
+// the dump of a file is written beside its place in DIR and renamed into it
+// once complete, so a run which is stopped leaves none half written.
+
+// writes the dumps missing from the cache, then points the parameters at the
+// dumps of every file in place of the files; false if a dump couldn't be made
+bool prepareLikelihoodCache(Parameters& parameters);
+
+#endif
@@ -0,0 +1,311 @@
+#include "LikelihoodDump.h"
+#include "Utility.h"
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <limits>
+
+static const char LIKELIHOOD_DUMP_MAGIC[8] = { 'F', 'B', 'G', 'L', 'D', 'M', 'P', '1' };
+
+template <class T>
+static void appendValue(string& buffer, T value) {
+    buffer.append((const char*) &value, sizeof(T));
+}
+
+static void appendString(string& buffer, const string& s) {
+    appendValue<uint32_t>(buffer, s.size());
+    buffer.append(s);
+}
+
+static void writeString(FILE* file, const string& s) {
+    uint32_t length = s.size();
+    fwrite(&length, sizeof(length), 1, file);
+    fwrite(s.data(), 1, length, file);
+}
+
+bool LikelihoodDumpWriter::open(const string& filename, const vector<string>& samples, const vector<string>& sequences) {
+    if (!(file = fopen(filename.c_str(), "wb"))) {
+        return false;
+    }
+    // the offset of the table is filled in by close
+    uint64_t tableOffset = 0;
+    fwrite(LIKELIHOOD_DUMP_MAGIC, 1, sizeof(LIKELIHOOD_DUMP_MAGIC), file);
+    fwrite(&tableOffset, sizeof(tableOffset), 1, file);
+    offset = sizeof(LIKELIHOOD_DUMP_MAGIC) + sizeof(tableOffset);
+    sampleNames = samples;
+    sampleIndexes.clear();
+    for (size_t i = 0; i < sampleNames.size(); ++i) {
+        sampleIndexes[sampleNames[i]] = i;
+    }
+    sequenceNames = sequences;
+    sequenceIndexes.clear();
+    for (size_t i = 0; i < sequenceNames.size(); ++i) {
+        sequenceIndexes[sequenceNames[i]] = i;
+    }
+    siteOffsets.assign(sequenceNames.size(), map<long int, uint64_t>());
+    return true;
+}
+
+void LikelihoodDumpWriter::add(const string& sequence, long int position,
+                               vector<Allele>& genotypeAlleles,
+                               map<int, vector<Genotype> >& genotypesByPloidy,
+                               Samples& samples,
+                               map<string, vector<vector<SampleDataLikelihood> > >& sampleDataLikelihoodsByPopulation) {
+
+    map<string, size_t>::iterator sequenceIndex = sequenceIndexes.find(sequence);
+    if (sequenceIndex == sequenceIndexes.end()) {
+        return;
+    }
+
+    // encode the site outside of the lock, so threads only contend on the write
+    string site;
+    appendValue<uint32_t>(site, genotypeAlleles.size());
+    for (vector<Allele>::iterator a = genotypeAlleles.begin(); a != genotypeAlleles.end(); ++a) {
+        appendValue<uint32_t>(site, a->type);
+        appendValue<int64_t>(site, a->position);
+        appendValue<uint32_t>(site, a->length);
+        appendValue<uint32_t>(site, a->referenceLength);
+        appendValue<int64_t>(site, a->repeatRightBoundary);
+        appendString(site, a->alternateSequence);
+        appendString(site, a->cigar.str());
+    }
+
+    map<Genotype*, size_t> genotypeIndexes;
+    vector<int> gtspec;
+    size_t genotypeCount = 0;
+    for (map<int, vector<Genotype> >::iterator p = genotypesByPloidy.begin(); p != genotypesByPloidy.end(); ++p) {
+        for (vector<Genotype>::iterator g = p->second.begin(); g != p->second.end(); ++g) {
+            genotypeIndexes[&*g] = genotypeCount++;
+        }
+    }
+    appendValue<uint32_t>(site, genotypeIndexes.size());
+    for (map<int, vector<Genotype> >::iterator p = genotypesByPloidy.begin(); p != genotypesByPloidy.end(); ++p) {
+        for (vector<Genotype>::iterator g = p->second.begin(); g != p->second.end(); ++g) {
+            gtspec.clear();
+            g->relativeGenotype(gtspec, genotypeAlleles);
+            appendValue<uint32_t>(site, gtspec.size());
+            for (vector<int>::iterator i = gtspec.begin(); i != gtspec.end(); ++i) {
+                appendValue<uint32_t>(site, *i);
+            }
+        }
+    }
+
+    size_t sampleCount = sampleNames.size();
+    size_t alleleCount = genotypeAlleles.size();
+    vector<int32_t> observations(sampleCount * alleleCount, 0);
+    vector<int32_t> qualSums(sampleCount * alleleCount, 0);
+    vector<double> likelihoods(sampleCount * genotypeCount, numeric_limits<double>::quiet_NaN());
+
+    for (Samples::iterator s = samples.begin(); s != samples.end(); ++s) {
+        map<string, size_t>::iterator i = sampleIndexes.find(s->first);
+        if (i == sampleIndexes.end()) {
+            continue;
+        }
+        for (size_t a = 0; a < alleleCount; ++a) {
+            string& base = genotypeAlleles[a].currentBase;
+            observations[i->second * alleleCount + a] = s->second.observationCount(base);
+            qualSums[i->second * alleleCount + a] = s->second.qualSum(base);
+        }
+    }
+    for (map<string, vector<vector<SampleDataLikelihood> > >::iterator p = sampleDataLikelihoodsByPopulation.begin();
+         p != sampleDataLikelihoodsByPopulation.end(); ++p) {
+        for (vector<vector<SampleDataLikelihood> >::iterator s = p->second.begin(); s != p->second.end(); ++s) {
+            if (s->empty()) {
+                continue;
+            }
+            map<string, size_t>::iterator i = sampleIndexes.find(*s->front().name);
+            if (i == sampleIndexes.end()) {
+                continue;
+            }
+            for (vector<SampleDataLikelihood>::iterator l = s->begin(); l != s->end(); ++l) {
+                map<Genotype*, size_t>::iterator g = genotypeIndexes.find(l->genotype);
+                if (g != genotypeIndexes.end()) {
+                    likelihoods[i->second * genotypeCount + g->second] = l->prob;
+                }
+            }
+        }
+    }
+    site.append((const char*) observations.data(), observations.size() * sizeof(int32_t));
+    site.append((const char*) qualSums.data(), qualSums.size() * sizeof(int32_t));
+    site.append((const char*) likelihoods.data(), likelihoods.size() * sizeof(double));
+
+    lock_guard<mutex> lock(writeMutex);
+    if (!file) {
+        return;
+    }
+    fwrite(site.data(), 1, site.size(), file);
+    siteOffsets[sequenceIndex->second][position] = offset;
+    offset += site.size();
+}
+
+void LikelihoodDumpWriter::close(void) {
+    if (!file) {
+        return;
+    }
+    uint64_t tableOffset = offset;
+    uint32_t sampleCount = sampleNames.size();
+    fwrite(&sampleCount, sizeof(sampleCount), 1, file);
+    for (vector<string>::iterator s = sampleNames.begin(); s != sampleNames.end(); ++s) {
+        writeString(file, *s);
+    }
+    uint32_t sequenceCount = sequenceNames.size();
+    fwrite(&sequenceCount, sizeof(sequenceCount), 1, file);
+    for (size_t i = 0; i < sequenceNames.size(); ++i) {
+        writeString(file, sequenceNames[i]);
+        uint64_t siteCount = siteOffsets[i].size();
+        fwrite(&siteCount, sizeof(siteCount), 1, file);
+        for (map<long int, uint64_t>::iterator s = siteOffsets[i].begin(); s != siteOffsets[i].end(); ++s) {
+            int64_t position = s->first;
+            fwrite(&position, sizeof(position), 1, file);
+            fwrite(&s->second, sizeof(s->second), 1, file);
+        }
+    }
+    fseek(file, sizeof(LIKELIHOOD_DUMP_MAGIC), SEEK_SET);
+    fwrite(&tableOffset, sizeof(tableOffset), 1, file);
+    fclose(file);
+    file = NULL;
+}
+
+static string readString(const char*& p) {
+    uint32_t length = readValue<uint32_t>(p);
+    string s(p, length);
+    p += length;
+    return s;
+}
+
+// the value at the index of a column
+template <class T>
+static T columnValue(const char* column, size_t index) {
+    T value;
+    memcpy(&value, column + index * sizeof(T), sizeof(T));
+    return value;
+}
+
+int LikelihoodDumpSite::observationCount(size_t sample, size_t allele) const {
+    return columnValue<int32_t>(observations, sample * alleles.size() + allele);
+}
+
+int LikelihoodDumpSite::qualSum(size_t sample, size_t allele) const {
+    return columnValue<int32_t>(qualSums, sample * alleles.size() + allele);
+}
+
+double LikelihoodDumpSite::likelihood(size_t sample, size_t genotype) const {
+    return columnValue<double>(likelihoods, sample * genotypes.size() + genotype);
+}
+
+LikelihoodDump::~LikelihoodDump(void) {
+    if (data) {
+        munmap((void*) data, dataSize);
+    }
+}
+
+bool LikelihoodDump::isDump(const string& filename) {
+    char magic[sizeof(LIKELIHOOD_DUMP_MAGIC)];
+    FILE* f = fopen(filename.c_str(), "rb");
+    if (!f) {
+        return false;
+    }
+    size_t n = fread(magic, 1, sizeof(magic), f);
+    fclose(f);
+    return n == sizeof(magic) && memcmp(magic, LIKELIHOOD_DUMP_MAGIC, sizeof(magic)) == 0;
+}
+
+bool LikelihoodDump::open(const string& filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) (sizeof(LIKELIHOOD_DUMP_MAGIC) + sizeof(uint64_t))) {
+        ::close(fd);
+        return false;
+    }
+    void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    data = (const char*) mapped;
+    dataSize = st.st_size;
+
+    if (memcmp(data, LIKELIHOOD_DUMP_MAGIC, sizeof(LIKELIHOOD_DUMP_MAGIC)) != 0) {
+        return false;
+    }
+    const char* p = data + sizeof(LIKELIHOOD_DUMP_MAGIC);
+    uint64_t tableOffset = readValue<uint64_t>(p);
+    if (tableOffset == 0 || tableOffset + sizeof(uint32_t) > dataSize) {
+        // not closed
+        return false;
+    }
+    p = data + tableOffset;
+    uint32_t sampleCount = readValue<uint32_t>(p);
+    for (uint32_t i = 0; i < sampleCount; ++i) {
+        sampleNames.push_back(readString(p));
+    }
+    uint32_t sequenceCount = readValue<uint32_t>(p);
+    for (uint32_t i = 0; i < sequenceCount; ++i) {
+        string name = readString(p);
+        sequenceNames.push_back(name);
+        map<long int, uint64_t>& sites = siteOffsets[name];
+        uint64_t siteCount = readValue<uint64_t>(p);
+        for (uint64_t j = 0; j < siteCount; ++j) {
+            long int position = readValue<int64_t>(p);
+            sites[position] = readValue<uint64_t>(p);
+        }
+    }
+    return true;
+}
+
+void LikelihoodDump::positions(const string& sequence, vector<long int>& sitePositions) const {
+    map<string, map<long int, uint64_t> >::const_iterator s = siteOffsets.find(sequence);
+    if (s == siteOffsets.end()) {
+        return;
+    }
+    for (map<long int, uint64_t>::const_iterator p = s->second.begin(); p != s->second.end(); ++p) {
+        sitePositions.push_back(p->first);
+    }
+}
+
+bool LikelihoodDump::read(const string& sequence, long int position, LikelihoodDumpSite& site) const {
+    map<string, map<long int, uint64_t> >::const_iterator s = siteOffsets.find(sequence);
+    if (s == siteOffsets.end()) {
+        return false;
+    }
+    map<long int, uint64_t>::const_iterator o = s->second.find(position);
+    if (o == s->second.end()) {
+        return false;
+    }
+    const char* p = data + o->second;
+    site.position = position;
+    site.alleles.clear();
+    site.genotypes.clear();
+    uint32_t alleleCount = readValue<uint32_t>(p);
+    for (uint32_t i = 0; i < alleleCount; ++i) {
+        AlleleType type = (AlleleType) readValue<uint32_t>(p);
+        long int allelePosition = readValue<int64_t>(p);
+        unsigned int length = readValue<uint32_t>(p);
+        unsigned int referenceLength = readValue<uint32_t>(p);
+        long int repeatRightBoundary = readValue<int64_t>(p);
+        string alternateSequence = readString(p);
+        Cigar cigar(readString(p));
+        site.alleles.push_back(genotypeAllele(type, alternateSequence, length, cigar,
+                                              referenceLength, allelePosition, repeatRightBoundary));
+    }
+    uint32_t genotypeCount = readValue<uint32_t>(p);
+    for (uint32_t i = 0; i < genotypeCount; ++i) {
+        uint32_t ploidy = readValue<uint32_t>(p);
+        site.genotypes.push_back(vector<int>());
+        for (uint32_t j = 0; j < ploidy; ++j) {
+            site.genotypes.back().push_back(readValue<uint32_t>(p));
+        }
+    }
+    site.observations = p;
+    p += sizeof(int32_t) * sampleNames.size() * alleleCount;
+    site.qualSums = p;
+    p += sizeof(int32_t) * sampleNames.size() * alleleCount;
+    site.likelihoods = p;
+    return true;
+}
@@ -0,0 +1,133 @@
+#ifndef FREEBAYES_LIKELIHOODDUMP_H
+#define FREEBAYES_LIKELIHOODDUMP_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include "Allele.h"
+#include "Genotype.h"
+#include "Sample.h"
+
+using namespace std;
+
+// a columnar dump of the genotype likelihoods and allele observation
+// summaries of each sample at each site which was genotyped, written with
+// --likelihood-dump, so that the samples can later be genotyped jointly
+// without their alignments or reparsing VCF text
+//
+// the file is a header, then the sites in the order they were genotyped,
+// then a table of the samples and the sites of each sequence, sorted:
+//
+//   header   "FBGLDMP1", uint64 offset of the table
+//   site     uint32 allele count, then per allele: uint32 type, int64
+//            position, uint32 length, uint32 reference length, int64 repeat
+//            right boundary, uint32 sequence length, alternate sequence,
+//            uint32 CIGAR length, CIGAR;
+//            uint32 genotype count, then per genotype: uint32 ploidy, then
+//            the uint32 index of each of its alleles, in order;
+//            then the columns, each by sample (in the order of the table)
+//            and then by allele or genotype:
+//              int32 observations of each allele
+//              int32 sum of the qualities of the observations of each allele
+//              double ln likelihood of each genotype, NaN if not computed
+//   table    uint32 sample count, then per sample: uint32 name length, name;
+//            uint32 sequence count, then per sequence: uint32 name length,
+//            name, uint64 site count, then per site: int64 position (0-based),
+//            uint64 offset
+//
+// the integers and the likelihoods are written as the host holds them, so a
+// dump is read back on machines of the same byte order and double format.
+class LikelihoodDumpWriter {
+
+public:
+
+    LikelihoodDumpWriter(void) : file(NULL) { }
+    ~LikelihoodDumpWriter(void) { close(); }
+
+    // the sites are written out in the order of the sequences given
+    bool open(const string& filename, const vector<string>& samples, const vector<string>& sequences);
+    bool is_open(void) const { return file != NULL; }
+    // adds the site at the 0-based position.  may be called from any thread,
+    // and the sites of each sequence in any order.
+    void add(const string& sequence, long int position,
+             vector<Allele>& genotypeAlleles,
+             map<int, vector<Genotype> >& genotypesByPloidy,
+             Samples& samples,
+             map<string, vector<vector<SampleDataLikelihood> > >& sampleDataLikelihoodsByPopulation);
+    // writes the table
+    void close(void);
+
+private:
+
+    FILE* file;
+    uint64_t offset;
+    vector<string> sampleNames;
+    map<string, size_t> sampleIndexes;
+    vector<string> sequenceNames;
+    map<string, size_t> sequenceIndexes;
+    vector<map<long int, uint64_t> > siteOffsets; // by sequence
+    mutex writeMutex;
+
+};
+
+// one site of a dump, as read from the mapped file
+class LikelihoodDumpSite {
+
+public:
+
+    long int position;
+    vector<Allele> alleles;
+    vector<vector<int> > genotypes;  // the indexes of the alleles of each genotype
+
+    int observationCount(size_t sample, size_t allele) const;
+    int qualSum(size_t sample, size_t allele) const;
+    // NaN where the likelihood wasn't computed for the sample
+    double likelihood(size_t sample, size_t genotype) const;
+
+private:
+
+    friend class LikelihoodDump;
+
+    // the columns, which needn't be aligned
+    const char* observations;
+    const char* qualSums;
+    const char* likelihoods;
+
+};
+
+// a dump written by LikelihoodDumpWriter, mapped into memory
+class LikelihoodDump {
+
+public:
+
+    LikelihoodDump(void) : data(NULL), dataSize(0) { }
+    ~LikelihoodDump(void);
+
+    static bool isDump(const string& filename);
+    bool open(const string& filename);
+    bool is_open(void) const { return data != NULL; }
+
+    const vector<string>& samples(void) const { return sampleNames; }
+    const vector<string>& sequences(void) const { return sequenceNames; }
+    // the 0-based positions of the sites of the sequence, sorted
+    void positions(const string& sequence, vector<long int>& sitePositions) const;
+    // reads the site at the position, returning false if there is none
+    bool read(const string& sequence, long int position, LikelihoodDumpSite& site) const;
+
+private:
+
+    LikelihoodDump(const LikelihoodDump&);
+    LikelihoodDump& operator=(const LikelihoodDump&);
+
+    const char* data;
+    size_t dataSize;
+    vector<string> sampleNames;
+    vector<string> sequenceNames;
+    map<string, map<long int, uint64_t> > siteOffsets;
+
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef FREEBAYES_LIKELIHOODENGINE_H
+#define FREEBAYES_LIKELIHOODENGINE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cmath>
+#include "Allele.h"
+#include "Sample.h"
+#include "Genotype.h"
+#include "Bias.h"
+#include "Contamination.h"
+#include "Parameters.h"
+#include "WorkerTeam.h"
+
+using namespace std;
+
+// a sample whose likelihoods are calculated at the site, in the order of the
+// sample list
+class SampleLikelihoodSlot {
+public:
+    string* name;
+    Sample* sample;
+    vector<Genotype>* genotypes;
+    vector<SampleDataLikelihood> likelihoods; // sorted, or empty to skip the sample
+    Probability lnFloor; // the --gl-margin below the best, if any were left out under it, or -inf
+
+    SampleLikelihoodSlot(void) : name(NULL), sample(NULL), genotypes(NULL), lnFloor(-INFINITY) { }
+};
+
+// what the samples of a site are scored against
+class SiteLikelihoodInputs {
+public:
+    Bias& observationBias;
+    vector<Allele>& genotypeAlleles;
+    Contamination& contaminations;
+    map<string, double>& frequencies;
+    Parameters& parameters;
+    bool usingNull;
+
+    SiteLikelihoodInputs(Bias& b, vector<Allele>& a, Contamination& c,
+                         map<string, double>& f, Parameters& p, bool n)
+        : observationBias(b), genotypeAlleles(a), contaminations(c)
+        , frequencies(f), parameters(p), usingNull(n) { }
+};
+
+// scores the genotypes of the samples of a site, for --likelihood-engine
+//
+// an engine is given every sample of the site at once, so one which works
+// away from the calling thread, as on an accelerator, can move the site's
+// observations in one batch.  its likelihoods are to be those of the cpu
+// engine, the reference, to within LIKELIHOOD_ENGINE_TOLERANCE in log space;
+// as the genotype search ranks combos by their sums, anything looser can
+// change the calls.  the cpu engine is the only one in this tree.
+#define LIKELIHOOD_ENGINE_TOLERANCE 1e-9
+
+class LikelihoodEngine {
+public:
+    virtual ~LikelihoodEngine(void) { }
+    virtual const char* name(void) const = 0;
+    // fills in the sorted likelihoods of each slot, leaving those of samples
+    // with no genotypes to score empty; the team may be used for the batch
+    virtual void score(vector<SampleLikelihoodSlot>& slots, SiteLikelihoodInputs& site, WorkerTeam* team) = 0;
+};
+
+// the genotypes of the slot's sample which are to be scored
+void genotypesToScore(SampleLikelihoodSlot& slot, SiteLikelihoodInputs& site, vector<Genotype*>& genotypes);
+
+// sorts the slot's likelihoods once they are scored, first leaving out those
+// --gl-margin doesn't keep
+void sortSampleLikelihoods(SampleLikelihoodSlot& slot, SiteLikelihoodInputs& site);
+
+// a new engine of the given name, or NULL if this build has none of that name
+LikelihoodEngine* makeLikelihoodEngine(const string& name);
+// the names of those it has, for the usage
+string likelihoodEngineNames(void);
+
+#endif
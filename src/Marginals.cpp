@@ -1,4 +1,5 @@
 #include "Marginals.h"
+#include <unordered_map>
 
 
 /*
@@ -6,27 +7,27 @@
 void marginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCombos, Results& results) {
 
 
-    map<string, map<Genotype*, vector<long double> > > rawMarginals;
+    map<string, map<Genotype*, vector<Probability> > > rawMarginals;
 
     // push the marginal likelihoods into the rawMarginals vectors in the results
     for (list<GenotypeCombo>::iterator gc = genotypeCombos.begin(); gc != genotypeCombos.end(); ++gc) {
         for (GenotypeCombo::const_iterator i = gc->begin(); i != gc->end(); ++i) {
             const SampleDataLikelihood& sdl = **i;
-            rawMarginals[sdl.name][sdl.genotype].push_back(gc->posteriorProb);
+            rawMarginals[*sdl.name][sdl.genotype].push_back(gc->posteriorProb);
         }
     }
 
     // safely add the raw marginal vectors using logsumexp
     for (Results::iterator r = results.begin(); r != results.end(); ++r) {
         ResultData& sample = r->second;
-        map<Genotype*, vector<long double> >& rawmgs = rawMarginals[r->first];
-        vector<long double> probs;
-        for (map<Genotype*, vector<long double> >::iterator m = rawmgs.begin(); m != rawmgs.end(); ++m) {
+        map<Genotype*, vector<Probability> >& rawmgs = rawMarginals[r->first];
+        vector<Probability> probs;
+        for (map<Genotype*, vector<Probability> >::iterator m = rawmgs.begin(); m != rawmgs.end(); ++m) {
             probs.push_back(logsumexp_probs(m->second));
         }
-        long double normalizer = logsumexp_probs(probs);
-        vector<long double>::iterator p = probs.begin();
-        for (map<Genotype*, vector<long double> >::iterator m = rawmgs.begin(); m != rawmgs.end(); ++m, ++p) {
+        Probability normalizer = logsumexp_probs(probs);
+        vector<Probability>::iterator p = probs.begin();
+        for (map<Genotype*, vector<Probability> >::iterator m = rawmgs.begin(); m != rawmgs.end(); ++m, ++p) {
             sample.marginals[m->first] = *p - normalizer;
         }
     }
@@ -35,55 +36,73 @@ void marginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCombos, Results& r
 */
 
 // recompute data likelihoods using marginals from the combos
-// assumes that the genotype combos are in the same order as the likelihoods
-// assumes that the genotype combos are the same size as the number of samples in the likelihoods
+// the combos' sample data likelihoods must point into the likelihoods of the
+// populations, which are updated in place
 // returns the delta from the previous marginals, informative in the case of EM
-long double marginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCombos, SampleDataLikelihoods& likelihoods) {
+Probability marginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCombos, map<string, SampleDataLikelihoods>& likelihoodsByPopulation) {
+
+    Probability delta = 0;
+
+    // the samples of every population, in the order in which they appear in
+    // combos of the first population.  combos built from the other
+    // populations order their samples differently, so their genotypes are
+    // placed by sample when they don't fall where we expect them.
+    vector<vector<SampleDataLikelihood>*> samples;
+    unordered_map<Sample*, size_t> sampleIndexes;
+    for (map<string, SampleDataLikelihoods>::iterator p = likelihoodsByPopulation.begin(); p != likelihoodsByPopulation.end(); ++p) {
+        for (SampleDataLikelihoods::iterator s = p->second.begin(); s != p->second.end(); ++s) {
+            sampleIndexes[s->front().sample] = samples.size();
+            samples.push_back(&*s);
+        }
+    }
 
-    long double delta = 0;
+    if (genotypeCombos.empty() || samples.empty()) {
+        return delta;
+    }
 
-    vector< map<Genotype*, long double> > rawMarginals;
-    rawMarginals.resize(likelihoods.size());
-    vector< map<Genotype*, long double> >::iterator rawMarginalsItr;
+    // the posterior mass of the combos including each genotype of each
+    // sample, relative to the best combo's.  scaling by the best combo means
+    // each combo's mass is a single exp, which is then just added to the
+    // entries of its genotypes.
+    Probability best = genotypeCombos.front().posteriorProb;
+    for (list<GenotypeCombo>::iterator gc = genotypeCombos.begin(); gc != genotypeCombos.end(); ++gc) {
+        best = max(best, gc->posteriorProb);
+    }
+    vector<vector<Probability> > mass(samples.size());
+    vector<vector<bool> > seen(samples.size());
+    for (size_t i = 0; i < samples.size(); ++i) {
+        mass[i].assign(samples[i]->size(), 0);
+        seen[i].assign(samples[i]->size(), false);
+    }
 
-    // push the marginal likelihoods into the rawMarginals maps
     for (list<GenotypeCombo>::iterator gc = genotypeCombos.begin(); gc != genotypeCombos.end(); ++gc) {
-        rawMarginalsItr = rawMarginals.begin();
-        for (GenotypeCombo::const_iterator i = gc->begin(); i != gc->end(); ++i) {
-            const SampleDataLikelihood& sdl = **i;
-            map<Genotype*, long double>& rmgs = *rawMarginalsItr++;
-            map<Genotype*, long double>::iterator rmgsItr = rmgs.find(sdl.genotype);
-            if (rmgsItr == rmgs.end()) {
-                rmgs[sdl.genotype] = gc->posteriorProb;
-            } else {
-                //vector<long double> x;
-                //x.push_back(rmgsItr->second); x.push_back(gc->posteriorProb);
-                //rmgs[sdl.genotype] = logsumexp_probs(x);
-                rmgs[sdl.genotype] = log(safe_exp(rmgsItr->second) + safe_exp(gc->posteriorProb));
-            }
+        Probability m = exp(gc->posteriorProb - best);
+        size_t i = 0;
+        for (GenotypeCombo::const_iterator g = gc->begin(); g != gc->end(); ++g, ++i) {
+            SampleDataLikelihood* sdl = *g;
+            size_t j = (i < samples.size() && samples[i]->front().sample == sdl->sample)
+                ? i : sampleIndexes[sdl->sample];
+            size_t k = sdl - &samples[j]->front();
+            mass[j][k] += m;
+            seen[j][k] = true;
         }
     }
 
-    // safely add the raw marginal vectors using logsumexp
-    // and use to update the sample data likelihoods
-    rawMarginalsItr = rawMarginals.begin();
-    long double minAllowedMarginal = -1e-16;
-    for (SampleDataLikelihoods::iterator s = likelihoods.begin(); s != likelihoods.end(); ++s) {
-        vector<SampleDataLikelihood>& sdls = *s;
-        const map<Genotype*, long double>& rawmgs = *rawMarginalsItr++;
-        map<Genotype*, long double> marginals;
-        vector<long double> rawprobs;
-        for (map<Genotype*, long double>::const_iterator m = rawmgs.begin(); m != rawmgs.end(); ++m) {
-            long double p = m->second;
-            marginals[m->first] = p;
-            rawprobs.push_back(p);
+    // normalize the marginals for each sample and update its data likelihoods
+    Probability minAllowedMarginal = -1e-16;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        vector<SampleDataLikelihood>& sdls = *samples[i];
+        Probability total = 0;
+        for (vector<Probability>::iterator m = mass[i].begin(); m != mass[i].end(); ++m) {
+            total += *m;
         }
-        long double normalizer = logsumexp_probs(rawprobs);
-        for (vector<SampleDataLikelihood>::iterator sdl = sdls.begin(); sdl != sdls.end(); ++sdl) {
-            long double newmarginal = marginals[sdl->genotype] - normalizer;
-            delta += newmarginal - sdl->marginal;
+        Probability normalizer = log(total) + best;
+        for (size_t k = 0; k < sdls.size(); ++k) {
+            // genotypes in no combo have always been given a raw marginal of 0
+            Probability newmarginal = seen[i][k] ? log(mass[i][k] / total) : -normalizer;
+            delta += newmarginal - sdls[k].marginal;
             // ensure the marginal is non-0 to guard against underflow
-            sdl->marginal = min(minAllowedMarginal, newmarginal);
+            sdls[k].marginal = min(minAllowedMarginal, newmarginal);
         }
     }
 
@@ -95,20 +114,20 @@ long double marginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCombos, Sam
 void bestMarginalGenotypeCombo(GenotypeCombo& combo,
         Results& results,
         SampleDataLikelihoods& samples,
-        long double theta,
+        Probability theta,
         bool pooled,
         bool permute,
         bool hwePriors,
         bool binomialObsPriors,
         bool alleleBalancePriors,
-        long double diffusionPriorScalar) {
+        Probability diffusionPriorScalar) {
 
     for (SampleDataLikelihoods::iterator s = samples.begin(); s != samples.end(); ++s) {
         vector<SampleDataLikelihood>& sdls = *s;
-        const string& name = sdls.front().name;
-        const map<Genotype*, long double>& marginals = results[name].marginals;;
-        map<Genotype*, long double>::const_iterator m = marginals.begin();
-        long double bestMarginalProb = m->second;
+        const string& name = *sdls.front().name;
+        const map<Genotype*, Probability>& marginals = results[name].marginals;;
+        map<Genotype*, Probability>::const_iterator m = marginals.begin();
+        Probability bestMarginalProb = m->second;
         Genotype* bestMarginalGenotype = m->first;
         ++m;
         for (; m != marginals.end(); ++m) {
@@ -132,14 +151,14 @@ void bestMarginalGenotypeCombo(GenotypeCombo& combo,
 }
 */
 
-long double balancedMarginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCombos, SampleDataLikelihoods& likelihoods) {
+Probability balancedMarginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCombos, SampleDataLikelihoods& likelihoods) {
 
-    long double delta = 0;
+    Probability delta = 0;
 
-    //map<string, map<Genotype*, vector<long double> > > rawMarginals;
-    vector< map<Genotype*, vector<long double> > > rawMarginals;
+    //map<string, map<Genotype*, vector<Probability> > > rawMarginals;
+    vector< map<Genotype*, vector<Probability> > > rawMarginals;
     rawMarginals.resize(likelihoods.size());
-    vector< map<Genotype*, vector<long double> > >::iterator rawMarginalsItr;
+    vector< map<Genotype*, vector<Probability> > >::iterator rawMarginalsItr;
 
     // push the marginal likelihoods into the rawMarginals maps
     for (list<GenotypeCombo>::iterator gc = genotypeCombos.begin(); gc != genotypeCombos.end(); ++gc) {
@@ -147,7 +166,7 @@ long double balancedMarginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCom
             rawMarginalsItr = rawMarginals.begin();
             for (GenotypeCombo::const_iterator i = gc->begin(); i != gc->end(); ++i) {
                 const SampleDataLikelihood& sdl = **i;
-                map<Genotype*, vector<long double> >& rmgs = *rawMarginalsItr++;
+                map<Genotype*, vector<Probability> >& rmgs = *rawMarginalsItr++;
                 rmgs[sdl.genotype].push_back(gc->posteriorProb);
             }
         } else {
@@ -157,7 +176,7 @@ long double balancedMarginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCom
                 const SampleDataLikelihood& sdl = **i;
                 if (sdl.rank != 0) {
                     isComboKing = false;
-                    map<Genotype*, vector<long double> >& rmgs = *rawMarginalsItr;
+                    map<Genotype*, vector<Probability> >& rmgs = *rawMarginalsItr;
                     rmgs[sdl.genotype].push_back(gc->posteriorProb);
                 }
                 ++rawMarginalsItr;
@@ -166,7 +185,7 @@ long double balancedMarginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCom
                 rawMarginalsItr = rawMarginals.begin();
                 for (GenotypeCombo::const_iterator i = gc->begin(); i != gc->end(); ++i) {
                     const SampleDataLikelihood& sdl = **i;
-                    map<Genotype*, vector<long double> >& rmgs = *rawMarginalsItr++;
+                    map<Genotype*, vector<Probability> >& rmgs = *rawMarginalsItr++;
                     rmgs[sdl.genotype].push_back(gc->posteriorProb);
                 }
             }
@@ -177,17 +196,17 @@ long double balancedMarginalGenotypeLikelihoods(list<GenotypeCombo>& genotypeCom
     rawMarginalsItr = rawMarginals.begin();
     for (SampleDataLikelihoods::iterator s = likelihoods.begin(); s != likelihoods.end(); ++s) {
         vector<SampleDataLikelihood>& sdls = *s;
-        const map<Genotype*, vector<long double> >& rawmgs = *rawMarginalsItr++;
-        map<Genotype*, long double> marginals;
-        vector<long double> rawprobs;
-        for (map<Genotype*, vector<long double> >::const_iterator m = rawmgs.begin(); m != rawmgs.end(); ++m) {
-            long double p = logsumexp_probs(m->second);
+        const map<Genotype*, vector<Probability> >& rawmgs = *rawMarginalsItr++;
+        map<Genotype*, Probability> marginals;
+        vector<Probability> rawprobs;
+        for (map<Genotype*, vector<Probability> >::const_iterator m = rawmgs.begin(); m != rawmgs.end(); ++m) {
+            Probability p = logsumexp_probs(m->second);
             marginals[m->first] = p;
             rawprobs.push_back(p);
         }
-        long double normalizer = logsumexp_probs(rawprobs);
+        Probability normalizer = logsumexp_probs(rawprobs);
         for (vector<SampleDataLikelihood>::iterator sdl = sdls.begin(); sdl != sdls.end(); ++sdl) {
-            long double newmarginal = marginals[sdl->genotype] - normalizer;
+            Probability newmarginal = marginals[sdl->genotype] - normalizer;
             delta += newmarginal - sdl->marginal;
             sdl->marginal = newmarginal;
         }
@@ -0,0 +1,34 @@
+#include "MemoryBudget.h"
+#include "Progress.h"
+#include "Logging.h"
+#include <iostream>
+
+bool MemoryBudget::check(void) {
+    if (!limit) {
+        return false;
+    }
+    bool pressed = pressure.load(memory_order_relaxed);
+    if (pressed) {
+        ++pressedSites;
+    }
+    if (calls++ % MEMORY_BUDGET_CHECK_INTERVAL != 0) {
+        return pressed;
+    }
+    uint64_t resident = residentMemoryBytes();
+    if (!pressed && resident >= limit * MEMORY_PRESSURE_FRACTION) {
+        if (!pressure.exchange(true)) {
+            WARNING("resident memory of " << resident / (1024 * 1024) << "MB is near --max-memory; "
+                    << "downsampling alignments to " << MEMORY_PRESSURE_COVERAGE
+                    << " and keeping " << MEMORY_PRESSURE_COMBOS << " genotype combinations, "
+                    << "and flagging the records this changes MEMLIMIT");
+        }
+        return true;
+    } else if (pressed && resident < limit * MEMORY_EASED_FRACTION) {
+        if (pressure.exchange(false)) {
+            WARNING("resident memory of " << resident / (1024 * 1024) << "MB is back under --max-memory, after "
+                    << pressedSites.exchange(0) << " sites called within its limits");
+        }
+        return false;
+    }
+    return pressed;
+}
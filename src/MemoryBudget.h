@@ -0,0 +1,57 @@
+#ifndef FREEBAYES_MEMORYBUDGET_H
+#define FREEBAYES_MEMORYBUDGET_H
+
+#include <atomic>
+#include <stdint.h>
+
+using namespace std;
+
+// the sites called, by any thread, between looks at the resident memory
+#define MEMORY_BUDGET_CHECK_INTERVAL 256
+
+// the run is pressed once its resident memory passes this share of
+// --max-memory, and eased again once it falls below the second
+#define MEMORY_PRESSURE_FRACTION 0.9
+#define MEMORY_EASED_FRACTION 0.8
+
+// while pressed, the coverage each sample is downsampled to as its
+// alignments are read (as with --limit-coverage), and the genotype
+// combinations kept at each site (as with --max-combos)
+#define MEMORY_PRESSURE_COVERAGE 200
+#define MEMORY_PRESSURE_COMBOS 64
+
+// the resident memory of the run against --max-memory
+//
+// the structures which grow at pathological loci (the registered alignments
+// and their alleles, and the genotype combinations of a site) grow with the
+// alignments over the window and the search, so rather than counting each of
+// them, the budget watches the memory of the process as a whole, which also
+// takes in the reader, the output queue and the allocator.  while it is
+// pressed the parsers downsample their incoming alignments and the callers
+// cap the combinations they keep, and the records whose alignments or
+// combinations were so cut are flagged MEMLIMIT.  gVCF blocks hold a summary of each sample however long they
+// are, so they are left alone.  it is shared by every thread of the run.
+class MemoryBudget {
+
+public:
+
+    MemoryBudget(void) : limit(0), pressure(false), calls(0), pressedSites(0) { }
+
+    void start(uint64_t bytes) { limit = bytes; }
+    bool enabled(void) const { return limit > 0; }
+
+    // called at each site, looks at the resident memory now and then, and
+    // logs when the run is pressed or eased; true while it is pressed
+    bool check(void);
+    bool pressed(void) const { return pressure.load(memory_order_relaxed); }
+
+private:
+
+    uint64_t limit; // bytes, or 0 if there is no budget
+    atomic<bool> pressure;
+    atomic<unsigned long> calls;
+    atomic<unsigned long> pressedSites; // checked while pressed, for the log
+
+};
+
+#endif
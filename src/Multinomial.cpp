@@ -3,12 +3,12 @@
 #include "Product.h"
 
 
-long double multinomialSamplingProb(const vector<long double>& probs, const vector<int>& obs) {
-    vector<long double> factorials;
-    vector<long double> probsPowObs;
+Probability multinomialSamplingProb(const vector<Probability>& probs, const vector<int>& obs) {
+    vector<Probability> factorials;
+    vector<Probability> probsPowObs;
     factorials.resize(obs.size());
     transform(obs.begin(), obs.end(), factorials.begin(), factorial);
-    vector<long double>::const_iterator p = probs.begin();
+    vector<Probability>::const_iterator p = probs.begin();
     vector<int>::const_iterator o = obs.begin();
     for (; p != probs.end() && o != obs.end(); ++p, ++o) {
         probsPowObs.push_back(pow(*p, *o));
@@ -18,30 +18,52 @@ long double multinomialSamplingProb(const vector<long double>& probs, const vect
 
 // TODO rename to reflect the fact that this is the multinomial sampling
 // probability for obs counts given probs probabilities
-long double multinomialSamplingProbLn(const vector<long double>& probs, const vector<int>& obs) {
-    vector<long double> factorials;
-    vector<long double> probsPowObs;
-    factorials.resize(obs.size());
-    transform(obs.begin(), obs.end(), factorials.begin(), factorialln);
-    vector<long double>::const_iterator p = probs.begin();
+Probability multinomialSamplingProbLn(const vector<Probability>& probs, const vector<int>& obs) {
+    // the terms are summed in the order, and with the types, of the sums
+    // they were once collected into
+    int total = 0;
+    Probability factorials = 0;
+    for (vector<int>::const_iterator o = obs.begin(); o != obs.end(); ++o) {
+        total += *o;
+        factorials += factorialln(*o);
+    }
+    Probability probsPowObs = 0;
+    vector<Probability>::const_iterator p = probs.begin();
     vector<int>::const_iterator o = obs.begin();
     for (; p != probs.end() && o != obs.end(); ++p, ++o) {
-        probsPowObs.push_back(powln(log(*p), *o));
+        probsPowObs += powln(log(*p), *o);
+    }
+    return factorialln(total) - factorials + probsPowObs;
+}
+
+Probability multinomialSamplingLnProbs(const Probability* lnProbs, const int* obs, size_t k) {
+    int total = 0;
+    Probability factorials = 0;
+    Probability probsPowObs = 0;
+    for (size_t i = 0; i < k; ++i) {
+        total += obs[i];
+        factorials += factorialln(obs[i]);
+        probsPowObs += powln(lnProbs[i], obs[i]);
     }
-    return factorialln(sum(obs)) - sum(factorials) + sum(probsPowObs);
+    return factorialln(total) - factorials + probsPowObs;
+}
+
+Probability multinomialCoefficientLn(int n, const vector<int>& counts) {
+    return multinomialCoefficientLn(n, counts.data(), counts.size());
 }
 
-long double multinomialCoefficientLn(int n, const vector<int>& counts) {
-    vector<long double> count_factorials;
-    count_factorials.resize(counts.size());
-    transform(counts.begin(), counts.end(), count_factorials.begin(), factorialln);
-    return factorialln(n) - sum(count_factorials);
+Probability multinomialCoefficientLn(int n, const int* counts, size_t k) {
+    Probability factorials = 0;
+    for (size_t i = 0; i < k; ++i) {
+        factorials += factorialln(counts[i]);
+    }
+    return factorialln(n) - factorials;
 }
 
-long double samplingProbLn(const vector<long double>& probs, const vector<int>& obs) {
-    vector<long double>::const_iterator p = probs.begin();
+Probability samplingProbLn(const vector<Probability>& probs, const vector<int>& obs) {
+    vector<Probability>::const_iterator p = probs.begin();
     vector<int>::const_iterator o = obs.begin();
-    long double r = 0;
+    Probability r = 0;
     for (; p != probs.end() && o != obs.end(); ++p, ++o) {
         r += powln(log(*p), *o);
     }
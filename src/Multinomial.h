@@ -4,10 +4,15 @@
 #include "Utility.h"
 #include <vector>
 
-long double multinomialSamplingProb(const vector<long double>& probs, const vector<int>& obs);
-long double multinomialSamplingProbLn(const vector<long double>& probs, const vector<int>& obs);
-long double multinomialCoefficientLn(int n, const vector<int>& counts);
+Probability multinomialSamplingProb(const vector<Probability>& probs, const vector<int>& obs);
+Probability multinomialSamplingProbLn(const vector<Probability>& probs, const vector<int>& obs);
+Probability multinomialCoefficientLn(int n, const vector<int>& counts);
 
-long double samplingProbLn(const vector<long double>& probs, const vector<int>& obs);
+// the same over spans of k counts, which don't allocate; the first takes
+// the logs of the probabilities, as cached by Genotype
+Probability multinomialSamplingLnProbs(const Probability* lnProbs, const int* obs, size_t k);
+Probability multinomialCoefficientLn(int n, const int* counts, size_t k);
+
+Probability samplingProbLn(const vector<Probability>& probs, const vector<int>& obs);
 
 #endif
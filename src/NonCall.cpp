@@ -1,62 +1,22 @@
 #include "NonCall.h"
 
 NonCall NonCalls::aggregateAll(void) {
-    NonCall aggregate;
-    bool first = true;
-    for (NonCalls::const_iterator nc = this->begin(); nc != this->end(); ++nc) {
-        for (map<long, map<string, NonCall> >::const_iterator p
-            = nc->second.begin(); p != nc->second.end(); ++p) {
-            for (map<string, NonCall>::const_iterator s = p->second.begin();
-                 s != p->second.end(); ++s) {
-                const NonCall& nonCall = s->second;
-                aggregate.refCount += nonCall.refCount;
-                aggregate.altCount += nonCall.altCount;
-                aggregate.reflnQ += nonCall.reflnQ;
-                aggregate.altlnQ += nonCall.altlnQ;
-                aggregate.nCount += 1;
-                if (first) {
-                      aggregate.minDepth = nonCall.refCount + nonCall.altCount;
-                      first = false;
-                } else {
-                    aggregate.minDepth = min(aggregate.minDepth,
-                      nonCall.refCount + nonCall.altCount);
-                  }
-            }
-        }
-    }
-    return aggregate;
+    return total;
 }
 
-void NonCalls::aggregatePerSample(map<string, NonCall>& perSample) {
-    set<string> seen;
-    for (NonCalls::const_iterator nc = this->begin(); nc != this->end(); ++nc) {
-        for (map<long, map<string, NonCall> >::const_iterator p = nc->second.begin();
-             p != nc->second.end(); ++p) {
-            for (map<string, NonCall>::const_iterator s = p->second.begin();
-                 s != p->second.end(); ++s) {
-                const string& name = s->first;
-                const NonCall& nonCall = s->second;
-                NonCall& aggregate = perSample[name];
-                aggregate.refCount += nonCall.refCount;
-                aggregate.altCount += nonCall.altCount;
-                aggregate.reflnQ += nonCall.reflnQ;
-                aggregate.altlnQ += nonCall.altlnQ;
-                aggregate.nCount += 1;
-                if (!seen.count(name)) {
-                    aggregate.minDepth = nonCall.refCount + nonCall.altCount;
-                    seen.insert(name);
-                } else {
-                    aggregate.minDepth = min(aggregate.minDepth, nonCall.refCount + nonCall.altCount);
-                }
-            }
-        }
-    }
+void NonCalls::aggregatePerSample(map<string, NonCall>& perSite) {
+    perSite = perSample;
+}
+
+int NonCalls::gqBand(const NonCall& site) {
+    Probability gq = ln2phred(site.reflnQ - site.altlnQ);
+    return upper_bound(gqBands.begin(), gqBands.end(), gq) - gqBands.begin();
 }
 
-void NonCalls::record(const string& seqName, long pos, const Samples& samples) {
-    map<string, NonCall>& site = (*this)[seqName][pos];
+bool NonCalls::record(const string& seq, long pos, const Samples& samples) {
+    // tally ref and non-ref alleles at the site
+    map<string, NonCall> site;
     for (Samples::const_iterator s = samples.begin(); s != samples.end(); ++s) {
-        // tally ref and non-ref alleles
         const string& name = s->first;
         const Sample& sample = s->second;
         NonCall& noncall = site[name];
@@ -74,16 +34,74 @@ void NonCalls::record(const string& seqName, long pos, const Samples& samples) {
             }
         }
     }
+
+    if (!gqBands.empty()) {
+        if (siteCount == 0) {
+            sampleBands.clear();
+            for (map<string, NonCall>::iterator s = site.begin(); s != site.end(); ++s) {
+                sampleBands[s->first] = gqBand(s->second);
+            }
+        } else {
+            // samples without observations have the GQ of an empty site
+            NonCall none;
+            for (map<string, int>::iterator b = sampleBands.begin(); b != sampleBands.end(); ++b) {
+                map<string, NonCall>::iterator s = site.find(b->first);
+                if (gqBand(s != site.end() ? s->second : none) != b->second) {
+                    return false;
+                }
+            }
+            for (map<string, NonCall>::iterator s = site.begin(); s != site.end(); ++s) {
+                if (!sampleBands.count(s->first) && gqBand(s->second) != gqBand(none)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    if (siteCount == 0) {
+        seqName = seq;
+        startPos = pos;
+    }
+    endPos = pos;
+    ++siteCount;
+
+    for (map<string, NonCall>::iterator s = site.begin(); s != site.end(); ++s) {
+        const string& name = s->first;
+        const NonCall& nonCall = s->second;
+        int depth = nonCall.refCount + nonCall.altCount;
+
+        total.refCount += nonCall.refCount;
+        total.altCount += nonCall.altCount;
+        total.reflnQ += nonCall.reflnQ;
+        total.altlnQ += nonCall.altlnQ;
+        total.nCount += 1;
+        total.minDepth = first ? depth : min(total.minDepth, depth);
+        first = false;
+
+        NonCall& aggregate = perSample[name];
+        aggregate.refCount += nonCall.refCount;
+        aggregate.altCount += nonCall.altCount;
+        aggregate.reflnQ += nonCall.reflnQ;
+        aggregate.altlnQ += nonCall.altlnQ;
+        aggregate.minDepth = (aggregate.nCount == 0) ? depth : min(aggregate.minDepth, depth);
+        aggregate.nCount += 1;
+    }
+
+    return true;
+}
+
+void NonCalls::clear(void) {
+    siteCount = 0;
+    total = NonCall();
+    first = true;
+    perSample.clear();
+    sampleBands.clear();
 }
 
 pair<string, long> NonCalls::firstPos(void) {
-    const string& startChrom = begin()->first;
-    long startPos = begin()->second.begin()->first;
-    return make_pair(startChrom, startPos);
+    return make_pair(seqName, startPos);
 }
 
 pair<string, long> NonCalls::lastPos(void) {
-    const string& endChrom = rbegin()->first;
-    long endPos = rbegin()->second.rbegin()->first;
-    return make_pair(endChrom, endPos);
+    return make_pair(seqName, endPos);
 }
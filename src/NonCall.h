@@ -23,7 +23,7 @@ public:
         , nCount(0)
 
     { }
-    NonCall(int rc, long double rq, int ac, long double aq, int mdp)
+    NonCall(int rc, Probability rq, int ac, Probability aq, int mdp)
         : refCount(rc)
         , reflnQ(rq)
         , altCount(ac)
@@ -34,17 +34,44 @@ public:
     int altCount;
     int minDepth;
     int nCount  ; 
-    long double reflnQ;
-    long double altlnQ;
+    Probability reflnQ;
+    Probability altlnQ;
 };
 
-class NonCalls : public map<string, map<long, map<string, NonCall> > > {
+// the running gVCF reference block
+//
+// sites are folded into the block as they are recorded, so that only one
+// NonCall per sample is held however long the block gets.  when GQ bands are
+// given, a site only joins the block if each sample's GQ at the site falls in
+// the same band as at the first site of the block.
+class NonCalls {
 public:
-    void record(const string& seqName, long pos, const Samples& samples);
+    NonCalls(void) : startPos(0), endPos(0), siteCount(0), first(true) { }
+    // bands are given by their lower GQ bounds, in increasing order
+    NonCalls(const vector<int>& bands) : gqBands(bands), startPos(0), endPos(0), siteCount(0), first(true) { }
+
+    // adds the site to the block and returns true, or, if the site doesn't
+    // belong in the block, returns false and leaves the block as it is
+    bool record(const string& seqName, long pos, const Samples& samples);
     NonCall aggregateAll(void);
     void aggregatePerSample(map<string, NonCall>& perSite);
     pair<string, long> firstPos(void);
     pair<string, long> lastPos(void);
+    bool empty(void) const { return siteCount == 0; }
+    void clear(void);
+
+private:
+    int gqBand(const NonCall& site);
+
+    vector<int> gqBands;
+    string seqName;
+    long startPos;
+    long endPos;
+    long siteCount;
+    NonCall total;                  // over every sample at every site
+    bool first;                     // total has no site yet
+    map<string, NonCall> perSample; // over every site
+    map<string, int> sampleBands;   // the GQ band of each sample in the block
 };
 
 #endif
@@ -0,0 +1,70 @@
+#include "Numa.h"
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+bool parseCpuList(const string& list, vector<int>& cpus) {
+    stringstream ranges(list);
+    string range;
+    while (getline(ranges, range, ',')) {
+        if (range.empty() || range == "\n") {
+            continue;
+        }
+        char* end;
+        long first = strtol(range.c_str(), &end, 10);
+        long last = first;
+        if (*end == '-') {
+            last = strtol(end + 1, &end, 10);
+        }
+        if ((*end != '\0' && *end != '\n') || first < 0 || last < first) {
+            return false;
+        }
+        for (long c = first; c <= last; ++c) {
+            cpus.push_back(c);
+        }
+    }
+    return true;
+}
+
+bool NumaTopology::load(void) {
+    nodeCpus.clear();
+#ifdef __linux__
+    // nodes may be numbered with gaps, so look a little past the last found
+    for (int node = 0, missing = 0; missing < 64; ++node) {
+        stringstream path;
+        path << "/sys/devices/system/node/node" << node << "/cpulist";
+        ifstream in(path.str().c_str());
+        if (!in) {
+            ++missing;
+            continue;
+        }
+        missing = 0;
+        string list;
+        getline(in, list);
+        vector<int> cpus;
+        if (parseCpuList(list, cpus) && !cpus.empty()) {
+            nodeCpus.push_back(cpus);
+        }
+    }
+#endif
+    return !nodeCpus.empty();
+}
+
+bool pinThreadToCpus(const vector<int>& cpus) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (vector<int>::const_iterator c = cpus.begin(); c != cpus.end(); ++c) {
+        if (*c < CPU_SETSIZE) {
+            CPU_SET(*c, &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
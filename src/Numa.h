@@ -0,0 +1,35 @@
+#ifndef FREEBAYES_NUMA_H
+#define FREEBAYES_NUMA_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// the NUMA nodes of the machine and the CPUs of each, for --numa
+//
+// these are read from the node directories under /sys, so there is no
+// dependency on libnuma.  a machine without them, or which isn't Linux, has
+// no nodes, and --numa places nothing.
+class NumaTopology {
+
+public:
+
+    // returns false if the machine has no NUMA nodes we can see
+    bool load(void);
+
+    size_t nodes(void) const { return nodeCpus.size(); }
+
+    // the CPUs of each node, which have any
+    vector<vector<int> > nodeCpus;
+
+};
+
+// parses a Linux CPU list, such as "0-3,8-11", into its CPUs
+bool parseCpuList(const string& list, vector<int>& cpus);
+
+// keeps the calling thread, and the threads it starts from now on, to the
+// CPUs.  memory the thread touches first is then allocated on their node.
+bool pinThreadToCpus(const vector<int>& cpus);
+
+#endif
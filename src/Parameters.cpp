@@ -1,8 +1,59 @@
 #include "Parameters.h"
 #include "convert.h"
+#include "LikelihoodEngine.h"
 
 using namespace std;
 
+// long options which have no single-character form are given ids outside of
+// the range of characters used by getopt
+enum LongOnlyOptions {
+    OPT_THREADS = 256,
+    OPT_AUTO_REGIONS,
+    OPT_DECOMPRESS_THREADS,
+    OPT_PREFETCH_ALIGNMENTS,
+    OPT_IDLE_ALIGNMENT_FILES,
+    OPT_GVCF_GQ_BANDS,
+    OPT_GENOTYPING_THREADS,
+    OPT_MAX_COMBOS,
+    OPT_OUTPUT_FORMAT,
+    OPT_COMPRESS_THREADS,
+    OPT_LIKELIHOOD_DUMP,
+    OPT_JOINT_LIKELIHOODS,
+    OPT_PROFILE_REPORT,
+    OPT_SLOW_SITE_LOG,
+    OPT_SLOW_SITE_TIME,
+    OPT_MAX_SITE_TIME,
+    OPT_PROGRESS,
+    OPT_PROGRESS_FILE,
+    OPT_USE_BEST_N_INDELS,
+    OPT_POOL_FREQUENCY_GRID,
+    OPT_SERVE,
+    OPT_OPEN_THREADS,
+    OPT_HEADER_CACHE,
+    OPT_RANDOM_SEED,
+    OPT_NUMA,
+    OPT_TRACE,
+    OPT_TRACE_REGION,
+    OPT_TRACE_SAMPLE,
+    OPT_CHECKPOINT,
+    OPT_CHECKPOINT_INTERVAL,
+    OPT_RESUME,
+    OPT_LIKELIHOOD_CACHE,
+    OPT_EMIT_QUEUE,
+    OPT_LIKELIHOOD_ENGINE,
+    OPT_GL_MARGIN,
+    OPT_LOCAL_ALLELES,
+    OPT_EMIT_SHARDS,
+    OPT_SHARD,
+    OPT_MERGE_SHARDS,
+    OPT_REMOTE_READ_AHEAD,
+    OPT_MERGE_OVERLAPPING_MATES,
+    OPT_MAX_HAPLOTYPE_COST,
+    OPT_GENOTYPING_TOLERANCE,
+    OPT_MAX_MEMORY,
+    OPT_BATCH
+};
+
 void Parameters::simpleUsage(char ** argv) {
     cout
         << "usage: " << argv[0] << " -f [REFERENCE] [OPTIONS] [BAM FILES] >[OUTPUT]" << endl
@@ -103,9 +154,15 @@ void Parameters::usage(char** argv) {
         << "   -L --bam-list FILE" << endl
         << "                   A file containing a list of BAM files to be analyzed." << endl
         << "   -c --stdin      Read BAM input on stdin." << endl
+        << "   --joint-likelihoods FILE" << endl
+        << "                   Genotype the samples of the likelihood dump FILE, written by" << endl
+        << "                   --likelihood-dump, jointly with those of the other dumps given," << endl
+        << "                   in place of reading alignments.  May be given multiple times." << endl
         << "   -f --fasta-reference FILE" << endl
         << "                   Use FILE as the reference sequence for analysis." << endl
         << "                   An index file (FILE.fai) will be created if none exists." << endl
+        << "                   FILE may be bgzip-compressed, in which case its block" << endl
+        << "                   index (FILE.gzi) is also created if none exists." << endl
         << "                   If neither --targets nor --region are specified, FreeBayes" << endl
         << "                   will analyze every position in this reference." << endl
         << "   -t --targets FILE" << endl
@@ -135,6 +192,33 @@ void Parameters::usage(char** argv) {
         << "output:" << endl
         << endl
         << "   -v --vcf FILE   Output VCF-format results to FILE. (default: stdout)" << endl
+        << "                   If FILE ends in .gz it is written BGZF-compressed and given a" << endl
+        << "                   tabix index (CSI for sequences over 2^29 bases) as it is written." << endl
+        << "   --output-format FORMAT" << endl
+        << "                   Write the results as vcf, bcf (compressed BCF) or ubcf" << endl
+        << "                   (uncompressed BCF).  BCF records are encoded directly rather" << endl
+        << "                   than formatted as text.  BCF files are given a CSI index as they" << endl
+        << "                   are written.  default: vcf" << endl
+        << "   --compress-threads N" << endl
+        << "                   Compress the blocks of BGZF-compressed VCF or BCF output on N" << endl
+        << "                   threads of htslib's thread pool.  default: 0 (off)" << endl
+        << "   --serve SOCKET" << endl
+        << "                   Open the reference and alignments once, then answer requests" << endl
+        << "                   on the Unix socket SOCKET, one connection at a time.  Each" << endl
+        << "                   request is a line of regions, as given to --region, separated" << endl
+        << "                   by spaces, and is answered with the VCF of those regions, after" << endl
+        << "                   which the connection is closed." << endl
+        << "   --likelihood-dump FILE" << endl
+        << "                   Also write the genotype likelihoods and the allele observation" << endl
+        << "                   counts and quality sums of every sample at every genotyped site" << endl
+        << "                   to FILE, in a binary columnar format, so the samples can later" << endl
+        << "                   be genotyped together without their alignments." << endl
+        << "   --likelihood-cache DIR" << endl
+        << "                   Call each BAM file alone into a likelihood dump kept in DIR," << endl
+        << "                   then genotype the dumps together as --joint-likelihoods does." << endl
+        << "                   The dump of a file is reused by later runs for as long as the" << endl
+        << "                   file and the calling arguments are unchanged, so that only new" << endl
+        << "                   or changed files are read." << endl
         << "   --gvcf" << endl
         << "                   Write gVCF output, which indicates coverage in uncalled regions." << endl
         << "   --gvcf-chunk NUM" << endl
@@ -143,10 +227,15 @@ void Parameters::usage(char** argv) {
         << "                   When writing the gVCF output emit a record for all bases if" << endl
         << "                   set to \"true\" , will also route an int to --gvcf-chunk" << endl
         << "                   similar to --output-mode EMIT_ALL_SITES from GATK" << endl
+        << "   --gvcf-gq-bands LIST" << endl
+        << "                   When writing gVCF output, also end a record wherever the GQ" << endl
+        << "                   of a sample moves into a different band.  LIST gives the lower" << endl
+        << "                   bound of each band, e.g. 10,20,30,40,50,60. (default: no bands)" << endl
         << "   -@ --variant-input VCF" << endl
         << "                   Use variants reported in VCF file as input to the algorithm." << endl
         << "                   Variants in this file will included in the output even if" << endl
         << "                   there is not enough support in the data to pass input filters." << endl
+        << "                   VCF may also be an index of its alleles built by indexalleles." << endl
         << "   -l --only-use-input-alleles" << endl
         << "                   Only provide variant calls and genotype likelihoods for sites" << endl
         << "                   and alleles which are provided in the VCF input, and provide" << endl
@@ -156,6 +245,7 @@ void Parameters::usage(char** argv) {
         << "                   When specified, only variant alleles provided in this input" << endl
         << "                   VCF will be used for the construction of complex or haplotype" << endl
         << "                   alleles." << endl
+        << "                   VCF may also be an index of its alleles built by indexalleles." << endl
         << "   --report-all-haplotype-alleles" << endl
         << "                   At sites where genotypes are made over haplotype alleles," << endl
         << "                   provide information about all alleles in output, not only" << endl
@@ -169,6 +259,12 @@ void Parameters::usage(char** argv) {
         << "                   filtering is generally recommended over the use of this parameter." << endl
         << "   --strict-vcf" << endl
         << "                   Generate strict VCF format (FORMAT/GQ will be an int)" << endl
+        << "   --local-alleles" << endl
+        << "                   At records with more than one alternate, write the per-allele" << endl
+        << "                   fields of each sample over only the alternates it has observed" << endl
+        << "                   or been called with, as LAA, LAD, LAO, LQA and LGL in place of" << endl
+        << "                   AD, AO, QA and GL.  This keeps large cohorts with many alleles" << endl
+        << "                   from carrying a GL for every genotype of every sample." << endl
         << endl
         << "population model:" << endl
         << endl
@@ -183,6 +279,12 @@ void Parameters::usage(char** argv) {
         << "                   When using this flag, set --ploidy to the number of" << endl
         << "                   alleles in each sample or use the --cnv-map to define" << endl
         << "                   per-sample ploidy." << endl
+        << "   --pool-frequency-grid N" << endl
+        << "                   For samples of ploidy above N, consider only the genotypes" << endl
+        << "                   whose allele frequencies fall on N+1 evenly spaced points, so" << endl
+        << "                   that the genotypes of large pools grow with N rather than" << endl
+        << "                   the ploidy.  Genotype likelihoods are then not output." << endl
+        << "                   (Set to 0 to consider every genotype; default: 0)" << endl
         << "   -K --pooled-continuous" << endl
         << "                   Output all alleles which pass input filters, regardles of" << endl
         << "                   genotyping outcome or model." << endl
@@ -201,10 +303,21 @@ void Parameters::usage(char** argv) {
         << "   -n --use-best-n-alleles N" << endl
         << "                   Evaluate only the best N SNP alleles, ranked by sum of" << endl
         << "                   supporting quality scores.  (Set to 0 to use all; default: all)" << endl
+        << "   --use-best-n-indels N" << endl
+        << "                   Evaluate only the best N indel, MNP and complex alleles," << endl
+        << "                   ranked apart from the SNP alleles, which -n then limits" << endl
+        << "                   alone.  (Set to 0 to rank them together under -n; default: 0)" << endl
         << "   -E --max-complex-gap N" << endl
         << "      --haplotype-length N" << endl
         << "                   Allow haplotype calls with contiguous embedded matches of up" << endl
         << "                   to this length. Set N=-1 to disable clumping. (default: 3)" << endl
+        << "   --max-haplotype-cost N" << endl
+        << "                   Stop growing a haplotype over repeats and overlapping alleles" << endl
+        << "                   once its candidate alleles times the samples times the" << endl
+        << "                   genotypes of those alleles passes N, keeping it to the length" << endl
+        << "                   of the alleles at the site, and drop the least supported" << endl
+        << "                   alleles until it fits.  Such records are flagged HCAP." << endl
+        << "                   default: 0 (no limit)" << endl
         << "   --min-repeat-size N" << endl
         << "                   When assembling observations across repeats, require the total repeat" << endl
         << "                   length at least this many bp.  (default: 5)" << endl
@@ -243,6 +356,11 @@ void Parameters::usage(char** argv) {
         << "   -4 --use-duplicate-reads" << endl
         << "                   Include duplicate-marked alignments in the analysis." << endl
         << "                   default: exclude duplicates marked as such in alignments" << endl
+        << "   --merge-overlapping-mates" << endl
+        << "                   Count the bases where the mates of a pair overlap once," << endl
+        << "                   as observations of the first mate with the quality of" << endl
+        << "                   both: their sum (up to 60) where they agree, and their" << endl
+        << "                   difference where they don't.  default: count each mate" << endl
         << "   -m --min-mapping-quality Q" << endl
         << "                   Exclude alignments from analysis if they have a mapping" << endl
         << "                   quality less than Q.  default: 1" << endl
@@ -295,7 +413,15 @@ void Parameters::usage(char** argv) {
         << "                   Require at least this coverage to process a site. default: 0" << endl
         << "   --limit-coverage N" << endl
         << "                   Downsample per-sample coverage to this level if greater than this coverage." << endl
+        << "                   Reads are dropped as they are read, before they are broken into" << endl
+        << "                   alleles, choosing among those starting at a position by a hash" << endl
+        << "                   of the read name, so the mates of a pair rank alike, though" << endl
+        << "                   the depth where each starts may keep one and drop the other." << endl
+        << "                   The reads kept are the same whatever the threads or regions." << endl
         << "                   default: no limit" << endl
+        << "   --random-seed N" << endl
+        << "                   Seed the hash by which --limit-coverage chooses reads, to draw" << endl
+        << "                   a different, but as reproducible, set of them.  default: 0" << endl
         << "   -g --skip-coverage N" << endl
         << "                   Skip processing of alignments overlapping positions with coverage >N." << endl
         << "                   This filters sites above this coverage, but will also reduce data nearby." << endl
@@ -347,9 +473,41 @@ void Parameters::usage(char** argv) {
         << "                   from genotype likelihoods." << endl
         << "   -B --genotyping-max-iterations N" << endl
         << "                   Iterate no more than N times during genotyping step. default: 1000." << endl
+        << "   --genotyping-tolerance N" << endl
+        << "                   Stop the genotype search once an iteration raises the posterior" << endl
+        << "                   of the best genotype combination by less than N (log10), and" << endl
+        << "                   keep the combinations of each iteration so that the last" << endl
+        << "                   needn't be searched again.  default: 0 (iterate until the best" << endl
+        << "                   combination holds)" << endl
         << "   --genotyping-max-banddepth N" << endl
         << "                   Integrate no deeper than the Nth best genotype by likelihood when" << endl
         << "                   genotyping. default: 6." << endl
+        << "   --max-combos N" << endl
+        << "                   Keep no more than the N most probable genotype combinations" << endl
+        << "                   at each site, besides the best and the homozygous ones, so" << endl
+        << "                   that memory doesn't grow with the search.  The posterior mass" << endl
+        << "                   of the combinations dropped is still counted when normalizing." << endl
+        << "                   default: 0 (keep all)" << endl
+        << "   --gl-margin N" << endl
+        << "                   Keep for each sample only the genotypes whose likelihood is" << endl
+        << "                   within N (log10) of its best, besides the homozygous ones, so" << endl
+        << "                   that sites with many alleles don't carry every genotype of" << endl
+        << "                   every sample through the search.  The GLs of the genotypes" << endl
+        << "                   left out are reported as N below the best." << endl
+        << "                   default: 0 (keep all)" << endl
+        << "   --max-site-time SECONDS" << endl
+        << "                   Spend no more than SECONDS of wall time on a site: once it's" << endl
+        << "                   spent, the genotype search stops where it is, or if it hasn't" << endl
+        << "                   begun, takes the data likelihood maximum and the homozygous" << endl
+        << "                   combinations in its place.  Such records are flagged APPROX." << endl
+        << "                   default: 0 (no limit)" << endl
+        << "   --max-memory MB" << endl
+        << "                   Keep the resident memory of the run under MB megabytes: as it" << endl
+        << "                   nears them, downsample the incoming alignments of each sample" << endl
+        << "                   to a depth of 200 and keep no more than 64 genotype" << endl
+        << "                   combinations at each site, until it falls back.  Records" << endl
+        << "                   these limits changed are flagged MEMLIMIT." << endl
+        << "                   default: 0 (no limit)" << endl
         << "   -W --posterior-integration-limits N,M" << endl
         << "                   Integrate all genotype combinations in our posterior space" << endl
         << "                   which include no more than N samples with their Mth best" << endl
@@ -373,10 +531,138 @@ void Parameters::usage(char** argv) {
         << "                   Calculate the marginal probability of genotypes and report as GQ in" << endl
         << "                   each sample field in the VCF output." << endl
         << endl
+        << "parallelism:" << endl
+        << endl
+        << "   --threads N     Call N regions at a time in separate threads of this process." << endl
+        << "                   Targets (or, if none are given, the reference sequences) are" << endl
+        << "                   split into regions which are called independently, and the" << endl
+        << "                   results are written in the order of the regions.  Requires" << endl
+        << "                   indexed alignment input; not compatible with --stdin.  default: 1" << endl
+        << "   --auto-regions N" << endl
+        << "                   When calling with --threads, split the targets into N regions" << endl
+        << "                   of roughly equal work, estimated from the amount of data the" << endl
+        << "                   alignment indexes (BAI/CSI/CRAI) assign to each part of the" << endl
+        << "                   genome, rather than into regions of a fixed size.  default: 0 (off)" << endl
+        << "   --emit-shards N:FILE" << endl
+        << "                   Write to FILE a plan splitting the targets into N shards of" << endl
+        << "                   roughly equal work, balanced as with --auto-regions, to be" << endl
+        << "                   called as separate processes, and exit.  Each shard owns a list" << endl
+        << "                   of intervals of the targets, and is called over them padded by" << endl
+        << "                   1000bp, so calls at their edges see what a single run would." << endl
+        << "                   Targets with too little data to split N ways get fewer shards," << endl
+        << "                   with a warning giving how many." << endl
+        << "   --shard FILE:I  Call shard I (0-based) of the plan in FILE, in place of the" << endl
+        << "                   targets, given the arguments the plan was made with." << endl
+        << "   --merge-shards FILE" << endl
+        << "                   Given the VCF outputs of the shards of the plan in FILE in place" << endl
+        << "                   of alignment files, in the order of the shards, write the records" << endl
+        << "                   of each which begin in the intervals it owns, so each record is" << endl
+        << "                   written once and in order, without a sort." << endl
+        << "   --batch FILE    Call each of the jobs listed in FILE, a line of an alignment" << endl
+        << "                   file, its reference and the VCF to write, tab-separated, with" << endl
+        << "                   the rest of the arguments, in this one process.  With" << endl
+        << "                   --threads N, N jobs are called at a time, each on one thread." << endl
+        << "                   For runs over many small genomes, where starting a process" << endl
+        << "                   for each would cost more than calling it." << endl
+        << "   --numa          When calling with --threads, keep each calling thread, and its" << endl
+        << "                   --genotyping-threads team, to the CPUs of one NUMA node, taking" << endl
+        << "                   the nodes in turn, so that the memory each thread works in is" << endl
+        << "                   local to it.  --profile-report gives the threads of each node." << endl
+        << "   --checkpoint DIR" << endl
+        << "                   Every --checkpoint-interval, record in DIR how much of the output" << endl
+        << "                   is complete, so that a run which is stopped can be picked up" << endl
+        << "                   with --resume.  The run is called in regions, as with --threads," << endl
+        << "                   even on one thread.  Requires an output file (-v)." << endl
+        << "   --checkpoint-interval SECONDS" << endl
+        << "                   The least time between checkpoints.  default: 300" << endl
+        << "   --resume        Continue the run recorded by --checkpoint, given with the same" << endl
+        << "                   arguments: cut the output back to the last checkpoint and call" << endl
+        << "                   the regions after it, appending to the output.  Output written" << endl
+        << "                   through htslib isn't indexed when it is resumed." << endl
+        << "   --decompress-threads N" << endl
+        << "                   Use a pool of N threads, shared by all of the input alignment" << endl
+        << "                   files, to inflate BAM blocks and decode CRAM slices, rather" << endl
+        << "                   than doing so on the threads which parse the alignments." << endl
+        << "                   default: 0 (off)" << endl
+        << "   --prefetch-alignments N" << endl
+        << "                   Read and filter alignments on a separate thread, holding up to" << endl
+        << "                   N batches of alignments ahead of the caller, so that slow input" << endl
+        << "                   (e.g. from a network filesystem) overlaps with genotyping." << endl
+        << "                   default: 0 (off), or 8 with --stdin" << endl
+        << "   --remote-read-ahead BYTES" << endl
+        << "                   Read alignment files given as URLs (https://, s3://, gs://) in" << endl
+        << "                   requests of BYTES, so that each range request brings in many of" << endl
+        << "                   the BGZF blocks or CRAM containers which follow.  With" << endl
+        << "                   --prefetch-alignments, the requests run ahead of the caller." << endl
+        << "                   0 leaves it to htslib.  default: 4194304" << endl
+        << "   --idle-alignment-files N" << endl
+        << "                   Keep at most N input alignment files open while they have no" << endl
+        << "                   alignments in the region being read.  The rest are closed," << endl
+        << "                   keeping their BAM indexes, until a region their index has data" << endl
+        << "                   in, which bounds the file handles of runs over thousands of" << endl
+        << "                   files.  0 keeps every file open.  default: 256" << endl
+        << "   --open-threads N" << endl
+        << "                   Open the input alignment files and read their headers, and" << endl
+        << "                   load their indexes for each region, N files at a time on as" << endl
+        << "                   many threads, for many files on slow storage.  default: 8" << endl
+        << "   --header-cache FILE" << endl
+        << "                   Keep the headers of the input alignment files in FILE, by their" << endl
+        << "                   sizes and modification times, so that later runs over the same" << endl
+        << "                   files open them only when a region needs them." << endl
+        << "   --genotyping-threads N" << endl
+        << "                   Use a team of N threads for each calling thread to search the" << endl
+        << "                   genotype combinations at sites with many samples, so that a few" << endl
+        << "                   hard sites in a large cohort don't hold up their region.  When" << endl
+        << "                   --populations gives several populations, the team searches" << endl
+        << "                   them concurrently instead.  The team also scores the data" << endl
+        << "                   likelihoods of the samples and fills in the sample columns of" << endl
+        << "                   records at sites with many samples.  May be combined with" << endl
+        << "                   --threads.  default: 1" << endl
+        << "   --likelihood-engine NAME" << endl
+        << "                   Score the genotype likelihoods of the samples of each site" << endl
+        << "                   with the named engine.  This build has: " << likelihoodEngineNames() << endl
+        << "                   default: cpu" << endl
+        << "   --emit-queue N" << endl
+        << "                   When calling on a single thread, format and write the records" << endl
+        << "                   on a thread of their own while the next sites are called," << endl
+        << "                   queueing at most N of them.  Helps most with many samples," << endl
+        << "                   each of which adds a column to every record.  default: 0" << endl
+        << endl
         << "debugging:" << endl
         << endl
         << "   -d --debug      Print debugging output." << endl
         << "   -dd             Print more verbose debugging output (requires \"make DEBUG\")" << endl
+        << "   --profile-report FILE" << endl
+        << "                   Write the wall and CPU time spent in each stage of the main" << endl
+        << "                   loop and the number of calls to it, histograms of the genotyping" << endl
+        << "                   iterations, genotype combinations and observations at each site," << endl
+        << "                   the counts of sites seen and processed, and counters of the work" << endl
+        << "                   done, which don't depend on the machine, to FILE as JSON." << endl
+        << "   --slow-site-log FILE" << endl
+        << "                   Write each site which takes longer than --slow-site-time to" << endl
+        << "                   call to the BED file FILE, with the time taken, coverage, number" << endl
+        << "                   of genotype alleles, haplotype length, genotyping iterations and" << endl
+        << "                   genotype combinations, to find the sites which hold up a run." << endl
+        << "   --trace FILE    Write the observations and genotype data likelihoods of each" << endl
+        << "                   sample at each site genotyped to FILE, as a JSON object per" << endl
+        << "                   sample and site on a line of its own." << endl
+        << "   --trace-region REGION" << endl
+        << "                   Trace only the sites in REGION, given as to --region.  May be" << endl
+        << "                   given more than once.  default: every site" << endl
+        << "   --trace-sample NAME" << endl
+        << "                   Trace only the sample NAME.  May be given more than once." << endl
+        << "                   default: every sample" << endl
+        << "   --slow-site-time SECONDS" << endl
+        << "                   The wall time past which --slow-site-log logs a site.  default: 1" << endl
+        << "   --progress SECONDS" << endl
+        << "                   Every SECONDS, report the current position of each thread, the" << endl
+        << "                   bases and sites processed per second, the alignments held in" << endl
+        << "                   memory, the resident memory and the estimated time remaining" << endl
+        << "                   over the targets, as a line on stderr.  default: 0 (off)" << endl
+        << "   --progress-file FILE" << endl
+        << "                   Rewrite FILE with the --progress metrics in the Prometheus text" << endl
+        << "                   format instead, e.g. for the node_exporter textfile collector." << endl
+        << "                   Reports every 10 seconds unless --progress is given." << endl
         << endl
         << endl
         << "author:   Erik Garrison <erik.garrison@gmail.com>" << endl
@@ -410,6 +696,17 @@ Parameters::Parameters(int argc, char** argv) {
     cnvFile = "";
     output = "vcf";               // -v --vcf
     outputFile = "";
+    outputFormat = "vcf";         // --output-format
+    compressThreads = 0;          // --compress-threads
+    serveSocket = "";             // --serve
+    likelihoodDumpFile = "";      // --likelihood-dump
+    likelihoodCacheDir = "";      // --likelihood-cache
+    profileReportFile = "";       // --profile-report
+    slowSiteLogFile = "";         // --slow-site-log
+    traceFile = "";               // --trace
+    slowSiteTime = 1;             // --slow-site-time
+    progressInterval = 0;         // --progress
+    progressFile = "";            // --progress-file
     gVCFout = false;
     gVCFchunk = 0;
     gVCFNoChunk = false;         // --gvcf-no-chunk sets this to true
@@ -417,8 +714,10 @@ Parameters::Parameters(int argc, char** argv) {
 
     // operation parameters
     useDuplicateReads = false;      // -E --use-duplicate-reads
+    mergeOverlappingMates = false;  // --merge-overlapping-mates
     suppressOutput = false;         // -N --suppress-output
     useBestNAlleles = 0;         // -n --use-best-n-alleles
+    useBestNIndels = 0;          // --use-best-n-indels
     forceRefAllele = false;         // -Z --use-reference-allele
     useRefAllele = false;           // .....
     diploidReference = false;      // -H --diploid-reference
@@ -428,13 +727,16 @@ Parameters::Parameters(int argc, char** argv) {
     allowSNPs = true;          // -I --no-snps
     allowComplex = true;
     strictVCF = false;
+    localAlleles = false;         // --local-alleles
     maxComplexGap = 3;
+    maxHaplotypeCost = 0;         // --max-haplotype-cost
     //maxHaplotypeLength = 100;
     minRepeatSize = 5;
     minRepeatEntropy = 1;
     usePartialObservations = true;
     pooledDiscrete = false;                 // -J --pooled
     pooledContinuous = false;
+    poolFrequencyGrid = 0;        // --pool-frequency-grid
     ewensPriors = true;
     permute = true;                // -K --permute
     useMappingQuality = false;
@@ -448,7 +750,12 @@ Parameters::Parameters(int argc, char** argv) {
     siteSelectionMaxIterations = 5;
     reportGenotypeLikelihoodMax = false;
     genotypingMaxIterations = 1000;
+    genotypingTolerance = 0;      // --genotyping-tolerance
     genotypingMaxBandDepth = 7;
+    maxCombos = 0;
+    glMargin = 0;                 // --gl-margin
+    maxSiteTime = 0;                // --max-site-time
+    maxMemory = 0;                  // --max-memory
     minPairedAltCount = 0;
     minAltMeanMapQ = 0;
     limitGL = 0;
@@ -487,8 +794,30 @@ Parameters::Parameters(int argc, char** argv) {
     //minAltQSumTotal = 0;
     minCoverage = 0;
     limitCoverage = 0;
+    randomSeed = 0;               // --random-seed
     skipCoverage = 0;
     trimComplexTail = 0;
+    threads = 1;
+    autoRegions = 0;
+    emitShards = 0;               // --emit-shards
+    emitShardsFile = "";
+    shardPlanFile = "";           // --shard
+    shardIndex = -1;
+    mergeShardsFile = "";         // --merge-shards
+    batchFile = "";               // --batch
+    numa = false;                 // --numa
+    checkpointDir = "";           // --checkpoint
+    checkpointInterval = 300;     // --checkpoint-interval
+    resume = false;               // --resume
+    decompressThreads = 0;
+    prefetchAlignments = 0;
+    remoteReadAhead = 4194304;    // --remote-read-ahead
+    idleAlignmentFiles = 256;
+    openThreads = 8;
+    headerCacheFile = "";
+    genotypingThreads = 1;
+    emitQueue = 0;                // --emit-queue
+    likelihoodEngine = "cpu";     // --likelihood-engine
     debuglevel = 0;
     debug = false;
     debug2 = false;
@@ -514,9 +843,12 @@ Parameters::Parameters(int argc, char** argv) {
             {"gvcf", no_argument, 0, '8'},
             {"gvcf-chunk", required_argument, 0, '&'},
             {"gvcf-dont-use-chunk", required_argument, 0 , '&'},
+            {"gvcf-gq-bands", required_argument, 0, OPT_GVCF_GQ_BANDS},
             {"use-duplicate-reads", no_argument, 0, '4'},
+            {"merge-overlapping-mates", no_argument, 0, OPT_MERGE_OVERLAPPING_MATES},
             {"no-partial-observations", no_argument, 0, '['},
             {"use-best-n-alleles", required_argument, 0, 'n'},
+            {"use-best-n-indels", required_argument, 0, OPT_USE_BEST_N_INDELS},
             {"use-reference-allele", no_argument, 0, 'Z'},
             {"harmonic-indel-quality", no_argument, 0, 'H'},
             {"standard-filters", no_argument, 0, '0'},
@@ -524,6 +856,7 @@ Parameters::Parameters(int argc, char** argv) {
             {"ploidy", required_argument, 0, 'p'},
             {"pooled-discrete", no_argument, 0, 'J'},
             {"pooled-continuous", no_argument, 0, 'K'},
+            {"pool-frequency-grid", required_argument, 0, OPT_POOL_FREQUENCY_GRID},
             {"no-population-priors", no_argument, 0, 'k'},
             {"use-mapping-quality", no_argument, 0, 'j'},
             {"min-mapping-quality", required_argument, 0, 'm'},
@@ -548,6 +881,7 @@ Parameters::Parameters(int argc, char** argv) {
             {"theta", required_argument, 0, 'T'},
             {"pvar", required_argument, 0, 'P'},
             {"strict-vcf", no_argument, 0, '/'},
+            {"local-alleles", no_argument, 0, OPT_LOCAL_ALLELES},
             {"read-dependence-factor", required_argument, 0, 'D'},
             {"binomial-obs-priors-off", no_argument, 0, 'V'},
             {"allele-balance-priors-off", no_argument, 0, 'a'},
@@ -563,6 +897,7 @@ Parameters::Parameters(int argc, char** argv) {
             {"min-coverage", required_argument, 0, '!'},
             {"limit-coverage", required_argument, 0, '+'},
             {"skip-coverage", required_argument, 0, 'g'},
+            {"random-seed", required_argument, 0, OPT_RANDOM_SEED},
             {"trim-complex-tail", no_argument, 0, ']'},
             {"genotype-qualities", no_argument, 0, '='},
             {"variant-input", required_argument, 0, '@'},
@@ -572,7 +907,27 @@ Parameters::Parameters(int argc, char** argv) {
             {"genotype-variant-threshold", required_argument, 0, 'S'},
             {"site-selection-max-iterations", required_argument, 0, 'M'},
             {"genotyping-max-iterations", required_argument, 0, 'B'},
+            {"genotyping-tolerance", required_argument, 0, OPT_GENOTYPING_TOLERANCE},
             {"genotyping-max-banddepth", required_argument, 0, '7'},
+            {"max-combos", required_argument, 0, OPT_MAX_COMBOS},
+            {"gl-margin", required_argument, 0, OPT_GL_MARGIN},
+            {"output-format", required_argument, 0, OPT_OUTPUT_FORMAT},
+            {"compress-threads", required_argument, 0, OPT_COMPRESS_THREADS},
+            {"serve", required_argument, 0, OPT_SERVE},
+            {"likelihood-dump", required_argument, 0, OPT_LIKELIHOOD_DUMP},
+            {"likelihood-cache", required_argument, 0, OPT_LIKELIHOOD_CACHE},
+            {"joint-likelihoods", required_argument, 0, OPT_JOINT_LIKELIHOODS},
+            {"profile-report", required_argument, 0, OPT_PROFILE_REPORT},
+            {"slow-site-log", required_argument, 0, OPT_SLOW_SITE_LOG},
+            {"trace", required_argument, 0, OPT_TRACE},
+            {"trace-region", required_argument, 0, OPT_TRACE_REGION},
+            {"trace-sample", required_argument, 0, OPT_TRACE_SAMPLE},
+            {"slow-site-time", required_argument, 0, OPT_SLOW_SITE_TIME},
+            {"max-site-time", required_argument, 0, OPT_MAX_SITE_TIME},
+            {"max-memory", required_argument, 0, OPT_MAX_MEMORY},
+            {"max-haplotype-cost", required_argument, 0, OPT_MAX_HAPLOTYPE_COST},
+            {"progress", required_argument, 0, OPT_PROGRESS},
+            {"progress-file", required_argument, 0, OPT_PROGRESS_FILE},
             {"haplotype-basis-alleles", required_argument, 0, '9'},
             {"report-genotype-likelihood-max", no_argument, 0, '5'},
             {"report-all-haplotype-alleles", no_argument, 0, '6'},
@@ -581,6 +936,25 @@ Parameters::Parameters(int argc, char** argv) {
             {"prob-contamination", required_argument, 0, '_'},
             {"contamination-estimates", required_argument, 0, ','},
             {"report-monomorphic", no_argument, 0, '6'},
+            {"threads", required_argument, 0, OPT_THREADS},
+            {"auto-regions", required_argument, 0, OPT_AUTO_REGIONS},
+            {"emit-shards", required_argument, 0, OPT_EMIT_SHARDS},
+            {"shard", required_argument, 0, OPT_SHARD},
+            {"merge-shards", required_argument, 0, OPT_MERGE_SHARDS},
+            {"batch", required_argument, 0, OPT_BATCH},
+            {"numa", no_argument, 0, OPT_NUMA},
+            {"checkpoint", required_argument, 0, OPT_CHECKPOINT},
+            {"checkpoint-interval", required_argument, 0, OPT_CHECKPOINT_INTERVAL},
+            {"resume", no_argument, 0, OPT_RESUME},
+            {"decompress-threads", required_argument, 0, OPT_DECOMPRESS_THREADS},
+            {"prefetch-alignments", required_argument, 0, OPT_PREFETCH_ALIGNMENTS},
+            {"remote-read-ahead", required_argument, 0, OPT_REMOTE_READ_AHEAD},
+            {"idle-alignment-files", required_argument, 0, OPT_IDLE_ALIGNMENT_FILES},
+            {"open-threads", required_argument, 0, OPT_OPEN_THREADS},
+            {"header-cache", required_argument, 0, OPT_HEADER_CACHE},
+            {"genotyping-threads", required_argument, 0, OPT_GENOTYPING_THREADS},
+            {"emit-queue", required_argument, 0, OPT_EMIT_QUEUE},
+            {"likelihood-engine", required_argument, 0, OPT_LIKELIHOOD_ENGINE},
             {"debug", no_argument, 0, 'd'},
             {0, 0, 0, 0}
 
@@ -677,11 +1051,36 @@ Parameters::Parameters(int argc, char** argv) {
             }
             break;
 
+            // --gvcf-gq-bands
+        case OPT_GVCF_GQ_BANDS:
+        {
+            vector<string> bands = split(optarg, ",");
+            gVCFGQBands.clear();
+            for (vector<string>::iterator b = bands.begin(); b != bands.end(); ++b) {
+                int band;
+                if (!convert(*b, band)) {
+                    cerr << "could not parse gvcf-gq-bands" << endl;
+                    exit(1);
+                }
+                if (!gVCFGQBands.empty() && band <= gVCFGQBands.back()) {
+                    cerr << "gvcf-gq-bands must be given in increasing order" << endl;
+                    exit(1);
+                }
+                gVCFGQBands.push_back(band);
+            }
+        }
+            break;
+
             // -4 --use-duplicate-reads
         case '4':
             useDuplicateReads = true;
             break;
 
+            // --merge-overlapping-mates
+        case OPT_MERGE_OVERLAPPING_MATES:
+            mergeOverlappingMates = true;
+            break;
+
             // -3 --min-alternate-qsum
         case '3':
             if (!convert(optarg, minAltQSum)) {
@@ -714,6 +1113,14 @@ Parameters::Parameters(int argc, char** argv) {
             }
             break;
 
+            // --random-seed
+        case OPT_RANDOM_SEED:
+            if (!convert(optarg, randomSeed)) {
+                cerr << "could not parse random-seed" << endl;
+                exit(1);
+            }
+            break;
+
             // -g --skip-coverage
         case 'g':
             if (!convert(optarg, skipCoverage)) {
@@ -735,6 +1142,18 @@ Parameters::Parameters(int argc, char** argv) {
             }
             break;
 
+            // --use-best-n-indels
+        case OPT_USE_BEST_N_INDELS:
+            if (!convert(optarg, useBestNIndels)) {
+                cerr << "could not parse use-best-n-indels" << endl;
+                exit(1);
+            }
+            if (useBestNIndels < 0) {
+                cerr << "cannot set use-best-n-indels to less than 0" << endl;
+                exit(1);
+            }
+            break;
+
             // -Z --use-reference-allele
         case 'Z':
             forceRefAllele = true;
@@ -806,6 +1225,43 @@ Parameters::Parameters(int argc, char** argv) {
             }
             break;
 
+            // --max-combos
+        case OPT_MAX_COMBOS:
+            if (!convert(optarg, maxCombos)) {
+                cerr << "could not parse max-combos" << endl;
+                exit(1);
+            }
+            if (maxCombos < 0) {
+                cerr << "cannot set max-combos to less than 0" << endl;
+                exit(1);
+            }
+            break;
+
+            // --genotyping-tolerance
+        case OPT_GENOTYPING_TOLERANCE:
+            if (!convert(optarg, genotypingTolerance) || genotypingTolerance < 0) {
+                cerr << "could not parse genotyping-tolerance" << endl;
+                exit(1);
+            }
+            break;
+
+            // --gl-margin
+        case OPT_GL_MARGIN:
+            if (!convert(optarg, glMargin)) {
+                cerr << "could not parse gl-margin" << endl;
+                exit(1);
+            }
+            if (glMargin < 0) {
+                cerr << "cannot set gl-margin to less than 0" << endl;
+                exit(1);
+            }
+            break;
+
+            // --local-alleles
+        case OPT_LOCAL_ALLELES:
+            localAlleles = true;
+            break;
+
             // -1 --reference-quality
         case '1':
             if (!convert(split(optarg, ",").front(), MQR)) {
@@ -1030,6 +1486,18 @@ Parameters::Parameters(int argc, char** argv) {
             pooledContinuous = true;
             break;
 
+            // --pool-frequency-grid
+        case OPT_POOL_FREQUENCY_GRID:
+            if (!convert(optarg, poolFrequencyGrid)) {
+                cerr << "could not parse pool-frequency-grid" << endl;
+                exit(1);
+            }
+            if (poolFrequencyGrid < 0) {
+                cerr << "cannot set pool-frequency-grid to less than 0" << endl;
+                exit(1);
+            }
+            break;
+
         case '=':
             calculateMarginals = true;
             break;
@@ -1082,6 +1550,304 @@ Parameters::Parameters(int argc, char** argv) {
             }
             break;
 
+            // --threads
+        case OPT_THREADS:
+            if (!convert(optarg, threads)) {
+                cerr << "could not parse threads" << endl;
+                exit(1);
+            }
+            if (threads < 1) {
+                cerr << "cannot set threads to less than 1" << endl;
+                exit(1);
+            }
+            break;
+
+            // --auto-regions
+        case OPT_AUTO_REGIONS:
+            if (!convert(optarg, autoRegions)) {
+                cerr << "could not parse auto-regions" << endl;
+                exit(1);
+            }
+            if (autoRegions < 0) {
+                cerr << "cannot set auto-regions to less than 0" << endl;
+                exit(1);
+            }
+            break;
+
+            // --emit-shards
+        case OPT_EMIT_SHARDS:
+        {
+            string arg(optarg);
+            size_t colon = arg.find(':');
+            if (colon == string::npos || !convert(arg.substr(0, colon), emitShards) || emitShards < 1
+                || colon + 1 == arg.size()) {
+                cerr << "could not parse emit-shards, which is given as N:FILE, with N at least 1" << endl;
+                exit(1);
+            }
+            emitShardsFile = arg.substr(colon + 1);
+        }
+            break;
+
+            // --shard
+        case OPT_SHARD:
+        {
+            string arg(optarg);
+            size_t colon = arg.rfind(':');
+            if (colon == string::npos || !convert(arg.substr(colon + 1), shardIndex) || shardIndex < 0) {
+                cerr << "could not parse shard, which is given as FILE:I" << endl;
+                exit(1);
+            }
+            shardPlanFile = arg.substr(0, colon);
+        }
+            break;
+
+            // --merge-shards
+        case OPT_MERGE_SHARDS:
+            mergeShardsFile = optarg;
+            break;
+
+            // --batch
+        case OPT_BATCH:
+            batchFile = optarg;
+            break;
+
+            // --decompress-threads
+        case OPT_DECOMPRESS_THREADS:
+            if (!convert(optarg, decompressThreads)) {
+                cerr << "could not parse decompress-threads" << endl;
+                exit(1);
+            }
+            if (decompressThreads < 0) {
+                cerr << "cannot set decompress-threads to less than 0" << endl;
+                exit(1);
+            }
+            break;
+
+            // --prefetch-alignments
+        case OPT_PREFETCH_ALIGNMENTS:
+            if (!convert(optarg, prefetchAlignments)) {
+                cerr << "could not parse prefetch-alignments" << endl;
+                exit(1);
+            }
+            if (prefetchAlignments < 0) {
+                cerr << "cannot set prefetch-alignments to less than 0" << endl;
+                exit(1);
+            }
+            break;
+
+            // --remote-read-ahead
+        case OPT_REMOTE_READ_AHEAD:
+            if (!convert(optarg, remoteReadAhead)) {
+                cerr << "could not parse remote-read-ahead" << endl;
+                exit(1);
+            }
+            if (remoteReadAhead < 0) {
+                cerr << "cannot set remote-read-ahead to less than 0" << endl;
+                exit(1);
+            }
+            break;
+
+            // --idle-alignment-files
+        case OPT_IDLE_ALIGNMENT_FILES:
+            if (!convert(optarg, idleAlignmentFiles)) {
+                cerr << "could not parse idle-alignment-files" << endl;
+                exit(1);
+            }
+            if (idleAlignmentFiles < 0) {
+                cerr << "cannot set idle-alignment-files to less than 0" << endl;
+                exit(1);
+            }
+            break;
+
+            // --numa
+        case OPT_NUMA:
+            numa = true;
+            break;
+
+            // --checkpoint
+        case OPT_CHECKPOINT:
+            checkpointDir = optarg;
+            break;
+
+            // --checkpoint-interval
+        case OPT_CHECKPOINT_INTERVAL:
+            if (!convert(optarg, checkpointInterval) || checkpointInterval < 0) {
+                cerr << "could not parse checkpoint-interval" << endl;
+                exit(1);
+            }
+            break;
+
+            // --resume
+        case OPT_RESUME:
+            resume = true;
+            break;
+
+            // --open-threads
+        case OPT_OPEN_THREADS:
+            if (!convert(optarg, openThreads)) {
+                cerr << "could not parse open-threads" << endl;
+                exit(1);
+            }
+            if (openThreads < 1) {
+                cerr << "cannot set open-threads to less than 1" << endl;
+                exit(1);
+            }
+            break;
+
+            // --header-cache
+        case OPT_HEADER_CACHE:
+            headerCacheFile = optarg;
+            break;
+
+            // --genotyping-threads
+        case OPT_GENOTYPING_THREADS:
+            if (!convert(optarg, genotypingThreads)) {
+                cerr << "could not parse genotyping-threads" << endl;
+                exit(1);
+            }
+            if (genotypingThreads < 1) {
+                cerr << "cannot set genotyping-threads to less than 1" << endl;
+                exit(1);
+            }
+            break;
+
+            // --likelihood-engine
+        case OPT_LIKELIHOOD_ENGINE:
+            likelihoodEngine = optarg;
+            {
+                LikelihoodEngine* engine = makeLikelihoodEngine(likelihoodEngine);
+                if (!engine) {
+                    cerr << "there is no likelihood engine " << likelihoodEngine
+                         << " in this build, which has: " << likelihoodEngineNames() << endl;
+                    exit(1);
+                }
+                delete engine;
+            }
+            break;
+
+            // --emit-queue
+        case OPT_EMIT_QUEUE:
+            if (!convert(optarg, emitQueue)) {
+                cerr << "could not parse emit-queue" << endl;
+                exit(1);
+            }
+            if (emitQueue < 0) {
+                cerr << "cannot set emit-queue to less than 0" << endl;
+                exit(1);
+            }
+            break;
+
+            // --output-format
+        case OPT_OUTPUT_FORMAT:
+            outputFormat = optarg;
+            if (outputFormat != "vcf" && outputFormat != "bcf" && outputFormat != "ubcf") {
+                cerr << "unrecognized output-format " << outputFormat << ", expected vcf, bcf or ubcf" << endl;
+                exit(1);
+            }
+            break;
+
+            // --compress-threads
+        case OPT_COMPRESS_THREADS:
+            if (!convert(optarg, compressThreads)) {
+                cerr << "could not parse compress-threads" << endl;
+                exit(1);
+            }
+            if (compressThreads < 0) {
+                cerr << "cannot set compress-threads to less than 0" << endl;
+                exit(1);
+            }
+            break;
+
+            // --serve
+        case OPT_SERVE:
+            serveSocket = optarg;
+            break;
+
+            // --likelihood-dump
+        case OPT_LIKELIHOOD_DUMP:
+            likelihoodDumpFile = optarg;
+            break;
+
+            // --likelihood-cache
+        case OPT_LIKELIHOOD_CACHE:
+            likelihoodCacheDir = optarg;
+            break;
+
+            // --joint-likelihoods
+        case OPT_JOINT_LIKELIHOODS:
+            jointLikelihoodFiles.push_back(optarg);
+            break;
+
+            // --profile-report
+        case OPT_PROFILE_REPORT:
+            profileReportFile = optarg;
+            break;
+
+            // --slow-site-log
+        case OPT_SLOW_SITE_LOG:
+            slowSiteLogFile = optarg;
+            break;
+
+            // --trace
+        case OPT_TRACE:
+            traceFile = optarg;
+            break;
+
+            // --trace-region
+        case OPT_TRACE_REGION:
+            traceRegions.push_back(optarg);
+            break;
+
+            // --trace-sample
+        case OPT_TRACE_SAMPLE:
+            traceSamples.push_back(optarg);
+            break;
+
+            // --slow-site-time
+        case OPT_SLOW_SITE_TIME:
+            if (!convert(optarg, slowSiteTime) || slowSiteTime < 0) {
+                cerr << "could not parse slow-site-time" << endl;
+                exit(1);
+            }
+            break;
+
+            // --max-haplotype-cost
+        case OPT_MAX_HAPLOTYPE_COST:
+            if (!convert(optarg, maxHaplotypeCost) || maxHaplotypeCost < 0) {
+                cerr << "could not parse max-haplotype-cost" << endl;
+                exit(1);
+            }
+            break;
+
+            // --max-site-time
+        case OPT_MAX_SITE_TIME:
+            if (!convert(optarg, maxSiteTime) || maxSiteTime < 0) {
+                cerr << "could not parse max-site-time" << endl;
+                exit(1);
+            }
+            break;
+
+            // --max-memory
+        case OPT_MAX_MEMORY:
+            if (!convert(optarg, maxMemory) || maxMemory < 0) {
+                cerr << "could not parse max-memory" << endl;
+                exit(1);
+            }
+            break;
+
+            // --progress
+        case OPT_PROGRESS:
+            if (!convert(optarg, progressInterval) || progressInterval < 0) {
+                cerr << "could not parse progress" << endl;
+                exit(1);
+            }
+            break;
+
+            // --progress-file
+        case OPT_PROGRESS_FILE:
+            progressFile = optarg;
+            break;
+
             // -d --debug
         case 'd':
             ++debuglevel;
@@ -1143,11 +1909,74 @@ Parameters::Parameters(int argc, char** argv) {
         debug2 = true;
     }
 
-    if (bams.size() == 0) {
+    if (!progressFile.empty() && progressInterval == 0) {
+        progressInterval = 10;
+    }
+
+    // the files given are the outputs of the shards, and nothing is called
+    if (!mergeShardsFile.empty()) {
+        if (bams.empty()) {
+            cerr << "--merge-shards needs the outputs of the shards of the plan, in order." << endl;
+            exit(1);
+        }
+        return;
+    }
+
+    // the inputs, references and outputs are those of the jobs of the batch
+    if (!batchFile.empty()) {
+        if (!bams.empty() || useStdin || !jointLikelihoodFiles.empty() || !outputFile.empty()
+            || !serveSocket.empty() || !emitShardsFile.empty() || !shardPlanFile.empty()
+            || !likelihoodDumpFile.empty() || !likelihoodCacheDir.empty() || !checkpointDir.empty()) {
+            cerr << "--batch takes the alignment file, reference and output of each job from its list, so can't be used with alignment files, --stdin, --joint-likelihoods, -v, --serve, --emit-shards, --shard, --likelihood-dump, --likelihood-cache or --checkpoint." << endl;
+            exit(1);
+        }
+        return;
+    }
+
+    if (!emitShardsFile.empty() && !shardPlanFile.empty()) {
+        cerr << "--emit-shards writes a plan of shards, and can't be used with --shard." << endl;
+        exit(1);
+    }
+
+    if ((!emitShardsFile.empty() || !shardPlanFile.empty())
+        && (useStdin || !jointLikelihoodFiles.empty() || !serveSocket.empty())) {
+        cerr << "--emit-shards and --shard split the run into regions of indexed alignment files, so can't be used with --stdin, --joint-likelihoods or --serve." << endl;
+        exit(1);
+    }
+
+    if (bams.size() == 0 && jointLikelihoodFiles.empty()) {
         cerr << "Please specify a BAM file or files." << endl;
         exit(1);
     }
 
+    if (!bams.empty() && !jointLikelihoodFiles.empty()) {
+        cerr << "--joint-likelihoods genotypes stored likelihoods in place of alignments, and can't be used with BAM files." << endl;
+        exit(1);
+    }
+
+    if (!serveSocket.empty() && (useStdin || !jointLikelihoodFiles.empty())) {
+        cerr << "--serve calls regions from indexed alignment files, and can't be used with --stdin or --joint-likelihoods." << endl;
+        exit(1);
+    }
+
+    if (!likelihoodCacheDir.empty()
+        && (useStdin || !jointLikelihoodFiles.empty() || !likelihoodDumpFile.empty()
+            || !serveSocket.empty() || !checkpointDir.empty())) {
+        cerr << "--likelihood-cache calls each alignment file into a dump of its own, so can't be used with --stdin, --joint-likelihoods, --likelihood-dump, --serve or --checkpoint." << endl;
+        exit(1);
+    }
+
+    if (resume && checkpointDir.empty()) {
+        cerr << "--resume continues from the checkpoints of --checkpoint, which must be given." << endl;
+        exit(1);
+    }
+
+    if (!checkpointDir.empty()
+        && (outputFile.empty() || useStdin || !jointLikelihoodFiles.empty() || !serveSocket.empty())) {
+        cerr << "--checkpoint needs an output file (-v), and calls regions from indexed alignment files, so can't be used with --stdin, --joint-likelihoods or --serve." << endl;
+        exit(1);
+    }
+
     if (fasta == "") {
         cerr << "Please specify a fasta reference file." << endl;
         exit(1);
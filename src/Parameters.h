@@ -35,9 +35,24 @@ public:
     //string log;
     string output;               // -v --vcf
     string outputFile;
+    string outputFormat;         // --output-format
+    int compressThreads;         // --compress-threads
+    string serveSocket;          // --serve
+    string likelihoodDumpFile;   // --likelihood-dump
+    string likelihoodCacheDir;   // --likelihood-cache
+    vector<string> jointLikelihoodFiles; // --joint-likelihoods
+    string profileReportFile;    // --profile-report
+    string slowSiteLogFile;      // --slow-site-log
+    string traceFile;            // --trace
+    vector<string> traceRegions; // --trace-region
+    vector<string> traceSamples; // --trace-sample
+    double slowSiteTime;         // --slow-site-time
+    double progressInterval;     // --progress
+    string progressFile;         // --progress-file
     bool gVCFout;    // -l --gvcf
     int gVCFchunk;
     bool gVCFNoChunk;
+    vector<int> gVCFGQBands;     // --gvcf-gq-bands
     string variantPriorsFile;
     string haplotypeVariantFile;
     bool reportAllHaplotypeAlleles;
@@ -52,8 +67,10 @@ public:
 
     // operation parameters
     bool useDuplicateReads;      // -E --use-duplicate-reads
+    bool mergeOverlappingMates;  // --merge-overlapping-mates
     bool suppressOutput;         // -S --suppress-output
     int useBestNAlleles;         // -n --use-best-n-alleles
+    int useBestNIndels;          // --use-best-n-indels
     bool forceRefAllele;         // -F --force-reference-allele
     bool useRefAllele;           // -U --use-reference-allele
     bool diploidReference;       // -H --haploid-reference
@@ -62,7 +79,9 @@ public:
     bool allowMNPs;              // -X --allow-mnps
     bool allowComplex;           // -X --allow-complex
     bool strictVCF;
+    bool localAlleles;           // --local-alleles
     int maxComplexGap;
+    double maxHaplotypeCost;     // --max-haplotype-cost
     //int maxHaplotypeLength;
     int minRepeatSize;
     double minRepeatEntropy;
@@ -70,6 +89,7 @@ public:
     bool allowSNPs;              // -I --no-snps
     bool pooledDiscrete;
     bool pooledContinuous;
+    int poolFrequencyGrid;       // --pool-frequency-grid
     bool ewensPriors;
     bool permute;                //    --permute
     bool useMappingQuality;      //
@@ -79,7 +99,12 @@ public:
     bool hwePriors;
     bool reportGenotypeLikelihoodMax;
     int genotypingMaxIterations;
+    Probability genotypingTolerance;  // --genotyping-tolerance
     int genotypingMaxBandDepth;
+    int maxCombos;  // --max-combos
+    Probability glMargin;        // --gl-margin
+    double maxSiteTime;  // --max-site-time
+    long int maxMemory;  // --max-memory, in MB
     bool excludePartiallyObservedGenotypes;
     bool excludeUnobservedGenotypes;
     float genotypeVariantThreshold;
@@ -102,14 +127,14 @@ public:
     int readSnpLimit;            // -$ --read-snp-limit
     int readIndelLimit;          // -e --read-indel-limit
     int IDW;                     // -I --indel-exclusion-window
-    long double TH;              // -T --theta
-    long double PVL;             // -P --pvar
+    Probability TH;              // -T --theta
+    Probability PVL;             // -P --pvar
                                  // -K --posterior-integration-depth
     int posteriorIntegrationDepth;
     bool calculateMarginals;
     string algorithm;
     double RDF;             // -D --read-dependence-factor
-    long double diffusionPriorScalar; // -V --diffusion-prior-scalar
+    Probability diffusionPriorScalar; // -V --diffusion-prior-scalar
     int WB;                      // -W --posterior-integration-bandwidth
     // XXX adjusting this to anything other than 1 may have bad consequences
     // for large numbers of samples
@@ -117,13 +142,35 @@ public:
     bool includeMonoB;
     int TR;
     int I;
-    long double minAltFraction;  // -F --min-alternate-fraction
+    Probability minAltFraction;  // -F --min-alternate-fraction
     int minAltCount;             // -C --min-alternate-count
     int minAltTotal;             // -G --min-alternate-total
     int minCoverage;             // -! --min-coverage
     int limitCoverage;           // -+ --limit-coverage
+    unsigned long randomSeed;    // --random-seed
     int skipCoverage;            // -g --skip-coverage
     int trimComplexTail;         // -. --trim-complex-tail
+    int threads;                 // --threads
+    int autoRegions;             // --auto-regions
+    int emitShards;              // --emit-shards
+    string emitShardsFile;
+    string shardPlanFile;        // --shard
+    int shardIndex;
+    string mergeShardsFile;      // --merge-shards
+    string batchFile;            // --batch
+    bool numa;                   // --numa
+    string checkpointDir;        // --checkpoint
+    double checkpointInterval;   // --checkpoint-interval
+    bool resume;                 // --resume
+    int decompressThreads;       // --decompress-threads
+    int prefetchAlignments;      // --prefetch-alignments
+    int remoteReadAhead;         // --remote-read-ahead
+    int idleAlignmentFiles;      // --idle-alignment-files
+    int openThreads;             // --open-threads
+    string headerCacheFile;      // --header-cache
+    int genotypingThreads;       // --genotyping-threads
+    int emitQueue;               // --emit-queue
+    string likelihoodEngine;     // --likelihood-engine
     int debuglevel;              // -d --debug increments
     bool debug; // set if debuglevel >=1
     bool debug2; // set if debuglevel >=2
@@ -0,0 +1,169 @@
+#ifndef FREEBAYES_POSITIONWINDOW_H
+#define FREEBAYES_POSITIONWINDOW_H
+
+#include <vector>
+#include <utility>
+
+using namespace std;
+
+// values kept for a window of reference positions which moves along the
+// genome as we do
+//
+// the parser keeps state for the positions around the one it's calling,
+// e.g. the registered alignments keyed by their end position, which it adds
+// to just ahead of the current position and retires just behind it.  rather
+// than a map, this keeps the window as a ring indexed by position modulo its
+// size, so finding a position and retiring the ones behind us take constant
+// time.  the ring grows when the window does not fit in it.
+//
+// values are allocated for a position when it's first used, and recycled
+// once it is retired, so a window of values which allocate (such as deques)
+// costs nothing in steady state.  T must be default constructible and provide
+// clear(), which makes it empty(), and empty().
+template <class T>
+class PositionWindow {
+
+public:
+
+    typedef pair<long unsigned int, T> Slot;
+
+    // visits the non-empty positions in the window, in order
+    class iterator {
+    public:
+        iterator(PositionWindow* w, long unsigned int p) : window(w), position(p) { skipEmpty(); }
+        Slot& operator*(void) { return *window->slot(position); }
+        Slot* operator->(void) { return window->slot(position); }
+        iterator& operator++(void) { ++position; skipEmpty(); return *this; }
+        bool operator==(const iterator& other) const { return position == other.position; }
+        bool operator!=(const iterator& other) const { return position != other.position; }
+    private:
+        void skipEmpty(void) {
+            while (position < window->stop()
+                   && (!window->slot(position) || window->slot(position)->second.empty())) {
+                ++position;
+            }
+        }
+        PositionWindow* window;
+        long unsigned int position;
+    };
+
+    PositionWindow(void) : first(0), count(0), ring(64, (Slot*) NULL) { }
+
+    ~PositionWindow(void) {
+        clear();
+        for (typename vector<Slot*>::iterator s = spare.begin(); s != spare.end(); ++s) {
+            delete *s;
+        }
+    }
+
+    // the value at the position, which becomes part of the window
+    T& operator[](long unsigned int position) {
+        if (count == 0) {
+            first = position;
+            count = 1;
+        } else if (position < first) {
+            fit(first + count - position);
+            count += first - position;
+            first = position;
+        } else if (position >= first + count) {
+            fit(position - first + 1);
+            count = position - first + 1;
+        }
+        Slot*& s = ring[position & (ring.size() - 1)];
+        if (!s) {
+            if (spare.empty()) {
+                s = new Slot;
+            } else {
+                s = spare.back();
+                spare.pop_back();
+            }
+            s->first = position;
+        }
+        return s->second;
+    }
+
+    // the value at the position, or NULL if the position hasn't been used
+    T* find(long unsigned int position) {
+        Slot* s = slot(position);
+        return s ? &s->second : NULL;
+    }
+
+    iterator begin(void) { return iterator(this, first); }
+    iterator end(void) { return iterator(this, stop()); }
+    // the first non-empty position at or after the given one
+    iterator lower_bound(long unsigned int position) {
+        return iterator(this, max(position, first));
+    }
+
+    // true if no position is in the window
+    bool empty(void) const { return count == 0; }
+    // the first position in the window, and one past the last
+    long unsigned int start(void) const { return first; }
+    long unsigned int stop(void) const { return first + count; }
+
+    // retires the positions before the given one
+    void eraseBefore(long unsigned int position) {
+        if (count == 0 || position <= first) {
+            return;
+        }
+        if (position >= first + count) {
+            clear();
+            return;
+        }
+        for ( ; first < position; ++first, --count) {
+            release(first);
+        }
+    }
+
+    void clear(void) {
+        for (long unsigned int p = first; p < first + count; ++p) {
+            release(p);
+        }
+        count = 0;
+    }
+
+private:
+
+    PositionWindow(const PositionWindow&);
+    PositionWindow& operator=(const PositionWindow&);
+
+    Slot* slot(long unsigned int position) {
+        if (count == 0 || position < first || position >= first + count) {
+            return NULL;
+        }
+        return ring[position & (ring.size() - 1)];
+    }
+
+    void release(long unsigned int position) {
+        Slot*& s = ring[position & (ring.size() - 1)];
+        if (s) {
+            s->second.clear();
+            spare.push_back(s);
+            s = NULL;
+        }
+    }
+
+    // grows the ring, if needed, so that it can hold a window of the given size
+    void fit(long unsigned int size) {
+        if (size <= ring.size()) {
+            return;
+        }
+        long unsigned int capacity = ring.size();
+        while (capacity < size) {
+            capacity *= 2;
+        }
+        vector<Slot*> grown(capacity, (Slot*) NULL);
+        for (long unsigned int p = first; p < first + count; ++p) {
+            grown[p & (capacity - 1)] = ring[p & (ring.size() - 1)];
+        }
+        ring.swap(grown);
+    }
+
+    long unsigned int first; // the first position in the window
+    long unsigned int count; // the number of positions in the window
+    vector<Slot*> ring;      // indexed by position modulo its size, a power of two
+    vector<Slot*> spare;     // retired values, for reuse
+
+};
+
+#endif
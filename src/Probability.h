@@ -0,0 +1,23 @@
+#ifndef FREEBAYES_PROBABILITY_H
+#define FREEBAYES_PROBABILITY_H
+
+// the type of the probabilities, log probabilities and qualities the
+// likelihood code works in
+//
+// long double by default, which on x86-64 is the 80-bit x87 format, whose
+// arithmetic the compiler can't vectorise.  builds configured with
+//
+//     meson build -Dprobability=double
+//
+// work in double instead, which it can.  double keeps some 15 significant
+// digits, where the search over genotype combos sums and compares log
+// likelihoods of sites in large cohorts, so such builds are to be checked
+// against test/regression before they are relied on.
+
+#ifdef FREEBAYES_PROBABILITY_DOUBLE
+typedef double Probability;
+#else
+typedef long double Probability;
+#endif
+
+#endif
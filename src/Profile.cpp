@@ -0,0 +1,204 @@
+#include "Profile.h"
+#include <time.h>
+#include <chrono>
+#include <algorithm>
+
+static const char* stageNames[STAGE_COUNT] = {
+    "getNextAlleles",
+    "genotypeAlleles",
+    "buildHaplotypeAlleles",
+    "calculateSampleDataLikelihoods",
+    "convergentGenotypeComboSearch",
+    "marginalGenotypeLikelihoods",
+    "Results::vcf"
+};
+
+static const char* histogramNames[HISTOGRAM_COUNT] = {
+    "genotyping_iterations",
+    "genotype_combos",
+    "observations"
+};
+
+static const char* counterNames[COUNTER_COUNT] = {
+    "genotyping_iterations",
+    "likelihood_evaluations",
+    "alleles_registered",
+    "peak_registered_alignments"
+};
+
+const char* RunProfile::stageName(int stage) {
+    return stageNames[stage];
+}
+
+const char* RunProfile::histogramName(int histogram) {
+    return histogramNames[histogram];
+}
+
+const char* RunProfile::counterName(int counter) {
+    return counterNames[counter];
+}
+
+uint64_t wallClockNanoseconds(void) {
+    return chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t threadCpuNanoseconds(void) {
+    struct timespec t;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t) != 0) {
+        return 0;
+    }
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+void Log2Histogram::add(long int value) {
+    if (value < 0) {
+        value = 0;
+    }
+    size_t bin = 0;
+    for (unsigned long v = value; v > 0; v >>= 1) {
+        ++bin;
+    }
+    if (bins.size() <= bin) {
+        bins.resize(bin + 1, 0);
+    }
+    ++bins[bin];
+    ++count;
+    sum += value;
+    if (value > max) {
+        max = value;
+    }
+}
+
+void Log2Histogram::add(const Log2Histogram& other) {
+    if (bins.size() < other.bins.size()) {
+        bins.resize(other.bins.size(), 0);
+    }
+    for (size_t i = 0; i < other.bins.size(); ++i) {
+        bins[i] += other.bins[i];
+    }
+    count += other.count;
+    sum += other.sum;
+    if (other.max > max) {
+        max = other.max;
+    }
+}
+
+void Log2Histogram::json(ostream& out) const {
+    out << "{\"count\":" << count
+        << ",\"sum\":" << sum
+        << ",\"max\":" << max
+        << ",\"bins\":[";
+    bool first = true;
+    for (size_t i = 0; i < bins.size(); ++i) {
+        if (bins[i] == 0) {
+            continue;
+        }
+        // the inclusive range of the bin
+        long int low = i == 0 ? 0 : 1L << (i - 1);
+        long int high = i == 0 ? 0 : (1L << i) - 1;
+        out << (first ? "" : ",")
+            << "{\"min\":" << low << ",\"max\":" << high << ",\"count\":" << bins[i] << "}";
+        first = false;
+    }
+    out << "]}";
+}
+
+void RunProfile::add(const RunProfile& other) {
+    for (int i = 0; i < STAGE_COUNT; ++i) {
+        stages[i].calls += other.stages[i].calls;
+        stages[i].wallNanoseconds += other.stages[i].wallNanoseconds;
+        stages[i].cpuNanoseconds += other.stages[i].cpuNanoseconds;
+        stages[i].allocations += other.stages[i].allocations;
+        stages[i].allocatedBytes += other.stages[i].allocatedBytes;
+        stages[i].peakAlleles = max(stages[i].peakAlleles, other.stages[i].peakAlleles);
+        stages[i].peakGenotypeCombos = max(stages[i].peakGenotypeCombos, other.stages[i].peakGenotypeCombos);
+    }
+    for (int i = 0; i < HISTOGRAM_COUNT; ++i) {
+        histograms[i].add(other.histograms[i]);
+    }
+    for (int i = 0; i < COUNTER_COUNT; ++i) {
+        tally((ProfileCounter) i, other.counters[i]);
+    }
+    if (numaThreads.size() < other.numaThreads.size()) {
+        numaThreads.resize(other.numaThreads.size(), 0);
+    }
+    for (size_t i = 0; i < other.numaThreads.size(); ++i) {
+        numaThreads[i] += other.numaThreads[i];
+    }
+}
+
+void RunProfile::json(ostream& out, const vector<pair<string, unsigned long> >& siteCounts, uint64_t runNanoseconds) const {
+    out << "{" << endl
+        << "  \"wall_seconds\": " << runNanoseconds / 1e9 << "," << endl
+        << "  \"sites\": {";
+    for (size_t i = 0; i < siteCounts.size(); ++i) {
+        out << (i ? ", " : "") << "\"" << siteCounts[i].first << "\": " << siteCounts[i].second;
+    }
+    out << "}," << endl;
+    // on one line, for scripts to pick out
+    out << "  \"work\": {";
+    for (int i = 0; i < COUNTER_COUNT; ++i) {
+        out << (i ? ", " : "") << "\"" << counterName(i) << "\": " << counters[i];
+    }
+    out << "}," << endl;
+    if (!numaThreads.empty()) {
+        out << "  \"numa_threads\": [";
+        for (size_t i = 0; i < numaThreads.size(); ++i) {
+            out << (i ? ", " : "") << numaThreads[i];
+        }
+        out << "]," << endl;
+    }
+    out << "  \"stages\": {" << endl;
+    for (int i = 0; i < STAGE_COUNT; ++i) {
+        const StageTimes& t = stages[i];
+        out << "    \"" << stageName(i) << "\": {"
+            << "\"calls\": " << t.calls
+            << ", \"wall_seconds\": " << t.wallNanoseconds / 1e9
+            << ", \"cpu_seconds\": " << t.cpuNanoseconds / 1e9
+#ifdef ALLOC_PROFILE
+            << ", \"allocations\": " << t.allocations
+            << ", \"allocated_bytes\": " << t.allocatedBytes
+            << ", \"peak_alleles\": " << t.peakAlleles
+            << ", \"peak_genotype_combos\": " << t.peakGenotypeCombos
+#endif
+            << "}" << (i + 1 < STAGE_COUNT ? "," : "") << endl;
+    }
+    out << "  }," << endl
+        << "  \"histograms\": {" << endl;
+    for (int i = 0; i < HISTOGRAM_COUNT; ++i) {
+        out << "    \"" << histogramName(i) << "\": ";
+        histograms[i].json(out);
+        out << (i + 1 < HISTOGRAM_COUNT ? "," : "") << endl;
+    }
+    out << "  }" << endl
+        << "}" << endl;
+}
+
+bool SlowSiteLog::open(const string& filename, double thresholdSeconds, bool append) {
+    out.open(filename.c_str(), append ? ios::out | ios::app : ios::out);
+    if (!out) {
+        return false;
+    }
+    threshold = thresholdSeconds * 1e9;
+    // the header is already there if the log is appended to
+    if (append && out.tellp() > 0) {
+        return true;
+    }
+    out << "#chrom\tstart\tend\tseconds\tcoverage\talleles\thaplotype_length\titerations\tcombos\tapproximate" << endl;
+    return true;
+}
+
+void SlowSiteLog::log(const string& sequence, long int position, int haplotypeLength,
+                      uint64_t nanoseconds, int coverage, int alleles, int iterations,
+                      size_t combos, bool approximate) {
+    lock_guard<mutex> lock(logMutex);
+    out << sequence << "\t" << position << "\t" << position + max(haplotypeLength, 1)
+        << "\t" << nanoseconds / 1e9
+        << "\t" << coverage
+        << "\t" << alleles
+        << "\t" << haplotypeLength
+        << "\t" << iterations
+        << "\t" << combos
+        << "\t" << (approximate ? 1 : 0) << endl;
+}
@@ -0,0 +1,238 @@
+#ifndef FREEBAYES_PROFILE_H
+#define FREEBAYES_PROFILE_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <fstream>
+#include <mutex>
+#include <stdint.h>
+#include <algorithm>
+#include "AllocationProfile.h"
+
+using namespace std;
+
+// USDT probes for perf or bpftrace to attach to, in builds configured with
+// -Dusdt=true: freebayes:stage_begin and freebayes:stage_end give the stage,
+// as numbered below, whether or not --profile-report is, and freebayes:site
+// gives the sequence and position of each site as it's called
+#ifdef FREEBAYES_USDT
+#include <sys/sdt.h>
+#define FREEBAYES_PROBE1(name, a) DTRACE_PROBE1(freebayes, name, a)
+#define FREEBAYES_PROBE2(name, a, b) DTRACE_PROBE2(freebayes, name, a, b)
+#else
+#define FREEBAYES_PROBE1(name, a)
+#define FREEBAYES_PROBE2(name, a, b)
+#endif
+
+// the stages of the main loop which --profile-report times
+enum ProfileStage {
+    STAGE_GET_NEXT_ALLELES = 0,
+    STAGE_GENOTYPE_ALLELES,
+    STAGE_BUILD_HAPLOTYPE_ALLELES,
+    STAGE_DATA_LIKELIHOODS,
+    STAGE_COMBO_SEARCH,
+    STAGE_MARGINALS,
+    STAGE_RESULTS_VCF,
+    STAGE_COUNT
+};
+
+// the per-site values which --profile-report keeps histograms of
+enum ProfileHistogram {
+    HISTOGRAM_GENOTYPING_ITERATIONS = 0,
+    HISTOGRAM_COMBOS,
+    HISTOGRAM_OBSERVATIONS,
+    HISTOGRAM_COUNT
+};
+
+// the work done over the run, which unlike its time is the same on any
+// machine, so that runs can be compared by test/performance/regression.sh
+enum ProfileCounter {
+    COUNTER_GENOTYPING_ITERATIONS = 0,
+    COUNTER_LIKELIHOOD_EVALUATIONS,  // of a sample's data given a genotype
+    COUNTER_ALLELES_REGISTERED,
+    COUNTER_PEAK_REGISTERED_ALIGNMENTS,  // the most in the window at once
+    COUNTER_COUNT
+};
+
+// a count of values in bins by powers of two: bin 0 holds 0, and bin k
+// holds [2^(k-1), 2^k)
+class Log2Histogram {
+
+public:
+
+    Log2Histogram(void) : count(0), sum(0), max(0) { }
+
+    void add(long int value);
+    void add(const Log2Histogram& other);
+    void json(ostream& out) const;
+
+    uint64_t count;
+    uint64_t sum;
+    long int max;
+    vector<uint64_t> bins;
+
+};
+
+class StageTimes {
+
+public:
+
+    StageTimes(void)
+        : calls(0)
+        , wallNanoseconds(0)
+        , cpuNanoseconds(0)
+        , allocations(0)
+        , allocatedBytes(0)
+        , peakAlleles(0)
+        , peakGenotypeCombos(0)
+    { }
+
+    uint64_t calls;
+    uint64_t wallNanoseconds;
+    uint64_t cpuNanoseconds; // of the calling thread, not of any team helping it
+    // with -Dalloc_profile=true, those of the calling thread, and the most
+    // alive in the process during any call
+    uint64_t allocations;
+    uint64_t allocatedBytes;
+    long peakAlleles;
+    long peakGenotypeCombos;
+
+};
+
+// where the time of a run goes, kept by each thread calling variants and
+// added up at the end.  a disabled profile records nothing, so the timers
+// cost a branch when --profile-report isn't given.
+class RunProfile {
+
+public:
+
+    RunProfile(void) : enabled(false) {
+        for (int i = 0; i < COUNTER_COUNT; ++i) {
+            counters[i] = 0;
+        }
+    }
+
+    bool enabled;
+    StageTimes stages[STAGE_COUNT];
+    Log2Histogram histograms[HISTOGRAM_COUNT];
+    uint64_t counters[COUNTER_COUNT];
+    vector<uint64_t> numaThreads; // calling threads placed on each node by --numa
+
+    void record(ProfileStage stage, uint64_t wall, uint64_t cpu) {
+        StageTimes& t = stages[stage];
+        ++t.calls;
+        t.wallNanoseconds += wall;
+        t.cpuNanoseconds += cpu;
+    }
+#ifdef ALLOC_PROFILE
+    void recordAllocations(ProfileStage stage, const AllocationCounts& made) {
+        StageTimes& t = stages[stage];
+        t.allocations += made.allocations;
+        t.allocatedBytes += made.bytes;
+        t.peakAlleles = max(t.peakAlleles, livePeak(LIVE_ALLELES));
+        t.peakGenotypeCombos = max(t.peakGenotypeCombos, livePeak(LIVE_GENOTYPE_COMBOS));
+    }
+#endif
+    void count(ProfileHistogram histogram, long int value) {
+        if (enabled) {
+            histograms[histogram].add(value);
+        }
+    }
+    void tally(ProfileCounter counter, uint64_t value) {
+        if (counter == COUNTER_PEAK_REGISTERED_ALIGNMENTS) {
+            counters[counter] = max(counters[counter], value);
+        } else {
+            counters[counter] += value;
+        }
+    }
+    void add(const RunProfile& other);
+
+    // writes the report as a JSON object, with the given site counts
+    // and the wall time of the whole run
+    void json(ostream& out, const vector<pair<string, unsigned long> >& siteCounts, uint64_t runNanoseconds) const;
+
+    static const char* stageName(int stage);
+    static const char* histogramName(int histogram);
+    static const char* counterName(int counter);
+
+};
+
+// nanoseconds on the monotonic clock, and of CPU time used by this thread
+uint64_t wallClockNanoseconds(void);
+uint64_t threadCpuNanoseconds(void);
+
+// times the stage over the life of the timer
+class StageTimer {
+
+public:
+
+    StageTimer(RunProfile& p, ProfileStage s)
+        : profile(p)
+        , stage(s)
+    {
+        FREEBAYES_PROBE1(stage_begin, (int) stage);
+        if (profile.enabled) {
+            wallStart = wallClockNanoseconds();
+            cpuStart = threadCpuNanoseconds();
+#ifdef ALLOC_PROFILE
+            allocationStart = threadAllocations();
+            resetLivePeaks();
+#endif
+        }
+    }
+
+    ~StageTimer(void) {
+        if (profile.enabled) {
+            profile.record(stage, wallClockNanoseconds() - wallStart, threadCpuNanoseconds() - cpuStart);
+#ifdef ALLOC_PROFILE
+            AllocationCounts made = threadAllocations();
+            made.allocations -= allocationStart.allocations;
+            made.bytes -= allocationStart.bytes;
+            profile.recordAllocations(stage, made);
+#endif
+        }
+        FREEBAYES_PROBE1(stage_end, (int) stage);
+    }
+
+private:
+
+    RunProfile& profile;
+    ProfileStage stage;
+    uint64_t wallStart;
+    uint64_t cpuStart;
+#ifdef ALLOC_PROFILE
+    AllocationCounts allocationStart;
+#endif
+
+};
+
+// the sites which take longer than a threshold to call, as a BED file, one
+// line per site: the span of its haplotype, then the seconds it took, its
+// coverage, the number of genotype alleles, the haplotype length, the
+// genotyping iterations, the genotype combinations and whether it ran past
+// --max-site-time.  every thread calling variants writes to it, under its lock.
+class SlowSiteLog {
+
+public:
+
+    SlowSiteLog(void) : threshold(0) { }
+
+    // a resumed run appends to the log
+    bool open(const string& filename, double thresholdSeconds, bool append = false);
+    bool is_open(void) const { return out.is_open(); }
+    uint64_t thresholdNanoseconds(void) const { return threshold; }
+
+    void log(const string& sequence, long int position, int haplotypeLength,
+             uint64_t nanoseconds, int coverage, int alleles, int iterations,
+             size_t combos, bool approximate);
+
+private:
+
+    ofstream out;
+    uint64_t threshold;
+    mutex logMutex;
+
+};
+
+#endif
@@ -0,0 +1,239 @@
+#include "Progress.h"
+#include "Profile.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <cmath>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+uint64_t residentMemoryBytes(void) {
+    // pages of the program and of them resident, on linux
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        unsigned long size = 0, resident = 0;
+        int read = fscanf(statm, "%lu %lu", &size, &resident);
+        fclose(statm);
+        if (read == 2) {
+            return (uint64_t) resident * sysconf(_SC_PAGESIZE);
+        }
+    }
+    // elsewhere, the peak will have to do
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return (uint64_t) usage.ru_maxrss * 1024;
+#endif
+}
+
+bool ProgressMonitor::start(double intervalSeconds, const string& filename, uint64_t totalBases) {
+    if (!filename.empty()) {
+        ofstream test(filename.c_str());
+        if (!test) {
+            return false;
+        }
+    }
+    interval = intervalSeconds * 1e9;
+    if (interval == 0) {
+        interval = 1;
+    }
+    file = filename;
+    targetBases = totalBases;
+    startTime = lastReport = lastAdvance = wallClockNanoseconds();
+    lastBases = lastSites = lastProcessedSites = 0;
+    reporter = thread(&ProgressMonitor::run, this);
+    return true;
+}
+
+void ProgressMonitor::stop(void) {
+    if (!reporter.joinable()) {
+        return;
+    }
+    {
+        lock_guard<mutex> lock(reporterMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    reporter.join();
+    report(true);
+}
+
+ProgressSlot* ProgressMonitor::slot(void) {
+    lock_guard<mutex> lock(slotsMutex);
+    ProgressSlot*& s = threadSlots[this_thread::get_id()];
+    if (!s) {
+        slots.emplace_back();
+        s = &slots.back();
+    }
+    return s;
+}
+
+void ProgressMonitor::run(void) {
+    unique_lock<mutex> lock(reporterMutex);
+    while (!stopping) {
+        if (!wake.wait_for(lock, chrono::nanoseconds(interval), [this]() { return stopping; })) {
+            lock.unlock();
+            report(false);
+            lock.lock();
+        }
+    }
+}
+
+// e.g. 2h05m, or 40s
+static string duration(double seconds) {
+    if (std::isnan(seconds) || std::isinf(seconds)) {
+        return "unknown";
+    }
+    long int s = seconds;
+    stringstream out;
+    if (s >= 3600) {
+        out << s / 3600 << "h" << setw(2) << setfill('0') << (s % 3600) / 60 << "m";
+    } else if (s >= 60) {
+        out << s / 60 << "m" << setw(2) << setfill('0') << s % 60 << "s";
+    } else {
+        out << s << "s";
+    }
+    return out.str();
+}
+
+void ProgressMonitor::report(bool final) {
+
+    uint64_t now = wallClockNanoseconds();
+    uint64_t b = bases.load();
+    uint64_t s = sites.load();
+    uint64_t p = processedSites.load();
+    if (targetBases > 0 && b > targetBases) {
+        b = targetBases;
+    }
+
+    double elapsed = (now - startTime) / 1e9;
+    double sinceLast = max((now - lastReport) / 1e9, 1e-9);
+    double basesPerSecond = (b - lastBases) / sinceLast;
+    double sitesPerSecond = (s - lastSites) / sinceLast;
+    double processedPerSecond = (p - lastProcessedSites) / sinceLast;
+    if (b > lastBases || s > lastSites) {
+        lastAdvance = now;
+    }
+    double stalled = (now - lastAdvance) / 1e9;
+    // from the rate over the whole run, which is steadier than the last interval's
+    double remaining = final ? 0 : NAN;
+    if (!final && b > 0 && targetBases > 0) {
+        remaining = (targetBases - b) / (b / max(elapsed, 1e-9));
+    }
+    uint64_t rss = residentMemoryBytes();
+
+    vector<string> sequences;
+    vector<long int> positions;
+    vector<uint64_t> alignments;
+    uint64_t totalAlignments = 0;
+    {
+        lock_guard<mutex> lock(slotsMutex);
+        for (deque<ProgressSlot>::iterator t = slots.begin(); t != slots.end(); ++t) {
+            lock_guard<mutex> slotLock(t->slotMutex);
+            sequences.push_back(t->sequence);
+            positions.push_back(t->position);
+            alignments.push_back(t->alignments);
+            totalAlignments += t->alignments;
+        }
+    }
+
+    lastReport = now;
+    lastBases = b;
+    lastSites = s;
+    lastProcessedSites = p;
+
+    if (file.empty()) {
+        stringstream line;
+        line << "progress(freebayes): ";
+        for (size_t i = 0; i < sequences.size(); ++i) {
+            if (!sequences[i].empty()) {
+                line << (i ? ", " : "") << sequences[i] << ":" << positions[i] + 1;
+            }
+        }
+        line << (sequences.empty() ? "" : "; ")
+             << fixed << setprecision(1)
+             << (targetBases > 0 ? 100.0 * b / targetBases : 0.0) << "% of " << targetBases << " bases; "
+             << setprecision(0)
+             << basesPerSecond << " bases/s, "
+             << sitesPerSecond << " sites/s ("
+             << processedPerSecond << " processed/s); "
+             << totalAlignments << " alignments in memory; "
+             << "rss " << rss / (1024 * 1024) << "MB; "
+             << (final ? "done after " + duration(elapsed) : duration(remaining) + " remaining");
+        if (!final && stalled >= 2 * interval / 1e9) {
+            line << "; no progress for " << duration(stalled);
+        }
+        cerr << line.str() << endl;
+        return;
+    }
+
+    // written aside and moved into place, so a scrape never reads half a file
+    string tmp = file + ".tmp";
+    ofstream out(tmp.c_str());
+    if (!out) {
+        return;
+    }
+    out << setprecision(12)
+        << "# HELP freebayes_bases_total Bases of the targets called so far." << endl
+        << "# TYPE freebayes_bases_total counter" << endl
+        << "freebayes_bases_total " << b << endl
+        << "# HELP freebayes_target_bases Bases of the targets of the run." << endl
+        << "# TYPE freebayes_target_bases gauge" << endl
+        << "freebayes_target_bases " << targetBases << endl
+        << "# HELP freebayes_sites_total Sites visited so far." << endl
+        << "# TYPE freebayes_sites_total counter" << endl
+        << "freebayes_sites_total " << s << endl
+        << "# HELP freebayes_processed_sites_total Sites genotyped so far." << endl
+        << "# TYPE freebayes_processed_sites_total counter" << endl
+        << "freebayes_processed_sites_total " << p << endl
+        << "# HELP freebayes_bases_per_second Bases called per second since the last report." << endl
+        << "# TYPE freebayes_bases_per_second gauge" << endl
+        << "freebayes_bases_per_second " << basesPerSecond << endl
+        << "# HELP freebayes_sites_per_second Sites visited per second since the last report." << endl
+        << "# TYPE freebayes_sites_per_second gauge" << endl
+        << "freebayes_sites_per_second " << sitesPerSecond << endl
+        << "# HELP freebayes_processed_sites_per_second Sites genotyped per second since the last report." << endl
+        << "# TYPE freebayes_processed_sites_per_second gauge" << endl
+        << "freebayes_processed_sites_per_second " << processedPerSecond << endl
+        << "# HELP freebayes_alignments_in_memory Alignments registered with the parser of each thread." << endl
+        << "# TYPE freebayes_alignments_in_memory gauge" << endl;
+    for (size_t i = 0; i < alignments.size(); ++i) {
+        out << "freebayes_alignments_in_memory{thread=\"" << i << "\"} " << alignments[i] << endl;
+    }
+    out << "# HELP freebayes_position The 1-based position each thread is calling at." << endl
+        << "# TYPE freebayes_position gauge" << endl;
+    for (size_t i = 0; i < sequences.size(); ++i) {
+        if (!sequences[i].empty()) {
+            out << "freebayes_position{thread=\"" << i << "\",sequence=\"" << sequences[i] << "\"} "
+                << positions[i] + 1 << endl;
+        }
+    }
+    out << "# HELP freebayes_resident_memory_bytes Resident memory of the process." << endl
+        << "# TYPE freebayes_resident_memory_bytes gauge" << endl
+        << "freebayes_resident_memory_bytes " << rss << endl
+        << "# HELP freebayes_elapsed_seconds Wall time since the run started calling." << endl
+        << "# TYPE freebayes_elapsed_seconds gauge" << endl
+        << "freebayes_elapsed_seconds " << elapsed << endl
+        << "# HELP freebayes_estimated_remaining_seconds Estimated wall time left, from the rate over the run." << endl
+        << "# TYPE freebayes_estimated_remaining_seconds gauge" << endl
+        << "freebayes_estimated_remaining_seconds ";
+    if (std::isnan(remaining)) {
+        out << "NaN" << endl;
+    } else {
+        out << remaining << endl;
+    }
+    out << "# HELP freebayes_seconds_since_progress Wall time since the bases or sites last went up." << endl
+        << "# TYPE freebayes_seconds_since_progress gauge" << endl
+        << "freebayes_seconds_since_progress " << stalled << endl
+        << "# HELP freebayes_done Whether the run has finished calling." << endl
+        << "# TYPE freebayes_done gauge" << endl
+        << "freebayes_done " << (final ? 1 : 0) << endl;
+    out.close();
+    rename(tmp.c_str(), file.c_str());
+
+}
@@ -0,0 +1,96 @@
+#ifndef FREEBAYES_PROGRESS_H
+#define FREEBAYES_PROGRESS_H
+
+#include <string>
+#include <deque>
+#include <map>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <stdint.h>
+
+using namespace std;
+
+// where one thread calling variants has got to, as last reported by it
+class ProgressSlot {
+
+public:
+
+    ProgressSlot(void) : position(0), alignments(0) { }
+
+    mutex slotMutex;
+    string sequence;
+    long int position;   // 0-based
+    uint64_t alignments; // registered with its parser
+
+};
+
+// reports the throughput of the run every so often, for --progress
+//
+// threads calling variants add the bases and sites they get through to the
+// counts here, and keep a slot up to date with their position.  a reporting
+// thread wakes every interval and writes out the rates since its last report,
+// the estimated time remaining over the bases of the run's targets, and the
+// time since the run last got anywhere, by which a stalled run can be told.
+// the report is a line on stderr, or if given a file, the file rewritten in
+// the Prometheus text format.
+class ProgressMonitor {
+
+public:
+
+    ProgressMonitor(void)
+        : bases(0)
+        , sites(0)
+        , processedSites(0)
+        , interval(0)
+        , targetBases(0)
+        , stopping(false)
+    { }
+    ~ProgressMonitor(void) { stop(); }
+
+    bool enabled(void) const { return interval > 0; }
+    // starts reporting, returning false if the file can't be written
+    bool start(double intervalSeconds, const string& filename, uint64_t totalBases);
+    // writes a last report, and stops
+    void stop(void);
+
+    // the slot of the calling thread, which remains valid for the run
+    ProgressSlot* slot(void);
+
+    atomic<uint64_t> bases;
+    atomic<uint64_t> sites;
+    atomic<uint64_t> processedSites;
+
+private:
+
+    void run(void);
+    void report(bool final);
+
+    uint64_t interval;    // in nanoseconds
+    string file;
+    uint64_t targetBases;
+
+    mutex slotsMutex;
+    deque<ProgressSlot> slots; // references to these remain valid as slots are added
+    map<thread::id, ProgressSlot*> threadSlots;
+
+    thread reporter;
+    mutex reporterMutex;
+    condition_variable wake;
+    bool stopping;
+
+    // as of the last report
+    uint64_t startTime;
+    uint64_t lastReport;
+    uint64_t lastAdvance; // when the bases or sites last went up
+    uint64_t lastBases;
+    uint64_t lastSites;
+    uint64_t lastProcessedSites;
+
+};
+
+// the resident memory of the process in bytes
+uint64_t residentMemoryBytes(void);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef FREEBAYES_RECORDVALUES_H
+#define FREEBAYES_RECORDVALUES_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+using namespace std;
+
+// the numbers of the INFO and FORMAT fields of a record, as they were
+// computed before being formatted into its text
+//
+// BCF output encodes these directly, rather than parsing them back from the
+// text, which would lose what the text rounds away.  NaN stands for a
+// missing value.  fields which have no numbers here, such as those of
+// strings, are encoded from the text.
+class RecordValues {
+public:
+    map<string, vector<double> > info;
+    map<string, map<string, vector<double> > > samples; // by sample, then field
+
+    void clear(void) {
+        info.clear();
+        samples.clear();
+    }
+};
+
+#endif
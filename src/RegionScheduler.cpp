@@ -0,0 +1,146 @@
+#include "RegionScheduler.h"
+
+// positions are 0-based, as in BedTarget
+bool ScheduledRegion::contains(const string& seq, long int position) {
+    for (vector<BedTarget>::const_iterator t = targets.begin(); t != targets.end(); ++t) {
+        if (t->seq == seq && t->left <= position && position <= t->right) {
+            return true;
+        }
+    }
+    return false;
+}
+
+RegionScheduler::RegionScheduler(VariantWriter& w, const vector<vector<BedTarget> >& r, size_t m,
+                                 RunCheckpoint* c)
+    : writer(w)
+    , maxInFlight(max(m, (size_t) 1))
+    , checkpoint(c)
+    , nextToWrite(NULL)
+    , inFlight(0)
+    , started(0)
+{
+    ScheduledRegion* last = NULL;
+    for (vector<vector<BedTarget> >::const_iterator t = r.begin(); t != r.end(); ++t) {
+        regions.emplace_back(*t);
+        ScheduledRegion* region = &regions.back();
+        region->origin = regions.size() - 1;
+        region->prev = last;
+        if (last) {
+            last->next = region;
+        }
+        last = region;
+        queue.push_back(region);
+    }
+    if (!regions.empty()) {
+        nextToWrite = &regions.front();
+    }
+}
+
+ScheduledRegion* RegionScheduler::longestRunningRegion(void) {
+    ScheduledRegion* longest = NULL;
+    for (vector<ScheduledRegion*>::iterator r = running.begin(); r != running.end(); ++r) {
+        if ((*r)->splittable && !(*r)->splitRequested
+            && (!longest || (*r)->startOrder < longest->startOrder)) {
+            longest = *r;
+        }
+    }
+    return longest;
+}
+
+ScheduledRegion* RegionScheduler::nextRegion(void) {
+    unique_lock<mutex> lock(schedulerMutex);
+    while (true) {
+        if (!queue.empty()) {
+            ScheduledRegion* region = queue.front();
+            if (region == nextToWrite || inFlight < maxInFlight) {
+                queue.pop_front();
+                region->started = true;
+                region->startOrder = started++;
+                running.push_back(region);
+                ++inFlight;
+                return region;
+            }
+        } else if (running.empty()) {
+            return NULL;
+        } else if (inFlight < maxInFlight) {
+            // nothing left to hand out, so try to take work from a running region
+            ScheduledRegion* victim = longestRunningRegion();
+            if (victim) {
+                victim->splitRequested = true;
+            }
+        }
+        progress.wait(lock);
+    }
+}
+
+bool RegionScheduler::ownedByOtherRegion(ScheduledRegion* region, const string& seq, long int position) {
+    // regions are stored in order, so only the neighbours can share an edge
+    return (region->prev && region->prev->contains(seq, position))
+        || (region->next && region->next->contains(seq, position));
+}
+
+void RegionScheduler::add(ScheduledRegion* region, vcflib::Variant& var, const RecordValues* values) {
+    // encode outside of the lock, so workers only contend on the append
+    EncodedRecords record;
+    writer.encode(var, record, values);
+    long int position = var.position - 1;
+    lock_guard<mutex> lock(schedulerMutex);
+    if (!region->contains(var.sequenceName, position)
+        && ownedByOtherRegion(region, var.sequenceName, position)) {
+        return;
+    }
+    region->pending.append(record);
+}
+
+void RegionScheduler::offerSplit(ScheduledRegion* region, AlleleParser* parser) {
+    if (!region->splitRequested.load(memory_order_relaxed) || !parser->atSafeSplitPosition()) {
+        return;
+    }
+    vector<BedTarget> tail = parser->remainingTargets(parser->currentPosition + 1);
+    long int tailLength = 0;
+    for (vector<BedTarget>::iterator t = tail.begin(); t != tail.end(); ++t) {
+        tailLength += t->right - t->left + 1;
+    }
+
+    {
+        lock_guard<mutex> lock(schedulerMutex);
+        region->splitRequested = false;
+        if (tailLength < MIN_STOLEN_REGION_SIZE) {
+            // not worth it, and it will only get smaller
+            region->splittable = false;
+        } else {
+            parser->splitTargets(parser->currentPosition + 1);
+            // the region now ends where the parser will stop
+            region->targets = parser->targets;
+            regions.emplace_back(tail);
+            ScheduledRegion* split = &regions.back();
+            split->origin = region->origin;
+            split->prev = region;
+            split->next = region->next;
+            if (region->next) {
+                region->next->prev = split;
+            }
+            region->next = split;
+            queue.push_front(split);
+        }
+    }
+    progress.notify_all();
+}
+
+void RegionScheduler::finishRegion(ScheduledRegion* region) {
+    {
+        lock_guard<mutex> lock(schedulerMutex);
+        region->finished = true;
+        running.erase(find(running.begin(), running.end(), region));
+        while (nextToWrite && nextToWrite->finished) {
+            writer.write(nextToWrite->pending); // and release the memory
+            --inFlight;
+            ScheduledRegion* written = nextToWrite;
+            nextToWrite = nextToWrite->next;
+            if (checkpoint && (!nextToWrite || nextToWrite->origin != written->origin)) {
+                checkpoint->regionsWritten(writer, written->origin + 1);
+            }
+        }
+    }
+    progress.notify_all();
+}
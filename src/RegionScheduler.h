@@ -0,0 +1,147 @@
+#ifndef FREEBAYES_REGIONSCHEDULER_H
+#define FREEBAYES_REGIONSCHEDULER_H
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include "BedReader.h"
+#include "Variant.h"
+#include "AlleleParser.h"
+#include "VariantWriter.h"
+#include "Checkpoint.h"
+
+// the smallest tail of a region which is worth handing to an idle thread
+#define MIN_STOLEN_REGION_SIZE 10000
+
+using namespace std;
+
+// receives the records made while calling variants, with the numbers of
+// their fields where the caller has them
+class VariantOutput {
+public:
+    virtual ~VariantOutput(void) { }
+    virtual void write(vcflib::Variant& var, RecordValues* values) = 0;
+    void write(vcflib::Variant& var) { write(var, NULL); }
+};
+
+// writes records straight to the output
+class StreamVariantOutput : public VariantOutput {
+public:
+    using VariantOutput::write;
+    StreamVariantOutput(VariantWriter& w) : writer(w) { }
+    void write(vcflib::Variant& var, RecordValues* values) {
+        writer.write(var, values);
+    }
+private:
+    VariantWriter& writer;
+};
+
+// a region of the run, made of one or more targets, as tracked by the scheduler
+class ScheduledRegion {
+public:
+    vector<BedTarget> targets;
+    ScheduledRegion* prev; // neighbours in the output order
+    ScheduledRegion* next;
+    bool started;
+    bool finished;
+    bool splittable;       // false once the region has declined to be split
+    atomic<bool> splitRequested;
+    long int startOrder;   // the order in which regions were started
+    size_t origin;         // the region of the run it is, or was split from
+    EncodedRecords pending; // encoded records, not yet written
+
+    ScheduledRegion(const vector<BedTarget>& t)
+        : targets(t)
+        , prev(NULL)
+        , next(NULL)
+        , started(false)
+        , finished(false)
+        , splittable(true)
+        , splitRequested(false)
+        , startOrder(0)
+        , origin(0)
+    { }
+
+    bool contains(const string& seq, long int position);
+};
+
+// hands out the regions of a run to worker threads and streams their records
+// to the output in region order
+//
+// regions are handed out in order.  at most maxInFlight regions may be started
+// and not yet written at a time (the oldest unwritten one is always allowed to
+// start), so memory is bounded by the records of those regions.
+//
+// when no regions are left to hand out, an idle worker asks the region which
+// has been running longest to give up its unprocessed tail.  that region's
+// worker cuts it at the next safe position (see
+// AlleleParser::atSafeSplitPosition) and the tail becomes a new region,
+// written directly after the one it came from.
+//
+// a record belongs to the region containing its start.  records which a
+// region calls at positions owned by a neighbouring region (e.g. haplotype
+// alleles which run over the edge) are dropped, as the neighbour calls them
+// too.  records starting outside every region have no other owner and are kept.
+//
+// given a checkpoint, the scheduler tells it as each region of the run is
+// written in full, with the tails split from it.
+class RegionScheduler {
+
+public:
+
+    RegionScheduler(VariantWriter& w, const vector<vector<BedTarget> >& r, size_t maxInFlight,
+                    RunCheckpoint* checkpoint = NULL);
+
+    // blocks until a region can be processed, and returns it, or returns
+    // NULL once every region has been processed
+    ScheduledRegion* nextRegion(void);
+    // adds a record made in the region
+    void add(ScheduledRegion* region, vcflib::Variant& var, const RecordValues* values = NULL);
+    // called by the worker of a region at each position; if an idle worker
+    // is waiting on the region and the parser is at a safe position, the
+    // parser's remaining targets are given up as a new region
+    void offerSplit(ScheduledRegion* region, AlleleParser* parser);
+    // marks the region as complete, writing it and any completed regions
+    // following it if all the regions before it have been written
+    void finishRegion(ScheduledRegion* region);
+
+private:
+
+    bool ownedByOtherRegion(ScheduledRegion* region, const string& seq, long int position);
+    ScheduledRegion* longestRunningRegion(void);
+
+    VariantWriter& writer;
+    size_t maxInFlight;
+    RunCheckpoint* checkpoint;
+
+    deque<ScheduledRegion> regions; // references to these remain valid as regions are added
+    deque<ScheduledRegion*> queue;  // regions not yet started, in order
+    vector<ScheduledRegion*> running;
+    ScheduledRegion* nextToWrite;
+    size_t inFlight;
+    long int started;
+
+    mutex schedulerMutex;
+    condition_variable progress;
+
+};
+
+// sends the records of one region to a RegionScheduler
+class RegionVariantOutput : public VariantOutput {
+public:
+    using VariantOutput::write;
+    RegionVariantOutput(RegionScheduler& s, ScheduledRegion* r) : scheduler(s), region(r) { }
+    void write(vcflib::Variant& var, RecordValues* values) {
+        scheduler.add(region, var, values);
+    }
+private:
+    RegionScheduler& scheduler;
+    ScheduledRegion* region;
+};
+
+#endif
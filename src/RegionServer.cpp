@@ -0,0 +1,163 @@
+#include "RegionServer.h"
+#include "Logging.h"
+#include <sstream>
+#include <vector>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+// writes all of the data, or returns false once the client has gone
+static bool sendAll(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = write(fd, data, length);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+// reads up to the end of the first line, or of the connection
+static bool readRequest(int fd, string& request) {
+    char buffer[4096];
+    while (request.find('\n') == string::npos) {
+        ssize_t got = read(fd, buffer, sizeof(buffer));
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (got == 0) {
+            break;
+        }
+        request.append(buffer, got);
+        if (request.size() > MAX_REQUEST_LENGTH) {
+            return false;
+        }
+    }
+    size_t end = request.find('\n');
+    if (end != string::npos) {
+        request.erase(end);
+    }
+    return true;
+}
+
+static void answer(CallingSession& session, int fd) {
+
+    const Parameters& parameters = session.parameters();
+    string request;
+    if (!readRequest(fd, request)) {
+        string error = "error: could not read the request\n";
+        sendAll(fd, error.c_str(), error.size());
+        return;
+    }
+
+    vector<string> regions;
+    stringstream words(request);
+    string region;
+    while (words >> region) {
+        regions.push_back(region);
+    }
+    vector<BedTarget> targets;
+    for (vector<string>::iterator r = regions.begin(); r != regions.end(); ++r) {
+        BedTarget target;
+        if (!session.regionTarget(*r, target)) {
+            string error = "error: " + *r + " is not a region of the reference\n";
+            sendAll(fd, error.c_str(), error.size());
+            return;
+        }
+        targets.push_back(target);
+    }
+
+    DEBUG("serving " << request);
+
+    string out = session.vcfHeader() + "\n";
+    bool connected = true;
+    session.callTargets(targets, [&](vcflib::Variant& var) {
+        if (!connected) {
+            return;
+        }
+        stringstream line;
+        line << var << endl;
+        out += line.str();
+        if (out.size() >= SERVER_SEND_BUFFER) {
+            connected = sendAll(fd, out.c_str(), out.size());
+            out.clear();
+        }
+    });
+    if (connected) {
+        sendAll(fd, out.c_str(), out.size());
+    }
+
+}
+
+bool serveRegions(CallingSession& session, const string& socketPath) {
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        ERROR("socket path is too long: " << socketPath);
+        return false;
+    }
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0) {
+        ERROR("could not create socket: " << strerror(errno));
+        return false;
+    }
+    // left behind by an earlier server
+    struct stat existing;
+    if (lstat(socketPath.c_str(), &existing) == 0) {
+        if (!S_ISSOCK(existing.st_mode)) {
+            ERROR(socketPath << " exists and is not a socket");
+            close(server);
+            return false;
+        }
+        unlink(socketPath.c_str());
+    }
+    if (bind(server, (struct sockaddr*) &address, sizeof(address)) < 0
+        || listen(server, 16) < 0) {
+        ERROR("could not listen on " << socketPath << ": " << strerror(errno));
+        close(server);
+        return false;
+    }
+
+    // a client which hangs up is for the write to notice, not the process
+    signal(SIGPIPE, SIG_IGN);
+
+    cerr << "freebayes: serving on " << socketPath << endl;
+
+    while (true) {
+        int client = accept(server, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            ERROR("could not accept a connection on " << socketPath << ": " << strerror(errno));
+            close(server);
+            return false;
+        }
+        // so a client which stalls can't hold up those after it
+        struct timeval timeout;
+        timeout.tv_sec = SERVER_CLIENT_TIMEOUT;
+        timeout.tv_usec = 0;
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        answer(session, client);
+        close(client);
+    }
+
+}
@@ -0,0 +1,32 @@
+#ifndef FREEBAYES_REGIONSERVER_H
+#define FREEBAYES_REGIONSERVER_H
+
+#include <string>
+#include "CallingSession.h"
+
+using namespace std;
+
+// the longest request line we read, past which the request is refused
+#define MAX_REQUEST_LENGTH 1048576
+// records are sent on once this much of them is waiting
+#define SERVER_SEND_BUFFER 65536
+// seconds a client may take to send its request, or to take the records,
+// before the server hangs up and goes on to the next
+#define SERVER_CLIENT_TIMEOUT 5
+
+// answers requests to call regions on a Unix socket, for --serve
+//
+// connections are answered one at a time.  each sends a line of regions,
+// given as to --region and separated by whitespace, and gets back the VCF
+// header and the records of the regions, streamed as they're called, after
+// which the connection is closed.  a request with a region which isn't on
+// the reference is answered with a line beginning "error:" instead.  the
+// session stays open between requests, so only the first pays for opening
+// the inputs.  a client which stops sending or reading is hung up on after
+// SERVER_CLIENT_TIMEOUT.  a socket left at the path by an earlier server is
+// replaced, but anything else there is left, and the server isn't started.
+// serves until the process is stopped, returning false if the socket can't
+// be set up.
+bool serveRegions(CallingSession& session, const string& socketPath);
+
+#endif
@@ -0,0 +1,81 @@
+#include "RegisteredAlleleIndex.h"
+#include <algorithm>
+
+void RegisteredAlleleIndex::add(const vector<Allele*>& alleles) {
+    if (!valid) {
+        return;
+    }
+    for (vector<Allele*>::const_iterator a = alleles.begin(); a != alleles.end(); ++a) {
+        insert(Entry(*a, nextOrder++));
+    }
+}
+
+void RegisteredAlleleIndex::invalidate(void) {
+    valid = false;
+    alternates.clear();
+    upcoming.clear();
+    spanning.clear();
+}
+
+// files the entry, unless it is already behind the position
+void RegisteredAlleleIndex::insert(const Entry& entry) {
+    if (entry.allele->type != ALLELE_REFERENCE) {
+        if (entry.start >= position) {
+            alternates[entry.start].push_back(entry);
+        }
+    } else if (entry.start > position) {
+        upcoming[entry.start].push_back(entry);
+    } else if (entry.end > position) {
+        spanning.push_back(entry);
+        push_heap(spanning.begin(), spanning.end(), endsAfter);
+    }
+}
+
+// drops what ends before the new position, by the positions of the entries
+// alone, as the alleles themselves may be gone
+void RegisteredAlleleIndex::advance(long int to) {
+    position = to;
+    alternates.erase(alternates.begin(), alternates.lower_bound(position));
+    map<long int, vector<Entry> >::iterator u = upcoming.begin();
+    for ( ; u != upcoming.end() && u->first <= position; ++u) {
+        for (vector<Entry>::iterator e = u->second.begin(); e != u->second.end(); ++e) {
+            if (e->end > position) {
+                spanning.push_back(*e);
+                push_heap(spanning.begin(), spanning.end(), endsAfter);
+            }
+        }
+    }
+    upcoming.erase(upcoming.begin(), u);
+    while (!spanning.empty() && spanning.front().end <= position) {
+        pop_heap(spanning.begin(), spanning.end(), endsAfter);
+        spanning.pop_back();
+    }
+}
+
+void RegisteredAlleleIndex::build(const vector<Allele*>& registered, long int at) {
+    invalidate();
+    valid = true;
+    position = at;
+    nextOrder = 0;
+    for (vector<Allele*>::const_iterator a = registered.begin(); a != registered.end(); ++a) {
+        insert(Entry(*a, nextOrder++));
+    }
+}
+
+void RegisteredAlleleIndex::find(const vector<Allele*>& registered, long int at, int span, vector<Allele*>& found) {
+    if (!valid || at < position) {
+        build(registered, at);
+    } else if (at > position) {
+        advance(at);
+    }
+    candidates.assign(spanning.begin(), spanning.end());
+    map<long int, vector<Entry> >::iterator b = alternates.begin();
+    for ( ; b != alternates.end() && b->first < at + span; ++b) {
+        candidates.insert(candidates.end(), b->second.begin(), b->second.end());
+    }
+    sort(candidates.begin(), candidates.end(), listedBefore);
+    found.clear();
+    for (vector<Entry>::iterator c = candidates.begin(); c != candidates.end(); ++c) {
+        found.push_back(c->allele);
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef FREEBAYES_REGISTEREDALLELEINDEX_H
+#define FREEBAYES_REGISTEREDALLELEINDEX_H
+
+#include <vector>
+#include <map>
+#include "Allele.h"
+
+using namespace std;
+
+// the registered alleles, indexed by where they lie, for getAlleles
+//
+// at each position getAlleles wants the non-reference observations starting
+// there (or, for a haplotype, within it) and the reference observations
+// spanning it.  the registered alleles are a flat list, which with deep
+// coverage or long reads holds hundreds of thousands of observations, nearly
+// all of them away from the position.  this keeps the non-reference ones
+// bucketed by start, and the reference ones which have begun in a heap on
+// their ends, so a position only looks at the observations overlapping it.
+//
+// the index follows the list as alignments are registered, and as the
+// position moves on it drops what is behind, by the positions the alleles
+// had when indexed, so it never looks at an allele whose storage has been
+// recycled.  any other change to the list, or to where its alleles lie (as
+// when fitting haplotypes), must invalidate() the index, which is then built
+// again from the list when next used.
+class RegisteredAlleleIndex {
+
+public:
+
+    RegisteredAlleleIndex(void) : valid(false), position(0), nextOrder(0) { }
+
+    // the alleles have been appended to the list
+    void add(const vector<Allele*>& alleles);
+    void invalidate(void);
+
+    // the alleles of the list which may be wanted at the position: the
+    // reference alleles overlapping it, and the others starting within the
+    // span, in the order of the list.  positions may only move back after
+    // the index is invalidated, or it is built again.
+    void find(const vector<Allele*>& registered, long int at, int span, vector<Allele*>& found);
+
+private:
+
+    class Entry {
+    public:
+        Allele* allele;
+        long int start;
+        long int end;
+        unsigned long order; // in the list
+        Entry(Allele* a, unsigned long o)
+            : allele(a)
+            , start(a->position)
+            , end(a->position + a->referenceLength)
+            , order(o) { }
+    };
+
+    // orders the heap of reference alleles, the first ending at the top
+    static bool endsAfter(const Entry& a, const Entry& b) { return a.end > b.end; }
+    static bool listedBefore(const Entry& a, const Entry& b) { return a.order < b.order; }
+
+    void insert(const Entry& entry);
+    void advance(long int to);
+    void build(const vector<Allele*>& registered, long int at);
+
+    bool valid;
+    long int position;
+    unsigned long nextOrder;
+    map<long int, vector<Entry> > alternates; // non-reference alleles, by start
+    map<long int, vector<Entry> > upcoming; // reference alleles starting after the position
+    vector<Entry> spanning; // reference alleles which have begun, a heap on end
+    vector<Entry> candidates;
+
+};
+
+#endif
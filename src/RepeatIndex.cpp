@@ -0,0 +1,76 @@
+#include "RepeatIndex.h"
+#include <algorithm>
+
+void RepeatIndex::clear(void) {
+    for (vector<deque<Run> >::iterator r = runs.begin(); r != runs.end(); ++r) {
+        r->clear();
+    }
+    start = end = 0;
+}
+
+void RepeatIndex::update(const string& sequence, long int sequenceStart) {
+    long int sequenceEnd = sequenceStart + sequence.size();
+    if (start == end || sequenceStart < start || sequenceStart > end || sequenceEnd < end) {
+        clear();
+        start = end = sequenceStart;
+    }
+
+    // drop what has been trimmed from the front of the window
+    if (sequenceStart > start) {
+        for (int k = 1; k <= maxUnitLength; ++k) {
+            deque<Run>& r = runs[k];
+            while (!r.empty() && r.front().second <= sequenceStart) {
+                r.pop_front();
+            }
+            if (!r.empty() && r.front().first < sequenceStart) {
+                r.front().first = sequenceStart;
+            }
+        }
+        start = sequenceStart;
+    }
+
+    // and add the positions whose matches are now in the window
+    if (sequenceEnd > end) {
+        const char* s = sequence.data() - sequenceStart;
+        for (int k = 1; k <= maxUnitLength; ++k) {
+            deque<Run>& r = runs[k];
+            for (long int x = max(start, end - k); x + k < sequenceEnd; ++x) {
+                if (s[x] == s[x + k]) {
+                    if (!r.empty() && r.back().second == x) {
+                        ++r.back().second;
+                    } else {
+                        r.push_back(make_pair(x, x + 1));
+                    }
+                }
+            }
+        }
+        end = sequenceEnd;
+    }
+}
+
+static bool runStartsAfter(long int position, const pair<long int, long int>& run) {
+    return position < run.first;
+}
+
+int RepeatIndex::copies(long int position, int unitLength) const {
+    if (unitLength < 1 || unitLength > maxUnitLength
+        || position < start || position + unitLength > end) {
+        return 0;
+    }
+    const deque<Run>& r = runs[unitLength];
+    // the last run starting at or before the position
+    deque<Run>::const_iterator run = upper_bound(r.begin(), r.end(), position, runStartsAfter);
+    long int left = 0;  // matching bases before the position
+    long int right = 0; // and from it on
+    if (run != r.begin()) {
+        --run;
+        if (run->second > position) {
+            left = position - run->first;
+            right = run->second - position;
+        } else if (run->second == position) {
+            left = position - run->first;
+        }
+    }
+    // the unit at the position is itself one copy
+    return left / unitLength + 1 + right / unitLength;
+}
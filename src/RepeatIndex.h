@@ -0,0 +1,51 @@
+#ifndef FREEBAYES_REPEATINDEX_H
+#define FREEBAYES_REPEATINDEX_H
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <utility>
+
+using namespace std;
+
+// the tandem repeats of the cached window of reference sequence
+//
+// for each unit length k up to maxUnit, this keeps the runs of positions x
+// where the base at x matches the one at x + k.  a run [a, b) means the
+// sequence from a to b + k repeats with period k, so the copies of the unit
+// at a position, left and right of it, follow from the run around it
+// without comparing any sequence.  the runs are found in one pass over each
+// base as the window grows, and dropped as it is trimmed.
+class RepeatIndex {
+
+public:
+
+    RepeatIndex(int maxUnit = 12)
+        : maxUnitLength(maxUnit), runs(maxUnit + 1), start(0), end(0) { }
+
+    void clear(void);
+
+    // brings the index up to the window of sequence beginning at the
+    // sequenceStart.  windows extending or trimming the last one are
+    // indexed incrementally, others from scratch.
+    void update(const string& sequence, long int sequenceStart);
+
+    // the number of copies of the unit of the given length at the position
+    // which are found stepping left and right by whole units, as counted by
+    // AlleleParser::repeatCounts, or 0 if the unit doesn't fit in the window
+    int copies(long int position, int unitLength) const;
+
+    int maxUnit(void) const { return maxUnitLength; }
+
+private:
+
+    typedef pair<long int, long int> Run;
+
+    int maxUnitLength;
+    vector<deque<Run> > runs; // by unit length, sorted by start
+    long int start;           // the window indexed
+    long int end;
+
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include <string>
 #include <algorithm>
 #include <utility>
+#include <cmath>
 #include "Genotype.h"
 
 using namespace std;
@@ -15,10 +16,13 @@ public:
 
     string name;
     Sample* observations;
+    Probability lnFloor; // the --gl-margin floor the genotypes left out fall below, or -inf
+
+    Result(void) : observations(NULL), lnFloor(-INFINITY) { }
 
     void sortDataLikelihoods(void);
 
-    //pair<Genotype*, long double> bestMarginalGenotype(void);
+    //pair<Genotype*, Probability> bestMarginalGenotype(void);
 
 };
 
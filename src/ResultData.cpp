@@ -1,15 +1,166 @@
 #include "ResultData.h"
 #include "TryCatch.h"
+#include <unordered_map>
 
 using namespace std;
 
+// the numeric fields of a record are added both as their text and as their
+// values, which the BCF writer encodes without parsing the text
+template <typename T>
+static void addValue(vector<string>& text, vector<double>& values, T value) {
+    text.push_back(convert(value));
+    values.push_back((double) value);
+}
+
+template <typename T>
+static void addInfo(vcflib::Variant& var, RecordValues& values, const string& key, T value) {
+    addValue(var.info[key], values.info[key], value);
+}
+
+static void addInt(vector<string>& text, vector<double>& values, long int value) {
+    text.push_back(formatInt(value));
+    values.push_back(value);
+}
+
+static void addFloat(vector<string>& text, vector<double>& values, Probability value) {
+    text.push_back(formatFloat(value));
+    values.push_back(value);
+}
+
+
+void AlleleObservationStats::add(Allele& allele) {
+    ++count;
+    readMismatchSum += allele.readMismatchRate;
+    readSNPSum += allele.readSNPRate;
+    readIndelSum += allele.readIndelRate;
+    if (allele.isProperPair) {
+        ++properPairs;
+    }
+    if (!allele.sequencingTechnology.empty()) {
+        ++bySequencingTechnology[allele.sequencingTechnology];
+    }
+    basesLeft += allele.basesLeft;
+    basesRight += allele.basesRight;
+    if (allele.basesLeft >= allele.basesRight) {
+        readsLeft += 1;
+        if (allele.strand == STRAND_FORWARD) {
+            endLeft += 1;
+        } else {
+            endRight += 1;
+        }
+    } else {
+        readsRight += 1;
+        if (allele.strand == STRAND_FORWARD) {
+            endRight += 1;
+        } else {
+            endLeft += 1;
+        }
+    }
+    mqsum += allele.mapQuality;
+}
+
+SiteObservationStats::SiteObservationStats(
+    Samples& samples,
+    vector<string>& sampleNames,
+    const string& refbase,
+    vector<string>& altBases,
+    map<string, vector<Allele*> >& alleleGroups)
+    : basesInObservations(0) {
+
+    // the alleles of the same base share a column
+    unordered_map<string, int> columns;
+    columns[refbase] = 0;
+    column.push_back(0);
+    for (vector<string>::iterator b = altBases.begin(); b != altBases.end(); ++b) {
+        column.push_back(columns.insert(make_pair(*b, (int) columns.size())).first->second);
+    }
+    width = columns.size();
+
+    alleles.resize(width);
+    for (map<string, vector<Allele*> >::iterator g = alleleGroups.begin(); g != alleleGroups.end(); ++g) {
+        unordered_map<string, int>::iterator c = columns.find(g->first);
+        for (vector<Allele*>::iterator a = g->second.begin(); a != g->second.end(); ++a) {
+            basesInObservations += (*a)->alternateSequence.size();
+            if (c != columns.end()) {
+                alleles[c->second].add(**a);
+            }
+        }
+    }
+
+    totalQualSum.assign(width, 0);
+    totalPartialCount.assign(width, 0);
+    totalPartialQualSum.assign(width, 0);
+    size_t sampleTotal = sampleNames.size();
+    sampleObservations.assign(sampleTotal, 0);
+    sampleCount.assign(sampleTotal * width, 0);
+    sampleQualSum.assign(sampleTotal * width, 0);
+    sampleForward.assign(sampleTotal * width, 0);
+    sampleReverse.assign(sampleTotal * width, 0);
+
+    map<string, size_t> rows;
+    for (size_t i = 0; i < sampleTotal; ++i) {
+        rows[sampleNames[i]] = i;
+    }
+    for (Samples::iterator s = samples.begin(); s != samples.end(); ++s) {
+        Sample& sample = s->second;
+        map<string, size_t>::iterator r = rows.find(s->first);
+        bool inRecord = r != rows.end();
+        size_t row = inRecord ? r->second * width : 0;
+        for (Sample::iterator g = sample.begin(); g != sample.end(); ++g) {
+            if (inRecord) {
+                sampleObservations[r->second] += g->second.size();
+            }
+            unordered_map<string, int>::iterator c = columns.find(g->first);
+            if (c == columns.end()) {
+                continue;
+            }
+            // summed as integers, as Sample::qualSum does
+            int qsum = 0;
+            int forwardCount = 0;
+            int reverseCount = 0;
+            for (vector<Allele*>::iterator a = g->second.begin(); a != g->second.end(); ++a) {
+                qsum += (*a)->quality;
+                if ((*a)->strand == STRAND_FORWARD) {
+                    ++forwardCount;
+                } else if ((*a)->strand == STRAND_REVERSE) {
+                    ++reverseCount;
+                }
+            }
+            totalQualSum[c->second] += qsum;
+            if (inRecord) {
+                sampleCount[row + c->second] += g->second.size();
+                sampleQualSum[row + c->second] += qsum;
+                sampleForward[row + c->second] += forwardCount;
+                sampleReverse[row + c->second] += reverseCount;
+            }
+        }
+        for (map<string, vector<Allele*> >::iterator p = sample.partialSupport.begin(); p != sample.partialSupport.end(); ++p) {
+            unordered_map<string, int>::iterator c = columns.find(p->first);
+            if (c == columns.end()) {
+                continue;
+            }
+            // summed by sample, as Samples::partialObservationCount does
+            double partialCount = 0;
+            double partialQualSum = 0;
+            for (vector<Allele*>::iterator a = p->second.begin(); a != p->second.end(); ++a) {
+                double supported = sample.reversePartials[*a].size();
+                partialCount += (double) 1 / supported;
+                partialQualSum += (double) (*a)->quality / supported;
+            }
+            totalPartialCount[c->second] += partialCount;
+            totalPartialQualSum[c->second] += partialQualSum;
+        }
+    }
+
+}
+
 
 
 vcflib::Variant& Results::vcf(
     vcflib::Variant& var, // variant to update
-    BigFloat pHom,
-    long double bestComboOddsRatio,
-    //long double alleleSamplingProb,
+    Probability lnHom,
+    Probability bestComboOddsRatio,
+    //Probability alleleSamplingProb,
     Samples& samples,
     string refbase,
     vector<Allele>& altAllelesIncludingNulls,
@@ -23,9 +174,11 @@ vcflib::Variant& Results::vcf(
     map<Allele*, set<Allele*> >& partialObservationSupport,
     map<int, vector<Genotype> >& genotypesByPloidy,
     vector<string>& sequencingTechnologies,
-    AlleleParser* parser) {
+    AlleleParser* parser,
+    WorkerTeam* team) {
 
     Parameters& parameters = parser->parameters;
+    values.clear();
 
     GenotypeComboMap comboMap;
     genotypeCombo2Map(genotypeCombo, comboMap);
@@ -44,7 +197,7 @@ vcflib::Variant& Results::vcf(
     map<string, string> adjustedCigar;
     vector<Allele>& adjustedAltAlleles = altAlleles; // just an alias
     for (vector<Allele>::iterator aa = altAlleles.begin(); aa != altAlleles.end(); ++aa) {
-        adjustedCigar[aa->base()] = aa->cigar;
+        adjustedCigar[aa->base()] = aa->cigar.str();
         var.alt.push_back(aa->alternateSequence);
     }
 
@@ -63,7 +216,8 @@ vcflib::Variant& Results::vcf(
     var.filter = ".";
 
     // note that we set QUAL to 0 at loci with no data
-    var.quality = max((long double) 0, nan2zero(big2phred(pHom)));
+    // (and at those where no combination is homozygous reference)
+    var.quality = std::isfinite(lnHom) ? max((Probability) 0, nan2zero(ln2phred(lnHom))) : 0;
     if (coverage == 0) {
         var.quality = 0;
     }
@@ -76,85 +230,52 @@ vcflib::Variant& Results::vcf(
     if (parameters.calculateMarginals) var.format.push_back("GQ");
     // XXX
     var.format.push_back("DP");
-    var.format.push_back("AD");
+    // with --local-alleles, the per-allele fields of multi-allelic records
+    // cover only the alleles each sample has, listed in LAA
+    bool localAlleles = parameters.localAlleles && altAlleles.size() > 1;
+    if (localAlleles) {
+        var.format.push_back("LAA");
+        var.format.push_back("LAD");
+    } else {
+        var.format.push_back("AD");
+    }
     var.format.push_back("RO");
     var.format.push_back("QR");
-    var.format.push_back("AO");
-    var.format.push_back("QA");
+    var.format.push_back(localAlleles ? "LAO" : "AO");
+    var.format.push_back(localAlleles ? "LQA" : "QA");
     // add GL/GLE later, when we know if we need to use one or the other
 
-    unsigned int refBasesLeft = 0;
-    unsigned int refBasesRight = 0;
-    unsigned int refReadsLeft = 0;
-    unsigned int refReadsRight = 0;
-    unsigned int refEndLeft = 0;
-    unsigned int refEndRight = 0;
-    unsigned int refmqsum = 0;
-    unsigned int refProperPairs = 0;
-    long double refReadMismatchSum = 0;
-    long double refReadSNPSum = 0;
-    long double refReadIndelSum = 0;
-    long double refReadSoftClipSum = 0;
-    unsigned int refObsCount = 0;
-    map<string, int> refObsBySequencingTechnology;
-
-    map<string, vector<Allele*> >::iterator f = alleleGroups.find(refbase);
-    if (f != alleleGroups.end()) {
-        vector<Allele*>& referenceAlleles = alleleGroups.at(refbase);
-        refObsCount = referenceAlleles.size();
-        for (vector<Allele*>::iterator app = referenceAlleles.begin(); app != referenceAlleles.end(); ++app) {
-            Allele& allele = **app;
-            refReadMismatchSum += allele.readMismatchRate;
-            refReadSNPSum += allele.readSNPRate;
-            refReadIndelSum += allele.readIndelRate;
-            if (allele.isProperPair) {
-                ++refProperPairs;
-            }
-            if (!allele.sequencingTechnology.empty()) {
-                ++refObsBySequencingTechnology[allele.sequencingTechnology];
-            }
-            refBasesLeft += allele.basesLeft;
-            refBasesRight += allele.basesRight;
-            if (allele.basesLeft >= allele.basesRight) {
-                refReadsLeft += 1;
-                if (allele.strand == STRAND_FORWARD) {
-                    refEndLeft += 1;
-                } else {
-                    refEndRight += 1;
-                }
-            } else {
-                refReadsRight += 1;
-                if (allele.strand == STRAND_FORWARD) {
-                    refEndRight += 1;
-                } else {
-                    refEndLeft += 1;
-                }
-            }
-            refmqsum += allele.mapQuality;
-        }
+    vector<string> altBases;
+    for (vector<Allele>::iterator aa = altAlleles.begin(); aa != altAlleles.end(); ++aa) {
+        altBases.push_back(aa->base());
     }
+    SiteObservationStats stats(samples, sampleNames, refbase, altBases, alleleGroups);
+
+    const AlleleObservationStats& ref = stats.site(0);
+    unsigned int refObsCount = ref.count;
 
-    long double refReadMismatchRate = (refObsCount == 0 ? 0 : refReadMismatchSum / (long double) refObsCount);
-    long double refReadSNPRate = (refObsCount == 0 ? 0 : refReadSNPSum / (long double) refObsCount);
-    long double refReadIndelRate = (refObsCount == 0 ? 0 : refReadIndelSum / (long double) refObsCount);
+    Probability refReadMismatchRate = (refObsCount == 0 ? 0 : ref.readMismatchSum / (Probability) refObsCount);
+    Probability refReadSNPRate = (refObsCount == 0 ? 0 : ref.readSNPSum / (Probability) refObsCount);
+    Probability refReadIndelRate = (refObsCount == 0 ? 0 : ref.readIndelSum / (Probability) refObsCount);
 
     //var.info["XRM"].push_back(convert(refReadMismatchRate));
     //var.info["XRS"].push_back(convert(refReadSNPRate));
     //var.info["XRI"].push_back(convert(refReadIndelRate));
 
-    var.info["MQMR"].push_back(convert((refObsCount == 0) ? 0 : (double) refmqsum / (double) refObsCount));
-    var.info["RPPR"].push_back(convert((refObsCount == 0) ? 0 : nan2zero(ln2phred(hoeffdingln(refReadsLeft, refReadsRight + refReadsLeft, 0.5)))));
-    var.info["EPPR"].push_back(convert((refBasesLeft + refBasesRight == 0) ? 0 : nan2zero(ln2phred(hoeffdingln(refEndLeft, refEndLeft + refEndRight, 0.5)))));
-    var.info["PAIREDR"].push_back(convert((refObsCount == 0) ? 0 : (double) refProperPairs / (double) refObsCount));
+    addInfo(var, values, "MQMR", (refObsCount == 0) ? 0 : (double) ref.mqsum / (double) refObsCount);
+    addInfo(var, values, "RPPR", (refObsCount == 0) ? 0 : hoeffdingPhred(ref.readsLeft, ref.readsRight + ref.readsLeft));
+    addInfo(var, values, "EPPR", (ref.basesLeft + ref.basesRight == 0) ? 0 : hoeffdingPhred(ref.endLeft, ref.endLeft + ref.endRight));
+    addInfo(var, values, "PAIREDR", (refObsCount == 0) ? 0 : (double) ref.properPairs / (double) refObsCount);
 
     //var.info["HWE"].push_back(convert(nan2zero(ln2phred(genotypeCombo.hweComboProb()))));
-    var.info["GTI"].push_back(convert(genotypingIterations));
+    addInfo(var, values, "GTI", genotypingIterations);
 
     // loop over all alternate alleles
     for (vector<Allele>::iterator aa = altAlleles.begin(); aa != altAlleles.end(); ++aa) {
 
         Allele& altAllele = *aa;
         string altbase = altAllele.base();
+        size_t allele = aa - altAlleles.begin() + 1; // in the stats
 
         // count alternate alleles in the best genotyping
         unsigned int alternateCount = 0;
@@ -180,9 +301,8 @@ vcflib::Variant& Results::vcf(
         unsigned int hetAllObsCount = 0;
 
         StrandBaseCounts baseCountsTotal;
-        map<string, StrandBaseCounts> baseCountsBySample;
-        for (vector<string>::iterator sampleName = sampleNames.begin(); sampleName != sampleNames.end(); ++sampleName) {
-            GenotypeComboMap::iterator gc = comboMap.find(*sampleName);
+        for (size_t i = 0; i < sampleNames.size(); ++i) {
+            GenotypeComboMap::iterator gc = comboMap.find(sampleNames[i]);
             //cerr << "alternate count for " << altbase << " and " << *genotype << " is " << genotype->alleleCount(altbase) << endl;
             if (gc != comboMap.end()) {
                 Genotype* genotype = gc->second->genotype;
@@ -190,7 +310,7 @@ vcflib::Variant& Results::vcf(
                 Sample& sample = *gc->second->sample;
 
                 // check that we actually have observations for this sample
-                unsigned int observationCount = sample.observationCount();
+                unsigned int observationCount = stats.observationCount(i);
                 if (observationCount == 0) {
                     continue;
                 }
@@ -198,8 +318,8 @@ vcflib::Variant& Results::vcf(
                 alternateCount += genotype->alleleCount(altbase);
                 alleleCount += genotype->ploidy;
 
-                unsigned int altCount = sample.observationCount(altbase);
-                unsigned int refCount = sample.observationCount(refbase);
+                unsigned int altCount = stats.count(i, allele);
+                unsigned int refCount = stats.count(i, 0);
 
                 if (!genotype->homozygous) {
                     // het case
@@ -228,75 +348,22 @@ vcflib::Variant& Results::vcf(
                         refSampleObsCount += observationCount;
                     }
                 }
-                //altCountBySample[*sampleName] = altCount;
-
-                //altQualBySample[*sampleName] = sample.qualSum(altbase);
 
-                StrandBaseCounts baseCounts = sample.strandBaseCount(refbase, altbase);
-                baseCountsBySample[*sampleName] = baseCounts;
-                baseCountsTotal.forwardRef += baseCounts.forwardRef;
-                baseCountsTotal.forwardAlt += baseCounts.forwardAlt;
-                baseCountsTotal.reverseRef += baseCounts.reverseRef;
-                baseCountsTotal.reverseAlt += baseCounts.reverseAlt;
+                baseCountsTotal.forwardRef += stats.forward(i, 0);
+                baseCountsTotal.forwardAlt += stats.forward(i, allele);
+                baseCountsTotal.reverseRef += stats.reverse(i, 0);
+                baseCountsTotal.reverseAlt += stats.reverse(i, allele);
             }
         }
 
-        unsigned int altBasesLeft = 0;
-        unsigned int altBasesRight = 0;
-        unsigned int altReadsLeft = 0;
-        unsigned int altReadsRight = 0;
-        unsigned int altEndLeft = 0;
-        unsigned int altEndRight = 0;
-        unsigned int altmqsum = 0;
-        unsigned int altproperPairs = 0;
-        long double altReadMismatchSum = 0;
-        long double altReadSNPSum = 0;
-        long double altReadIndelSum = 0;
-        unsigned int altObsCount = 0;
-        map<string, int> altObsBySequencingTechnology;
-
         // TODO we need a partial obs structure to annotate partial obs
-        map<string, vector<Allele*> >::iterator f = alleleGroups.find(altbase);
-        if (f != alleleGroups.end()) {
-            vector<Allele*>& alternateAlleles = alleleGroups.at(altbase);
-            // TODO XXX XXX adjust to use partial observations
-            altObsCount = alternateAlleles.size();
-            for (vector<Allele*>::iterator app = alternateAlleles.begin(); app != alternateAlleles.end(); ++app) {
-                Allele& allele = **app;
-                altReadMismatchSum += allele.readMismatchRate;
-                altReadSNPSum += allele.readSNPRate;
-                altReadIndelSum += allele.readIndelRate;
-				// TODO: add altReadSoftClipRate (avg)
-                if (allele.isProperPair) {
-                    ++altproperPairs;
-                }
-                if (!allele.sequencingTechnology.empty()) {
-                    ++altObsBySequencingTechnology[allele.sequencingTechnology];
-                }
-                altBasesLeft += allele.basesLeft;
-                altBasesRight += allele.basesRight;
-                if (allele.basesLeft >= allele.basesRight) {
-                    altReadsLeft += 1;
-                    if (allele.strand == STRAND_FORWARD) {
-                        altEndLeft += 1;
-                    } else {
-                        altEndRight += 1;
-                    }
-                } else {
-                    altReadsRight += 1;
-                    if (allele.strand == STRAND_FORWARD) {
-                        altEndRight += 1;
-                    } else {
-                        altEndLeft += 1;
-                    }
-                }
-                altmqsum += allele.mapQuality;
-            }
-        }
+        // TODO XXX XXX adjust to use partial observations
+        const AlleleObservationStats& alt = stats.site(allele);
+        unsigned int altObsCount = alt.count;
 
-        long double altReadMismatchRate = (altObsCount == 0 ? 0 : altReadMismatchSum / altObsCount);
-        long double altReadSNPRate = (altObsCount == 0 ? 0 : altReadSNPSum / altObsCount);
-        long double altReadIndelRate = (altObsCount == 0 ? 0 : altReadIndelSum / altObsCount);
+        Probability altReadMismatchRate = (altObsCount == 0 ? 0 : alt.readMismatchSum / altObsCount);
+        Probability altReadSNPRate = (altObsCount == 0 ? 0 : alt.readSNPSum / altObsCount);
+        Probability altReadIndelRate = (altObsCount == 0 ? 0 : alt.readIndelSum / altObsCount);
 
         //var.info["XAM"].push_back(convert(altReadMismatchRate));
         //var.info["XAS"].push_back(convert(altReadSNPRate));
@@ -313,47 +380,50 @@ vcflib::Variant& Results::vcf(
         //out.setf(ios::fixed,ios::floatfield);
         //out.precision(5);
 
-        var.info["AC"].push_back(convert(alternateCount));
-        var.info["AN"].clear(); var.info["AN"].push_back(convert(alleleCount)); // XXX hack...
-        var.info["AF"].push_back(convert((alleleCount == 0) ? 0 : (double) alternateCount / (double) alleleCount));
-        var.info["AO"].push_back(convert(altObsCount));
-        var.info["PAO"].push_back(convert(samples.partialObservationCount(altbase)));
-        var.info["QA"].push_back(convert(samples.qualSum(altbase)));
-        var.info["PQA"].push_back(convert(samples.partialQualSum(altbase)));
+        addInfo(var, values, "AC", alternateCount);
+        var.info["AN"].clear(); values.info["AN"].clear(); addInfo(var, values, "AN", alleleCount); // XXX hack...
+        addInfo(var, values, "AF", (alleleCount == 0) ? 0 : (double) alternateCount / (double) alleleCount);
+        addInfo(var, values, "AO", altObsCount);
+        addInfo(var, values, "PAO", stats.partialCount(allele));
+        addInfo(var, values, "QA", stats.qualSum(allele));
+        addInfo(var, values, "PQA", stats.partialQualSum(allele));
         if (homRefSamples > 0 && hetAltSamples + homAltSamples > 0) {
             double altSampleAverageDepth = (double) altSampleObsCount
                 / ( (double) hetAltSamples + (double) homAltSamples );
             double refSampleAverageDepth = (double) refSampleObsCount / (double) homRefSamples;
-            var.info["DPRA"].push_back(convert(altSampleAverageDepth / refSampleAverageDepth));
+            addInfo(var, values, "DPRA", altSampleAverageDepth / refSampleAverageDepth);
         } else {
-            var.info["DPRA"].push_back(convert(0));
+            addInfo(var, values, "DPRA", 0);
         }
 
         var.info["SRP"].clear(); // XXX hack
         var.info["SRF"].clear();
         var.info["SRR"].clear();
-        var.info["SRF"].push_back(convert(baseCountsTotal.forwardRef));
-        var.info["SRR"].push_back(convert(baseCountsTotal.reverseRef));
-        var.info["SRP"].push_back(convert((refObsCount == 0) ? 0 : nan2zero(ln2phred(hoeffdingln(baseCountsTotal.forwardRef, refObsCount, 0.5)))));
-        var.info["SAF"].push_back(convert(baseCountsTotal.forwardAlt));
-        var.info["SAR"].push_back(convert(baseCountsTotal.reverseAlt));
-        var.info["SAP"].push_back(convert((altObsCount == 0) ? 0 : nan2zero(ln2phred(hoeffdingln(baseCountsTotal.forwardAlt, altObsCount, 0.5)))));
-        var.info["AB"].push_back(convert((hetAllObsCount == 0) ? 0 : nan2zero((double) hetAlternateObsCount / (double) hetAllObsCount )));
-        var.info["ABP"].push_back(convert((hetAllObsCount == 0) ? 0 : nan2zero(ln2phred(hoeffdingln(hetAlternateObsCount, hetAllObsCount, 0.5)))));
-        var.info["RUN"].push_back(convert(parser->homopolymerRunLeft(altbase) + 1 + parser->homopolymerRunRight(altbase)));
-        var.info["MQM"].push_back(convert((altObsCount == 0) ? 0 : nan2zero((double) altmqsum / (double) altObsCount)));
-        var.info["RPP"].push_back(convert((altObsCount == 0) ? 0 : nan2zero(ln2phred(hoeffdingln(altReadsLeft, altReadsRight + altReadsLeft, 0.5)))));
-        var.info["RPR"].push_back(convert(altReadsRight));
-		var.info["RPL"].push_back(convert(altReadsLeft));
-        var.info["EPP"].push_back(convert((altBasesLeft + altBasesRight == 0) ? 0 : nan2zero(ln2phred(hoeffdingln(altEndLeft, altEndLeft + altEndRight, 0.5)))));
-        var.info["PAIRED"].push_back(convert((altObsCount == 0) ? 0 : nan2zero((double) altproperPairs / (double) altObsCount)));
+        values.info["SRP"].clear();
+        values.info["SRF"].clear();
+        values.info["SRR"].clear();
+        addInfo(var, values, "SRF", baseCountsTotal.forwardRef);
+        addInfo(var, values, "SRR", baseCountsTotal.reverseRef);
+        addInfo(var, values, "SRP", (refObsCount == 0) ? 0 : hoeffdingPhred(baseCountsTotal.forwardRef, refObsCount));
+        addInfo(var, values, "SAF", baseCountsTotal.forwardAlt);
+        addInfo(var, values, "SAR", baseCountsTotal.reverseAlt);
+        addInfo(var, values, "SAP", (altObsCount == 0) ? 0 : hoeffdingPhred(baseCountsTotal.forwardAlt, altObsCount));
+        addInfo(var, values, "AB", (hetAllObsCount == 0) ? 0 : nan2zero((double) hetAlternateObsCount / (double) hetAllObsCount ));
+        addInfo(var, values, "ABP", (hetAllObsCount == 0) ? 0 : hoeffdingPhred(hetAlternateObsCount, hetAllObsCount));
+        addInfo(var, values, "RUN", parser->homopolymerRunLeft(altbase) + 1 + parser->homopolymerRunRight(altbase));
+        addInfo(var, values, "MQM", (altObsCount == 0) ? 0 : nan2zero((double) alt.mqsum / (double) altObsCount));
+        addInfo(var, values, "RPP", (altObsCount == 0) ? 0 : hoeffdingPhred(alt.readsLeft, alt.readsRight + alt.readsLeft));
+        addInfo(var, values, "RPR", alt.readsRight);
+		addInfo(var, values, "RPL", alt.readsLeft);
+        addInfo(var, values, "EPP", (alt.basesLeft + alt.basesRight == 0) ? 0 : hoeffdingPhred(alt.endLeft, alt.endLeft + alt.endRight));
+        addInfo(var, values, "PAIRED", (altObsCount == 0) ? 0 : nan2zero((double) alt.properPairs / (double) altObsCount));
         var.info["CIGAR"].push_back(adjustedCigar[altAllele.base()]);
-        var.info["MEANALT"].push_back(convert((hetAltSamples + homAltSamples == 0) ? 0 : nan2zero((double) uniqueAllelesInAltSamples / (double) (hetAltSamples + homAltSamples))));
+        addInfo(var, values, "MEANALT", (hetAltSamples + homAltSamples == 0) ? 0 : nan2zero((double) uniqueAllelesInAltSamples / (double) (hetAltSamples + homAltSamples)));
 
         for (vector<string>::iterator st = sequencingTechnologies.begin();
              st != sequencingTechnologies.end(); ++st) { string& tech = *st;
-            var.info["technology." + tech].push_back(convert((altObsCount == 0) ? 0
-                                                             : nan2zero((double) altObsBySequencingTechnology[tech] / (double) altObsCount )));
+            addInfo(var, values, "technology." + tech, (altObsCount == 0) ? 0
+                    : nan2zero((double) alt.technologyCount(tech) / (double) altObsCount ));
         }
 
         // allele class
@@ -385,7 +455,7 @@ vcflib::Variant& Results::vcf(
                  << "allele: " << altAllele << endl;
             */
         }
-        var.info["LEN"].push_back(convert(altAllele.length));
+        addInfo(var, values, "LEN", altAllele.length);
 
     }
 
@@ -397,46 +467,33 @@ vcflib::Variant& Results::vcf(
     // site-wide coverage
     int samplesWithData = 0;
     int refAlleleObservations = 0;
-    for (vector<string>::iterator sampleName = sampleNames.begin(); sampleName != sampleNames.end(); ++sampleName) {
-        GenotypeComboMap::iterator gc = comboMap.find(*sampleName);
-        //cerr << "alternate count for " << altbase << " and " << *genotype << " is " << genotype->alleleCount(altbase) << endl;
-        if (gc != comboMap.end()) {
-            Genotype* genotype = gc->second->genotype;
-
-            Sample& sample = *gc->second->sample;
-            //refAlleleObservations += sample.observationCount(refbase);
-            refAlleleObservations += sample.observationCount(refbase);
-
+    for (size_t i = 0; i < sampleNames.size(); ++i) {
+        if (comboMap.find(sampleNames[i]) != comboMap.end()) {
+            refAlleleObservations += stats.count(i, 0);
             ++samplesWithData;
         }
     }
 
-    var.info["NS"].push_back(convert(samplesWithData));
-    var.info["DP"].push_back(convert(coverage));
-    var.info["RO"].push_back(convert(refAlleleObservations));
-    var.info["PRO"].push_back(convert(samples.partialObservationCount(refbase)));
-    var.info["QR"].push_back(convert(samples.qualSum(refbase)));
-    var.info["PQR"].push_back(convert(samples.partialQualSum(refbase)));
+    addInfo(var, values, "NS", samplesWithData);
+    addInfo(var, values, "DP", coverage);
+    addInfo(var, values, "RO", refAlleleObservations);
+    addInfo(var, values, "PRO", stats.partialCount(0));
+    addInfo(var, values, "QR", stats.qualSum(0));
+    addInfo(var, values, "PQR", stats.partialQualSum(0));
 
     // tally partial observations to get a mean coverage per bp of reference
     int haplotypeLength = refbase.size();
-    int basesInObservations = 0;
-
-    for (map<string, vector<Allele*> >::iterator g = alleleGroups.begin(); g != alleleGroups.end(); ++g) {
-        for (vector<Allele*>::iterator a = g->second.begin(); a != g->second.end(); ++a) {
-            basesInObservations += (*a)->alternateSequence.size();
-        }
-    }
+    int basesInObservations = stats.basesInObservations;
 
     for (map<Allele*, set<Allele*> >::iterator p = partialObservationSupport.begin(); p != partialObservationSupport.end(); ++p) {
         basesInObservations += p->first->alternateSequence.size();
     }
 
     double depthPerBase = (double) basesInObservations / (double) haplotypeLength;
-    var.info["DPB"].push_back(convert(depthPerBase));
+    addInfo(var, values, "DPB", depthPerBase);
 
     // number of alternate alleles
-    var.info["NUMALT"].push_back(convert(altAlleles.size()));
+    addInfo(var, values, "NUMALT", altAlleles.size());
 
     if (parameters.showReferenceRepeats && !repeats.empty()) {
         stringstream repeatsstr;
@@ -449,7 +506,7 @@ vcflib::Variant& Results::vcf(
         var.info["REPEAT"].push_back(repeatstr);
     }
 
-    var.info["ODDS"].push_back(convert(bestComboOddsRatio));
+    addInfo(var, values, "ODDS", bestComboOddsRatio);
 
     // samples
 
@@ -494,142 +551,296 @@ vcflib::Variant& Results::vcf(
     }
 
     // get the best genotypes from the combos, and set the output GTs and GQs using them
-    for (vector<string>::iterator sn = sampleNames.begin(); sn != sampleNames.end(); ++sn) {
-        string& sampleName = *sn;
-        GenotypeComboMap::iterator gc = comboMap.find(sampleName);
-        Results::iterator s = find(sampleName);
-        map<string, vector<string> >& sampleOutput = var.samples[sampleName];
-        if (gc != comboMap.end() && s != end()) {
-
-            Sample& sample = *gc->second->sample;
-            Result& sampleLikelihoods = s->second;
-            Genotype* genotype = gc->second->genotype;
-            if (sample.observationCount() == 0) {
-                continue;
+    //
+    // the values of each sample are computed into typed columns and then
+    // formatted into its own entry of var.samples, so with enough samples
+    // the genotyping team fills chunks of them in parallel
+    size_t sampleCount = sampleNames.size();
+    size_t altCount = altAlleles.size();
+    // which are only output when every genotype has one
+    bool outputGenotypeLikelihoods = outputAnyGenotypeLikelihoods
+        && !parameters.excludeUnobservedGenotypes && !parameters.excludePartiallyObservedGenotypes
+        && parameters.poolFrequencyGrid == 0;
+    // entries are made for every sample up front, so the workers only touch their own
+    vector<map<string, vector<string> >*> sampleOutputs(sampleCount);
+    vector<map<string, vector<double> >*> sampleValues(sampleCount);
+    for (size_t i = 0; i < sampleCount; ++i) {
+        sampleOutputs[i] = &var.samples[sampleNames[i]];
+        sampleValues[i] = &values.samples[sampleNames[i]];
+    }
+    SampleColumns columns(sampleCount, altCount);
+
+    // the VCF order of the genotype, or -1 if it has none
+    auto genotypeOrder = [&](Genotype* genotype) {
+        map<int, map<string, int> >::iterator p = vcfGenotypeOrder.find(genotype->ploidy);
+        if (p != vcfGenotypeOrder.end()) {
+            map<string, int>::iterator o = p->second.find(genotype->str());
+            if (o != p->second.end()) {
+                return o->second;
             }
+        }
+        return -1;
+    };
+
+    // if the genotype has null (unspecified) alleles, these are the fully
+    // specified genotypes it can match with.  the gls for these will be the
+    // same, so the gl for this genotype can be used for all of them.  these
+    // are the genotypes which the sample does not have, but for which one
+    // allele or no alleles match
+    auto nullMatchingGenotypes = [&](Genotype* genotype) {
+        map<int, vector<Genotype> >::iterator p = genotypesByPloidy.find(genotype->ploidy);
+        return p != genotypesByPloidy.end() ? genotype->nullMatchingGenotypes(p->second) : vector<Genotype*>();
+    };
+
+    auto fillSample = [&](size_t i) {
+        GenotypeComboMap::iterator gc = comboMap.find(sampleNames[i]);
+        Results::iterator s = find(sampleNames[i]);
+        if (gc == comboMap.end() || s == end()) {
+            return;
+        }
+        Result& sampleLikelihoods = s->second;
+        Genotype* genotype = gc->second->genotype;
+        if (stats.observationCount(i) == 0) {
+            return;
+        }
+        columns.called[i] = true;
 
-            sampleOutput["GT"].push_back(genotype->relativeGenotype(refbase, altAlleles));
-
-            if (parameters.calculateMarginals) {
-                double val = nan2zero(big2phred((BigFloat)1 - big_exp(sampleLikelihoods.front().marginal)));
-                if (parameters.strictVCF)
-                    sampleOutput["GQ"].push_back(convert(int(round(val))));
-                else
-                    sampleOutput["GQ"].push_back(convert(val));
-            }
+        columns.gt[i] = genotype->relativeGenotype(refbase, altAlleles);
+        if (parameters.calculateMarginals) {
+            columns.gq[i] = nan2zero(big2phred((BigFloat)1 - big_exp(sampleLikelihoods.front().marginal)));
+        }
+        columns.dp[i] = stats.observationCount(i);
+        columns.ro[i] = stats.count(i, 0);
+        columns.qr[i] = stats.qualSum(i, 0);
+        for (size_t a = 0; a < altCount; ++a) {
+            columns.ao[i * altCount + a] = stats.count(i, a + 1);
+            columns.qa[i * altCount + a] = stats.qualSum(i, a + 1);
+        }
 
-            sampleOutput["DP"].push_back(convert(sample.observationCount()));
-            sampleOutput["AD"].push_back(convert(sample.observationCount(refbase)));
-            sampleOutput["RO"].push_back(convert(sample.observationCount(refbase)));
-            sampleOutput["QR"].push_back(convert(sample.qualSum(refbase)));
-
-            for (vector<Allele>::iterator aa = altAlleles.begin(); aa != altAlleles.end(); ++aa) {
-                Allele& altAllele = *aa;
-                string altbase = altAllele.base();
-                sampleOutput["AO"].push_back(convert(sample.observationCount(altbase)));
-                sampleOutput["AD"].push_back(convert(sample.observationCount(altbase)));
-                sampleOutput["QA"].push_back(convert(sample.qualSum(altbase)));
+        // the local alleles are those observed or called in the sample
+        if (localAlleles) {
+            vector<int> gtspec;
+            genotype->relativeGenotype(gtspec, refbase, altAlleles);
+            set<int> called(gtspec.begin(), gtspec.end());
+            for (size_t a = 0; a < altCount; ++a) {
+                if (columns.ao[i * altCount + a] > 0 || called.count(a + 1)) {
+                    columns.laa[i].push_back(a + 1);
+                }
             }
+        }
 
-            if (outputAnyGenotypeLikelihoods && !parameters.excludeUnobservedGenotypes && !parameters.excludePartiallyObservedGenotypes) {
+        if (!outputGenotypeLikelihoods) {
+            return;
+        }
 
-                // get data likelihoods for present genotypes, none if we have excluded genotypes from data likelihood calculations
-                if (outputExplicitGenotypeLikelihoods) {
+        // get data likelihoods for present genotypes, none if we have excluded genotypes from data likelihood calculations
+        if (outputExplicitGenotypeLikelihoods) {
 
-                    if (var.format.back() != "GLE") {
-                        var.format.push_back("GLE");
+            map<string, Probability>& genotypeLikelihoodsExplicit = columns.gle[i];
+            for (Result::iterator g = sampleLikelihoods.begin(); g != sampleLikelihoods.end(); ++g) {
+                if (g->genotype->hasNullAllele()) {
+                    vector<Genotype*> nullmatchgts = nullMatchingGenotypes(g->genotype);
+                    for (vector<Genotype*>::iterator n = nullmatchgts.begin(); n != nullmatchgts.end(); ++n) {
+                        genotypeLikelihoodsExplicit[(*n)->relativeGenotype(refbase, altAlleles)] = ln2log10(g->prob);
                     }
-
-                    map<string, string> genotypeLikelihoodsExplicit;
-
-                    for (Result::iterator g = sampleLikelihoods.begin(); g != sampleLikelihoods.end(); ++g) {
-                        if (g->genotype->hasNullAllele()) {
-                            // if the genotype has null (unspecified) alleles, find
-                            // the fully specified genotypes it can match with.
-                            vector<Genotype*> nullmatchgts = g->genotype->nullMatchingGenotypes(genotypesByPloidy[g->genotype->ploidy]);
-                            // the gls for these will be the same, so the gl for
-                            // this genotype can be used for all of them.  these
-                            // are the genotypes which the sample does not have,
-                            // but for which one allele or no alleles match
-                            for (vector<Genotype*>::iterator n = nullmatchgts.begin(); n != nullmatchgts.end(); ++n) {
-                                genotypeLikelihoodsExplicit[(*n)->relativeGenotype(refbase, altAlleles)] = convert(ln2log10(g->prob));
-                            }
-                        } else {
-                            // otherwise, we are well-specified, and only one
-                            // genotype should match
-                            genotypeLikelihoodsExplicit[g->genotype->relativeGenotype(refbase, altAlleles)] = convert(ln2log10(g->prob));
+                } else {
+                    // otherwise, we are well-specified, and only one
+                    // genotype should match
+                    genotypeLikelihoodsExplicit[g->genotype->relativeGenotype(refbase, altAlleles)] = ln2log10(g->prob);
+                }
+            }
+            // the genotypes --gl-margin left out are given its floor
+            if (sampleLikelihoods.lnFloor != -INFINITY) {
+                vector<Genotype>& genotypes = genotypesByPloidy[genotype->ploidy];
+                for (vector<Genotype>::iterator g = genotypes.begin(); g != genotypes.end(); ++g) {
+                    if (!g->hasNullAllele()) {
+                        string relative = g->relativeGenotype(refbase, altAlleles);
+                        if (!genotypeLikelihoodsExplicit.count(relative)) {
+                            genotypeLikelihoodsExplicit[relative] = ln2log10(sampleLikelihoods.lnFloor);
                         }
                     }
+                }
+            }
 
-                    vector<string> datalikelihoods;
-                    for (map<string, string>::iterator gle = genotypeLikelihoodsExplicit.begin(); gle != genotypeLikelihoodsExplicit.end(); ++gle) {
-                        datalikelihoods.push_back(gle->first + "^" + gle->second);
-                    }
-                    sampleOutput["GLE"].push_back(join(datalikelihoods, "|"));
+        } else {
 
+            map<int, double> genotypeLikelihoods;
+            for (Result::iterator g = sampleLikelihoods.begin(); g != sampleLikelihoods.end(); ++g) {
+                if (g->genotype->hasNullAllele()) {
+                    vector<Genotype*> nullmatchgts = nullMatchingGenotypes(g->genotype);
+                    for (vector<Genotype*>::iterator n = nullmatchgts.begin(); n != nullmatchgts.end(); ++n) {
+                        int o = genotypeOrder(*n);
+                        if (o >= 0) {
+                            genotypeLikelihoods[o] = ln2log10(g->prob);
+                        }
+                    }
                 } else {
-
-                    if (var.format.back() != "GL") {
-                        var.format.push_back("GL");
+                    // otherwise, we are well-specified, and only one
+                    // genotype should match
+                    int o = genotypeOrder(g->genotype);
+                    if (o >= 0) {
+                        genotypeLikelihoods[o] = ln2log10(g->prob);
                     }
-
-                    map<int, double> genotypeLikelihoods;
-                    map<int, string> genotypeLikelihoodsOutput;
-
-                    for (Result::iterator g = sampleLikelihoods.begin(); g != sampleLikelihoods.end(); ++g) {
-                        if (g->genotype->hasNullAllele()) {
-                            // if the genotype has null (unspecified) alleles, find
-                            // the fully specified genotypes it can match with.
-                            vector<Genotype*> nullmatchgts = g->genotype->nullMatchingGenotypes(genotypesByPloidy[g->genotype->ploidy]);
-                            // the gls for these will be the same, so the gl for
-                            // this genotype can be used for all of them.  these
-                            // are the genotypes which the sample does not have,
-                            // but for which one allele or no alleles match
-                            for (vector<Genotype*>::iterator n = nullmatchgts.begin(); n != nullmatchgts.end(); ++n) {
-                                map<string, int>::iterator o = vcfGenotypeOrder[(*n)->ploidy].find((*n)->str());
-                                if (o != vcfGenotypeOrder[(*n)->ploidy].end()) {
-                                    genotypeLikelihoods[o->second] = ln2log10(g->prob);
-                                }
-                            }
-                        } else {
-                            // otherwise, we are well-specified, and only one
-                            // genotype should match
-                            map<string, int>::iterator o = vcfGenotypeOrder[g->genotype->ploidy].find(g->genotype->str());
-                            if (o != vcfGenotypeOrder[g->genotype->ploidy].end()) {
-                                genotypeLikelihoods[o->second] = ln2log10(g->prob);
-                            }
+                }
+            }
+            // as above
+            if (sampleLikelihoods.lnFloor != -INFINITY) {
+                map<int, map<string, int> >::iterator p = vcfGenotypeOrder.find(genotype->ploidy);
+                if (p != vcfGenotypeOrder.end()) {
+                    for (map<string, int>::iterator o = p->second.begin(); o != p->second.end(); ++o) {
+                        if (!genotypeLikelihoods.count(o->second)) {
+                            genotypeLikelihoods[o->second] = ln2log10(sampleLikelihoods.lnFloor);
                         }
                     }
+                }
+            }
+
+            // normalize GLs to 0 max using division by max
+            Probability minGL = 0;
+            for (map<int, double>::iterator g = genotypeLikelihoods.begin(); g != genotypeLikelihoods.end(); ++g) {
+                if (g->second < minGL) minGL = g->second;
+            }
+            Probability maxGL = minGL;
+            for (map<int, double>::iterator g = genotypeLikelihoods.begin(); g != genotypeLikelihoods.end(); ++g) {
+                if (g->second > maxGL) maxGL = g->second;
+            }
+
+            auto normalizedGL = [&](double gl) {
+                if (parameters.limitGL == 0) {
+                    return (Probability) (gl - maxGL);
+                } else {
+                    return max((Probability) + parameters.limitGL, (gl - maxGL));
+                }
+            };
+
+            // output is sorted by map
+            vector<Probability>& gls = columns.gl[i];
+            for (map<int, double>::iterator g = genotypeLikelihoods.begin(); g != genotypeLikelihoods.end(); ++g) {
+                gls.push_back(normalizedGL(g->second));
+            }
 
-                    // normalize GLs to 0 max using division by max
-                    long double minGL = 0;
-                    for (map<int, double>::iterator g = genotypeLikelihoods.begin(); g != genotypeLikelihoods.end(); ++g) {
-                        if (g->second < minGL) minGL = g->second;
+            // the GLs of the genotypes of the reference and local alleles,
+            // in the VCF order of those alleles.  each genotype has its place,
+            // so one without a likelihood is given as missing
+            if (localAlleles) {
+                vector<int> alleles(1, 0);
+                alleles.insert(alleles.end(), columns.laa[i].begin(), columns.laa[i].end());
+                vector<Probability>& lgls = columns.lgl[i];
+                auto localGL = [&](int order) {
+                    map<int, double>::iterator g = genotypeLikelihoods.find(order);
+                    return g == genotypeLikelihoods.end() ? (Probability) NAN : normalizedGL(g->second);
+                };
+                for (size_t k = 0; k < alleles.size(); ++k) {
+                    if (genotype->ploidy == 1) {
+                        lgls.push_back(localGL(alleles[k]));
+                        continue;
                     }
-                    long double maxGL = minGL;
-                    for (map<int, double>::iterator g = genotypeLikelihoods.begin(); g != genotypeLikelihoods.end(); ++g) {
-                        if (g->second > maxGL) maxGL = g->second;
+                    for (size_t j = 0; j <= k; ++j) {
+                        lgls.push_back(localGL((alleles[k] * (alleles[k] + 1) / 2) + alleles[j]));
                     }
+                }
+            }
 
-                    if (parameters.limitGL == 0) {
-                        for (map<int, double>::iterator g = genotypeLikelihoods.begin(); g != genotypeLikelihoods.end(); ++g) {
-                            genotypeLikelihoodsOutput[g->first] = convert(g->second-maxGL);
-                        }
-                    } else {
-                        for (map<int, double>::iterator g = genotypeLikelihoods.begin(); g != genotypeLikelihoods.end(); ++g) {
-                            genotypeLikelihoodsOutput[g->first] = convert( max((long double) + parameters.limitGL, (g->second-maxGL)) );
-                        }
-                    }
+        }
+    };
 
-                    vector<string>& datalikelihoods = sampleOutput["GL"];
-                    // output is sorted by map
-                    for (map<int, string>::iterator gl = genotypeLikelihoodsOutput.begin(); gl != genotypeLikelihoodsOutput.end(); ++gl) {
-                        datalikelihoods.push_back(gl->second);
-                    }
+    auto formatSample = [&](size_t i) {
+        if (!columns.called[i]) {
+            return;
+        }
+        map<string, vector<string> >& sampleOutput = *sampleOutputs[i];
+        map<string, vector<double> >& sampleValue = *sampleValues[i];
+
+        sampleOutput["GT"].push_back(columns.gt[i]);
+        if (parameters.calculateMarginals) {
+            if (parameters.strictVCF)
+                addInt(sampleOutput["GQ"], sampleValue["GQ"], int(round(columns.gq[i])));
+            else
+                addFloat(sampleOutput["GQ"], sampleValue["GQ"], columns.gq[i]);
+        }
+
+        addInt(sampleOutput["DP"], sampleValue["DP"], columns.dp[i]);
+        addInt(sampleOutput["RO"], sampleValue["RO"], columns.ro[i]);
+        addInt(sampleOutput["QR"], sampleValue["QR"], columns.qr[i]);
+        if (localAlleles) {
+            // a sample with no local alleles has none of LAA, LAO or LQA
+            vector<string>& laa = sampleOutput["LAA"];
+            vector<string>& lad = sampleOutput["LAD"];
+            vector<string>& lao = sampleOutput["LAO"];
+            vector<string>& lqa = sampleOutput["LQA"];
+            addInt(lad, sampleValue["LAD"], columns.ro[i]);
+            for (vector<int>::iterator a = columns.laa[i].begin(); a != columns.laa[i].end(); ++a) {
+                addInt(laa, sampleValue["LAA"], *a);
+                addInt(lao, sampleValue["LAO"], columns.ao[i * altCount + *a - 1]);
+                addInt(lad, sampleValue["LAD"], columns.ao[i * altCount + *a - 1]);
+                addInt(lqa, sampleValue["LQA"], columns.qa[i * altCount + *a - 1]);
+            }
+        } else {
+            vector<string>& ad = sampleOutput["AD"];
+            addInt(ad, sampleValue["AD"], columns.ro[i]);
+            if (altCount) {
+                vector<string>& ao = sampleOutput["AO"];
+                vector<string>& qa = sampleOutput["QA"];
+                for (size_t a = 0; a < altCount; ++a) {
+                    addInt(ao, sampleValue["AO"], columns.ao[i * altCount + a]);
+                    addInt(ad, sampleValue["AD"], columns.ao[i * altCount + a]);
+                    addInt(qa, sampleValue["QA"], columns.qa[i * altCount + a]);
+                }
+            }
+        }
 
+        if (!outputGenotypeLikelihoods) {
+            return;
+        }
+        if (outputExplicitGenotypeLikelihoods) {
+            string datalikelihoods;
+            map<string, Probability>& gle = columns.gle[i];
+            for (map<string, Probability>::iterator g = gle.begin(); g != gle.end(); ++g) {
+                if (g != gle.begin()) {
+                    datalikelihoods += "|";
+                }
+                datalikelihoods += g->first + "^" + formatFloat(g->second);
+            }
+            sampleOutput["GLE"].push_back(datalikelihoods);
+        } else {
+            const char* field = localAlleles ? "LGL" : "GL";
+            vector<string>& datalikelihoods = sampleOutput[field];
+            vector<double>& datalikelihoodValues = sampleValue[field];
+            vector<Probability>& gls = localAlleles ? columns.lgl[i] : columns.gl[i];
+            for (vector<Probability>::iterator g = gls.begin(); g != gls.end(); ++g) {
+                if (std::isnan(*g)) {
+                    datalikelihoods.push_back(".");
+                    datalikelihoodValues.push_back(*g);
+                } else {
+                    addFloat(datalikelihoods, datalikelihoodValues, *g);
                 }
             }
         }
+    };
+
+    if (team && team->size() > 1 && sampleCount >= PARALLEL_FORMAT_MIN_SAMPLES) {
+        size_t chunk = (sampleCount + team->size() - 1) / team->size();
+        team->run([&](int member) {
+            size_t last = min(sampleCount, (member + 1) * chunk);
+            for (size_t i = member * chunk; i < last; ++i) {
+                fillSample(i);
+                formatSample(i);
+            }
+        });
+    } else {
+        for (size_t i = 0; i < sampleCount; ++i) {
+            fillSample(i);
+            formatSample(i);
+        }
+    }
+
+    // the likelihoods are in the FORMAT if any sample has them
+    if (outputGenotypeLikelihoods
+        && std::find(columns.called.begin(), columns.called.end(), (char) true) != columns.called.end()) {
+        string field = outputExplicitGenotypeLikelihoods ? "GLE" : (localAlleles ? "LGL" : "GL");
+        if (var.format.back() != field) {
+            var.format.push_back(field);
+        }
     }
 
     return var;
@@ -656,6 +867,7 @@ vcflib::Variant& Results::gvcf(
         endPos = parser->currentPosition;
     }
     long numSites = endPos - startPos;
+    values.clear();
     if(numSites <= 0){
         std::cerr << "Hit end of chr, but still attempted to call location !!! \n Breaking\n";
         exit(1);
@@ -686,11 +898,11 @@ vcflib::Variant& Results::gvcf(
 	
     int minDepth = (numSites != total.nCount) ?  0 : total.minDepth;
 
-    var.info["DP"].push_back(convert((total.refCount+total.altCount) / numSites));
-    var.info["MIN_DP"].push_back(convert(minDepth));
+    addInfo(var, values, "DP", (total.refCount+total.altCount) / numSites);
+    addInfo(var, values, "MIN_DP", minDepth);
     // The text END field is one-based, inclusive. We proudly conflate this
     // with our zero-based, exclusive endPos.
-    var.info["END"].push_back(convert(endPos));
+    addInfo(var, values, "END", endPos);
 
     // genotype quality is 1- p(polymorphic)
 
@@ -703,8 +915,9 @@ vcflib::Variant& Results::gvcf(
         const string& sampleName = *s;
         const NonCall& nc = perSample[sampleName];
         map<string, vector<string> >& sampleOutput = var.samples[sampleName];
-        long double qual = nc.reflnQ - nc.altlnQ;
-        sampleOutput["GQ"].push_back(convert(ln2phred(qual)));
+        map<string, vector<double> >& sampleValue = values.samples[sampleName];
+        Probability qual = nc.reflnQ - nc.altlnQ;
+        addValue(sampleOutput["GQ"], sampleValue["GQ"], ln2phred(qual));
 
 
       /* This resets min depth to zero if nonCalls is less than numSites. */
@@ -712,13 +925,112 @@ vcflib::Variant& Results::gvcf(
         int minDepth = (numSites != nc.nCount) ?  0 : nc.minDepth;
       
 	    
-        sampleOutput["DP"].push_back(convert((nc.refCount+nc.altCount) / numSites));
-        sampleOutput["MIN_DP"].push_back(convert(minDepth));
-        sampleOutput["QR"].push_back(convert(llrintl(ln2phred(nc.reflnQ))));
-	sampleOutput["RO"].push_back(convert((nc.refCount/numSites)));
-        sampleOutput["QA"].push_back(convert(llrintl(ln2phred(nc.altlnQ))));
-	sampleOutput["AO"].push_back(convert((nc.altCount/numSites)));
+        addValue(sampleOutput["DP"], sampleValue["DP"], (nc.refCount+nc.altCount) / numSites);
+        addValue(sampleOutput["MIN_DP"], sampleValue["MIN_DP"], minDepth);
+        addValue(sampleOutput["QR"], sampleValue["QR"], llrintl(ln2phred(nc.reflnQ)));
+	addValue(sampleOutput["RO"], sampleValue["RO"], (nc.refCount/numSites));
+        addValue(sampleOutput["QA"], sampleValue["QA"], llrintl(ln2phred(nc.altlnQ)));
+	addValue(sampleOutput["AO"], sampleValue["AO"], (nc.altCount/numSites));
     }
 
     return var;
 }
+
+
+vcflib::Variant& Results::monomorphicVcf(
+    vcflib::Variant& var,
+    Samples& samples,
+    string refbase,
+    vector<string>& sampleNames,
+    int coverage,
+    AlleleParser* parser) {
+
+    Parameters& parameters = parser->parameters;
+    values.clear();
+
+    var.ref = refbase;
+    assert(!var.ref.empty());
+    var.sequenceName = parser->currentSequenceName;
+    var.position = (long int) parser->currentPosition + 1;
+    var.id = ".";
+    var.filter = ".";
+    // as with the full record, p(hom-ref) is 1 when no other genotype is possible
+    var.quality = 0;
+
+    // the sole genotype has a GL of 0, given wherever the full record would
+    bool outputGenotypeLikelihoods = !parameters.excludeUnobservedGenotypes
+        && !parameters.excludePartiallyObservedGenotypes
+        && parameters.poolFrequencyGrid == 0;
+
+    var.format.clear();
+    var.format.push_back("GT");
+    var.format.push_back("GQ");
+    var.format.push_back("DP");
+    var.format.push_back("AD");
+    var.format.push_back("RO");
+    var.format.push_back("QR");
+
+    int samplesWithData = 0;
+    int refAlleleObservations = 0;
+    bool anyGenotypeLikelihoods = false;
+    for (vector<string>::iterator sampleName = sampleNames.begin(); sampleName != sampleNames.end(); ++sampleName) {
+        Samples::iterator s = samples.find(*sampleName);
+        if (s == samples.end() || s->second.observationCount() == 0) {
+            continue;
+        }
+        Sample& sample = s->second;
+        ++samplesWithData;
+
+        // the GQ of hom-ref is that of a gVCF block, by the qualities of the
+        // reference and other observations
+        Probability reflnQ = 0;
+        Probability altlnQ = 0;
+        for (Sample::iterator a = sample.begin(); a != sample.end(); ++a) {
+            for (vector<Allele*>::iterator o = a->second.begin(); o != a->second.end(); ++o) {
+                if ((*o)->isReference()) {
+                    reflnQ += (*o)->lnquality;
+                } else {
+                    altlnQ += (*o)->lnquality;
+                }
+            }
+        }
+        Probability gq = max((Probability) 0, nan2zero(ln2phred(reflnQ - altlnQ)));
+
+        int ploidy = parser->currentSamplePloidy(*sampleName);
+        string gt = "0";
+        for (int i = 1; i < ploidy; ++i) {
+            gt += "/0";
+        }
+
+        int refCount = sample.observationCount(refbase);
+        refAlleleObservations += refCount;
+
+        map<string, vector<string> >& sampleOutput = var.samples[*sampleName];
+        map<string, vector<double> >& sampleValue = values.samples[*sampleName];
+        sampleOutput["GT"].push_back(gt);
+        if (parameters.strictVCF) {
+            addInt(sampleOutput["GQ"], sampleValue["GQ"], int(round(gq)));
+        } else {
+            addFloat(sampleOutput["GQ"], sampleValue["GQ"], gq);
+        }
+        addInt(sampleOutput["DP"], sampleValue["DP"], sample.observationCount());
+        addInt(sampleOutput["AD"], sampleValue["AD"], refCount);
+        addInt(sampleOutput["RO"], sampleValue["RO"], refCount);
+        addInt(sampleOutput["QR"], sampleValue["QR"], sample.qualSum(refbase));
+        if (outputGenotypeLikelihoods && ploidy <= 2) {
+            addFloat(sampleOutput["GL"], sampleValue["GL"], 0);
+            anyGenotypeLikelihoods = true;
+        }
+    }
+    if (anyGenotypeLikelihoods) {
+        var.format.push_back("GL");
+    }
+
+    addInfo(var, values, "NS", samplesWithData);
+    addInfo(var, values, "DP", coverage);
+    addInfo(var, values, "RO", refAlleleObservations);
+    addInfo(var, values, "QR", samples.qualSum(refbase));
+    addInfo(var, values, "NUMALT", 0);
+
+    return var;
+}
@@ -12,40 +12,156 @@
 #include "version_git.h"
 #include "Result.h"
 #include "NonCall.h"
+#include "WorkerTeam.h"
+#include "RecordValues.h"
 
 using namespace std;
 
+// records with at least this many samples have their FORMAT values filled in
+// parallel by the genotyping team, if there is one
+#define PARALLEL_FORMAT_MIN_SAMPLES 64
+
 // for sorting data likelihoods
 class DataLikelihoodCompare {
 public:
-    bool operator()(const pair<Genotype*, long double>& a,
-            const pair<Genotype*, long double>& b) {
+    bool operator()(const pair<Genotype*, Probability>& a,
+            const pair<Genotype*, Probability>& b) {
         return a.second > b.second;
     }
 };
 
 
+// the FORMAT values of the samples of a record, by sample, as computed
+// before they are formatted
+class SampleColumns {
+public:
+    SampleColumns(size_t samples, size_t alts)
+        : called(samples, false)
+        , gt(samples)
+        , gq(samples, 0)
+        , dp(samples, 0)
+        , ro(samples, 0)
+        , qr(samples, 0)
+        , ao(samples * alts, 0)
+        , qa(samples * alts, 0)
+        , gl(samples)
+        , gle(samples)
+        , laa(samples)
+        , lgl(samples)
+    { }
+    vector<char> called;  // samples with a genotype and observations
+    vector<string> gt;
+    vector<double> gq;
+    vector<int> dp;
+    vector<int> ro;
+    vector<int> qr;
+    vector<int> ao;       // by sample, then alternate
+    vector<int> qa;
+    vector<vector<Probability> > gl;          // normalized, in VCF order
+    vector<map<string, Probability> > gle;    // by relative genotype
+    vector<vector<int> > laa;                 // --local-alleles, 1-based
+    vector<vector<Probability> > lgl;         // gl of the local genotypes
+};
+
+// the statistics of the observations of an allele over a site, from which
+// its INFO fields are formatted
+class AlleleObservationStats {
+public:
+    AlleleObservationStats(void)
+        : count(0)
+        , basesLeft(0)
+        , basesRight(0)
+        , readsLeft(0)
+        , readsRight(0)
+        , endLeft(0)
+        , endRight(0)
+        , mqsum(0)
+        , properPairs(0)
+        , readMismatchSum(0)
+        , readSNPSum(0)
+        , readIndelSum(0)
+    { }
+    unsigned int count;
+    unsigned int basesLeft;
+    unsigned int basesRight;
+    unsigned int readsLeft;   // placed more to the left of their reads
+    unsigned int readsRight;
+    unsigned int endLeft;     // placed nearer the 5' end of their reads
+    unsigned int endRight;
+    unsigned int mqsum;
+    unsigned int properPairs;
+    Probability readMismatchSum;
+    Probability readSNPSum;
+    Probability readIndelSum;
+    map<string, int> bySequencingTechnology;
+    void add(Allele& allele);
+    int technologyCount(const string& tech) const {
+        map<string, int>::const_iterator t = bySequencingTechnology.find(tech);
+        return t == bySequencingTechnology.end() ? 0 : t->second;
+    }
+};
+
+// the observations of the alleles of a record, the reference first and then
+// the alternates, gathered in one pass over the allele groups of the site and
+// one over the observations of each sample, so that building the record only
+// reads them.  the samples are those of the record, in its order; the totals
+// over the samples also count any others, such as the reference sample.
+class SiteObservationStats {
+public:
+    SiteObservationStats(Samples& samples,
+                         vector<string>& sampleNames,
+                         const string& refbase,
+                         vector<string>& altBases,
+                         map<string, vector<Allele*> >& alleleGroups);
+
+    // over the site
+    const AlleleObservationStats& site(size_t allele) const { return alleles[column[allele]]; }
+    int qualSum(size_t allele) const { return totalQualSum[column[allele]]; }
+    double partialCount(size_t allele) const { return totalPartialCount[column[allele]]; }
+    double partialQualSum(size_t allele) const { return totalPartialQualSum[column[allele]]; }
+    int basesInObservations; // of all the allele groups, for DPB
+
+    // by sample
+    int observationCount(size_t sample) const { return sampleObservations[sample]; }
+    int count(size_t sample, size_t allele) const { return sampleCount[sample * width + column[allele]]; }
+    int qualSum(size_t sample, size_t allele) const { return sampleQualSum[sample * width + column[allele]]; }
+    int forward(size_t sample, size_t allele) const { return sampleForward[sample * width + column[allele]]; }
+    int reverse(size_t sample, size_t allele) const { return sampleReverse[sample * width + column[allele]]; }
+
+private:
+    size_t width;               // distinct bases among the alleles
+    vector<size_t> column;      // of each allele
+    vector<AlleleObservationStats> alleles;
+    vector<int> totalQualSum;
+    vector<double> totalPartialCount;
+    vector<double> totalPartialQualSum;
+    vector<int> sampleObservations;
+    vector<int> sampleCount;    // by sample, then column
+    vector<int> sampleQualSum;
+    vector<int> sampleForward;
+    vector<int> sampleReverse;
+};
+
 // maps sample names to results
 class Results : public map<string, Result> {
 
 public:
+    // the numbers of the record last built by vcf, gvcf or monomorphicVcf
+    RecordValues values;
+
     void update(SampleDataLikelihoods& likelihoods) {
         for (SampleDataLikelihoods::iterator s = likelihoods.begin(); s != likelihoods.end(); ++s) {
             vector<SampleDataLikelihood>& sdls = *s;
-            string& name = sdls.front().name;
-            Result& result = (*this)[name];
-            result.clear();
-            for (vector<SampleDataLikelihood>::iterator s = sdls.begin(); s != sdls.end(); ++s) {
-                result.push_back(*s);
-            }
+            const string& name = *sdls.front().name;
+            (*this)[name].assign(sdls.begin(), sdls.end());
         }
     }
 
     vcflib::Variant& vcf(
         vcflib::Variant& var, // variant to update
-        BigFloat pHom,
-        long double bestComboOddsRatio,
-        //long double alleleSamplingProb,
+        Probability lnHom,
+        Probability bestComboOddsRatio,
+        //Probability alleleSamplingProb,
         Samples& samples,
         string refbase,
         vector<Allele>& altAlleles,
@@ -59,12 +175,23 @@ public:
         map<Allele*, set<Allele*> >& partialSupport,
         map<int, vector<Genotype> >& genotypesByPloidy,
         vector<string>& sequencingTechnologies,
-        AlleleParser* parser);
+        AlleleParser* parser,
+        WorkerTeam* team = NULL);
 
     vcflib::Variant& gvcf(
         vcflib::Variant& var,
         NonCalls& noncalls,
         AlleleParser* parser);
+
+    // the record of a site whose only genotype allele is the reference, with
+    // every sample hom-ref, written from the observations without genotyping
+    vcflib::Variant& monomorphicVcf(
+        vcflib::Variant& var,
+        Samples& samples,
+        string refbase,
+        vector<string>& sampleNames,
+        int coverage,
+        AlleleParser* parser);
 };
 
 
@@ -0,0 +1,146 @@
+#ifndef FREEBAYES_RUNCONTEXT_H
+#define FREEBAYES_RUNCONTEXT_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+
+#include "Parameters.h"
+#include "CNV.h"
+#include "Bias.h"
+#include "Contamination.h"
+#include "LikelihoodDump.h"
+#include "Profile.h"
+#include "Progress.h"
+#include "SiteTrace.h"
+#include "Checkpoint.h"
+#include "LikelihoodEngine.h"
+#include "MemoryBudget.h"
+#include "Logging.h"
+
+#ifndef HAVE_BAMTOOLS
+#include "SeqLib/ThreadPool.h"
+#endif
+
+using namespace std;
+
+// the state of a run which is common to every region we call
+//
+// this is filled in once, by the first AlleleParser constructed for the run,
+// and is then only read.  parsers created for individual regions share it
+// rather than reloading (or copying) the sample metadata, so that any number
+// of them can work through the genome at the same time.  the likelihood dump,
+// the slow site log and the progress monitor are the exceptions, being written
+// by all of them, each under its own lock.
+class RunContext {
+
+public:
+
+    Parameters parameters; // holds operational parameters passed at program invocation
+
+    vector<string> sampleList; // list of sample names, indexed by sample id
+    vector<string> sampleListFromBam; // sample names drawn from BAM file
+    vector<string> sampleListFromVCF; // sample names drawn from input VCF
+    map<string, string> samplePopulation; // population subdivisions of samples
+    map<string, vector<string> > populationSamples; // inversion of samplePopulation
+    map<string, string> readGroupToSampleNames; // maps read groups to samples
+    map<string, string> readGroupToTechnology; // maps read groups to technologies
+    vector<string> sequencingTechnologies;  // a list of the present technologies
+    bool oneSampleAnalysis; // if we are analyzing just one sample, and there are no specified read groups
+
+    // integer ids for the samples and read groups, set by assignIDs once they
+    // are known, so that observations can be grouped without comparing names
+    map<string, int> sampleIDs; // the position of each sample in sampleList
+    vector<string> readGroupNames; // read groups, indexed by read group id
+    map<string, int> readGroupIDs;
+
+    CNVMap sampleCNV;
+
+    Bias observationBias;
+    Contamination contaminationEstimates;
+
+    string vcfHeader; // the header of the output VCF, built after the samples are known
+
+    LikelihoodDumpWriter likelihoodDump; // --likelihood-dump, opened once the samples are known
+    vector<shared_ptr<LikelihoodDump> > jointLikelihoods; // --joint-likelihoods, read in place of alignments
+    SlowSiteLog slowSiteLog; // --slow-site-log
+    SiteTrace siteTrace; // --trace
+    ProgressMonitor progress; // --progress
+    RunCheckpoint checkpoint; // --checkpoint, read back first with --resume
+    unique_ptr<LikelihoodEngine> likelihoodEngine; // --likelihood-engine
+    MemoryBudget memoryBudget; // --max-memory
+
+#ifndef HAVE_BAMTOOLS
+    // inflates BGZF blocks and decodes CRAM slices for every alignment reader
+    // of the run, when using --decompress-threads
+    SeqLib::ThreadPool decompressionPool;
+#endif
+
+    RunContext(int argc, char** argv)
+        : RunContext(Parameters(argc, argv))
+    { }
+
+    RunContext(const Parameters& p)
+        : parameters(p)
+        , oneSampleAnalysis(false)
+        , contaminationEstimates(0.5 + parameters.probContamination, parameters.probContamination)
+        , likelihoodEngine(makeLikelihoodEngine(parameters.likelihoodEngine))
+    {
+        if (!parameters.alleleObservationBiasFile.empty()) {
+            observationBias.open(parameters.alleleObservationBiasFile);
+        }
+        if (!parameters.contaminationEstimateFile.empty()) {
+            contaminationEstimates.open(parameters.contaminationEstimateFile);
+        }
+        memoryBudget.start((uint64_t) parameters.maxMemory * 1024 * 1024);
+#ifndef HAVE_BAMTOOLS
+        if (parameters.decompressThreads > 0) {
+            decompressionPool.p.pool = hts_tpool_init(parameters.decompressThreads);
+            decompressionPool.p.qsize = 0; // let htslib size each file's queue
+            if (!decompressionPool.IsOpen()) {
+                ERROR("could not start " << parameters.decompressThreads << " decompression threads");
+                exit(1);
+            }
+        }
+#endif
+    }
+
+    void assignIDs(void) {
+        sampleIDs.clear();
+        for (int i = 0; i < sampleList.size(); ++i) {
+            sampleIDs[sampleList[i]] = i;
+        }
+        readGroupNames.clear();
+        readGroupIDs.clear();
+        for (map<string, string>::iterator r = readGroupToSampleNames.begin(); r != readGroupToSampleNames.end(); ++r) {
+            readGroupIDs[r->first] = readGroupNames.size();
+            readGroupNames.push_back(r->first);
+        }
+        contaminationEstimates.index(readGroupNames);
+    }
+
+    // -1 if the name has no id
+    int sampleID(const string& name) const {
+        map<string, int>::const_iterator s = sampleIDs.find(name);
+        return (s != sampleIDs.end()) ? s->second : -1;
+    }
+
+    int readGroupID(const string& name) const {
+        map<string, int>::const_iterator r = readGroupIDs.find(name);
+        return (r != readGroupIDs.end()) ? r->second : -1;
+    }
+
+    // the readers using the pool belong to the run's parsers, which hold the
+    // run, so they are closed by the time we get here
+    ~RunContext(void) {
+#ifndef HAVE_BAMTOOLS
+        if (decompressionPool.IsOpen()) {
+            hts_tpool_destroy(decompressionPool.p.pool);
+        }
+#endif
+    }
+
+};
+
+#endif
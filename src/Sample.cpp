@@ -166,7 +166,7 @@ double Samples::partialQualSum(const string& base) {
 }
 
 map<string, double> Samples::estimatedAlleleFrequencies(void) {
-    map<string, long double> qualsums;
+    map<string, Probability> qualsums;
     for (Samples::iterator s = begin(); s != end(); ++s) {
         Sample& sample = s->second;
         for (Sample::iterator o = sample.begin(); o != sample.end(); ++o) {
@@ -174,42 +174,18 @@ map<string, double> Samples::estimatedAlleleFrequencies(void) {
             qualsums[base] += sample.qualSum(base);
         }
     }
-    long double total = 0;
-    for (map<string, long double>::iterator q = qualsums.begin(); q != qualsums.end(); ++q) {
+    Probability total = 0;
+    for (map<string, Probability>::iterator q = qualsums.begin(); q != qualsums.end(); ++q) {
         total += q->second;
     }
     map<string, double> freqs;
-    for (map<string, long double>::iterator q = qualsums.begin(); q != qualsums.end(); ++q) {
+    for (map<string, Probability>::iterator q = qualsums.begin(); q != qualsums.end(); ++q) {
         freqs[q->first] = q->second / total;
         //cerr << "estimated frequency " << q->first << " " << freqs[q->first] << endl;
     }
     return freqs;
 }
 
-// puts alleles into the right bins if they have changed their base (as
-// occurs in the case of reference alleles)
-void Sample::sortReferenceAlleles(void) {
-    for (Sample::iterator g = begin(); g != end(); ++g) {
-        const string& groupBase = g->first;
-        vector<Allele*>& alleles = g->second;
-        for (vector<Allele*>::iterator a = alleles.begin(); a != alleles.end(); ++a) {
-            const string& base = (*a)->currentBase;
-            if (base != groupBase) {
-                Sample::iterator g = find(base);
-                if (g != end()) {
-                    g->second.push_back(*a);
-                } else {
-                    vector<Allele*> alleles;
-                    alleles.push_back(*a);
-                    insert(begin(), make_pair(base, alleles));
-                }
-                *a = NULL;
-            }
-        }
-        alleles.erase(remove(alleles.begin(), alleles.end(), (Allele*)NULL), alleles.end());
-    }
-}
-
 StrandBaseCounts
 Sample::strandBaseCount(string refbase, string altbase) {
 
@@ -272,14 +248,27 @@ string Sample::tojson(void) {
 }
 
 void groupAlleles(Samples& samples, map<string, vector<Allele*> >& alleleGroups) {
+    // gathered by id, so each sample's groups are found without walking the
+    // map, which is then filled once for each allele
+    SiteAlleles siteAlleles;
+    vector<vector<Allele*> > groups;
     for (Samples::iterator s = samples.begin(); s != samples.end(); ++s) {
         Sample& sample = s->second;
         for (Sample::iterator g = sample.begin(); g != sample.end(); ++g) {
-            const string& base = g->first;
-            const vector<Allele*>& alleles = g->second;
-            vector<Allele*>& group = alleleGroups[base];
-            group.reserve(group.size() + distance(alleles.begin(), alleles.end()));
-            group.insert(group.end(), alleles.begin(), alleles.end());
+            size_t id = siteAlleles.intern(g->first);
+            if (id == groups.size()) {
+                groups.push_back(vector<Allele*>());
+            }
+            vector<Allele*>& group = groups[id];
+            group.insert(group.end(), g->second.begin(), g->second.end());
+        }
+    }
+    for (size_t id = 0; id < siteAlleles.size(); ++id) {
+        vector<Allele*>& group = alleleGroups[siteAlleles.base(id)];
+        if (group.empty()) {
+            group.swap(groups[id]);
+        } else {
+            group.insert(group.end(), groups[id].begin(), groups[id].end());
         }
     }
 }
@@ -352,6 +341,62 @@ ostream& operator<<(ostream& out, Sample& sample) {
 }
 
 
+// the alleles of a site by their sequences, read from the start or from the
+// end, so that a partial observation is matched against all of them in one
+// walk down from the root.  each node keeps the alleles passing through it,
+// which are those beginning (or ending) with the sequence leading to it.
+class AlleleSequenceTrie {
+
+public:
+
+    AlleleSequenceTrie(bool e) : fromEnd(e), nodes(1) { }
+
+    void add(const string& seq, int allele) {
+        int node = 0;
+        for (size_t i = 0; i < seq.size(); ++i) {
+            char c = fromEnd ? seq[seq.size() - 1 - i] : seq[i];
+            int next = child(node, c);
+            if (next < 0) {
+                next = nodes.size();
+                nodes[node].children.push_back(make_pair(c, next));
+                nodes.push_back(Node());
+            }
+            node = next;
+            nodes[node].alleles.push_back(allele);
+        }
+    }
+
+    // the alleles beginning (or ending) with seq, or NULL if there are none
+    const vector<int>* find(const string& seq) const {
+        int node = 0;
+        for (size_t i = 0; i < seq.size() && node >= 0; ++i) {
+            node = child(node, fromEnd ? seq[seq.size() - 1 - i] : seq[i]);
+        }
+        return node > 0 ? &nodes[node].alleles : NULL;
+    }
+
+private:
+
+    struct Node {
+        vector<pair<char, int> > children;
+        vector<int> alleles;
+    };
+
+    int child(int node, char c) const {
+        const vector<pair<char, int> >& children = nodes[node].children;
+        for (vector<pair<char, int> >::const_iterator n = children.begin(); n != children.end(); ++n) {
+            if (n->first == c) {
+                return n->second;
+            }
+        }
+        return -1;
+    }
+
+    bool fromEnd;
+    vector<Node> nodes;
+
+};
+
 void Samples::assignPartialSupport(vector<Allele>& alleles,
                                    vector<Allele*>& partialObservations,
                                    map<string, vector<Allele*> >& partialObservationGroups,
@@ -362,46 +407,68 @@ void Samples::assignPartialSupport(vector<Allele>& alleles,
     // clean up results of any previous calls to this function
     clearPartialObservations();
 
-    for (vector<Allele>::iterator a = alleles.begin(); a != alleles.end(); ++a) {
-        Allele& allele = *a;
-        //string& base = allele.currentBase;
-        // hacks here
-        string& aseq = allele.alternateSequence;
-        //cerr << "alternate, seeking partial support " << aseq << endl
-        //     << "allele: " << allele << endl;
-        // construct pseudo-sequence
-        for (vector<Allele*>::iterator p = partialObservations.begin(); p != partialObservations.end(); ++p) {
-            Allele& partial = **p;
-            string pseq = partial.alternateSequence;
-            bool same = false;
-            // if the partial could support the alternate if we consider "reference-matching"
-            // sequence beyond the haplotype window, add it to the comparison
-            if (partial.position == haplotypeStart && partial.referenceLength == haplotypeLength) {
-                if (pseq.size() + partial.basesLeft <= aseq.size()) {
-                    pseq = partial.read5p();
-                } else if (pseq.size() + partial.basesRight <= aseq.size()) {
-                    pseq = partial.read3p();
-                }
+    AlleleSequenceTrie prefixes(false);
+    AlleleSequenceTrie suffixes(true);
+    for (size_t i = 0; i < alleles.size(); ++i) {
+        prefixes.add(alleles[i].alternateSequence, i);
+        suffixes.add(alleles[i].alternateSequence, i);
+    }
+
+    // the partials supporting each allele, in the order they were given
+    vector<vector<Allele*> > supporting(alleles.size());
+    vector<int> lastSupportedBy(alleles.size(), -1);
+
+    for (size_t i = 0; i < partialObservations.size(); ++i) {
+        Allele& partial = *partialObservations[i];
+        size_t length = partial.alternateSequence.size();
+        // if the partial could support the alternate if we consider "reference-matching"
+        // sequence beyond the haplotype window, it's compared with the read's
+        // sequence to one side of it, for the alleles long enough to take that in
+        bool window = partial.position == haplotypeStart && partial.referenceLength == haplotypeLength;
+        string pseqs[3];
+        pseqs[0] = partial.alternateSequence;
+        if (window) {
+            pseqs[1] = partial.read5p();
+            pseqs[2] = partial.read3p();
+        }
+        for (int k = 0; k < (window ? 3 : 1); ++k) {
+            if (pseqs[k].empty()) {
+                continue;
             }
-            // otherwise, we should be fine to go with the seqs
-            // basically, this is the partial reference coordinate-matching case
-            //cerr << partial << " bp l/r " << partial.basesLeft << "/" << partial.basesRight
-            //     << " szes , " << pseq.size() << " vs " << aseq.size() << endl;
-            if (!pseq.empty()
-                && aseq.size() >= pseq.size()
-                && ((partial.alternateSequence.size() + partial.basesRight <= aseq.size()
-                     && (aseq.substr(0, pseq.size()) == pseq))
-                    || (partial.alternateSequence.size() + partial.basesLeft <= aseq.size() 
-                        && (aseq.substr(aseq.size()-pseq.size()) == pseq)))) {
-                // dAY's du saem
-                partialObservationGroups[allele.currentBase].push_back(*p);
-                partialObservationSupport[*p].insert(&*a);
-                //cerr << "partial support of " << *a << " by " << *p << endl;
-                same = true;
+            for (int fromEnd = 0; fromEnd < 2; ++fromEnd) {
+                const vector<int>* found = fromEnd ? suffixes.find(pseqs[k]) : prefixes.find(pseqs[k]);
+                if (!found) {
+                    continue;
+                }
+                for (vector<int>::const_iterator a = found->begin(); a != found->end(); ++a) {
+                    size_t alength = alleles[*a].alternateSequence.size();
+                    int used = 0; // which of pseqs this allele is compared with
+                    if (window) {
+                        if (length + partial.basesLeft <= alength) {
+                            used = 1;
+                        } else if (length + partial.basesRight <= alength) {
+                            used = 2;
+                        }
+                    }
+                    if (used == k && lastSupportedBy[*a] != (int) i
+                        && length + (fromEnd ? partial.basesLeft : partial.basesRight) <= alength) {
+                        // dAY's du saem
+                        lastSupportedBy[*a] = i;
+                        supporting[*a].push_back(&partial);
+                        partialObservationSupport[&partial].insert(&alleles[*a]);
+                    }
+                }
             }
         }
     }
 
+    for (size_t i = 0; i < alleles.size(); ++i) {
+        if (!supporting[i].empty()) {
+            vector<Allele*>& group = partialObservationGroups[alleles[i].currentBase];
+            group.insert(group.end(), supporting[i].begin(), supporting[i].end());
+        }
+    }
+
     for (vector<Allele*>::iterator p = partialObservations.begin(); p != partialObservations.end(); ++p) {
         // get the sample
         Allele& partial = **p;
@@ -413,12 +480,14 @@ void Samples::assignPartialSupport(vector<Allele>& alleles,
         map<Allele*, set<Allele*> >::iterator sup = partialObservationSupport.find(*p);
         if (sup != partialObservationSupport.end()) {
             set<Allele*>& supported = sup->second;
+            AlleleSupport support;
             for (set<Allele*>::iterator s = supported.begin(); s != supported.end(); ++s) {
                 sample.partialSupport[(*s)->currentBase].push_back(*p);
                 sample.supportedAlleles.insert((*s)->currentBase);
+                support.insert(*s - &alleles.front());
             }
             if (!supported.empty()) {
-                sample.reversePartials[*p] = supported;
+                sample.reversePartials[*p] = support;
             }
         }
         //sample.partialObservations.push_back(*p);
@@ -426,21 +495,6 @@ void Samples::assignPartialSupport(vector<Allele>& alleles,
 
 }
 
-bool Sample::observationSupports(Allele* obs, Allele* allele) {
-    if (obs->currentBase == allele->currentBase) {
-        return true;
-    } else {
-        map<Allele*, set<Allele*> >::iterator p = reversePartials.find(obs);
-        if (p != reversePartials.end()) {
-            set<Allele*>& supports = p->second;
-            if (supports.find(allele) != supports.end()) {
-                return true;
-            }
-        }
-        return false;
-    }
-}
-
 void Samples::clearFullObservations(void) {
     for (Samples::iterator s = begin(); s != end(); ++s) {
         s->second.clear();
@@ -461,6 +515,32 @@ void Sample::clearPartialObservations(void) {
     reversePartials.clear();
 }
 
+void CompactObservations::assign(vector<Allele*>& observations) {
+    alleles = observations;
+    lnProbIncorrect.resize(alleles.size());
+    readGroupIndex.resize(alleles.size());
+    isReference.resize(alleles.size());
+    lnqualitySum = 0;
+    lnBestQualitySum = 0;
+    for (int i = 0; i < alleles.size(); ++i) {
+        Allele& obs = *alleles[i];
+        // the mapping quality is an integer so its term comes from the phred tables
+        Probability lnProbCorrect = log1m_exp(obs.lnquality) + phred2lnCorrect(obs.mapQuality);
+        lnProbIncorrect[i] = log1m_exp(lnProbCorrect);
+        readGroupIndex[i] = obs.readGroupIndex;
+        isReference[i] = obs.isReference();
+        lnqualitySum += obs.lnquality;
+        lnBestQualitySum += max(obs.lnquality, obs.lnmapQuality);
+    }
+}
+
+void Sample::setCompactObservations(void) {
+    compactObservations.clear();
+    for (Sample::iterator a = begin(); a != end(); ++a) {
+        compactObservations[a->first].assign(a->second);
+    }
+}
+
 void Sample::setSupportedAlleles(void) {
     for (Sample::iterator a = begin(); a != end(); ++a)
         supportedAlleles.insert(a->first);
@@ -4,9 +4,13 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <utility>
+#include <bitset>
+#include <stdint.h>
 #include "Utility.h"
 #include "Allele.h"
+#include "SlabAllocator.h"
 
 using namespace std;
 
@@ -33,8 +37,89 @@ StrandBaseCounts(int fr,
 
 };
 
+// the parts of a group of observations which are read when computing
+// genotype likelihoods, stored column-wise and precomputed where they don't
+// depend on the genotype, so that the likelihood loops don't touch the
+// observations themselves
+class CompactObservations {
+
+public:
+    vector<Probability> lnProbIncorrect; // log(1 - p(base and mapping are correct))
+    vector<int> readGroupIndex;
+    vector<char> isReference;
+    vector<Allele*> alleles; // the observations, for anything else
+    Probability lnqualitySum; // sum of lnquality
+    Probability lnBestQualitySum; // sum of max(lnquality, lnmapQuality)
+
+    CompactObservations(void) : lnqualitySum(0), lnBestQualitySum(0) { }
+    void assign(vector<Allele*>& observations);
+    int size(void) const { return alleles.size(); }
+
+};
+
+// the genotype alleles of a site which a partial observation supports, as a
+// bitset over their indexes in the site's vector of them
+class AlleleSupport {
+
+public:
+    void insert(int allele) {
+        size_t w = allele / 64;
+        if (w >= words.size()) {
+            words.resize(w + 1, 0);
+        }
+        words[w] |= (uint64_t) 1 << (allele % 64);
+    }
+    bool contains(int allele) const {
+        size_t w = allele / 64;
+        return w < words.size() && ((words[w] >> (allele % 64)) & 1);
+    }
+    int size(void) const {
+        int n = 0;
+        for (vector<uint64_t>::const_iterator w = words.begin(); w != words.end(); ++w) {
+            n += bitset<64>(*w).count();
+        }
+        return n;
+    }
+    bool empty(void) const { return size() == 0; }
+
+private:
+    vector<uint64_t> words;
+
+};
+
+// the distinct alleles observed at a site, as small integers
+//
+// the observations of a site are grouped by their bases, within each sample
+// and across them, in maps keyed by the bases.  at haplotypes the bases run
+// long, and the same few keys are compared again for each observation and
+// each sample; interning each once, through a hash, lets the grouping be
+// done in arrays over the ids.
+class SiteAlleles {
+
+public:
+    // the id of the bases, which are added if they are new to the site
+    size_t intern(const string& base) {
+        pair<unordered_map<string, size_t>::iterator, bool> i = ids.insert(make_pair(base, bases.size()));
+        if (i.second) {
+            bases.push_back(&i.first->first);
+        }
+        return i.first->second;
+    }
+    const string& base(size_t id) const { return *bases[id]; }
+    size_t size(void) const { return bases.size(); }
+    void clear(void) { ids.clear(); bases.clear(); }
+
+private:
+    unordered_map<string, size_t> ids;
+    vector<const string*> bases; // the keys of ids, by id
+};
+
+// the observations of a sample at a site, binned by their bases, and as
+// these are rebuilt at every site their nodes come from a SlabAllocator
+typedef map<string, vector<Allele*>, less<string>, SlabAllocator<pair<const string, vector<Allele*> > > > SampleObservations;
+
 // sample tracking and allele sorting
-class Sample : public map<string, vector<Allele*> > {
+class Sample : public SampleObservations {
 
     friend ostream& operator<<(ostream& out, Sample& sample);
 
@@ -47,18 +132,21 @@ public:
     // partial support for alleles, such as for observations that partially overlap the calling window
     map<string, vector<Allele*> > partialSupport;
 
-    // for fast scaling of qualities for partial supports
-    map<Allele*, set<Allele*> > reversePartials;
+    // for fast scaling of qualities for partial supports, the genotype
+    // alleles each partial observation supports
+    map<Allele*, AlleleSupport> reversePartials;
 
     // clear the above
     void clearPartialObservations(void);
 
+    // the full observations of each allele, in compact form; made by
+    // setCompactObservations, once the observations are final
+    map<string, CompactObservations> compactObservations;
+    void setCompactObservations(void);
+
     // set of partial observations (keys of the above map) cached for faster GL calculation
     //vector<Allele*> partialObservations;
 
-    // if the observation (partial or otherwise) supports the allele
-    bool observationSupports(Allele* obs, Allele* allele);
-
     // the number of observations for this allele
     int observationCount(Allele& allele);
     double observationCountInclPartials(Allele& allele);
@@ -81,10 +169,6 @@ public:
     double partialQualSum(Allele& allele);
     double partialQualSum(const string& base);
 
-    // puts alleles into the right bins if they have changed their base (as
-    // occurs in the case of reference alleles)
-    void sortReferenceAlleles(void);
-
     StrandBaseCounts strandBaseCount(string refbase, string altbase);
 
     int baseCount(string base, AlleleStrand strand);
@@ -93,7 +177,7 @@ public:
 
 };
 
-class Samples : public map<string, Sample> {
+class Samples : public map<string, Sample, less<string>, SlabAllocator<pair<const string, Sample> > > {
 public:
     map<string, double> estimatedAlleleFrequencies(void);
     void assignPartialSupport(vector<Allele>& alleles,
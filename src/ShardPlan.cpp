@@ -0,0 +1,179 @@
+#include "ShardPlan.h"
+#include "Logging.h"
+#include "convert.h"
+#include "htslib/bgzf.h"
+#include "htslib/kstring.h"
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+
+bool ShardPlan::write(const string& file) const {
+    ofstream out(file.c_str());
+    out << "##freebayes shard plan" << endl
+        << "##padding=" << padding << endl
+        << "#shard\tchrom\tstart\tend" << endl;
+    for (size_t i = 0; i < shards.size(); ++i) {
+        for (vector<BedTarget>::const_iterator t = shards[i].begin(); t != shards[i].end(); ++t) {
+            out << i << "\t" << t->seq << "\t" << t->left << "\t" << t->right + 1 << endl;
+        }
+    }
+    out.close();
+    return (bool) out;
+}
+
+bool ShardPlan::read(const string& file) {
+    ifstream in(file.c_str());
+    if (!in) {
+        ERROR("could not open the shard plan " << file);
+        return false;
+    }
+    shards.clear();
+    string line;
+    size_t lineNumber = 0;
+    while (getline(in, line)) {
+        ++lineNumber;
+        if (line.compare(0, 10, "##padding=") == 0) {
+            if (!convert(line.substr(10), padding) || padding < 0) {
+                ERROR("could not parse the padding of the shard plan " << file);
+                return false;
+            }
+            continue;
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        stringstream fields(line);
+        size_t shard;
+        BedTarget target;
+        long int end;
+        if (!(fields >> shard >> target.seq >> target.left >> end) || end <= target.left) {
+            ERROR("could not parse line " << lineNumber << " of the shard plan " << file);
+            return false;
+        }
+        target.right = end - 1;
+        if (shard >= shards.size()) {
+            shards.resize(shard + 1);
+        }
+        shards[shard].push_back(target);
+    }
+    if (shards.empty()) {
+        ERROR("the shard plan " << file << " has no shards");
+        return false;
+    }
+    index();
+    return true;
+}
+
+void ShardPlan::index(void) {
+    owned.assign(shards.size(), map<string, map<long int, long int> >());
+    for (size_t i = 0; i < shards.size(); ++i) {
+        for (vector<BedTarget>::const_iterator t = shards[i].begin(); t != shards[i].end(); ++t) {
+            owned[i][t->seq][t->left] = t->right;
+        }
+    }
+}
+
+vector<BedTarget> ShardPlan::calledTargets(size_t shard) const {
+    vector<BedTarget> called;
+    for (vector<BedTarget>::const_iterator t = shards[shard].begin(); t != shards[shard].end(); ++t) {
+        BedTarget padded(t->seq, max(0, t->left - padding), t->right + padding, t->desc);
+        if (!called.empty() && called.back().seq == padded.seq && padded.left <= called.back().right + 1) {
+            called.back().right = max(called.back().right, padded.right);
+        } else {
+            called.push_back(padded);
+        }
+    }
+    return called;
+}
+
+bool ShardPlan::owns(size_t shard, const string& seq, long int position) const {
+    map<string, map<long int, long int> >::const_iterator s = owned[shard].find(seq);
+    if (s == owned[shard].end()) {
+        return false;
+    }
+    // the last interval starting at or before the position
+    map<long int, long int>::const_iterator i = s->second.upper_bound(position);
+    if (i == s->second.begin()) {
+        return false;
+    }
+    --i;
+    return position <= i->second;
+}
+
+bool mergeShards(const ShardPlan& plan, const Parameters& parameters) {
+
+    const vector<string>& files = parameters.bams;
+    const string& outputFile = parameters.outputFile;
+
+    if (files.size() != plan.shards.size()) {
+        ERROR("the shard plan has " << plan.shards.size() << " shards, but "
+              << files.size() << " outputs were given to merge");
+        return false;
+    }
+
+    bool compress = outputFile.size() > 3 && outputFile.compare(outputFile.size() - 3, 3, ".gz") == 0;
+    BGZF* out = bgzf_open(outputFile.empty() ? "-" : outputFile.c_str(), compress ? "w" : "wu");
+    if (!out) {
+        ERROR("unable to open output file: " << (outputFile.empty() ? "stdout" : outputFile));
+        return false;
+    }
+
+    bool ok = true;
+    string columns; // the #CHROM line of the first output
+    kstring_t line = {0, 0, NULL};
+    for (size_t i = 0; ok && i < files.size(); ++i) {
+        BGZF* in = bgzf_open(files[i].c_str(), "r");
+        if (!in) {
+            ERROR("could not open the shard output " << files[i]);
+            ok = false;
+            break;
+        }
+        unsigned long kept = 0;
+        unsigned long dropped = 0;
+        bool first = true;
+        while (ok && bgzf_getline(in, '\n', &line) >= 0) {
+            // the records are only looked at as far as their CHROM and POS
+            if (first && strncmp(line.s, "##fileformat=VCF", 16) != 0) {
+                ERROR("the shard output " << files[i] << " is not VCF; shards to be merged are to be written as VCF");
+                ok = false;
+                break;
+            }
+            first = false;
+            bool keep = i == 0;
+            if (line.l > 1 && line.s[0] == '#' && line.s[1] != '#') {
+                if (i == 0) {
+                    columns.assign(line.s, line.l);
+                } else if (columns.compare(0, string::npos, line.s, line.l) != 0) {
+                    ERROR("the samples of the shard output " << files[i] << " differ from those of " << files[0]);
+                    ok = false;
+                    break;
+                }
+            } else if (line.l > 0 && line.s[0] != '#') {
+                char* tab = strchr(line.s, '\t');
+                long int position = tab ? strtol(tab + 1, NULL, 10) - 1 : -1;
+                keep = tab && plan.owns(i, string(line.s, tab - line.s), position);
+                if (keep) {
+                    ++kept;
+                } else {
+                    ++dropped;
+                }
+            }
+            if (keep && (bgzf_write(out, line.s, line.l) < 0 || bgzf_write(out, "\n", 1) < 0)) {
+                ERROR("could not write the merged output");
+                ok = false;
+            }
+        }
+        bgzf_close(in);
+        DEBUG("merged " << kept << " records of " << files[i] << ", leaving out the "
+              << dropped << " in its padding");
+    }
+    free(line.s);
+
+    if (bgzf_close(out) < 0) {
+        ERROR("could not write the merged output");
+        ok = false;
+    }
+    return ok;
+
+}
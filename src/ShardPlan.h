@@ -0,0 +1,62 @@
+#ifndef FREEBAYES_SHARDPLAN_H
+#define FREEBAYES_SHARDPLAN_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include "BedReader.h"
+#include "Parameters.h"
+
+using namespace std;
+
+// the bases around each interval of a shard which it also calls, so that the
+// calls at its edges see the alleles they would in a single run
+#define SHARD_PADDING 1000
+
+// a plan for calling the targets of a run in shards, as separate processes
+// or on separate nodes: --emit-shards writes one, --shard calls one of its
+// shards and --merge-shards joins the outputs of all of them.
+//
+// each shard owns a list of intervals, balanced as with --auto-regions by the
+// amount of indexed alignment data they hold, and together tiling the targets
+// of the run in order.  a shard is called over its intervals widened by the
+// padding of the plan, and the merge keeps only the records of each shard
+// which begin in its own intervals, so each record is written once, and in
+// order without a sort.
+//
+// as a file, the plan is a line of its padding, then a line for each
+// interval of the shard it belongs to, its sequence, and its start and end,
+// 0-based and end-exclusive as in BED.
+class ShardPlan {
+
+public:
+
+    ShardPlan(void) : padding(SHARD_PADDING) { }
+
+    int padding;
+    vector<vector<BedTarget> > shards; // 0-based and inclusive, as targets
+
+    bool write(const string& file) const;
+    bool read(const string& file);
+
+    // what the shard calls, its intervals widened by the padding, merged
+    // where they then overlap; the ends may run past those of the sequences
+    vector<BedTarget> calledTargets(size_t shard) const;
+    // true if the 0-based position is in one of the shard's intervals
+    bool owns(size_t shard, const string& seq, long int position) const;
+
+private:
+
+    // the lefts and rights of the intervals of each shard, by sequence
+    vector<map<string, map<long int, long int> > > owned;
+    void index(void);
+
+};
+
+// writes the records of the outputs of the shards of the plan, given in place
+// of the alignment files in the order of the shards, to the output file or
+// stdout, keeping the header of the first; false if one couldn't be read or
+// they don't match
+bool mergeShards(const ShardPlan& plan, const Parameters& parameters);
+
+#endif
@@ -0,0 +1,156 @@
+#include "SiteTrace.h"
+#include <algorithm>
+
+static void appendJSONString(string& out, const string& s) {
+    out += '"';
+    for (string::const_iterator c = s.begin(); c != s.end(); ++c) {
+        if (*c == '"' || *c == '\\') {
+            out += '\\';
+        }
+        out += *c;
+    }
+    out += '"';
+}
+
+static void appendNumber(string& out, long int value) {
+    char digits[32];
+    int length = snprintf(digits, sizeof(digits), "%ld", value);
+    out.append(digits, length);
+}
+
+static void appendNumber(string& out, double value) {
+    char digits[32];
+    int length = snprintf(digits, sizeof(digits), "%.6g", value);
+    out.append(digits, length);
+}
+
+bool SiteTrace::open(const string& filename, const vector<BedTarget>& traceRegions, const vector<string>& traceSamples,
+                     bool append) {
+    file = fopen(filename.c_str(), append ? "a" : "w");
+    if (!file) {
+        return false;
+    }
+    setvbuf(file, NULL, _IOFBF, TRACE_FILE_BUFFER);
+    for (vector<BedTarget>::const_iterator r = traceRegions.begin(); r != traceRegions.end(); ++r) {
+        regions[r->seq].push_back(make_pair((long int) r->left, (long int) r->right));
+    }
+    for (map<string, vector<pair<long int, long int> > >::iterator r = regions.begin(); r != regions.end(); ++r) {
+        sort(r->second.begin(), r->second.end());
+    }
+    samples.insert(traceSamples.begin(), traceSamples.end());
+    return true;
+}
+
+bool SiteTrace::traces(const string& sequence, long int position) const {
+    if (regions.empty()) {
+        return true;
+    }
+    map<string, vector<pair<long int, long int> > >::const_iterator r = regions.find(sequence);
+    if (r == regions.end()) {
+        return false;
+    }
+    // there are only ever a few regions, so look through them all
+    for (vector<pair<long int, long int> >::const_iterator s = r->second.begin(); s != r->second.end(); ++s) {
+        if (s->first <= position && position <= s->second) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SiteTrace::add(const string& sequence, long int position,
+                    vector<Allele>& genotypeAlleles,
+                    map<string, vector<vector<SampleDataLikelihood> > >& sampleDataLikelihoodsByPopulation) {
+
+    // kept by each thread, so the records are built without allocating once it has grown
+    static thread_local string records;
+    static thread_local vector<int> gtspec;
+    records.clear();
+
+    for (map<string, vector<vector<SampleDataLikelihood> > >::iterator p = sampleDataLikelihoodsByPopulation.begin();
+         p != sampleDataLikelihoodsByPopulation.end(); ++p) {
+        for (vector<vector<SampleDataLikelihood> >::iterator s = p->second.begin(); s != p->second.end(); ++s) {
+            if (s->empty()) {
+                continue;
+            }
+            const string& name = *s->front().name;
+            if (!samples.empty() && !samples.count(name)) {
+                continue;
+            }
+            records += "{\"seq\":";
+            appendJSONString(records, sequence);
+            records += ",\"pos\":";
+            appendNumber(records, position);
+            records += ",\"sample\":";
+            appendJSONString(records, name);
+            records += ",\"alleles\":[";
+            for (vector<Allele>::iterator a = genotypeAlleles.begin(); a != genotypeAlleles.end(); ++a) {
+                if (a != genotypeAlleles.begin()) {
+                    records += ',';
+                }
+                appendJSONString(records, a->alternateSequence);
+            }
+            records += "],\"observations\":[";
+            Sample& sample = *s->front().sample;
+            bool first = true;
+            for (Sample::iterator g = sample.begin(); g != sample.end(); ++g) {
+                for (vector<Allele*>::iterator o = g->second.begin(); o != g->second.end(); ++o) {
+                    Allele& obs = **o;
+                    records += first ? "{\"type\":\"" : ",{\"type\":\"";
+                    first = false;
+                    records += obs.typeName();
+                    records += "\",\"base\":";
+                    appendJSONString(records, obs.currentBase);
+                    records += ",\"pos\":";
+                    appendNumber(records, obs.position);
+                    records += obs.strand == STRAND_FORWARD ? ",\"strand\":\"+\"" : ",\"strand\":\"-\"";
+                    records += ",\"q\":";
+                    appendNumber(records, (double) obs.quality);
+                    records += ",\"mq\":";
+                    appendNumber(records, (long int) obs.mapQuality);
+                    records += '}';
+                }
+            }
+            records += "],\"likelihoods\":[";
+            for (vector<SampleDataLikelihood>::iterator l = s->begin(); l != s->end(); ++l) {
+                if (l != s->begin()) {
+                    records += ',';
+                }
+                gtspec.clear();
+                l->genotype->relativeGenotype(gtspec, genotypeAlleles);
+                records += "{\"gt\":\"";
+                for (vector<int>::iterator i = gtspec.begin(); i != gtspec.end(); ++i) {
+                    if (i != gtspec.begin()) {
+                        records += '/';
+                    }
+                    appendNumber(records, (long int) *i);
+                }
+                records += "\",\"ll\":";
+                appendNumber(records, (double) l->prob);
+                records += '}';
+            }
+            records += "]}\n";
+            if (records.size() >= TRACE_FLUSH_SIZE) {
+                write(records);
+            }
+        }
+    }
+    write(records);
+
+}
+
+void SiteTrace::write(string& records) {
+    if (records.empty()) {
+        return;
+    }
+    lock_guard<mutex> lock(writeMutex);
+    fwrite(records.data(), 1, records.size(), file);
+    records.clear();
+}
+
+void SiteTrace::close(void) {
+    if (file) {
+        fclose(file);
+        file = NULL;
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef FREEBAYES_SITETRACE_H
+#define FREEBAYES_SITETRACE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <stdio.h>
+#include "BedReader.h"
+#include "Allele.h"
+#include "Sample.h"
+#include "Genotype.h"
+
+using namespace std;
+
+// the buffer of the --trace file, and how much of a site's records we build
+// before writing them out
+#define TRACE_FILE_BUFFER 1048576
+#define TRACE_FLUSH_SIZE 65536
+
+// writes the observations and data likelihoods of each sample at each site
+// genotyped, for --trace, as JSON Lines: one object per sample and site,
+//
+//   {"seq":"20","pos":1234,"sample":"NA12878","alleles":["A","G"],
+//    "observations":[{"type":"snp","base":"G","pos":1233,"strand":"+","q":30,"mq":60},...],
+//    "likelihoods":[{"gt":"0/1","ll":-1.23},...]}
+//
+// with pos 0-based.  only the sites in the trace regions and the samples
+// named are written, and the sites and samples which aren't are passed over
+// before anything is built for them.  the records of a site are built into a
+// buffer of the calling thread, which is kept from site to site, and written
+// out under a lock, so tracing costs no allocation per observation.
+class SiteTrace {
+
+public:
+
+    SiteTrace(void) : file(NULL) { }
+    ~SiteTrace(void) { close(); }
+
+    // no regions traces every site, and no samples every sample.  a resumed
+    // run appends to the trace
+    bool open(const string& filename, const vector<BedTarget>& regions, const vector<string>& samples,
+              bool append = false);
+    bool is_open(void) const { return file != NULL; }
+
+    // true if the site at the 0-based position is traced
+    bool traces(const string& sequence, long int position) const;
+
+    // adds the records of the samples traced at the site
+    void add(const string& sequence, long int position,
+             vector<Allele>& genotypeAlleles,
+             map<string, vector<vector<SampleDataLikelihood> > >& sampleDataLikelihoodsByPopulation);
+
+    void close(void);
+
+private:
+
+    void write(string& records);
+
+    FILE* file;
+    map<string, vector<pair<long int, long int> > > regions; // by sequence, 0-based and inclusive
+    set<string> samples;
+    mutex writeMutex;
+
+};
+
+#endif
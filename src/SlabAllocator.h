@@ -0,0 +1,114 @@
+#ifndef FREEBAYES_SLABALLOCATOR_H
+#define FREEBAYES_SLABALLOCATOR_H
+
+#include <new>
+#include <algorithm>
+#include <stddef.h>
+
+using namespace std;
+
+// the largest node, in bytes, which SlabAllocator keeps to reuse
+#define SLAB_MAX_NODE_SIZE 1024
+#define SLAB_SIZE_CLASS 16
+
+// the free nodes of each size class, kept by each thread.  nodes given back on
+// one thread may be taken again on another; all of them come from operator new.
+class SlabFreeList {
+
+public:
+
+    static void* take(size_t size) {
+        size_t c = sizeClass(size);
+        SlabFreeList& lists = threadLists();
+        if (c < CLASSES && lists.alive && lists.heads[c]) {
+            FreeNode* n = lists.heads[c];
+            lists.heads[c] = n->next;
+            return n;
+        }
+        return ::operator new(c < CLASSES ? (c + 1) * SLAB_SIZE_CLASS : size);
+    }
+
+    static void give(void* p, size_t size) {
+        size_t c = sizeClass(size);
+        SlabFreeList& lists = threadLists();
+        if (c < CLASSES && lists.alive) {
+            FreeNode* n = static_cast<FreeNode*>(p);
+            n->next = lists.heads[c];
+            lists.heads[c] = n;
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+private:
+
+    struct FreeNode { FreeNode* next; };
+    static const size_t CLASSES = SLAB_MAX_NODE_SIZE / SLAB_SIZE_CLASS;
+
+    static size_t sizeClass(size_t size) {
+        return (max(size, sizeof(FreeNode)) - 1) / SLAB_SIZE_CLASS;
+    }
+
+    static SlabFreeList& threadLists(void) {
+        static thread_local SlabFreeList lists;
+        return lists;
+    }
+
+    SlabFreeList(void) : alive(true) {
+        for (size_t c = 0; c < CLASSES; ++c) {
+            heads[c] = NULL;
+        }
+    }
+
+    // nodes given back after the thread's lists are gone go straight to delete
+    ~SlabFreeList(void) {
+        alive = false;
+        for (size_t c = 0; c < CLASSES; ++c) {
+            while (heads[c]) {
+                FreeNode* n = heads[c];
+                heads[c] = n->next;
+                ::operator delete(n);
+            }
+        }
+    }
+
+    bool alive;
+    FreeNode* heads[CLASSES];
+
+};
+
+// an allocator for the nodes of the containers which are built up and cleared
+// at every site, such as Samples and each Sample, so that once the first sites
+// have been seen, the nodes of each site are those given back by the last one
+// rather than new allocations
+template <class T>
+class SlabAllocator {
+
+public:
+
+    typedef T value_type;
+
+    SlabAllocator(void) { }
+    template <class U> SlabAllocator(const SlabAllocator<U>&) { }
+
+    T* allocate(size_t n) {
+        if (n != 1) {
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T*>(SlabFreeList::take(sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n) {
+        if (n != 1) {
+            ::operator delete(p);
+        } else {
+            SlabFreeList::give(p, sizeof(T));
+        }
+    }
+
+    template <class U> bool operator==(const SlabAllocator<U>&) const { return true; }
+    template <class U> bool operator!=(const SlabAllocator<U>&) const { return false; }
+
+};
+
+#endif
@@ -3,6 +3,8 @@
 #include "Utility.h"
 #include "Sum.h"
 #include "Product.h"
+#include <stdio.h>
+#include <limits>
 
 #define PHRED_MAX 50000.0 // max Phred seems to be about 43015 (?), could be an underflow bug...
 
@@ -12,11 +14,11 @@ short qualityChar2ShortInt(char c) {
     return static_cast<short>(c) - 33;
 }
 
-long double qualityChar2LongDouble(char c) {
-    return static_cast<long double>(c) - 33;
+Probability qualityChar2LongDouble(char c) {
+    return static_cast<Probability>(c) - 33;
 }
 
-long double lnqualityChar2ShortInt(char c) {
+Probability lnqualityChar2ShortInt(char c) {
     return log(static_cast<short>(c) - 33);
 }
 
@@ -24,41 +26,87 @@ char qualityInt2Char(short i) {
     return static_cast<char>(i + 33);
 }
 
-long double ln2log10(long double prob) {
+Probability ln2log10(Probability prob) {
     return M_LOG10E * prob;
 }
 
-long double log102ln(long double prob) {
+Probability log102ln(Probability prob) {
     return M_LN10 * prob;
 }
 
-long double phred2ln(int qual) {
+// quality math on integer phred scores is looked up in tables filled in
+// once, as it's done for every observation of every site
+class PhredTables {
+public:
+    Probability ln[PHRED_TABLE_SIZE];          // log p(error)
+    Probability error[PHRED_TABLE_SIZE];       // p(error)
+    Probability lnCorrect[PHRED_TABLE_SIZE];   // log(1 - p(error))
+    PhredTables(void) {
+        for (int q = 0; q < PHRED_TABLE_SIZE; ++q) {
+            ln[q] = M_LN10 * q * -.1;
+            error[q] = pow(10, q * -.1);
+            lnCorrect[q] = log1m_exp(ln[q]);
+        }
+    }
+};
+
+static const PhredTables phredTables;
+
+Probability log1m_exp(Probability lnprob) {
+    // log1p is accurate for small probabilities, and expm1 for large ones
+    return (lnprob < -M_LN2) ? log1p(-exp(lnprob)) : log(-expm1(lnprob));
+}
+
+Probability logaddexp(Probability lna, Probability lnb) {
+    if (lna < lnb) {
+        swap(lna, lnb);
+    }
+    if (lna == -INFINITY) {
+        return lna;
+    }
+    return lna + log1p(exp(lnb - lna));
+}
+
+Probability phred2ln(int qual) {
+    if (qual >= 0 && qual < PHRED_TABLE_SIZE) {
+        return phredTables.ln[qual];
+    }
     return M_LN10 * qual * -.1;
 }
 
-long double ln2phred(long double prob) {
+Probability phred2lnCorrect(int qual) {
+    if (qual >= 0 && qual < PHRED_TABLE_SIZE) {
+        return phredTables.lnCorrect[qual];
+    }
+    return log1m_exp(phred2ln(qual));
+}
+
+Probability ln2phred(Probability prob) {
     return -10 * M_LOG10E * prob;
 }
 
-long double phred2float(int qual) {
+Probability phred2float(int qual) {
+    if (qual >= 0 && qual < PHRED_TABLE_SIZE) {
+        return phredTables.error[qual];
+    }
     return pow(10, qual * -.1);
 }
 
-long double float2phred(long double prob) {
+Probability float2phred(Probability prob) {
     if (prob == 1)
         return PHRED_MAX;  // guards against "-0"
-    long double p = -10 * (long double) log10(prob);
+    Probability p = -10 * (Probability) log10(prob);
     if (p < 0 || p > PHRED_MAX) // int overflow guard
         return PHRED_MAX;
     else
         return p;
 }
 
-long double big2phred(const BigFloat& prob) {
-    return -10 * (long double) (ttmath::Log(prob, (BigFloat)10)).ToDouble();
+Probability big2phred(const BigFloat& prob) {
+    return -10 * (Probability) (ttmath::Log(prob, (BigFloat)10)).ToDouble();
 }
 
-long double nan2zero(long double x) {
+Probability nan2zero(Probability x) {
     if (x != x) {
         return 0;
     } else {
@@ -66,18 +114,18 @@ long double nan2zero(long double x) {
     }
 }
 
-long double powln(long double m, int n) {
+Probability powln(Probability m, int n) {
     return m * n;
 }
 
 // the probability that we have a completely true vector of qualities
-long double jointQuality(const std::vector<short>& quals) {
-    std::vector<long double> probs;
+Probability jointQuality(const std::vector<short>& quals) {
+    std::vector<Probability> probs;
     for (int i = 0; i<quals.size(); ++i) {
         probs.push_back(phred2float(quals[i]));
     }
     // product of probability we don't have a true event for each element
-    long double prod = 1 - probs.front();
+    Probability prod = 1 - probs.front();
     for (int i = 1; i<probs.size(); ++i) {
         prod *= 1 - probs.at(i);
     }
@@ -85,9 +133,9 @@ long double jointQuality(const std::vector<short>& quals) {
     return 1 - prod;
 }
 
-long double jointQuality(const std::string& qualstr) {
+Probability jointQuality(const std::string& qualstr) {
 
-    long double jq = 1;
+    Probability jq = 1;
     // product of probability we don't have a true event for each element
     for (string::const_iterator q = qualstr.begin(); q != qualstr.end(); ++q) {
         jq *= 1 - phred2float(qualityChar2ShortInt(*q));
@@ -108,17 +156,17 @@ std::vector<short> qualities(const std::string& qualstr) {
 
 }
 
-long double sumQuality(const std::string& qualstr) {
-    long double qual = 0;
+Probability sumQuality(const std::string& qualstr) {
+    Probability qual = 0;
     for (string::const_iterator q = qualstr.begin(); q != qualstr.end(); ++q)
         qual += qualityChar2LongDouble(*q);
     return qual;
 }
 
-long double minQuality(const std::string& qualstr) {
-    long double qual = 0;
+Probability minQuality(const std::string& qualstr) {
+    Probability qual = 0;
     for (string::const_iterator q = qualstr.begin(); q != qualstr.end(); ++q) {
-        long double nq = qualityChar2LongDouble(*q);
+        Probability nq = qualityChar2LongDouble(*q);
         if (qual == 0) {
             qual = nq;
         } else if (nq < qual) {
@@ -137,15 +185,15 @@ short minQuality(const std::vector<short>& qualities) {
 }
 
 // crudely averages quality scores in phred space
-long double averageQuality(const std::string& qualstr) {
-    long double qual = 0; //(long double) *max_element(quals.begin(), quals.end());
+Probability averageQuality(const std::string& qualstr) {
+    Probability qual = 0; //(Probability) *max_element(quals.begin(), quals.end());
     for (string::const_iterator q = qualstr.begin(); q != qualstr.end(); ++q)
         qual += qualityChar2LongDouble(*q);
     return qual / qualstr.size();
 }
 
-long double averageQuality(const vector<short>& qualities) {
-    long double qual = 0;
+Probability averageQuality(const vector<short>& qualities) {
+    Probability qual = 0;
     for (vector<short>::const_iterator q = qualities.begin(); q != qualities.end(); ++q) {
         qual += *q;
     }
@@ -198,48 +246,56 @@ int binomialCoefficient(int n, int k) {
 }
 
 // k successes in n trials with prob of success p
-long double binomialProb(int k, int n, long double p) {
+Probability binomialProb(int k, int n, Probability p) {
     return factorial(n) / (factorial(k) * factorial(n - k)) * pow(p, k) * pow(1 - p, n - k);
 }
 
-long double impl_binomialProbln(int k, int n, long double p) {
+Probability impl_binomialProbln(int k, int n, Probability p) {
     return factorialln(n) - (factorialln(k) + factorialln(n - k)) + powln(log(p), k) + powln(log(1 - p), n - k);
 }
 
-long double binomialCoefficientLn(int k, int n) {
+Probability binomialCoefficientLn(int k, int n) {
     return factorialln(n) - (factorialln(k) + factorialln(n - k));
 }
 
-BinomialCache binomialCache;
-
-long double binomialProbln(int k, int n, long double p) {
-    return binomialCache.binomialProbln(k, n, p);
+// the coefficient comes from the factorial table, so the only thing to keep
+// is the logs of p, which is nearly always the same from one call to the next
+Probability binomialProbln(int k, int n, Probability p) {
+    thread_local Probability lastp = NAN;
+    thread_local Probability lnp = 0;
+    thread_local Probability ln1mp = 0;
+    if (!(p == lastp)) {
+        lastp = p;
+        lnp = log(p);
+        ln1mp = log(1 - p);
+    }
+    return binomialCoefficientLn(k, n) + powln(lnp, k) + powln(ln1mp, n - k);
 }
 
 /*
-long double probability(int k, int n, long double p) {
+Probability probability(int k, int n, Probability p) {
     int n = n - k;
     int m = k;
-    long double q = 1 - p;
-    long double temp = lgammal(m + n + 1.0);
+    Probability q = 1 - p;
+    Probability temp = lgammal(m + n + 1.0);
     temp -= lgammal(n + 1.0) + lgammal(m + 1.0);
     temp += m*log(p) + n*log(q);
     return temp;
 }
 */
 
-long double poissonpln(int observed, int expected) {
+Probability poissonpln(int observed, int expected) {
     return ((log(expected) * observed) - expected) - factorialln(observed);
 }
 
-long double poissonp(int observed, int expected) {
+Probability poissonp(int observed, int expected) {
     return (double) pow((double) expected, (double) observed) * (double) pow(M_E, (double) -expected) / factorial(observed);
 }
 
 
 // given the expected number of events is the max of a and b
 // what is the probability that we might observe less than the observed?
-long double poissonPvalLn(int a, int b) {
+Probability poissonPvalLn(int a, int b) {
 
     int expected, observed;
     if (a > b) {
@@ -248,7 +304,7 @@ long double poissonPvalLn(int a, int b) {
         expected = b; observed = a;
     }
 
-    vector<long double> probs;
+    vector<Probability> probs;
     for (int i = 0; i < observed; ++i) {
         probs.push_back(poissonpln(i, expected));
     }
@@ -258,106 +314,99 @@ long double poissonPvalLn(int a, int b) {
 }
 
 
-long double gammaln(
-    long double x
+Probability gammaln(
+    Probability x
     ) {
 
-    long double cofactors[] = { 76.18009173, 
+    Probability cofactors[] = { 76.18009173, 
                                 -86.50532033,
                                 24.01409822,
                                 -1.231739516,
                                 0.120858003E-2,
                                 -0.536382E-5 };    
 
-    long double x1 = x - 1.0;
-    long double tmp = x1 + 5.5;
+    Probability x1 = x - 1.0;
+    Probability tmp = x1 + 5.5;
     tmp -= (x1 + 0.5) * log(tmp);
-    long double ser = 1.0;
+    Probability ser = 1.0;
     for (int j=0; j<=5; j++) {
         x1 += 1.0;
         ser += cofactors[j]/x1;
     }
-    long double y =  (-1.0 * tmp + log(2.50662827465 * ser));
+    Probability y =  (-1.0 * tmp + log(2.50662827465 * ser));
 
     return y;
 }
 
-long double factorial(
+Probability factorial(
     int n
     ) {
     if (n < 0) {
-        return (long double)0.0;
+        return (Probability)0.0;
     }
     else if (n == 0) {
-        return (long double)1.0;
+        return (Probability)1.0;
     }
     else {
         return exp(gammaln(n + 1.0));
     }
 }
 
-FactorialCache factorialCache;
-
-/*
-long double factorialln(int n) {
-    return factorialCache.factorialln(n);
-}
-*/
-
-long double impl_factorialln(
+Probability impl_factorialln(
     int n
     ) {
     if (n < 0) {
-        return (long double)-1.0;
+        return (Probability)-1.0;
     }
     else if (n == 0) {
-        return (long double)0.0;
+        return (Probability)0.0;
     }
     else {
         return gammaln(n + 1.0);
     }
 }
 
-long double cofactor(
+Probability cofactor(
     int n, 
     int i
     ) {
     if ((n < 0) || (i < 0) || (n < i)) {
-        return (long double)0.0;
+        return (Probability)0.0;
     }
     else if (n == i) {
-        return (long double)1.0;
+        return (Probability)1.0;
     }
     else {
         return exp(gammaln(n + 1.0) - gammaln(i + 1.0) - gammaln(n-i + 1.0));
     }
 }
 
-long double cofactorln(
+Probability cofactorln(
     int n, 
     int i
     ) {
     if ((n < 0) || (i < 0) || (n < i)) {
-        return (long double)-1.0;
+        return (Probability)-1.0;
     }
     else if (n == i) {
-        return (long double)0.0;
+        return (Probability)0.0;
     }
     else {
         return gammaln(n + 1.0) - gammaln(i + 1.0) - gammaln(n-i + 1.0);
     }
 }
 
-// prevent underflows by returning exp(LDBL_MIN_EXP) if exponentiation will produce an underflow
-long double safe_exp(long double ln) {
-    if (ln < LDBL_MIN_EXP) {  // -16381
-        return LDBL_MIN;      // 3.3621e-4932
+// prevent underflows by returning the least normal value (3.3621e-4932 as a long
+// double) if exponentiation will produce an underflow
+Probability safe_exp(Probability ln) {
+    if (ln < numeric_limits<Probability>::min_exponent) {
+        return numeric_limits<Probability>::min();
     } else {
         return exp(ln);
     }
 }
 
-BigFloat big_exp(long double ln) {
+BigFloat big_exp(Probability ln) {
     BigFloat x, result;
     x.FromDouble(ln);
     result = ttmath::Exp(x);
@@ -365,29 +414,45 @@ BigFloat big_exp(long double ln) {
 }
 
 // 'safe' log summation for probabilities
-long double logsumexp_probs(const vector<long double>& lnv) {
-    vector<long double>::const_iterator i = lnv.begin();
-    long double maxN = *i;
+//
+// after the max is factored out every term is at most 1, and one of them is
+// exactly 1, so the sum can be taken in doubles; only a sum we can't
+// factor (all -inf, or inf or nan terms) goes to the BigFloat path
+Probability logsumexp_probs(const vector<Probability>& lnv) {
+    vector<Probability>::const_iterator i = lnv.begin();
+    Probability maxN = *i;
     ++i;
     for (; i != lnv.end(); ++i) {
         if (*i > maxN)
             maxN = *i;
     }
+    if (std::isfinite(maxN)) {
+        double sum = 0;
+        for (vector<Probability>::const_iterator i = lnv.begin(); i != lnv.end(); ++i) {
+            sum += exp((double) (*i - maxN));
+        }
+        if (std::isfinite(sum)) {
+            return maxN + log(sum);
+        }
+    }
+    return big_logsumexp_probs(lnv, maxN);
+}
+
+Probability big_logsumexp_probs(const vector<Probability>& lnv, Probability maxN) {
     BigFloat sum = 0;
-    for (vector<long double>::const_iterator i = lnv.begin(); i != lnv.end(); ++i) {
+    for (vector<Probability>::const_iterator i = lnv.begin(); i != lnv.end(); ++i) {
         sum += big_exp(*i - maxN);
     }
     BigFloat maxNb; maxNb.FromDouble(maxN);
     BigFloat bigResult = maxNb + ttmath::Ln(sum);
-    long double result;
     return bigResult.ToDouble();
 }
 
 // unsafe, kept for potential future use
-long double logsumexp(const vector<long double>& lnv) {
-    long double maxAbs, minN, maxN, c;
-    vector<long double>::const_iterator i = lnv.begin();
-    long double n = *i;
+Probability logsumexp(const vector<Probability>& lnv) {
+    Probability maxAbs, minN, maxN, c;
+    vector<Probability>::const_iterator i = lnv.begin();
+    Probability n = *i;
     maxAbs = n; maxN = n; minN = n;
     ++i;
     for (; i != lnv.end(); ++i) {
@@ -404,36 +469,44 @@ long double logsumexp(const vector<long double>& lnv) {
     } else {
         c = maxN;
     }
-    long double sum = 0;
-    for (vector<long double>::const_iterator i = lnv.begin(); i != lnv.end(); ++i) {
+    Probability sum = 0;
+    for (vector<Probability>::const_iterator i = lnv.begin(); i != lnv.end(); ++i) {
         sum += exp(*i - c);
     }
     return c + log(sum);
 }
 
-long double betaln(const vector<long double>& alphas) {
-    vector<long double> gammalnAlphas;
+Probability betaln(const vector<Probability>& alphas) {
+    vector<Probability> gammalnAlphas;
     gammalnAlphas.resize(alphas.size());
     transform(alphas.begin(), alphas.end(), gammalnAlphas.begin(), gammaln);
     return sum(gammalnAlphas) - gammaln(sum(alphas));
 }
 
-long double beta(const vector<long double>& alphas) {
+Probability beta(const vector<Probability>& alphas) {
     return exp(betaln(alphas));
 }
 
-long double hoeffding(double successes, double trials, double prob) {
+Probability hoeffding(double successes, double trials, double prob) {
     return 0.5 * exp(-2 * pow(trials * prob - successes, 2) / trials);
 }
 
-long double hoeffdingln(double successes, double trials, double prob) {
+Probability hoeffdingln(double successes, double trials, double prob) {
     return log(0.5) + (-2 * pow(trials * prob - successes, 2) / trials);
 }
 
+// with prob 0.5, the bound is ln(0.5) - (trials - 2 successes)^2 / (2 trials),
+// with no pow, and the same as hoeffdingln gives to the bit: the square and
+// the doubled trials are exact, so only the division rounds, as it does there
+Probability hoeffdingPhred(unsigned long successes, unsigned long trials) {
+    double d = (double) trials - 2.0 * (double) successes;
+    return nan2zero(ln2phred(log(0.5) - d * d / (2.0 * (double) trials)));
+}
+
 // the sum of the harmonic series 1, n
-long double harmonicSum(int n) {
-    long double r = 0;
-    long double i = 1;
+Probability harmonicSum(int n) {
+    Probability r = 0;
+    Probability i = 1;
     while (i <= n) {
         r += 1 / i;
         ++i;
@@ -557,19 +630,41 @@ string dateStr(void) {
 
 }
 
-long double string2float(const string& s) {
-    long double r;
+Probability string2float(const string& s) {
+    Probability r;
     convert(s, r);
     return r;
 }
 
-long double log10string2ln(const string& s) {
-    long double r;
+Probability log10string2ln(const string& s) {
+    Probability r;
     convert(s, r);
     return log102ln(r);
 }
 
-long double safedivide(long double a, long double b) {
+string formatInt(long int i) {
+    char buffer[24];
+    char* end = buffer + sizeof(buffer);
+    char* p = end;
+    unsigned long int u = i < 0 ? -(unsigned long int) i : i;
+    do {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (i < 0) {
+        *--p = '-';
+    }
+    return string(p, end - p);
+}
+
+string formatFloat(Probability x) {
+    // %g, with ostream's default precision of 6
+    char buffer[32];
+    int n = snprintf(buffer, sizeof(buffer), "%Lg", (long double) x);
+    return string(buffer, n);
+}
+
+Probability safedivide(Probability a, Probability b) {
     if (b == 0) {
         if (a == 0) {
             return 1;
@@ -581,97 +676,6 @@ long double safedivide(long double a, long double b) {
     }
 }
 
-string mergeCigar(const string& c1, const string& c2) {
-    vector<pair<int, string> > cigar1 = splitCigar(c1);
-    vector<pair<int, string> > cigar2 = splitCigar(c2);
-    // check if the middle elements are the same
-    if (cigar1.back().second == cigar2.front().second) {
-        cigar1.back().first += cigar2.front().first;
-        cigar2.erase(cigar2.begin());
-    }
-    for (vector<pair<int, string> >::iterator c = cigar2.begin(); c != cigar2.end(); ++c) {
-        cigar1.push_back(*c);
-    }
-    return joinCigar(cigar1);
-}
-
-vector<pair<int, string> > splitCigar(const string& cigarStr) {
-    vector<pair<int, string> > cigar;
-    string number;
-    string type;
-    // strings go [Number][Type] ...
-    for (string::const_iterator s = cigarStr.begin(); s != cigarStr.end(); ++s) {
-        char c = *s;
-        if (isdigit(c)) {
-            if (type.empty()) {
-                number += c;
-            } else {
-                // signal for next token, push back the last pair, clean up
-                cigar.push_back(make_pair(atoi(number.c_str()), type));
-                number.clear();
-                type.clear();
-                number += c;
-            }
-        } else {
-            type += c;
-        }
-    }
-    if (!number.empty() && !type.empty()) {
-        cigar.push_back(make_pair(atoi(number.c_str()), type));
-    }
-    return cigar;
-}
-
-list<pair<int, string> > splitCigarList(const string& cigarStr) {
-    list<pair<int, string> > cigar;
-    string number;
-    string type;
-    // strings go [Number][Type] ...
-    for (string::const_iterator s = cigarStr.begin(); s != cigarStr.end(); ++s) {
-        char c = *s;
-        if (isdigit(c)) {
-            if (type.empty()) {
-                number += c;
-            } else {
-                // signal for next token, push back the last pair, clean up
-                cigar.push_back(make_pair(atoi(number.c_str()), type));
-                number.clear();
-                type.clear();
-                number += c;
-            }
-        } else {
-            type += c;
-        }
-    }
-    if (!number.empty() && !type.empty()) {
-        cigar.push_back(make_pair(atoi(number.c_str()), type));
-    }
-    return cigar;
-}
-
-string joinCigar(const vector<pair<int, string> >& cigar) {
-    string cigarStr;
-    for (vector<pair<int, string> >::const_iterator c = cigar.begin(); c != cigar.end(); ++c) {
-        if (c->first) {
-            cigarStr += convert(c->first) + c->second;
-        }
-    }
-    return cigarStr;
-}
-
-string joinCigarList(const list<pair<int, string> >& cigar) {
-    string cigarStr;
-    for (list<pair<int, string> >::const_iterator c = cigar.begin(); c != cigar.end(); ++c) {
-        cigarStr += convert(c->first) + c->second;
-    }
-    return cigarStr;
-}
-
-bool isEmptyCigarElement(const pair<int, string>& elem) {
-    return elem.first == 0;
-}
-
-
 // string * overload
 // from http://stackoverflow.com/a/5145880
 std::string operator*(std::string const &s, size_t n)
@@ -684,12 +688,12 @@ std::string operator*(std::string const &s, size_t n)
 }
 
 // normalize vector sum to 1
-void normalizeSumToOne(vector<long double>& v) {
-    long double sum = 0;
-    for (vector<long double>::iterator i = v.begin(); i != v.end(); ++i) {
+void normalizeSumToOne(vector<Probability>& v) {
+    Probability sum = 0;
+    for (vector<Probability>::iterator i = v.begin(); i != v.end(); ++i) {
         sum += *i;
     }
-    for (vector<long double>::iterator i = v.begin(); i != v.end(); ++i) {
+    for (vector<Probability>::iterator i = v.begin(); i != v.end(); ++i) {
         *i /= sum;
     }
 }
@@ -709,7 +713,8 @@ void addLinesFromFile(vector<string>& v, const string& f) {
 }
 
 
-double lf[] = {
+// log(n!) for n < FACTORIALLN_TABLE_SIZE
+static const double lf[FACTORIALLN_TABLE_SIZE] = {
 0.000000000000000,
 0.000000000000000,
 0.693147180559945,
@@ -100723,7 +100728,7 @@ double factorialln(int n)
         throw std::invalid_argument( os.str() );
         
     }
-    else if (n > 100000-1)
+    else if (n >= FACTORIALLN_TABLE_SIZE)
     {
         const double PI = 3.141592653589793;
         double x = n + 1;
@@ -100756,3 +100761,11 @@ double entropy(const string& st) {
     ent = -ent;
     return ent;
 }
+
+uint64_t fnv1a(const string& s, uint64_t h) {
+    for (string::const_iterator c = s.begin(); c != s.end(); ++c) {
+        h ^= (unsigned char) *c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
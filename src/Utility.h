@@ -14,38 +14,47 @@
 #include <fstream>
 #include <map>
 #include <time.h>
+#include <stdint.h>
+#include <string.h>
 #include "convert.h"
 #include "ttmath.h"
+#include "Probability.h"
 
 using namespace std;
 
 typedef ttmath::Big<TTMATH_BITS(256), TTMATH_BITS(64)> BigFloat;
 
-long double factorial(int);
+Probability factorial(int);
 short qualityChar2ShortInt(char c);
-long double qualityChar2LongDouble(char c);
-long double lnqualityChar2ShortInt(char c);
+Probability qualityChar2LongDouble(char c);
+Probability lnqualityChar2ShortInt(char c);
 char qualityInt2Char(short i);
-//long double phred2float(int qual);
-long double phred2ln(int qual);
-long double ln2phred(long double prob);
-long double ln2log10(long double prob);
-long double log102ln(long double prob);
-long double phred2float(int qual);
-long double float2phred(long double prob);
-long double big2phred(const BigFloat& prob);
-long double nan2zero(long double x);
-long double powln(long double m, int n);
+//Probability phred2float(int qual);
+// phred scores below this are converted by table lookup
+#define PHRED_TABLE_SIZE 256
+
+Probability phred2ln(int qual);
+Probability phred2lnCorrect(int qual); // log(1 - p(error))
+Probability log1m_exp(Probability lnprob); // log(1 - exp(lnprob))
+Probability logaddexp(Probability lna, Probability lnb); // log(exp(lna) + exp(lnb))
+Probability ln2phred(Probability prob);
+Probability ln2log10(Probability prob);
+Probability log102ln(Probability prob);
+Probability phred2float(int qual);
+Probability float2phred(Probability prob);
+Probability big2phred(const BigFloat& prob);
+Probability nan2zero(Probability x);
+Probability powln(Probability m, int n);
 // here 'joint' means 'probability that we have a vector entirely composed of true bases'
-long double jointQuality(const std::vector<short>& quals);
-long double jointQuality(const std::string& qualstr);
+Probability jointQuality(const std::vector<short>& quals);
+Probability jointQuality(const std::string& qualstr);
 std::vector<short> qualities(const std::string& qualstr);
 // 
-long double sumQuality(const std::string& qualstr);
-long double minQuality(const std::string& qualstr);
+Probability sumQuality(const std::string& qualstr);
+Probability minQuality(const std::string& qualstr);
 short minQuality(const std::vector<short>& qualities);
-long double averageQuality(const std::string& qualstr);
-long double averageQuality(const std::vector<short>& qualities);
+Probability averageQuality(const std::string& qualstr);
+Probability averageQuality(const std::vector<short>& qualities);
 //unsigned int factorial(int n);
 bool stringInVector(string item, vector<string> items);
 int upper(int c); // helper to below, wraps toupper
@@ -54,101 +63,79 @@ bool allATGC(string& s);
 string strip(string const& str, char const* separators = " \t");
 
 int binomialCoefficient(int n, int k);
-long double binomialCoefficientLn(int k, int n);
-long double binomialProb(int k, int n, long double p);
-long double impl_binomialProbln(int k, int n, long double p);
-long double binomialProbln(int k, int n, long double p);
+Probability binomialCoefficientLn(int k, int n);
+Probability binomialProb(int k, int n, Probability p);
+Probability impl_binomialProbln(int k, int n, Probability p);
+Probability binomialProbln(int k, int n, Probability p);
+
+Probability poissonpln(int observed, int expected);
+Probability poissonp(int observed, int expected);
+Probability poissonPvalLn(int a, int b);
+
+Probability gammaln( Probability x);
+Probability factorial( int n);
+// log(n!), read from a precomputed table, shared by every thread, for n below
+// FACTORIALLN_TABLE_SIZE, and from Stirling's series beyond
+#define FACTORIALLN_TABLE_SIZE 100000
+double factorialln( int n);
+Probability impl_factorialln( int n);
 
-long double poissonpln(int observed, int expected);
-long double poissonp(int observed, int expected);
-long double poissonPvalLn(int a, int b);
+Probability cofactor( int n, int i);
+Probability cofactorln( int n, int i);
 
-long double gammaln( long double x);
-long double factorial( int n);
-double factorialln( int n);
-long double impl_factorialln( int n);
-
-#define MAX_FACTORIAL_CACHE_SIZE 100000
-
-class FactorialCache : public map<int, long double> {
-public:
-    long double factorialln(int n) {
-        map<int, long double>::iterator f = find(n);
-        if (f == end()) {
-            if (size() > MAX_FACTORIAL_CACHE_SIZE) {
-                clear();
-            }
-            long double fln = impl_factorialln(n);
-            insert(make_pair(n, fln));
-            return fln;
-        } else {
-            return f->second;
-        }
-    }
-};
-
-#define MAX_BINOMIAL_CACHE_SIZE 100000
-
-class BinomialCache : public map<long double, map<pair<int, int>, long double> > {
-public:
-    long double binomialProbln(int k, int n, long double p) {
-        map<pair<int, int>, long double>& t = (*this)[p];
-        pair<int, int> kn = make_pair(k, n);
-        map<pair<int, int>, long double>::iterator f = t.find(kn);
-        if (f == t.end()) {
-            if (t.size() > MAX_BINOMIAL_CACHE_SIZE) {
-                t.clear();
-            }
-            long double bln = impl_binomialProbln(k, n, p);
-            t.insert(make_pair(kn, bln));
-            return bln;
-        } else {
-            return f->second;
-        }
-    }
-};
-
-long double cofactor( int n, int i);
-long double cofactorln( int n, int i);
-
-long double harmonicSum(int n);
-
-long double safedivide(long double a, long double b);
-
-long double safe_exp(long double ln);
-
-BigFloat big_exp(long double ln);
-
-long double logsumexp_probs(const vector<long double>& lnv);
-long double logsumexp(const vector<long double>& lnv);
-
-long double betaln(const vector<long double>& alphas);
-long double beta(const vector<long double>& alphas);
-
-long double hoeffding(double successes, double trials, double prob);
-long double hoeffdingln(double successes, double trials, double prob);
+Probability harmonicSum(int n);
+
+Probability safedivide(Probability a, Probability b);
+
+Probability safe_exp(Probability ln);
+
+BigFloat big_exp(Probability ln);
+
+Probability logsumexp_probs(const vector<Probability>& lnv);
+Probability big_logsumexp_probs(const vector<Probability>& lnv, Probability maxN);
+Probability logsumexp(const vector<Probability>& lnv);
+
+Probability betaln(const vector<Probability>& alphas);
+Probability beta(const vector<Probability>& alphas);
+
+Probability hoeffding(double successes, double trials, double prob);
+Probability hoeffdingln(double successes, double trials, double prob);
+// the bias statistics of the records, nan2zero(ln2phred(hoeffdingln(successes,
+// trials, 0.5))), in closed form
+Probability hoeffdingPhred(unsigned long successes, unsigned long trials);
 
 int levenshteinDistance(const std::string source, const std::string target);
 bool isTransition(string& ref, string& alt);
 
 string dateStr(void);
 
-long double string2float(const string& s);
-long double log10string2ln(const string& s);
+Probability string2float(const string& s);
+Probability log10string2ln(const string& s);
+// formatted as convert formats them, i.e. as an ostream does by default,
+// without the cost of a stringstream
+string formatInt(long int i);
+string formatFloat(Probability x);
 
-string mergeCigar(const string& c1, const string& c2);
-vector<pair<int, string> > splitCigar(const string& cigarStr);
-list<pair<int, string> > splitCigarList(const string& cigarStr);
-string joinCigar(const vector<pair<int, string> >& cigar);
-string joinCigarList(const list<pair<int, string> >& cigar);
-bool isEmptyCigarElement(const pair<int, string>& elem);
 
 std::string operator*(std::string const &s, size_t n);
 
-void normalizeSumToOne(vector<long double>&);
+void normalizeSumToOne(vector<Probability>&);
 
 void addLinesFromFile(vector<string>& v, const string& f);
 
 double entropy(const string& st);
 
+// the FNV-1a hash of the string, continuing from h
+uint64_t fnv1a(const string& s, uint64_t h = 14695981039346656037ULL);
+
+// reads a value of the binary files we map, at p, which needn't be aligned,
+// and steps over it
+template <class T>
+T readValue(const char*& p) {
+    T value;
+    memcpy(&value, p, sizeof(T));
+    p += sizeof(T);
+    return value;
+}
+
 #endif
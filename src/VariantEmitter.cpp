@@ -0,0 +1,48 @@
+#include "VariantEmitter.h"
+
+VariantEmitter::VariantEmitter(VariantWriter& w, size_t depth)
+    : writer(w)
+    , maxQueued(depth > 0 ? depth : 1)
+    , closing(false)
+{
+    emitter = thread(&VariantEmitter::run, this);
+}
+
+void VariantEmitter::write(vcflib::Variant& var, RecordValues* values) {
+    unique_lock<mutex> lock(queueMutex);
+    queueChanged.wait(lock, [this]() { return queued.size() < maxQueued; });
+    queued.push_back(make_pair(std::move(var), RecordValues()));
+    if (values) {
+        queued.back().second = std::move(*values);
+    }
+    queueChanged.notify_all();
+}
+
+void VariantEmitter::close(void) {
+    {
+        lock_guard<mutex> lock(queueMutex);
+        closing = true;
+        queueChanged.notify_all();
+    }
+    if (emitter.joinable()) {
+        emitter.join();
+    }
+}
+
+void VariantEmitter::run(void) {
+    unique_lock<mutex> lock(queueMutex);
+    while (true) {
+        queueChanged.wait(lock, [this]() { return closing || !queued.empty(); });
+        if (queued.empty()) {
+            return;
+        }
+        // written outside the lock, so the caller can queue the next meanwhile
+        vcflib::Variant var(std::move(queued.front().first));
+        RecordValues values(std::move(queued.front().second));
+        queued.pop_front();
+        queueChanged.notify_all();
+        lock.unlock();
+        writer.write(var, &values);
+        lock.lock();
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef FREEBAYES_VARIANTEMITTER_H
+#define FREEBAYES_VARIANTEMITTER_H
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "Variant.h"
+#include "VariantWriter.h"
+#include "RegionScheduler.h"
+
+using namespace std;
+
+// writes the records of a single calling thread from a thread of its own, for
+// --emit-queue
+//
+// formatting a record as VCF text, or encoding it as BCF, and compressing it
+// costs in proportion to the samples, as genotyping does, and goes on while
+// the calling thread moves on to the next site.  the records are queued in
+// the order they are made and written in that order.  at most depth records
+// are queued at once, so a writer which falls behind holds the caller back
+// rather than filling memory.
+class VariantEmitter : public VariantOutput {
+
+public:
+
+    VariantEmitter(VariantWriter& w, size_t depth);
+    ~VariantEmitter(void) { close(); }
+
+    using VariantOutput::write;
+    // takes the record and its numbers, which are left empty
+    void write(vcflib::Variant& var, RecordValues* values);
+    // writes the records still queued, then stops the thread
+    void close(void);
+
+private:
+
+    VariantEmitter(const VariantEmitter&);
+    VariantEmitter& operator=(const VariantEmitter&);
+
+    void run(void);
+
+    VariantWriter& writer;
+    size_t maxQueued;
+    deque<pair<vcflib::Variant, RecordValues> > queued;
+    mutex queueMutex;
+    condition_variable queueChanged;
+    bool closing;
+    thread emitter;
+
+};
+
+#endif
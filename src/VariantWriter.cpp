@@ -0,0 +1,562 @@
+#include "VariantWriter.h"
+#include <stdlib.h>
+#include <math.h>
+#include <sstream>
+#include <algorithm>
+#include "htslib/bgzf.h"
+#include "htslib/hfile.h"
+#include "Logging.h"
+
+void EncodedRecords::append(EncodedRecords& other) {
+    text.append(other.text);
+    spans.insert(spans.end(), other.spans.begin(), other.spans.end());
+    records.insert(records.end(), other.records.begin(), other.records.end());
+    string().swap(other.text);
+    vector<EncodedSpan>().swap(other.spans);
+    vector<bcf1_t*>().swap(other.records);
+}
+
+void EncodedRecords::clear(void) {
+    for (vector<bcf1_t*>::iterator r = records.begin(); r != records.end(); ++r) {
+        bcf_destroy(*r);
+    }
+    string().swap(text);
+    vector<EncodedSpan>().swap(spans);
+    vector<bcf1_t*>().swap(records);
+}
+
+VariantWriter::VariantWriter(void)
+    : out(NULL)
+    , hts(NULL)
+    , bcf(false)
+    , compressed(false)
+    , appending(false)
+    , lastRid(-1)
+    , lastStart(0)
+    , header(NULL)
+    , record(NULL)
+{ }
+
+VariantWriter::~VariantWriter(void) {
+    close();
+}
+
+void VariantWriter::open(ostream& o, bool append) {
+    out = &o;
+    appending = append;
+}
+
+bool VariantWriter::opensFile(const string& filename, const string& format) {
+    return format != "vcf"
+        || (filename.size() > 3 && filename.compare(filename.size() - 3, 3, ".gz") == 0);
+}
+
+bool VariantWriter::open(const string& f, const string& format, int threads, bool append) {
+    bcf = format != "vcf";
+    compressed = format != "ubcf";
+    appending = append;
+    filename = f;
+    const char* mode = (format == "ubcf") ? "wbu" : (bcf ? "wb" : "wz");
+    if (appending) {
+        mode = (format == "ubcf") ? "abu" : (bcf ? "ab" : "az");
+    }
+    hts = hts_open(filename.empty() ? "-" : filename.c_str(), mode);
+    if (hts && !bcf) {
+        // htslib takes text it writes for VCF only if told, and only then
+        // indexes it with the tabix meta
+        hts->format.format = vcf;
+    }
+    if (hts && threads > 0 && compressed) {
+        hts_set_threads(hts, threads);
+    }
+    return hts != NULL;
+}
+
+void VariantWriter::writeHeader(const string& headerStr) {
+    if (!hts) {
+        if (!appending) {
+            buffer(headerStr + "\n");
+        }
+        return;
+    }
+    // parsed from the text, as htslib would read it back
+    string text = headerStr + "\n";
+    header = bcf_hdr_init("r");
+    if (!header || bcf_hdr_parse(header, &text[0]) != 0) {
+        ERROR("unable to parse the VCF header for BCF output");
+        exit(1);
+    }
+    if (!appending && bcf_hdr_write(hts, header) != 0) {
+        ERROR("unable to write the " << (bcf ? "BCF" : "VCF") << " header");
+        exit(1);
+    }
+
+    // only files can be indexed, and uncompressed BCF can't be
+    if (appending && compressed) {
+        WARNING(filename << " is appended to, so isn't indexed; index it once the run is done");
+    } else if (!filename.empty() && compressed) {
+        // tabix only reaches 2^29 bases, and only indexes VCF
+        int minShift = bcf ? 14 : 0;
+        for (int i = 0; i < header->n[BCF_DT_CTG]; ++i) {
+            if (header->id[BCF_DT_CTG][i].val->info[0] > (1 << 29)) {
+                minShift = 14;
+            }
+        }
+        // htslib keeps the name, rather than a copy of it
+        indexFilename = filename + (minShift ? ".csi" : ".tbi");
+        if (bcf_idx_init(hts, header, minShift, indexFilename.c_str()) != 0) {
+            ERROR("unable to create the index " << indexFilename);
+            exit(1);
+        }
+        finishedRids.assign(header->n[BCF_DT_CTG], false);
+    }
+    for (int i = 0; i < header->n[BCF_DT_ID]; ++i) {
+        const char* key = header->id[BCF_DT_ID][i].key;
+        if (!key) {
+            continue;
+        }
+        if (bcf_hdr_idinfo_exists(header, BCF_HL_INFO, i)) {
+            infoTypes[key] = bcf_hdr_id2type(header, BCF_HL_INFO, i);
+        }
+        if (bcf_hdr_idinfo_exists(header, BCF_HL_FMT, i)) {
+            formatTypes[key] = bcf_hdr_id2type(header, BCF_HL_FMT, i);
+        }
+    }
+    for (int i = 0; i < bcf_hdr_nsamples(header); ++i) {
+        sampleNames.push_back(header->samples[i]);
+    }
+    record = bcf_init();
+}
+
+void VariantWriter::encode(vcflib::Variant& var, EncodedRecords& records, const RecordValues* values) {
+    if (!bcf) {
+        stringstream line;
+        line << var << endl;
+        if (hts) {
+            EncodedSpan span;
+            locate(var, span);
+            span.length = line.str().size();
+            records.spans.push_back(span);
+        }
+        records.text.append(line.str());
+        return;
+    }
+    bcf1_t* r = bcf_init();
+    encodeRecord(var, values, r);
+    records.records.push_back(r);
+}
+
+void VariantWriter::write(vcflib::Variant& var, const RecordValues* values) {
+    if (!hts || !bcf) {
+        line.str("");
+        line << var << '\n';
+    }
+    if (!hts) {
+        buffer(line.str());
+        return;
+    } else if (!bcf) {
+        EncodedSpan span;
+        locate(var, span);
+        span.length = line.str().size();
+        writeLine(line.str().c_str(), span);
+        return;
+    }
+    bcf_clear(record);
+    encodeRecord(var, values, record);
+    writeRecord(record);
+}
+
+void VariantWriter::write(EncodedRecords& records) {
+    if (!hts) {
+        buffer(records.text);
+    } else if (!bcf) {
+        const char* line = records.text.c_str();
+        for (vector<EncodedSpan>::iterator s = records.spans.begin(); s != records.spans.end(); ++s) {
+            writeLine(line, *s);
+            line += s->length;
+        }
+    } else {
+        for (vector<bcf1_t*>::iterator r = records.records.begin(); r != records.records.end(); ++r) {
+            writeRecord(*r);
+        }
+    }
+    records.clear();
+}
+
+void VariantWriter::buffer(const string& text) {
+    pending.append(text);
+    if (pending.size() >= STREAM_BUFFER_BYTES) {
+        drain();
+    }
+}
+
+void VariantWriter::drain(void) {
+    if (!pending.empty()) {
+        out->write(pending.data(), pending.size());
+        pending.clear();
+    }
+}
+
+void VariantWriter::flush(void) {
+    if (!hts) {
+        drain();
+        out->flush();
+        return;
+    }
+    BGZF* fp = hts->fp.bgzf;
+    if (bgzf_flush(fp) != 0 || hflush(fp->fp) != 0) {
+        ERROR("unable to flush the output " << filename);
+        exit(1);
+    }
+}
+
+void VariantWriter::checkOrder(int rid, long int start) {
+    if (!hts->idx) {
+        return;
+    }
+    if (rid == lastRid ? start < lastStart : finishedRids[rid]) {
+        WARNING("records are not in reference order, so " << filename << " can't be indexed as it is written");
+        hts_idx_destroy(hts->idx);
+        hts->idx = NULL;
+        return;
+    }
+    if (rid != lastRid && lastRid >= 0) {
+        finishedRids[lastRid] = true;
+    }
+    lastRid = rid;
+    lastStart = start;
+}
+
+// gVCF records reach to their END
+void VariantWriter::locate(vcflib::Variant& var, EncodedSpan& span) {
+    span.rid = bcf_hdr_name2id(header, var.sequenceName.c_str());
+    if (span.rid < 0) {
+        ERROR("sequence " << var.sequenceName << " is not in the header of the output");
+        exit(1);
+    }
+    span.start = var.position - 1;
+    span.end = span.start + var.ref.size();
+    map<string, vector<string> >::iterator end = var.info.find("END");
+    if (end != var.info.end() && !end->second.empty()) {
+        span.end = max(span.end, atol(end->second.front().c_str()));
+    }
+}
+
+// indexed as vcf_write would, with the names of the sequences for tabix, and
+// through bgzf_idx_push, which has the offsets of blocks compressed by threads
+void VariantWriter::writeLine(const char* line, const EncodedSpan& span) {
+    BGZF* fp = hts->fp.bgzf;
+    checkOrder(span.rid, span.start);
+    int tid = span.rid;
+    if (hts->idx) {
+        tid = hts_idx_tbi_name(hts->idx, span.rid, bcf_hdr_id2name(header, span.rid));
+    }
+    if (tid < 0
+        || bgzf_write(fp, line, span.length) < 0
+        || (hts->idx && bgzf_idx_push(fp, hts->idx, tid, span.start, span.end, bgzf_tell(fp), 1) < 0)) {
+        ERROR("unable to write the VCF output");
+        exit(1);
+    }
+}
+
+void VariantWriter::writeRecord(bcf1_t* r) {
+    checkOrder(r->rid, r->pos);
+    if (bcf_write(hts, header, r) < 0) {
+        ERROR("unable to write BCF record");
+        exit(1);
+    }
+}
+
+void VariantWriter::close(void) {
+    if (hts) {
+        if (hts->idx && bcf_idx_save(hts) != 0) {
+            ERROR("unable to write the index of " << filename);
+            exit(1);
+        }
+        if (hts_close(hts) != 0) {
+            ERROR("unable to close the output");
+            exit(1);
+        }
+        hts = NULL;
+    } else if (out) {
+        drain();
+        out->flush();
+    }
+    out = NULL;
+    if (record) {
+        bcf_destroy(record);
+        record = NULL;
+    }
+    if (header) {
+        bcf_hdr_destroy(header);
+        header = NULL;
+    }
+}
+
+// "." is the missing value of every type
+static inline bool isMissing(const string& value) {
+    return value.empty() || value == ".";
+}
+
+static int32_t parseInt(const string& value) {
+    return isMissing(value) ? bcf_int32_missing : (int32_t) strtol(value.c_str(), NULL, 10);
+}
+
+static float parseFloat(const string& value) {
+    float f;
+    if (isMissing(value)) {
+        bcf_float_set_missing(f);
+    } else {
+        f = strtod(value.c_str(), NULL);
+    }
+    return f;
+}
+
+// NaN is the missing value of the numbers
+static int32_t toInt(double value) {
+    return isnan(value) ? bcf_int32_missing : (int32_t) llround(value);
+}
+
+static float toFloat(double value) {
+    float f;
+    if (isnan(value)) {
+        bcf_float_set_missing(f);
+    } else {
+        f = value;
+    }
+    return f;
+}
+
+// the numbers of the field, if there are as many as it has values in the text
+static const vector<double>* numbersOf(const map<string, vector<double> >& numbers,
+                                       const string& key, size_t count) {
+    map<string, vector<double> >::const_iterator n = numbers.find(key);
+    return n != numbers.end() && n->second.size() == count ? &n->second : NULL;
+}
+
+static string joinValues(const vector<string>& values) {
+    string joined;
+    for (vector<string>::const_iterator v = values.begin(); v != values.end(); ++v) {
+        if (v != values.begin()) {
+            joined += ",";
+        }
+        joined += *v;
+    }
+    return joined;
+}
+
+// appends the alleles of e.g. 0/1, 1|0 or ./. as BCF encodes them
+static void parseGenotype(const string& gt, vector<int32_t>& alleles) {
+    bool phased = false; // by the separator before the allele
+    size_t start = 0;
+    while (start <= gt.size()) {
+        size_t end = gt.find_first_of("/|", start);
+        if (end == string::npos) {
+            end = gt.size();
+        }
+        string allele = gt.substr(start, end - start);
+        if (isMissing(allele)) {
+            alleles.push_back(bcf_gt_missing | (phased ? 1 : 0));
+        } else {
+            int index = atoi(allele.c_str());
+            alleles.push_back(phased ? bcf_gt_phased(index) : bcf_gt_unphased(index));
+        }
+        if (end < gt.size()) {
+            phased = gt[end] == '|';
+        }
+        start = end + 1;
+    }
+}
+
+void VariantWriter::encodeRecord(vcflib::Variant& var, const RecordValues* values, bcf1_t* r) {
+    r->rid = bcf_hdr_name2id(header, var.sequenceName.c_str());
+    if (r->rid < 0) {
+        ERROR("sequence " << var.sequenceName << " is not in the header of the BCF output");
+        exit(1);
+    }
+    r->pos = var.position - 1;
+    r->qual = var.quality;
+    if (!isMissing(var.id)) {
+        bcf_update_id(header, r, var.id.c_str());
+    }
+
+    string alleles = var.ref;
+    for (vector<string>::iterator a = var.alt.begin(); a != var.alt.end(); ++a) {
+        alleles += "," + *a;
+    }
+    bcf_update_alleles_str(header, r, alleles.c_str());
+
+    if (!isMissing(var.filter)) {
+        vector<int> filters;
+        stringstream filterss(var.filter);
+        string filter;
+        while (getline(filterss, filter, ';')) {
+            int id = bcf_hdr_id2int(header, BCF_DT_ID, filter.c_str());
+            if (id >= 0) {
+                filters.push_back(id);
+            }
+        }
+        if (!filters.empty()) {
+            bcf_update_filter(header, r, &filters[0], filters.size());
+        }
+    }
+
+    encodeInfo(var, values, r);
+    encodeFormat(var, values, r);
+}
+
+// numbers are encoded from the values where they have them, and otherwise
+// from the text.  fields which aren't in the header can't be encoded, and
+// are left out
+void VariantWriter::encodeInfo(vcflib::Variant& var, const RecordValues* recordValues, bcf1_t* r) {
+    vector<int32_t> ints;
+    vector<float> floats;
+    for (map<string, vector<string> >::iterator i = var.info.begin(); i != var.info.end(); ++i) {
+        map<string, int>::iterator t = infoTypes.find(i->first);
+        const vector<string>& values = i->second;
+        if (t == infoTypes.end() || values.empty()) {
+            continue;
+        }
+        const char* key = i->first.c_str();
+        const vector<double>* numbers = recordValues ? numbersOf(recordValues->info, i->first, values.size()) : NULL;
+        switch (t->second) {
+        case BCF_HT_INT:
+            ints.clear();
+            for (size_t v = 0; v < values.size(); ++v) {
+                ints.push_back(numbers ? toInt((*numbers)[v]) : parseInt(values[v]));
+            }
+            bcf_update_info_int32(header, r, key, &ints[0], ints.size());
+            break;
+        case BCF_HT_REAL:
+            floats.clear();
+            for (size_t v = 0; v < values.size(); ++v) {
+                floats.push_back(numbers ? toFloat((*numbers)[v]) : parseFloat(values[v]));
+            }
+            bcf_update_info_float(header, r, key, &floats[0], floats.size());
+            break;
+        case BCF_HT_FLAG:
+            bcf_update_info_flag(header, r, key, NULL, 1);
+            break;
+        default:
+            bcf_update_info_string(header, r, key, joinValues(values).c_str());
+            break;
+        }
+    }
+    for (map<string, bool>::iterator f = var.infoFlags.begin(); f != var.infoFlags.end(); ++f) {
+        map<string, int>::iterator t = infoTypes.find(f->first);
+        if (f->second && t != infoTypes.end() && t->second == BCF_HT_FLAG) {
+            bcf_update_info_flag(header, r, f->first.c_str(), NULL, 1);
+        }
+    }
+}
+
+void VariantWriter::encodeFormat(vcflib::Variant& var, const RecordValues* recordValues, bcf1_t* r) {
+    size_t sampleCount = sampleNames.size();
+    if (sampleCount == 0) {
+        return;
+    }
+    // the numbers of each sample, or NULL where it has none
+    vector<const map<string, vector<double> >*> sampleRecordValues(sampleCount, NULL);
+    if (recordValues) {
+        for (size_t i = 0; i < sampleCount; ++i) {
+            map<string, map<string, vector<double> > >::const_iterator s = recordValues->samples.find(sampleNames[i]);
+            if (s != recordValues->samples.end()) {
+                sampleRecordValues[i] = &s->second;
+            }
+        }
+    }
+    // the values of the current field for each sample, or NULL where the
+    // sample doesn't have it, and likewise its numbers
+    vector<const vector<string>*> sampleValues(sampleCount);
+    vector<const vector<double>*> sampleNumbers(sampleCount);
+    vector<int32_t> ints;
+    vector<float> floats;
+    vector<string> strings(sampleCount);
+    vector<const char*> stringPtrs(sampleCount);
+
+    for (vector<string>::iterator f = var.format.begin(); f != var.format.end(); ++f) {
+        map<string, int>::iterator t = formatTypes.find(*f);
+        if (t == formatTypes.end()) {
+            continue;
+        }
+        size_t width = 1; // values per sample
+        for (size_t i = 0; i < sampleCount; ++i) {
+            sampleValues[i] = NULL;
+            sampleNumbers[i] = NULL;
+            map<string, map<string, vector<string> > >::iterator s = var.samples.find(sampleNames[i]);
+            if (s != var.samples.end()) {
+                map<string, vector<string> >::iterator v = s->second.find(*f);
+                if (v != s->second.end() && !v->second.empty()) {
+                    sampleValues[i] = &v->second;
+                    width = max(width, v->second.size());
+                    if (sampleRecordValues[i]) {
+                        sampleNumbers[i] = numbersOf(*sampleRecordValues[i], *f, v->second.size());
+                    }
+                }
+            }
+        }
+        const char* key = f->c_str();
+
+        if (*f == "GT") {
+            vector<int32_t> alleles;
+            vector<vector<int32_t> > genotypes(sampleCount);
+            width = 1;
+            for (size_t i = 0; i < sampleCount; ++i) {
+                if (sampleValues[i]) {
+                    parseGenotype(sampleValues[i]->front(), genotypes[i]);
+                } else {
+                    genotypes[i].push_back(bcf_gt_missing);
+                }
+                width = max(width, genotypes[i].size());
+            }
+            ints.assign(sampleCount * width, bcf_int32_vector_end);
+            for (size_t i = 0; i < sampleCount; ++i) {
+                copy(genotypes[i].begin(), genotypes[i].end(), ints.begin() + i * width);
+            }
+            bcf_update_genotypes(header, r, &ints[0], ints.size());
+            continue;
+        }
+
+        switch (t->second) {
+        case BCF_HT_INT:
+            ints.assign(sampleCount * width, bcf_int32_vector_end);
+            for (size_t i = 0; i < sampleCount; ++i) {
+                int32_t* p = &ints[i * width];
+                if (!sampleValues[i]) {
+                    *p = bcf_int32_missing;
+                    continue;
+                }
+                for (size_t v = 0; v < sampleValues[i]->size(); ++v) {
+                    *p++ = sampleNumbers[i] ? toInt((*sampleNumbers[i])[v]) : parseInt((*sampleValues[i])[v]);
+                }
+            }
+            bcf_update_format_int32(header, r, key, &ints[0], ints.size());
+            break;
+        case BCF_HT_REAL:
+            floats.resize(sampleCount * width);
+            for (size_t i = 0; i < sampleCount; ++i) {
+                float* p = &floats[i * width];
+                size_t n = 0;
+                if (!sampleValues[i]) {
+                    bcf_float_set_missing(p[n++]);
+                } else {
+                    for (size_t v = 0; v < sampleValues[i]->size(); ++v) {
+                        p[n++] = sampleNumbers[i] ? toFloat((*sampleNumbers[i])[v]) : parseFloat((*sampleValues[i])[v]);
+                    }
+                }
+                for ( ; n < width; ++n) {
+                    bcf_float_set_vector_end(p[n]);
+                }
+            }
+            bcf_update_format_float(header, r, key, &floats[0], floats.size());
+            break;
+        default:
+            for (size_t i = 0; i < sampleCount; ++i) {
+                strings[i] = sampleValues[i] ? joinValues(*sampleValues[i]) : ".";
+                stringPtrs[i] = strings[i].c_str();
+            }
+            bcf_update_format_string(header, r, key, &stringPtrs[0], sampleCount);
+            break;
+        }
+    }
+}
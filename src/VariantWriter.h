@@ -0,0 +1,144 @@
+#ifndef FREEBAYES_VARIANTWRITER_H
+#define FREEBAYES_VARIANTWRITER_H
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include "Variant.h"
+#include "RecordValues.h"
+#include "htslib/hts.h"
+#include "htslib/vcf.h"
+
+using namespace std;
+
+// how much VCF text a writer to a stream gathers before writing it out
+#define STREAM_BUFFER_BYTES (1 << 20)
+
+// where a line of VCF text lies on the reference, for indexing it
+struct EncodedSpan {
+    int rid;
+    long int start; // 0-based, half-open
+    long int end;
+    size_t length;  // of the line
+};
+
+// records encoded for the output but not yet written, as lines of VCF or
+// as BCF records, depending on the writer which encoded them
+class EncodedRecords {
+
+public:
+
+    EncodedRecords(void) { }
+    ~EncodedRecords(void) { clear(); }
+
+    bool empty(void) const { return text.empty() && records.empty(); }
+    // moves the other's records onto the end of these
+    void append(EncodedRecords& other);
+    // drops the records, releasing their memory
+    void clear(void);
+
+    string text;
+    vector<EncodedSpan> spans; // of the lines of text, if they are to be indexed
+    vector<bcf1_t*> records;
+
+private:
+
+    EncodedRecords(const EncodedRecords&);
+    EncodedRecords& operator=(const EncodedRecords&);
+
+};
+
+// writes the header and records of the run as VCF text or as BCF
+//
+// BCF, and VCF written to a file ending in .gz, go through htslib, which
+// compresses BGZF blocks on a pool of threads.  files written this way are
+// indexed as they are written, with CSI for BCF and for VCF of sequences
+// too long for tabix, and otherwise with a tabix index.  if the records
+// turn out not to be sorted, as when targets are given out of reference
+// order, the index is abandoned with a warning.
+//
+// BCF records are encoded straight into an htslib bcf1_t, with the types of
+// the INFO and FORMAT fields taken from the header once.  the numbers come
+// from the RecordValues of the record where it has them, and only the other
+// fields are taken from the text of the vcflib::Variant.  once the header is written, encode only reads the writer, so
+// workers may encode their records in parallel and have them written in
+// order.
+//
+// VCF text written to a stream is gathered into a buffer of the writer and
+// written out in large pieces, rather than a line, and a flush, at a time.
+// what is buffered goes out on flush() and close().
+class VariantWriter {
+
+public:
+
+    VariantWriter(void);
+    ~VariantWriter(void);
+
+    // writes VCF text to the stream; a writer which appends to output resumed
+    // by --resume doesn't write the header again
+    void open(ostream& o, bool append = false);
+    // true where the output is written through htslib, rather than to a stream
+    static bool opensFile(const string& filename, const string& format);
+    // opens the file, or stdout if it is "", to write the format, which is
+    // "vcf" (BGZF-compressed), "bcf" or "ubcf" (uncompressed BCF), using the
+    // given number of threads for compression.  a file appended to isn't
+    // indexed, as the index would only cover what is appended.
+    bool open(const string& filename, const string& format, int threads, bool append = false);
+    bool isBCF(void) const { return bcf; }
+
+    // the header is given as VCF text, without its final newline
+    void writeHeader(const string& headerStr);
+
+    // appends the record to the encoded records; the values, if given, are
+    // the numbers of its fields
+    void encode(vcflib::Variant& var, EncodedRecords& records, const RecordValues* values = NULL);
+    // writes the record
+    void write(vcflib::Variant& var, const RecordValues* values = NULL);
+    // writes the encoded records, and clears them
+    void write(EncodedRecords& records);
+    // writes out what the output holds, ending the BGZF block if it has one
+    void flush(void);
+
+    void close(void);
+
+private:
+
+    VariantWriter(const VariantWriter&);
+    VariantWriter& operator=(const VariantWriter&);
+
+    void encodeRecord(vcflib::Variant& var, const RecordValues* values, bcf1_t* record);
+    void encodeInfo(vcflib::Variant& var, const RecordValues* values, bcf1_t* record);
+    void encodeFormat(vcflib::Variant& var, const RecordValues* values, bcf1_t* record);
+    void writeRecord(bcf1_t* record);
+    void writeLine(const char* line, const EncodedSpan& span);
+    void locate(vcflib::Variant& var, EncodedSpan& span);
+    // stops indexing if the record is out of order
+    void checkOrder(int rid, long int start);
+    // adds the text to the buffer of the stream, writing it out once full
+    void buffer(const string& text);
+    void drain(void);
+
+    ostream* out;
+    htsFile* hts;
+    bool bcf;
+    bool compressed;
+    bool appending;
+    string filename;
+    string indexFilename;
+    int lastRid;              // of the last record indexed
+    long int lastStart;
+    vector<bool> finishedRids;
+    bcf_hdr_t* header;
+    bcf1_t* record;           // reused by write(var)
+    stringstream line;        // likewise
+    string pending;           // text for the stream, not yet written to it
+
+    map<string, int> infoTypes;   // BCF_HT_* of the fields in the header
+    map<string, int> formatTypes;
+    vector<string> sampleNames;   // in the order of the header
+
+};
+
+#endif
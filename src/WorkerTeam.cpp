@@ -0,0 +1,64 @@
+#include "WorkerTeam.h"
+
+WorkerTeam::WorkerTeam(int size)
+    : members(max(size, 1))
+    , task(NULL)
+    , generation(0)
+    , running(0)
+    , stopping(false)
+{
+    for (int i = 1; i < members; ++i) {
+        threads.push_back(thread(&WorkerTeam::work, this, i));
+    }
+}
+
+WorkerTeam::~WorkerTeam(void) {
+    {
+        lock_guard<mutex> lock(teamMutex);
+        stopping = true;
+    }
+    started.notify_all();
+    for (vector<thread>::iterator t = threads.begin(); t != threads.end(); ++t) {
+        t->join();
+    }
+}
+
+void WorkerTeam::run(const function<void(int)>& t) {
+    if (members == 1) {
+        t(0);
+        return;
+    }
+    {
+        lock_guard<mutex> lock(teamMutex);
+        task = &t;
+        running = members - 1;
+        ++generation;
+    }
+    started.notify_all();
+    t(0);
+    unique_lock<mutex> lock(teamMutex);
+    finished.wait(lock, [&]() { return running == 0; });
+    task = NULL;
+}
+
+void WorkerTeam::work(int member) {
+    long int seen = 0;
+    while (true) {
+        const function<void(int)>* t;
+        {
+            unique_lock<mutex> lock(teamMutex);
+            started.wait(lock, [&]() { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            t = task;
+        }
+        (*t)(member);
+        {
+            lock_guard<mutex> lock(teamMutex);
+            --running;
+        }
+        finished.notify_one();
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef FREEBAYES_WORKERTEAM_H
+#define FREEBAYES_WORKERTEAM_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+using namespace std;
+
+// a fixed team of threads which work together on one task at a time
+//
+// the thread which owns the team takes part as member 0, so a team of size
+// N starts N-1 threads.  the threads persist between tasks, which keeps
+// their thread_local caches (e.g. of Ewens and binomial priors) warm from
+// one site to the next.  a team of size 1 runs tasks on the caller alone.
+class WorkerTeam {
+
+public:
+
+    WorkerTeam(int size);
+    ~WorkerTeam(void);
+
+    int size(void) const { return members; }
+    // runs task(member) for each member of the team, returning once every
+    // member has finished
+    void run(const function<void(int)>& task);
+
+private:
+
+    WorkerTeam(const WorkerTeam&);
+    WorkerTeam& operator=(const WorkerTeam&);
+
+    void work(int member);
+
+    int members;
+    vector<thread> threads;
+
+    const function<void(int)>* task;
+    long int generation;  // incremented as each task is handed out
+    int running;          // members still working on the current task
+    bool stopping;
+
+    mutex teamMutex;
+    condition_variable started;
+    condition_variable finished;
+
+};
+
+#endif
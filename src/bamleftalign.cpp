@@ -13,6 +13,7 @@
 #include "FBFasta.h"
 
 #include "LeftAlign.h"
+#include "WorkerTeam.h"
 
 #ifdef VERBOSE_DEBUG
 #define DEBUG(msg) \
@@ -23,6 +24,9 @@
 
 using namespace std;
 
+// the number of alignments read, realigned and written at a time
+#define LEFT_ALIGN_BATCH_SIZE 10000
+
 void printUsage(char** argv) {
     cerr << "usage: [BAM data stream] | " << argv[0] << " [options]" << endl
          << endl
@@ -34,21 +38,35 @@ void printUsage(char** argv) {
          << "      -d --debug             Print debugging information about realignment process" << endl
          << "      -s --suppress-output   Don't write BAM output stream (for debugging)" << endl
          << "      -m --max-iterations N  Iterate the left-realignment no more than this many times" << endl
-         << "      -c --compressed        Write compressed BAM on stdout, default is uncompressed" << endl;
+         << "      -c --compressed        Write compressed BAM on stdout, default is uncompressed" << endl
+         << "      -t --threads N         Realign with N threads, which also decompress the input" << endl
+         << "                             and compress the output.  default: 1" << endl;
+}
+
+// reads up to LEFT_ALIGN_BATCH_SIZE alignments into the batch, false if there are none
+bool readBatch(BAMSINGLEREADER& reader, vector<BAMALIGN>& batch) {
+    batch.resize(LEFT_ALIGN_BATCH_SIZE);
+    size_t n = 0;
+    while (n < batch.size() && GETNEXT(reader, batch[n])) {
+        ++n;
+    }
+    batch.resize(n);
+    return n > 0;
 }
 
 int main(int argc, char** argv) {
 
     int c;
 
-    FB::FastaReference reference;
+    string referenceFile;
     bool has_ref = false;
     bool suppress_output = false;
     bool debug = false;
     bool isuncompressed = true;
 
     int maxiterations = 50;
-    
+    int threads = 1;
+
     if (argc < 2) {
         printUsage(argv);
         exit(1);
@@ -63,12 +81,13 @@ int main(int argc, char** argv) {
             {"max-iterations", required_argument, 0, 'm'},
             {"suppress-output", no_argument, 0, 's'},
             {"compressed", no_argument, 0, 'c'},
+            {"threads", required_argument, 0, 't'},
             {0, 0, 0, 0}
         };
 
         int option_index = 0;
 
-        c = getopt_long (argc, argv, "hdcsf:m:",
+        c = getopt_long (argc, argv, "hdcsf:m:t:",
                          long_options, &option_index);
 
         /* Detect the end of the options. */
@@ -78,7 +97,7 @@ int main(int argc, char** argv) {
         switch (c) {
 
             case 'f':
-                reference.open(optarg); // will exit on open failure
+                referenceFile = optarg;
                 has_ref = true;
                 break;
      
@@ -98,6 +117,14 @@ int main(int argc, char** argv) {
                 isuncompressed = false;
                 break;
 
+            case 't':
+                threads = atoi(optarg);
+                if (threads < 1) {
+                    cerr << "--threads must be at least 1" << endl;
+                    exit(1);
+                }
+                break;
+
             case 'h':
                 printUsage(argv);
                 exit(0);
@@ -119,6 +146,17 @@ int main(int argc, char** argv) {
         exit(1);
     }
 
+    // the debugging output of concurrent realignments would be interleaved
+    if (debug) {
+        threads = 1;
+    }
+
+    // each thread reads the reference through its own handle
+    vector<FB::FastaReference> references(threads);
+    for (vector<FB::FastaReference>::iterator r = references.begin(); r != references.end(); ++r) {
+        r->open(referenceFile); // will exit on open failure
+    }
+
 
     BAMSINGLEREADER reader;
     if (!reader.Open(STDIN)) {
@@ -153,53 +191,95 @@ int main(int argc, char** argv) {
         exit(1);
     }
     writer.WriteHeader();
+
+    // BGZF blocks are decompressed and compressed by the pool, alongside
+    // the realignment
+    SeqLib::ThreadPool pool;
+    if (threads > 1) {
+        pool = SeqLib::ThreadPool(threads);
+        reader.SetThreadPool(pool);
+        if (!suppress_output) {
+            writer.SetThreadPool(pool);
+        }
+    }
 #endif
 
     // store the names of all the reference sequences in the BAM file
-    map<int, string> referenceIDToName;
+    vector<string> referenceIDToName;
     REFVEC referenceSequences = reader.GETREFDATA;
-    int i = 0;
     for (REFVEC::iterator r = referenceSequences.begin(); r != referenceSequences.end(); ++r) {
-        referenceIDToName[i] = r->REFNAME;
-        ++i;
+        referenceIDToName.push_back(r->REFNAME);
     }
 
-    BAMALIGN alignment;
-
-    while (GETNEXT(reader, alignment)) {
-      
-            DEBUG("---------------------------   read    --------------------------" << endl);
-            DEBUG("| " << referenceIDToName[alignment.REFID] << ":" << alignment.POSITION << endl);
-            DEBUG("| " << alignment.QNAME << ":" << alignment.ENDPOSITION << endl);
-            DEBUG("| " << alignment.QNAME << ":" << (alignment.ISMAPPED ? " mapped" : " unmapped") << endl);
-            DEBUG("| " << alignment.QNAME << ":" << " cigar data size: " << alignment.GETCIGAR.size() << endl);
-            DEBUG("--------------------------- realigned --------------------------" << endl);
-
-            // skip unmapped alignments, as they cannot be left-realigned without CIGAR data
-            if (alignment.ISMAPPED) {
-
-                int endpos = alignment.ENDPOSITION;
-                int length = endpos - alignment.POSITION + 1;
-                if (alignment.POSITION >= 0 && length > 0) {
-                    if (!stablyLeftAlign(alignment,
-                                reference.getSubSequence(
-                                    referenceIDToName[alignment.REFID],
-                                    alignment.POSITION,
-                                    length),
-                                maxiterations, debug)) {
-                        cerr << "unstable realignment of " << alignment.QNAME
-                             << " at " << referenceIDToName[alignment.REFID] << ":" << alignment.POSITION << endl
-                             << alignment.QUERYBASES << endl;
+    // while the team realigns one batch, its first member reads the next.
+    // batches are written in the order they were read.
+    WorkerTeam team(threads);
+    int realigners = max(threads - 1, 1);
+    vector<BAMALIGN> batch;
+    vector<BAMALIGN> nextBatch;
+    vector<char> unstable;
+    bool more = readBatch(reader, batch);
+
+    while (more) {
+
+        unstable.assign(batch.size(), false);
+
+        team.run([&](int member) {
+            if (threads > 1 && member == 0) {
+                more = readBatch(reader, nextBatch);
+                return;
+            }
+            FB::FastaReference& reference = references[member];
+            for (size_t i = max(member - 1, 0); i < batch.size(); i += realigners) {
+                BAMALIGN& alignment = batch[i];
+
+                DEBUG("---------------------------   read    --------------------------" << endl);
+                DEBUG("| " << (alignment.REFID >= 0 ? referenceIDToName[alignment.REFID] : "*") << ":" << alignment.POSITION << endl);
+                DEBUG("| " << alignment.QNAME << ":" << alignment.ENDPOSITION << endl);
+                DEBUG("| " << alignment.QNAME << ":" << (alignment.ISMAPPED ? " mapped" : " unmapped") << endl);
+                DEBUG("| " << alignment.QNAME << ":" << " cigar data size: " << alignment.GETCIGAR.size() << endl);
+                DEBUG("--------------------------- realigned --------------------------" << endl);
+
+                // skip unmapped alignments, as they cannot be left-realigned without CIGAR data
+                // those without indels pass through as they are
+                if (alignment.ISMAPPED && hasIndels(alignment)) {
+
+                    int endpos = alignment.ENDPOSITION;
+                    int length = endpos - alignment.POSITION + 1;
+                    if (alignment.POSITION >= 0 && length > 0) {
+                        if (!stablyLeftAlign(alignment,
+                                    reference.getSubSequence(
+                                        referenceIDToName[alignment.REFID],
+                                        alignment.POSITION,
+                                        length),
+                                    maxiterations, debug)) {
+                            unstable[i] = true;
+                        }
                     }
+
                 }
 
+                DEBUG("----------------------------------------------------------------" << endl);
+                DEBUG(endl);
             }
+        });
+
+        if (threads == 1) {
+            more = readBatch(reader, nextBatch);
+        }
 
-            DEBUG("----------------------------------------------------------------" << endl);
-            DEBUG(endl);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            BAMALIGN& alignment = batch[i];
+            if (unstable[i]) {
+                cerr << "unstable realignment of " << alignment.QNAME
+                     << " at " << referenceIDToName[alignment.REFID] << ":" << alignment.POSITION << endl
+                     << alignment.QUERYBASES << endl;
+            }
+            if (!suppress_output)
+                WRITEALIGNMENT(writer, alignment);
+        }
 
-        if (!suppress_output)
-	  WRITEALIGNMENT(writer, alignment);
+        batch.swap(nextBatch);
 
     }
 
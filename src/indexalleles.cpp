@@ -0,0 +1,131 @@
+#include <iostream>
+#include <getopt.h>
+#include <stdlib.h>
+#include <map>
+#include <set>
+#include <vector>
+#include <list> // XXX workaround for a missing include in vcflib's join.h
+
+#include "Variant.h"
+#include "InputAlleleIndex.h"
+
+using namespace std;
+
+void printUsage(char** argv) {
+    cerr << "usage: " << argv[0] << " [options] <input.vcf[.gz]> <output index>" << endl
+         << endl
+         << "Decomposes the alternates of every record of the sorted VCF into allelic" << endl
+         << "primitives and writes them to a binary, block-indexed file which freebayes" << endl
+         << "reads in place of the VCF with --haplotype-basis-alleles or --variant-input." << endl
+         << "The alignment of each REF against its ALTs is then done once, here, rather" << endl
+         << "than in every run which uses the VCF." << endl
+         << endl
+         << "arguments:" << endl
+         << "      -h --help              Print this message" << endl;
+}
+
+int main(int argc, char** argv) {
+
+    int c;
+
+    while (true) {
+        static struct option long_options[] =
+        {
+            {"help", no_argument, 0, 'h'},
+            {0, 0, 0, 0}
+        };
+
+        int option_index = 0;
+
+        c = getopt_long (argc, argv, "h",
+                         long_options, &option_index);
+
+        /* Detect the end of the options. */
+        if (c == -1)
+            break;
+
+        switch (c) {
+
+            case 'h':
+                printUsage(argv);
+                exit(0);
+                break;
+
+            case '?':
+                printUsage(argv);
+                exit(1);
+                break;
+
+            default:
+                abort();
+                break;
+        }
+    }
+
+    if (argc - optind != 2) {
+        printUsage(argv);
+        exit(1);
+    }
+
+    string inputFile = argv[optind];
+    string outputFile = argv[optind + 1];
+
+    vcflib::VariantCallFile vcf;
+    vcf.open(inputFile);
+    if (!vcf.is_open()) {
+        cerr << "could not open VCF " << inputFile << endl;
+        exit(1);
+    }
+
+    InputAlleleIndexWriter index;
+    if (!index.open(outputFile)) {
+        cerr << "could not open " << outputFile << " for writing" << endl;
+        exit(1);
+    }
+
+    set<string> finishedSequences;
+    string sequence;
+    long int position = 0;
+    long int records = 0;
+    long int primitives = 0;
+
+    vcflib::Variant var(vcf);
+    while (vcf.getNextVariant(var)) {
+        if (var.sequenceName != sequence) {
+            if (!sequence.empty()) {
+                finishedSequences.insert(sequence);
+            }
+            if (finishedSequences.count(var.sequenceName)) {
+                cerr << inputFile << " is not sorted: " << var.sequenceName
+                     << " appears again after " << sequence << endl;
+                exit(1);
+            }
+            sequence = var.sequenceName;
+        } else if (var.position < position) {
+            cerr << inputFile << " is not sorted: " << sequence << ":" << var.position
+                 << " follows " << sequence << ":" << position << endl;
+            exit(1);
+        }
+        position = var.position;
+        ++records;
+
+        // in the order of the alternates, as freebayes takes them from the VCF
+        map<string, vector<vcflib::VariantAllele> > variants = var.parsedAlternates();
+        for (vector<string>::iterator a = var.alt.begin(); a != var.alt.end(); ++a) {
+            vector<vcflib::VariantAllele>& altAllele = variants[*a];
+            for (vector<vcflib::VariantAllele>::iterator v = altAllele.begin(); v != altAllele.end(); ++v) {
+                if (v->ref != v->alt) {
+                    index.add(sequence, position, InputPrimitive(v->position, v->ref, v->alt));
+                    ++primitives;
+                }
+            }
+        }
+    }
+
+    index.close();
+
+    cerr << "indexed " << primitives << " primitives from " << records << " records" << endl;
+
+    return 0;
+
+}
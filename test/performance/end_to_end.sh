@@ -0,0 +1,49 @@
+#! /bin/bash
+#
+# end-to-end benchmarks: runs freebayes over the test/tiny data, writing one
+# JSON object per run to stdout with the sites per second and the peak RSS,
+# so that the results of each commit can be kept and compared.  run from the
+# test directory, through `meson test --benchmark`, or directly:
+#
+#     bash performance/end_to_end.sh path/to/freebayes
+#
+# the peak RSS needs GNU time as /usr/bin/time, and is null without it.
+
+freebayes=${1:-freebayes}
+version=$($freebayes --version | sed -n 's/^version: *//p')
+scratch=$(mktemp -d)
+trap 'rm -rf "$scratch"' EXIT
+
+runs=(
+    "NA12878.chr22.tiny|-f tiny/q.fa tiny/NA12878.chr22.tiny.bam"
+    "NA12878.chr22.tiny.threads4|-f tiny/q.fa --threads 4 tiny/NA12878.chr22.tiny.bam"
+    "NA12878.chr22.tiny.cram|-f tiny/q.fa tiny/NA12878.chr22.tiny.cram"
+    "NA12878.chr22.tiny.hla|-f tiny/hla.fa tiny/NA12878.chr22.tiny.hla.bam"
+)
+
+failed=0
+for run in "${runs[@]}"; do
+    name=${run%%|*}
+    args=${run#*|}
+    if [ -x /usr/bin/time ] && /usr/bin/time -f %M true 2>/dev/null; then
+        /usr/bin/time -f %M -o "$scratch/rss" $freebayes $args --profile-report "$scratch/profile.json" >/dev/null
+    else
+        $freebayes $args --profile-report "$scratch/profile.json" >/dev/null
+    fi
+    if [ $? -ne 0 ]; then
+        echo "benchmark $name failed" >&2
+        failed=1
+        continue
+    fi
+    rss=$( [ -s "$scratch/rss" ] && tail -1 "$scratch/rss" || echo null )
+    wall=$(sed -n 's/^ *"wall_seconds": \([^,]*\),$/\1/p' "$scratch/profile.json")
+    total=$(sed -n 's/.*"total_sites": \([0-9]*\).*/\1/p' "$scratch/profile.json")
+    processed=$(sed -n 's/.*"processed_sites": \([0-9]*\).*/\1/p' "$scratch/profile.json")
+    rate=$(awk -v n="$total" -v t="$wall" 'BEGIN { printf "%.1f", (t > 0 ? n / t : 0) }')
+    echo "{\"benchmark\": \"end_to_end/$name\", \"version\": \"$version\"," \
+         "\"wall_seconds\": $wall, \"total_sites\": $total, \"processed_sites\": $processed," \
+         "\"sites_per_second\": $rate, \"peak_rss_kilobytes\": $rss}"
+    rm -f "$scratch/rss"
+done
+
+exit $failed
@@ -0,0 +1,271 @@
+//
+// microbenchmarks
+//
+// times the hot paths of freebayes on synthetic data, writing one JSON object
+// per benchmark to stdout, so that the results of each commit can be kept and
+// compared.  run through `meson test --benchmark`, or directly:
+//
+//     microbenchmarks REFERENCE BAM
+//
+// the reference and alignments are only used to set up a parser for
+// Results::vcf, and to read from for getSubSequence; the sites are made up.
+//
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <functional>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include "AlleleParser.h"
+#include "Allele.h"
+#include "Sample.h"
+#include "Genotype.h"
+#include "DataLikelihood.h"
+#include "ResultData.h"
+#include "Utility.h"
+#include "Profile.h"
+#include "version_git.h"
+
+using namespace std;
+
+// runs the benchmark in batches until it has taken at least minSeconds, and
+// reports the time per iteration
+void bench(const string& name, const function<void(void)>& body, double minSeconds = 0.5) {
+    body(); // warm up
+    uint64_t iterations = 0;
+    uint64_t batch = 1;
+    uint64_t start = wallClockNanoseconds();
+    uint64_t cpuStart = threadCpuNanoseconds();
+    uint64_t elapsed = 0;
+    while (elapsed < minSeconds * 1e9) {
+        for (uint64_t i = 0; i < batch; ++i) {
+            body();
+        }
+        iterations += batch;
+        batch *= 2;
+        elapsed = wallClockNanoseconds() - start;
+    }
+    uint64_t cpu = threadCpuNanoseconds() - cpuStart;
+    cout << "{\"benchmark\": \"" << name << "\""
+         << ", \"version\": \"" << VERSION_GIT << "\""
+         << ", \"iterations\": " << iterations
+         << ", \"wall_seconds\": " << elapsed / 1e9
+         << ", \"cpu_seconds\": " << cpu / 1e9
+         << ", \"ns_per_iteration\": " << (double) elapsed / iterations
+         << "}" << endl;
+}
+
+// a biallelic SNP site in a number of diploid samples, with the data
+// likelihoods of each sample calculated as calculateSampleDataLikelihoods does
+class SyntheticSite {
+
+public:
+
+    vector<Allele> genotypeAlleles;
+    map<int, vector<Genotype> > genotypesByPloidy;
+    vector<string> sampleNames;
+    Samples samples;
+    map<string, vector<Allele*> > alleleGroups;
+    Results results;
+    SampleDataLikelihoods sampleDataLikelihoods;
+
+    SyntheticSite(int sampleCount, int depth, Parameters& parameters,
+                  Bias& observationBias, Contamination& contamination) {
+
+        genotypeAlleles.push_back(genotypeAllele(ALLELE_REFERENCE, "A", 1, "1M"));
+        genotypeAlleles.push_back(genotypeAllele(ALLELE_SNP, "T", 1, "1X"));
+        vector<int> ploidies(1, 2);
+        genotypesByPloidy = getGenotypesByPloidy(ploidies, genotypeAlleles);
+        vector<Genotype>& genotypes = genotypesByPloidy[2];
+        vector<Genotype*> genotypePointers;
+        for (vector<Genotype>::iterator g = genotypes.begin(); g != genotypes.end(); ++g) {
+            genotypePointers.push_back(&*g);
+        }
+
+        srand(13);
+        for (int s = 0; s < sampleCount; ++s) {
+            string name = "sample" + convert(s);
+            sampleNames.push_back(name);
+            Sample& sample = samples[name];
+            // a quarter of the samples are het, and a tenth hom alt
+            double altFraction = s % 10 == 0 ? 1 : (s % 4 == 0 ? 0.5 : 0);
+            for (int d = 0; d < depth; ++d) {
+                bool alt = rand() / (double) RAND_MAX < altFraction;
+                observations.push_back(genotypeAlleles[alt ? 1 : 0]);
+                Allele& observation = observations.back();
+                observation.quality = 30;
+                observation.lnquality = phred2ln(30);
+                observation.mapQuality = 60;
+                observation.lnmapQuality = phred2ln(60);
+                observation.readGroupID = name;
+                sample[observation.currentBase].push_back(&observation);
+                alleleGroups[observation.currentBase].push_back(&observation);
+            }
+            sample.setCompactObservations();
+        }
+
+        map<string, double> freqs = samples.estimatedAlleleFrequencies();
+        for (vector<string>::iterator n = sampleNames.begin(); n != sampleNames.end(); ++n) {
+            Sample& sample = samples[*n];
+            vector<pair<Genotype*, long double> > probs
+                = probObservedAllelesGivenGenotypes(sample, genotypePointers, observationBias,
+                                                    genotypeAlleles, contamination, freqs, parameters);
+            Result& sampleData = results[*n];
+            sampleData.name = *n;
+            sampleData.observations = &sample;
+            for (vector<pair<Genotype*, long double> >::iterator p = probs.begin(); p != probs.end(); ++p) {
+                sampleData.push_back(SampleDataLikelihood(*n, &sample, p->first, p->second, 0));
+            }
+            sortSampleDataLikelihoods(sampleData);
+            sampleDataLikelihoods.push_back(sampleData);
+        }
+    }
+
+    // searches the genotype space, as callVariants does with default settings
+    void search(Parameters& parameters, list<GenotypeCombo>& combos, int& iterations) {
+        combos.clear();
+        GenotypeCombo nullCombo;
+        SampleDataLikelihoods nullSampleDataLikelihoods;
+        map<string, int> priorACs;
+        convergentGenotypeComboSearch(
+            combos,
+            nullCombo,
+            sampleDataLikelihoods,
+            sampleDataLikelihoods,
+            nullSampleDataLikelihoods,
+            samples,
+            genotypeAlleles,
+            priorACs,
+            0, 0,
+            parameters.TH,
+            parameters.pooledDiscrete,
+            parameters.ewensPriors,
+            parameters.permute,
+            parameters.hwePriors,
+            parameters.obsBinomialPriors,
+            parameters.alleleBalancePriors,
+            parameters.diffusionPriorScalar,
+            parameters.genotypingMaxIterations,
+            iterations,
+            true,
+            NULL,
+            parameters.maxCombos,
+            NULL,
+            true);
+    }
+
+private:
+
+    deque<Allele> observations;
+
+};
+
+int main(int argc, char** argv) {
+
+    if (argc != 3) {
+        cerr << "usage: " << argv[0] << " REFERENCE BAM" << endl;
+        return 1;
+    }
+    string fasta = argv[1];
+    string bam = argv[2];
+
+    // the parser brings the parameters, reference and header Results::vcf needs
+    const char* parserArgv[] = { "freebayes", "-f", fasta.c_str(), bam.c_str() };
+    AlleleParser* parser = new AlleleParser(4, (char**) parserArgv);
+    Parameters& parameters = parser->parameters;
+    Bias observationBias;
+    Contamination contamination(0.5 + parameters.probContamination, parameters.probContamination);
+
+    {
+        vector<long double> probs;
+        for (int i = 0; i < 1000; ++i) {
+            probs.push_back(-(rand() % 10000) / 10.0);
+        }
+        bench("logsumexp_probs/1000", [&]() {
+            volatile long double r = logsumexp_probs(probs);
+            (void) r;
+        });
+    }
+
+    {
+        vector<Allele> alleles;
+        alleles.push_back(genotypeAllele(ALLELE_REFERENCE, "A", 1, "1M"));
+        alleles.push_back(genotypeAllele(ALLELE_SNP, "C", 1, "1X"));
+        alleles.push_back(genotypeAllele(ALLELE_SNP, "G", 1, "1X"));
+        alleles.push_back(genotypeAllele(ALLELE_SNP, "T", 1, "1X"));
+        bench("allPossibleGenotypes/ploidy2/alleles4", [&]() {
+            vector<Genotype> genotypes = allPossibleGenotypes(2, alleles);
+        });
+        bench("allPossibleGenotypes/ploidy4/alleles4", [&]() {
+            vector<Genotype> genotypes = allPossibleGenotypes(4, alleles);
+        });
+    }
+
+    {
+        SyntheticSite site(1, 50, parameters, observationBias, contamination);
+        Sample& sample = site.samples.begin()->second;
+        map<string, double> freqs = site.samples.estimatedAlleleFrequencies();
+        vector<Genotype>& genotypes = site.genotypesByPloidy[2];
+        bench("probObservedAllelesGivenGenotype/depth50", [&]() {
+            for (vector<Genotype>::iterator g = genotypes.begin(); g != genotypes.end(); ++g) {
+                volatile long double r = probObservedAllelesGivenGenotype(sample, *g, observationBias, site.genotypeAlleles,
+                                                                          contamination, freqs, parameters);
+                (void) r;
+            }
+        });
+    }
+
+    int sampleCounts[] = { 10, 100 };
+    for (int i = 0; i < 2; ++i) {
+        int sampleCount = sampleCounts[i];
+        SyntheticSite site(sampleCount, 20, parameters, observationBias, contamination);
+        list<GenotypeCombo> combos;
+        int iterations = 0;
+        bench("convergentGenotypeComboSearch/samples" + convert(sampleCount), [&]() {
+            site.search(parameters, combos, iterations);
+        });
+
+        // a record of the site, from the combos of the last search
+        vector<BedTarget> targets = parser->runTargets();
+        long int position = min((long int) 1000, (long int) targets.front().right / 2);
+        parser->toJointSite(targets.front().seq, position, 1);
+        vector<Allele> alts(1, site.genotypeAlleles[1]);
+        map<string, int> repeats;
+        map<string, vector<Allele*> > partialObservationGroups;
+        map<Allele*, set<Allele*> > partialObservationSupport;
+        GenotypeCombo& bestCombo = combos.front();
+        int coverage = countAlleles(site.samples);
+        bench("Results::vcf/samples" + convert(sampleCount), [&]() {
+            vcflib::Variant var(parser->variantCallFile);
+            site.results.vcf(var, -10, 10, site.samples, site.genotypeAlleles[0].currentBase, alts, repeats,
+                             iterations, site.sampleNames, coverage, bestCombo, site.alleleGroups,
+                             partialObservationGroups, partialObservationSupport, site.genotypesByPloidy,
+                             parser->sequencingTechnologies, parser);
+        });
+    }
+
+    {
+        FB::FastaReference reference;
+        reference.open(fasta);
+        vector<BedTarget> targets = parser->runTargets();
+        string sequence = targets.front().seq;
+        int length = targets.front().right + 1;
+        srand(13);
+        bench("FastaReference::getSubSequence/100bp", [&]() {
+            string s = reference.getSubSequence(sequence, rand() % max(1, length - 100), 100);
+        });
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    cout << "{\"benchmark\": \"peak_rss\", \"version\": \"" << VERSION_GIT << "\""
+         << ", \"kilobytes\": " << usage.ru_maxrss << "}" << endl;
+
+    delete parser;
+    return 0;
+
+}
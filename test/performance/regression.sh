@@ -0,0 +1,88 @@
+#! /bin/bash
+#
+# regression gate: calls variants over the test/tiny data and compares the
+# records with the golden file in test/regression, and the work counters of
+# --profile-report with those recorded beside it.  the counters, the summed
+# genotyping iterations, likelihood evaluations, alleles registered and the
+# peak of registered alignments, are the same on any machine, unlike times,
+# so a change which makes freebayes do more work fails the gate wherever it
+# runs.  run from the test directory, through `meson test --benchmark`, or
+# directly:
+#
+#     bash performance/regression.sh path/to/freebayes [--update]
+#
+# --update records the counters of this build as the new baseline, for when
+# a change is meant to do more work, as does the first run.  the limits can be set in the
+# environment:
+#
+#     REGRESSION_TOLERANCE    how far a counter may grow, as a fraction (0.05)
+#     REGRESSION_CONCORDANCE  the least fraction of records which must agree,
+#                             by site, alleles and genotypes (1)
+#
+# writes one JSON object to stdout, and exits nonzero if the gate fails.
+
+freebayes=${1:-freebayes}
+update=$2
+tolerance=${REGRESSION_TOLERANCE:-0.05}
+concordance=${REGRESSION_CONCORDANCE:-1}
+version=$($freebayes --version | sed -n 's/^version: *//p')
+golden=regression/NA12878.chr22.tiny.vcf
+baseline=regression/NA12878.chr22.tiny.work
+scratch=$(mktemp -d)
+trap 'rm -rf "$scratch"' EXIT
+
+# as test/t/01_call_variants.t writes the golden file; one thread, so that
+# the peak of registered alignments doesn't depend on how regions are split
+if ! $freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam --profile-report "$scratch/profile.json" > "$scratch/out.vcf"; then
+    echo "freebayes failed" >&2
+    exit 1
+fi
+egrep -vi "source|filedate|RPPR=7.64277|11126|10515" "$scratch/out.vcf" > "$scratch/calls.vcf"
+
+# the records agreeing on their site, alleles and genotypes, over all of either
+agreed=$(awk -F'\t' '
+    function key(   k, i) {
+        k = $1 "\t" $2 "\t" $4 "\t" $5
+        for (i = 10; i <= NF; ++i) {
+            k = k "\t" substr($i, 1, index($i ":" , ":") - 1)
+        }
+        return k
+    }
+    /^#/ { next }
+    FNR == NR { golden[key()] = 1; ++goldens; next }
+    { if (key() in golden) ++both; ++calls }
+    END {
+        total = calls + goldens - both
+        printf "%.6f", (total > 0 ? both / total : 1)
+    }' "$golden" "$scratch/calls.vcf")
+
+work=$(grep '"work"' "$scratch/profile.json" | sed 's/.*{\(.*\)}.*/\1/; s/[",]//g; s/: / /g')
+counters=$(echo $work | awk '{ for (i = 1; i < NF; i += 2) print $i, $(i + 1) }')
+
+# the first run records the baseline, which is kept in git with the golden file
+if [ "$update" = "--update" ] || [ ! -s "$baseline" ]; then
+    echo "$counters" > "$baseline"
+    echo "recorded the work counters of $version in $baseline" >&2
+fi
+
+failed=0
+if awk -v a="$agreed" -v c="$concordance" 'BEGIN { exit !(a < c) }'; then
+    echo "concordance with $golden is $agreed, below $concordance" >&2
+    failed=1
+fi
+while read name value; do
+    recorded=$(awk -v n="$name" '$1 == n { print $2 }' "$baseline")
+    if [ -z "$recorded" ]; then
+        echo "$name isn't in $baseline" >&2
+        failed=1
+    elif awk -v v="$value" -v r="$recorded" -v t="$tolerance" 'BEGIN { exit !(v > r * (1 + t)) }'; then
+        echo "$name grew from $recorded to $value, past the tolerance of $tolerance" >&2
+        failed=1
+    fi
+done <<< "$counters"
+
+json=$(echo "$counters" | awk '{ printf ", \"%s\": %s", $1, $2 }')
+echo "{\"benchmark\": \"regression/NA12878.chr22.tiny\", \"version\": \"$version\"," \
+     "\"concordance\": $agreed$json, \"passed\": $( [ $failed -eq 0 ] && echo true || echo false )}"
+
+exit $failed
@@ -10,7 +10,7 @@ root=$(dirname $0)/../..
 PATH=../build:$root/build:$root/../build:$root/bin:$PATH
 PATH=../scripts:$PATH # for freebayes-parallel
 
-plan tests 16
+plan tests 20
 
 is $(echo "$(comm -12 <(cat tiny/NA12878.chr22.tiny.giab.vcf | grep -v "^#" | cut -f 2 | sort) <(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v "^#" | cut -f 2 | sort) | wc -l) >= 13" | bc) 1 "variant calling recovers most of the GiAB variants in a test region"
 
@@ -77,6 +77,13 @@ is $(samtools view tiny/NA12878.chr22.tiny.bam | wc -l) $(freebayes -f tiny/q.fa
 
 is $(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam -d 2>&1 | grep ^alignment: | wc -l) $(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.cram -d 2>&1 | grep ^alignment: | wc -l) "freebayes processes all alignments in CRAM input"
 
+calls=$(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v "^#" | wc -l)
+freebayes -f tiny/q.fa --report-monomorphic tiny/NA12878.chr22.tiny.bam | grep -v "^#" >tiny/q.monomorphic.vcf
+ok [ $(awk '$5 == "."' tiny/q.monomorphic.vcf | wc -l) -gt 0 -a $(awk '$5 != "."' tiny/q.monomorphic.vcf | wc -l) -ge $calls ] "--report-monomorphic adds reference-only records to the calls"
+is $(awk '$5 == "." { split($10, f, ":"); if (f[1] != "0/0") print }' tiny/q.monomorphic.vcf | wc -l) 0 "reference-only records are hom-ref"
+is $(freebayes -f tiny/q.fa --report-monomorphic -p 3 tiny/NA12878.chr22.tiny.bam | grep -v "^#" | awk '$5 == "." { split($10, f, ":"); if (f[1] != "0/0/0") print }' | wc -l) 0 "reference-only records are hom-ref at the ploidy of the sample"
+rm tiny/q.monomorphic.vcf
+
 # Add a regression test
 $(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam 2>&1 |egrep -vi "source|filedate|RPPR=7.64277|11126|10515" > regression/NA12878.chr22.tiny.vcf)
 
@@ -102,6 +109,11 @@ is $(freebayes -f tiny/q.fa -@ tiny/q_spiked.vcf.gz -l --stdin < tiny/NA12878.ch
 
 is $(freebayes -f tiny/q.fa -@ tiny/q_spiked.vcf.gz -r q:1-10000 -l --stdin < tiny/NA12878.chr22.tiny.bam | grep -v "^#" | cut -f1,2 | grep -P "(\t500$|\t1000$)" | wc -l) 2 "freebayes handles region, stdin, and variant input"
 
+indexalleles tiny/q_spiked.vcf.gz tiny/q_spiked.alleles 2>/dev/null
+is "$(freebayes -f tiny/q.fa -@ tiny/q_spiked.alleles -l tiny/NA12878.chr22.tiny.bam | grep -v "^#")" \
+   "$(freebayes -f tiny/q.fa -@ tiny/q_spiked.vcf.gz -l tiny/NA12878.chr22.tiny.bam | grep -v "^#")" "variant input compiled by indexalleles gives the same calls as the VCF"
+rm tiny/q_spiked.alleles
+
 gzip -c tiny/q.fa >tiny/q.fa.gz
 cp tiny/q.fa.fai tiny/q.fa.gz.fai
 freebayes -f tiny/q.fa.gz -@ tiny/q_spiked.vcf.gz -r q:1-10000 -l - < tiny/NA12878.chr22.tiny.bam >/dev/null 2>/dev/null
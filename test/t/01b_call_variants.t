@@ -10,7 +10,7 @@ root=$(dirname $0)/../..
 PATH=../build:$root/build:$root/../build:$root/bin:$PATH
 PATH=../scripts:$PATH # for freebayes-parallel
 
-plan tests 10
+plan tests 75
 
 
 is $(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v "^#" | wc -l) $(freebayes-parallel tiny/q.regions 2 -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v "^#" | wc -l) "running in parallel makes no difference"
@@ -28,12 +28,143 @@ is $(freebayes -f tiny/q.fa -F 0.2 tiny/NA12878.chr22.tiny.bam --gvcf --gvcf-chu
 
 is $(freebayes -f tiny/q.fa -F 0.2 tiny/NA12878.chr22.tiny.bam --gvcf --gvcf-dont-use-chunk true | grep '<\*>' | wc -l) 12250 "freebayes produces the expected number of lines of gVCF output"
 
+# the banded records are the runs of the per-site records, unbroken by a call,
+# whose GQs fall in the same band
+bands=$(freebayes -f tiny/q.fa -F 0.2 tiny/NA12878.chr22.tiny.bam --gvcf --gvcf-dont-use-chunk true | grep -v '^#' | awk -F'\t' '
+    BEGIN { n = split("10,20,30,40,50,60", bounds, ",") }
+    $5 != "<*>" { run = 0; next }
+    { split($10, fields, ":"); band = 0; for (i = 1; i <= n; ++i) if (fields[1] + 0 >= bounds[i]) band = i;
+      if (!run || $1 != chrom || band != last) ++blocks; run = 1; chrom = $1; last = band }
+    END { print blocks }')
+is $(freebayes -f tiny/q.fa -F 0.2 tiny/NA12878.chr22.tiny.bam --gvcf --gvcf-gq-bands 10,20,30,40,50,60 | grep '<\*>' | wc -l) $bands "GQ bands split the gVCF records where the GQ of a site changes band"
+
 samtools view -h tiny/NA12878.chr22.tiny.bam | sed s/NA12878D_HiSeqX_R1.fastq.gz/222.NA12878D_HiSeqX_R1.fastq.gz/ | sed s/SM:1/SM:2/ >tiny/x.sam
 is $(freebayes -f tiny/q.fa -F 0.2 tiny/NA12878.chr22.tiny.bam tiny/x.sam -A <(echo 1 8; echo 2 13) | grep 'AN=21' | wc -l) 19 "the CNV map may be used to specify per-sample copy numbers"
 rm -f tiny/x.sam
 
 is $(freebayes -f tiny/q.fa --skip-coverage 30 tiny/NA12878.chr22.tiny.bam | grep -v '^#' | wc -l) 22 "freebayes makes the expected number of calls when capping coverage"
 
+maxdp=$(freebayes -f tiny/q.fa --limit-coverage 10 tiny/NA12878.chr22.tiny.bam | grep -v '^#' | grep -o 'DP=[0-9]*' | cut -d= -f2 | sort -n | tail -1)
+ok [ ${maxdp:-0} -gt 0 -a ${maxdp:-0} -le 10 ] "reads over --limit-coverage are dropped as they are read" || echo "$maxdp"
+
+is "$(freebayes -f tiny/q.fa --limit-coverage 10 --threads 2 tiny/NA12878.chr22.tiny.bam | grep -v '^#' | md5sum)" "$(freebayes -f tiny/q.fa --limit-coverage 10 tiny/NA12878.chr22.tiny.bam | grep -v '^#' | md5sum)" "--limit-coverage keeps the same reads whatever the threads"
+
+# the reference and alternate observations of each record, by position
+observations() {
+    freebayes -f tiny/q.fa "$@" | grep -v '^#' | awk -F'\t' '{
+        obs = 0; n = split($8, fields, ";");
+        for (i = 1; i <= n; ++i) {
+            if (fields[i] ~ /^(RO|AO)=/) { m = split(substr(fields[i], 4), counts, ","); for (j = 1; j <= m; ++j) obs += counts[j] }
+        }
+        print $2 "\t" obs }' | sort
+}
+merged=$(join <(observations --merge-overlapping-mates tiny/NA12878.chr22.tiny.bam) <(observations tiny/NA12878.chr22.tiny.bam) \
+    | awk '{ m += $2; u += $3 } END { print (NR > 0 && m < u) ? "fewer" : m " of " u }')
+is "$merged" "fewer" "--merge-overlapping-mates counts the overlapping bases of mates once"
+
+is "$(observations --merge-overlapping-mates tiny/NA12878.chr22.tiny.cram | md5sum)" "$(observations --merge-overlapping-mates tiny/NA12878.chr22.tiny.bam | md5sum)" "--merge-overlapping-mates pairs the mates of CRAM input as of BAM"
+
+# a budget the run is always over, so every site is called pressed for memory,
+# but only the records the limits changed are flagged, and the rest are those
+# of a run without them
+freebayes -f tiny/q.fa --max-memory 1 tiny/NA12878.chr22.tiny.bam >tiny/q.memlimit.vcf 2>/dev/null
+freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v '^#' | sort >tiny/q.unlimited.calls
+records=$(grep -v '^#' tiny/q.memlimit.vcf | wc -l)
+well_formed=$(grep -v '^#' tiny/q.memlimit.vcf | awk -F'\t' 'NF == 10' | wc -l)
+described=$(grep -c '^##INFO=<ID=MEMLIMIT' tiny/q.memlimit.vcf)
+unchanged=$(grep -v '^#' tiny/q.memlimit.vcf | awk -F'\t' '$8 !~ /(^|;)MEMLIMIT(;|$)/' | sort | comm -23 - tiny/q.unlimited.calls | wc -l)
+ok [ $records -gt 0 -a $records -eq $well_formed -a $described -eq 1 -a $unchanged -eq 0 ] "--max-memory under pressure flags only the records its limits changed" || echo "$well_formed of $records, $unchanged unflagged records differ"
+rm -f tiny/q.memlimit.vcf tiny/q.unlimited.calls
+
+freebayes -f tiny/q.fa --emit-shards 1000:tiny/q.shards tiny/NA12878.chr22.tiny.bam 2>tiny/q.shards.log
+shards=$(grep -v '^#' tiny/q.shards | cut -f1 | sort -u | wc -l)
+ok grep -q "so the plan has $shards\$" tiny/q.shards.log "--emit-shards warns of a plan of fewer shards than asked for"
+rm -f tiny/q.shards.log
+freebayes -f tiny/q.fa --emit-shards 2:tiny/q.shards tiny/NA12878.chr22.tiny.bam
+shards=$(grep -v '^#' tiny/q.shards | cut -f1 | sort -u | wc -l)
+for i in $(seq 0 $((shards - 1))); do
+    freebayes -f tiny/q.fa --shard tiny/q.shards:$i tiny/NA12878.chr22.tiny.bam >tiny/q.shard$i.vcf
+done
+is "$(freebayes --merge-shards tiny/q.shards $(seq -f 'tiny/q.shard%g.vcf' 0 $((shards - 1))) | grep -v '^#' | md5sum)" "$(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v '^#' | md5sum)" "merged shards give the calls of a single run"
+rm -f tiny/q.shards tiny/q.shard*.vcf
+
+freebayes -f tiny/q.fa -v tiny/q.calls.vcf.gz tiny/NA12878.chr22.tiny.bam
+is "$(tabix tiny/q.calls.vcf.gz q:5000-10000 | md5sum)" "$(zcat tiny/q.calls.vcf.gz | grep -v '^#' | awk '$2 <= 10000 && $2 + length($4) > 5000' | md5sum)" "compressed VCF output is indexed for tabix as it is written"
+freebayes -f tiny/q.fa --output-format bcf -v tiny/q.calls.bcf tiny/NA12878.chr22.tiny.bam
+is "$(bcftools view -H -r q:5000-10000 tiny/q.calls.bcf | md5sum)" "$(bcftools view -H tiny/q.calls.bcf | awk '$2 <= 10000 && $2 + length($4) > 5000' | md5sum)" "BCF output is indexed as it is written"
+fields='%CHROM\t%POS\t%REF\t%ALT\t%INFO/NS\t%INFO/DP\t%INFO/RO\t%INFO/AO\t%INFO/SRF\t%INFO/SAF[\t%GT\t%DP\t%AD\t%QR\t%QA]\n'
+is "$(bcftools query -f "$fields" tiny/q.calls.bcf | md5sum)" "$(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | bcftools query -f "$fields" - | md5sum)" "BCF output reads back as the VCF text output"
+rm -f tiny/q.calls.vcf.gz* tiny/q.calls.bcf*
+
+# a run stopped after its header, part way into its first region, is resumed
+# from a checkpoint of the header alone
+rm -rf tiny/q.ckpt
+freebayes -f tiny/q.fa --checkpoint tiny/q.ckpt --checkpoint-interval 0 -v tiny/q.ckpt.vcf tiny/NA12878.chr22.tiny.bam
+full=$(md5sum < tiny/q.ckpt.vcf)
+sed -i "s/^written .*/written 0/; s/^offset .*/offset $(grep '^#' tiny/q.ckpt.vcf | wc -c)/" tiny/q.ckpt/checkpoint
+grep -v '^#' tiny/q.ckpt.vcf | head -3 > tiny/q.ckpt.partial
+sed -i '/^[^#]/d' tiny/q.ckpt.vcf
+cat tiny/q.ckpt.partial >> tiny/q.ckpt.vcf
+freebayes -f tiny/q.fa --checkpoint tiny/q.ckpt --checkpoint-interval 0 -v tiny/q.ckpt.vcf tiny/NA12878.chr22.tiny.bam --resume
+is "$(md5sum < tiny/q.ckpt.vcf)" "$full" "a resumed run gives the output of one which wasn't stopped"
+sed -i "s/^regions .*/regions 1000/" tiny/q.ckpt/checkpoint
+freebayes -f tiny/q.fa --checkpoint tiny/q.ckpt --checkpoint-interval 0 -v tiny/q.ckpt.vcf tiny/NA12878.chr22.tiny.bam --resume 2>/dev/null
+is "$(md5sum < tiny/q.ckpt.vcf)" "$full" "resuming from the checkpoint of another run leaves the output as it was"
+rm -rf tiny/q.ckpt tiny/q.ckpt.vcf tiny/q.ckpt.partial
+
+# sends a request to the server on the socket, printing its answer
+request() {
+    python3 -c '
+import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+s.sendall((sys.argv[2] + "\n").encode())
+while True:
+    data = s.recv(65536)
+    if not data:
+        break
+    sys.stdout.write(data.decode())
+' "$1" "$2"
+}
+rm -f tiny/q.sock
+freebayes -f tiny/q.fa --threads 2 --serve tiny/q.sock tiny/NA12878.chr22.tiny.bam 2>tiny/q.serve.log &
+server=$!
+for i in $(seq 100); do [ -S tiny/q.sock ] && break; sleep 0.1; done
+# a client which connects and sends nothing
+python3 -c 'import socket, sys, time; s = socket.socket(socket.AF_UNIX); s.connect(sys.argv[1]); time.sleep(30)' tiny/q.sock &
+idle=$!
+sleep 0.5
+is "$(timeout 20 bash -c "$(declare -f request); request tiny/q.sock q:1-10000" | grep -v '^#' | md5sum)" "$(freebayes -f tiny/q.fa -r q:1-10000 tiny/NA12878.chr22.tiny.bam | grep -v '^#' | md5sum)" "--serve answers the next client once a stalled one times out"
+kill $idle $server 2>/dev/null
+wait $idle $server 2>/dev/null
+ok grep -q "on a single thread, ignoring --threads" tiny/q.serve.log "a calling session warns that it ignores --threads"
+rm -f tiny/q.serve.log
+echo "not a socket" > tiny/q.notsock
+freebayes -f tiny/q.fa --serve tiny/q.notsock tiny/NA12878.chr22.tiny.bam 2>/dev/null
+is $? 1 "--serve won't start over a file which isn't a socket"
+is "$(cat tiny/q.notsock)" "not a socket" "--serve leaves a file which isn't a socket as it was"
+rm -f tiny/q.sock tiny/q.notsock
+
+calls=$(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v '^#' | md5sum)
+is "$(freebayes -f tiny/q.fa --genotyping-tolerance 0 tiny/NA12878.chr22.tiny.bam | grep -v '^#' | md5sum)" "$calls" "--genotyping-tolerance 0 gives the calls of the default search"
+is "$(freebayes -f tiny/q.fa --genotyping-tolerance 1e-300 tiny/NA12878.chr22.tiny.bam | grep -v '^#' | md5sum)" "$calls" "a vanishing --genotyping-tolerance gives the calls of the default search"
+
+freebayes -f tiny/q.fa --likelihood-dump tiny/q.gld tiny/NA12878.chr22.tiny.bam >tiny/q.dumped.vcf
+is "$(grep -v '^#' tiny/q.dumped.vcf | md5sum)" "$calls" "--likelihood-dump leaves the calls as they are"
+is "$(freebayes -f tiny/q.fa --joint-likelihoods tiny/q.gld | grep -v '^#' | awk '{ split($10, f, ":"); print $1, $2, $4, $5, f[1] }' | md5sum)" \
+   "$(grep -v '^#' tiny/q.dumped.vcf | awk '{ split($10, f, ":"); print $1, $2, $4, $5, f[1] }' | md5sum)" "--joint-likelihoods of a single dump calls its sites and genotypes again"
+rm -f tiny/q.gld* tiny/q.dumped.vcf
+
+printf "tiny/NA12878.chr22.tiny.bam\ttiny/q.fa\ttiny/q.batch0.vcf\ntiny/NA12878.chr22.tiny.bam\ttiny/q.fa\ttiny/q.batch1.vcf\n" >tiny/q.batch
+freebayes --batch tiny/q.batch --threads 2
+is "$(grep -v '^#' tiny/q.batch0.vcf | md5sum) $(grep -v '^#' tiny/q.batch1.vcf | md5sum)" "$(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v '^#' | md5sum) $(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v '^#' | md5sum)" "each job of a batch gives the calls of a run of its own"
+rm -f tiny/q.batch tiny/q.batch*.vcf
+printf "tiny/missing.bam\ttiny/q.fa\ttiny/q.batch0.vcf\ntiny/NA12878.chr22.tiny.bam\ttiny/q.fa\ttiny/q.batch1.vcf\n" >tiny/q.batch
+freebayes --batch tiny/q.batch 2>/dev/null
+is $? 1 "a batch with a job which fails exits with an error"
+is "$(grep -v '^#' tiny/q.batch1.vcf | md5sum)" "$(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v '^#' | md5sum)" "the jobs of a batch after one which fails are still called"
+rm -f tiny/q.batch tiny/q.batch*.vcf
+
 # is $(freebayes -f tiny/q.fa -g 30 tiny/NA12878.chr22.tiny.bam | vcf2tsv | cut -f 8 | tail -n+2 | awk '$1 <= 30 { print }' | wc -l) 22 "all coverage capped calls are below the coverage threshold"
 
 > cnv-map.bed
@@ -44,3 +175,191 @@ is $(freebayes -f tiny/q.fa -F 0.2 tiny/NA12878.chr22.tiny.bam -A cnv-map.bed |
     awk 'BEGIN{errors = 0} {cn = int($1 / 2000) + 2; obs = gsub(/\/|\|/, "", $2) + 1; if (cn != obs) errors += 1 } END {OFS=":"; print errors,NR}') "0:19" \
     "freebayes correctly uses CNV map with multiple entries"
 rm cnv-map.bed
+
+# each sample has an LGL for every genotype of the reference and its LAA
+freebayes -f tiny/q.fa --local-alleles tiny/NA12878.chr22.tiny.bam | grep -v '^#' >tiny/q.local.vcf
+local=$(awk -F'\t' '$9 ~ /LAA/' tiny/q.local.vcf | wc -l)
+short=$(awk -F'\t' '$9 ~ /LGL/ {
+    split($9, keys, ":"); split($10, values, ":")
+    for (k in keys) field[keys[k]] = values[k]
+    n = 1 + (field["LAA"] == "." ? 0 : split(field["LAA"], laa, ","))
+    if (split(field["LGL"], lgl, ",") != n * (n + 1) / 2) print
+}' tiny/q.local.vcf | wc -l)
+ok [ $local -gt 0 -a $short -eq 0 ] "--local-alleles gives an LGL for every local genotype" || echo "$short of $local"
+rm -f tiny/q.local.vcf
+
+# with no threshold, every site a record is made at is in the slow site log
+freebayes -f tiny/q.fa --slow-site-log tiny/q.slow.bed --slow-site-time 0 tiny/NA12878.chr22.tiny.bam | grep -v '^#' | cut -f1,2 >tiny/q.slow.sites
+is "$(comm -23 <(sort -u tiny/q.slow.sites) <(awk -F'\t' '!/^#/ { print $1 "\t" $2 + 1 }' tiny/q.slow.bed | sort -u) | wc -l)" 0 "--slow-site-log logs the sites of the records"
+rm -f tiny/q.slow.bed tiny/q.slow.sites
+is "$(freebayes -f tiny/q.fa --max-site-time 1000 tiny/NA12878.chr22.tiny.bam | grep -v '^#' | md5sum)" "$(freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v '^#' | md5sum)" "--max-site-time which isn't reached leaves the calls as they are, without APPROX"
+ok [ $(freebayes -f tiny/q.fa --max-site-time 0.000000001 tiny/NA12878.chr22.tiny.bam | grep -v '^#' | grep -c 'APPROX') -gt 0 ] "--max-site-time which is spent before the search flags the records APPROX"
+
+# with --use-best-n-indels, at most that many indel, MNP and complex alleles
+# are kept at a site, besides the SNPs -n keeps
+freebayes -f tiny/q.fa -n 2 --use-best-n-indels 1 tiny/NA12878.chr22.tiny.bam | grep -v '^#' > tiny/q.bestindels.calls
+over=$(awk -F'\t' '{ match($8, /(^|;)TYPE=[^;]*/); n = split(substr($8, RSTART, RLENGTH), t, ","); snps = 0; others = 0; for (i = 1; i <= n; ++i) { if (t[i] ~ /snp$/) ++snps; else ++others } if (snps > 2 || others > 1) print }' tiny/q.bestindels.calls | wc -l)
+indels=$(awk -F'\t' '$8 ~ /(^|;)TYPE=([^;]*,)?(ins|del|mnp|complex)/' tiny/q.bestindels.calls | wc -l)
+ok [ $over -eq 0 -a $indels -gt 0 ] "--use-best-n-indels keeps no more than N indel alleles at a site, apart from the SNPs" || echo "$over records over the limits, $indels records with indels"
+rm -f tiny/q.bestindels.calls
+
+# --gl-margin keeps the GLs within the margin of each sample's best, and gives
+# those it leaves out the floor, which is above their own
+freebayes -f tiny/q.fa tiny/NA12878.chr22.tiny.bam | grep -v '^#' >tiny/q.glall.calls
+freebayes -f tiny/q.fa --gl-margin 2 tiny/NA12878.chr22.tiny.bam | grep -v '^#' >tiny/q.glmargin.calls
+is "$(python3 -c '
+import sys
+def gls(path):
+    records = {}
+    for line in open(path):
+        f = line.rstrip("\n").split("\t")
+        keys = f[8].split(":")
+        if "GL" in keys:
+            records[(f[0], f[1], f[4])] = [g.split(":")[keys.index("GL")] for g in f[9:]]
+    return records
+full, margin = gls(sys.argv[1]), gls(sys.argv[2])
+bad = 0
+for site in set(full) & set(margin):
+    for a, b in zip(full[site], margin[site]):
+        if a == "." or b == ".":
+            continue
+        for x, y in zip(map(float, a.split(",")), map(float, b.split(","))):
+            if x >= -2 + 1e-6 and abs(x - y) > 1e-3:
+                bad += 1
+            elif x < -2 - 1e-6 and abs(x - y) > 1e-3 and abs(y + 2) > 1e-6:
+                bad += 1
+print(bad)
+' tiny/q.glall.calls tiny/q.glmargin.calls)" 0 "--gl-margin keeps the likely GLs and reports those it leaves out at its floor"
+rm -f tiny/q.glall.calls tiny/q.glmargin.calls
+
+# the p(var) bound only passes over sites the search wouldn't report: the
+# records of -P 0.9 are those of -P 0 with a QUAL of 10 or more, away from the
+# edge, where they round
+for opts in "" "--genotype-variant-threshold 4" "--max-combos 8"; do
+    freebayes -f tiny/q.fa -P 0 $opts tiny/NA12878.chr22.tiny.bam | grep -v '^#' >tiny/q.pvar0.calls
+    freebayes -f tiny/q.fa -P 0.9 $opts --profile-report tiny/q.pvar.json tiny/NA12878.chr22.tiny.bam | grep -v '^#' >tiny/q.pvar.calls
+    pruned=$(grep -o '"pruned_sites": [0-9]*' tiny/q.pvar.json | cut -d' ' -f2)
+    missing=$(awk -F'\t' '$5 != "." && $6 > 10.01' tiny/q.pvar0.calls | sort | comm -23 - <(sort tiny/q.pvar.calls) | wc -l)
+    extra=$(sort tiny/q.pvar.calls | comm -23 - <(awk -F'\t' '$6 >= 9.99' tiny/q.pvar0.calls | sort) | wc -l)
+    ok [ "$pruned" -gt 0 -a $missing -eq 0 -a $extra -eq 0 ] "the p(var) bound prunes only sites below --pvar${opts:+ with $opts}" || echo "$pruned pruned, $missing missing, $extra extra"
+done
+rm -f tiny/q.pvar0.calls tiny/q.pvar.calls tiny/q.pvar.json
+
+# the records of a run, without its header
+calls() {
+    freebayes "$@" | grep -v '^#' | md5sum
+}
+single=$(calls -f tiny/q.fa tiny/NA12878.chr22.tiny.bam)
+printf "q\t100\t3000\nq\t6000\t9000\n" > tiny/q.threads.bed
+is "$(calls -f tiny/q.fa --threads 3 tiny/NA12878.chr22.tiny.bam)" "$single" "--threads gives the calls of a single thread"
+is "$(calls -f tiny/q.fa --threads 3 --auto-regions 5 tiny/NA12878.chr22.tiny.bam)" "$single" "--auto-regions gives the calls of a single thread"
+is "$(calls -f tiny/q.fa --threads 2 --auto-regions 4 -t tiny/q.threads.bed tiny/NA12878.chr22.tiny.bam)" "$(calls -f tiny/q.fa -t tiny/q.threads.bed tiny/NA12878.chr22.tiny.bam)" "--auto-regions over targets gives the calls of a single thread"
+rm -f tiny/q.threads.bed
+
+is "$(calls -f tiny/q.fa --decompress-threads 2 tiny/NA12878.chr22.tiny.bam)" "$single" "--decompress-threads gives the same calls"
+is "$(calls -f tiny/q.fa --decompress-threads 2 tiny/NA12878.chr22.tiny.cram)" "$(calls -f tiny/q.fa tiny/NA12878.chr22.tiny.cram)" "--decompress-threads gives the same calls from CRAM"
+
+is "$(calls -f tiny/q.fa --prefetch-alignments 4 tiny/NA12878.chr22.tiny.bam)" "$single" "--prefetch-alignments gives the same calls"
+is "$(calls -f tiny/q.fa --prefetch-alignments 1 -r q:2000-9000 tiny/NA12878.chr22.tiny.bam)" "$(calls -f tiny/q.fa -r q:2000-9000 tiny/NA12878.chr22.tiny.bam)" "--prefetch-alignments gives the same calls over a region"
+
+# --profile-report writes JSON whose counts are those of the run, however it
+# is threaded
+freebayes -f tiny/q.fa --profile-report tiny/q.profile.json tiny/NA12878.chr22.tiny.bam | grep -v '^#' >tiny/q.profile.calls
+freebayes -f tiny/q.fa --threads 2 --profile-report tiny/q.profile2.json tiny/NA12878.chr22.tiny.bam >/dev/null
+profiled() {
+    python3 -c 'import json, sys; p = json.load(open(sys.argv[1])); print(p["sites"]["processed_sites"], p["stages"]["Results::vcf"]["calls"], p["stages"]["convergentGenotypeComboSearch"]["calls"] > 0)' "$1"
+}
+is "$(md5sum < tiny/q.profile.calls)" "$single" "--profile-report leaves the calls as they were"
+is "$(profiled tiny/q.profile.json | cut -d' ' -f2)" "$(wc -l < tiny/q.profile.calls)" "--profile-report counts a Results::vcf call for each record"
+is "$(profiled tiny/q.profile2.json)" "$(profiled tiny/q.profile.json)" "--profile-report counts the same sites and stages with --threads"
+rm -f tiny/q.profile.json tiny/q.profile2.json tiny/q.profile.calls
+
+# --progress ends with a report of the whole run, and --progress-file holds
+# the same metrics for a collector to read
+freebayes -f tiny/q.fa --progress 1 --progress-file tiny/q.progress.prom tiny/NA12878.chr22.tiny.bam 2>tiny/q.progress.log >/dev/null
+ok grep -q "^progress(freebayes): .*done after" tiny/q.progress.log "--progress reports when the run is done"
+is "$(awk '$1 == "freebayes_target_bases" { print $2 }' tiny/q.progress.prom)" "$(cut -f2 tiny/q.fa.fai | paste -sd+ | bc)" "--progress-file gives the bases of the targets"
+ok [ "$(awk '$1 == "freebayes_sites_total" { print $2 }' tiny/q.progress.prom)" -gt 0 ] "--progress-file counts the sites visited"
+rm -f tiny/q.progress.prom tiny/q.progress.log
+
+# with --pool-frequency-grid, the genotypes of a pool of 20 have allele counts
+# on the grid, and no GLs
+freebayes -f tiny/q.fa --ploidy 20 -J --pool-frequency-grid 4 tiny/NA12878.chr22.tiny.bam | grep -v '^#' >tiny/q.grid.calls
+offgrid=$(awk -F'\t' '{ split($10, f, ":"); n = split(f[1], a, "/"); delete c; for (i = 1; i <= n; ++i) ++c[a[i]]; for (k in c) if (c[k] % 5) { print; break } }' tiny/q.grid.calls | wc -l)
+ok [ $(wc -l < tiny/q.grid.calls) -gt 0 -a $offgrid -eq 0 ] "--pool-frequency-grid keeps the genotypes of a pool on the grid" || echo "$offgrid records off the grid"
+is "$(cut -f9 tiny/q.grid.calls | grep -c '\(^\|:\)GL\(:\|$\)')" 0 "--pool-frequency-grid leaves out the GLs"
+rm -f tiny/q.grid.calls
+
+# files opened several at a time, or from the headers of --header-cache, give
+# the calls of files opened one at a time
+cp tiny/NA12878.chr22.tiny.bam tiny/q.copy.bam
+cp tiny/NA12878.chr22.tiny.bam.bai tiny/q.copy.bam.bai
+both=$(calls -f tiny/q.fa --open-threads 1 tiny/NA12878.chr22.tiny.bam tiny/q.copy.bam)
+is "$(calls -f tiny/q.fa --open-threads 4 tiny/NA12878.chr22.tiny.bam tiny/q.copy.bam)" "$both" "--open-threads gives the same calls"
+rm -f tiny/q.headers
+is "$(calls -f tiny/q.fa --header-cache tiny/q.headers tiny/NA12878.chr22.tiny.bam tiny/q.copy.bam)" "$both" "--header-cache gives the same calls as it fills the cache"
+ok [ -s tiny/q.headers ] "--header-cache writes the headers of the files"
+is "$(calls -f tiny/q.fa --header-cache tiny/q.headers tiny/NA12878.chr22.tiny.bam tiny/q.copy.bam)" "$both" "--header-cache gives the same calls from the cached headers"
+rm -f tiny/q.headers tiny/q.copy.bam tiny/q.copy.bam.bai
+
+# --numa places the threads, where there are nodes to place them on, without
+# changing what they call
+is "$(calls -f tiny/q.fa --threads 2 --numa tiny/NA12878.chr22.tiny.bam 2>/dev/null)" "$single" "--numa gives the calls of a single thread"
+
+# --trace writes a JSON object per sample and site genotyped, over the sites
+# of --trace-region, which take in those of the records there
+freebayes -f tiny/q.fa --trace tiny/q.trace.json --trace-region q:2000-4000 -r q:1-6000 tiny/NA12878.chr22.tiny.bam | grep -v '^#' >tiny/q.trace.calls
+is "$(python3 -c '
+import json, sys
+positions = set()
+for line in open(sys.argv[1]):
+    record = json.loads(line)
+    assert record["seq"] == "q" and 1998 <= record["pos"] <= 4000 and record["likelihoods"]
+    positions.add(record["pos"])
+records = set(int(line.split("\t")[1]) - 1 for line in open(sys.argv[2]))
+print(len(positions) > 0, sorted(p for p in records if 2000 <= p <= 3998 and p not in positions))
+' tiny/q.trace.json tiny/q.trace.calls)" "True []" "--trace writes the sites of the records in --trace-region, and no others"
+rm -f tiny/q.trace.json tiny/q.trace.calls
+
+is "$(calls -f tiny/q.fa --emit-queue 16 tiny/NA12878.chr22.tiny.bam)" "$single" "--emit-queue gives the same records"
+is "$(calls -f tiny/q.fa --emit-queue 1 --gvcf -r q:1-5000 tiny/NA12878.chr22.tiny.bam)" "$(calls -f tiny/q.fa --gvcf -r q:1-5000 tiny/NA12878.chr22.tiny.bam)" "--emit-queue gives the same gVCF records"
+
+# the cpu engine scores the samples alike on the calling thread and the team
+is "$(calls -f tiny/q.fa --likelihood-engine cpu tiny/NA12878.chr22.tiny.bam)" "$single" "--likelihood-engine cpu gives the same calls"
+is "$(calls -f tiny/q.fa --likelihood-engine cpu --genotyping-threads 3 tiny/NA12878.chr22.tiny.bam)" "$single" "the cpu engine gives the same calls scoring on a team"
+freebayes -f tiny/q.fa --likelihood-engine nonesuch tiny/NA12878.chr22.tiny.bam >/dev/null 2>tiny/q.engine.log
+is $? 1 "--likelihood-engine rejects an engine this build hasn't"
+ok grep -q "there is no likelihood engine nonesuch in this build, which has: .*cpu" tiny/q.engine.log "--likelihood-engine names the engines it has"
+rm -f tiny/q.engine.log
+
+# alignments read over HTTP give the calls of the local file, in a build which
+# reads remote inputs
+python3 -u -m http.server 0 --bind 127.0.0.1 --directory tiny >tiny/q.http.log 2>&1 &
+http=$!
+for i in $(seq 100); do grep -q "port [0-9]" tiny/q.http.log && break; sleep 0.1; done
+port=$(grep -o "port [0-9]*" tiny/q.http.log | head -1 | cut -d' ' -f2)
+remote=$(calls -f tiny/q.fa --remote-read-ahead 65536 http://127.0.0.1:$port/NA12878.chr22.tiny.bam 2>tiny/q.remote.log)
+if grep -q "Could not open input BAM file" tiny/q.remote.log; then
+    ok true "remote inputs (not tested: this build doesn't read them)"
+else
+    is "$remote" "$single" "alignments read over HTTP give the calls of the local file"
+fi
+kill $http 2>/dev/null
+wait $http 2>/dev/null
+rm -f tiny/q.http.log tiny/q.remote.log
+
+# a tight --max-haplotype-cost flags the haplotypes it held back HCAP, and one
+# no haplotype reaches leaves the calls as they were
+freebayes -f tiny/q.fa --max-haplotype-cost 2 tiny/NA12878.chr22.tiny.bam >tiny/q.hcap.vcf
+capped=$(grep -v '^#' tiny/q.hcap.vcf | awk -F'\t' 'NF == 10 && $8 ~ /(^|;)HCAP(;|$)/' | wc -l)
+ok [ $capped -gt 0 -a $(grep -c '^##INFO=<ID=HCAP' tiny/q.hcap.vcf) -eq 1 ] "--max-haplotype-cost flags the records it held back HCAP"
+is "$(calls -f tiny/q.fa --max-haplotype-cost 1000000000 tiny/NA12878.chr22.tiny.bam)" "$single" "--max-haplotype-cost above every haplotype gives the same calls"
+rm -f tiny/q.hcap.vcf
+
+# reading --stdin with targets, the reads far from them are dropped as they
+# stream in, and the calls are those of the indexed file
+printf "q\t500\t2500\nq\t7000\t9500\n" > tiny/q.stdin.bed
+targeted=$(calls -f tiny/q.fa -t tiny/q.stdin.bed tiny/NA12878.chr22.tiny.bam)
+is "$(samtools view -u tiny/NA12878.chr22.tiny.bam | calls -f tiny/q.fa --stdin -t tiny/q.stdin.bed)" "$targeted" "--stdin with targets gives the calls of the indexed file"
+is "$(samtools view -u tiny/NA12878.chr22.tiny.bam | calls -f tiny/q.fa --stdin --prefetch-alignments 1 -t tiny/q.stdin.bed)" "$targeted" "--stdin with targets gives the same calls prefetching one batch at a time"
+rm -f tiny/q.stdin.bed